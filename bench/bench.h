@@ -0,0 +1,52 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_BENCH_H_
+#define NCCL_BENCH_H_
+
+#include "nccl.h"
+#include <cuda_runtime.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCHCHECK(cmd) do {                               \
+  ncclResult_t res_ = (cmd);                               \
+  if (res_ != ncclSuccess) {                               \
+    fprintf(stderr, "%s:%d '%s' failed: %s\n",             \
+        __FILE__, __LINE__, #cmd, ncclGetErrorString(res_)); \
+    exit(EXIT_FAILURE);                                    \
+  }                                                        \
+} while (0)
+
+#define BENCHCUDACHECK(cmd) do {                           \
+  cudaError_t err_ = (cmd);                                \
+  if (err_ != cudaSuccess) {                               \
+    fprintf(stderr, "%s:%d '%s' failed: %s\n",             \
+        __FILE__, __LINE__, #cmd, cudaGetErrorString(err_)); \
+    exit(EXIT_FAILURE);                                    \
+  }                                                        \
+} while (0)
+
+static inline double benchNow() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Integer knob from the environment, so that runs can be scripted without
+// growing a command line parser in every harness.
+static inline long benchParam(const char* name, long deflt) {
+  const char* str = getenv(name);
+  return str ? strtol(str, NULL, 0) : deflt;
+}
+
+// Harnesses pin transport or protocol choices through NCCL's own
+// environment variables; an explicit user setting always wins.
+static inline void benchDefaultEnv(const char* name, const char* value) {
+  setenv(name, value, 0);
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Predicted vs. measured times of the tuning model.
+//
+// Creates a single-process communicator on every visible GPU and, for each
+// collective and size, forces every algorithm/protocol the communicator can
+// run (as NCCL_CALIBRATE does) on every channel budget, times it and
+// compares it to what ncclTopoGetAlgoTime predicts from the model built by
+// ncclTopoTuneModel. Prints one JSON document with every measurement, the
+// error of each (algorithm, protocol) over the sweep, and per size the
+// choice of the model against the fastest measured one, so systematic
+// mis-tuning can be spotted and corrected with a tuner plugin.
+//
+// BENCH_ITERS, BENCH_WARMUP, BENCH_MIN_BYTES, BENCH_MAX_BYTES (sizes go by
+// factors of 4) and BENCH_CHANNELS (also time 1, 2, 4, ... channels,
+// through ncclGroupSetMaxCTAs) tune the run.
+
+#include "bench.h"
+#include "comm.h"
+#include "enqueue.h"
+#include "graph.h"
+#include "info.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+static const ncclFunc_t colls[] = { ncclFuncBroadcast, ncclFuncReduce, ncclFuncAllGather, ncclFuncReduceScatter, ncclFuncAllReduce };
+
+struct benchComms {
+  int n;
+  ncclComm_t* comms;
+  cudaStream_t* streams;
+  void** bufs;
+};
+
+struct result {
+  ncclFunc_t coll;
+  size_t bytes;
+  int algo, proto, nChannels;
+  double measured, predicted; // us
+};
+
+static void runOp(struct benchComms* c, ncclFunc_t coll, size_t count, int maxCTAs) {
+  BENCHCHECK(ncclGroupStart());
+  if (maxCTAs) BENCHCHECK(ncclGroupSetMaxCTAs(maxCTAs));
+  for (int i = 0; i < c->n; i++) {
+    float* buf = (float*)c->bufs[i];
+    switch (coll) {
+    case ncclFuncBroadcast:
+      BENCHCHECK(ncclBroadcast(buf, buf, count, ncclFloat, 0, c->comms[i], c->streams[i])); break;
+    case ncclFuncReduce:
+      BENCHCHECK(ncclReduce(buf, buf, count, ncclFloat, ncclSum, 0, c->comms[i], c->streams[i])); break;
+    case ncclFuncAllGather:
+      BENCHCHECK(ncclAllGather(buf+i*count, buf, count, ncclFloat, c->comms[i], c->streams[i])); break;
+    case ncclFuncReduceScatter:
+      BENCHCHECK(ncclReduceScatter(buf, buf+i*count, count, ncclFloat, ncclSum, c->comms[i], c->streams[i])); break;
+    default:
+      BENCHCHECK(ncclAllReduce(buf, buf, count, ncclFloat, ncclSum, c->comms[i], c->streams[i])); break;
+    }
+  }
+  BENCHCHECK(ncclGroupEnd());
+}
+
+static double timeOp(struct benchComms* c, ncclFunc_t coll, size_t count, int maxCTAs, int warmup, int iters) {
+  for (int w = 0; w < warmup; w++) runOp(c, coll, count, maxCTAs);
+  for (int i = 0; i < c->n; i++) BENCHCUDACHECK(cudaStreamSynchronize(c->streams[i]));
+  double start = benchNow();
+  for (int it = 0; it < iters; it++) runOp(c, coll, count, maxCTAs);
+  for (int i = 0; i < c->n; i++) BENCHCUDACHECK(cudaStreamSynchronize(c->streams[i]));
+  return (benchNow() - start) / iters * 1e6;
+}
+
+static void forceAlgo(struct benchComms* c, int algo, int proto) {
+  for (int i = 0; i < c->n; i++) {
+    c->comms[i]->forceAlgorithm = algo;
+    c->comms[i]->forceProtocol = proto;
+  }
+}
+
+// Model time of the operation, -1 if the communicator can't run it with this
+// algorithm and protocol. All ranks share the same model, rank 0 stands for them.
+static double predict(ncclComm_t comm, ncclFunc_t coll, size_t count, int algo, int proto, int maxCTAs) {
+  struct ncclInfo info;
+  memset(&info, 0, sizeof(info));
+  info.comm = comm;
+  info.coll = coll;
+  info.count = count;
+  info.datatype = ncclFloat;
+  info.op = ncclSum;
+  info.opFull.op = ncclDevSum;
+  BENCHCHECK(ncclInfoSetDerived(&info, comm->nRanks));
+  if (!ncclAlgoAvailable(&info, algo)) return -1;
+  float time;
+  comm->tasks.maxCTAs = maxCTAs;
+  BENCHCHECK(ncclTopoGetAlgoTime(&info, algo, proto, 1, &time, NULL));
+  comm->tasks.maxCTAs = 0;
+  return time;
+}
+
+int main(int argc, char* argv[]) {
+  int iters = benchParam("BENCH_ITERS", 20);
+  int warmup = benchParam("BENCH_WARMUP", 5);
+  size_t minBytes = benchParam("BENCH_MIN_BYTES", 1024);
+  size_t maxBytes = benchParam("BENCH_MAX_BYTES", 256 << 20);
+  int sweepChannels = benchParam("BENCH_CHANNELS", 0);
+
+  struct benchComms c;
+  BENCHCUDACHECK(cudaGetDeviceCount(&c.n));
+  if (c.n < 2) {
+    fprintf(stderr, "costmodel: needs at least 2 GPUs, found %d\n", c.n);
+    return EXIT_FAILURE;
+  }
+  c.comms = (ncclComm_t*)calloc(c.n, sizeof(ncclComm_t));
+  c.streams = (cudaStream_t*)calloc(c.n, sizeof(cudaStream_t));
+  c.bufs = (void**)calloc(c.n, sizeof(void*));
+  for (int i = 0; i < c.n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaStreamCreateWithFlags(c.streams+i, cudaStreamNonBlocking));
+    BENCHCUDACHECK(cudaMalloc(c.bufs+i, maxBytes));
+    BENCHCUDACHECK(cudaMemset(c.bufs[i], 0, maxBytes));
+  }
+  BENCHCHECK(ncclCommInitAll(c.comms, c.n, NULL));
+  ncclComm_t comm0 = c.comms[0];
+
+  // Channel budgets: 0 is the default (no limit)
+  std::vector<int> budgets = { 0 };
+  for (int nc = 1; sweepChannels && nc < comm0->nChannels; nc *= 2) budgets.push_back(nc);
+
+  std::vector<struct result> results;
+  for (ncclFunc_t coll : colls) {
+    for (size_t bytes = minBytes; bytes <= maxBytes; bytes *= 4) {
+      // Per rank count for AllGather and ReduceScatter, the buffer holds all ranks' parts
+      size_t count = bytes/sizeof(float);
+      if (coll == ncclFuncAllGather || coll == ncclFuncReduceScatter) count /= c.n;
+      if (count == 0) continue;
+      for (int a = 0; a < NCCL_NUM_ALGORITHMS; a++) {
+        for (int p = 0; p < NCCL_NUM_PROTOCOLS; p++) {
+          for (int nc : budgets) {
+            double predicted = predict(comm0, coll, count, a, p, nc);
+            if (predicted <= 0) continue;
+            forceAlgo(&c, a, p);
+            double measured = timeOp(&c, coll, count, nc, warmup, iters);
+            results.push_back({ coll, bytes, a, p, nc, measured, predicted });
+          }
+        }
+      }
+    }
+  }
+  forceAlgo(&c, NCCL_ALGO_UNDEF, NCCL_PROTO_UNDEF);
+
+  printf("{\n  \"nRanks\": %d, \"nNodes\": %d, \"nChannels\": %d, \"iters\": %d,\n", comm0->nRanks, comm0->nNodes, comm0->nChannels, iters);
+  printf("  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    struct result* r = &results[i];
+    printf("    { \"coll\": \"%s\", \"bytes\": %zu, \"algo\": \"%s\", \"proto\": \"%s\", \"nChannels\": %d, \"measuredUs\": %.2f, \"predictedUs\": %.2f, \"error\": %.3f }%s\n",
+        ncclFuncStr[r->coll], r->bytes, ncclAlgoStr[r->algo], ncclProtoStr[r->proto], r->nChannels,
+        r->measured, r->predicted, r->predicted/r->measured - 1, i+1 < results.size() ? "," : "");
+  }
+
+  // Geometric mean of predicted/measured per (coll, algo, proto): above 1 the
+  // model is pessimistic, below 1 optimistic. Spread is the worst ratio to it.
+  printf("  ],\n  \"models\": [\n");
+  bool first = true;
+  for (ncclFunc_t coll : colls) {
+    for (int a = 0; a < NCCL_NUM_ALGORITHMS; a++) {
+      for (int p = 0; p < NCCL_NUM_PROTOCOLS; p++) {
+        double sumLog = 0;
+        int n = 0;
+        for (struct result& r : results) {
+          if (r.coll != coll || r.algo != a || r.proto != p) continue;
+          sumLog += log(r.predicted/r.measured);
+          n++;
+        }
+        if (n == 0) continue;
+        double mean = sumLog/n, spread = 0;
+        for (struct result& r : results) {
+          if (r.coll == coll && r.algo == a && r.proto == p) spread = std::max(spread, fabs(log(r.predicted/r.measured) - mean));
+        }
+        printf("%s    { \"coll\": \"%s\", \"algo\": \"%s\", \"proto\": \"%s\", \"samples\": %d, \"ratio\": %.3f, \"spread\": %.3f }",
+            first ? "" : ",\n", ncclFuncStr[coll], ncclAlgoStr[a], ncclProtoStr[p], n, exp(mean), exp(spread));
+        first = false;
+      }
+    }
+  }
+
+  // Per size, with the default channels: what the model picks and what was fastest
+  printf("\n  ],\n  \"choices\": [\n");
+  first = true;
+  for (ncclFunc_t coll : colls) {
+    for (size_t bytes = minBytes; bytes <= maxBytes; bytes *= 4) {
+      struct result *model = NULL, *best = NULL;
+      for (struct result& r : results) {
+        if (r.coll != coll || r.bytes != bytes || r.nChannels != 0) continue;
+        if (model == NULL || r.predicted < model->predicted) model = &r;
+        if (best == NULL || r.measured < best->measured) best = &r;
+      }
+      if (model == NULL) continue;
+      printf("%s    { \"coll\": \"%s\", \"bytes\": %zu, \"model\": \"%s/%s\", \"modelUs\": %.2f, \"best\": \"%s/%s\", \"bestUs\": %.2f, \"loss\": %.3f }",
+          first ? "" : ",\n", ncclFuncStr[coll], bytes, ncclAlgoStr[model->algo], ncclProtoStr[model->proto], model->measured,
+          ncclAlgoStr[best->algo], ncclProtoStr[best->proto], best->measured, model->measured/best->measured - 1);
+      first = false;
+    }
+  }
+  printf("\n  ]\n}\n");
+
+  for (int i = 0; i < c.n; i++) BENCHCHECK(ncclCommDestroy(c.comms[i]));
+  for (int i = 0; i < c.n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaFree(c.bufs[i]));
+    BENCHCUDACHECK(cudaStreamDestroy(c.streams[i]));
+  }
+  free(c.comms); free(c.streams); free(c.bufs);
+  return 0;
+}
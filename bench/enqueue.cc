@@ -0,0 +1,89 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Host-side cost of the enqueue path.
+//
+// Issues groups of tiny AllReduces on every visible GPU and times, on the
+// host only, the collective calls (argument checks, task queueing) and
+// ncclGroupEnd (ncclLaunchPrepare, plan building, uploadWork and the
+// kernel launch). Streams are drained between batches outside the timed
+// region so that device time and work FIFO back-pressure do not leak into
+// the numbers; ncclCommGetStats confirms no FIFO stall was hit.
+//
+// BENCH_ITERS and BENCH_WARMUP tune the run.
+
+#include "bench.h"
+
+static const int opsPerGroup[] = { 1, 4, 16, 64 };
+// Keep batches well inside the work FIFO so no launch blocks on the device.
+#define BENCH_BATCH 16
+
+int main(int argc, char* argv[]) {
+  int iters = benchParam("BENCH_ITERS", 1000);
+  int warmup = benchParam("BENCH_WARMUP", 50);
+
+  int n;
+  BENCHCUDACHECK(cudaGetDeviceCount(&n));
+  if (n < 2) {
+    // A single rank bypasses plans entirely, which is not what we measure.
+    fprintf(stderr, "enqueue: needs at least 2 GPUs, found %d\n", n);
+    return EXIT_FAILURE;
+  }
+  ncclComm_t* comms = (ncclComm_t*)calloc(n, sizeof(ncclComm_t));
+  cudaStream_t* streams = (cudaStream_t*)calloc(n, sizeof(cudaStream_t));
+  float** bufs = (float**)calloc(n, sizeof(float*));
+  int maxOps = opsPerGroup[sizeof(opsPerGroup)/sizeof(opsPerGroup[0])-1];
+  for (int i = 0; i < n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaStreamCreateWithFlags(streams+i, cudaStreamNonBlocking));
+    BENCHCUDACHECK(cudaMalloc(bufs+i, maxOps*sizeof(float)));
+  }
+  BENCHCHECK(ncclCommInitAll(comms, n, NULL));
+
+  printf("# %d GPUs, %d groups per point\n", n, iters);
+  printf("%8s %14s %14s %14s\n", "ops", "calls(us/op)", "groupEnd(us)", "perComm(us)");
+  for (int o = 0; o < (int)(sizeof(opsPerGroup)/sizeof(opsPerGroup[0])); o++) {
+    int nOps = opsPerGroup[o];
+    double callTime = 0, endTime = 0;
+    for (int it = -warmup; it < iters; it++) {
+      double t0 = benchNow();
+      BENCHCHECK(ncclGroupStart());
+      for (int i = 0; i < n; i++) {
+        for (int op = 0; op < nOps; op++) {
+          BENCHCHECK(ncclAllReduce(bufs[i]+op, bufs[i]+op, 1, ncclFloat, ncclSum, comms[i], streams[i]));
+        }
+      }
+      double t1 = benchNow();
+      BENCHCHECK(ncclGroupEnd());
+      double t2 = benchNow();
+      if (it >= 0) { callTime += t1-t0; endTime += t2-t1; }
+      if ((it+1) % BENCH_BATCH == 0) {
+        for (int i = 0; i < n; i++) BENCHCUDACHECK(cudaStreamSynchronize(streams[i]));
+      }
+    }
+    for (int i = 0; i < n; i++) BENCHCUDACHECK(cudaStreamSynchronize(streams[i]));
+    // Each communicator prepares, uploads and launches its own plans, so
+    // perComm approximates the host cost of one plan for small groups.
+    printf("%8d %14.3f %14.3f %14.3f\n", nOps, callTime/iters/(n*nOps)*1e6, endTime/iters*1e6,
+        endTime/iters/n*1e6);
+  }
+
+  ncclCommStats_t stats;
+  BENCHCHECK(ncclCommGetStats(comms[0], &stats));
+  printf("# rank 0: %llu enqueue calls, %.3f us each; %llu work FIFO stalls\n",
+      (unsigned long long)stats.enqueueCalls,
+      stats.enqueueCalls ? stats.enqueueNs/1e3/stats.enqueueCalls : 0.0,
+      (unsigned long long)stats.workFifoStalls);
+
+  for (int i = 0; i < n; i++) BENCHCHECK(ncclCommDestroy(comms[i]));
+  for (int i = 0; i < n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaFree(bufs[i]));
+    BENCHCUDACHECK(cudaStreamDestroy(streams[i]));
+  }
+  free(comms); free(streams); free(bufs);
+  return 0;
+}
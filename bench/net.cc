@@ -0,0 +1,126 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Message rate of the builtin net plugins.
+//
+// Connects ncclNetIb and ncclNetSocket to themselves over loopback on
+// device 0 and keeps a window of isend/irecv pairs in flight from a single
+// thread, testing the oldest request of each side as the proxy would.
+// Reports messages per second and bandwidth per message size, isolating
+// the plugin's post and completion paths from the rest of NCCL.
+//
+// BENCH_ITERS, BENCH_WINDOW (<= NCCL_NET_MAX_REQUESTS) and BENCH_MAXBYTES
+// tune the run; BENCH_NET=IB|Socket restricts it to one plugin.
+
+#include "bench.h"
+#include "net.h"
+
+#define BENCH_TAG 0x42
+
+struct benchNetPair {
+  void* listenComm;
+  void* sendComm;
+  void* recvComm;
+  void* sendMh;
+  void* recvMh;
+};
+
+static void benchNetConnect(ncclNet_t* net, int dev, struct benchNetPair* pair) {
+  char handle[NCCL_NET_HANDLE_MAXSIZE];
+  ncclNetDeviceHandle_v8_t* devHandle = NULL;
+  memset(pair, 0, sizeof(*pair));
+  BENCHCHECK(net->listen(dev, handle, &pair->listenComm));
+  // Both calls are non-blocking; alternate until both ends are up.
+  while (pair->sendComm == NULL || pair->recvComm == NULL) {
+    if (pair->sendComm == NULL) BENCHCHECK(net->connect(dev, handle, &pair->sendComm, &devHandle));
+    if (pair->recvComm == NULL) BENCHCHECK(net->accept(pair->listenComm, &pair->recvComm, &devHandle));
+  }
+}
+
+static void benchNetClose(ncclNet_t* net, struct benchNetPair* pair) {
+  BENCHCHECK(net->deregMr(pair->sendComm, pair->sendMh));
+  BENCHCHECK(net->deregMr(pair->recvComm, pair->recvMh));
+  BENCHCHECK(net->closeSend(pair->sendComm));
+  BENCHCHECK(net->closeRecv(pair->recvComm));
+  BENCHCHECK(net->closeListen(pair->listenComm));
+}
+
+// Returns elapsed seconds for iters messages of the given size.
+static double benchNetRun(ncclNet_t* net, struct benchNetPair* pair, char* sendBuf, char* recvBuf,
+    int size, int iters, int window) {
+  void* sendReqs[NCCL_NET_MAX_REQUESTS];
+  void* recvReqs[NCCL_NET_MAX_REQUESTS];
+  int sendPosted = 0, sendDone = 0, recvPosted = 0, recvDone = 0;
+  double start = benchNow();
+  while (sendDone < iters || recvDone < iters) {
+    while (recvPosted < iters && recvPosted-recvDone < window) {
+      int tag = BENCH_TAG;
+      void* data = recvBuf;
+      void* req = NULL;
+      BENCHCHECK(net->irecv(pair->recvComm, 1, &data, &size, &tag, &pair->recvMh, &req));
+      if (req == NULL) break;
+      recvReqs[recvPosted++ % window] = req;
+    }
+    while (sendPosted < iters && sendPosted-sendDone < window) {
+      void* req = NULL;
+      BENCHCHECK(net->isend(pair->sendComm, sendBuf, size, BENCH_TAG, pair->sendMh, &req));
+      if (req == NULL) break;
+      sendReqs[sendPosted++ % window] = req;
+    }
+    int done;
+    if (sendDone < sendPosted) {
+      BENCHCHECK(net->test(sendReqs[sendDone % window], &done, NULL));
+      if (done) sendDone++;
+    }
+    if (recvDone < recvPosted) {
+      int sizes;
+      BENCHCHECK(net->test(recvReqs[recvDone % window], &done, &sizes));
+      if (done) recvDone++;
+    }
+  }
+  return benchNow() - start;
+}
+
+int main(int argc, char* argv[]) {
+  int iters = benchParam("BENCH_ITERS", 100000);
+  int window = benchParam("BENCH_WINDOW", 8);
+  int maxBytes = benchParam("BENCH_MAXBYTES", 1 << 20);
+  const char* only = getenv("BENCH_NET");
+  if (window < 1 || window > NCCL_NET_MAX_REQUESTS) window = NCCL_NET_MAX_REQUESTS;
+
+  char* sendBuf = (char*)calloc(1, maxBytes);
+  char* recvBuf = (char*)calloc(1, maxBytes);
+  ncclNet_t* nets[] = { &ncclNetIb, &ncclNetSocket };
+  for (int n = 0; n < (int)(sizeof(nets)/sizeof(nets[0])); n++) {
+    ncclNet_t* net = nets[n];
+    if (only && strcasecmp(only, net->name) != 0) continue;
+    int ndev = 0;
+    if (net->init(ncclDebugLog) != ncclSuccess || net->devices(&ndev) != ncclSuccess || ndev == 0) {
+      printf("# %s: not available\n", net->name);
+      continue;
+    }
+    ncclNetProperties_t props;
+    BENCHCHECK(net->getProperties(0, &props));
+    struct benchNetPair pair;
+    benchNetConnect(net, 0, &pair);
+    BENCHCHECK(net->regMr(pair.sendComm, sendBuf, maxBytes, NCCL_PTR_HOST, &pair.sendMh));
+    BENCHCHECK(net->regMr(pair.recvComm, recvBuf, maxBytes, NCCL_PTR_HOST, &pair.recvMh));
+
+    printf("# %s device 0 (%s) loopback, window %d\n", net->name, props.name, window);
+    printf("%12s %14s %12s\n", "size(B)", "msg/s", "GB/s");
+    benchNetRun(net, &pair, sendBuf, recvBuf, 0, window*4, window);
+    for (int size = 0; size <= maxBytes; size = size ? size*4 : 8) {
+      // Scale the count down for large messages to keep runs short.
+      int count = size > 4096 ? iters/(size/4096) + window : iters;
+      double t = benchNetRun(net, &pair, sendBuf, recvBuf, size, count, window);
+      printf("%12d %14.0f %12.3f\n", size, count/t, (double)size*count/t/1e9);
+    }
+    benchNetClose(net, &pair);
+  }
+  free(sendBuf);
+  free(recvBuf);
+  return 0;
+}
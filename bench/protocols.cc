@@ -0,0 +1,99 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Per-protocol primitive throughput and flag latency.
+//
+// Drives the device Primitives<> through single-process AllReduce and
+// AllGather on every visible GPU with one protocol forced at a time, so
+// that LL, LL128 and SIMPLE copy/reduce loops and their flag handshakes
+// are measured without the tuner picking for us. Large messages report
+// bus bandwidth (copy for AllGather, reduce+copy for AllReduce); one or
+// two element messages report the per-operation latency, dominated by flag
+// round trips.
+//
+// BENCH_ITERS, BENCH_WARMUP and BENCH_BYTES tune the run.
+
+#include "bench.h"
+
+static const char* protos[] = { "LL", "LL128", "Simple" };
+
+struct benchComms {
+  int n;
+  ncclComm_t* comms;
+  cudaStream_t* streams;
+  void** bufs;
+};
+
+static void runOp(struct benchComms* c, int allReduce, size_t count) {
+  BENCHCHECK(ncclGroupStart());
+  for (int i = 0; i < c->n; i++) {
+    if (allReduce) {
+      BENCHCHECK(ncclAllReduce(c->bufs[i], c->bufs[i], count, ncclFloat, ncclSum, c->comms[i], c->streams[i]));
+    } else {
+      // In-place AllGather: each rank's slice sits at offset rank*count.
+      BENCHCHECK(ncclAllGather((float*)c->bufs[i]+i*count, c->bufs[i], count, ncclFloat, c->comms[i], c->streams[i]));
+    }
+  }
+  BENCHCHECK(ncclGroupEnd());
+}
+
+static double timeOp(struct benchComms* c, int allReduce, size_t count, int warmup, int iters) {
+  for (int w = 0; w < warmup; w++) runOp(c, allReduce, count);
+  for (int i = 0; i < c->n; i++) BENCHCUDACHECK(cudaStreamSynchronize(c->streams[i]));
+  double start = benchNow();
+  for (int it = 0; it < iters; it++) runOp(c, allReduce, count);
+  for (int i = 0; i < c->n; i++) BENCHCUDACHECK(cudaStreamSynchronize(c->streams[i]));
+  return (benchNow() - start) / iters;
+}
+
+int main(int argc, char* argv[]) {
+  int iters = benchParam("BENCH_ITERS", 100);
+  int warmup = benchParam("BENCH_WARMUP", 10);
+  size_t bytes = benchParam("BENCH_BYTES", 64 << 20);
+
+  struct benchComms c;
+  BENCHCUDACHECK(cudaGetDeviceCount(&c.n));
+  if (c.n < 2) {
+    fprintf(stderr, "protocols: needs at least 2 GPUs, found %d\n", c.n);
+    return EXIT_FAILURE;
+  }
+  c.comms = (ncclComm_t*)calloc(c.n, sizeof(ncclComm_t));
+  c.streams = (cudaStream_t*)calloc(c.n, sizeof(cudaStream_t));
+  c.bufs = (void**)calloc(c.n, sizeof(void*));
+  for (int i = 0; i < c.n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaStreamCreateWithFlags(c.streams+i, cudaStreamNonBlocking));
+    BENCHCUDACHECK(cudaMalloc(c.bufs+i, bytes));
+    BENCHCUDACHECK(cudaMemset(c.bufs[i], 0, bytes));
+  }
+
+  printf("# %d GPUs, %zu bytes, %d iterations\n", c.n, bytes, iters);
+  printf("%-8s %-14s %12s %12s %12s\n", "proto", "op", "latency(us)", "size(B)", "busbw(GB/s)");
+  for (int p = 0; p < (int)(sizeof(protos)/sizeof(protos[0])); p++) {
+    // NCCL_PROTO is read at every communicator init.
+    setenv("NCCL_PROTO", protos[p], 1);
+    BENCHCHECK(ncclCommInitAll(c.comms, c.n, NULL));
+    for (int allReduce = 0; allReduce <= 1; allReduce++) {
+      const char* op = allReduce ? "AllReduce" : "AllGather";
+      // Flag latency: smallest message, one element per rank.
+      double lat = timeOp(&c, allReduce, allReduce ? 2 : 1, warmup, iters);
+      // Throughput: the factors below match nccl-tests' bus bandwidth.
+      size_t count = allReduce ? bytes/sizeof(float) : bytes/sizeof(float)/c.n;
+      double t = timeOp(&c, allReduce, count, warmup, iters);
+      double factor = allReduce ? 2.0*(c.n-1)/c.n : (double)(c.n-1)/c.n;
+      printf("%-8s %-14s %12.2f %12zu %12.2f\n", protos[p], op, lat*1e6, bytes, bytes*factor/t/1e9);
+    }
+    for (int i = 0; i < c.n; i++) BENCHCHECK(ncclCommDestroy(c.comms[i]));
+  }
+
+  for (int i = 0; i < c.n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaFree(c.bufs[i]));
+    BENCHCUDACHECK(cudaStreamDestroy(c.streams[i]));
+  }
+  free(c.comms); free(c.streams); free(c.bufs);
+  return 0;
+}
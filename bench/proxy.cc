@@ -0,0 +1,97 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Proxy progress throughput.
+//
+// Forces every connection between the visible GPUs onto the network
+// transport (P2P, SHM and NVLS disabled) so that each Send/Recv becomes a
+// proxy op driven by progressOps, then pushes small ring-neighbour
+// exchanges through as fast as the proxy retires them. Reports proxy ops
+// per second and, from ncclCommGetStats, the fraction of time the proxy
+// threads spent in their progress loops rather than idle.
+//
+// BENCH_ITERS, BENCH_WARMUP, BENCH_BYTES and BENCH_DEPTH (operations
+// aggregated per group) tune the run. NCCL_NET selects IB or Socket.
+
+#include "bench.h"
+
+static void exchange(int n, ncclComm_t* comms, cudaStream_t* streams, char** bufs, size_t bytes, int depth) {
+  BENCHCHECK(ncclGroupStart());
+  for (int d = 0; d < depth; d++) {
+    for (int i = 0; i < n; i++) {
+      char* send = bufs[i] + 2*d*bytes;
+      char* recv = send + bytes;
+      BENCHCHECK(ncclSend(send, bytes, ncclInt8, (i+1)%n, comms[i], streams[i]));
+      BENCHCHECK(ncclRecv(recv, bytes, ncclInt8, (i+n-1)%n, comms[i], streams[i]));
+    }
+  }
+  BENCHCHECK(ncclGroupEnd());
+}
+
+static void proxyTimes(int n, ncclComm_t* comms, double* active, double* idle) {
+  *active = *idle = 0;
+  for (int i = 0; i < n; i++) {
+    ncclCommStats_t stats;
+    BENCHCHECK(ncclCommGetStats(comms[i], &stats));
+    *active += stats.proxyActiveNs/1e9;
+    *idle += stats.proxyIdleNs/1e9;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int iters = benchParam("BENCH_ITERS", 2000);
+  int warmup = benchParam("BENCH_WARMUP", 100);
+  size_t bytes = benchParam("BENCH_BYTES", 8);
+  int depth = benchParam("BENCH_DEPTH", 1);
+
+  benchDefaultEnv("NCCL_P2P_DISABLE", "1");
+  benchDefaultEnv("NCCL_SHM_DISABLE", "1");
+  benchDefaultEnv("NCCL_NVLS_ENABLE", "0");
+
+  int n;
+  BENCHCUDACHECK(cudaGetDeviceCount(&n));
+  if (n < 2) {
+    fprintf(stderr, "proxy: needs at least 2 GPUs, found %d\n", n);
+    return EXIT_FAILURE;
+  }
+  ncclComm_t* comms = (ncclComm_t*)calloc(n, sizeof(ncclComm_t));
+  cudaStream_t* streams = (cudaStream_t*)calloc(n, sizeof(cudaStream_t));
+  char** bufs = (char**)calloc(n, sizeof(char*));
+  for (int i = 0; i < n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaStreamCreateWithFlags(streams+i, cudaStreamNonBlocking));
+    BENCHCUDACHECK(cudaMalloc(bufs+i, 2*depth*bytes));
+  }
+  BENCHCHECK(ncclCommInitAll(comms, n, NULL));
+
+  for (int it = 0; it < warmup; it++) exchange(n, comms, streams, bufs, bytes, depth);
+  for (int i = 0; i < n; i++) BENCHCUDACHECK(cudaStreamSynchronize(streams[i]));
+
+  double active0, idle0, active1, idle1;
+  proxyTimes(n, comms, &active0, &idle0);
+  double start = benchNow();
+  for (int it = 0; it < iters; it++) exchange(n, comms, streams, bufs, bytes, depth);
+  for (int i = 0; i < n; i++) BENCHCUDACHECK(cudaStreamSynchronize(streams[i]));
+  double elapsed = benchNow() - start;
+  proxyTimes(n, comms, &active1, &idle1);
+
+  // One send and one receive proxy op per rank per exchange.
+  double ops = 2.0*n*depth*iters;
+  double busy = active1-active0, total = busy + idle1-idle0;
+  printf("# %d GPUs over the network transport, %zu bytes, depth %d\n", n, bytes, depth);
+  printf("%14s %14s %14s %14s\n", "ops/s", "us/exchange", "proxyBusy(%)", "proxyUs/op");
+  printf("%14.0f %14.3f %14.1f %14.3f\n", ops/elapsed, elapsed/iters*1e6,
+      total > 0 ? 100.0*busy/total : 0.0, busy/ops*1e6);
+
+  for (int i = 0; i < n; i++) BENCHCHECK(ncclCommDestroy(comms[i]));
+  for (int i = 0; i < n; i++) {
+    BENCHCUDACHECK(cudaSetDevice(i));
+    BENCHCUDACHECK(cudaFree(bufs[i]));
+    BENCHCUDACHECK(cudaStreamDestroy(streams[i]));
+  }
+  free(comms); free(streams); free(bufs);
+  return 0;
+}
@@ -0,0 +1,222 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Offline topology search and tuning replay.
+//
+// Builds a system from a topology XML (e.g. one written by
+// NCCL_TOPO_DUMP_FILE) or from a synthesized rail-optimized node, then
+// runs the same path computation, ring/tree/NVLS searches and tuning model
+// as communicator init, without any GPU. Reports the time each search took,
+// the channels and bandwidths it found, and the algorithm/protocol the
+// model would pick per collective and size for the requested node count.
+//
+// Usage: topo [-x topo.xml] [-n nodes] [-g gpus/node] [-s sm] [-l nvlinks]
+//             [-b nic Mbps] [-v] [-r repeat]
+//   -x       load this XML instead of synthesizing a node
+//   -g/-s/-l/-b  synthesized node: GPUs, compute capability, NVLinks per
+//            GPU to an NVSwitch (0 for PCI only) and NIC speed, one NIC per
+//            GPU behind the same PCI switch
+//   -n       number of identical nodes fed to the tuning model
+//   -v       also search NVLS graphs (the tool cannot probe multicast)
+//   -r       repeat each search to average its time
+// NCCL_* environment variables (NCCL_ALGO, NCCL_PROTO, NCCL_CROSS_NIC, ...)
+// apply as they would at init.
+
+#include "bench.h"
+#include "comm.h"
+#include "graph.h"
+#include "topo.h"
+#include "xml.h"
+#include "info.h"
+#include <unistd.h>
+#include <algorithm>
+
+static void synthesizeNode(FILE* f, int nGpus, int sm, int nvlinks, int nicMbps) {
+  int nCpus = nGpus > 1 ? 2 : 1;
+  fprintf(f, "<system version=\"%d\">\n", NCCL_TOPO_XML_VERSION);
+  for (int c=0; c<nCpus; c++) {
+    fprintf(f, "  <cpu numaid=\"%d\" arch=\"x86_64\" vendor=\"GenuineIntel\" familyid=\"6\" modelid=\"143\">\n", c);
+    for (int g=c*nGpus/nCpus; g<(c+1)*nGpus/nCpus; g++) {
+      int bus = 0x10*(g+1);
+      fprintf(f, "    <pci busid=\"0000:%02x:00.0\" class=\"0x060400\" link_speed=\"32.0 GT/s PCIe\" link_width=\"16\">\n", bus);
+      fprintf(f, "      <pci busid=\"0000:%02x:00.0\" class=\"0x030200\" link_speed=\"32.0 GT/s PCIe\" link_width=\"16\">\n", bus+1);
+      fprintf(f, "        <gpu dev=\"%d\" sm=\"%d\" rank=\"%d\" gdr=\"1\">\n", g, sm, g);
+      if (nvlinks) fprintf(f, "          <nvlink target=\"0000:ff:00.0\" count=\"%d\" tclass=\"0x068000\"/>\n", nvlinks);
+      fprintf(f, "        </gpu>\n      </pci>\n");
+      fprintf(f, "      <pci busid=\"0000:%02x:00.0\" class=\"0x020700\" link_speed=\"32.0 GT/s PCIe\" link_width=\"16\">\n", bus+2);
+      fprintf(f, "        <nic>\n          <net name=\"mlx5_%d\" dev=\"%d\" speed=\"%d\" port=\"1\" guid=\"0x%x\" maxconn=\"131072\" gdr=\"1\"/>\n        </nic>\n", g, g, nicMbps, g);
+      fprintf(f, "      </pci>\n    </pci>\n");
+    }
+    fprintf(f, "  </cpu>\n");
+  }
+  fprintf(f, "</system>\n");
+}
+
+static void loadSystem(const char* xmlFile, int nGpus, int sm, int nvlinks, int nicMbps, struct ncclTopoSystem** system) {
+  struct ncclXml* xml;
+  BENCHCHECK(xmlAlloc(&xml, NCCL_TOPO_XML_MAX_NODES));
+  char tmpName[] = "/tmp/nccl-topo-XXXXXX";
+  if (xmlFile == NULL) {
+    int fd = mkstemp(tmpName);
+    FILE* f = fd == -1 ? NULL : fdopen(fd, "w");
+    if (f == NULL) { perror("topo: mkstemp"); exit(EXIT_FAILURE); }
+    synthesizeNode(f, nGpus, sm, nvlinks, nicMbps);
+    fclose(f);
+    xmlFile = tmpName;
+  }
+  BENCHCHECK(ncclTopoGetXmlFromFile(xmlFile, xml, 1));
+  if (xmlFile == tmpName) unlink(tmpName);
+  if (xml->maxIndex == 0) {
+    fprintf(stderr, "topo: no topology in %s\n", xmlFile);
+    exit(EXIT_FAILURE);
+  }
+  BENCHCHECK(ncclTopoGetSystemFromXml(xml, system, 0));
+  free(xml);
+}
+
+static double searchGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int repeat) {
+  struct ncclTopoGraph input = *graph;
+  double start = benchNow();
+  for (int r=0; r<repeat; r++) {
+    *graph = input;
+    BENCHCHECK(ncclTopoCompute(system, graph));
+  }
+  return (benchNow()-start)/repeat;
+}
+
+static void printGraph(const char* name, struct ncclTopoGraph* graph, double seconds) {
+  printf("%-8s %10.3f %9d %9.1f %9.1f %5s/%-5s %6d\n", name, seconds*1e3, graph->nChannels,
+      graph->bwIntra, graph->bwInter, topoPathTypeStr[graph->typeIntra], topoPathTypeStr[graph->typeInter],
+      graph->crossNic);
+}
+
+int main(int argc, char* argv[]) {
+  const char* xmlFile = NULL;
+  int nNodes = 1, nGpus = 8, sm = 90, nvlinks = 18, nicMbps = 400000, nvls = 0, repeat = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "x:n:g:s:l:b:vr:")) != -1) {
+    switch (opt) {
+      case 'x': xmlFile = optarg; break;
+      case 'n': nNodes = atoi(optarg); break;
+      case 'g': nGpus = atoi(optarg); break;
+      case 's': sm = atoi(optarg); break;
+      case 'l': nvlinks = atoi(optarg); break;
+      case 'b': nicMbps = atoi(optarg); break;
+      case 'v': nvls = 1; break;
+      case 'r': repeat = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-x topo.xml] [-n nodes] [-g gpus] [-s sm] [-l nvlinks] [-b mbps] [-v] [-r repeat]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (nNodes < 1 || nGpus < 1 || nGpus > NCCL_TOPO_MAX_NODES || repeat < 1) {
+    fprintf(stderr, "topo: invalid arguments\n");
+    return EXIT_FAILURE;
+  }
+
+  struct ncclTopoSystem* system;
+  double start = benchNow();
+  loadSystem(xmlFile, nGpus, sm, nvlinks, nicMbps, &system);
+  if (system->nodes[GPU].count == 0) {
+    fprintf(stderr, "topo: no GPU with a rank in the topology\n");
+    return EXIT_FAILURE;
+  }
+  // Only the fields topology trimming, the tuning model and
+  // ncclTopoGetAlgoTime read. We act as the first GPU of the node.
+  struct ncclComm* comm;
+  BENCHCHECK(ncclCalloc(&comm, 1));
+  comm->topo = system;
+  comm->rank = system->nodes[GPU].nodes[0].gpu.rank;
+  comm->nNodes = nNodes;
+  comm->nRanks = system->nodes[GPU].count*nNodes;
+  // Same sequence as initTransportsRank; P2P/SHM reachability is assumed.
+  BENCHCHECK(ncclTopoComputePaths(system, NULL));
+  BENCHCHECK(ncclTopoTrimSystem(system, comm));
+  BENCHCHECK(ncclTopoComputePaths(system, NULL));
+  BENCHCHECK(ncclTopoSearchInit(system));
+  double setup = benchNow()-start;
+
+  int nLocal = system->nodes[GPU].count;
+  comm->nRanks = nLocal*nNodes;
+  int minCompCap = INT_MAX, maxCompCap = 0;
+  for (int g=0; g<nLocal; g++) {
+    minCompCap = std::min(minCompCap, system->nodes[GPU].nodes[g].gpu.cudaCompCap);
+    maxCompCap = std::max(maxCompCap, system->nodes[GPU].nodes[g].gpu.cudaCompCap);
+  }
+  printf("# %d GPUs, %d NICs, %d NVSwitches per node, %d nodes; paths computed in %.3f ms\n",
+      nLocal, system->nodes[NET].count, system->nodes[NVS].count, nNodes, setup*1e3);
+
+  // Same graphs, in the same order, as initTransportsRank.
+  struct ncclTopoGraph ringGraph, treeGraph, collNetGraph, nvlsGraph;
+  memset(&ringGraph, 0, sizeof(ringGraph));
+  ringGraph.id = 0;
+  ringGraph.pattern = NCCL_TOPO_PATTERN_RING;
+  ringGraph.minChannels = 1;
+  ringGraph.maxChannels = MAXCHANNELS/2;
+  printf("%-8s %10s %9s %9s %9s %11s %6s\n", "graph", "search(ms)", "channels", "bwIntra", "bwInter", "type", "xnic");
+  printGraph("ring", &ringGraph, searchGraph(system, &ringGraph, repeat));
+
+  memset(&treeGraph, 0, sizeof(treeGraph));
+  treeGraph.id = 1;
+  treeGraph.pattern = NCCL_TOPO_PATTERN_BALANCED_TREE;
+  treeGraph.minChannels = treeGraph.maxChannels = ringGraph.nChannels;
+  printGraph("tree", &treeGraph, searchGraph(system, &treeGraph, repeat));
+
+  memset(&collNetGraph, 0, sizeof(collNetGraph));
+  collNetGraph.id = 2;
+  collNetGraph.pattern = NCCL_TOPO_PATTERN_TREE;
+  collNetGraph.collNet = 1;
+
+  memset(&nvlsGraph, 0, sizeof(nvlsGraph));
+  nvlsGraph.id = 3;
+  nvlsGraph.pattern = NCCL_TOPO_PATTERN_NVLS;
+  nvlsGraph.minChannels = 1;
+  nvlsGraph.maxChannels = MAXCHANNELS;
+  if (nvls) printGraph("nvls", &nvlsGraph, searchGraph(system, &nvlsGraph, repeat));
+
+  comm->minCompCap = minCompCap;
+  comm->maxCompCap = maxCompCap;
+  comm->nvlsSupport = nvls;
+  comm->treeRadix = std::max(2, (int)benchParam("NCCL_TREE_RADIX", 2));
+  comm->hierSupport = nNodes > 1 && nLocal > 1 && benchParam("NCCL_HIER_ENABLE", 1);
+  comm->recDblSupport = benchParam("NCCL_RECDBL_ENABLE", 0);
+  comm->nChannels = std::min(MAXCHANNELS, 2*std::min(treeGraph.nChannels, ringGraph.nChannels));
+  struct ncclTopoGraph* graphs[] = { &treeGraph, &ringGraph, &collNetGraph, &collNetGraph, &nvlsGraph, &nvlsGraph, &ringGraph, &ringGraph, &ringGraph };
+  BENCHCHECK(ncclTopoTuneModel(comm, minCompCap, maxCompCap, graphs));
+
+  static const ncclFunc_t colls[] = { ncclFuncAllReduce, ncclFuncAllGather, ncclFuncReduceScatter, ncclFuncBroadcast };
+  printf("\n%12s", "size(B)");
+  for (int c=0; c<(int)(sizeof(colls)/sizeof(colls[0])); c++) printf(" %27s", ncclFuncStr[colls[c]]);
+  printf("\n");
+  for (size_t bytes = 8; bytes <= (8ULL<<30); bytes *= 8) {
+    printf("%12zu", bytes);
+    for (int c=0; c<(int)(sizeof(colls)/sizeof(colls[0])); c++) {
+      struct ncclInfo info;
+      memset(&info, 0, sizeof(info));
+      info.comm = comm;
+      info.coll = colls[c];
+      info.nBytes = bytes;
+      int bestAlgo = -1, bestProto = -1;
+      float bestTime = 0;
+      for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+        for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+          float time;
+          BENCHCHECK(ncclTopoGetAlgoTime(&info, a, p, 1, &time));
+          if (time >= 0 && (bestAlgo == -1 || time < bestTime)) { bestAlgo = a; bestProto = p; bestTime = time; }
+        }
+      }
+      char choice[32];
+      if (bestAlgo == -1) snprintf(choice, sizeof(choice), "-");
+      else snprintf(choice, sizeof(choice), "%s/%s %.1fus", ncclAlgoStr[bestAlgo], ncclProtoStr[bestProto], bestTime);
+      printf(" %27s", choice);
+    }
+    printf("\n");
+  }
+
+  free(comm);
+  ncclTopoFree(system);
+  return 0;
+}
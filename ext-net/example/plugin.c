@@ -6,15 +6,121 @@
 
 #include "net.h"
 
+#include <errno.h>
+
 #define __hidden __attribute__ ((visibility("hidden")))
 
+/* Loopback network moving data through host shared memory, so that the NCCL
+ * net proxy path can be exercised and profiled on a single box without NICs.
+ * All ranks must run on the same host. Each connection is a single-producer,
+ * single-consumer byte ring in a POSIX shared memory segment created by the
+ * receiver. Messages are framed with their size and delivered in order.
+ *
+ * Environment:
+ *   NCCL_EXAMPLE_NET_RING_SIZE  bytes of ring per connection (default 4MB)
+ *   NCCL_EXAMPLE_NET_LATENCY    injected latency per message in us (default 0)
+ *   NCCL_EXAMPLE_NET_BW         injected bandwidth per connection in Gbps (default 0, unlimited)
+ *   NCCL_EXAMPLE_NET_SPEED      speed reported to NCCL in Mbps (default 100000)
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
 int max_requests = NCCL_NET_MAX_REQUESTS;
 
-__hidden ncclResult_t pluginInit(ncclDebugLogger_t logFunction) { return ncclSuccess; }
-__hidden ncclResult_t pluginDevices(int* ndev) { *ndev = 0; return ncclSuccess; }
+static ncclDebugLogger_t pluginLogFunction;
+#define WARN(...) if (pluginLogFunction) pluginLogFunction(NCCL_LOG_WARN, NCCL_ALL, __FILE__, __LINE__, __VA_ARGS__)
+#define INFO(FLAGS, ...) if (pluginLogFunction) pluginLogFunction(NCCL_LOG_INFO, (FLAGS), __func__, __LINE__, __VA_ARGS__)
+
+#define CACHE_LINE_SIZE 64
+#define MSG_HEADER_SIZE sizeof(uint64_t)
+
+static uint64_t ringSize = 4*1024*1024;
+static uint64_t latencyNs = 0;
+static double bwGbps = 0;
+static int speedMbps = 100000;
+
+static uint64_t envInt(const char* name, uint64_t def) {
+  const char* str = getenv(name);
+  return str ? strtoull(str, NULL, 0) : def;
+}
+
+static uint64_t clockNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+struct shmRing {
+  volatile uint32_t connected;
+  char pad0[CACHE_LINE_SIZE-sizeof(uint32_t)];
+  uint64_t head; // Bytes written by the sender
+  char pad1[CACHE_LINE_SIZE-sizeof(uint64_t)];
+  uint64_t tail; // Bytes consumed by the receiver
+  char pad2[CACHE_LINE_SIZE-sizeof(uint64_t)];
+  char data[];
+};
+
+struct pluginHandle {
+  char shmName[64];
+  uint64_t ringSize;
+};
+
+enum requestState { reqFree = 0, reqPending = 1, reqDone = 2 };
+
+struct pluginComm;
+
+struct pluginRequest {
+  enum requestState state;
+  struct pluginComm* comm;
+  char* data;
+  uint64_t size;     // Posted size, message size once the header is received
+  uint64_t offset;   // Bytes of the message moved so far, the header included
+  uint64_t readyNs;  // Receives complete once the injected latency has elapsed
+};
+
+struct pluginComm {
+  int isSend;
+  char shmName[64];
+  struct shmRing* ring;
+  size_t mapSize;
+  uint64_t ringSize;
+  uint64_t pos;       // Local copy of head (send) or tail (recv)
+  uint64_t linkFreeNs; // Injected bandwidth, time the link is done with what was sent
+  // Requests are processed in the order they were posted
+  struct pluginRequest requests[NCCL_NET_MAX_REQUESTS];
+  int next;  // Next request to post
+  int first; // Oldest request still moving data
+};
+
+struct pluginListenComm {
+  char shmName[64];
+  struct shmRing* ring;
+  size_t mapSize;
+  uint64_t ringSize;
+};
+
+__hidden ncclResult_t pluginInit(ncclDebugLogger_t logFunction) {
+  pluginLogFunction = logFunction;
+  ringSize = envInt("NCCL_EXAMPLE_NET_RING_SIZE", ringSize);
+  latencyNs = envInt("NCCL_EXAMPLE_NET_LATENCY", 0)*1000;
+  bwGbps = envInt("NCCL_EXAMPLE_NET_BW", 0);
+  speedMbps = envInt("NCCL_EXAMPLE_NET_SPEED", speedMbps);
+  if (ringSize < 2*MSG_HEADER_SIZE) {
+    WARN("NET/Example : NCCL_EXAMPLE_NET_RING_SIZE %lu is too small", ringSize);
+    return ncclInvalidArgument;
+  }
+  INFO(NCCL_INIT|NCCL_NET, "NET/Example : shared memory loopback, ring %lu bytes, latency %lu us, bandwidth %g Gbps", ringSize, latencyNs/1000, bwGbps);
+  return ncclSuccess;
+}
+__hidden ncclResult_t pluginDevices(int* ndev) { *ndev = 1; return ncclSuccess; }
 
-__hidden ncclResult_t pluginPciPath(int dev, char** path) { return ncclInternalError; }
-__hidden ncclResult_t pluginPtrSupport(int dev, int* supportedTypes) { return ncclInternalError; }
+__hidden ncclResult_t pluginPciPath(int dev, char** path) { *path = NULL; return ncclSuccess; }
+__hidden ncclResult_t pluginPtrSupport(int dev, int* supportedTypes) { *supportedTypes = NCCL_PTR_HOST; return ncclSuccess; }
 __hidden ncclResult_t pluginGetProperties(int dev, ncclNetProperties_v8_t* props) {
   // Below are default values, if unsure don't change.
 
@@ -28,11 +134,11 @@ __hidden ncclResult_t pluginGetProperties(int dev, ncclNetProperties_v8_t* props
   // If you regMr has a fast registration cache, set to 1. If set to 0, user buffer registration may be disabled.
   props->regIsGlobal = 0;
   // Speed in *Mbps*. 100000 means 100G
-  props->speed = 100000;
+  props->speed = speedMbps;
   // Port number, used in conjunction with guid
   props->port = 0;
   // Custom latency (used to help tuning if latency is high. If set to 0, use default NCCL values.
-  props->latency = 0;
+  props->latency = latencyNs/1000.0;
   // Maximum number of comm objects we can create.
   props->maxComms = 1024*1024;
   // Maximum number of receive operations taken by irecv().
@@ -40,22 +146,238 @@ __hidden ncclResult_t pluginGetProperties(int dev, ncclNetProperties_v8_t* props
   // Coupling with NCCL network device-side code.
   props->netDeviceType = 0;
   props->netDeviceVersion = NCCL_NET_DEVICE_INVALID_VERSION;
-  return ncclInternalError;
+  return ncclSuccess;
+}
+
+static ncclResult_t shmMap(const char* name, int create, uint64_t size, struct shmRing** ring, size_t* mapSize) {
+  *mapSize = sizeof(struct shmRing) + size;
+  int fd = shm_open(name, create ? O_CREAT|O_EXCL|O_RDWR : O_RDWR, 0600);
+  if (fd == -1) {
+    WARN("NET/Example : shm_open %s failed : %s", name, strerror(errno));
+    return ncclSystemError;
+  }
+  if (create && ftruncate(fd, *mapSize) != 0) {
+    WARN("NET/Example : ftruncate %s to %zu bytes failed : %s", name, *mapSize, strerror(errno));
+    close(fd);
+    shm_unlink(name);
+    return ncclSystemError;
+  }
+  void* ptr = mmap(NULL, *mapSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    WARN("NET/Example : mmap %s failed : %s", name, strerror(errno));
+    if (create) shm_unlink(name);
+    return ncclSystemError;
+  }
+  *ring = (struct shmRing*)ptr;
+  return ncclSuccess;
+}
+
+__hidden ncclResult_t pluginListen(int dev, void* opaqueHandle, void** listenComm) {
+  static uint32_t counter = 0;
+  struct pluginHandle* handle = (struct pluginHandle*)opaqueHandle;
+  _Static_assert(sizeof(struct pluginHandle) <= NCCL_NET_HANDLE_MAXSIZE, "pluginHandle size too large");
+  struct pluginListenComm* comm = (struct pluginListenComm*)calloc(1, sizeof(struct pluginListenComm));
+  if (comm == NULL) return ncclSystemError;
+  snprintf(comm->shmName, sizeof(comm->shmName), "/nccl-example-net-%d-%u", getpid(), __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+  comm->ringSize = ringSize;
+  ncclResult_t ret = shmMap(comm->shmName, 1, comm->ringSize, &comm->ring, &comm->mapSize);
+  if (ret != ncclSuccess) {
+    free(comm);
+    return ret;
+  }
+  memset(handle, 0, sizeof(struct pluginHandle));
+  strcpy(handle->shmName, comm->shmName);
+  handle->ringSize = comm->ringSize;
+  *listenComm = comm;
+  return ncclSuccess;
+}
+
+static struct pluginComm* pluginCommAlloc(int isSend, const char* name, struct shmRing* ring, size_t mapSize, uint64_t size) {
+  struct pluginComm* comm = (struct pluginComm*)calloc(1, sizeof(struct pluginComm));
+  if (comm == NULL) return NULL;
+  comm->isSend = isSend;
+  strcpy(comm->shmName, name);
+  comm->ring = ring;
+  comm->mapSize = mapSize;
+  comm->ringSize = size;
+  return comm;
+}
+
+__hidden ncclResult_t pluginConnect(int dev, void* opaqueHandle, void** sendComm, ncclNetDeviceHandle_v8_t** sendDevComm) {
+  struct pluginHandle* handle = (struct pluginHandle*)opaqueHandle;
+  struct shmRing* ring;
+  size_t mapSize;
+  ncclResult_t ret = shmMap(handle->shmName, 0, handle->ringSize, &ring, &mapSize);
+  if (ret != ncclSuccess) return ret;
+  struct pluginComm* comm = pluginCommAlloc(1, handle->shmName, ring, mapSize, handle->ringSize);
+  if (comm == NULL) {
+    munmap(ring, mapSize);
+    return ncclSystemError;
+  }
+  __atomic_store_n(&ring->connected, 1, __ATOMIC_RELEASE);
+  *sendComm = comm;
+  return ncclSuccess;
+}
+
+__hidden ncclResult_t pluginAccept(void* listenComm, void** recvComm, ncclNetDeviceHandle_v8_t** recvDevComm) {
+  struct pluginListenComm* lComm = (struct pluginListenComm*)listenComm;
+  *recvComm = NULL;
+  if (lComm->ring == NULL) return ncclInternalError; // Only one connection per listen
+  if (__atomic_load_n(&lComm->ring->connected, __ATOMIC_ACQUIRE) == 0) return ncclSuccess; // Retry later
+  struct pluginComm* comm = pluginCommAlloc(0, lComm->shmName, lComm->ring, lComm->mapSize, lComm->ringSize);
+  if (comm == NULL) return ncclSystemError;
+  // Both sides are mapped, the name is no longer needed
+  shm_unlink(lComm->shmName);
+  lComm->ring = NULL;
+  *recvComm = comm;
+  return ncclSuccess;
+}
+
+__hidden ncclResult_t pluginRegMr(void* collComm, void* data, size_t size, int type, void** mhandle) {
+  *mhandle = NULL;
+  return type == NCCL_PTR_HOST ? ncclSuccess : ncclInternalError;
 }
-__hidden ncclResult_t pluginListen(int dev, void* handle, void** listenComm) { return ncclInternalError; }
-__hidden ncclResult_t pluginConnect(int dev, void* handle, void** sendComm, ncclNetDeviceHandle_v8_t** sendDevComm) { return ncclInternalError; }
-__hidden ncclResult_t pluginAccept(void* listenComm, void** recvComm, ncclNetDeviceHandle_v8_t** recvDevComm) { return ncclInternalError; }
-__hidden ncclResult_t pluginRegMr(void* collComm, void* data, size_t size, int type, void** mhandle) { return ncclInternalError; }
 __hidden ncclResult_t pluginRegMrDmaBuf(void* collComm, void* data, size_t size, int type, uint64_t offset, int fd, void** mhandle) { return ncclInternalError; }
-__hidden ncclResult_t pluginDeregMr(void* collComm, void* mhandle) { return ncclInternalError;}
-__hidden ncclResult_t pluginIsend(void* sendComm, void* data, int size, int tag, void* mhandle, void** request) { return ncclInternalError; }
-__hidden ncclResult_t pluginIrecv(void* recvComm, int n, void** data, int* sizes, int* tags, void** mhandles, void** request) { return ncclInternalError; }
-__hidden ncclResult_t pluginIflush(void* recvComm, int n, void** data, int* sizes, void** mhandles, void** request) { return ncclInternalError; }
-__hidden ncclResult_t pluginTest(void* request, int* done, int* size) { return ncclInternalError; }
-__hidden ncclResult_t pluginCloseSend(void* sendComm) { return ncclInternalError; }
-__hidden ncclResult_t pluginCloseRecv(void* recvComm) { return ncclInternalError; }
-__hidden ncclResult_t pluginCloseListen(void* listenComm) { return ncclInternalError; }
-__hidden ncclResult_t pluginIrecvConsumed(void* recvComm, int n, void* request) { return ncclInternalError; }
+__hidden ncclResult_t pluginDeregMr(void* collComm, void* mhandle) { return ncclSuccess; }
+
+// Copy between a buffer and the ring at a position that may wrap around
+static void ringCopy(struct pluginComm* comm, uint64_t pos, char* buff, uint64_t size, int toRing) {
+  uint64_t off = pos % comm->ringSize;
+  uint64_t n = size < comm->ringSize-off ? size : comm->ringSize-off;
+  if (toRing) {
+    memcpy(comm->ring->data+off, buff, n);
+    memcpy(comm->ring->data, buff+n, size-n);
+  } else {
+    memcpy(buff, comm->ring->data+off, n);
+    memcpy(buff+n, comm->ring->data, size-n);
+  }
+}
+
+static ncclResult_t progressSend(struct pluginComm* comm, struct pluginRequest* r) {
+  uint64_t now = clockNs();
+  if (bwGbps > 0 && now < comm->linkFreeNs) return ncclSuccess;
+  uint64_t avail = comm->ringSize - (comm->pos - __atomic_load_n(&comm->ring->tail, __ATOMIC_ACQUIRE));
+  uint64_t total = MSG_HEADER_SIZE + r->size;
+  uint64_t moved = 0;
+  if (r->offset == 0) {
+    if (avail < MSG_HEADER_SIZE) return ncclSuccess;
+    ringCopy(comm, comm->pos, (char*)&r->size, MSG_HEADER_SIZE, 1);
+    moved = MSG_HEADER_SIZE;
+    avail -= MSG_HEADER_SIZE;
+  }
+  uint64_t payload = total - r->offset - moved;
+  if (payload > avail) payload = avail;
+  ringCopy(comm, comm->pos+moved, r->data + r->offset + moved - MSG_HEADER_SIZE, payload, 1);
+  moved += payload;
+  if (moved == 0) return ncclSuccess;
+  comm->pos += moved;
+  r->offset += moved;
+  __atomic_store_n(&comm->ring->head, comm->pos, __ATOMIC_RELEASE);
+  if (bwGbps > 0) comm->linkFreeNs = (now > comm->linkFreeNs ? now : comm->linkFreeNs) + (uint64_t)(moved*8/bwGbps);
+  if (r->offset == total) r->state = reqDone;
+  return ncclSuccess;
+}
+
+static ncclResult_t progressRecv(struct pluginComm* comm, struct pluginRequest* r) {
+  uint64_t avail = __atomic_load_n(&comm->ring->head, __ATOMIC_ACQUIRE) - comm->pos;
+  uint64_t moved = 0;
+  if (r->offset == 0) {
+    if (avail < MSG_HEADER_SIZE) return ncclSuccess;
+    uint64_t size;
+    ringCopy(comm, comm->pos, (char*)&size, MSG_HEADER_SIZE, 0);
+    if (size > r->size) {
+      WARN("NET/Example : message truncated : receiving %lu bytes instead of %lu", size, r->size);
+      return ncclRemoteError;
+    }
+    r->size = size;
+    moved = MSG_HEADER_SIZE;
+    avail -= MSG_HEADER_SIZE;
+  }
+  uint64_t payload = MSG_HEADER_SIZE + r->size - r->offset - moved;
+  if (payload > avail) payload = avail;
+  ringCopy(comm, comm->pos+moved, r->data + r->offset + moved - MSG_HEADER_SIZE, payload, 0);
+  moved += payload;
+  if (moved == 0) return ncclSuccess;
+  comm->pos += moved;
+  r->offset += moved;
+  __atomic_store_n(&comm->ring->tail, comm->pos, __ATOMIC_RELEASE);
+  if (r->offset == MSG_HEADER_SIZE + r->size) {
+    r->state = reqDone;
+    r->readyNs = clockNs() + latencyNs;
+  }
+  return ncclSuccess;
+}
+
+// Move data for the oldest requests of a comm, in order
+static ncclResult_t progressComm(struct pluginComm* comm) {
+  while (1) {
+    struct pluginRequest* r = comm->requests+comm->first;
+    if (r->state != reqPending) return ncclSuccess;
+    ncclResult_t ret = comm->isSend ? progressSend(comm, r) : progressRecv(comm, r);
+    if (ret != ncclSuccess) return ret;
+    if (r->state != reqDone) return ncclSuccess;
+    comm->first = (comm->first+1) % max_requests;
+  }
+}
+
+static ncclResult_t postRequest(struct pluginComm* comm, void* data, uint64_t size, void** request) {
+  struct pluginRequest* r = comm->requests+comm->next;
+  if (r->state != reqFree) { *request = NULL; return ncclSuccess; } // Out of requests, retry later
+  r->state = reqPending;
+  r->comm = comm;
+  r->data = (char*)data;
+  r->size = size;
+  r->offset = 0;
+  r->readyNs = 0;
+  comm->next = (comm->next+1) % max_requests;
+  *request = r;
+  return progressComm(comm);
+}
+
+__hidden ncclResult_t pluginIsend(void* sendComm, void* data, int size, int tag, void* mhandle, void** request) {
+  return postRequest((struct pluginComm*)sendComm, data, size, request);
+}
+__hidden ncclResult_t pluginIrecv(void* recvComm, int n, void** data, int* sizes, int* tags, void** mhandles, void** request) {
+  if (n != 1) return ncclInternalError;
+  return postRequest((struct pluginComm*)recvComm, data[0], sizes[0], request);
+}
+__hidden ncclResult_t pluginIflush(void* recvComm, int n, void** data, int* sizes, void** mhandles, void** request) {
+  // Data lands in host memory, there is nothing to flush
+  *request = NULL;
+  return ncclSuccess;
+}
+__hidden ncclResult_t pluginTest(void* request, int* done, int* size) {
+  struct pluginRequest* r = (struct pluginRequest*)request;
+  *done = 0;
+  ncclResult_t ret = progressComm(r->comm);
+  if (ret != ncclSuccess) return ret;
+  if (r->state != reqDone || (r->readyNs && clockNs() < r->readyNs)) return ncclSuccess;
+  *done = 1;
+  if (size) *size = r->size;
+  r->state = reqFree;
+  return ncclSuccess;
+}
+static ncclResult_t pluginClose(void* opaqueComm) {
+  struct pluginComm* comm = (struct pluginComm*)opaqueComm;
+  if (comm == NULL) return ncclSuccess;
+  munmap(comm->ring, comm->mapSize);
+  free(comm);
+  return ncclSuccess;
+}
+__hidden ncclResult_t pluginCloseSend(void* sendComm) { return pluginClose(sendComm); }
+__hidden ncclResult_t pluginCloseRecv(void* recvComm) { return pluginClose(recvComm); }
+__hidden ncclResult_t pluginCloseListen(void* listenComm) {
+  struct pluginListenComm* comm = (struct pluginListenComm*)listenComm;
+  if (comm == NULL) return ncclSuccess;
+  if (comm->ring) { // Never accepted
+    munmap(comm->ring, comm->mapSize);
+    shm_unlink(comm->shmName);
+  }
+  free(comm);
+  return ncclSuccess;
+}
+__hidden ncclResult_t pluginIrecvConsumed(void* recvComm, int n, void* request) { return ncclSuccess; }
 __hidden ncclResult_t pluginGetDeviceMr(void* comm, void* mhandle, void** dptr_mhandle) { return ncclInternalError; }
 
 #define PLUGIN_NAME "Plugin"
@@ -210,16 +532,16 @@ static ncclResult_t pluginIflush_v4(void* recvComm, void* data, int size, void*
 static ncclResult_t pluginConnect_v4(int dev, void* handle, void** sendComm) {
   ncclResult_t ret;
   do {
-    ncclNetDeviceHandle_v7_t* handle = NULL;
-    ret = pluginConnect(dev, handle, sendComm, &handle);
+    ncclNetDeviceHandle_v7_t* devHandle = NULL;
+    ret = pluginConnect(dev, handle, sendComm, &devHandle);
   } while (ret == ncclSuccess && *sendComm == NULL);
   return ret;
 }
 static ncclResult_t pluginAccept_v4(void* listenComm, void** recvComm) {
   ncclResult_t ret;
   do {
-    ncclNetDeviceHandle_v7_t* handle = NULL;
-    ret = pluginAccept(listenComm, recvComm, &handle);
+    ncclNetDeviceHandle_v7_t* devHandle = NULL;
+    ret = pluginAccept(listenComm, recvComm, &devHandle);
   } while (ret == ncclSuccess && *recvComm == NULL);
   return ret;
 }
@@ -0,0 +1,55 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_PROFILER_H_
+#define NCCL_PROFILER_H_
+
+#include "nccl.h"
+
+typedef enum {NCCL_LOG_NONE=0, NCCL_LOG_VERSION=1, NCCL_LOG_WARN=2, NCCL_LOG_INFO=3, NCCL_LOG_ABORT=4, NCCL_LOG_TRACE=5} ncclDebugLogLevel;
+typedef enum {NCCL_INIT=1, NCCL_COLL=2, NCCL_P2P=4, NCCL_SHM=8, NCCL_NET=16, NCCL_GRAPH=32, NCCL_TUNING=64, NCCL_ENV=128, NCCL_ALLOC=256, NCCL_CALL=512, NCCL_PROXY=1024, NCCL_NVLS=2048, NCCL_ALL=~0} ncclDebugLogSubSys;
+
+typedef void (*ncclDebugLogger_t)(ncclDebugLogLevel level, unsigned long flags, const char *file, int line, const char *fmt, ...);
+
+typedef enum { ncclFuncBroadcast, ncclFuncReduce, ncclFuncAllGather, ncclFuncReduceScatter, ncclFuncAllReduce, ncclFuncSendRecv, ncclFuncSend, ncclFuncRecv, ncclFuncAllToAll, ncclFuncGather, ncclFuncScatter, ncclNumFuncs} ncclFunc_t;
+
+enum {
+  ncclProfilerProxyOpBegin = 0,
+
+  ncclProfilerProxySendGPUWait = 1,
+  ncclProfilerProxySendWait = 2,
+
+  ncclProfilerProxyRecvWait = 1,
+  ncclProfilerProxyRecvFlushWait = 2,
+  ncclProfilerProxyRecvGPUWait = 3,
+
+  ncclProfilerProxyOpEnd = 4
+};
+
+// API to be implemented by external profiler, see src/include/nccl_profiler.h
+typedef struct {
+  const char* name;
+  ncclResult_t (*init)(uint64_t commHash, int rank, int nRanks, ncclDebugLogger_t logFunction, void **context);
+  void (*collEnqueue)(void* context, uint64_t opCount, ncclFunc_t func, size_t count,
+                      ncclDataType_t datatype, int root, cudaStream_t stream);
+  void (*planLaunch)(void* context, uint64_t opCount, uint64_t channelMask, int nColl, cudaStream_t stream, uint64_t opTag);
+  void (*proxyOpState)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, int state, uint64_t opTag);
+  void (*netComplete)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, size_t size, uint64_t opTag);
+  ncclResult_t (*destroy)(void* context);
+} ncclProfiler_v2_t;
+
+typedef struct {
+  const char* name;
+  ncclResult_t (*init)(uint64_t commHash, int rank, int nRanks, ncclDebugLogger_t logFunction, void **context);
+  void (*collEnqueue)(void* context, uint64_t opCount, ncclFunc_t func, size_t count,
+                      ncclDataType_t datatype, int root, cudaStream_t stream);
+  void (*planLaunch)(void* context, uint64_t opCount, uint64_t channelMask, int nColl, cudaStream_t stream);
+  void (*proxyOpState)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, int state);
+  void (*netComplete)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, size_t size);
+  ncclResult_t (*destroy)(void* context);
+} ncclProfiler_v1_t;
+
+#endif
@@ -0,0 +1,63 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include <stdlib.h>
+#include "profiler.h"
+
+#define __hidden __attribute__ ((visibility("hidden")))
+
+struct context {
+  ncclDebugLogger_t log;
+  int rank;
+  uint64_t colls, plans, taggedPlans, netSends, netRecvs;
+  size_t netBytes;
+};
+
+__hidden ncclResult_t pluginInit(uint64_t commHash, int rank, int nRanks, ncclDebugLogger_t logFunction, void **context) {
+  struct context* ctx = calloc(1, sizeof(struct context));
+  if (ctx == NULL) return ncclSystemError;
+  ctx->log = logFunction;
+  ctx->rank = rank;
+  *context = ctx;
+  return ncclSuccess;
+}
+
+__hidden void pluginCollEnqueue(void* context, uint64_t opCount, ncclFunc_t func, size_t count,
+                                ncclDataType_t datatype, int root, cudaStream_t stream) {
+  ((struct context*)context)->colls++;
+}
+
+__hidden void pluginPlanLaunch(void* context, uint64_t opCount, uint64_t channelMask, int nColl, cudaStream_t stream, uint64_t opTag) {
+  struct context* ctx = (struct context*)context;
+  ctx->plans++;
+  if (opTag) ctx->taggedPlans++;
+}
+
+__hidden void pluginNetComplete(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, size_t size, uint64_t opTag) {
+  struct context* ctx = (struct context*)context;
+  if (isSend) ctx->netSends++; else ctx->netRecvs++;
+  ctx->netBytes += size;
+}
+
+__hidden ncclResult_t pluginDestroy(void* context) {
+  struct context* ctx = (struct context*)context;
+  ctx->log(NCCL_LOG_INFO, NCCL_ALL, __FILE__, __LINE__, "Example profiler: rank %d colls %lu plans %lu (%lu tagged) net sends %lu recvs %lu bytes %zu",
+      ctx->rank, ctx->colls, ctx->plans, ctx->taggedPlans, ctx->netSends, ctx->netRecvs, ctx->netBytes);
+  free(ctx);
+  return ncclSuccess;
+}
+
+#define PLUGIN_NAME "Example"
+
+const ncclProfiler_v2_t ncclProfiler_v2 = {
+  .name = PLUGIN_NAME,
+  .init = pluginInit,
+  .collEnqueue = pluginCollEnqueue,
+  .planLaunch = pluginPlanLaunch,
+  .proxyOpState = NULL,
+  .netComplete = pluginNetComplete,
+  .destroy = pluginDestroy
+};
@@ -16,7 +16,7 @@ typedef enum {NCCL_INIT=1, NCCL_COLL=2, NCCL_P2P=4, NCCL_SHM=8, NCCL_NET=16, NCC
 typedef void (*ncclDebugLogger_t)(ncclDebugLogLevel level, unsigned long flags, const char *file, int line, const char *fmt, ...);
 
 #define NCCL_NUM_FUNCTIONS 5 // Send/Recv not included for now
-typedef enum { ncclFuncBroadcast, ncclFuncReduce, ncclFuncAllGather, ncclFuncReduceScatter, ncclFuncAllReduce, ncclFuncSendRecv, ncclFuncSend, ncclFuncRecv, ncclNumFuncs} ncclFunc_t;
+typedef enum { ncclFuncBroadcast, ncclFuncReduce, ncclFuncAllGather, ncclFuncReduceScatter, ncclFuncAllReduce, ncclFuncSendRecv, ncclFuncSend, ncclFuncRecv, ncclFuncAllToAll, ncclFuncGather, ncclFuncScatter, ncclNumFuncs} ncclFunc_t;
 
 #define NCCL_NUM_ALGORITHMS 6 // Tree/Ring/CollNet*
 #define NCCL_ALGO_UNDEF -1
@@ -75,8 +75,39 @@ typedef struct {
   ncclResult_t (*destroy)(void* context);
 } ncclTuner_v2_t;
 
-typedef ncclTuner_v2_t ncclTuner_t;
+#define NCCL_ALGO_PROTO_IGNORE -1.0
 
-#define NCCL_TUNER_PLUGIN_SYMBOL "ncclTunerPlugin_v2"
+// v3 passes the cost table of NCCL's model and reports measured durations,
+// see src/include/nccl_tuner.h for details.
+typedef struct {
+  const char* name;
+  ncclResult_t (*init)(size_t nRanks, size_t nNodes, ncclDebugLogger_t logFunction, void **context);
+  // collCostTable is a numAlgo x numProto row-major table of predicted times in us
+  ncclResult_t (*getCollInfo)(void* context, ncclFunc_t collType, size_t nBytes, int numPipeOps,
+                              float* collCostTable, int numAlgo, int numProto, int* nChannels);
+  // Measured kernel duration in us of a collective run with the given configuration
+  ncclResult_t (*collComplete)(void* context, ncclFunc_t collType, size_t nBytes,
+                               int algorithm, int protocol, int nChannels, float duration);
+  ncclResult_t (*destroy)(void* context);
+} ncclTuner_v3_t;
+
+// v4 lets the plugin set the chunk size once algorithm, protocol and channels
+// are chosen, see src/include/nccl_tuner.h for details.
+typedef struct {
+  const char* name;
+  ncclResult_t (*init)(size_t nRanks, size_t nNodes, ncclDebugLogger_t logFunction, void **context);
+  ncclResult_t (*getCollInfo)(void* context, ncclFunc_t collType, size_t nBytes, int numPipeOps,
+                              float* collCostTable, int numAlgo, int numProto, int* nChannels);
+  ncclResult_t (*collComplete)(void* context, ncclFunc_t collType, size_t nBytes,
+                               int algorithm, int protocol, int nChannels, float duration);
+  // chunkSize holds NCCL's choice in bytes on input, may be NULL
+  ncclResult_t (*getChunkSize)(void* context, ncclFunc_t collType, size_t nBytes,
+                               int algorithm, int protocol, int nChannels, size_t* chunkSize);
+  ncclResult_t (*destroy)(void* context);
+} ncclTuner_v4_t;
+
+typedef ncclTuner_v4_t ncclTuner_t;
+
+#define NCCL_TUNER_PLUGIN_SYMBOL "ncclTunerPlugin_v4"
 
 #endif
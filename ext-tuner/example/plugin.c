@@ -6,21 +6,315 @@
 
 #include "tuner.h"
 
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
 #define __hidden __attribute__ ((visibility("hidden")))
 
-__hidden ncclResult_t pluginInit(size_t nRanks, size_t nNodes, ncclDebugLogger_t logFunction, void **context) { return ncclSuccess; }
+/* Table-driven tuner. NCCL_TUNER_CONFIG_FILE points to a CSV file, reloaded
+ * when it changes (checked at most once per second), with three kinds of lines:
+ *
+ *   rule,<coll>,<minBytes>,<maxBytes>,<nNodes>,<nRanks>,<algo>,<proto>,<nChannels>
+ *     Force algo/proto (and nChannels, -1 to let NCCL pick) for collectives of
+ *     minBytes <= nBytes <= maxBytes. The first matching rule wins.
+ *   point,<coll>,<nBytes>,<nNodes>,<nRanks>,<algo>,<proto>,<timeUs>
+ *     Measured time of a configuration. Costs are interpolated between points
+ *     in log2(nBytes), kept flat below the first point and scaled with nBytes
+ *     above the last one, then replace NCCL's own estimate for that algo/proto.
+ *   chunk,<coll>,<minBytes>,<maxBytes>,<nNodes>,<nRanks>,<algo>,<proto>,<chunkSize>
+ *     Chunk size in bytes of collectives of minBytes <= nBytes <= maxBytes run
+ *     with algo/proto. The first matching line wins.
+ *
+ * coll is broadcast, reduce, allgather, reducescatter or allreduce. algo is
+ * tree, ring, collnet_direct, collnet_chain, nvls or nvls_tree. proto is ll,
+ * ll128 or simple. nNodes and nRanks may be -1 to match any communicator, and
+ * '#' starts a comment.
+ *
+ * NCCL_TUNER_DUMP_FILE appends, once per collective and power of two size, the
+ * cost table NCCL computed as point lines. The output is a starting point for a
+ * config file.
+ */
+
+static const char* collNames[NCCL_NUM_FUNCTIONS] = { "broadcast", "reduce", "allgather", "reducescatter", "allreduce" };
+static const char* algoNames[NCCL_NUM_ALGORITHMS] = { "tree", "ring", "collnet_direct", "collnet_chain", "nvls", "nvls_tree" };
+static const char* protoNames[NCCL_NUM_PROTOCOLS] = { "ll", "ll128", "simple" };
+
+#define WARN(...) if (ctx->logFunction) ctx->logFunction(NCCL_LOG_WARN, NCCL_ALL, __FILE__, __LINE__, __VA_ARGS__)
+#define INFO(FLAGS, ...) if (ctx->logFunction) ctx->logFunction(NCCL_LOG_INFO, (FLAGS), __func__, __LINE__, __VA_ARGS__)
+
+struct tunerRule {
+  int coll;
+  size_t minBytes, maxBytes;
+  int nNodes, nRanks;
+  int algo, proto, nChannels;
+};
+
+struct tunerChunk {
+  int coll;
+  size_t minBytes, maxBytes;
+  int algo, proto;
+  size_t chunkSize;
+};
+
+struct tunerPoint {
+  int coll;
+  size_t nBytes;
+  int nNodes, nRanks;
+  int algo, proto;
+  float time;
+};
+
+struct tunerContext {
+  size_t nRanks, nNodes;
+  ncclDebugLogger_t logFunction;
+  const char* configFile;
+  time_t configMtime;
+  time_t lastCheck;
+  struct tunerRule* rules;
+  int nRules;
+  struct tunerPoint* points; // Sorted by coll, algo, proto, nBytes
+  int nPoints;
+  struct tunerChunk* chunks;
+  int nChunks;
+  FILE* dumpFile;
+  uint64_t dumped[NCCL_NUM_FUNCTIONS]; // Power of two sizes already dumped
+};
+
+static int lookup(const char** names, int n, const char* str) {
+  for (int i=0; i<n; i++) if (strcmp(names[i], str) == 0) return i;
+  return -1;
+}
+
+static int pointCompare(const void* a, const void* b) {
+  const struct tunerPoint* p = (const struct tunerPoint*)a;
+  const struct tunerPoint* q = (const struct tunerPoint*)b;
+  if (p->coll != q->coll) return p->coll - q->coll;
+  if (p->algo != q->algo) return p->algo - q->algo;
+  if (p->proto != q->proto) return p->proto - q->proto;
+  return p->nBytes < q->nBytes ? -1 : p->nBytes > q->nBytes;
+}
+
+static int matchComm(struct tunerContext* ctx, int nNodes, int nRanks) {
+  return (nNodes == -1 || nNodes == (int)ctx->nNodes) && (nRanks == -1 || nRanks == (int)ctx->nRanks);
+}
+
+// Parse the config file, keeping the lines that apply to this communicator.
+// On any error the previous tables are kept.
+static ncclResult_t loadConfig(struct tunerContext* ctx) {
+  FILE* f = fopen(ctx->configFile, "r");
+  if (f == NULL) {
+    WARN("TUNER/Example: cannot open %s : %s", ctx->configFile, strerror(errno));
+    return ncclSystemError;
+  }
+  struct tunerRule* rules = NULL;
+  struct tunerPoint* points = NULL;
+  struct tunerChunk* chunks = NULL;
+  int nRules = 0, nPoints = 0, nChunks = 0;
+  char line[1024];
+  int lineNo = 0;
+  ncclResult_t ret = ncclSuccess;
+  while (fgets(line, sizeof(line), f)) {
+    lineNo++;
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    char kind[16], coll[32], algo[32], proto[32];
+    unsigned long long minBytes, maxBytes, chunkSize;
+    int nNodes, nRanks, nChannels;
+    float time;
+    if (sscanf(line, " %15[a-z]", kind) != 1) continue; // Empty line
+    int c, a, p;
+    if (strcmp(kind, "rule") == 0 &&
+        sscanf(line, " rule , %31[a-z] , %llu , %llu , %d , %d , %31[a-z_] , %31[a-z0-9] , %d",
+               coll, &minBytes, &maxBytes, &nNodes, &nRanks, algo, proto, &nChannels) == 8 &&
+        (c = lookup(collNames, NCCL_NUM_FUNCTIONS, coll)) >= 0 &&
+        (a = lookup(algoNames, NCCL_NUM_ALGORITHMS, algo)) >= 0 &&
+        (p = lookup(protoNames, NCCL_NUM_PROTOCOLS, proto)) >= 0) {
+      if (!matchComm(ctx, nNodes, nRanks)) continue;
+      struct tunerRule* r = (struct tunerRule*)realloc(rules, (nRules+1)*sizeof(struct tunerRule));
+      if (r == NULL) { ret = ncclSystemError; break; }
+      rules = r;
+      rules[nRules++] = (struct tunerRule){ c, minBytes, maxBytes, nNodes, nRanks, a, p, nChannels };
+    } else if (strcmp(kind, "point") == 0 &&
+        sscanf(line, " point , %31[a-z] , %llu , %d , %d , %31[a-z_] , %31[a-z0-9] , %f",
+               coll, &minBytes, &nNodes, &nRanks, algo, proto, &time) == 7 &&
+        (c = lookup(collNames, NCCL_NUM_FUNCTIONS, coll)) >= 0 &&
+        (a = lookup(algoNames, NCCL_NUM_ALGORITHMS, algo)) >= 0 &&
+        (p = lookup(protoNames, NCCL_NUM_PROTOCOLS, proto)) >= 0) {
+      if (!matchComm(ctx, nNodes, nRanks)) continue;
+      struct tunerPoint* q = (struct tunerPoint*)realloc(points, (nPoints+1)*sizeof(struct tunerPoint));
+      if (q == NULL) { ret = ncclSystemError; break; }
+      points = q;
+      points[nPoints++] = (struct tunerPoint){ c, minBytes, nNodes, nRanks, a, p, time };
+    } else if (strcmp(kind, "chunk") == 0 &&
+        sscanf(line, " chunk , %31[a-z] , %llu , %llu , %d , %d , %31[a-z_] , %31[a-z0-9] , %llu",
+               coll, &minBytes, &maxBytes, &nNodes, &nRanks, algo, proto, &chunkSize) == 8 &&
+        (c = lookup(collNames, NCCL_NUM_FUNCTIONS, coll)) >= 0 &&
+        (a = lookup(algoNames, NCCL_NUM_ALGORITHMS, algo)) >= 0 &&
+        (p = lookup(protoNames, NCCL_NUM_PROTOCOLS, proto)) >= 0) {
+      if (!matchComm(ctx, nNodes, nRanks)) continue;
+      struct tunerChunk* k = (struct tunerChunk*)realloc(chunks, (nChunks+1)*sizeof(struct tunerChunk));
+      if (k == NULL) { ret = ncclSystemError; break; }
+      chunks = k;
+      chunks[nChunks++] = (struct tunerChunk){ c, minBytes, maxBytes, a, p, chunkSize };
+    } else {
+      WARN("TUNER/Example: %s:%d: cannot parse '%s'", ctx->configFile, lineNo, line);
+      ret = ncclInvalidArgument;
+      break;
+    }
+  }
+  fclose(f);
+  if (ret != ncclSuccess) {
+    free(rules);
+    free(points);
+    free(chunks);
+    return ret;
+  }
+  qsort(points, nPoints, sizeof(struct tunerPoint), pointCompare);
+  free(ctx->rules);
+  free(ctx->points);
+  free(ctx->chunks);
+  ctx->rules = rules;
+  ctx->nRules = nRules;
+  ctx->points = points;
+  ctx->nPoints = nPoints;
+  ctx->chunks = chunks;
+  ctx->nChunks = nChunks;
+  INFO(NCCL_TUNING, "TUNER/Example: loaded %d rules, %d points and %d chunk sizes from %s", nRules, nPoints, nChunks, ctx->configFile);
+  return ncclSuccess;
+}
+
+static void checkReload(struct tunerContext* ctx) {
+  time_t now = time(NULL);
+  if (now == ctx->lastCheck) return;
+  ctx->lastCheck = now;
+  struct stat st;
+  if (stat(ctx->configFile, &st) != 0 || st.st_mtime == ctx->configMtime) return;
+  // Keep serving the old tables if the new file does not parse
+  if (loadConfig(ctx) == ncclSuccess) ctx->configMtime = st.st_mtime;
+}
+
+// Cost of a configuration from the measured points, negative if there are none
+static float interpolate(struct tunerContext* ctx, int coll, int algo, int proto, size_t nBytes) {
+  const struct tunerPoint* lo = NULL;
+  const struct tunerPoint* hi = NULL;
+  for (int i=0; i<ctx->nPoints; i++) {
+    const struct tunerPoint* p = ctx->points+i;
+    if (p->coll != coll || p->algo != algo || p->proto != proto) continue;
+    if (p->nBytes <= nBytes) lo = p;
+    else if (hi == NULL) hi = p;
+  }
+  if (lo == NULL && hi == NULL) return -1;
+  if (hi == NULL) return lo->nBytes ? lo->time * nBytes / lo->nBytes : lo->time;
+  if (lo == NULL || lo->nBytes == 0) return hi->time;
+  float x = (log2f(nBytes) - log2f(lo->nBytes)) / (log2f(hi->nBytes) - log2f(lo->nBytes));
+  return lo->time + x * (hi->time - lo->time);
+}
+
+static void dumpCosts(struct tunerContext* ctx, ncclFunc_t collType, size_t nBytes, float* collCostTable, int numAlgo, int numProto) {
+  int log2Bytes = 0;
+  while (log2Bytes < 63 && (1ULL << (log2Bytes+1)) <= nBytes) log2Bytes++;
+  if (ctx->dumped[collType] & (1ULL << log2Bytes)) return;
+  ctx->dumped[collType] |= 1ULL << log2Bytes;
+  for (int a=0; a<numAlgo && a<NCCL_NUM_ALGORITHMS; a++) {
+    for (int p=0; p<numProto && p<NCCL_NUM_PROTOCOLS; p++) {
+      float time = collCostTable[a*numProto+p];
+      if (time == NCCL_ALGO_PROTO_IGNORE) continue;
+      fprintf(ctx->dumpFile, "point,%s,%zu,%zu,%zu,%s,%s,%g\n", collNames[collType], nBytes, ctx->nNodes, ctx->nRanks,
+              algoNames[a], protoNames[p], time);
+    }
+  }
+  fflush(ctx->dumpFile);
+}
+
+__hidden ncclResult_t pluginInit(size_t nRanks, size_t nNodes, ncclDebugLogger_t logFunction, void **context) {
+  struct tunerContext* ctx = (struct tunerContext*)calloc(1, sizeof(struct tunerContext));
+  if (ctx == NULL) return ncclSystemError;
+  ctx->nRanks = nRanks;
+  ctx->nNodes = nNodes;
+  ctx->logFunction = logFunction;
+  ctx->configFile = getenv("NCCL_TUNER_CONFIG_FILE");
+  if (ctx->configFile) {
+    struct stat st;
+    if (stat(ctx->configFile, &st) == 0) ctx->configMtime = st.st_mtime;
+    if (loadConfig(ctx) != ncclSuccess) INFO(NCCL_TUNING, "TUNER/Example: using NCCL's defaults until %s loads", ctx->configFile);
+  }
+  const char* dumpName = getenv("NCCL_TUNER_DUMP_FILE");
+  if (dumpName) {
+    ctx->dumpFile = fopen(dumpName, "a");
+    if (ctx->dumpFile == NULL) WARN("TUNER/Example: cannot open %s : %s", dumpName, strerror(errno));
+  }
+  *context = ctx;
+  return ncclSuccess;
+}
+
+__hidden ncclResult_t pluginGetCollInfo(void* context, ncclFunc_t collType, size_t nBytes, int numPipeOps,
+                              float* collCostTable, int numAlgo, int numProto, int* nChannels) {
+  struct tunerContext* ctx = (struct tunerContext*)context;
+  if (collType >= NCCL_NUM_FUNCTIONS) return ncclSuccess;
+  if (ctx->dumpFile) dumpCosts(ctx, collType, nBytes, collCostTable, numAlgo, numProto);
+  if (ctx->configFile) checkReload(ctx);
+
+  for (int i=0; i<ctx->nRules; i++) {
+    struct tunerRule* r = ctx->rules+i;
+    if (r->coll != (int)collType || nBytes < r->minBytes || nBytes > r->maxBytes) continue;
+    if (r->algo >= numAlgo || r->proto >= numProto) continue;
+    float* cost = collCostTable + r->algo*numProto + r->proto;
+    if (*cost == NCCL_ALGO_PROTO_IGNORE) continue; // Not available on this communicator
+    *cost = 0.0;
+    if (r->nChannels > 0) *nChannels = r->nChannels;
+    return ncclSuccess;
+  }
+
+  for (int a=0; a<numAlgo && a<NCCL_NUM_ALGORITHMS; a++) {
+    for (int p=0; p<numProto && p<NCCL_NUM_PROTOCOLS; p++) {
+      float* cost = collCostTable + a*numProto + p;
+      if (*cost == NCCL_ALGO_PROTO_IGNORE) continue;
+      float time = interpolate(ctx, collType, a, p, nBytes);
+      if (time >= 0) *cost = time;
+    }
+  }
+  return ncclSuccess;
+}
+
+__hidden ncclResult_t pluginCollComplete(void* context, ncclFunc_t collType, size_t nBytes,
+                              int algorithm, int protocol, int nChannels, float duration) { return ncclSuccess; }
 
-__hidden ncclResult_t pluginGetCollInfo(void* context, ncclFunc_t collType, size_t nBytes,
-                              int collNetSupport, int nvlsSupport, int numPipeOps,
-                              int *algorithm, int *protocol, int* nChannels) { *algorithm = NCCL_ALGO_RING; *protocol = NCCL_PROTO_SIMPLE; return ncclSuccess; }
+__hidden ncclResult_t pluginGetChunkSize(void* context, ncclFunc_t collType, size_t nBytes,
+                              int algorithm, int protocol, int nChannels, size_t* chunkSize) {
+  struct tunerContext* ctx = (struct tunerContext*)context;
+  for (int i=0; i<ctx->nChunks; i++) {
+    struct tunerChunk* k = ctx->chunks+i;
+    if (k->coll != (int)collType || k->algo != algorithm || k->proto != protocol) continue;
+    if (nBytes < k->minBytes || nBytes > k->maxBytes) continue;
+    *chunkSize = k->chunkSize;
+    break;
+  }
+  return ncclSuccess;
+}
 
-__hidden ncclResult_t pluginDestroy(void* context) { return ncclSuccess; }
+__hidden ncclResult_t pluginDestroy(void* context) {
+  struct tunerContext* ctx = (struct tunerContext*)context;
+  if (ctx == NULL) return ncclSuccess;
+  if (ctx->dumpFile) fclose(ctx->dumpFile);
+  free(ctx->rules);
+  free(ctx->points);
+  free(ctx->chunks);
+  free(ctx);
+  return ncclSuccess;
+}
 
 #define PLUGIN_NAME "Example"
 
-const ncclTuner_v2_t ncclTunerPlugin_v2 = {
+const ncclTuner_v4_t ncclTunerPlugin_v4 = {
   .name = PLUGIN_NAME,
   .init = pluginInit,
   .getCollInfo = pluginGetCollInfo,
+  .collComplete = pluginCollComplete,
+  .getChunkSize = pluginGetChunkSize,
   .destroy = pluginDestroy
 };
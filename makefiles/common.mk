@@ -12,6 +12,7 @@ DEBUG ?= 0
 ASAN ?= 0
 TRACE ?= 0
 PROFAPI ?= 1
+DEVPROFILE ?= 0
 NVTX ?= 1
 RDMA_CORE ?= 0
 
@@ -116,6 +117,11 @@ ifneq ($(PROFAPI), 0)
 CXXFLAGS += -DPROFAPI
 endif
 
+ifneq ($(DEVPROFILE), 0)
+CXXFLAGS  += -DENABLE_DEVICE_PROFILE
+NVCUFLAGS += -DENABLE_DEVICE_PROFILE
+endif
+
 ifneq ($(RDMA_CORE), 0)
 CXXFLAGS += -DNCCL_BUILD_RDMA_CORE=1
 endif
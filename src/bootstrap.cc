@@ -11,8 +11,13 @@
 #include "net.h"
 #include <unistd.h>
 #include <sys/types.h>
+#include <poll.h>
+#include <climits>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "proxy.h"
 #include "param.h"
+#include "shm.h"
 
 struct bootstrapRootArgs {
   struct ncclSocket* listenSock;
@@ -91,9 +96,64 @@ static ncclResult_t bootstrapNetSendRecv(struct ncclSocket* sendSock, void* send
   return ncclSuccess;
 }
 
+// Scalable mode: the root hands the address table down a tree of ranks
+// instead of contacting each rank, and allgathers use the Bruck algorithm
+// (log(nranks) steps) instead of the ring. -1 enables it from
+// NCCL_BOOTSTRAP_SCALABLE_NRANKS ranks.
+NCCL_PARAM(BootstrapScalable, "BOOTSTRAP_SCALABLE", -1);
+NCCL_PARAM(BootstrapScalableNranks, "BOOTSTRAP_SCALABLE_NRANKS", 1024);
+#define BOOTSTRAP_TREE_ARITY 8
+#define BOOTSTRAP_TAG_BRUCK (-16)
+
+static int bootstrapScalable(int nranks) {
+  int mode = ncclParamBootstrapScalable();
+  if (mode == -1) return nranks >= ncclParamBootstrapScalableNranks() ? 1 : 0;
+  return mode ? 1 : 0;
+}
+
+// Children of a rank in the distribution tree, among the ranks of its root.
+// The root is the parent of ranks 0 to BOOTSTRAP_TREE_ARITY-1, so it is given
+// rank -1.
+static int bootstrapTreeChild(int rank, int c) {
+  return (rank+1)*BOOTSTRAP_TREE_ARITY + c;
+}
+
+// With several unique IDs (ncclCommInitRankScalable), ranks are spread over
+// the roots in contiguous blocks. Each root collects the handles of its ranks
+// and the roots form a tree (root 0 on top): blocks are gathered up to root 0,
+// the whole table is sent back down, then each root distributes it to its
+// ranks as usual. A root only talks to its parent and children, so the load of
+// each root stays flat as the number of roots grows.
+static int bootstrapRootFirstRank(int root, int nranks, int nroots) {
+  return (int)((int64_t)root*nranks/nroots);
+}
+static int bootstrapRankRoot(int rank, int nranks, int nroots) {
+  return (int)((((int64_t)rank+1)*nroots-1)/nranks);
+}
+static int bootstrapRootChild(int root, int c) {
+  return root*BOOTSTRAP_TREE_ARITY + 1 + c;
+}
+static int bootstrapRootSubtreeSize(int root, int nroots) {
+  int size = 1;
+  for (int c=0; c<BOOTSTRAP_TREE_ARITY && bootstrapRootChild(root, c)<nroots; c++) {
+    size += bootstrapRootSubtreeSize(bootstrapRootChild(root, c), nroots);
+  }
+  return size;
+}
+
+// Messages between roots carry an extInfo with a negative rank
+#define BOOTSTRAP_ROOT_BLOCK (-1) // handles of the ranks of root info.root, going up
+#define BOOTSTRAP_ROOT_TABLE (-2) // all handles, going down
+
 struct extInfo {
   int rank;
   int nranks;
+  int scalable;
+  int nroots;
+  int root; // root of the rank, or root of the block
+  // Roots next to ours in the tree of roots: parent, then children
+  uint64_t rootMagics[1+BOOTSTRAP_TREE_ARITY];
+  union ncclSocketAddress rootAddresses[1+BOOTSTRAP_TREE_ARITY];
   union ncclSocketAddress extAddressListenRoot;
   union ncclSocketAddress extAddressListen;
 };
@@ -108,16 +168,42 @@ static ncclResult_t setFilesLimit() {
   return ncclSuccess;
 }
 
+// Sends the handles of the ranks of root block (BOOTSTRAP_ROOT_BLOCK) or all
+// of them (BOOTSTRAP_ROOT_TABLE) to the root at rootAddresses[peer] in info
+static ncclResult_t bootstrapRootSend(struct extInfo* info, int peer, int type, int block, union ncclSocketAddress* rankAddresses) {
+  int nranks = info->nranks, nroots = info->nroots;
+  struct extInfo header = *info;
+  struct ncclSocket sock;
+  header.rank = type;
+  header.root = block;
+  NCCLCHECK(ncclSocketInit(&sock, info->rootAddresses+peer, info->rootMagics[peer], ncclSocketTypeBootstrap));
+  NCCLCHECK(ncclSocketConnect(&sock));
+  NCCLCHECK(bootstrapNetSend(&sock, &header, sizeof(header)));
+  if (type == BOOTSTRAP_ROOT_TABLE) {
+    NCCLCHECK(bootstrapNetSend(&sock, rankAddresses, 2*nranks*sizeof(union ncclSocketAddress)));
+  } else {
+    int first = bootstrapRootFirstRank(block, nranks, nroots);
+    int count = bootstrapRootFirstRank(block+1, nranks, nroots) - first;
+    NCCLCHECK(bootstrapNetSend(&sock, rankAddresses+first, count*sizeof(union ncclSocketAddress)));
+    NCCLCHECK(bootstrapNetSend(&sock, rankAddresses+nranks+first, count*sizeof(union ncclSocketAddress)));
+  }
+  NCCLCHECK(ncclSocketClose(&sock));
+  return ncclSuccess;
+}
+
 static void *bootstrapRoot(void* rargs) {
   struct bootstrapRootArgs* args = (struct bootstrapRootArgs*)rargs;
   struct ncclSocket* listenSock = args->listenSock;
   uint64_t magic = args->magic;
   ncclResult_t res = ncclSuccess;
-  int nranks = 0, c = 0;
-  struct extInfo info;
+  int nranks = 0, c = 0, scalable = 0, nroots = 1, root = -1, first = 0, count = 0;
+  int nBlocks = 0, nSubtree = 1; // blocks received from the roots below us
+  bool started = false, haveTable = false;
+  struct extInfo info, rootInfo;
   union ncclSocketAddress *rankAddresses = NULL;
   union ncclSocketAddress *rankAddressesRoot = NULL; // for initial rank <-> root information exchange
   union ncclSocketAddress *zero = NULL;
+  bool* pending = NULL; // blocks to pass on to our parent
   NCCLCHECKGOTO(ncclCalloc(&zero, 1), res, out);
   setFilesLimit();
 
@@ -128,41 +214,107 @@ static void *bootstrapRoot(void* rargs) {
     NCCLCHECKGOTO(ncclSocketInit(&sock), res, out);
     NCCLCHECKGOTO(ncclSocketAccept(&sock, listenSock), res, out);
     NCCLCHECKGOTO(bootstrapNetRecv(&sock, &info, sizeof(info)), res, out);
-    NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
 
-    if (c == 0) {
+    if (!started) {
       nranks = info.nranks;
-      NCCLCHECKGOTO(ncclCalloc(&rankAddresses, nranks), res, out);
-      NCCLCHECKGOTO(ncclCalloc(&rankAddressesRoot, nranks), res, out);
+      scalable = info.scalable;
+      nroots = info.nroots;
+      // Both tables are sent together in scalable mode
+      NCCLCHECKGOTO(ncclCalloc(&rankAddresses, 2*nranks), res, out);
+      rankAddressesRoot = rankAddresses+nranks;
+      NCCLCHECKGOTO(ncclCalloc(&pending, nroots), res, out);
+      started = true;
     }
 
-    if (nranks != info.nranks) {
-      WARN("Bootstrap Root : mismatch in rank count from procs %d : %d", nranks, info.nranks);
+    if (nranks != info.nranks || nroots != info.nroots) {
+      WARN("Bootstrap Root : mismatch in rank count from procs %d : %d or in root count %d : %d", nranks, info.nranks, nroots, info.nroots);
+      ncclSocketClose(&sock);
       goto out;
     }
 
-    if (memcmp(zero, &rankAddressesRoot[info.rank], sizeof(union ncclSocketAddress)) != 0) {
-      WARN("Bootstrap Root : rank %d of %d ranks has already checked in", info.rank, nranks);
+    if (scalable != info.scalable) {
+      WARN("Bootstrap Root : rank %d uses a different bootstrap mode, check NCCL_BOOTSTRAP_SCALABLE", info.rank);
+      ncclSocketClose(&sock);
       goto out;
     }
 
-    // Save the connection handle for that rank
-    memcpy(rankAddressesRoot+info.rank, &info.extAddressListenRoot, sizeof(union ncclSocketAddress));
-    memcpy(rankAddresses+info.rank, &info.extAddressListen, sizeof(union ncclSocketAddress));
+    if (info.rank == BOOTSTRAP_ROOT_TABLE) {
+      NCCLCHECKGOTO(bootstrapNetRecv(&sock, rankAddresses, 2*nranks*sizeof(union ncclSocketAddress)), res, out);
+      NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+      haveTable = true;
+      continue;
+    }
+    if (info.rank == BOOTSTRAP_ROOT_BLOCK) {
+      int bFirst = bootstrapRootFirstRank(info.root, nranks, nroots);
+      int bCount = bootstrapRootFirstRank(info.root+1, nranks, nroots) - bFirst;
+      NCCLCHECKGOTO(bootstrapNetRecv(&sock, rankAddresses+bFirst, bCount*sizeof(union ncclSocketAddress)), res, out);
+      NCCLCHECKGOTO(bootstrapNetRecv(&sock, rankAddressesRoot+bFirst, bCount*sizeof(union ncclSocketAddress)), res, out);
+      NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+      pending[info.root] = true;
+      ++nBlocks;
+      TRACE(NCCL_INIT, "Received block of root %d", info.root);
+    } else {
+      NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+      if (root == -1) {
+        root = info.root;
+        first = bootstrapRootFirstRank(root, nranks, nroots);
+        count = bootstrapRootFirstRank(root+1, nranks, nroots) - first;
+        nSubtree = bootstrapRootSubtreeSize(root, nroots);
+        rootInfo = info;
+      }
+
+      if (info.root != root) {
+        WARN("Bootstrap Root : rank %d belongs to root %d, not %d", info.rank, info.root, root);
+        goto out;
+      }
+
+      if (memcmp(zero, &rankAddressesRoot[info.rank], sizeof(union ncclSocketAddress)) != 0) {
+        WARN("Bootstrap Root : rank %d of %d ranks has already checked in", info.rank, nranks);
+        goto out;
+      }
+
+      // Save the connection handle for that rank
+      memcpy(rankAddressesRoot+info.rank, &info.extAddressListenRoot, sizeof(union ncclSocketAddress));
+      memcpy(rankAddresses+info.rank, &info.extAddressListen, sizeof(union ncclSocketAddress));
+
+      ++c;
+      TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info.rank, c, count);
+      if (c == count) pending[root] = true;
+    }
 
-    ++c;
-    TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info.rank, c, nranks);
-  } while (c < nranks);
+    // Pass blocks up as they come, our parent only waits for them
+    if (root > 0) {
+      for (int b=0; b<nroots; b++) {
+        if (pending[b]) NCCLCHECKGOTO(bootstrapRootSend(&rootInfo, 0, BOOTSTRAP_ROOT_BLOCK, b, rankAddresses), res, out);
+        pending[b] = false;
+      }
+    }
+  } while (root == -1 || c < count || nBlocks < nSubtree-1 || (root > 0 && !haveTable));
   TRACE(NCCL_INIT, "COLLECTED ALL %d HANDLES", nranks);
 
-  // Send the connect handle for the next rank in the AllGather ring
-  for (int r=0; r<nranks; ++r) {
-    int next = (r+1) % nranks;
-    struct ncclSocket sock;
-    NCCLCHECKGOTO(ncclSocketInit(&sock, rankAddressesRoot+r, magic, ncclSocketTypeBootstrap), res, out);
-    NCCLCHECKGOTO(ncclSocketConnect(&sock), res, out);
-    NCCLCHECKGOTO(bootstrapNetSend(&sock, rankAddresses+next, sizeof(union ncclSocketAddress)), res, out);
-    NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+  for (int r=0; r<BOOTSTRAP_TREE_ARITY && bootstrapRootChild(root, r)<nroots; ++r) {
+    NCCLCHECKGOTO(bootstrapRootSend(&rootInfo, 1+r, BOOTSTRAP_ROOT_TABLE, 0, rankAddresses), res, out);
+  }
+
+  if (scalable) {
+    // Send all handles to the top of the tree, ranks will forward them
+    for (int r=0; r<BOOTSTRAP_TREE_ARITY && r<count; ++r) {
+      struct ncclSocket sock;
+      NCCLCHECKGOTO(ncclSocketInit(&sock, rankAddressesRoot+first+r, magic, ncclSocketTypeBootstrap), res, out);
+      NCCLCHECKGOTO(ncclSocketConnect(&sock), res, out);
+      NCCLCHECKGOTO(bootstrapNetSend(&sock, rankAddresses, 2*nranks*sizeof(union ncclSocketAddress)), res, out);
+      NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+    }
+  } else {
+    // Send the connect handle for the next rank in the AllGather ring
+    for (int r=0; r<nranks; ++r) {
+      int next = (r+1) % nranks;
+      struct ncclSocket sock;
+      NCCLCHECKGOTO(ncclSocketInit(&sock, rankAddressesRoot+r, magic, ncclSocketTypeBootstrap), res, out);
+      NCCLCHECKGOTO(ncclSocketConnect(&sock), res, out);
+      NCCLCHECKGOTO(bootstrapNetSend(&sock, rankAddresses+next, sizeof(union ncclSocketAddress)), res, out);
+      NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+    }
   }
   TRACE(NCCL_INIT, "SENT OUT ALL %d HANDLES", nranks);
 
@@ -172,8 +324,8 @@ out:
     free(listenSock);
   }
   if (rankAddresses) free(rankAddresses);
-  if (rankAddressesRoot) free(rankAddressesRoot);
   if (zero) free(zero);
+  free(pending);
   free(rargs);
 
   TRACE(NCCL_INIT, "DONE");
@@ -218,13 +370,37 @@ ncclResult_t bootstrapGetUniqueId(struct ncclBootstrapHandle* handle) {
   return ncclSuccess;
 }
 
+// Messages and connections that arrived before we asked for them are kept in
+// a mailbox hashed on (peer, tag), so large out of order bursts (e.g. during
+// init of large communicators) don't make each lookup scan all of them.
+// Messages carry their size and are read right away, which also closes their
+// socket instead of holding one fd per pending message.
+#define BOOTSTRAP_MAILBOX_BUCKETS 256
+// Connection header tag of a persistent peer socket, see bootstrapSend
+#define BOOTSTRAP_TAG_PERSISTENT INT_MIN
+
 struct unexConn {
   int peer;
   int tag;
+  int size; // -1 for a connection from bootstrapConnect, held in sock
+  void* data;
   struct ncclSocket sock;
   struct unexConn* next;
 };
 
+// Sent first on every connection, then before each message of a persistent
+// socket. size is -1 for bootstrapConnect streams.
+struct bootstrapHeader {
+  int peer;
+  int tag;
+  int size;
+};
+
+// Number of peers bootstrapSend keeps a persistent socket to, reusing it for
+// all messages to that peer instead of connecting for each of them. Each one
+// costs an fd on both sides for the lifetime of the communicator.
+NCCL_PARAM(BootstrapPeerSockets, "BOOTSTRAP_PEER_SOCKETS", 0);
+
 struct bootstrapState {
   struct ncclSocket listenSock;
   struct ncclSocket ringRecvSocket;
@@ -232,17 +408,32 @@ struct bootstrapState {
   union ncclSocketAddress* peerCommAddresses;
   union ncclSocketAddress* peerProxyAddresses;
   uint64_t* peerProxyAddressesUDS;
-  struct unexConn* unexpectedConnections;
+  struct unexConn* mailbox[BOOTSTRAP_MAILBOX_BUCKETS];
+  int nUnexpected;
+  struct ncclSocket** peerSendSockets; // persistent sockets, allocated on first use
+  struct ncclSocket** peerRecvSockets;
+  int nPeerSendSockets;
   int cudaDev;
   int rank;
   int nranks;
+  int scalable; // use the Bruck allgather, the ring sockets are unused
+  struct bootstrapShm* shm; // intra-node segment, NULL when not set up
+  ncclShmHandle_t shmHandle;
+  int* shmRanks;
+  int shmRank;
+  int shmNranks;
+  bool shmIdentity; // shmRanks[i] == i, so global collectives can use it too
   uint64_t magic;
   volatile uint32_t *abortFlag;
 };
 
-ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm* comm) {
+ncclResult_t bootstrapInit(int nHandles, struct ncclBootstrapHandle* handles, struct ncclComm* comm) {
   int rank = comm->rank;
   int nranks = comm->nRanks;
+  int root = bootstrapRankRoot(rank, nranks, nHandles);
+  int first = bootstrapRootFirstRank(root, nranks, nHandles);
+  int count = bootstrapRootFirstRank(root+1, nranks, nHandles) - first;
+  struct ncclBootstrapHandle* handle = handles+root;
   struct bootstrapState* state;
   struct ncclSocket* proxySocket;
   ncclSocketAddress nextAddr;
@@ -254,25 +445,38 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   state->nranks = nranks;
   state->abortFlag = comm->abortFlag;
   comm->bootstrap = state;
-  comm->magic = state->magic = handle->magic;
+  comm->magic = state->magic = handles[0].magic;
 
-  TRACE(NCCL_INIT, "rank %d nranks %d", rank, nranks);
+  TRACE(NCCL_INIT, "rank %d nranks %d root %d/%d", rank, nranks, root, nHandles);
 
   info.rank = rank;
   info.nranks = nranks;
+  // Only the tree distribution knows about several roots
+  info.scalable = nHandles > 1 ? 1 : bootstrapScalable(nranks);
+  info.nroots = nHandles;
+  info.root = root;
+  if (root > 0) {
+    info.rootMagics[0] = handles[(root-1)/BOOTSTRAP_TREE_ARITY].magic;
+    info.rootAddresses[0] = handles[(root-1)/BOOTSTRAP_TREE_ARITY].addr;
+  }
+  for (int c=0; c<BOOTSTRAP_TREE_ARITY && bootstrapRootChild(root, c)<nHandles; c++) {
+    info.rootMagics[1+c] = handles[bootstrapRootChild(root, c)].magic;
+    info.rootAddresses[1+c] = handles[bootstrapRootChild(root, c)].addr;
+  }
   // Create socket for other ranks to contact me
   NCCLCHECK(ncclSocketInit(&state->listenSock, &bootstrapNetIfAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
   NCCLCHECK(ncclSocketListen(&state->listenSock));
   NCCLCHECK(ncclSocketGetAddr(&state->listenSock, &info.extAddressListen));
 
-  // Create socket for root to contact me
-  NCCLCHECK(ncclSocketInit(&listenSockRoot, &bootstrapNetIfAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
+  // Create socket for root to contact me, with the magic of our root
+  NCCLCHECK(ncclSocketInit(&listenSockRoot, &bootstrapNetIfAddr, handle->magic, ncclSocketTypeBootstrap, comm->abortFlag));
   NCCLCHECK(ncclSocketListen(&listenSockRoot));
   NCCLCHECK(ncclSocketGetAddr(&listenSockRoot, &info.extAddressListenRoot));
 
-  // stagger connection times to avoid an overload of the root
-  if (nranks > 128) {
-    long msec = rank;
+  // stagger connection times to avoid an overload of the root. In scalable
+  // mode the root only has to accept, so we can go faster.
+  if (count > 128) {
+    long msec = info.scalable ? (rank-first)/16 : rank;
     struct timespec tv;
     tv.tv_sec = msec / 1000;
     tv.tv_nsec = 1000000 * (msec % 1000);
@@ -281,28 +485,50 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   }
 
   // send info on my listening socket to root
-  NCCLCHECK(ncclSocketInit(&sock, &handle->addr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
+  NCCLCHECK(ncclSocketInit(&sock, &handle->addr, handle->magic, ncclSocketTypeBootstrap, comm->abortFlag));
   NCCLCHECK(ncclSocketConnect(&sock));
   NCCLCHECK(bootstrapNetSend(&sock, &info, sizeof(info)));
   NCCLCHECK(ncclSocketClose(&sock));
 
-  // get info on my "next" rank in the bootstrap ring from root
-  NCCLCHECK(ncclSocketInit(&sock));
-  NCCLCHECK(ncclSocketAccept(&sock, &listenSockRoot));
-  NCCLCHECK(bootstrapNetRecv(&sock, &nextAddr, sizeof(union ncclSocketAddress)));
-  NCCLCHECK(ncclSocketClose(&sock));
-  NCCLCHECK(ncclSocketClose(&listenSockRoot));
-
-  NCCLCHECK(ncclSocketInit(&state->ringSendSocket, &nextAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
-  NCCLCHECK(ncclSocketConnect(&state->ringSendSocket));
-  // Accept the connect request from the previous rank in the AllGather ring
-  NCCLCHECK(ncclSocketInit(&state->ringRecvSocket));
-  NCCLCHECK(ncclSocketAccept(&state->ringRecvSocket, &state->listenSock));
-
-  // AllGather all listen handlers
-  NCCLCHECK(ncclCalloc(&state->peerCommAddresses, nranks));
-  NCCLCHECK(ncclSocketGetAddr(&state->listenSock, state->peerCommAddresses+rank));
-  NCCLCHECK(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union ncclSocketAddress)));
+  if (info.scalable) {
+    // Get all listen handlers from our parent in the tree and pass them on
+    union ncclSocketAddress* addresses;
+    NCCLCHECK(ncclCalloc(&addresses, 2*nranks));
+    NCCLCHECK(ncclSocketInit(&sock));
+    NCCLCHECK(ncclSocketAccept(&sock, &listenSockRoot));
+    NCCLCHECK(bootstrapNetRecv(&sock, addresses, 2*nranks*sizeof(union ncclSocketAddress)));
+    NCCLCHECK(ncclSocketClose(&sock));
+    NCCLCHECK(ncclSocketClose(&listenSockRoot));
+    for (int c=0; c<BOOTSTRAP_TREE_ARITY && bootstrapTreeChild(rank-first, c)<count; c++) {
+      int child = first+bootstrapTreeChild(rank-first, c);
+      NCCLCHECK(ncclSocketInit(&sock, addresses+nranks+child, handle->magic, ncclSocketTypeBootstrap, comm->abortFlag));
+      NCCLCHECK(ncclSocketConnect(&sock));
+      NCCLCHECK(bootstrapNetSend(&sock, addresses, 2*nranks*sizeof(union ncclSocketAddress)));
+      NCCLCHECK(ncclSocketClose(&sock));
+    }
+    state->peerCommAddresses = addresses; // only the first nranks entries are used from now on
+    state->scalable = 1;
+    NCCLCHECK(ncclSocketInit(&state->ringSendSocket));
+    NCCLCHECK(ncclSocketInit(&state->ringRecvSocket));
+  } else {
+    // get info on my "next" rank in the bootstrap ring from root
+    NCCLCHECK(ncclSocketInit(&sock));
+    NCCLCHECK(ncclSocketAccept(&sock, &listenSockRoot));
+    NCCLCHECK(bootstrapNetRecv(&sock, &nextAddr, sizeof(union ncclSocketAddress)));
+    NCCLCHECK(ncclSocketClose(&sock));
+    NCCLCHECK(ncclSocketClose(&listenSockRoot));
+
+    NCCLCHECK(ncclSocketInit(&state->ringSendSocket, &nextAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
+    NCCLCHECK(ncclSocketConnect(&state->ringSendSocket));
+    // Accept the connect request from the previous rank in the AllGather ring
+    NCCLCHECK(ncclSocketInit(&state->ringRecvSocket));
+    NCCLCHECK(ncclSocketAccept(&state->ringRecvSocket, &state->listenSock));
+
+    // AllGather all listen handlers
+    NCCLCHECK(ncclCalloc(&state->peerCommAddresses, nranks));
+    NCCLCHECK(ncclSocketGetAddr(&state->listenSock, state->peerCommAddresses+rank));
+    NCCLCHECK(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union ncclSocketAddress)));
+  }
 
   // Create the service proxy
   NCCLCHECK(ncclCalloc(&state->peerProxyAddresses, nranks));
@@ -367,6 +593,8 @@ ncclResult_t bootstrapSplit(struct ncclBootstrapHandle* handle, struct ncclComm*
   NCCLCHECKGOTO(ncclCalloc(&state->peerCommAddresses, nranks), ret, fail);
   memcpy(state->peerCommAddresses+rank, &listenAddr, sizeof(union ncclSocketAddress));
   NCCLCHECKGOTO(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union ncclSocketAddress)), ret, fail);
+  // Now that we know everyone, later allgathers can skip the ring.
+  state->scalable = bootstrapScalable(nranks);
 
   if (parent->config.splitShare) {
     /* map local rank to top parent local rank. */
@@ -404,29 +632,64 @@ fail:
 //
 // We do not keep connections opened with all ranks at all times, and we have no guarantee
 // that connections to our unique listen socket will arrive in the same order as we need
-// them. Therefore, when establishing a connection, the sender sends a (peer, tag) tuple to
-// allow the receiver to identify the flow, and keep it in an unexpected queue if needed.
+// them. Therefore, when establishing a connection, the sender sends a (peer, tag, size)
+// header to allow the receiver to identify the flow, and keep it in the mailbox if needed.
 
 ncclResult_t bootstrapConnect(void* commState, int peer, int tag, struct ncclSocket* sock) {
   ncclResult_t ret = ncclSuccess;
   struct bootstrapState* state = (struct bootstrapState*)commState;
+  struct bootstrapHeader header = { state->rank, tag, -1 };
 
   NCCLCHECKGOTO(ncclSocketInit(sock, state->peerCommAddresses+peer, state->magic, ncclSocketTypeBootstrap), ret, fail);
   NCCLCHECKGOTO(ncclSocketConnect(sock), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(sock, &state->rank, sizeof(int)), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(sock, &tag, sizeof(int)), ret, fail);
+  NCCLCHECKGOTO(bootstrapNetSend(sock, &header, sizeof(header)), ret, fail);
   return ncclSuccess;
 fail:
   NCCLCHECK(ncclSocketClose(sock));
   return ret;
 }
 
+// Persistent socket to peer, or NULL once BOOTSTRAP_PEER_SOCKETS are in use
+static ncclResult_t bootstrapPeerSendSocket(struct bootstrapState* state, int peer, struct ncclSocket** sock) {
+  *sock = NULL;
+  if (state->peerSendSockets == NULL) {
+    if (ncclParamBootstrapPeerSockets() <= 0) return ncclSuccess;
+    NCCLCHECK(ncclCalloc(&state->peerSendSockets, state->nranks));
+  }
+  if (state->peerSendSockets[peer] == NULL && state->nPeerSendSockets < ncclParamBootstrapPeerSockets()) {
+    struct ncclSocket* newSock;
+    NCCLCHECK(ncclCalloc(&newSock, 1));
+    ncclResult_t ret = bootstrapConnect(state, peer, BOOTSTRAP_TAG_PERSISTENT, newSock);
+    if (ret != ncclSuccess) {
+      free(newSock);
+      return ret;
+    }
+    state->peerSendSockets[peer] = newSock;
+    state->nPeerSendSockets++;
+  }
+  *sock = state->peerSendSockets[peer];
+  return ncclSuccess;
+}
+
 ncclResult_t bootstrapSend(void* commState, int peer, int tag, void* data, int size) {
   ncclResult_t ret = ncclSuccess;
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  struct bootstrapHeader header = { state->rank, tag, size };
+  struct ncclSocket* peerSock;
   struct ncclSocket sock;
 
   TRACE(NCCL_BOOTSTRAP, "Sending to peer=%d tag=%d size=%d", peer, tag, size);
-  NCCLCHECK(bootstrapConnect(commState, peer, tag, &sock));
+  NCCLCHECK(bootstrapPeerSendSocket(state, peer, &peerSock));
+  if (peerSock) {
+    NCCLCHECK(bootstrapNetSend(peerSock, &header, sizeof(header)));
+    NCCLCHECK(bootstrapNetSend(peerSock, data, size));
+    TRACE(NCCL_BOOTSTRAP, "Sent to peer=%d tag=%d size=%d", peer, tag, size);
+    return ncclSuccess;
+  }
+
+  NCCLCHECK(ncclSocketInit(&sock, state->peerCommAddresses+peer, state->magic, ncclSocketTypeBootstrap));
+  NCCLCHECKGOTO(ncclSocketConnect(&sock), ret, exit);
+  NCCLCHECKGOTO(bootstrapNetSend(&sock, &header, sizeof(header)), ret, exit);
   NCCLCHECKGOTO(bootstrapNetSend(&sock, data, size), ret, exit);
 
   TRACE(NCCL_BOOTSTRAP, "Sent to peer=%d tag=%d size=%d", peer, tag, size);
@@ -436,78 +699,98 @@ exit:
   return ret;
 }
 
-ncclResult_t unexpectedEnqueue(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock) {
-  // New unex
+static int mailboxBucket(int peer, int tag) {
+  return (int)(((uint32_t)peer*2654435761u ^ (uint32_t)tag*40503u) % BOOTSTRAP_MAILBOX_BUCKETS);
+}
+
+// Appends to the bucket so entries with the same (peer, tag) come out in order
+static ncclResult_t mailboxEnqueue(struct bootstrapState* state, int peer, int tag, int size, void* data, struct ncclSocket* sock) {
   struct unexConn* unex;
   NCCLCHECK(ncclCalloc(&unex, 1));
   unex->peer = peer;
   unex->tag = tag;
-  memcpy(&unex->sock, sock, sizeof(struct ncclSocket));
+  unex->size = size;
+  unex->data = data;
+  if (sock) memcpy(&unex->sock, sock, sizeof(struct ncclSocket));
+
+  struct unexConn** list = state->mailbox+mailboxBucket(peer, tag);
+  while (*list) list = &(*list)->next;
+  *list = unex;
+  state->nUnexpected++;
+  return ncclSuccess;
+}
 
-  // Enqueue
-  struct unexConn* list = state->unexpectedConnections;
-  if (list == NULL) {
-    state->unexpectedConnections = unex;
-    return ncclSuccess;
+// First entry for (peer, tag), a connection if isConn or else a message
+static struct unexConn* mailboxDequeue(struct bootstrapState* state, int peer, int tag, bool isConn) {
+  for (struct unexConn** elem = state->mailbox+mailboxBucket(peer, tag); *elem; elem = &(*elem)->next) {
+    struct unexConn* unex = *elem;
+    if (unex->peer == peer && unex->tag == tag && (unex->size == -1) == isConn) {
+      *elem = unex->next;
+      state->nUnexpected--;
+      return unex;
+    }
   }
-  while (list->next) list = list->next;
-  list->next = unex;
-  return ncclSuccess;
+  return NULL;
 }
 
-ncclResult_t unexpectedDequeue(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock, int* found) {
-  struct unexConn* elem = state->unexpectedConnections;
-  struct unexConn* prev = NULL;
-  *found = 0;
-  while (elem) {
-    if (elem->peer == peer && elem->tag == tag) {
-      if (prev == NULL) {
-        state->unexpectedConnections = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      memcpy(sock, &elem->sock, sizeof(struct ncclSocket));
+static void mailboxFree(struct bootstrapState* state) {
+  for (int b=0; b<BOOTSTRAP_MAILBOX_BUCKETS; b++) {
+    struct unexConn* elem = state->mailbox[b];
+    while (elem) {
+      struct unexConn* next = elem->next;
+      if (elem->size == -1) ncclSocketClose(&elem->sock);
+      free(elem->data);
       free(elem);
-      *found = 1;
-      return ncclSuccess;
+      elem = next;
     }
-    prev = elem;
-    elem = elem->next;
+    state->mailbox[b] = NULL;
   }
-  return ncclSuccess;
+  state->nUnexpected = 0;
 }
 
-static void unexpectedFree(struct bootstrapState* state) {
-  struct unexConn* elem = state->unexpectedConnections;
-  struct unexConn* prev = NULL;
-
-  while (elem) {
-    prev = elem;
-    elem = elem->next;
-    free(prev);
+// Reads a message whose header was just received on sock into the mailbox
+static ncclResult_t mailboxRecvMessage(struct bootstrapState* state, struct ncclSocket* sock, struct bootstrapHeader* header) {
+  void* data = NULL;
+  if (header->size > 0) {
+    NCCLCHECK(ncclCalloc((char**)&data, header->size));
+    ncclResult_t ret = bootstrapNetRecv(sock, data, header->size);
+    if (ret != ncclSuccess) {
+      free(data);
+      return ret;
+    }
   }
-  return;
+  NCCLCHECK(mailboxEnqueue(state, header->peer, header->tag, header->size, data, NULL));
+  return ncclSuccess;
 }
 
-// We can't know who we'll receive from, so we need to receive everything at once
-ncclResult_t bootstrapAccept(void* commState, int peer, int tag, struct ncclSocket* sock) {
+// Accepts one new connection and files it: persistent sockets are kept per
+// peer, messages go to the mailbox, and bootstrapConnect streams too unless
+// it is the one we wait for (peer, tag), returned in sock with *found set.
+static ncclResult_t bootstrapAcceptOne(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock, int* found) {
   ncclResult_t ret = ncclSuccess;
-  struct bootstrapState* state = (struct bootstrapState*)commState;
-  int newPeer, newTag;
-
-  // Search unexpected connections first
-  int found;
-  NCCLCHECK(unexpectedDequeue(state, peer, tag, sock, &found));
-  if (found) return ncclSuccess;
-
-  // Then look for new connections
-  while (1) {
-    NCCLCHECKGOTO(ncclSocketInit(sock), ret, fail);
-    NCCLCHECKGOTO(ncclSocketAccept(sock, &state->listenSock), ret, fail);
-    NCCLCHECKGOTO(bootstrapNetRecv(sock, &newPeer, sizeof(int)), ret, fail);
-    NCCLCHECKGOTO(bootstrapNetRecv(sock, &newTag, sizeof(int)), ret, fail);
-    if (newPeer == peer && newTag == tag) return ncclSuccess;
-    NCCLCHECKGOTO(unexpectedEnqueue(state, newPeer, newTag, sock), ret, fail);
+  struct bootstrapHeader header;
+  *found = 0;
+  NCCLCHECKGOTO(ncclSocketInit(sock), ret, fail);
+  NCCLCHECKGOTO(ncclSocketAccept(sock, &state->listenSock), ret, fail);
+  NCCLCHECKGOTO(bootstrapNetRecv(sock, &header, sizeof(header)), ret, fail);
+  if (header.size == -1 && header.tag == BOOTSTRAP_TAG_PERSISTENT) {
+    if (state->peerRecvSockets == NULL) NCCLCHECKGOTO(ncclCalloc(&state->peerRecvSockets, state->nranks), ret, fail);
+    if (state->peerRecvSockets[header.peer] != NULL) {
+      WARN("Bootstrap : second persistent connection from peer %d", header.peer);
+      ret = ncclInternalError;
+      goto fail;
+    }
+    NCCLCHECKGOTO(ncclCalloc(state->peerRecvSockets+header.peer, 1), ret, fail);
+    memcpy(state->peerRecvSockets[header.peer], sock, sizeof(struct ncclSocket));
+  } else if (header.size == -1) {
+    if (header.peer == peer && header.tag == tag) {
+      *found = 1;
+      return ncclSuccess;
+    }
+    NCCLCHECKGOTO(mailboxEnqueue(state, header.peer, header.tag, -1, NULL, sock), ret, fail);
+  } else {
+    NCCLCHECKGOTO(mailboxRecvMessage(state, sock, &header), ret, fail);
+    NCCLCHECK(ncclSocketClose(sock));
   }
   return ncclSuccess;
 fail:
@@ -516,17 +799,85 @@ fail:
 }
 
 // We can't know who we'll receive from, so we need to receive everything at once
+ncclResult_t bootstrapAccept(void* commState, int peer, int tag, struct ncclSocket* sock) {
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  struct unexConn* unex = mailboxDequeue(state, peer, tag, /*isConn=*/true);
+  if (unex) {
+    memcpy(sock, &unex->sock, sizeof(struct ncclSocket));
+    free(unex);
+    return ncclSuccess;
+  }
+  int found = 0;
+  while (!found) NCCLCHECK(bootstrapAcceptOne(state, peer, tag, sock, &found));
+  return ncclSuccess;
+}
+
+// Waits for the next message on the persistent socket of peer, still
+// accepting new connections so that peers connecting to us are not stuck.
+static ncclResult_t bootstrapPeerRecvOne(struct bootstrapState* state, int peer) {
+  struct ncclSocket* peerSock = state->peerRecvSockets[peer];
+  struct pollfd pfd[2];
+  NCCLCHECK(ncclSocketGetFd(peerSock, &pfd[0].fd));
+  NCCLCHECK(ncclSocketGetFd(&state->listenSock, &pfd[1].fd));
+  while (1) {
+    pfd[0].events = pfd[1].events = POLLIN;
+    pfd[0].revents = pfd[1].revents = 0;
+    SYSCHECK(poll(pfd, 2, 100), "poll");
+    if (__atomic_load_n(state->abortFlag, __ATOMIC_RELAXED)) return ncclInternalError;
+    if (pfd[0].revents) {
+      struct bootstrapHeader header;
+      NCCLCHECK(bootstrapNetRecv(peerSock, &header, sizeof(header)));
+      NCCLCHECK(mailboxRecvMessage(state, peerSock, &header));
+      return ncclSuccess;
+    }
+    if (pfd[1].revents) {
+      struct ncclSocket sock;
+      int found;
+      NCCLCHECK(bootstrapAcceptOne(state, -1, 0, &sock, &found));
+    }
+  }
+}
+
 ncclResult_t bootstrapRecv(void* commState, int peer, int tag, void* data, int size) {
-  ncclResult_t ret;
-  struct ncclSocket sock;
-  NCCLCHECK(bootstrapAccept(commState, peer, tag, &sock));
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  struct unexConn* unex;
   TRACE(NCCL_BOOTSTRAP, "Receiving tag=%d peer=%d size=%d", tag, peer, size);
-  NCCLCHECKGOTO(bootstrapNetRecv(&sock, ((char*)data), size), ret, exit);
-exit:
-  NCCLCHECK(ncclSocketClose(&sock));
+  while ((unex = mailboxDequeue(state, peer, tag, /*isConn=*/false)) == NULL) {
+    if (state->peerRecvSockets && state->peerRecvSockets[peer]) {
+      NCCLCHECK(bootstrapPeerRecvOne(state, peer));
+    } else {
+      struct ncclSocket sock;
+      int found;
+      NCCLCHECK(bootstrapAcceptOne(state, -1, 0, &sock, &found));
+    }
+  }
+  ncclResult_t ret = ncclSuccess;
+  if (unex->size != size) {
+    WARN("Bootstrap : message from peer %d tag %d has %d bytes, expected %d", peer, tag, unex->size, size);
+    ret = ncclInternalError;
+  } else if (size > 0) {
+    memcpy(data, unex->data, size);
+  }
+  free(unex->data);
+  free(unex);
   return ret;
 }
 
+static void bootstrapPeerSocketsFree(struct bootstrapState* state) {
+  for (int p=0; p<state->nranks; p++) {
+    if (state->peerSendSockets && state->peerSendSockets[p]) {
+      ncclSocketClose(state->peerSendSockets[p]);
+      free(state->peerSendSockets[p]);
+    }
+    if (state->peerRecvSockets && state->peerRecvSockets[p]) {
+      ncclSocketClose(state->peerRecvSockets[p]);
+      free(state->peerRecvSockets[p]);
+    }
+  }
+  free(state->peerSendSockets);
+  free(state->peerRecvSockets);
+}
+
 // Collective algorithms, based on bootstrapSend/Recv, and sometimes bootstrapConnect/Accept
 
 ncclResult_t bootstrapRingAllGather(struct ncclSocket* prevSocket, struct ncclSocket* nextSocket, int rank, int nranks, char* data, int size) {
@@ -543,6 +894,37 @@ ncclResult_t bootstrapRingAllGather(struct ncclSocket* prevSocket, struct ncclSo
   }
   return ncclSuccess;
 }
+
+// Bruck AllGather: at step k, send the 2^k slices we have to rank-2^k and
+// receive as many from rank+2^k. Slices are kept rotated so that ours is first.
+static ncclResult_t bootstrapBruckAllGather(struct bootstrapState* state, char* data, int size) {
+  ncclResult_t ret = ncclSuccess;
+  int rank = state->rank;
+  int nranks = state->nranks;
+  char* tmp;
+  NCCLCHECK(ncclCalloc(&tmp, (size_t)nranks*size));
+  memcpy(tmp, data+(size_t)rank*size, size);
+  for (int dist=1, step=0; dist<nranks; dist<<=1, step++) {
+    int count = std::min(dist, nranks-dist);
+    int dst = (rank-dist+nranks) % nranks;
+    int src = (rank+dist) % nranks;
+    struct ncclSocket sendSock, recvSock;
+    NCCLCHECKGOTO(bootstrapConnect(state, dst, BOOTSTRAP_TAG_BRUCK-step, &sendSock), ret, exit);
+    NCCLCHECKGOTO(bootstrapAccept(state, src, BOOTSTRAP_TAG_BRUCK-step, &recvSock), ret, fail);
+    NCCLCHECKGOTO(bootstrapNetSendRecv(&sendSock, tmp, count*size, &recvSock, tmp+(size_t)dist*size, count*size), ret, fail);
+    NCCLCHECKGOTO(ncclSocketClose(&recvSock), ret, fail);
+    NCCLCHECKGOTO(ncclSocketClose(&sendSock), ret, exit);
+    continue;
+fail:
+    ncclSocketClose(&sendSock);
+    goto exit;
+  }
+  for (int i=0; i<nranks; i++) memcpy(data+(size_t)((rank+i)%nranks)*size, tmp+(size_t)i*size, size);
+exit:
+  free(tmp);
+  return ret;
+}
+
 ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
   int rank = state->rank;
@@ -550,15 +932,137 @@ ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
 
   TRACE(NCCL_INIT, "rank %d nranks %d size %d", rank, nranks, size);
 
-  NCCLCHECK(bootstrapRingAllGather(&state->ringRecvSocket, &state->ringSendSocket, rank, nranks, (char*)allData, size));
+  if (state->scalable) {
+    NCCLCHECK(bootstrapBruckAllGather(state, (char*)allData, size));
+  } else {
+    NCCLCHECK(bootstrapRingAllGather(&state->ringRecvSocket, &state->ringSendSocket, rank, nranks, (char*)allData, size));
+  }
 
   TRACE(NCCL_INIT, "rank %d nranks %d size %d - DONE", rank, nranks, size);
   return ncclSuccess;
 }
 
+/* Shared memory intra-node collectives
+ *
+ * Once the local ranks are known, local rank 0 creates a segment holding a
+ * barrier and one slot per local rank. Collectives over exactly those ranks
+ * (or over all ranks on a single node) then copy through the slots between
+ * two barriers instead of going through sockets. Waiters spin a little, then
+ * sleep on the generation counter with a futex, which works across processes
+ * since the segment is MAP_SHARED. Other rank sets and messages larger than
+ * a slot still use sockets; the choice only depends on arguments all ranks
+ * agree on.
+ */
+NCCL_PARAM(BootstrapShm, "BOOTSTRAP_SHM", 0);
+NCCL_PARAM(BootstrapShmSlotSize, "BOOTSTRAP_SHM_SLOT_SIZE", 65536);
+#define BOOTSTRAP_SHM_SPIN 4096
+
+struct bootstrapShm {
+  uint32_t count;
+  uint32_t gen;
+  size_t slotSize;
+  char pad[64-sizeof(size_t)-2*sizeof(uint32_t)];
+  char slots[];
+};
+
+static long bootstrapFutex(uint32_t* addr, int op, uint32_t val, const struct timespec* timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static ncclResult_t bootstrapShmBarrier(struct bootstrapState* state) {
+  struct bootstrapShm* shm = state->shm;
+  // Read the generation before arriving; it cannot move until we did
+  uint32_t gen = __atomic_load_n(&shm->gen, __ATOMIC_ACQUIRE);
+  if (__atomic_add_fetch(&shm->count, 1, __ATOMIC_ACQ_REL) == (uint32_t)state->shmNranks) {
+    __atomic_store_n(&shm->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->gen, gen+1, __ATOMIC_RELEASE);
+    bootstrapFutex(&shm->gen, FUTEX_WAKE, INT_MAX, NULL);
+    return ncclSuccess;
+  }
+  struct timespec timeout = { 0, 1000000 }; // wake up to check the abort flag
+  for (int spin=0; __atomic_load_n(&shm->gen, __ATOMIC_ACQUIRE) == gen; spin++) {
+    if (__atomic_load_n(state->abortFlag, __ATOMIC_RELAXED)) return ncclInternalError;
+    if (spin < BOOTSTRAP_SHM_SPIN) continue;
+    bootstrapFutex(&shm->gen, FUTEX_WAIT, gen, &timeout);
+  }
+  return ncclSuccess;
+}
+
+static bool bootstrapShmUsable(struct bootstrapState* state, int* ranks, int nranks, int size) {
+  if (state->shm == NULL || nranks != state->shmNranks || size < 0 || (size_t)size > state->shm->slotSize) return false;
+  return ranks ? ranks == state->shmRanks : state->shmIdentity;
+}
+
+static char* bootstrapShmSlot(struct bootstrapState* state, int rank) {
+  return state->shm->slots + rank*state->shm->slotSize;
+}
+
+ncclResult_t bootstrapIntraNodeShmSetup(void* commState, int* ranks, int rank, int nranks) {
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  ncclResult_t ret = ncclSuccess;
+  char shmPath[sizeof("/dev/shm/nccl-XXXXXX")];
+  size_t slotSize = ROUNDUP(std::max<int64_t>(ncclParamBootstrapShmSlotSize(), 64), 64);
+  size_t size = sizeof(struct bootstrapShm) + nranks*slotSize;
+  struct bootstrapShm* shm = NULL;
+  ncclShmHandle_t handle = NULL;
+  int* ok = NULL;
+  bool allOk = true;
+
+  if (ncclParamBootstrapShm() == 0 || nranks == 1 || state->shm) return ncclSuccess;
+
+  // Creation and attachment failures are not fatal, all local ranks just keep
+  // using sockets.
+  shmPath[0] = '\0';
+  if (rank == 0) {
+    if (ncclShmOpen(shmPath, size, (void**)&shm, NULL, nranks-1, &handle) == ncclSuccess) {
+      memset(shm, 0, sizeof(struct bootstrapShm));
+      shm->slotSize = slotSize;
+    } else {
+      shmPath[0] = '\0';
+    }
+  }
+  NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(commState, ranks, rank, nranks, 0, shmPath, sizeof(shmPath)), ret, fail);
+  if (rank != 0 && shmPath[0] != '\0') {
+    if (ncclShmOpen(shmPath, size, (void**)&shm, NULL, -1, &handle) != ncclSuccess) shm = NULL;
+  }
+
+  NCCLCHECKGOTO(ncclCalloc(&ok, nranks), ret, fail);
+  ok[rank] = shm ? 1 : 0;
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(commState, ranks, rank, nranks, ok, sizeof(int)), ret, fail);
+  for (int r=0; r<nranks; r++) allOk &= ok[r] == 1;
+  if (!allOk) {
+    INFO(NCCL_INIT, "Bootstrap shared memory segment unavailable on this node, using sockets");
+    goto fail;
+  }
+
+  state->shm = shm;
+  state->shmHandle = handle;
+  state->shmRanks = ranks;
+  state->shmRank = rank;
+  state->shmNranks = nranks;
+  state->shmIdentity = nranks == state->nranks;
+  for (int r=0; r<nranks; r++) state->shmIdentity &= ranks[r] == r;
+  INFO(NCCL_INIT, "Bootstrap intra-node collectives through shared memory, %d ranks, %zu bytes per rank", nranks, slotSize);
+exit:
+  free(ok);
+  return ret;
+fail:
+  if (handle) ncclShmClose(handle);
+  goto exit;
+}
+
+static void bootstrapShmFree(struct bootstrapState* state) {
+  if (state->shmHandle) ncclShmClose(state->shmHandle);
+  state->shmHandle = NULL;
+  state->shm = NULL;
+}
+
 ncclResult_t bootstrapIntraNodeBarrier(void* commState, int *ranks, int rank, int nranks, int tag) {
   if (nranks == 1) return ncclSuccess;
   TRACE(NCCL_INIT, "rank %d nranks %d tag %x - ENTER", rank, nranks, tag);
+  if (bootstrapShmUsable((struct bootstrapState*)commState, ranks, nranks, 0)) {
+    return bootstrapShmBarrier((struct bootstrapState*)commState);
+  }
 
   /* Simple [intra] process barrier
    *
@@ -585,6 +1089,19 @@ ncclResult_t bootstrapIntraNodeAllGather(void* commState, int *ranks, int rank,
   if (nranks == 1) return ncclSuccess;
   TRACE(NCCL_INIT, "rank %d nranks %d size %d - ENTER", rank, nranks, size);
 
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  if (bootstrapShmUsable(state, ranks, nranks, size)) {
+    memcpy(bootstrapShmSlot(state, rank), (char*)allData+rank*size, size);
+    NCCLCHECK(bootstrapShmBarrier(state));
+    for (int r=0; r<nranks; r++) {
+      if (r != rank) memcpy((char*)allData+r*size, bootstrapShmSlot(state, r), size);
+    }
+    // Slots are reused by the next collective
+    NCCLCHECK(bootstrapShmBarrier(state));
+    TRACE(NCCL_INIT, "rank %d nranks %d size %d - DONE (shm)", rank, nranks, size);
+    return ncclSuccess;
+  }
+
   int prevRank = ranks[(rank - 1 + nranks)%nranks];
   int nextRank = ranks[(rank + 1) % nranks];
   struct ncclSocket prevSocket, nextSocket;
@@ -605,6 +1122,16 @@ ncclResult_t bootstrapIntraNodeBroadcast(void* commState, int *ranks, int rank,
   if (nranks == 1) return ncclSuccess;
   TRACE(NCCL_INIT, "rank %d nranks %d root %d size %d - ENTER", rank, nranks, root, size);
 
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  if (bootstrapShmUsable(state, ranks, nranks, size)) {
+    if (rank == root) memcpy(bootstrapShmSlot(state, root), bcastData, size);
+    NCCLCHECK(bootstrapShmBarrier(state));
+    if (rank != root) memcpy(bcastData, bootstrapShmSlot(state, root), size);
+    NCCLCHECK(bootstrapShmBarrier(state));
+    TRACE(NCCL_INIT, "rank %d nranks %d root %d size %d - DONE (shm)", rank, nranks, root, size);
+    return ncclSuccess;
+  }
+
   if (rank == root) {
     for (int i=0; i<nranks; i++) {
       if (i != root) NCCLCHECK(bootstrapSend(commState, ranks ? ranks[i] : i, /*tag=*/ranks ? ranks[i] : i, bcastData, size));
@@ -624,13 +1151,15 @@ ncclResult_t bootstrapBroadcast(void* commState, int rank, int nranks, int root,
 
 ncclResult_t bootstrapClose(void* commState) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
-  if (state->unexpectedConnections != NULL) {
-    unexpectedFree(state);
+  if (state->nUnexpected != 0) {
+    mailboxFree(state);
     if (__atomic_load_n(state->abortFlag, __ATOMIC_RELAXED) == 0) {
       WARN("Unexpected connections are not empty");
       return ncclInternalError;
     }
   }
+  bootstrapPeerSocketsFree(state);
+  bootstrapShmFree(state);
 
   NCCLCHECK(ncclSocketClose(&state->listenSock));
   NCCLCHECK(ncclSocketClose(&state->ringSendSocket));
@@ -645,6 +1174,9 @@ ncclResult_t bootstrapClose(void* commState) {
 ncclResult_t bootstrapAbort(void* commState) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
   if (commState == NULL) return ncclSuccess;
+  mailboxFree(state);
+  bootstrapPeerSocketsFree(state);
+  bootstrapShmFree(state);
   NCCLCHECK(ncclSocketClose(&state->listenSock));
   NCCLCHECK(ncclSocketClose(&state->ringSendSocket));
   NCCLCHECK(ncclSocketClose(&state->ringRecvSocket));
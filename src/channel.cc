@@ -11,12 +11,14 @@
 ncclResult_t initChannel(struct ncclComm* comm, int channelId) {
   struct ncclChannel* channel = &comm->channels[channelId];
   if (channel->id != -1) return ncclSuccess;
+  ncclMemScope memScope(&comm->memStats, ncclMemDevComm);
 
   int nRanks = comm->nRanks;
   int nvlsRanks = comm->MNNVL ? comm->clique.size : comm->localRanks;
   int nPeers = nRanks + 1 /* Collnet */ + nvlsRanks /* NVLS */;
   channel->id = channelId;
   channel->workFifoSent = 0;
+  channel->workFifoAckd = 0;
 
   struct ncclSharedResources* sharedRes = comm->sharedRes;
 
@@ -38,17 +40,19 @@ ncclResult_t initChannel(struct ncclComm* comm, int channelId) {
 
   if (channel->devPeers == NULL) {
     if (sharedRes->devPeers[channelId] == NULL) {
-      NCCLCHECK(ncclCudaCallocAsync(sharedRes->devPeers + channelId, sharedRes->tpNRanks, sharedRes->deviceStream.cudaStream));
+      NCCLCHECK(ncclCudaCallocAsync(sharedRes->devPeers + channelId, sharedRes->sparsePeers ? 1 : sharedRes->tpNRanks, sharedRes->deviceStream.cudaStream));
+      if (sharedRes->sparsePeers) NCCLCHECK(ncclCalloc(sharedRes->devPeerTable + channelId, sharedRes->tpNRanks));
     }
     /* channel->devPeers is not shared, so just free it when calling commFree() */
     NCCLCHECK(ncclCudaCallocAsync(&channel->devPeers, nPeers, sharedRes->deviceStream.cudaStream));
     ncclCommPushCudaFree(comm, channel->devPeers);
     NCCLCHECK(ncclCalloc(&channel->devPeersHostPtr, nPeers));
     for (int r = 0; r < nRanks; r++) {
-      uintptr_t addr = (uintptr_t)(comm->sharedRes->devPeers[channelId] + comm->topParentRanks[r]);
-      NCCLCHECK(ncclCudaMemcpyAsync((uintptr_t*)(channel->devPeers + r), (uintptr_t*)&addr, 1, sharedRes->deviceStream.cudaStream));
-      channel->devPeersHostPtr[r] = (struct ncclDevChannelPeer*)addr;
+      // Sparse peers all start on the empty one, see ncclChannelDevPeerConnect
+      channel->devPeersHostPtr[r] = sharedRes->sparsePeers ? sharedRes->devPeers[channelId] :
+        sharedRes->devPeers[channelId] + comm->topParentRanks[r];
     }
+    NCCLCHECK(ncclCudaMemcpyAsync(channel->devPeers, channel->devPeersHostPtr, nRanks, sharedRes->deviceStream.cudaStream));
   }
 
   channel->ring.userRanks = ncclMemoryStackAlloc<int>(&comm->memPermanent, nRanks);
@@ -62,9 +66,29 @@ ncclResult_t initChannel(struct ncclComm* comm, int channelId) {
   return ncclSuccess;
 }
 
+// Gives peer its own device peer before its connectors are published to the
+// device, when device peers are sparse. Called on the host stream, which the
+// connector uploads use as well.
+ncclResult_t ncclChannelDevPeerConnect(struct ncclComm* comm, int channelId, int peer, cudaStream_t stream) {
+  struct ncclSharedResources* sharedRes = comm->sharedRes;
+  struct ncclChannel* channel = comm->channels+channelId;
+  if (!sharedRes->sparsePeers) return ncclSuccess;
+  struct ncclDevChannelPeer** devPeer = sharedRes->devPeerTable[channelId] + comm->topParentRanks[peer];
+  if (*devPeer == NULL) {
+    ncclMemScope memScope(&comm->memStats, ncclMemDevComm);
+    NCCLCHECK(ncclCudaCalloc(devPeer, 1));
+  }
+  if (channel->devPeersHostPtr[peer] != *devPeer) {
+    channel->devPeersHostPtr[peer] = *devPeer;
+    NCCLCHECK(ncclCudaMemcpyAsync(channel->devPeers+peer, channel->devPeersHostPtr+peer, 1, stream));
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share) {
   struct ncclChannel* channel = &comm->channels[channelId];
   struct ncclSharedResources* sharedRes = comm->sharedRes;
+  ncclMemScope memScope(&comm->memStats, ncclMemDevComm);
 
   if (channel->nvlsPeers != NULL)
     return ncclSuccess;
@@ -107,6 +131,7 @@ ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclCo
 ncclResult_t initCollnetChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share) {
   struct ncclChannel* channel = &comm->channels[channelId];
   struct ncclSharedResources* sharedRes = comm->sharedRes;
+  ncclMemScope memScope(&comm->memStats, ncclMemDevComm);
   uintptr_t addr;
 
   if (channel->collnetPeers != NULL)
@@ -129,6 +129,265 @@ ncclResult_t ncclReduceScatter(const void* sendbuff, void* recvbuff, size_t recv
   return ncclSuccess;
 }
 
+// True when counts/displs describe the same layout as the regular, evenly
+// sharded collective.
+static bool vCountsUniform(int nRanks, const size_t counts[], const size_t displs[]) {
+  for (int r=0; r<nRanks; r++) {
+    if (counts[r] != counts[0] || displs[r] != r*counts[0]) return false;
+  }
+  return true;
+}
+
+// Uneven shards are run as one broadcast (resp. reduce) rooted at each rank,
+// grouped in a single launch. Each one is pipelined along the ring, and every
+// link still carries each byte once as in the ring AllGather/ReduceScatter.
+NCCL_API(ncclResult_t, ncclAllGatherV, const void* sendbuff, void* recvbuff, const size_t recvcounts[],
+    const size_t rdispls[], ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclAllGatherV(const void* sendbuff, void* recvbuff, const size_t recvcounts[],
+    const size_t rdispls[], ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(CommCheck(comm, "AllGatherV", "comm"));
+  NCCLCHECK(PtrCheck((void*)recvcounts, "AllGatherV", "recvcounts"));
+  NCCLCHECK(PtrCheck((void*)rdispls, "AllGatherV", "rdispls"));
+  if (vCountsUniform(comm->nRanks, recvcounts, rdispls)) {
+    struct ncclInfo info = { ncclFuncAllGather, "AllGatherV",
+      sendbuff, recvbuff, recvcounts[0], datatype, ncclSum, 0, comm, stream, /* Args */
+      ALLGATHER_CHUNKSTEPS, ALLGATHER_SLICESTEPS };
+    NCCLCHECK(ncclEnqueueCheck(&info));
+    return ncclSuccess;
+  }
+  size_t typeSize = ncclTypeSize(datatype);
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECK(ncclGroupStart());
+  for (int r=0; r<comm->nRanks; r++) {
+    struct ncclInfo info = { ncclFuncBroadcast, "AllGatherV",
+      sendbuff, (char*)recvbuff + rdispls[r]*typeSize, recvcounts[r], datatype, ncclSum, r, comm, stream, /* Args */
+      BROADCAST_CHUNKSTEPS, BROADCAST_SLICESTEPS };
+    NCCLCHECKGOTO(ncclEnqueueCheck(&info), ret, exit);
+  }
+exit:
+  NCCLCHECK(ncclGroupEnd());
+  return ret;
+}
+
+// Several roots broadcasting at once. As grouped broadcasts, each root's data
+// goes around the ring after the previous one, each leaving the link into its
+// root idle and paying the pipeline fill. Instead, each rank packs the entries
+// it is root of into its segment of a stage, and the segments are allgathered
+// so every link carries all roots' data in a single pass. The AllGather moves
+// nRanks-1 segments of the busiest root per link against all the data for the
+// broadcasts, so it is only used when roots are balanced enough.
+// BROADCAST_MULTI_STAGE is the segment size in bytes, more data goes in
+// several rounds; 0 always runs grouped broadcasts.
+NCCL_PARAM(BroadcastMultiStage, "BROADCAST_MULTI_STAGE", 0);
+
+static ncclResult_t broadcastMultiUseAllGather(const size_t counts[], const int roots[], int nRoots, size_t typeSize,
+    ncclComm_t comm, cudaStream_t stream, size_t* maxRankBytes, bool* allGather) {
+  *allGather = false;
+  *maxRankBytes = 0;
+  if (ncclParamBroadcastMultiStage() <= 0 || nRoots <= 1 || comm->nRanks <= 2) return ncclSuccess;
+  // Same constraints as the Bruck AllToAll
+  if (ncclGroupDepth > 0 || !comm->config.blocking) return ncclSuccess;
+  cudaStreamCaptureStatus capture;
+  CUDACHECK(cudaStreamIsCapturing(stream, &capture));
+  if (capture != cudaStreamCaptureStatusNone) return ncclSuccess;
+  size_t* rankBytes;
+  size_t totalBytes = 0;
+  NCCLCHECK(ncclCalloc(&rankBytes, comm->nRanks));
+  for (int i=0; i<nRoots; i++) {
+    rankBytes[roots[i]] += counts[i]*typeSize;
+    totalBytes += counts[i]*typeSize;
+  }
+  for (int r=0; r<comm->nRanks; r++) *maxRankBytes = std::max(*maxRankBytes, rankBytes[r]);
+  free(rankBytes);
+  *allGather = *maxRankBytes > 0 && (comm->nRanks-1)*(*maxRankBytes) < totalBytes;
+  return ncclSuccess;
+}
+
+// Copy the part [lo, hi) of the entries rank r is root of, back to back, between
+// the user buffers and seg: from sendbuffs on pack, to recvbuffs otherwise.
+static ncclResult_t broadcastMultiCopy(bool pack, int r, const void* const sendbuffs[], void* const recvbuffs[],
+    const size_t counts[], const int roots[], int nRoots, size_t typeSize, char* seg, size_t lo, size_t hi,
+    ncclComm_t comm, cudaStream_t stream) {
+  size_t offset = 0;
+  for (int i=0; i<nRoots && offset < hi; i++) {
+    if (roots[i] != r) continue;
+    size_t bytes = counts[i]*typeSize;
+    size_t start = std::max(offset, lo), end = std::min(offset+bytes, hi);
+    if (start < end) {
+      char* stage = seg + (start-lo);
+      if (pack) {
+        CUDACHECK(cudaMemcpyAsync(stage, (const char*)sendbuffs[i] + (start-offset), end-start, cudaMemcpyDeviceToDevice, stream));
+      } else if (r != comm->rank || sendbuffs[i] != recvbuffs[i]) {
+        CUDACHECK(cudaMemcpyAsync((char*)recvbuffs[i] + (start-offset), stage, end-start, cudaMemcpyDeviceToDevice, stream));
+      }
+    }
+    offset += bytes;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t broadcastMultiAllGather(const void* const sendbuffs[], void* const recvbuffs[], const size_t counts[],
+    const int roots[], int nRoots, size_t typeSize, size_t maxRankBytes, ncclComm_t comm, cudaStream_t stream) {
+  int nRanks = comm->nRanks;
+  size_t segBytes = ncclParamBroadcastMultiStage();
+  if (comm->bcastMultiStage == nullptr) {
+    char* stage;
+    NCCLCHECK(ncclCudaCalloc(&stage, nRanks*segBytes));
+    ncclCommPushCudaFree(comm, stage);
+    comm->bcastMultiStage = stage;
+    CUDACHECK(cudaEventCreateWithFlags(&comm->bcastMultiDone, cudaEventDisableTiming));
+  } else {
+    CUDACHECK(cudaStreamWaitEvent(stream, comm->bcastMultiDone, 0));
+  }
+  char* stage = (char*)comm->bcastMultiStage;
+  INFO(NCCL_COLL, "BroadcastMulti: %d roots, up to %zu bytes per rank nRanks %d : AllGather", nRoots, maxRankBytes, nRanks);
+
+  for (size_t lo=0; lo<maxRankBytes; lo+=segBytes) {
+    size_t bytes = std::min(segBytes, maxRankBytes-lo);
+    NCCLCHECK(broadcastMultiCopy(true, comm->rank, sendbuffs, recvbuffs, counts, roots, nRoots, typeSize,
+          stage + comm->rank*bytes, lo, lo+bytes, comm, stream));
+    NCCLCHECK(ncclAllGather(stage + comm->rank*bytes, stage, bytes, ncclInt8, comm, stream));
+    for (int r=0; r<nRanks; r++) {
+      NCCLCHECK(broadcastMultiCopy(false, r, sendbuffs, recvbuffs, counts, roots, nRoots, typeSize,
+            stage + r*bytes, lo, lo+bytes, comm, stream));
+    }
+  }
+  CUDACHECK(cudaEventRecord(comm->bcastMultiDone, stream));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclBroadcastMulti, const void* const sendbuffs[], void* const recvbuffs[], const size_t counts[],
+    const int roots[], int nRoots, ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclBroadcastMulti(const void* const sendbuffs[], void* const recvbuffs[], const size_t counts[],
+    const int roots[], int nRoots, ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(CommCheck(comm, "BroadcastMulti", "comm"));
+  if (nRoots < 0) {
+    WARN("BroadcastMulti : invalid nRoots %d", nRoots);
+    return ncclInvalidArgument;
+  }
+  if (nRoots == 0) return ncclSuccess;
+  NCCLCHECK(PtrCheck((void*)sendbuffs, "BroadcastMulti", "sendbuffs"));
+  NCCLCHECK(PtrCheck((void*)recvbuffs, "BroadcastMulti", "recvbuffs"));
+  NCCLCHECK(PtrCheck((void*)counts, "BroadcastMulti", "counts"));
+  NCCLCHECK(PtrCheck((void*)roots, "BroadcastMulti", "roots"));
+  if (datatype < 0 || datatype >= ncclNumTypes) {
+    WARN("BroadcastMulti : invalid type %d", datatype);
+    return ncclInvalidArgument;
+  }
+  for (int i=0; i<nRoots; i++) {
+    if (roots[i] < 0 || roots[i] >= comm->nRanks) {
+      WARN("BroadcastMulti : invalid root %d (root should be in the 0..%d range)", roots[i], comm->nRanks);
+      return ncclInvalidArgument;
+    }
+  }
+  size_t typeSize = ncclTypeSize(datatype);
+  size_t maxRankBytes;
+  bool allGather;
+  NCCLCHECK(broadcastMultiUseAllGather(counts, roots, nRoots, typeSize, comm, stream, &maxRankBytes, &allGather));
+  if (allGather) return broadcastMultiAllGather(sendbuffs, recvbuffs, counts, roots, nRoots, typeSize, maxRankBytes, comm, stream);
+
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECK(ncclGroupStart());
+  for (int i=0; i<nRoots; i++) {
+    struct ncclInfo info = { ncclFuncBroadcast, "BroadcastMulti",
+      sendbuffs[i], recvbuffs[i], counts[i], datatype, ncclSum, roots[i], comm, stream, /* Args */
+      BROADCAST_CHUNKSTEPS, BROADCAST_SLICESTEPS };
+    NCCLCHECKGOTO(ncclEnqueueCheck(&info), ret, exit);
+  }
+exit:
+  NCCLCHECK(ncclGroupEnd());
+  return ret;
+}
+
+NCCL_API(ncclResult_t, ncclReduceScatterV, const void* sendbuff, const size_t sdispls[], void* recvbuff,
+    const size_t recvcounts[], ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclReduceScatterV(const void* sendbuff, const size_t sdispls[], void* recvbuff,
+    const size_t recvcounts[], ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(CommCheck(comm, "ReduceScatterV", "comm"));
+  NCCLCHECK(PtrCheck((void*)recvcounts, "ReduceScatterV", "recvcounts"));
+  NCCLCHECK(PtrCheck((void*)sdispls, "ReduceScatterV", "sdispls"));
+  if (vCountsUniform(comm->nRanks, recvcounts, sdispls)) {
+    struct ncclInfo info = { ncclFuncReduceScatter, "ReduceScatterV",
+      sendbuff, recvbuff, recvcounts[0], datatype, op, 0, comm, stream, /* Args */
+      REDUCESCATTER_CHUNKSTEPS, REDUCESCATTER_SLICESTEPS };
+    NCCLCHECK(ncclEnqueueCheck(&info));
+    return ncclSuccess;
+  }
+  size_t typeSize = ncclTypeSize(datatype);
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECK(ncclGroupStart());
+  for (int r=0; r<comm->nRanks; r++) {
+    struct ncclInfo info = { ncclFuncReduce, "ReduceScatterV",
+      (const char*)sendbuff + sdispls[r]*typeSize, recvbuff, recvcounts[r], datatype, op, r, comm, stream, /* Args */
+      REDUCE_CHUNKSTEPS, REDUCE_SLICESTEPS };
+    NCCLCHECKGOTO(ncclEnqueueCheck(&info), ret, exit);
+  }
+exit:
+  NCCLCHECK(ncclGroupEnd());
+  return ret;
+}
+
+// User buffers may hold half or bfloat16 while the reduction itself runs in
+// datatype (float): the ring primitives widen on load and narrow on store.
+static ncclResult_t mixedTypesCheck(struct ncclInfo* info, ncclDataType_t sendtype, ncclDataType_t recvtype) {
+  if (info->datatype != ncclFloat32) {
+    WARN("%s : datatype %d must be ncclFloat32", info->opName, info->datatype);
+    return ncclInvalidArgument;
+  }
+  ncclDataType_t types[2] = { sendtype, recvtype };
+  for (int i=0; i<2; i++) {
+    if (types[i] == info->datatype) continue;
+    if (types[i] != ncclFloat16 && types[i] != ncclBfloat16) {
+      WARN("%s : buffer type %d must be ncclFloat32, ncclFloat16 or ncclBfloat16", info->opName, types[i]);
+      return ncclInvalidArgument;
+    }
+    if ((info->castInput || info->castOutput) && info->castType != types[i]) {
+      WARN("%s : sendtype %d and recvtype %d must use the same 16 bit type", info->opName, sendtype, recvtype);
+      return ncclInvalidArgument;
+    }
+    info->castType = types[i];
+    if (i == 0) info->castInput = 1; else info->castOutput = 1;
+  }
+  if (sendtype != recvtype && info->sendbuff == info->recvbuff) {
+    WARN("%s : in place operation requires sendtype == recvtype", info->opName);
+    return ncclInvalidArgument;
+  }
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclAllReduceMixed, const void* sendbuff, ncclDataType_t sendtype, void* recvbuff,
+    ncclDataType_t recvtype, size_t count, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm,
+    cudaStream_t stream);
+ncclResult_t ncclAllReduceMixed(const void* sendbuff, ncclDataType_t sendtype, void* recvbuff,
+    ncclDataType_t recvtype, size_t count, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm,
+    cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  struct ncclInfo info = { ncclFuncAllReduce, "AllReduceMixed",
+    sendbuff, recvbuff, count, datatype, op, 0, comm, stream, /* Args */
+    ALLREDUCE_CHUNKSTEPS, ALLREDUCE_SLICESTEPS };
+  NCCLCHECK(mixedTypesCheck(&info, sendtype, recvtype));
+  NCCLCHECK(ncclEnqueueCheck(&info));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclReduceScatterMixed, const void* sendbuff, ncclDataType_t sendtype, void* recvbuff,
+    ncclDataType_t recvtype, size_t recvcount, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm,
+    cudaStream_t stream);
+ncclResult_t ncclReduceScatterMixed(const void* sendbuff, ncclDataType_t sendtype, void* recvbuff,
+    ncclDataType_t recvtype, size_t recvcount, ncclDataType_t datatype, ncclRedOp_t op, ncclComm_t comm,
+    cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  struct ncclInfo info = { ncclFuncReduceScatter, "ReduceScatterMixed",
+    sendbuff, recvbuff, recvcount, datatype, op, 0, comm, stream, /* Args */
+    REDUCESCATTER_CHUNKSTEPS, REDUCESCATTER_SLICESTEPS };
+  NCCLCHECK(mixedTypesCheck(&info, sendtype, recvtype));
+  NCCLCHECK(ncclEnqueueCheck(&info));
+  return ncclSuccess;
+}
+
 struct NvtxParamsSendRecv {
     size_t bytes;
     int peer;
@@ -173,3 +432,464 @@ exit:
   NCCLCHECK(ncclGroupEnd());
   return ret;
 }
+
+NCCL_API(ncclResult_t, ncclSendDevCount, const void* sendbuff, const size_t* devCount, size_t maxCount,
+    ncclDataType_t datatype, int peer, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclSendDevCount(const void* sendbuff, const size_t* devCount, size_t maxCount,
+    ncclDataType_t datatype, int peer, ncclComm_t comm, cudaStream_t stream) {
+  NvtxParamsSendRecv payload{maxCount * ncclTypeSize(datatype), peer};
+  NVTX3_FUNC_WITH_PARAMS(Send, SendRecvSchema, payload)
+
+  struct ncclInfo info = { ncclFuncSend, "SendDevCount",
+    NULL, (void*)sendbuff, maxCount, datatype, ncclSum, peer, comm, stream, /* Args */
+    1, 1, nullptr, nullptr, nullptr, nullptr, devCount };
+  ncclResult_t ret;
+  NCCLCHECK(ncclGroupStart());
+  NCCLCHECKGOTO(ncclEnqueueCheck(&info), ret, exit);
+exit:
+  NCCLCHECK(ncclGroupEnd());
+  return ret;
+}
+
+NCCL_API(ncclResult_t, ncclRecvDevCount, void* recvbuff, const size_t* devCount, size_t maxCount,
+    ncclDataType_t datatype, int peer, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclRecvDevCount(void* recvbuff, const size_t* devCount, size_t maxCount,
+    ncclDataType_t datatype, int peer, ncclComm_t comm, cudaStream_t stream) {
+  NvtxParamsSendRecv payload{maxCount * ncclTypeSize(datatype), peer};
+  NVTX3_FUNC_WITH_PARAMS(Recv, SendRecvSchema, payload)
+
+  struct ncclInfo info = { ncclFuncRecv, "RecvDevCount",
+    NULL, recvbuff, maxCount, datatype, ncclSum, peer, comm, stream, /* Args */
+    1, 1, nullptr, nullptr, nullptr, nullptr, devCount };
+  ncclResult_t ret;
+  NCCLCHECK(ncclGroupStart());
+  NCCLCHECKGOTO(ncclEnqueueCheck(&info), ret, exit);
+exit:
+  NCCLCHECK(ncclGroupEnd());
+  return ret;
+}
+
+// Pairwise AllToAll sends nRanks-1 messages per rank, which dominates when
+// they are small. The Bruck algorithm sends one message in each of log2(nRanks)
+// rounds instead, each carrying half of the blocks, so it wins below a few KB
+// per peer. ALLTOALL_BRUCK_THRESHOLD is the largest per peer size using it.
+NCCL_PARAM(AllToAllBruckThreshold, "ALLTOALL_BRUCK_THRESHOLD", 0);
+
+static ncclResult_t allToAllUseBruck(const void* sendbuff, void* recvbuff, size_t blockBytes, ncclComm_t comm,
+    cudaStream_t stream, bool* bruck) {
+  *bruck = false;
+  if (blockBytes == 0 || blockBytes > (size_t)ncclParamAllToAllBruckThreshold()) return ncclSuccess;
+  if (comm == NULL || comm->nRanks <= 2 || sendbuff == recvbuff) return ncclSuccess;
+  // Rounds depend on each other through local copies, so we launch them here
+  // and cannot be part of a group. Ordering with other streams through
+  // comm->bruckDone cannot be captured either.
+  if (ncclGroupDepth > 0 || !comm->config.blocking) return ncclSuccess;
+  cudaStreamCaptureStatus capture;
+  CUDACHECK(cudaStreamIsCapturing(stream, &capture));
+  *bruck = capture == cudaStreamCaptureStatusNone;
+  return ncclSuccess;
+}
+
+static ncclResult_t allToAllBruck(const void* sendbuff, void* recvbuff, size_t blockBytes, ncclComm_t comm,
+    cudaStream_t stream) {
+  NCCLCHECK(CommCheck(comm, "AllToAll", "comm"));
+  int nRanks = comm->nRanks, rank = comm->rank;
+  if (comm->bruckStage == nullptr) {
+    // Round 0 exchanges the most blocks
+    comm->bruckStageSize = ncclBruckStepBlocks(nRanks, 0)*(size_t)ncclParamAllToAllBruckThreshold();
+    char* stage;
+    NCCLCHECK(ncclCudaCalloc(&stage, 2*comm->bruckStageSize));
+    ncclCommPushCudaFree(comm, stage);
+    comm->bruckStage = stage;
+    CUDACHECK(cudaEventCreateWithFlags(&comm->bruckDone, cudaEventDisableTiming));
+  } else {
+    CUDACHECK(cudaStreamWaitEvent(stream, comm->bruckDone, 0));
+  }
+  char* sendStage = (char*)comm->bruckStage;
+  char* recvStage = sendStage + comm->bruckStageSize;
+  INFO(NCCL_COLL, "AllToAll: %zu bytes per peer nRanks %d : Bruck", blockBytes, nRanks);
+
+  NCCLCHECK(ncclLaunchBruckRotate(recvbuff, sendbuff, blockBytes, nRanks, rank, stream));
+  for (int step=0; (1<<step) < nRanks; step++) {
+    size_t bytes = ncclBruckStepBlocks(nRanks, step)*blockBytes;
+    int sendPeer = (rank + (1<<step)) % nRanks;
+    int recvPeer = (rank - (1<<step) + nRanks) % nRanks;
+    NCCLCHECK(ncclLaunchBruckPack(sendStage, recvbuff, blockBytes, nRanks, rank, step, stream));
+    NCCLCHECK(ncclGroupStart());
+    NCCLCHECK(ncclSend(sendStage, bytes, ncclInt8, sendPeer, comm, stream));
+    NCCLCHECK(ncclRecv(recvStage, bytes, ncclInt8, recvPeer, comm, stream));
+    NCCLCHECK(ncclGroupEnd());
+    NCCLCHECK(ncclLaunchBruckUnpack(recvbuff, recvStage, blockBytes, nRanks, rank, step, stream));
+  }
+  CUDACHECK(cudaEventRecord(comm->bruckDone, stream));
+  return ncclSuccess;
+}
+
+// Across nodes, pairwise AllToAll has every rank send nLocalRanks*nNodes small
+// network messages. The hierarchical variant first exchanges over NVLink so
+// that each rank holds what its local ranks send to its rail peer (same local
+// rank) on every node, then sends one message of nLocalRanks blocks to each
+// rail peer, so the receiver only reorders blocks locally.
+// ALLTOALL_HIER_THRESHOLD is the largest per peer size using it.
+NCCL_PARAM(AllToAllHierThreshold, "ALLTOALL_HIER_THRESHOLD", 0);
+
+static ncclResult_t allToAllUseHier(const void* sendbuff, void* recvbuff, size_t blockBytes, ncclComm_t comm,
+    cudaStream_t stream, bool* hier) {
+  *hier = false;
+  if (blockBytes == 0 || blockBytes > (size_t)ncclParamAllToAllHierThreshold()) return ncclSuccess;
+  if (comm == NULL || comm->nNodes <= 1 || comm->localRanks <= 1 || sendbuff == recvbuff) return ncclSuccess;
+  // Blocks are grouped by local rank, which needs the same number on every node
+  for (int n=0; n<comm->nNodes; n++) {
+    if (comm->nodeRanks[n].localRanks != comm->localRanks) return ncclSuccess;
+  }
+  // Same constraints as the Bruck AllToAll
+  if (ncclGroupDepth > 0 || !comm->config.blocking) return ncclSuccess;
+  cudaStreamCaptureStatus capture;
+  CUDACHECK(cudaStreamIsCapturing(stream, &capture));
+  *hier = capture == cudaStreamCaptureStatusNone;
+  return ncclSuccess;
+}
+
+// Block maps of the three local permutations, see allToAllHier
+static ncclResult_t allToAllHierMaps(ncclComm_t comm) {
+  int nRanks = comm->nRanks, nNodes = comm->nNodes, nLocal = comm->localRanks;
+  int* maps;
+  NCCLCHECK(ncclCalloc(&maps, 3*nRanks));
+  for (int m=0; m<nLocal; m++) {
+    for (int b=0; b<nNodes; b++) {
+      maps[m*nNodes+b] = comm->nodeRanks[b].localRankToRank[m];
+      maps[nRanks + b*nLocal+m] = m*nNodes+b;
+    }
+  }
+  for (int r=0; r<nRanks; r++) maps[2*nRanks + r] = comm->rankToNode[r]*nLocal + comm->rankToLocalRank[r];
+  ncclResult_t ret = ncclSuccess;
+  int* devMaps;
+  NCCLCHECKGOTO(ncclCudaCalloc(&devMaps, 3*nRanks), ret, exit);
+  ncclCommPushCudaFree(comm, devMaps);
+  NCCLCHECKGOTO(ncclCudaMemcpy(devMaps, maps, 3*nRanks), ret, exit);
+  comm->a2aHierMaps = devMaps;
+exit:
+  free(maps);
+  return ret;
+}
+
+// Rank (a, l) of node a with local rank l, blocks of blockBytes:
+//  1. stage[m][b] = sendbuff[rank(b, m)]
+//  2. Within the node, send stage[m][*] to (a, m), receive recvbuff[m][*] from (a, m)
+//  3. stage[b][m] = recvbuff[m][b], what (a, m) sends to (b, l)
+//  4. Across nodes, send stage[b][*] to (b, l), receive stage2[b][*] from (b, l)
+//  5. recvbuff[rank(b, m)] = stage2[b][m]
+static ncclResult_t allToAllHier(const void* sendbuff, void* recvbuff, size_t blockBytes, ncclComm_t comm,
+    cudaStream_t stream) {
+  NCCLCHECK(CommCheck(comm, "AllToAll", "comm"));
+  int nRanks = comm->nRanks, nNodes = comm->nNodes, nLocal = comm->localRanks;
+  if (comm->a2aHierStage == nullptr) {
+    comm->a2aHierStageSize = nRanks*(size_t)ncclParamAllToAllHierThreshold();
+    char* stage;
+    NCCLCHECK(ncclCudaCalloc(&stage, 2*comm->a2aHierStageSize));
+    ncclCommPushCudaFree(comm, stage);
+    comm->a2aHierStage = stage;
+    NCCLCHECK(allToAllHierMaps(comm));
+    CUDACHECK(cudaEventCreateWithFlags(&comm->a2aHierDone, cudaEventDisableTiming));
+  } else {
+    CUDACHECK(cudaStreamWaitEvent(stream, comm->a2aHierDone, 0));
+  }
+  char* stage = (char*)comm->a2aHierStage;
+  char* stage2 = stage + comm->a2aHierStageSize;
+  char* out = (char*)recvbuff;
+  int* maps = comm->a2aHierMaps;
+  INFO(NCCL_COLL, "AllToAll: %zu bytes per peer nRanks %d nNodes %d : Hierarchical", blockBytes, nRanks, nNodes);
+
+  NCCLCHECK(ncclLaunchBlockGather(stage, sendbuff, blockBytes, nRanks, maps, stream));
+  NCCLCHECK(ncclGroupStart());
+  for (int m=0; m<nLocal; m++) {
+    int peer = comm->localRankToRank[m];
+    NCCLCHECK(ncclSend(stage + m*nNodes*blockBytes, nNodes*blockBytes, ncclInt8, peer, comm, stream));
+    NCCLCHECK(ncclRecv(out + m*nNodes*blockBytes, nNodes*blockBytes, ncclInt8, peer, comm, stream));
+  }
+  NCCLCHECK(ncclGroupEnd());
+  NCCLCHECK(ncclLaunchBlockGather(stage, recvbuff, blockBytes, nRanks, maps+nRanks, stream));
+  NCCLCHECK(ncclGroupStart());
+  for (int b=0; b<nNodes; b++) {
+    int peer = comm->nodeRanks[b].localRankToRank[comm->localRank];
+    NCCLCHECK(ncclSend(stage + b*nLocal*blockBytes, nLocal*blockBytes, ncclInt8, peer, comm, stream));
+    NCCLCHECK(ncclRecv(stage2 + b*nLocal*blockBytes, nLocal*blockBytes, ncclInt8, peer, comm, stream));
+  }
+  NCCLCHECK(ncclGroupEnd());
+  NCCLCHECK(ncclLaunchBlockGather(recvbuff, stage2, blockBytes, nRanks, maps+2*nRanks, stream));
+  CUDACHECK(cudaEventRecord(comm->a2aHierDone, stream));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclAllToAll, const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclAllToAll(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream) {
+  // Just pass the size of one message and not the total bytes sent/received.
+  constexpr nvtxPayloadSchemaEntry_t AllToAllSchema[] = {
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_SIZE, "Message size [bytes]"}
+  };
+  size_t msgsize = count * ncclTypeSize(datatype);
+  NVTX3_FUNC_WITH_PARAMS(AllToAll, AllToAllSchema, msgsize)
+
+  bool hier, bruck;
+  NCCLCHECK(allToAllUseHier(sendbuff, recvbuff, msgsize, comm, stream, &hier));
+  if (hier) return allToAllHier(sendbuff, recvbuff, msgsize, comm, stream);
+  NCCLCHECK(allToAllUseBruck(sendbuff, recvbuff, msgsize, comm, stream, &bruck));
+  if (bruck) return allToAllBruck(sendbuff, recvbuff, msgsize, comm, stream);
+
+  struct ncclInfo info = { ncclFuncAllToAll, "AllToAll",
+    sendbuff, recvbuff, count, datatype, ncclSum, 0, comm, stream, /* Args */
+    1, 1 };
+  NCCLCHECK(ncclEnqueueCheck(&info));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclAllToAllv, const void* sendbuff, const size_t sendcounts[], const size_t sdispls[],
+    void* recvbuff, const size_t recvcounts[], const size_t rdispls[],
+    ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclAllToAllv(const void* sendbuff, const size_t sendcounts[], const size_t sdispls[],
+    void* recvbuff, const size_t recvcounts[], const size_t rdispls[],
+    ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+
+  struct ncclInfo info = { ncclFuncAllToAll, "AllToAllv",
+    sendbuff, recvbuff, 0, datatype, ncclSum, 0, comm, stream, /* Args */
+    1, 1, sendcounts, sdispls, recvcounts, rdispls };
+  NCCLCHECK(ncclEnqueueCheck(&info));
+  return ncclSuccess;
+}
+
+// Direct Gather/Scatter has the root exchange one message with every rank,
+// which is latency bound for small blocks. The binomial tree variant uses
+// log2(nRanks) rounds instead: in Gather each rank forwards the blocks of its
+// subtree, contiguous in relative rank order, to its parent, and in Scatter
+// the reverse. ROOTED_TREE_THRESHOLD is the largest block size using it; in
+// that range a tuner plugin may still pick the direct transfers (offered as
+// Ring, the tree as Tree, both with the Simple protocol).
+NCCL_PARAM(RootedTreeThreshold, "ROOTED_TREE_THRESHOLD", 0);
+
+static ncclResult_t rootedUseTree(ncclFunc_t coll, const void* sendbuff, void* recvbuff, size_t blockBytes, ncclComm_t comm,
+    cudaStream_t stream, bool* tree) {
+  *tree = false;
+  if (blockBytes == 0 || blockBytes > (size_t)ncclParamRootedTreeThreshold()) return ncclSuccess;
+  if (comm == NULL || comm->nRanks <= 2) return ncclSuccess;
+  // Same constraints as the Bruck AllToAll
+  if (ncclGroupDepth > 0 || !comm->config.blocking) return ncclSuccess;
+  cudaStreamCaptureStatus capture;
+  CUDACHECK(cudaStreamIsCapturing(stream, &capture));
+  if (capture != cudaStreamCaptureStatusNone) return ncclSuccess;
+  *tree = true;
+  if (comm->tuner != NULL) {
+    float costTable[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+    for (int i=0; i<NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS; i++) costTable[i] = NCCL_ALGO_PROTO_IGNORE;
+    float* treeCost = costTable + NCCL_ALGO_TREE*NCCL_NUM_PROTOCOLS + NCCL_PROTO_SIMPLE;
+    float* directCost = costTable + NCCL_ALGO_RING*NCCL_NUM_PROTOCOLS + NCCL_PROTO_SIMPLE;
+    // No model for these, only our preference
+    *treeCost = 0.0;
+    *directCost = 1.0;
+    int nChannels = 0;
+    if (comm->tuner->getCollInfo(comm->tunerContext, coll, comm->nRanks*blockBytes, 1, costTable,
+          NCCL_NUM_ALGORITHMS, NCCL_NUM_PROTOCOLS, &nChannels) == ncclSuccess) {
+      *tree = *treeCost >= 0 && (*directCost < 0 || *treeCost <= *directCost);
+    }
+  }
+  return ncclSuccess;
+}
+
+// The checks ncclEnqueueCheck runs before the direct transfers
+static ncclResult_t rootedArgsCheck(struct ncclInfo* info) {
+  NCCLCHECK(CommCheck(info->comm, info->opName, "comm"));
+  NCCLCHECK(ncclCommEnsureReady(info->comm));
+  int devOld = -1;
+  if (info->comm->checkPointers) {
+    CUDACHECK(cudaGetDevice(&devOld));
+    CUDACHECK(cudaSetDevice(info->comm->cudaDev));
+  }
+  ncclResult_t ret = ArgsCheck(info);
+  if (devOld != -1) CUDACHECK(cudaSetDevice(devOld));
+  return ret;
+}
+
+// Rank r relative to the root holds (Gather) or gets (Scatter) the blocks of
+// relative ranks [r, r+lowbit(r)) in the stage; the root holds all of them,
+// rotated to relative order. Arguments are checked by rootedArgsCheck.
+static ncclResult_t rootedTree(ncclFunc_t coll, const void* sendbuff, void* recvbuff, size_t blockBytes, int root,
+    ncclComm_t comm, cudaStream_t stream) {
+  bool gather = coll == ncclFuncGather;
+  const char* name = gather ? "Gather" : "Scatter";
+  int nRanks = comm->nRanks;
+  if (comm->rootedTreeStage == nullptr) {
+    char* stage;
+    NCCLCHECK(ncclCudaCalloc(&stage, nRanks*(size_t)ncclParamRootedTreeThreshold()));
+    ncclCommPushCudaFree(comm, stage);
+    comm->rootedTreeStage = stage;
+    CUDACHECK(cudaEventCreateWithFlags(&comm->rootedTreeDone, cudaEventDisableTiming));
+  } else {
+    CUDACHECK(cudaStreamWaitEvent(stream, comm->rootedTreeDone, 0));
+  }
+  char* stage = (char*)comm->rootedTreeStage;
+  int r = (comm->rank - root + nRanks) % nRanks;
+  INFO(NCCL_COLL, "%s: %zu bytes per rank nRanks %d root %d : Tree", name, blockBytes, nRanks, root);
+
+  if (gather) {
+    CUDACHECK(cudaMemcpyAsync(stage, sendbuff, blockBytes, cudaMemcpyDeviceToDevice, stream));
+    for (int mask=1; mask<nRanks; mask<<=1) {
+      if (r & mask) {
+        int n = std::min(mask, nRanks-r);
+        NCCLCHECK(ncclSend(stage, n*blockBytes, ncclInt8, (r-mask+root) % nRanks, comm, stream));
+        break;
+      }
+      if (r+mask < nRanks) {
+        int n = std::min(mask, nRanks-r-mask);
+        NCCLCHECK(ncclRecv(stage + mask*blockBytes, n*blockBytes, ncclInt8, (r+mask+root) % nRanks, comm, stream));
+      }
+    }
+    if (r == 0) {
+      // Relative rank x is rank (x+root) % nRanks
+      CUDACHECK(cudaMemcpyAsync((char*)recvbuff + root*blockBytes, stage, (nRanks-root)*blockBytes, cudaMemcpyDeviceToDevice, stream));
+      if (root) CUDACHECK(cudaMemcpyAsync(recvbuff, stage + (nRanks-root)*blockBytes, root*blockBytes, cudaMemcpyDeviceToDevice, stream));
+    }
+  } else {
+    int top = 1;
+    if (r == 0) {
+      CUDACHECK(cudaMemcpyAsync(stage, (const char*)sendbuff + root*blockBytes, (nRanks-root)*blockBytes, cudaMemcpyDeviceToDevice, stream));
+      if (root) CUDACHECK(cudaMemcpyAsync(stage + (nRanks-root)*blockBytes, sendbuff, root*blockBytes, cudaMemcpyDeviceToDevice, stream));
+      while (top < nRanks) top <<= 1;
+    } else {
+      top = r & -r;
+      int n = std::min(top, nRanks-r);
+      NCCLCHECK(ncclRecv(stage, n*blockBytes, ncclInt8, (r-top+root) % nRanks, comm, stream));
+    }
+    // Largest subtree first
+    for (int mask=top>>1; mask>0; mask>>=1) {
+      if (r+mask >= nRanks) continue;
+      int n = std::min(mask, nRanks-r-mask);
+      NCCLCHECK(ncclSend(stage + mask*blockBytes, n*blockBytes, ncclInt8, (r+mask+root) % nRanks, comm, stream));
+    }
+    CUDACHECK(cudaMemcpyAsync(recvbuff, stage, blockBytes, cudaMemcpyDeviceToDevice, stream));
+  }
+  CUDACHECK(cudaEventRecord(comm->rootedTreeDone, stream));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclGather, const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, int root, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclGather(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, int root, ncclComm_t comm, cudaStream_t stream) {
+  struct NvtxParamsGather {
+    size_t bytes;
+    int root;
+  };
+  constexpr nvtxPayloadSchemaEntry_t GatherSchema[] = {
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_SIZE, "Message size [bytes]"},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Root", nullptr, 0, offsetof(NvtxParamsGather, root)}
+  };
+  NvtxParamsGather payload{count * ncclTypeSize(datatype), root};
+  NVTX3_FUNC_WITH_PARAMS(Gather, GatherSchema, payload)
+
+  struct ncclInfo info = { ncclFuncGather, "Gather",
+    sendbuff, recvbuff, count, datatype, ncclSum, root, comm, stream, /* Args */
+    1, 1 };
+  bool tree;
+  NCCLCHECK(rootedUseTree(ncclFuncGather, sendbuff, recvbuff, payload.bytes, comm, stream, &tree));
+  if (tree) {
+    NCCLCHECK(rootedArgsCheck(&info));
+    return rootedTree(ncclFuncGather, sendbuff, recvbuff, payload.bytes, root, comm, stream);
+  }
+  NCCLCHECK(ncclEnqueueCheck(&info));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclScatter, const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, int root, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclScatter(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, int root, ncclComm_t comm, cudaStream_t stream) {
+  struct NvtxParamsScatter {
+    size_t bytes;
+    int root;
+  };
+  constexpr nvtxPayloadSchemaEntry_t ScatterSchema[] = {
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_SIZE, "Message size [bytes]"},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Root", nullptr, 0, offsetof(NvtxParamsScatter, root)}
+  };
+  NvtxParamsScatter payload{count * ncclTypeSize(datatype), root};
+  NVTX3_FUNC_WITH_PARAMS(Scatter, ScatterSchema, payload)
+
+  struct ncclInfo info = { ncclFuncScatter, "Scatter",
+    sendbuff, recvbuff, count, datatype, ncclSum, root, comm, stream, /* Args */
+    1, 1 };
+  bool tree;
+  NCCLCHECK(rootedUseTree(ncclFuncScatter, sendbuff, recvbuff, payload.bytes, comm, stream, &tree));
+  if (tree) {
+    NCCLCHECK(rootedArgsCheck(&info));
+    return rootedTree(ncclFuncScatter, sendbuff, recvbuff, payload.bytes, root, comm, stream);
+  }
+  NCCLCHECK(ncclEnqueueCheck(&info));
+  return ncclSuccess;
+}
+
+// Sparse blocks are allgathered, then summed into the dense output one rank
+// at a time so the result does not depend on timing. The ring AllGather moves
+// about nRanks*blockBytes per rank against 2*denseBytes for a ring AllReduce,
+// so past SPARSE_DENSE_RATIO percent of that we densify and AllReduce instead.
+NCCL_PARAM(SparseDenseRatio, "SPARSE_DENSE_RATIO", 100);
+
+NCCL_API(ncclResult_t, ncclSparseAllReduce, const void* sendindices, const void* sendvalues, const size_t* devNnz,
+    size_t maxNnz, ncclDataType_t indextype, void* recvbuff, size_t count, ncclDataType_t datatype,
+    void* scratchbuff, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclSparseAllReduce(const void* sendindices, const void* sendvalues, const size_t* devNnz,
+    size_t maxNnz, ncclDataType_t indextype, void* recvbuff, size_t count, ncclDataType_t datatype,
+    void* scratchbuff, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(CommCheck(comm, "SparseAllReduce", "comm"));
+  NCCLCHECK(PtrCheck((void*)devNnz, "SparseAllReduce", "devNnz"));
+  if (indextype != ncclInt32 && indextype != ncclInt64) {
+    WARN("SparseAllReduce : indextype %d must be ncclInt32 or ncclInt64", indextype);
+    return ncclInvalidArgument;
+  }
+  if (datatype < 0 || datatype >= ncclNumTypes) {
+    WARN("SparseAllReduce : invalid type %d", datatype);
+    return ncclInvalidArgument;
+  }
+  // The steps below are ordered on the stream, which needs the collectives to
+  // be launched by the time we return.
+  if (ncclGroupDepth > 0 || !comm->config.blocking) {
+    WARN("SparseAllReduce : cannot be called inside a group or on a non-blocking communicator");
+    return ncclInvalidUsage;
+  }
+
+  size_t eltSize = ncclTypeSize(datatype);
+  size_t blockBytes = ncclSparseBlockBytes(maxNnz, indextype, datatype);
+  bool dense = comm->nRanks*blockBytes*100 > 2*count*eltSize*ncclParamSparseDenseRatio();
+  INFO(NCCL_COLL, "SparseAllReduce: maxNnz %zu count %zu datatype %d nRanks %d : %s", maxNnz, count, datatype, comm->nRanks,
+      dense ? "dense AllReduce" : "sparse AllGather");
+
+  CUDACHECK(cudaMemsetAsync(recvbuff, 0, count*eltSize, stream));
+  if (dense) {
+    NCCLCHECK(ncclLaunchSparseScatter(recvbuff, count, sendindices, sendvalues, devNnz, maxNnz, indextype, datatype, stream));
+    NCCLCHECK(ncclAllReduce(recvbuff, recvbuff, count, datatype, ncclSum, comm, stream));
+    return ncclSuccess;
+  }
+
+  NCCLCHECK(PtrCheck(scratchbuff, "SparseAllReduce", "scratchbuff"));
+  char* myBlock = (char*)scratchbuff + comm->rank*blockBytes;
+  NCCLCHECK(ncclLaunchSparsePack(myBlock, sendindices, sendvalues, devNnz, maxNnz, indextype, datatype, stream));
+  NCCLCHECK(ncclAllGather(myBlock, scratchbuff, blockBytes, ncclInt8, comm, stream));
+  size_t valOffset = ROUNDUP(maxNnz*ncclTypeSize(indextype), 16);
+  for (int r=0; r<comm->nRanks; r++) {
+    char* block = (char*)scratchbuff + r*blockBytes;
+    NCCLCHECK(ncclLaunchSparseScatter(recvbuff, count, block, block+valOffset, nullptr, maxNnz, indextype, datatype, stream));
+  }
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclSparseAllReduceScratchSize, size_t maxNnz, ncclDataType_t indextype, ncclDataType_t datatype,
+    ncclComm_t comm, size_t* size);
+ncclResult_t ncclSparseAllReduceScratchSize(size_t maxNnz, ncclDataType_t indextype, ncclDataType_t datatype,
+    ncclComm_t comm, size_t* size) {
+  NCCLCHECK(CommCheck(comm, "SparseAllReduceScratchSize", "comm"));
+  NCCLCHECK(PtrCheck(size, "SparseAllReduceScratchSize", "size"));
+  *size = comm->nRanks*ncclSparseBlockBytes(maxNnz, indextype, datatype);
+  return ncclSuccess;
+}
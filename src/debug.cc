@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 #include "param.h"
 
 int ncclDebugLevel = -1;
@@ -23,6 +24,154 @@ std::chrono::steady_clock::time_point ncclEpoch;
 
 static __thread int tid = -1;
 
+/* Asynchronous logging (NCCL_DEBUG_ASYNC=1)
+ * Each thread owns a ring of log records which it fills without taking any
+ * lock. Only the message body is formatted on the caller's thread (its
+ * arguments may point to transient memory); the prefix, the timestamp
+ * formatting and the write to ncclDebugFile are deferred to a background
+ * flusher thread. Whoever holds ncclDebugLock is the consumer of every ring,
+ * so a producer finding its ring full simply drains it itself.
+ */
+#define NCCL_DEBUG_ASYNC_DEPTH 128
+#define NCCL_DEBUG_ASYNC_MSGLEN 1024
+#define NCCL_DEBUG_ASYNC_FUNCLEN 64
+#define NCCL_DEBUG_ASYNC_INTERVAL_US 1000
+
+struct ncclDebugRecord {
+  int level;
+  unsigned long flags;
+  int tid;
+  int cudaDev;
+  int line;
+  double timestamp;
+  char filefunc[NCCL_DEBUG_ASYNC_FUNCLEN];
+  char msg[NCCL_DEBUG_ASYNC_MSGLEN];
+};
+
+struct ncclDebugRing {
+  struct ncclDebugRing* next;
+  uint64_t head; // Written by the owning thread
+  uint64_t tail; // Written by the holder of ncclDebugLock
+  int dead;      // Owning thread exited; freed once drained
+  struct ncclDebugRecord records[NCCL_DEBUG_ASYNC_DEPTH];
+};
+
+static int ncclDebugAsync = 0;
+static struct ncclDebugRing* ncclDebugRings = nullptr;
+
+static thread_local struct ncclDebugRingOwner {
+  struct ncclDebugRing* ring = nullptr;
+  ~ncclDebugRingOwner() { if (ring) __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE); }
+} debugRing;
+
+static size_t ncclDebugHeader(char* buffer, size_t size, int level, unsigned long flags, const char* filefunc, int line,
+    int tid, int cudaDev, double timestamp) {
+  size_t len = 0;
+  if (level == NCCL_LOG_WARN) {
+    len = snprintf(buffer, size, "\n%s:%d:%d [%d] %s:%d NCCL WARN ",
+                   hostname, pid, tid, cudaDev, filefunc, line);
+  } else if (level == NCCL_LOG_INFO) {
+    len = snprintf(buffer, size, "%s:%d:%d [%d] NCCL INFO ", hostname, pid, tid, cudaDev);
+  } else if (level == NCCL_LOG_TRACE && flags == NCCL_CALL) {
+    len = snprintf(buffer, size, "%s:%d:%d NCCL CALL ", hostname, pid, tid);
+  } else if (level == NCCL_LOG_TRACE) {
+    len = snprintf(buffer, size, "%s:%d:%d [%d] %f %s:%d NCCL TRACE ",
+                   hostname, pid, tid, cudaDev, timestamp, filefunc, line);
+  }
+  return len;
+}
+
+static double ncclDebugTimestamp() {
+  auto delta = std::chrono::steady_clock::now() - ncclEpoch;
+  return std::chrono::duration_cast<std::chrono::duration<double>>(delta).count()*1000;
+}
+
+// Must be called with ncclDebugLock held
+static void ncclDebugDrainRing(struct ncclDebugRing* ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  char buffer[NCCL_DEBUG_ASYNC_MSGLEN+256];
+  for (; tail < head; tail++) {
+    struct ncclDebugRecord* rec = ring->records+(tail%NCCL_DEBUG_ASYNC_DEPTH);
+    size_t len = ncclDebugHeader(buffer, sizeof(buffer), rec->level, rec->flags, rec->filefunc, rec->line,
+                                 rec->tid, rec->cudaDev, rec->timestamp);
+    if (len == 0) continue;
+    len += snprintf(buffer+len, sizeof(buffer)-len, "%s\n", rec->msg);
+    if (len > sizeof(buffer)-1) { len = sizeof(buffer)-1; buffer[len-1] = '\n'; }
+    fwrite(buffer, 1, len, ncclDebugFile);
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+// Must be called with ncclDebugLock held
+static void ncclDebugDrainAll() {
+  struct ncclDebugRing** prev = &ncclDebugRings;
+  while (*prev) {
+    struct ncclDebugRing* ring = *prev;
+    // Read dead before draining so that a record posted just before the
+    // owner exited is never lost.
+    int dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+    ncclDebugDrainRing(ring);
+    if (dead) {
+      *prev = ring->next;
+      free(ring);
+    } else {
+      prev = &ring->next;
+    }
+  }
+}
+
+static void ncclDebugAsyncFlush() {
+  pthread_mutex_lock(&ncclDebugLock);
+  ncclDebugDrainAll();
+  fflush(ncclDebugFile);
+  pthread_mutex_unlock(&ncclDebugLock);
+}
+
+static void* ncclDebugFlusher(void*) {
+  ncclSetThreadName(pthread_self(), "NCCL Debug");
+  while (1) {
+    usleep(NCCL_DEBUG_ASYNC_INTERVAL_US);
+    ncclDebugAsyncFlush();
+  }
+  return NULL;
+}
+
+// Post a record to the calling thread's ring. Returns false if the ring
+// could not be allocated, in which case the caller logs synchronously.
+static bool ncclDebugPost(int level, unsigned long flags, const char* filefunc, int line, int cudaDev,
+    const char* fmt, va_list vargs) {
+  struct ncclDebugRing* ring = debugRing.ring;
+  if (ring == nullptr) {
+    ring = (struct ncclDebugRing*)calloc(1, sizeof(struct ncclDebugRing));
+    if (ring == nullptr) return false;
+    pthread_mutex_lock(&ncclDebugLock);
+    ring->next = ncclDebugRings;
+    ncclDebugRings = ring;
+    pthread_mutex_unlock(&ncclDebugLock);
+    debugRing.ring = ring;
+  }
+  uint64_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == NCCL_DEBUG_ASYNC_DEPTH) {
+    // Flusher fell behind; drain our own ring rather than dropping records.
+    pthread_mutex_lock(&ncclDebugLock);
+    ncclDebugDrainRing(ring);
+    pthread_mutex_unlock(&ncclDebugLock);
+  }
+  struct ncclDebugRecord* rec = ring->records+(head%NCCL_DEBUG_ASYNC_DEPTH);
+  rec->level = level;
+  rec->flags = flags;
+  rec->tid = tid;
+  rec->cudaDev = cudaDev;
+  rec->line = line;
+  rec->timestamp = level == NCCL_LOG_TRACE ? ncclDebugTimestamp() : 0;
+  strncpy(rec->filefunc, filefunc, NCCL_DEBUG_ASYNC_FUNCLEN-1);
+  rec->filefunc[NCCL_DEBUG_ASYNC_FUNCLEN-1] = '\0';
+  vsnprintf(rec->msg, NCCL_DEBUG_ASYNC_MSGLEN, fmt, vargs);
+  __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+  return true;
+}
+
 void ncclDebugInit() {
   pthread_mutex_lock(&ncclDebugLock);
   if (ncclDebugLevel != -1) { pthread_mutex_unlock(&ncclDebugLock); return; }
@@ -138,6 +287,18 @@ void ncclDebugInit() {
     }
   }
 
+  // Can't use NCCL_PARAM here: loading a parameter logs, which would recurse
+  // into ncclDebugInit while we hold ncclDebugLock.
+  const char* ncclDebugAsyncEnv = ncclGetEnv("NCCL_DEBUG_ASYNC");
+  if (tempNcclDebugLevel > NCCL_LOG_VERSION && ncclDebugAsyncEnv != NULL && atoi(ncclDebugAsyncEnv) != 0) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ncclDebugFlusher, NULL) == 0) {
+      pthread_detach(thread);
+      atexit(ncclDebugAsyncFlush);
+      ncclDebugAsync = 1;
+    }
+  }
+
   ncclEpoch = std::chrono::steady_clock::now();
   __atomic_store_n(&ncclDebugLevel, tempNcclDebugLevel, __ATOMIC_RELEASE);
   pthread_mutex_unlock(&ncclDebugLock);
@@ -168,28 +329,25 @@ void ncclDebugLog(ncclDebugLogLevel level, unsigned long flags, const char *file
     tid = syscall(SYS_gettid);
   }
 
-  int cudaDev;
+  int cudaDev = 0;
   if (!(level == NCCL_LOG_TRACE && flags == NCCL_CALL)) {
     cudaGetDevice(&cudaDev);
   }
 
-  char buffer[1024];
-  size_t len = 0;
-  if (level == NCCL_LOG_WARN) {
-    len = snprintf(buffer, sizeof(buffer), "\n%s:%d:%d [%d] %s:%d NCCL WARN ",
-                   hostname, pid, tid, cudaDev, filefunc, line);
-    if (ncclParamWarnSetDebugInfo()) ncclDebugLevel = NCCL_LOG_INFO;
-  } else if (level == NCCL_LOG_INFO) {
-    len = snprintf(buffer, sizeof(buffer), "%s:%d:%d [%d] NCCL INFO ", hostname, pid, tid, cudaDev);
-  } else if (level == NCCL_LOG_TRACE && flags == NCCL_CALL) {
-    len = snprintf(buffer, sizeof(buffer), "%s:%d:%d NCCL CALL ", hostname, pid, tid);
-  } else if (level == NCCL_LOG_TRACE) {
-    auto delta = std::chrono::steady_clock::now() - ncclEpoch;
-    double timestamp = std::chrono::duration_cast<std::chrono::duration<double>>(delta).count()*1000;
-    len = snprintf(buffer, sizeof(buffer), "%s:%d:%d [%d] %f %s:%d NCCL TRACE ",
-                   hostname, pid, tid, cudaDev, timestamp, filefunc, line);
+  if (level == NCCL_LOG_WARN && ncclParamWarnSetDebugInfo()) ncclDebugLevel = NCCL_LOG_INFO;
+
+  if (ncclDebugAsync && level != NCCL_LOG_WARN) {
+    va_list vargs;
+    va_start(vargs, fmt);
+    bool posted = ncclDebugPost(level, flags, filefunc, line, cudaDev, fmt, vargs);
+    va_end(vargs);
+    if (posted) return;
   }
 
+  char buffer[1024];
+  size_t len = ncclDebugHeader(buffer, sizeof(buffer), level, flags, filefunc, line, tid, cudaDev,
+                               level == NCCL_LOG_TRACE ? ncclDebugTimestamp() : 0);
+
   if (len) {
     va_list vargs;
     va_start(vargs, fmt);
@@ -199,7 +357,17 @@ void ncclDebugLog(ncclDebugLogLevel level, unsigned long flags, const char *file
     // Rewind len so that we can replace the final \0 by \n
     if (len > sizeof(buffer)) len = sizeof(buffer)-1;
     buffer[len++] = '\n';
-    fwrite(buffer, 1, len, ncclDebugFile);
+    if (ncclDebugAsync) {
+      // Keep WARNs ordered after everything already queued, and out
+      // immediately since they often precede an abort.
+      pthread_mutex_lock(&ncclDebugLock);
+      ncclDebugDrainAll();
+      fwrite(buffer, 1, len, ncclDebugFile);
+      fflush(ncclDebugFile);
+      pthread_mutex_unlock(&ncclDebugLock);
+    } else {
+      fwrite(buffer, 1, len, ncclDebugFile);
+    }
   }
 }
 
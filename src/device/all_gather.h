@@ -28,7 +28,7 @@ namespace {
     T *inputBuf = (T*)args->sendbuff;
     T *outputBuf = (T*)args->recvbuff;
     Primitives<T, RedOp, FanSymmetric<1>, 1, Proto, 0> prims
-      (tid, nthreads, &ring->prev, &ring->next, inputBuf, outputBuf, args->redOpArg);
+      (tid, nthreads, &ring->prev, &ring->next, inputBuf, outputBuf, args->redOpArg, 0, 0, 0, args);
 
     for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
       /////////////// begin AllGather steps ///////////////
@@ -61,6 +61,88 @@ namespace {
       prims.directRecv(offset, nelem);
     }
   }
+
+  // Hierarchical AllGather: the block of each rank goes around the ring of the
+  // ranks with the same intra-node index, one per node, then the blocks each
+  // rank gathered go around the intra-node ring. Only 1/nLocal of the output
+  // crosses the network per rank. The intra-node ring of a chunk runs while
+  // the inter-node ring moves the next one.
+  template<typename T, typename RedOp, typename Proto>
+  __device__ __forceinline__ void runHier(ncclWorkElem *args) {
+    const int tid = threadIdx.x;
+    const int nthreads = (int)args->nWarps * WARP_SIZE;
+    ncclHier *hier = &ncclShmem.channel.hier;
+    const int *ringRanks = ncclShmem.channel.ring.userRanks;
+    const int nranks = ncclShmem.comm.nRanks;
+    const int nLocal = hier->nLocal;
+    const int nNodes = hier->nNodes;
+    const size_t chunkCount = args->chunkCount;
+    const size_t channelCount = args->workCount;
+    const size_t gridOffset = args->workOffset;
+    const size_t count = args->count;
+    const int nthreadsIntra = (nthreads*6/(10*WARP_SIZE))*WARP_SIZE;
+    const int nthreadsInter = nthreads - nthreadsIntra;
+    volatile int* interDone = &ncclShmem.hierArDone;
+
+    // Rank at index `local` of the intra-node ring of node `node`. Nodes are
+    // contiguous segments of the ring, in order, see hierSetup().
+    auto rankAt = [&]__device__(int node, int local)->int {
+      int d = (node - hier->node)*nLocal + local - hier->localIndex;
+      return ringRanks[d < 0 ? d + nranks : d];
+    };
+
+    if (tid == 0) *interDone = 0;
+    asm volatile("bar.sync 1, %0;" :: "r"(nthreads) : "memory");
+
+    if (tid < nthreadsIntra) {
+      Primitives<T, RedOp, FanSymmetric<1>, /*Direct=*/0, Proto, 0> prims
+        (tid, nthreadsIntra, &hier->intraPrev, &hier->intraNext, args->sendbuff, args->recvbuff, args->redOpArg, 0*Proto::MaxGroupWidth);
+      const int ringIx = hier->localIndex;
+      int loop = 0;
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount, loop++) {
+        int nelem = min(chunkCount, channelCount - elemOffset);
+        size_t dataOffset = gridOffset + elemOffset;
+
+        // Wait for the inter-node ring to gather our shard of this chunk
+        while (*interDone < (loop+1)*nthreadsInter);
+        __threadfence_block();
+
+        for (int m = 0; m < nNodes; m++) prims.sendFromOutput(dataOffset + rankAt(m, ringIx)*count, nelem);
+        for (int j = 1; j < nLocal - 1; ++j) {
+          int local = (ringIx + nLocal - j) % nLocal;
+          for (int m = 0; m < nNodes; m++) prims.recvCopySend(dataOffset + rankAt(m, local)*count, nelem);
+        }
+        int local = (ringIx + 1) % nLocal;
+        for (int m = 0; m < nNodes; m++) prims.recv(dataOffset + rankAt(m, local)*count, nelem);
+      }
+    } else {
+      T *inputBuf = (T*)args->sendbuff;
+      T *outputBuf = (T*)args->recvbuff;
+      Primitives<T, RedOp, FanSymmetric<1>, /*Direct=*/0, Proto, 0> prims
+        (tid-nthreadsIntra, nthreadsInter, &hier->interPrev, &hier->interNext, args->sendbuff, args->recvbuff, args->redOpArg, 1*Proto::MaxGroupWidth);
+      const int ringIx = hier->node;
+      const int local = hier->localIndex;
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
+        int nelem = min(chunkCount, channelCount - elemOffset);
+        size_t dataOffset = gridOffset + elemOffset;
+
+        // Ring allgather of our block across nodes, as runRing() does
+        size_t offset = dataOffset + ringRanks[0]*count;
+        if (inputBuf + dataOffset == outputBuf + offset) { // In place
+          prims.send(dataOffset, nelem);
+        } else {
+          prims.copySend(dataOffset, offset, nelem);
+        }
+        for (int j = 1; j < nNodes - 1; ++j) {
+          prims.recvCopySend(dataOffset + rankAt((ringIx + nNodes - j) % nNodes, local)*count, nelem);
+        }
+        prims.recv(dataOffset + rankAt((ringIx + 1) % nNodes, local)*count, nelem);
+
+        __threadfence_block();
+        atomicAdd((int*)interDone, 1);
+      }
+    }
+  }
 }
 
 template<typename T, typename RedOp>
@@ -71,6 +153,14 @@ struct RunWorkElement<ncclFuncAllGather, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_SI
   }
 };
 
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncAllGather, T, RedOp, NCCL_ALGO_HIER, NCCL_PROTO_SIMPLE> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    using Proto = ProtoSimple<ALLGATHER_CHUNKSTEPS/ALLGATHER_SLICESTEPS, ALLGATHER_SLICESTEPS>;
+    runHier<T, RedOp, Proto>(args);
+  }
+};
+
 template<typename T, typename RedOp>
 struct RunWorkElement<ncclFuncAllGather, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_LL> {
   __device__ __forceinline__ void run(ncclWorkElem *args) {
@@ -9,14 +9,15 @@
 #include "primitives.h"
 
 namespace {
-  template<typename T, typename RedOp, typename Proto>
+  // NRanks != 0 is the ring size known at compile time, see runRingSpecialized.
+  template<typename T, typename RedOp, typename Proto, int NRanks=0>
   __device__ __forceinline__ void runRing(ncclWorkElem *args) {
     const int tid = threadIdx.x;
     const int nthreads = (int)args->nWarps * WARP_SIZE;
     ncclRing *ring = &ncclShmem.channel.ring;
     int ringIx = ring->index;
     ssize_t chunkCount = args->chunkCount;
-    const int nranks = ncclShmem.comm.nRanks;
+    const int nranks = NRanks ? NRanks : ncclShmem.comm.nRanks;
     const ssize_t loopCount = nranks * chunkCount;
     ssize_t offset;
     ssize_t gridOffset = args->workOffset;
@@ -25,7 +26,7 @@ namespace {
     int chunk;
 
     Primitives<T, RedOp, FanSymmetric<1>, 1, Proto, 0> prims
-      (tid, nthreads, &ring->prev, &ring->next, args->sendbuff, args->recvbuff, args->redOpArg);
+      (tid, nthreads, &ring->prev, &ring->next, args->sendbuff, args->recvbuff, args->redOpArg, 0, 0, 0, args);
 
     for (ssize_t elemOffset = 0; elemOffset < channelCount; elemOffset += loopCount) {
       ssize_t remCount = channelCount - elemOffset;
@@ -79,6 +80,20 @@ namespace {
     }
   }
 
+  // generate.py defines NCCL_RING_NRANKS_SPECIALIZATIONS with the ring sizes
+  // (RING_NRANKS) for which the ring loops are compiled with a constant trip
+  // count and chunk indices. Other sizes use the generic loop.
+  template<typename T, typename RedOp, typename Proto>
+  __device__ __forceinline__ void runRingSpecialized(ncclWorkElem *args) {
+    #ifdef NCCL_RING_NRANKS_SPECIALIZATIONS
+    #define NCCL_RUN_RING_NRANKS(n) \
+      if (ncclShmem.comm.nRanks == n) { runRing<T, RedOp, Proto, n>(args); return; }
+    NCCL_RING_NRANKS_SPECIALIZATIONS(NCCL_RUN_RING_NRANKS)
+    #undef NCCL_RUN_RING_NRANKS
+    #endif
+    runRing<T, RedOp, Proto>(args);
+  }
+
   template<typename T, typename RedOp, typename Proto>
   __device__ __forceinline__ void runTreeUpDown(ncclWorkElem *args) {
     const int tid = threadIdx.x;
@@ -221,13 +236,244 @@ namespace {
       }
     }
   }
+
+  // Hierarchical AllReduce. Each loop covers nLocal shards of nNodes chunks. The
+  // intra-node ring reduce-scatters the shards, the inter-node ring allreduces
+  // the shard we got, then the intra-node ring allgathers them. Each ring has
+  // its own threads, so that the inter-node ring of one loop overlaps with the
+  // intra-node steps of the next and previous ones. Threads of a ring count
+  // the loops they completed in shared memory for the other ring to wait on.
+  // The inter-node ring reads its input from the output, so it must not apply
+  // a pre-operation; ncclDevPreMulSum does not use this algorithm.
+  template<typename T, typename RedOp, typename Proto>
+  __device__ __forceinline__ void runHier(ncclWorkElem *args) {
+    const int tid = threadIdx.x;
+    const int nthreads = (int)args->nWarps * WARP_SIZE;
+    ncclHier *hier = &ncclShmem.channel.hier;
+    const int nLocal = hier->nLocal;
+    const int nNodes = hier->nNodes;
+    const ssize_t loopCount = nLocal * nNodes * (ssize_t)args->chunkCount;
+    const ssize_t gridOffset = args->workOffset;
+    const ssize_t channelCount = args->workCount;
+    // The intra-node ring moves nNodes times more chunks per loop and does not
+    // go through the network, give it a bit more threads.
+    const int nthreadsIntra = (nthreads*6/(10*WARP_SIZE))*WARP_SIZE;
+    const int nthreadsInter = nthreads - nthreadsIntra;
+    volatile int* rsDone = &ncclShmem.hierRsDone;
+    volatile int* arDone = &ncclShmem.hierArDone;
+
+    if (tid == 0) *rsDone = *arDone = 0;
+    asm volatile("bar.sync 1, %0;" :: "r"(nthreads) : "memory");
+
+    if (tid < nthreadsIntra) {
+      Primitives<T, RedOp, FanSymmetric<1>, /*Direct=*/0, Proto, 0> prims
+        (tid, nthreadsIntra, &hier->intraPrev, &hier->intraNext, args->sendbuff, args->recvbuff, args->redOpArg, 0*Proto::MaxGroupWidth);
+      const int ringIx = hier->localIndex;
+      auto modRanks = [&]__device__(int r)->int {
+        return r - (r >= nLocal ? nLocal : 0);
+      };
+      // Runs one primitive on each chunk of a shard
+      enum { HierSend, HierRecvReduceSend, HierRecvReduceCopy, HierSendFromOutput, HierRecvCopySend, HierRecv };
+      auto forShard = [&]__device__(int op, ssize_t elemOffset, ssize_t chunkCount, int shard) {
+        ssize_t remCount = channelCount - elemOffset;
+        for (int k = 0; k < nNodes; k++) {
+          ssize_t chunkOffset = (shard * nNodes + k) * chunkCount;
+          ssize_t offset = gridOffset + elemOffset + chunkOffset;
+          int nelem = (int)min(chunkCount, remCount - chunkOffset);
+          switch (op) {
+          case HierSend: prims.send(offset, nelem); break;
+          case HierRecvReduceSend: prims.recvReduceSend(offset, nelem); break;
+          case HierRecvReduceCopy: prims.recvReduceCopy(offset, offset, nelem); break;
+          case HierSendFromOutput: prims.sendFromOutput(offset, nelem); break;
+          case HierRecvCopySend: prims.recvCopySend(offset, nelem); break;
+          case HierRecv: prims.recv(offset, nelem); break;
+          }
+        }
+      };
+      auto allGather = [&]__device__(ssize_t elemOffset, ssize_t chunkCount) {
+        forShard(HierSendFromOutput, elemOffset, chunkCount, ringIx);
+        for (int j = 1; j < nLocal - 1; ++j) {
+          forShard(HierRecvCopySend, elemOffset, chunkCount, modRanks(ringIx + nLocal - j));
+        }
+        forShard(HierRecv, elemOffset, chunkCount, modRanks(ringIx + 1));
+      };
+
+      int loop = 0;
+      ssize_t prevElemOffset = 0, prevChunkCount = 0;
+      for (ssize_t elemOffset = 0; elemOffset < channelCount; elemOffset += loopCount, loop++) {
+        ssize_t chunkCount = channelCount - elemOffset < loopCount ? args->lastChunkCount : args->chunkCount;
+
+        // Reduce-scatter, we end up with the node's partial result of our shard
+        forShard(HierSend, elemOffset, chunkCount, modRanks(ringIx + nLocal - 1));
+        for (int j = 2; j < nLocal; ++j) {
+          forShard(HierRecvReduceSend, elemOffset, chunkCount, modRanks(ringIx + nLocal - j));
+        }
+        forShard(HierRecvReduceCopy, elemOffset, chunkCount, ringIx);
+        __threadfence_block();
+        atomicAdd((int*)rsDone, 1);
+
+        // Allgather the previous loop once the inter-node ring is done with it
+        if (loop > 0) {
+          while (*arDone < loop*nthreadsInter);
+          __threadfence_block();
+          allGather(prevElemOffset, prevChunkCount);
+        }
+        prevElemOffset = elemOffset;
+        prevChunkCount = chunkCount;
+      }
+      if (loop > 0) {
+        while (*arDone < loop*nthreadsInter);
+        __threadfence_block();
+        allGather(prevElemOffset, prevChunkCount);
+      }
+    } else {
+      Primitives<T, RedOp, FanSymmetric<1>, /*Direct=*/0, Proto, 0> prims
+        (tid-nthreadsIntra, nthreadsInter, &hier->interPrev, &hier->interNext, args->recvbuff, args->recvbuff, args->redOpArg, 1*Proto::MaxGroupWidth);
+      const int ringIx = hier->node;
+      const int shard = hier->localIndex;
+      auto modRanks = [&]__device__(int r)->int {
+        return r - (r >= nNodes ? nNodes : 0);
+      };
+
+      int loop = 0;
+      for (ssize_t elemOffset = 0; elemOffset < channelCount; elemOffset += loopCount, loop++) {
+        ssize_t remCount = channelCount - elemOffset;
+        ssize_t chunkCount = remCount < loopCount ? args->lastChunkCount : args->chunkCount;
+        ssize_t shardOffset = shard * nNodes * chunkCount;
+        ssize_t chunkOffset, offset;
+        int nelem, chunk;
+
+        while (*rsDone < (loop+1)*nthreadsIntra);
+        __threadfence_block();
+
+        // Ring allreduce of our shard across nodes, as runRing() does
+        chunk = modRanks(ringIx + nNodes - 1);
+        chunkOffset = shardOffset + chunk * chunkCount;
+        offset = gridOffset + elemOffset + chunkOffset;
+        nelem = (int)min(chunkCount, remCount - chunkOffset);
+        prims.send(offset, nelem);
+
+        for (int j = 2; j < nNodes; ++j) {
+          chunk = modRanks(ringIx + nNodes - j);
+          chunkOffset = shardOffset + chunk * chunkCount;
+          offset = gridOffset + elemOffset + chunkOffset;
+          nelem = (int)min(chunkCount, remCount - chunkOffset);
+          prims.recvReduceSend(offset, nelem);
+        }
+
+        chunk = ringIx;
+        chunkOffset = shardOffset + chunk * chunkCount;
+        offset = gridOffset + elemOffset + chunkOffset;
+        nelem = (int)min(chunkCount, remCount - chunkOffset);
+        prims.recvReduceCopySend(offset, offset, nelem, /*postOp=*/true);
+
+        for (int j = 1; j < nNodes - 1; ++j) {
+          chunk = modRanks(ringIx + nNodes - j);
+          chunkOffset = shardOffset + chunk * chunkCount;
+          offset = gridOffset + elemOffset + chunkOffset;
+          nelem = (int)min(chunkCount, remCount - chunkOffset);
+          prims.recvCopySend(offset, nelem);
+        }
+
+        chunk = modRanks(ringIx + 1);
+        chunkOffset = shardOffset + chunk * chunkCount;
+        offset = gridOffset + elemOffset + chunkOffset;
+        nelem = (int)min(chunkCount, remCount - chunkOffset);
+        prims.recv(offset, nelem);
+
+        __threadfence_block();
+        atomicAdd((int*)arDone, 1);
+      }
+    }
+  }
+
+  // Recursive doubling AllReduce. Each round exchanges all of the channel's
+  // data with one peer and reduces it, so every rank has the result after
+  // log2(nRanks) rounds. Both peers compute a+b and b+a, which are equal, so
+  // all ranks end up with the same bits. Folded ranks send their data to
+  // their partner first and receive the result from it at the end. Rounds
+  // after the first read their input from the output, so this must not apply
+  // a pre-operation; ncclDevPreMulSum does not use this algorithm.
+  template<typename T, typename RedOp, typename Proto>
+  __device__ __forceinline__ void runRecDbl(ncclWorkElem *args) {
+    const int tid = threadIdx.x;
+    const int nthreads = (int)args->nWarps * WARP_SIZE;
+    ncclRecDbl *recDbl = &ncclShmem.channel.recDbl;
+    const size_t channelCount = args->workCount;
+    const size_t gridOffset = args->workOffset;
+    const size_t chunkCount = args->chunkCount;
+    size_t offset;
+    int nelem;
+
+    if (recDbl->folded) {
+      Primitives<T, RedOp, FanSymmetric<1>, /*Direct=*/0, Proto, 0> prims
+        (tid, nthreads, &recDbl->extra, &recDbl->extra, args->sendbuff, args->recvbuff, args->redOpArg);
+      // All sends first: the partner only sends back once it has everything.
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
+        offset = gridOffset + elemOffset;
+        nelem = min(chunkCount, channelCount - elemOffset);
+        prims.send(offset, nelem);
+      }
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
+        offset = gridOffset + elemOffset;
+        nelem = min(chunkCount, channelCount - elemOffset);
+        prims.recv(offset, nelem);
+      }
+      return;
+    }
+
+    // Whether our partial result is in recvbuff yet
+    bool inOutput = false;
+    if (recDbl->extra != -1) {
+      Primitives<T, RedOp, FanAsymmetric<1, 0>, /*Direct=*/0, Proto, 0> prims
+        (tid, nthreads, &recDbl->extra, NULL, args->sendbuff, args->recvbuff, args->redOpArg);
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
+        offset = gridOffset + elemOffset;
+        nelem = min(chunkCount, channelCount - elemOffset);
+        prims.recvReduceCopy(offset, offset, nelem);
+      }
+      inOutput = true;
+    }
+
+    for (int r = 0; r < recDbl->nPeers; r++) {
+      const bool last = r == recDbl->nPeers-1;
+      Primitives<T, RedOp, FanSymmetric<1>, /*Direct=*/0, Proto, 0> prims
+        (tid, nthreads, recDbl->peers+r, recDbl->peers+r, inOutput ? args->recvbuff : args->sendbuff, args->recvbuff, args->redOpArg);
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
+        offset = gridOffset + elemOffset;
+        nelem = min(chunkCount, channelCount - elemOffset);
+        // The send completes before recvReduceCopy overwrites what it read
+        prims.send(offset, nelem);
+        prims.recvReduceCopy(offset, offset, nelem, /*postOp=*/last);
+      }
+      inOutput = true;
+    }
+
+    if (recDbl->extra != -1) {
+      Primitives<T, RedOp, FanAsymmetric<0, 1>, /*Direct=*/0, Proto, 0> prims
+        (tid, nthreads, NULL, &recDbl->extra, args->sendbuff, args->recvbuff, args->redOpArg);
+      for (size_t elemOffset = 0; elemOffset < channelCount; elemOffset += chunkCount) {
+        offset = gridOffset + elemOffset;
+        nelem = min(chunkCount, channelCount - elemOffset);
+        prims.sendFromOutput(offset, nelem);
+      }
+    }
+  }
 }
 
 template<typename T, typename RedOp>
 struct RunWorkElement<ncclFuncAllReduce, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE> {
   __device__ __forceinline__ void run(ncclWorkElem *args) {
     using Proto = ProtoSimple<ALLREDUCE_CHUNKSTEPS/ALLREDUCE_SLICESTEPS, ALLREDUCE_SLICESTEPS>;
-    runRing<T, RedOp, Proto>(args);
+    runRingSpecialized<T, RedOp, Proto>(args);
+  }
+};
+
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncAllReduce, T, RedOp, NCCL_ALGO_HIER, NCCL_PROTO_SIMPLE> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    using Proto = ProtoSimple<ALLREDUCE_CHUNKSTEPS/ALLREDUCE_SLICESTEPS, ALLREDUCE_SLICESTEPS>;
+    runHier<T, RedOp, Proto>(args);
   }
 };
 
@@ -740,3 +986,24 @@ struct RunWorkElement<ncclFuncAllReduce, T, RedOp, NCCL_ALGO_TREE, NCCL_PROTO_LL
     runTreeSplit<T, RedOp, ProtoLL128>(args);
   }
 };
+
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncAllReduce, T, RedOp, NCCL_ALGO_RECDBL, NCCL_PROTO_SIMPLE> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    runRecDbl<T, RedOp, ProtoSimple<1, 1>>(args);
+  }
+};
+
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncAllReduce, T, RedOp, NCCL_ALGO_RECDBL, NCCL_PROTO_LL> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    runRecDbl<T, RedOp, ProtoLL>(args);
+  }
+};
+
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncAllReduce, T, RedOp, NCCL_ALGO_RECDBL, NCCL_PROTO_LL128> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    runRecDbl<T, RedOp, ProtoLL128>(args);
+  }
+};
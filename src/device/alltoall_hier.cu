@@ -0,0 +1,34 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "alloc.h"
+#include "collectives.h"
+#include "common_kernel.h"
+#include "common.h"
+#include <cuda_runtime.h>
+
+namespace {
+  // dst block i = src block map[i]
+  __global__ __launch_bounds__(256, 1)
+  void blockGather(char* dst, char const* src, size_t blockBytes, int n, int const* map) {
+    for (int i = blockIdx.x; i < n; i += gridDim.x) {
+      void* dstPtr = dst + i*blockBytes;
+      void* srcPtr = (void*)(src + map[i]*blockBytes);
+      uint64_t redOpArg = 0;
+      reduceCopy<COLL_UNROLL, FuncSum<uint8_t>, uint8_t, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>
+        (threadIdx.x, blockDim.x, redOpArg, &redOpArg, false, 1, &srcPtr, 1, &dstPtr, blockBytes);
+    }
+  }
+}
+
+ncclResult_t ncclLaunchBlockGather(void* dst, void const* src, size_t blockBytes, int n, int const* map, cudaStream_t stream) {
+  if (blockBytes == 0) return ncclSuccess;
+  void* args[5] = {&dst, &src, &blockBytes, &n, &map};
+  dim3 grid(std::min(n, 1024), 1, 1);
+  dim3 block(blockBytes < 4096 ? 64 : 256, 1, 1);
+  CUDACHECK(cudaLaunchKernel((void const*)&blockGather, grid, block, args, 0, stream));
+  return ncclSuccess;
+}
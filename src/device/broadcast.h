@@ -45,6 +45,75 @@ namespace {
       }
     }
   }
+
+  // Each loop handles nranks chunks, one per rank in ring order. The root first
+  // scatters them around the ring, farthest rank first, then the ring
+  // allgathers them.
+  template<typename T, typename RedOp, typename Proto>
+  __device__ __forceinline__ void runRingScatter(ncclWorkElem *args) {
+    const int tid = threadIdx.x;
+    const int nthreads = (int)args->nWarps * WARP_SIZE;
+    ncclRing *ring = &ncclShmem.channel.ring;
+    const int ringIx = ring->index;
+    const int nranks = ncclShmem.comm.nRanks;
+    const int root = args->root;
+    ssize_t chunkCount = args->chunkCount;
+    const ssize_t loopCount = nranks * chunkCount;
+    const ssize_t gridOffset = args->workOffset;
+    const ssize_t channelCount = args->workCount;
+    ssize_t offset;
+    int nelem;
+
+    T *inputBuf = (T*)args->sendbuff;
+    T *outputBuf = (T*)args->recvbuff;
+    Primitives<T, RedOp, FanSymmetric<1>, 0, Proto, 0>
+      prims(tid, nthreads, &ring->prev, &ring->next, inputBuf, outputBuf, args->redOpArg);
+
+    auto modRanks = [&]__device__(int r)->int {
+      return r - (r >= nranks ? nranks : 0);
+    };
+    // Our distance from the root going down the ring
+    int dist = 0;
+    while (ring->userRanks[(nranks-dist)%nranks] != root) dist++;
+    const int rootIx = modRanks(ringIx + nranks - dist);
+
+    for (ssize_t elemOffset = 0; elemOffset < channelCount; elemOffset += loopCount) {
+      ssize_t remCount = channelCount - elemOffset;
+      if (remCount < loopCount) chunkCount = args->lastChunkCount;
+
+      auto setChunk = [&]__device__(int chunk) {
+        ssize_t chunkOffset = chunk * chunkCount;
+        offset = gridOffset + elemOffset + chunkOffset;
+        nelem = (int)min(chunkCount, remCount - chunkOffset);
+      };
+
+      // Scatter: forward the chunks of the ranks further down, keep ours
+      for (int d = nranks-1; d > 0 && d >= dist; d--) {
+        setChunk(modRanks(rootIx + d));
+        if (dist == 0) {
+          if (inputBuf == outputBuf) prims.send(offset, nelem);
+          else prims.copySend(offset, offset, nelem);
+        } else if (d > dist) {
+          prims.recvSend(nelem);
+        } else {
+          prims.recv(offset, nelem);
+        }
+      }
+
+      // Allgather, the root already has all chunks
+      setChunk(ringIx);
+      if (dist != 0) prims.sendFromOutput(offset, nelem);
+      else if (inputBuf == outputBuf) prims.send(offset, nelem);
+      else prims.copySend(offset, offset, nelem);
+      for (int j = 1; j < nranks - 1; ++j) {
+        setChunk(modRanks(ringIx + nranks - j));
+        if (dist == 0) prims.recvSend(nelem);
+        else prims.recvCopySend(offset, nelem);
+      }
+      setChunk(modRanks(ringIx + 1));
+      prims.recv(offset, nelem);
+    }
+  }
 }
 
 template<typename T, typename RedOp>
@@ -68,3 +137,11 @@ struct RunWorkElement<ncclFuncBroadcast, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_LL
     runRing<T, RedOp, ProtoLL128>(args);
   }
 };
+
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncBroadcast, T, RedOp, NCCL_ALGO_RING_SCATTER, NCCL_PROTO_SIMPLE> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    using Proto = ProtoSimple<BROADCAST_CHUNKSTEPS/BROADCAST_SLICESTEPS, BROADCAST_SLICESTEPS>;
+    runRingScatter<T, RedOp, Proto>(args);
+  }
+};
@@ -0,0 +1,73 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "alloc.h"
+#include "collectives.h"
+#include "common_kernel.h"
+#include "common.h"
+#include <cuda_runtime.h>
+
+namespace {
+  // Logical block i of the Bruck algorithm is kept at position (rank-i)%n of
+  // the output, so the last round leaves blocks where they belong and no final
+  // rotation is needed. Round k exchanges the blocks whose index has bit k set,
+  // stored contiguously in a staging buffer at the rank of i among them.
+  __device__ __forceinline__ int bruckPos(int i, int rank, int n) {
+    return (rank - i + n) % n;
+  }
+  __device__ __forceinline__ int bruckSlot(int i, int k) {
+    return ((i >> (k+1)) << k) + (i & ((1<<k)-1));
+  }
+
+  // step < 0: dst[pos(i)] = src[(rank+i)%n], the initial rotation.
+  // mode pack: dst[slot(i)] = src[pos(i)] for i with bit step set.
+  // mode unpack: dst[pos(i)] = src[slot(i)] for i with bit step set.
+  __global__ __launch_bounds__(256, 1)
+  void bruckCopy(char* dst, char const* src, size_t blockBytes, int n, int rank, int step, bool unpack) {
+    for (int i = blockIdx.x; i < n; i += gridDim.x) {
+      size_t d, s;
+      if (step < 0) {
+        d = bruckPos(i, rank, n);
+        s = (rank + i) % n;
+      } else {
+        if (((i >> step) & 1) == 0) continue;
+        d = unpack ? bruckPos(i, rank, n) : bruckSlot(i, step);
+        s = unpack ? bruckSlot(i, step) : bruckPos(i, rank, n);
+      }
+      void* dstPtr = dst + d*blockBytes;
+      void* srcPtr = (void*)(src + s*blockBytes);
+      uint64_t redOpArg = 0;
+      reduceCopy<COLL_UNROLL, FuncSum<uint8_t>, uint8_t, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>
+        (threadIdx.x, blockDim.x, redOpArg, &redOpArg, false, 1, &srcPtr, 1, &dstPtr, blockBytes);
+    }
+  }
+
+  ncclResult_t bruckLaunch(void* dst, void const* src, size_t blockBytes, int n, int rank, int step, bool unpack, cudaStream_t stream) {
+    if (blockBytes == 0) return ncclSuccess;
+    void* args[7] = {&dst, &src, &blockBytes, &n, &rank, &step, &unpack};
+    dim3 grid(std::min(n, 1024), 1, 1);
+    dim3 block(blockBytes < 4096 ? 64 : 256, 1, 1);
+    CUDACHECK(cudaLaunchKernel((void const*)&bruckCopy, grid, block, args, 0, stream));
+    return ncclSuccess;
+  }
+}
+
+int ncclBruckStepBlocks(int nRanks, int step) {
+  int period = 1 << (step+1);
+  return (nRanks/period)*(period/2) + std::max(0, nRanks%period - period/2);
+}
+
+ncclResult_t ncclLaunchBruckRotate(void* recvbuff, void const* sendbuff, size_t blockBytes, int nRanks, int rank, cudaStream_t stream) {
+  return bruckLaunch(recvbuff, sendbuff, blockBytes, nRanks, rank, -1, false, stream);
+}
+
+ncclResult_t ncclLaunchBruckPack(void* stage, void const* recvbuff, size_t blockBytes, int nRanks, int rank, int step, cudaStream_t stream) {
+  return bruckLaunch(stage, recvbuff, blockBytes, nRanks, rank, step, false, stream);
+}
+
+ncclResult_t ncclLaunchBruckUnpack(void* recvbuff, void const* stage, size_t blockBytes, int nRanks, int rank, int step, cudaStream_t stream) {
+  return bruckLaunch(recvbuff, stage, blockBytes, nRanks, rank, step, true, stream);
+}
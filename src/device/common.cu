@@ -17,8 +17,64 @@ struct RunWorkNop {
   __device__ void run(ncclWork *w) {}
 };
 
-__global__ void ncclDevKernel_Generic(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead) {
-  ncclKernelMain<-1, RunWorkNop>(comm, channelMask, workHead);
+__global__ void ncclDevKernel_Generic(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead, const NCCL_GRID_CONSTANT struct ncclDevWorkFirst workFirst) {
+  ncclKernelMain<-1, RunWorkNop>(comm, channelMask, workHead, workFirst);
 }
 
+__global__ void ncclDevKernel_ArgsWork(const NCCL_GRID_CONSTANT struct ncclDevKernelArgsWork args) {
+  ncclKernelMain<-1, RunWorkNop>(args.comm, args.channelMask, (struct ncclWork*)args.works, args.workFirst);
+}
+
+// Launched once with one block per channel. Each iteration waits for the
+// launch stream to mark the next slot ready and for all blocks to be done with
+// the previous one, runs the slot's work if this channel is part of it, then
+// the last block to finish signals completion back to the stream.
+__global__ void ncclDevKernel_Resident(struct ncclDevComm* comm, struct ncclResidentFifo* fifo, struct ncclResidentFlags* flags) {
+  int tid = threadIdx.x;
+  int channelId = blockIdx.x;
+  if (tid == 0) ncclShmem.clusterAbortShared = 0;
+  for (uint32_t seq = 0; ; seq++) {
+    if (tid == 0) {
+      volatile uint32_t* ready = &flags->ready[seq%NCCL_RESIDENT_FIFO_DEPTH];
+      volatile uint32_t* done = &flags->done;
+      int state = 0;
+      while (state == 0) {
+        if (*ready == seq+1 && *done == seq) state = 1;
+        else if (*comm->abortFlag) state = 2;
+        else if (*(volatile uint32_t*)&fifo->stop && *(volatile uint32_t*)&fifo->stopSeq == seq) state = 2;
+      }
+      if (state == 1) {
+        volatile struct ncclResidentSlot* slot = &fifo->slots[seq%NCCL_RESIDENT_FIFO_DEPTH];
+        ncclShmem.residentWorkHead = slot->workHead;
+        ncclShmem.residentChannelMask = slot->channelMask;
+        ncclShmem.residentWorkIx = slot->workFirst.ix[channelId];
+        uint32_t arrival = slot->workFirst.arrival;
+        if (arrival != 0 && channelId == 0) ncclArrivalStamp(comm, arrival);
+      }
+      ncclShmem.residentState = state;
+    }
+    __syncthreads();
+    if (ncclShmem.residentState == 2) break;
+
+    uint64_t channelMask = ncclShmem.residentChannelMask;
+    if (channelMask & (1ull<<channelId)) {
+      ncclKernelRun<-1, RunWorkNop>(comm, channelId, ncclShmem.residentWorkHead, ncclShmem.residentWorkIx);
+    }
+    __syncthreads();
+
+    if (tid == 0) {
+      __threadfence_system();
+      if (atomicAdd(&flags->blocksArrived, 1) == gridDim.x-1) {
+        flags->blocksArrived = 0;
+        *(volatile uint32_t*)&fifo->consumed = seq+1;
+        __threadfence_system();
+        atomicExch(&flags->done, seq+1);
+      }
+    }
+  }
+}
+
+void* const ncclDevKernelResident = (void*)ncclDevKernel_Resident;
+void* const ncclDevKernelArgsWork = (void*)ncclDevKernel_ArgsWork;
+
 __device__ void ncclDevFunc_Nop() {}
@@ -28,6 +28,8 @@ struct ncclShmemGroup {
     unpackGroupShmem unpack;
   } devicePlugin;
   int32_t dstSizes[NCCL_MAX_ARITY+1];
+  uint32_t netCompressRecvMask; // Peers exchanging quantized slices, see network/compress
+  uint32_t netCompressSendMask;
 };
 
 struct ncclShmemData {
@@ -35,6 +37,15 @@ struct ncclShmemData {
   uint64_t redOpArgs[NCCL_MAX_ARITY+1];
   int channelId;
   int aborted;
+  int residentState;
+  struct ncclWork* residentWorkHead;
+  uint64_t residentChannelMask;
+  uint32_t residentWorkIx;
+  int hierRsDone; // Hierarchical AllReduce/AllGather progress, see all_reduce.h
+  int hierArDone;
+  int clusterAbortShared; // See ncclAbortFlag()
+  uint32_t clusterAbort;
+  uint32_t clusterDone;
   alignas(16) struct ncclDevComm comm;
   alignas(16) struct ncclDevChannel channel;
   alignas(16) struct ncclWork work;
@@ -75,6 +86,45 @@ inline __device__ void copyToShmem16(int tid, void* dst, void const* src, int by
   }
 }
 
+// Record when this rank reached a plan, for straggler detection.
+__device__ __forceinline__ void ncclArrivalStamp(struct ncclDevComm* comm, uint32_t arrival) {
+  uint64_t t;
+  asm volatile("mov.u64 %0, %%globaltimer;" : "=l"(t));
+  *(volatile uint64_t*)(comm->arrivals + arrival-1) = t;
+}
+
+#ifdef ENABLE_DEVICE_PROFILE
+__device__ __forceinline__ uint64_t ncclDevProfileTime() {
+  uint64_t t;
+  asm volatile("mov.u64 %0, %%globaltimer;" : "=l"(t));
+  return t;
+}
+
+// Append one [begin, now] event to this channel's ring. Several role threads of
+// a channel record concurrently so slots are claimed through an atomic head;
+// the host only consumes an event once its seq matches the slot it expects.
+__device__ __forceinline__ void ncclDevProfileRecord(int type, int proto, uint64_t begin, uint64_t step) {
+  struct ncclDevProfileEvent* events = ncclShmem.comm.profileEvents;
+  if (events == nullptr || !ncclShmem.work.header.profile) return;
+  uint64_t end = ncclDevProfileTime();
+  int channelId = ncclShmem.channelId;
+  uint64_t ix = atomicAdd((unsigned long long*)ncclShmem.comm.profileHeads + channelId, 1ULL);
+  struct ncclDevProfileEvent* e = events + channelId*NCCL_DEV_PROFILE_RING_SIZE + ix%NCCL_DEV_PROFILE_RING_SIZE;
+  e->begin = begin;
+  e->end = end;
+  e->step = (uint32_t)step;
+  e->type = type;
+  e->proto = proto;
+  __threadfence_system();
+  *(volatile uint32_t*)&e->seq = (uint32_t)(ix+1);
+}
+#define NCCL_DEV_PROFILE_START(t) uint64_t t = ncclDevProfileTime()
+#define NCCL_DEV_PROFILE_RECORD(type, proto, t, step) ncclDevProfileRecord(type, proto, t, step)
+#else
+#define NCCL_DEV_PROFILE_START(t) do {} while (0)
+#define NCCL_DEV_PROFILE_RECORD(type, proto, t, step) do {} while (0)
+#endif
+
 template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto>
 struct RunWorkElement {
   __device__ void run(ncclWorkElem*) {
@@ -82,12 +132,49 @@ struct RunWorkElement {
   }
 };
 
+// Copy the part of the segments this channel works on between the user
+// buffers and the fusion buffer, using all threads of the block.
+template<typename T>
+__device__ void ncclFusedCopy(struct ncclWorkElemFused* fe, bool toFusionBuff) {
+  size_t begin = fe->elem.workOffset;
+  size_t end = begin + fe->elem.workCount;
+  T* fusionBuff = (T*)fe->elem.recvbuff;
+  size_t segBegin = 0;
+  for (int s=0; s < fe->nSegments; s++) {
+    size_t segEnd = segBegin + fe->segments[s].count;
+    size_t lo = begin > segBegin ? begin : segBegin;
+    size_t hi = end < segEnd ? end : segEnd;
+    if (lo < hi) {
+      T* buff = fusionBuff + lo;
+      if (toFusionBuff) {
+        const T* user = (const T*)fe->segments[s].sendbuff + (lo - segBegin);
+        for (size_t i = threadIdx.x; i < hi - lo; i += blockDim.x) buff[i] = user[i];
+      } else {
+        T* user = (T*)fe->segments[s].recvbuff + (lo - segBegin);
+        for (size_t i = threadIdx.x; i < hi - lo; i += blockDim.x) user[i] = buff[i];
+      }
+    }
+    segBegin = segEnd;
+  }
+}
+
 template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto>
 struct RunWork {
   // This __forceinline__ is necessary. The compiler was inserting a function call
   // here from the LL ncclKernel.
   __device__ __forceinline__ void run(ncclWork *w) {
     int wid = threadIdx.x / WARP_SIZE;
+    if (w->header.type == ncclWorkTypeFusedColl) {
+      ncclWorkElemFused* fe = &w->fusedElem;
+      ncclFusedCopy<T>(fe, /*toFusionBuff=*/true);
+      __syncthreads();
+      if (wid < fe->elem.nWarps) {
+        RunWorkElement<Fn, T, RedOp, Algo, Proto>().run(&fe->elem);
+      }
+      __syncthreads();
+      ncclFusedCopy<T>(fe, /*toFusionBuff=*/false);
+      return;
+    }
     ncclWorkElem* we = w->header.type == ncclWorkTypeRegColl ? &w->regElems[0].elem : &w->elems[0];
     int stride = w->header.type == ncclWorkTypeRegColl ? sizeof(ncclWorkElemReg) : sizeof(ncclWorkElem);
     #pragma unroll 1
@@ -121,10 +208,105 @@ static __device__ void ncclRedopPtrDeref(struct ncclWorkElem* we) {
   }
 }
 
+// In a CGA cluster with comm.clusterAbortShared, only the first CTA polls the
+// abort flag in host memory and mirrors it in its shared memory, where the
+// other CTAs read it through distributed shared memory. This takes the PCIe
+// reads of the spinning threads off all but one CTA per cluster.
+__device__ __forceinline__ uint32_t ncclClusterCtaRank() {
+  uint32_t rank = 0;
+  #if __CUDA_ARCH__ >= 900
+  asm("mov.u32 %0, %%cluster_ctarank;" : "=r"(rank));
+  #endif
+  return rank;
+}
+__device__ __forceinline__ uint32_t ncclClusterNCtas() {
+  uint32_t n = 1;
+  #if __CUDA_ARCH__ >= 900
+  asm("mov.u32 %0, %%cluster_nctarank;" : "=r"(n));
+  #endif
+  return n;
+}
+// Address of ptr in the shared memory of the first CTA of the cluster
+__device__ __forceinline__ uint32_t ncclClusterLeaderAddr(void* ptr) {
+  uint32_t addr = cvta_to_shared(ptr);
+  #if __CUDA_ARCH__ >= 900
+  asm("mapa.shared::cluster.u32 %0, %0, 0;" : "+r"(addr));
+  #endif
+  return addr;
+}
+__device__ __forceinline__ void ncclClusterSync() {
+  #if __CUDA_ARCH__ >= 900
+  asm volatile("barrier.cluster.arrive;\n\tbarrier.cluster.wait;" ::: "memory");
+  #endif
+}
+
+__device__ __forceinline__ uint32_t ncclAbortFlag() {
+  #if __CUDA_ARCH__ >= 900
+  if (ncclShmem.clusterAbortShared) {
+    uint32_t abort;
+    if (ncclClusterCtaRank() != 0) {
+      asm volatile("ld.relaxed.cluster.shared::cluster.u32 %0, [%1];"
+          : "=r"(abort) : "r"(ncclClusterLeaderAddr(&ncclShmem.clusterAbort)) : "memory");
+      return abort;
+    }
+    abort = *ncclShmem.comm.abortFlag;
+    if (abort) *(volatile uint32_t*)&ncclShmem.clusterAbort = abort;
+    return abort;
+  }
+  #endif
+  return *ncclShmem.comm.abortFlag;
+}
+
+// Peers may only access our shared memory once we started, and until they
+// are done. The first CTA keeps polling for the others while it waits.
+__device__ __forceinline__ void ncclClusterEnter(struct ncclDevComm* comm) {
+  if (threadIdx.x == 0) {
+    ncclShmem.clusterAbortShared = comm->clusterAbortShared && ncclClusterNCtas() > 1;
+    ncclShmem.clusterAbort = 0;
+    ncclShmem.clusterDone = 0;
+  }
+  __syncthreads();
+  if (ncclShmem.clusterAbortShared) ncclClusterSync();
+}
+
+__device__ __forceinline__ void ncclClusterExit(struct ncclDevComm* comm) {
+  if (!ncclShmem.clusterAbortShared) return;
+  __syncthreads();
+  if (threadIdx.x == 0) {
+    if (ncclClusterCtaRank() == 0) {
+      while (*(volatile uint32_t*)&ncclShmem.clusterDone < ncclClusterNCtas()-1) {
+        if (*comm->abortFlag) *(volatile uint32_t*)&ncclShmem.clusterAbort = 1;
+      }
+    } else {
+      #if __CUDA_ARCH__ >= 900
+      asm volatile("red.relaxed.cluster.shared::cluster.add.u32 [%0], 1;"
+          :: "r"(ncclClusterLeaderAddr(&ncclShmem.clusterDone)) : "memory");
+      #endif
+    }
+  }
+  ncclClusterSync();
+}
+
+// Waits for the grid we are a programmatic dependent of to complete and flush
+// its memory, then allows our own dependents to launch. Both are no-ops when
+// the launch did not use programmatic stream serialization.
+__device__ __forceinline__ void ncclGridDependencySync() {
+  #if __CUDA_ARCH__ >= 900
+  asm volatile("griddepcontrol.wait;" ::: "memory");
+  asm volatile("griddepcontrol.launch_dependents;" ::: "memory");
+  #endif
+}
+
+// Runs the chain of work starting at workHead[workIx] on channelId.
+template<int SpecializedFnId, typename SpecializedRunWork>
+__device__ void ncclKernelRun(struct ncclDevComm* comm, int channelId, struct ncclWork* workHead, int workIx);
+
 template<int SpecializedFnId, typename SpecializedRunWork>
-__device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead) {
+__device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead, const struct ncclDevWorkFirst& workFirst) {
   int tid = threadIdx.x;
 
+  if (workFirst.arrival != 0 && blockIdx.x == 0 && tid == 0) ncclArrivalStamp(comm, workFirst.arrival);
+
   // To map blockId to channelId, we need the n'th set bit of channelMask which
   // is the inverse of counting the number of set bits among the the first n.
   if (tid < WARP_SIZE) {
@@ -141,8 +323,14 @@ __device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, s
       }
     }
   }
-  __syncthreads(); // publish ncclShmem.channelId
-  int channelId = ncclShmem.channelId;
+  ncclClusterEnter(comm); // also publishes ncclShmem.channelId
+  ncclKernelRun<SpecializedFnId, SpecializedRunWork>(comm, ncclShmem.channelId, workHead, workFirst.ix[ncclShmem.channelId]);
+  ncclClusterExit(comm);
+}
+
+template<int SpecializedFnId, typename SpecializedRunWork>
+__device__ void ncclKernelRun(struct ncclDevComm* comm, int channelId, struct ncclWork* workHead, int workIx) {
+  int tid = threadIdx.x;
   /* set abort flag to 0 */
   if (tid == 0) ncclShmem.aborted = 0;
 
@@ -166,7 +354,7 @@ __device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, s
       break;
     case 2:
       dst = &ncclShmem.work;
-      src = workHead + blockIdx.x;
+      src = workHead + workIx;
       bytes = sizeof(ncclWork);
       static_assert(sizeof(ncclWork) <= 16*WARP_SIZE, "ncclWork cannot be loaded by a single warp in one insn.");
       break;
@@ -178,6 +366,11 @@ __device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, s
   }
   __syncthreads(); // publish ncclShmem
 
+  // Everything above only read NCCL state. When launched as a programmatic
+  // dependent, wait for the previous kernel to complete before reading user
+  // buffers or device scalars, and let the next one start its own prologue.
+  if (ncclShmem.comm.programmaticLaunch) ncclGridDependencySync();
+
   while (true) {
     // Notify host that all fifo reads are complete.
     if (tid == 0 && ncclShmem.work.header.isLast && ncclShmem.work.header.inFifo) {
@@ -189,9 +382,12 @@ __device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, s
       if (tid < NCCL_MAX_WORK_ELEMENTS) ncclRedopPtrDeref(&ncclShmem.work.elems[tid]);
     } else if (ncclShmem.work.header.type == ncclWorkTypeRegColl) {
       if (tid < NCCL_MAX_WORK_ELEMENTS_REG) ncclRedopPtrDeref(&ncclShmem.work.regElems[tid].elem);
+    } else if (ncclShmem.work.header.type == ncclWorkTypeFusedColl) {
+      if (tid == 0) ncclRedopPtrDeref(&ncclShmem.work.fusedElem.elem);
     }
     __syncthreads();
 
+    NCCL_DEV_PROFILE_START(profWork);
     if (0 <= SpecializedFnId && ncclShmem.work.header.funcIndex == (unsigned)SpecializedFnId) {
       SpecializedRunWork().run(&ncclShmem.work);
     } else {
@@ -199,10 +395,12 @@ __device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, s
     }
 
     int workIxNext = ncclShmem.work.header.workNext;
+    int workBytesNext = ncclShmem.work.header.nextSize ? 16*ncclShmem.work.header.nextSize : sizeof(ncclWork);
     __syncthreads();
+    if (tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfileWork, NCCL_NUM_PROTOCOLS, profWork, ncclShmem.work.header.funcIndex);
     if (ncclShmem.work.header.isLast) break;
 
-    copyToShmem16(tid, &ncclShmem.work, workHead + workIxNext, sizeof(ncclWork));
+    copyToShmem16(tid, &ncclShmem.work, workHead + workIxNext, workBytesNext);
 
     { // Check whether the last operation was aborted and make sure all threads exit
       int aborted = tid == 0 ? *comm->abortFlag : 0;
@@ -212,12 +410,14 @@ __device__ void ncclKernelMain(struct ncclDevComm* comm, uint64_t channelMask, s
   }
 }
 
-__global__ void ncclDevKernel_Generic(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead);
+__global__ void ncclDevKernel_Generic(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead, const NCCL_GRID_CONSTANT struct ncclDevWorkFirst workFirst);
+__global__ void ncclDevKernel_ArgsWork(const NCCL_GRID_CONSTANT struct ncclDevKernelArgsWork args);
+__global__ void ncclDevKernel_Resident(struct ncclDevComm* comm, struct ncclResidentFifo* fifo, struct ncclResidentFlags* flags);
 __device__ void ncclDevFunc_Nop();
 
 #define DEFINE_ncclDevKernel(suffix, coll, redop, ty, algo, proto, specializedFnId) \
-  __global__ void ncclDevKernel_##suffix(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead) { \
-    ncclKernelMain<specializedFnId, RunWork<coll, ty, redop<ty>, algo, proto>>(comm, channelMask, workHead); \
+  __global__ void ncclDevKernel_##suffix(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead, const NCCL_GRID_CONSTANT struct ncclDevWorkFirst workFirst) { \
+    ncclKernelMain<specializedFnId, RunWork<coll, ty, redop<ty>, algo, proto>>(comm, channelMask, workHead, workFirst); \
   }
 
 #define DEFINE_ncclDevFunc(suffix, coll, redop, ty, algo, proto) \
@@ -259,4 +259,187 @@ __device__ __forceinline__ void reduceCopy(
      nDsts, [=]__device__(int i) { return dstPtrs[i]; }, nElts);
 }
 
+// Reduction of nSrcs sources into dst with warp specialization. With many
+// sources reduceCopy spends its issue slots on per-source address arithmetic
+// and keeps few loads in flight. Here threads [0, nLoadThreads) only copy
+// tiles of every source to shared memory (cp.async on sm_80 and later) while
+// the others reduce the previous stage out of shared memory and store it, so
+// loads of one stage overlap the reduction of the other. Stages are handed
+// over with named barriers 1 to 2*NStages. Pointers must be 16B aligned and
+// nBytes a multiple of 16; smem must hold NStages tiles of 16B per source.
+template<typename RedFn, int NStages, typename IntBytes>
+__device__ __forceinline__ void reduceWarpSpecialized(
+    int thread, int nThreads, int nLoadThreads, uint64_t redArg,
+    int nSrcs, void** srcPtrs, void* dstPtr, IntBytes nBytes,
+    void* smem, int smemBytes
+  ) {
+  int tileBytes = (smemBytes/(NStages*nSrcs)) & -16;
+  IntBytes nTiles = (nBytes + tileBytes-1)/tileBytes;
+  uint32_t smemBase = cvta_to_shared(smem);
+  int nReduceThreads = nThreads - nLoadThreads;
+  RedFn redFn(redArg);
+  for (IntBytes t=0; t < nTiles; t++) {
+    int stage = t%NStages;
+    IntBytes offset = t*tileBytes;
+    int nPacks = (nBytes-offset < tileBytes ? nBytes-offset : tileBytes)/16;
+    uint32_t stageAddr = smemBase + stage*nSrcs*tileBytes;
+    if (thread < nLoadThreads) {
+      // Wait for the reducers to be done with what we loaded NStages tiles ago
+      if (t >= NStages) asm volatile("bar.sync %0, %1;" :: "r"(1+NStages+stage), "r"(nThreads) : "memory");
+      for (int q=thread; q < nSrcs*nPacks; q += nLoadThreads) {
+        int s = q/nPacks, p = q%nPacks;
+        uint32_t sh = stageAddr + s*tileBytes + p*16;
+        uintptr_t g = cvta_to_global(srcPtrs[s]) + offset + p*16;
+        #if __CUDA_ARCH__ >= 800
+        asm volatile("cp.async.cg.shared.global [%0], [%1], 16;" :: "r"(sh), "l"(g) : "memory");
+        #else
+        st_shared<16>(sh, ld_volatile_global<16>(g));
+        #endif
+      }
+      #if __CUDA_ARCH__ >= 800
+      asm volatile("cp.async.wait_all;" ::: "memory");
+      #endif
+      asm volatile("bar.arrive %0, %1;" :: "r"(1+stage), "r"(nThreads) : "memory");
+    } else {
+      asm volatile("bar.sync %0, %1;" :: "r"(1+stage), "r"(nThreads) : "memory");
+      for (int p=thread-nLoadThreads; p < nPacks; p += nReduceThreads) {
+        BytePack<16> acc = ld_shared<16>(stageAddr + p*16);
+        for (int s=1; s < nSrcs; s++) {
+          acc = applyReduce(redFn, acc, ld_shared<16>(stageAddr + s*tileBytes + p*16));
+        }
+        st_global<16>(cvta_to_global(dstPtr) + offset + p*16, acc);
+      }
+      if (t + NStages < nTiles) asm volatile("bar.arrive %0, %1;" :: "r"(1+NStages+stage), "r"(nThreads) : "memory");
+    }
+  }
+}
+
+// Mixed precision collectives: the wire and the reduction use float while the
+// user input and/or output buffers hold half or bfloat16 values.
+template<typename T>
+struct UserCastable { static constexpr bool value = false; };
+template<>
+struct UserCastable<float> { static constexpr bool value = true; };
+
+inline __device__ float userCastLoad(void* ptr, intptr_t i, bool bf16) {
+  BytePack<2> v = ld_volatile_global<2>((uintptr_t)((uint16_t*)ptr + i));
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+  if (bf16) return __bfloat162float(fromPack<__nv_bfloat16>(v));
+#endif
+  return __half2float(fromPack<half>(v));
+}
+
+inline __device__ void userCastStore(void* ptr, intptr_t i, float v, bool bf16) {
+  BytePack<2> p;
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+  if (bf16) p = toPack<__nv_bfloat16>(__float2bfloat16_rn(v));
+  else
+#endif
+  p = toPack<half>(__float2half_rn(v));
+  st_global<2>((uintptr_t)((uint16_t*)ptr + i), p);
+}
+
+// Same as reduceCopy, except that srcs[0] (when castSrc0) and dsts[0] (when
+// castDst0) are narrow user buffers, converted on load and store. Only the
+// first source can be the user input, hence preOpSrc0.
+template<typename RedFn, typename T>
+__device__ __forceinline__ void userCastReduceCopy(
+    int thread, int nThreads,
+    uint64_t redArg, uint64_t *preOpArgs, bool postOp, bool preOpSrc0,
+    int nSrcs, void** srcs, bool castSrc0, int nDsts, void** dsts, bool castDst0,
+    bool bf16, int nElts
+  ) {
+  RedFn redFn(redArg);
+  RedFn preFn(preOpSrc0 ? preOpArgs[0] : 0);
+  #pragma unroll 1
+  for (int i=thread; i < nElts; i += nThreads) {
+    BytePack<sizeof(T)> acc = castSrc0 ? toPack<T>(userCastLoad(srcs[0], i, bf16))
+                                       : ld_volatile_global<sizeof(T)>((uintptr_t)((T*)srcs[0] + i));
+    if (preOpSrc0) acc = applyPreOp(preFn, acc);
+    #pragma unroll 1
+    for (int s=1; s < nSrcs; s++) {
+      acc = applyReduce(redFn, acc, ld_volatile_global<sizeof(T)>((uintptr_t)((T*)srcs[s] + i)));
+    }
+    if (postOp) acc = applyPostOp(redFn, acc);
+    #pragma unroll 1
+    for (int d=0; d < nDsts; d++) {
+      if (d == 0 && castDst0) userCastStore(dsts[0], i, fromPack<T>(acc), bf16);
+      else st_global<sizeof(T)>((uintptr_t)((T*)dsts[d] + i), acc);
+    }
+  }
+}
+
+#if __CUDA_ARCH__ >= 900 && CUDART_VERSION >= 12010
+// Copy nBytes from src to every destination with the bulk copy engine
+// (cp.async.bulk), staging chunks in the warp's shared scratch so the data
+// never goes through registers. Lane 0 of each warp issues the copies; load
+// completion is tracked with an mbarrier held in the first 16 bytes of the
+// scratch. Addresses and nBytes must be 16B aligned.
+template<int MaxDsts, typename IntBytes>
+__device__ __forceinline__ void bulkCopyWarps(
+    int warp, int nWarps, int lane, void* scratch, int scratchBytes,
+    uintptr_t src, int nDsts, void** dstPtrs, IntBytes nBytes
+  ) {
+  uint32_t mbar = cvta_to_shared((uint64_t*)scratch);
+  uint32_t buff = mbar + 16;
+  IntBytes chunkBytes = (scratchBytes - 16) & -16;
+  if (lane == 0) {
+    uint32_t phase = 0;
+    asm volatile("mbarrier.init.shared.b64 [%0], 1;" :: "r"(mbar) : "memory");
+    // Order our earlier generic proxy accesses before the async proxy ones.
+    asm volatile("fence.proxy.async.global;" ::: "memory");
+    for (IntBytes offset = warp*chunkBytes; offset < nBytes; offset += nWarps*chunkBytes) {
+      uint32_t bytes = nBytes-offset < chunkBytes ? nBytes-offset : chunkBytes;
+      asm volatile("mbarrier.arrive.expect_tx.shared.b64 _, [%0], %1;" :: "r"(mbar), "r"(bytes) : "memory");
+      asm volatile("cp.async.bulk.shared::cluster.global.mbarrier::complete_tx::bytes [%0], [%1], %2, [%3];"
+          :: "r"(buff), "l"(src+offset), "r"(bytes), "r"(mbar) : "memory");
+      uint32_t done = 0;
+      while (!done) {
+        asm volatile("{ .reg .pred p; mbarrier.try_wait.parity.shared.b64 p, [%1], %2; selp.u32 %0, 1, 0, p; }"
+            : "=r"(done) : "r"(mbar), "r"(phase) : "memory");
+      }
+      phase ^= 1;
+      for (int d=0; d < MaxDsts && d < nDsts; d++) {
+        asm volatile("cp.async.bulk.global.shared::cta.bulk_group [%0], [%1], %2;"
+            :: "l"(cvta_to_global(dstPtrs[d])+offset), "r"(buff), "r"(bytes) : "memory");
+      }
+      asm volatile("cp.async.bulk.commit_group;" ::: "memory");
+      // Stores must have read the buffer before the next load overwrites it.
+      asm volatile("cp.async.bulk.wait_group.read 0;" ::: "memory");
+    }
+    asm volatile("cp.async.bulk.wait_group 0;" ::: "memory");
+    asm volatile("fence.proxy.async.global;" ::: "memory");
+    asm volatile("mbarrier.inval.shared.b64 [%0];" :: "r"(mbar) : "memory");
+  }
+  __syncwarp();
+}
+#endif
+
+// Pure copy of one source to nDsts destinations. On sm_90 the 16B aligned
+// part goes through the bulk copy engine, needing a single thread per warp;
+// the rest, or everything on older GPUs, falls back to reduceCopy.
+template<int Unroll, typename RedFn, typename T, int MaxDsts, typename IntBytes>
+__device__ __forceinline__ void bulkCopy(
+    int thread, int nThreads, void* scratch, int scratchBytes,
+    void* src, int nDsts, void** dstPtrs, IntBytes nElts
+  ) {
+  IntBytes nBytes = 0;
+  #if __CUDA_ARCH__ >= 900 && CUDART_VERSION >= 12010
+  int lane = thread%WARP_SIZE;
+  bool aligned = 0 == cvta_to_global(src)%16;
+  if (lane < nDsts) aligned &= 0 == cvta_to_global(dstPtrs[lane])%16;
+  if (__all_sync(~0u, aligned)) {
+    nBytes = (nElts*IntBytes(sizeof(T))) & -16;
+    bulkCopyWarps<MaxDsts>(thread/WARP_SIZE, nThreads/WARP_SIZE, lane, scratch, scratchBytes,
+                           cvta_to_global(src), nDsts, dstPtrs, nBytes);
+  }
+  #endif
+  IntBytes nEltsDone = nBytes/IntBytes(sizeof(T));
+  if (nEltsDone == nElts) return;
+  reduceCopy<Unroll, RedFn, T, 0, 1, 1, 0, 0, MaxDsts, /*PreOpSrcs*/0>
+    (thread, nThreads, /*redArg*/0, /*preOpArgs*/nullptr, /*postOp*/false,
+     1, [=]__device__(int i) { return (T*)src + nEltsDone; },
+     nDsts, [=]__device__(int i) { return (T*)dstPtrs[i] + nEltsDone; }, nElts - nEltsDone);
+}
+
 #endif // COMMON_KERNEL_H_
@@ -0,0 +1,163 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "alloc.h"
+#include "collectives.h"
+#include "common_kernel.h"
+#include "common.h"
+#include <cuda_runtime.h>
+
+namespace {
+  struct DirectSrcs {
+    void* ptrs[NCCL_MAX_LOCAL_RANKS];
+  };
+
+  template<typename RedOp>
+  __global__ __launch_bounds__(512, 1)
+  void directReduce(void* dst, DirectSrcs srcs, int nSrcs, size_t nElts, uint64_t redOpArg) {
+    using T = typename RedOp::EltType;
+    __shared__ void* shSrcs[NCCL_MAX_LOCAL_RANKS];
+    int tid = threadIdx.x;
+    int tn = blockDim.x;
+    int bid = blockIdx.x;
+    int bn = gridDim.x;
+
+    // each block gets a roughly equal segment of 16 byte packs
+    constexpr int EltPerPack = 16/sizeof(T);
+    intptr_t i0 = (bid+0)*alignUp(nElts/bn, EltPerPack);
+    intptr_t i1 = (bid+1)*alignUp(nElts/bn, EltPerPack);
+    i0 = min(i0, nElts);
+    i1 = min(i1, nElts);
+    if (bid == bn-1) i1 = nElts;
+    for (int s=tid; s < nSrcs; s += tn) shSrcs[s] = (T*)srcs.ptrs[s] + i0;
+    dst = (T*)dst + i0;
+    __syncthreads();
+    reduceCopy<COLL_UNROLL, RedOp, T, 0,1,NCCL_MAX_LOCAL_RANKS, 0,1,1, /*PreOpSrcs=*/0>
+      (tid, tn, redOpArg, &redOpArg, false, nSrcs, shSrcs, 1, &dst, i1-i0);
+  }
+
+  // Same as directReduce with warp specialized loads, for many sources. The
+  // 16 byte packs are split between blocks; the last block also does the
+  // remaining elements with reduceCopy.
+  constexpr int DirectReduceLoadThreads = 128;
+  constexpr int DirectReduceSmemBytes = 32<<10;
+  constexpr int DirectReduceWarpSpecMinSrcs = 4;
+
+  template<typename RedOp>
+  __global__ __launch_bounds__(512, 1)
+  void directReduceWarpSpec(void* dst, DirectSrcs srcs, int nSrcs, size_t nElts, uint64_t redOpArg) {
+    using T = typename RedOp::EltType;
+    extern __shared__ ulong2 directReduceSmem[];
+    __shared__ void* shSrcs[NCCL_MAX_LOCAL_RANKS];
+    int tid = threadIdx.x;
+    int tn = blockDim.x;
+    int bid = blockIdx.x;
+    int bn = gridDim.x;
+
+    size_t nPacks = nElts*sizeof(T)/16;
+    size_t p0 = min((bid+0)*divUp(nPacks, bn), nPacks);
+    size_t p1 = min((bid+1)*divUp(nPacks, bn), nPacks);
+    for (int s=tid; s < nSrcs; s += tn) shSrcs[s] = (char*)srcs.ptrs[s] + p0*16;
+    __syncthreads();
+    reduceWarpSpecialized<RedOp, /*NStages=*/2>
+      (tid, tn, DirectReduceLoadThreads, redOpArg, nSrcs, shSrcs, (char*)dst + p0*16, (p1-p0)*16,
+       directReduceSmem, DirectReduceSmemBytes);
+
+    size_t e0 = nPacks*16/sizeof(T);
+    if (bid != bn-1 || e0 == nElts) return;
+    __syncthreads();
+    for (int s=tid; s < nSrcs; s += tn) shSrcs[s] = (T*)srcs.ptrs[s] + e0;
+    dst = (T*)dst + e0;
+    __syncthreads();
+    reduceCopy<COLL_UNROLL, RedOp, T, 0,1,NCCL_MAX_LOCAL_RANKS, 0,1,1, /*PreOpSrcs=*/0>
+      (tid, tn, redOpArg, &redOpArg, false, nSrcs, shSrcs, 1, &dst, nElts-e0);
+  }
+
+  // dst[p*sliceBytes + i] = srcs[p][i] for i < sliceBytes, up to nBytes in
+  // total. blockIdx.y picks the source.
+  __global__ __launch_bounds__(512, 1)
+  void directGather(void* dst, DirectSrcs srcs, size_t sliceBytes, size_t nBytes) {
+    int tid = threadIdx.x;
+    int tn = blockDim.x;
+    int bid = blockIdx.x;
+    int bn = gridDim.x;
+    intptr_t s0 = blockIdx.y*sliceBytes;
+    intptr_t s1 = min(s0 + sliceBytes, nBytes);
+    if (s0 >= s1) return;
+    intptr_t i0 = min(s0 + (bid+0)*alignUp((s1-s0)/bn, 16), s1);
+    intptr_t i1 = bid == bn-1 ? s1 : min(s0 + (bid+1)*alignUp((s1-s0)/bn, 16), s1);
+    void* src = (char*)srcs.ptrs[blockIdx.y] + (i0-s0);
+    dst = (char*)dst + i0;
+    uint64_t redOpArg = 0;
+    reduceCopy<COLL_UNROLL, FuncSum<uint8_t>, uint8_t, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>
+      (tid, tn, redOpArg, &redOpArg, false, 1, &src, 1, &dst, i1-i0);
+  }
+
+  template<typename RedOp>
+  void const* directReduceKernel(bool warpSpec) {
+    return warpSpec ? (void const*)&directReduceWarpSpec<RedOp> : (void const*)&directReduce<RedOp>;
+  }
+
+  template<template<typename> class RedOp>
+  void const* directReduceKernel(ncclDataType_t eltType, bool warpSpec) {
+    switch (eltType) {
+    case ncclInt8:     return directReduceKernel<RedOp<int8_t>>(warpSpec);
+    case ncclUint8:    return directReduceKernel<RedOp<uint8_t>>(warpSpec);
+    case ncclInt32:    return directReduceKernel<RedOp<int32_t>>(warpSpec);
+    case ncclUint32:   return directReduceKernel<RedOp<uint32_t>>(warpSpec);
+    case ncclInt64:    return directReduceKernel<RedOp<int64_t>>(warpSpec);
+    case ncclUint64:   return directReduceKernel<RedOp<uint64_t>>(warpSpec);
+    case ncclFloat16:  return directReduceKernel<RedOp<half>>(warpSpec);
+    #if defined(__CUDA_BF16_TYPES_EXIST__)
+    case ncclBfloat16: return directReduceKernel<RedOp<__nv_bfloat16>>(warpSpec);
+    #endif
+    #if defined(__CUDA_FP8_TYPES_EXIST__)
+    case ncclFloat8e4m3: return directReduceKernel<RedOp<__nv_fp8_e4m3>>(warpSpec);
+    case ncclFloat8e5m2: return directReduceKernel<RedOp<__nv_fp8_e5m2>>(warpSpec);
+    #endif
+    case ncclFloat32:  return directReduceKernel<RedOp<float>>(warpSpec);
+    case ncclFloat64:  return directReduceKernel<RedOp<double>>(warpSpec);
+    default: return nullptr;
+    }
+  }
+}
+
+ncclResult_t ncclLaunchDirectReduce(void* dst, void* const* srcs, int nSrcs, size_t nElts, struct ncclDevRedOpFull redOp, ncclDataType_t eltType, cudaStream_t stream) {
+  void const* kernel = nullptr;
+  if (nSrcs > NCCL_MAX_LOCAL_RANKS || redOp.scalarArgIsPtr) return ncclInvalidArgument;
+  // Past a few sources, staging loads through shared memory beats reduceCopy
+  bool warpSpec = nSrcs >= DirectReduceWarpSpecMinSrcs && (uintptr_t)dst%16 == 0;
+  for (int s=0; s < nSrcs; s++) warpSpec &= (uintptr_t)srcs[s]%16 == 0;
+  switch (redOp.op) {
+  case ncclDevSum:    kernel = directReduceKernel<FuncSum>(eltType, warpSpec); break;
+  case ncclDevProd:   kernel = directReduceKernel<FuncProd>(eltType, warpSpec); break;
+  case ncclDevMinMax: kernel = directReduceKernel<FuncMinMax>(eltType, warpSpec); break;
+  default: break;
+  }
+  if (kernel == nullptr) return ncclInvalidArgument;
+
+  DirectSrcs ptrs;
+  for (int s=0; s < nSrcs; s++) ptrs.ptrs[s] = srcs[s];
+  size_t eltSize = ncclTypeSize(eltType);
+  dim3 grid = {0, 1, 1};
+  grid.x = std::max(1, std::min(32, (int)divUp(nElts*eltSize, 64<<10)));
+  dim3 block = {512, 1, 1};
+  void* args[5] = {&dst, &ptrs, &nSrcs, &nElts, &redOp.scalarArg};
+  CUDACHECK(cudaLaunchKernel(kernel, grid, block, args, warpSpec ? DirectReduceSmemBytes : 0, stream));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclLaunchDirectGather(void* dst, void* const* srcs, int nSrcs, size_t sliceBytes, size_t nBytes, cudaStream_t stream) {
+  if (nSrcs > NCCL_MAX_LOCAL_RANKS) return ncclInvalidArgument;
+  DirectSrcs ptrs;
+  for (int s=0; s < nSrcs; s++) ptrs.ptrs[s] = srcs[s];
+  dim3 grid = {0, (unsigned)nSrcs, 1};
+  grid.x = std::max(1, std::min(4, (int)divUp(sliceBytes, 64<<10)));
+  dim3 block = {512, 1, 1};
+  void* args[4] = {&dst, &ptrs, &sliceBytes, &nBytes};
+  CUDACHECK(cudaLaunchKernel((void const*)&directGather, grid, block, args, 0, stream));
+  return ncclSuccess;
+}
@@ -5,9 +5,9 @@ import sys
 # Order of redops, tys, protos, algos must match src/include/device.h
 all_colls =  ["Broadcast","Reduce","AllGather","ReduceScatter","AllReduce","SendRecv"]
 all_redops = ["Sum","Prod","MinMax","PreMulSum","SumPostDiv"]
-all_tys =    ["i8","u8","i32","u32","i64","u64","f16","f32","f64","bf16"]
+all_tys =    ["i8","u8","i32","u32","i64","u64","f16","f32","f64","bf16","f8e4m3","f8e5m2"]
 all_protos = ["LL","LL128","SIMPLE"]
-all_algos =  ["TREE","RING","COLLNET_DIRECT","COLLNET_CHAIN","NVLS","NVLS_TREE"]
+all_algos =  ["TREE","RING","COLLNET_DIRECT","COLLNET_CHAIN","NVLS","NVLS_TREE","HIER","RING_SCATTER","RECDBL"]
 
 ################################################################################
 # The first command line argument is the path to the directory to generate and
@@ -71,13 +71,21 @@ else:
   def func_filter(coll, redop, ty, algo, proto):
     return True
 
+################################################################################
+# The third command line argument lists the ring sizes for which AllReduce
+# RING SIMPLE gets a variant with the number of ranks known at compile time,
+# e.g. "2 4 8". The Makefile forwards it from the RING_NRANKS variable; empty
+# means no specialization.
+
+ring_nranks = [int(x) for x in (sys.argv[3] if len(sys.argv) > 3 else "").split()]
+
 ################################################################################
 
 algos_of_coll = {
-  "AllGather":     ["RING","COLLNET_DIRECT","NVLS"],
+  "AllGather":     ["RING","COLLNET_DIRECT","NVLS","HIER"],
   "AllReduce":     all_algos,
-  "Broadcast":     ["RING"],
-  "Reduce":        ["RING"],
+  "Broadcast":     ["RING","RING_SCATTER"],
+  "Reduce":        ["RING","RING_SCATTER"],
   "ReduceScatter": ["RING","COLLNET_DIRECT","NVLS"],
   "SendRecv":      [None]
 }
@@ -102,11 +110,17 @@ def required_cuda(coll, redop, ty, algo, proto):
   # kernels mapped to by coll="Nop" functions have coll="Generic"
   if coll in ("SendRecv", "Generic", "Nop"): return (cudart, arch)
 
-  if proto!="SIMPLE" and algo not in ("RING","TREE"): return None
+  if proto!="SIMPLE" and algo not in ("RING","TREE","RECDBL"): return None
+
+  # The HIER inter-node ring would apply the pre-multiplication again, see all_reduce.h
+  if algo=="HIER" and redop=="PreMulSum": return None
+  if algo=="RING_SCATTER" and coll not in ("Broadcast","Reduce"): return None
+  # Rounds after the first read their input from the output, see all_reduce.h
+  if algo=="RECDBL" and (coll!="AllReduce" or redop=="PreMulSum"): return None
 
   if coll in ("AllReduce","Reduce","ReduceScatter"):
-    if redop=="SumPostDiv" and ty[0] not in ("i","u"): return None
     if ty=="bf16": cudart = max(cudart, 11000)
+    if ty in ("f8e4m3","f8e5m2"): cudart = max(cudart, 11080)
 
   if "NVLS" in algo:
     if coll in ("AllReduce","Reduce","ReduceScatter"):
@@ -360,7 +374,9 @@ ty_to_cxx = {
   "f16": "half",
   "f32": "float",
   "f64": "double",
-  "bf16": "__nv_bfloat16"
+  "bf16": "__nv_bfloat16",
+  "f8e4m3": "__nv_fp8_e4m3",
+  "f8e5m2": "__nv_fp8_e5m2"
 }
 
 # Generate each <gensrc>/<impl>.cu:
@@ -368,6 +384,8 @@ for name in name_to_funcs.keys():
   (coll, fns) = name_to_funcs[name]
   with open(os.path.join(gensrc, name), "w") as f:
     out = f.write
+    if coll == "AllReduce" and ring_nranks:
+      out("#define NCCL_RING_NRANKS_SPECIALIZATIONS(X) %s\n" % " ".join("X(%d)" % n for n in ring_nranks))
     out(
       '#include "common.h"\n'
       '#include "{lower_coll}.h"\n'
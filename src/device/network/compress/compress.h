@@ -0,0 +1,115 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+#ifndef NET_DEVICE_COMPRESS_H
+#define NET_DEVICE_COMPRESS_H
+
+#include "op128.h"
+#include "align.h"
+#include "reduce_kernel.h"
+
+// Block-scaled 8-bit format used on network connections with NCCL_NET_COMPRESS.
+// A slice of n elements is stored as divUp(n, 32) int8 exponents, padded to 16
+// bytes, followed by n int8 values. Element i decodes as q[i]*2^exp[i/32].
+// Using power-of-two scales makes decoding and re-encoding a value exact, so
+// data forwarded along a ring arrives bit-identical on every rank.
+#define NET_COMPRESS_BLOCK WARP_SIZE
+
+template<typename T, typename RedOp>
+struct NetCompressible { static constexpr bool value = false; };
+template<>
+struct NetCompressible<float, FuncSum<float>> { static constexpr bool value = true; };
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+template<>
+struct NetCompressible<__nv_bfloat16, FuncSum<__nv_bfloat16>> { static constexpr bool value = true; };
+#endif
+
+inline __device__ int netCompressExpBytes(int nelem) {
+  return alignUp(divUp(nelem, NET_COMPRESS_BLOCK), 16);
+}
+
+inline __device__ int netCompressSize(int nelem) {
+  return netCompressExpBytes(nelem) + nelem;
+}
+
+template<typename T>
+inline __device__ float netCompressToFloat(T v) { return float(v); }
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+template<>
+inline __device__ float netCompressToFloat<__nv_bfloat16>(__nv_bfloat16 v) { return __bfloat162float(v); }
+#endif
+
+template<typename T>
+inline __device__ T netCompressCast(float v) { return T(v); }
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+template<>
+inline __device__ __nv_bfloat16 netCompressCast<__nv_bfloat16>(float v) { return __float2bfloat16_rn(v); }
+#endif
+
+// Sum nSrcs sources into nDsts destinations, in float. Sources and destinations
+// whose bit is set in srcMask/dstMask hold compressed slices. When a destination
+// is compressed, the others receive the decoded values so that all copies of
+// the result match what the peer will decode. Each warp handles one block.
+template<typename T>
+__device__ __forceinline__ void netCompressReduceCopy(
+    int tid, int nthreads,
+    int nSrcs, void** srcs, uint32_t srcMask,
+    int nDsts, void** dsts, uint32_t dstMask,
+    int nelem
+  ) {
+  int const lane = tid%WARP_SIZE;
+  int const nWarps = nthreads/WARP_SIZE;
+  int const nBlocks = divUp(nelem, NET_COMPRESS_BLOCK);
+  int const expBytes = netCompressExpBytes(nelem);
+
+  #pragma unroll 1
+  for (int b = tid/WARP_SIZE; b < nBlocks; b += nWarps) {
+    int const e = b*NET_COMPRESS_BLOCK + lane;
+    bool const valid = e < nelem;
+    float acc = 0.0f;
+    #pragma unroll 1
+    for (int s=0; s<nSrcs; s++) {
+      char* src = (char*)srcs[s];
+      if (!valid) continue;
+      if ((srcMask >> s) & 1) {
+        int8_t exp = (int8_t)ld_volatile_global<1>((uintptr_t)(src + b)).u8;
+        int8_t q = (int8_t)ld_volatile_global<1>((uintptr_t)(src + expBytes + e)).u8;
+        acc += __int_as_float((exp+127) << 23) * q;
+      } else {
+        acc += netCompressToFloat<T>(fromPack<T>(ld_volatile_global<sizeof(T)>((uintptr_t)((T*)src + e))));
+      }
+    }
+    T out = netCompressCast<T>(acc);
+    int8_t exp = 0, q = 0;
+    if (dstMask) {
+      // Round to T first, so the result does not depend on which hop encodes it
+      float v = valid ? netCompressToFloat<T>(out) : 0.0f;
+      float absmax = fabsf(v);
+      #pragma unroll
+      for (int o=WARP_SIZE/2; o>0; o/=2) absmax = fmaxf(absmax, __shfl_xor_sync(~0u, absmax, o));
+      // Smallest power of two with absmax/2^x < 127
+      int x;
+      frexpf(absmax/127.0f, &x);
+      x = min(max(x, -126), 126);
+      exp = x;
+      q = (int8_t)__float2int_rn(v * __int_as_float((127-x) << 23));
+      out = netCompressCast<T>(__int_as_float((x+127) << 23) * q);
+    }
+    #pragma unroll 1
+    for (int d=0; d<nDsts; d++) {
+      char* dst = (char*)dsts[d];
+      if (dst == nullptr) continue; // empty send
+      if ((dstMask >> d) & 1) {
+        BytePack<1> p;
+        if (lane == 0) { p.u8 = (uint8_t)exp; st_global<1>((uintptr_t)(dst + b), p); }
+        if (valid) { p.u8 = (uint8_t)q; st_global<1>((uintptr_t)(dst + expBytes + e), p); }
+      } else if (valid) {
+        st_global<sizeof(T)>((uintptr_t)((T*)dst + e), toPack<T>(out));
+      }
+    }
+  }
+}
+
+#endif
@@ -47,7 +47,10 @@ namespace {
 
 ncclResult_t ncclLaunchOneRank(void* dst, void const* src, size_t nElts, struct ncclDevRedOpFull redOp, ncclDataType_t eltType, cudaStream_t stream) {
   size_t eltSize = ncclTypeSize(eltType);
-  if (redOp.op != ncclDevPreMulSum) {
+  // With a single rank, post-multiplying floating point values is the same as
+  // pre-multiplying them. Integer post-division by 1 is a copy.
+  bool postMul = redOp.op == ncclDevSumPostDiv && ncclTypeIsFloat(eltType);
+  if (redOp.op != ncclDevPreMulSum && !postMul) {
     if (dst != src) {
       NCCLCHECK(ncclCudaMemcpyAsync((char*)dst, (char*)src, nElts*eltSize, stream));
     }
@@ -66,6 +69,10 @@ ncclResult_t ncclLaunchOneRank(void* dst, void const* src, size_t nElts, struct
   #if defined(__CUDA_BF16_TYPES_EXIST__)
   case ncclBfloat16: kernel = (void const*)&oneRankReduce<FuncPreMulSum<__nv_bfloat16>>; break;
   #endif
+  #if defined(__CUDA_FP8_TYPES_EXIST__)
+  case ncclFloat8e4m3: kernel = (void const*)&oneRankReduce<FuncPreMulSum<__nv_fp8_e4m3>>; break;
+  case ncclFloat8e5m2: kernel = (void const*)&oneRankReduce<FuncPreMulSum<__nv_fp8_e5m2>>; break;
+  #endif
   case ncclFloat32:  kernel = (void const*)&oneRankReduce<FuncPreMulSum<float>>; break;
   case ncclFloat64:  kernel = (void const*)&oneRankReduce<FuncPreMulSum<double>>; break;
   default: return ncclInvalidArgument;
@@ -55,7 +55,7 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL, P2p>:
   inline __device__ int checkAbort(int &spins, int send) {
     spins++;
     if (abort == 0 && spins == NCCL_SPINS_BEFORE_CHECK_ABORT) {
-      abort = *ncclShmem.comm.abortFlag;
+      abort = ncclAbortFlag();
       spins = 0;
     }
     return abort;
@@ -232,7 +232,10 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL, P2p>:
 
     // Always waitSend in case of cleanup
     nelem = nelem < 0 ? 0 : nelem;
+    NCCL_DEV_PROFILE_START(profWait);
     if (SEND) waitSend(divUp(nelem, EltPerLine)*sizeof(ncclLLFifoLine));
+    if (SEND && tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfileWaitSend, NCCL_PROTO_LL, profWait, sendStep[0]);
+    NCCL_DEV_PROFILE_START(profReduce);
 
     nelem -= tid*EltPerLine;
     srcElts += tid*EltPerLine;
@@ -281,7 +284,9 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL, P2p>:
       nelem -= eltPerTrip;
       offset += nthreads;
     }
+    if (tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfileReduce, NCCL_PROTO_LL, profReduce, RECV ? recvStep[0] : sendStep[0]);
 
+    NCCL_DEV_PROFILE_START(profPost);
     if (RECV) {
       for (int i=0; i < MaxRecv; i++) incRecv(i);
       postRecv();
@@ -291,6 +296,7 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL, P2p>:
         incSend(i, offset);
       incSend(0, offset);
     }
+    if (tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfilePost, NCCL_PROTO_LL, profPost, (RECV ? recvStep[0] : sendStep[0])-1);
   }
 
   __device__ __forceinline__ void loadRecvConn(struct ncclConnInfo* conn, int i) {
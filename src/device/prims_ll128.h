@@ -58,7 +58,7 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL128, P2p>:
   inline __device__ int checkAbort(int &spins, int i, int send) {
     spins++;
     if (abort == 0 && spins == NCCL_SPINS_BEFORE_CHECK_ABORT) {
-      abort = *ncclShmem.comm.abortFlag;
+      abort = ncclAbortFlag();
       spins = 0;
     }
     return abort;
@@ -182,14 +182,26 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL128, P2p>:
 
   #define WARP_MASK 0xffffffff
 
+  // With staged set, data of the first recv was polled by another warp and is
+  // read from shared memory; stagedEmpty is set to stagedSeq once it's read.
   template <int ELEMS_PER_THREAD, int RECV, int SEND, int SrcBuf, int DstBuf>
-  __device__ __forceinline__ void recvReduceSendCopy(uint64_t(&v)[ELEMS_PER_THREAD], int ll128Offset, bool postOp) {
+  __device__ __forceinline__ void recvReduceSendCopy(uint64_t(&v)[ELEMS_PER_THREAD], int ll128Offset, bool postOp,
+      uint64_t* staged = nullptr, volatile uint32_t* stagedEmpty = nullptr, uint32_t stagedSeq = 0) {
     constexpr int SRC = SrcBuf != -1 ? 1 : 0;
     uint64_t vr[ELEMS_PER_THREAD];
 
     __syncwarp();
     /************************ Wait first recv ********************/
-    if (RECV) {
+    if (RECV && staged) {
+      #pragma unroll
+      for (int u=0; u<ELEMS_PER_THREAD; u+=2)
+        loadShmem128(staged+u*WARP_SIZE, vr[u], vr[u+1]);
+      __syncwarp();
+      if (wid == 0) {
+        __threadfence_block();
+        *stagedEmpty = stagedSeq;
+      }
+    } else if (RECV) {
       uint64_t* ptr = recvPtr(0)+ll128Offset;
       uint64_t flag = recvFlag(0);
       bool needReload;
@@ -293,6 +305,77 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL128, P2p>:
   static constexpr int WireWordPerSlice = WARP_SIZE*NCCL_LL128_SHMEM_ELEMS_PER_THREAD;
   static constexpr int DataEltPerSlice = (WireWordPerSlice - WireWordPerSlice/NCCL_LL128_LINEELEMS)*(sizeof(uint64_t)/sizeof(T));
 
+  // Scratch of the even warp of a pair: full and empty counters, then a slice
+  inline __device__ char* stagingScratch() {
+    return (char*)ncclScratchForWarp(warp%2 == 0 ? warpInBlock : warpInBlock-1);
+  }
+
+  // Warp specialized loop of GenericOp, receiving from a single peer. Warps
+  // pair up and each pair goes through its slices in order: the even warp
+  // polls the flags of a slice and stages it in shared memory, then moves on
+  // to poll the next one while the odd warp reduces the staged slice with its
+  // source, forwards and stores it. Flag polling no longer stalls the reduce.
+  template <int SEND, int SrcBuf, int DstBuf>
+  __device__ __forceinline__ void stagedOp(T const *srcPtr, T *dstPtr, int nelem, bool postOp) {
+    constexpr int SRC = SrcBuf != -1 ? 1 : 0;
+    constexpr int DST = DstBuf != -1 ? 1 : 0;
+    char* scratch = stagingScratch();
+    volatile uint32_t* full = (volatile uint32_t*)scratch;
+    volatile uint32_t* empty = full+1;
+    uint64_t* staged = shmemCvtPtr((uint64_t*)(scratch+16)) + 2*wid;
+    const int npairs = nthreads/(2*WARP_SIZE);
+    const int nslices = divUp(nelem, DataEltPerSlice);
+    uint32_t seq = 0;
+
+    for (int s=warp/2; s < nslices; s += npairs) {
+      int ll128Offset = WireWordPerSlice*s + 2*wid;
+      int spins = 0;
+      if (warp%2 == 0) {
+        uint64_t vr[NCCL_LL128_SHMEM_ELEMS_PER_THREAD];
+        uint64_t* ptr = recvPtr(0)+ll128Offset;
+        uint64_t flag = recvFlag(0);
+        bool needReload;
+        do {
+          needReload = false;
+          #pragma unroll
+          for (int u=0; u<NCCL_LL128_SHMEM_ELEMS_PER_THREAD; u+=2) {
+            load128(ptr+u*WARP_SIZE, vr[u], vr[u+1]);
+            needReload |= flagThread && (vr[u+1] != flag);
+          }
+          needReload &= (0 == checkAbort(spins, 0, 0));
+        } while (__any_sync(WARP_MASK, needReload));
+
+        #pragma unroll
+        for (int u=0; u<NCCL_LL128_SHMEM_ELEMS_PER_THREAD; u+=2)
+          load128(ptr+u*WARP_SIZE, vr[u], vr[u+1]);
+
+        // Wait for the odd warp to have read the previous slice
+        while (*empty != seq) {
+          if (checkAbort(spins, 0, 0)) break;
+        }
+        #pragma unroll
+        for (int u=0; u<NCCL_LL128_SHMEM_ELEMS_PER_THREAD; u+=2)
+          storeShmem128(staged+u*WARP_SIZE, vr[u], vr[u+1]);
+        __syncwarp();
+        if (wid == 0) {
+          __threadfence_block();
+          *full = seq+1;
+        }
+      } else {
+        const int eltInSlice = min(nelem - DataEltPerSlice*s, DataEltPerSlice);
+        uint64_t regs[NCCL_LL128_SHMEM_ELEMS_PER_THREAD];
+        if (SRC) loadRegsBegin(regs, srcPtr + DataEltPerSlice*s, eltInSlice);
+        while (*full != seq+1) {
+          if (checkAbort(spins, 0, 0)) break;
+        }
+        __threadfence_block();
+        recvReduceSendCopy<NCCL_LL128_SHMEM_ELEMS_PER_THREAD, 1, SEND, SrcBuf, DstBuf>(regs, ll128Offset, postOp, staged, empty, seq+1);
+        if (DST) storeRegs(dstPtr + DataEltPerSlice*s, regs, eltInSlice);
+      }
+      seq++;
+    }
+  }
+
   template <int RECV, int SEND, int SrcBuf, int DstBuf>
   __device__ __forceinline__ void GenericOp(intptr_t srcIx, intptr_t dstIx, int nelem, bool postOp) {
     constexpr int SRC = SrcBuf != -1 ? 1 : 0;
@@ -301,31 +384,46 @@ class Primitives<T, RedOp, Fan, Direct, ProtoLL128, P2p>:
     T       *dstPtr = DstBuf == -1 ? nullptr : userBufs[DstBuf] + dstIx;
     int wireOffset = WireWordPerSlice*warp + 2*wid;
     const int nwarps = nthreads/WARP_SIZE;
+    const bool specialize = RECV && ncclShmem.comm.ll128WarpSpecialize && fan.nrecv() == 1 && nwarps%2 == 0;
     nelem = nelem < 0 ? 0 : nelem;
 
+    NCCL_DEV_PROFILE_START(profWait);
     if (SEND) waitSend(divUp(nelem, DataEltPerSlice)*WireWordPerSlice*sizeof(uint64_t));
+    if (specialize && warp%2 == 0 && wid == 0) {
+      volatile uint32_t* counters = (volatile uint32_t*)stagingScratch();
+      counters[0] = counters[1] = 0;
+    }
     barrier();
-    nelem -= DataEltPerSlice*warp;
-    srcPtr += DataEltPerSlice*warp;
-    dstPtr += DataEltPerSlice*warp;
-    while (nelem > 0) {
-      const int eltInSlice = min(nelem, DataEltPerSlice);
-      uint64_t regs[NCCL_LL128_SHMEM_ELEMS_PER_THREAD];
-      if (SRC) loadRegsBegin(regs, srcPtr, eltInSlice);
-      recvReduceSendCopy<NCCL_LL128_SHMEM_ELEMS_PER_THREAD, RECV, SEND, SrcBuf, DstBuf>(regs, wireOffset, postOp);
-      if (DST) storeRegs(dstPtr, regs, eltInSlice);
-
-      wireOffset += WireWordPerSlice*nwarps;
-      srcPtr += DataEltPerSlice*nwarps;
-      dstPtr += DataEltPerSlice*nwarps;
-      nelem -= DataEltPerSlice*nwarps;
+    if (SEND && tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfileWaitSend, NCCL_PROTO_LL128, profWait, sendStep[0]);
+    NCCL_DEV_PROFILE_START(profReduce);
+    if (specialize) {
+      stagedOp<SEND, SrcBuf, DstBuf>(srcPtr, dstPtr, nelem, postOp);
+    } else {
+      nelem -= DataEltPerSlice*warp;
+      srcPtr += DataEltPerSlice*warp;
+      dstPtr += DataEltPerSlice*warp;
+      while (nelem > 0) {
+        const int eltInSlice = min(nelem, DataEltPerSlice);
+        uint64_t regs[NCCL_LL128_SHMEM_ELEMS_PER_THREAD];
+        if (SRC) loadRegsBegin(regs, srcPtr, eltInSlice);
+        recvReduceSendCopy<NCCL_LL128_SHMEM_ELEMS_PER_THREAD, RECV, SEND, SrcBuf, DstBuf>(regs, wireOffset, postOp);
+        if (DST) storeRegs(dstPtr, regs, eltInSlice);
+
+        wireOffset += WireWordPerSlice*nwarps;
+        srcPtr += DataEltPerSlice*nwarps;
+        dstPtr += DataEltPerSlice*nwarps;
+        nelem -= DataEltPerSlice*nwarps;
+      }
     }
 
     barrier();
+    if (tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfileReduce, NCCL_PROTO_LL128, profReduce, RECV ? recvStep[0] : sendStep[0]);
+    NCCL_DEV_PROFILE_START(profPost);
     if (SEND) for (int i=0; i < MaxSend; i++) sendStep[i] += 1;
     if (SEND) postSend();
     if (RECV) for (int i=0; i < MaxRecv; i++) recvStep[i] += 1;
     if (RECV) postRecv();
+    if (tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfilePost, NCCL_PROTO_LL128, profPost, (RECV ? recvStep[0] : sendStep[0])-1);
   }
 
   __device__ __forceinline__ void loadRecvConn(struct ncclConnInfo* conn, int i) {
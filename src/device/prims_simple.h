@@ -5,6 +5,7 @@
  ************************************************************************/
 
 #include "network/unpack/unpack.h"
+#include "network/compress/compress.h"
 #include <cassert>
 
 template<typename T, typename RedOp, typename Fan, int Direct,
@@ -14,7 +15,9 @@ class Primitives<
   > {
   static constexpr int MaxRecv = Fan::MaxRecv, MaxSend = Fan::MaxSend;
   static constexpr int Input=0, Output=1;
-  static constexpr int RoleWaitRecv = 0x04, // 0x1 0x2 are free to use
+  static constexpr int P2pIpcRecv = 0x01,
+                       P2pIpcSend = 0x02,
+                       RoleWaitRecv = 0x04,
                        RoleWaitSend = 0x08,
                        RolePostSend = 0x10,
                        RolePostRecv = 0x20,
@@ -28,7 +31,17 @@ class Primitives<
                        NetDeviceUnpack = 0x2000,
                        AnyNetDeviceUnpack = 0x4000,
                        NvlsDirectRead = 0x8000,
-                       NvlsDirectWrite = 0x10000;
+                       NvlsDirectWrite = 0x10000,
+                       NetRegMode = 0x20000,
+                       NetRegElem = 0x40000,
+                       NetCompress = 0x80000,
+                       AnyNetCompress = 0x100000,
+                       UserCastInput = 0x200000,
+                       UserCastOutput = 0x400000,
+                       UserCastBf16 = 0x800000,
+                       PostBatch = 0x1000000;
+  // ptrExchange values of the cross-process P2P handshake (ncclWorkElemP2p::ipcReg)
+  static constexpr uintptr_t IpcReady = 1, IpcDirect = 2, IpcFifo = 3;
   const int tid, tidInBlock;
   const int nthreads;
   int nworkers;
@@ -44,6 +57,7 @@ class Primitives<
   uint64_t *connStepPtr;
   uint64_t connStepCache; // Cache last seen value of (*connStepPtr)
   int      connStepSize; // Connection step size
+  int      connStepMask; // Connection steps - 1, steps are a power of 2
   void*    mhandle;
   void*    netDeviceHandle;
 
@@ -97,7 +111,7 @@ class Primitives<
   inline __device__ bool checkAbort(int &spins) {
     spins++;
     if (!(flags & Aborted) && spins == NCCL_SPINS_BEFORE_CHECK_ABORT) {
-      if (*ncclShmem.comm.abortFlag) {
+      if (ncclAbortFlag()) {
         flags |= Aborted;
         ncclShmem.aborted = 1;
       }
@@ -126,31 +140,36 @@ class Primitives<
     const bool noSendWait = DirectSend && (flags & (DirectRead|DirectWrite)); // no wait in empty send (e.g. directScatter) or direct remote write
     if (((flags & (Recv*RoleWaitRecv)) && !noRecvWait) ||
         ((flags & (Send*RoleWaitSend)) && !noSendWait)) {
+      NCCL_DEV_PROFILE_START(profWait);
       int spins = 0;
-      while (connStepCache + (isSendNotRecv ? NCCL_STEPS : 0) < step + StepPerSlice) {
+      while (connStepCache + (isSendNotRecv ? connStepMask+1 : 0) < step + StepPerSlice) {
         connStepCache = loadStepValue(connStepPtr);
         if (checkAbort(spins)) break;
-        //if (spins == 0) printf("r=%d b=%d t=%d SPUN OUT got=%d want=%d\n", ncclShmem.comm.rank, blockIdx.x, threadIdx.x, int(connStepCache + (isSendNotRecv ? NCCL_STEPS : 0)), int(step+StepPerSlice));
+        //if (spins == 0) printf("r=%d b=%d t=%d SPUN OUT got=%d want=%d\n", ncclShmem.comm.rank, blockIdx.x, threadIdx.x, int(connStepCache + (isSendNotRecv ? connStepMask+1 : 0)), int(step+StepPerSlice));
       }
+      NCCL_DEV_PROFILE_RECORD(isSendNotRecv ? ncclDevProfileWaitSend : ncclDevProfileWaitRecv, NCCL_PROTO_SIMPLE, profWait, step);
     }
 
     if (flags & (Recv*RoleWaitRecv | Send*RoleWaitSend)) {
       if (flags & ConnFifoEnabled)
-        connFifo[step%NCCL_STEPS].size = nelts*sizeof(T);
+        connFifo[step&connStepMask].size = (NetCompressible<T, RedOp>::value && (flags & NetCompress)) ? netCompressSize(nelts) : nelts*sizeof(T);
 
       void **ptrs = isSendNotRecv ? (ncclShmem.groups[group].dsts + Dst)
                                   : (ncclShmem.groups[group].srcs + Src);
       if (flags & UserBufferMode) {
          // Do nothing
-      } else if ((flags & ConnFifoEnabled) && connFifo[step%NCCL_STEPS].mode == NCCL_MODE_OFFSET) {
-        ptrs[index] = connEltsFifo + loadInt(&connFifo[step%NCCL_STEPS].offset)/sizeof(T);
+      } else if (flags & NetRegMode) {
+        // The network proxy sends from or receives into the registered output buffer
+        ptrs[index] = (T*)ncclShmem.groups[group].userOutput + dstIx + offset;
+      } else if ((flags & ConnFifoEnabled) && connFifo[step&connStepMask].mode == NCCL_MODE_OFFSET) {
+        ptrs[index] = connEltsFifo + loadInt(&connFifo[step&connStepMask].offset)/sizeof(T);
       } else if (isSendNotRecv && DirectSend) {
         if (flags & (DirectWrite | NvlsDirectWrite)) {
           ptrs[index] = directBuff + dstIx + offset;
         } else if (flags & DirectRead) {  // empty send
           ptrs[index] = nullptr;
         } else {
-          ptrs[index] = connEltsFifo + (step%NCCL_STEPS)*connStepSize;
+          ptrs[index] = connEltsFifo + (step&connStepMask)*connStepSize;
         }
       } else if (!isSendNotRecv && DirectRecv) {
         if (flags & (DirectRead | NvlsDirectRead)) {
@@ -158,11 +177,11 @@ class Primitives<
         } else if (flags & DirectWrite) {
           ptrs[index] = directBuff + dstIx + offset;  // send to next from my output buffer
         } else {
-          ptrs[index] = connEltsFifo + (step%NCCL_STEPS)*connStepSize;
+          ptrs[index] = connEltsFifo + (step&connStepMask)*connStepSize;
         }
       }
       else {
-        ptrs[index] = connEltsFifo + (step%NCCL_STEPS)*connStepSize;
+        ptrs[index] = connEltsFifo + (step&connStepMask)*connStepSize;
       }
       if ((flags & (AnyNetDeviceUnpack)) && (flags & (Recv*RoleWaitRecv))) {
         ncclNetDeviceIncrementHead(group);
@@ -174,12 +193,26 @@ class Primitives<
   template<int Recv, int Send>
   inline __device__ void postPeer(bool dataStored) {
     if (flags & (Recv*RolePostRecv | Send*RolePostSend)) {
+      NCCL_DEV_PROFILE_START(profPost);
       step += StepPerSlice;
       if (Send && (flags & RolePostSend) && (dataStored||(flags&ConnFifoEnabled))) {
         fence_acq_rel_sys();
       }
-      st_relaxed_sys_global(connStepPtr, step);
+      // With PostBatch, credits of odd slices go out with the next one (or on exit)
+      if (!(Recv && (flags & PostBatch) && (flags & RolePostRecv) && ((step/StepPerSlice) & 1)))
+        st_relaxed_sys_global(connStepPtr, step);
+      NCCL_DEV_PROFILE_RECORD(ncclDevProfilePost, NCCL_PROTO_SIMPLE, profPost, step-StepPerSlice);
+    }
+  }
+
+  // Address of element ix of the user input or output, which may hold 2-byte
+  // values in mixed precision collectives.
+  __device__ __forceinline__ void* userPtr(int buf, intptr_t ix) {
+    void* base = buf == Input ? ncclShmem.groups[group].userInput : ncclShmem.groups[group].userOutput;
+    if (UserCastable<T>::value && (flags & (buf == Input ? UserCastInput : UserCastOutput))) {
+      return (uint16_t*)base + ix;
     }
+    return (T*)base + ix;
   }
 
   template <int DirectRecv1, int DirectSend1, int Recv, int Send, int SrcBuf, int DstBuf>
@@ -190,6 +223,7 @@ class Primitives<
     constexpr int DirectSend = 1 && Direct && DirectSend1;
     constexpr int Src = SrcBuf != -1;
     constexpr int Dst = DstBuf != -1;
+    constexpr bool BulkCopy = MultimemSrcs == 0 && MultimemDsts == 0;
 
     nelem = nelem < 0 ? 0 : nelem;
     int sliceSize = stepSize*StepPerSlice;
@@ -230,13 +264,12 @@ class Primitives<
       do {
         sliceSize = sliceSize < nelem-offset ? sliceSize : nelem-offset;
         if (tid == 0) {
-          T* userInput = (T*)ncclShmem.groups[group].userInput;
-          T* userOutput = (T*)ncclShmem.groups[group].userOutput;
-          if (Src) ncclShmem.groups[group].srcs[0] = (SrcBuf==Input ? userInput : userOutput) + srcIx + offset;
-          if (Dst) ncclShmem.groups[group].dsts[0] = (DstBuf==Input ? userInput : userOutput) + dstIx + offset;
+          if (Src) ncclShmem.groups[group].srcs[0] = userPtr(SrcBuf, srcIx + offset);
+          if (Dst) ncclShmem.groups[group].dsts[0] = userPtr(DstBuf, dstIx + offset);
         }
         waitPeer<DirectRecv, DirectSend, Recv, Send, Src, Dst>(srcIx, dstIx, offset, sliceSize);
         subBarrier();
+        NCCL_DEV_PROFILE_START(profReduce);
         /* if user abort the kernel, we don't need to actually perform copy/reduce; just set size
          * to 0 to avoid unnecessary workload. */
         int workSize = ncclShmem.aborted ? 0 : sliceSize;
@@ -246,7 +279,32 @@ class Primitives<
           subBarrier();
         }
 
-        if (DirectRecv && ncclShmem.groups[group].srcs[0] == ncclShmem.groups[group].dsts[0]
+        if (UserCastable<T>::value && (Src || Dst) && (flags & (UserCastInput|UserCastOutput))) {
+          userCastReduceCopy<RedOp, T>
+            (tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, postOp, SrcBuf == Input,
+             Recv*fan.nrecv()+Src, ncclShmem.groups[group].srcs,
+             Src && (flags & (SrcBuf == Input ? UserCastInput : UserCastOutput)),
+             Send*fan.nsend()+Dst, ncclShmem.groups[group].dsts,
+             Dst && (flags & (DstBuf == Input ? UserCastInput : UserCastOutput)),
+             flags & UserCastBf16, workSize);
+        } else if (NetCompressible<T, RedOp>::value && (flags & AnyNetCompress)) {
+          // Some network peers exchange quantized slices
+          netCompressReduceCopy<T>(tid, nworkers,
+            Recv*fan.nrecv()+Src, ncclShmem.groups[group].srcs, Recv ? ncclShmem.groups[group].netCompressRecvMask << Src : 0,
+            Send*fan.nsend()+Dst, ncclShmem.groups[group].dsts, Send ? ncclShmem.groups[group].netCompressSendMask << Dst : 0,
+            workSize);
+        } else if (Send && MaxSend == 1 && Recv+Src == 1 && MultimemSrcs == 0 && MultimemDsts == 0 && (flags & NetRegElem)
+            && ncclShmem.groups[group].dsts[Dst] == (Dst ? ncclShmem.groups[group].dsts[0] : ncclShmem.groups[group].srcs[0])) {
+          // The network sends straight from our output buffer, at most copy into it once
+          if (Dst && ncclShmem.groups[group].srcs[0] != ncclShmem.groups[group].dsts[0]) {
+            constexpr int PreOpSrcs = SrcBuf != Input ? 0 : 1;
+            reduceCopy<Unroll, RedOp, T, 0, 1, 1, 0, 1, 1, PreOpSrcs>
+              (tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, postOp,
+               1, ncclShmem.groups[group].srcs,
+               1, ncclShmem.groups[group].dsts,
+               workSize);
+          }
+        } else if (DirectRecv && ncclShmem.groups[group].srcs[0] == ncclShmem.groups[group].dsts[0]
             /* NVLS can have srcs[0] == dsts[0], but we cannot enter this "if branch",
              * so we need to check whether MultimemSrcs and MultimemDsts are 0. */
             && MultimemSrcs == 0 && MultimemDsts == 0) {
@@ -265,6 +323,15 @@ class Primitives<
              Recv, ncclShmem.groups[group].srcs,
              Dst, ncclShmem.groups[group].dsts,
              workSize);
+        } else if (BulkCopy && ncclShmem.comm.simpleBulkCopy && Recv*fan.nrecv()+Src == 1
+            && (SrcBuf != Input || Apply_PreOp<RedOp, 1>::IsIdentity)
+            && (!postOp || Apply_PostOp<RedOp, 1>::IsIdentity)) {
+          // Pure copy (e.g. AllGather, Broadcast, copy steps of ReduceScatter)
+          bulkCopy<Unroll, RedOp, T, Send*MaxSend+Dst>
+            (tid, nworkers, ncclScratchForWarp(tidInBlock/WARP_SIZE), ncclShmemScratchWarpSize(),
+             ncclShmem.groups[group].srcs[0],
+             Send*fan.nsend()+Dst, ncclShmem.groups[group].dsts,
+             workSize);
         } else {
           constexpr int PreOpSrcs = SrcBuf != Input ? 0 :
                                     DirectRecv*MaxRecv == NCCL_MAX_DIRECT_ARITY ? (1+NCCL_MAX_DIRECT_ARITY) : 1;
@@ -276,6 +343,8 @@ class Primitives<
              Send*fan.nsend()+Dst, ncclShmem.groups[group].dsts,
              workSize);
         }
+        // tid 0 always holds the first wait role, so its step matches this slice
+        if (tid == 0) NCCL_DEV_PROFILE_RECORD(ncclDevProfileReduce, NCCL_PROTO_SIMPLE, profReduce, step-StepPerSlice);
         barrier(); // This barrier has a counterpart in following loop
         postPeer<Recv, Send>(0 < sliceSize);
         offset += sliceSize;
@@ -315,7 +384,7 @@ public:
     st_relaxed_sys_global(peerPtr->recv[connIndex].head, peerPtr->recv[connIndex].step);
     while (ld_volatile_global(peerPtr->recv[connIndex].tail) < peerPtr->recv[connIndex].step) {
       if (spins++ == NCCL_SPINS_BEFORE_CHECK_ABORT) {
-        if (*ncclShmem.comm.abortFlag) {
+        if (ncclAbortFlag()) {
           ncclShmem.aborted = 1;
           break;
         }
@@ -332,17 +401,17 @@ public:
         if (flags & (Recv*RoleWaitRecv | Send*RoleWaitSend)) {
           bool isSendNotRecv = (Send && Recv) ? (flags & RoleWaitSend) : Send;
           int spins = 0;
-          while (connStepCache + (isSendNotRecv ? NCCL_STEPS : 0) < step + StepPerSlice) {
+          while (connStepCache + (isSendNotRecv ? connStepMask+1 : 0) < step + StepPerSlice) {
             connStepCache = loadStepValue(connStepPtr);
             if (checkAbort(spins)) break;
           }
           void **ptrs = isSendNotRecv ? ncclShmem.groups[group].dsts
                                       : ncclShmem.groups[group].srcs;
-          if ((flags & ConnFifoEnabled) && connFifo[step%NCCL_STEPS].mode == NCCL_MODE_OFFSET) {
-            int offset = loadInt(&connFifo[step%NCCL_STEPS].offset);
+          if ((flags & ConnFifoEnabled) && connFifo[step&connStepMask].mode == NCCL_MODE_OFFSET) {
+            int offset = loadInt(&connFifo[step&connStepMask].offset);
             ptrs[index] = connEltsFifo + offset/sizeof(T);
           } else {
-            ptrs[index] = connEltsFifo + (step%NCCL_STEPS)*stepSize;
+            ptrs[index] = connEltsFifo + (step&connStepMask)*stepSize;
           }
         }
         subBarrier();
@@ -356,7 +425,7 @@ public:
       if (flags & Send*RolePostSend) {
         dstSize = ncclShmem.groups[group].dstSizes[index];
         ncclShmem.groups[group].dstSizes[index] = 0;
-        if (flags & ConnFifoEnabled) connFifo[step%NCCL_STEPS].size = dstSize*sizeof(T);
+        if (flags & ConnFifoEnabled) connFifo[step&connStepMask].size = dstSize*sizeof(T);
       }
       barrier();
       if (flags & (Recv*(RoleWaitRecv|RolePostRecv) | Send*(RoleWaitSend|RolePostSend))) {
@@ -439,6 +508,7 @@ private:
   __device__ __forceinline__ void loadRecvConn(ncclDevChannelPeer *peer, int connIndex, struct ncclWorkElem* e) {
     if (flags & (RoleWaitRecv|RolePostRecv)) {
       auto *conn = &peer->recv[connIndex];
+      connStepMask = (conn->nSteps ? conn->nSteps : NCCL_STEPS) - 1;
       if (conn->netDeviceHandle.netDeviceType == NCCL_NET_DEVICE_UNPACK) {
         // handle must be a device ptr
         netDeviceHandle = conn->netDeviceHandle.handle;
@@ -451,6 +521,8 @@ private:
       if (flags & RolePostRecv) {
         connStepPtr = conn->head;
         *connStepPtr = step; // Return credits in case we rounded up.
+        // Withholding one slice of credits is safe as long as two slices fit in the FIFO
+        if ((conn->flags & NCCL_P2P_POST_BATCH) && 2*StepPerSlice <= connStepMask+1) flags |= PostBatch;
       }
       if (flags & RoleWaitRecv) {
         ncclShmem.groups[group].recvConns[index] = conn; // WaitRecv role saves since that's who needs it in setDataPtrs()
@@ -462,7 +534,11 @@ private:
         if (conn->connFifo != nullptr) {
           flags |= ConnFifoEnabled;
           connFifo = conn->connFifo;
-        } else if (Direct) {
+          if ((conn->flags & NCCL_NET_REG) && e != nullptr && e->netReg) flags |= NetRegMode;
+          if (NetCompressible<T, RedOp>::value && (conn->flags & NCCL_NET_COMPRESS) && !(flags & (UserCastInput|UserCastOutput))) flags |= NetCompress;
+        } else if (Direct && !(flags & (UserCastInput|UserCastOutput))) {
+          // Peers access each other's user buffers as T in direct mode, so
+          // mixed precision collectives always go through the FIFOs.
           // User buffers have been registered
           if ((conn->flags & (NCCL_IPC_READ|NCCL_IPC_WRITE)) && e != nullptr && e->regUsed) {
             if (connIndex == 1 && P2p == 0) {
@@ -491,6 +567,7 @@ private:
   __device__ __forceinline__ void loadSendConn(ncclDevChannelPeer *peer, int connIndex, struct ncclWorkElem* e) {
     if (flags & (RoleWaitSend|RolePostSend)) {
       auto *conn = &peer->send[connIndex];
+      connStepMask = (conn->nSteps ? conn->nSteps : NCCL_STEPS) - 1;
       step = conn->step;
       step = roundUp(step, SlicePerChunk*StepPerSlice);
 
@@ -508,7 +585,9 @@ private:
         connStepCache = loadStepValue(connStepPtr);
         connStepSize = conn->stepSize/sizeof(T);
         connEltsFifo = (T*)conn->buffs[NCCL_PROTO_SIMPLE];
-        if (connFifo == nullptr && Direct) {
+        if (connFifo != nullptr && (conn->flags & NCCL_NET_REG) && e != nullptr && e->netReg) flags |= NetRegMode;
+        if (NetCompressible<T, RedOp>::value && connFifo != nullptr && (conn->flags & NCCL_NET_COMPRESS) && !(flags & (UserCastInput|UserCastOutput))) flags |= NetCompress;
+        if (connFifo == nullptr && Direct && !(flags & (UserCastInput|UserCastOutput))) {
           // User buffers have been registered
           if ((conn->flags & (NCCL_IPC_READ|NCCL_IPC_WRITE)) && e != nullptr && e->regUsed) {
             if (connIndex == 1 && P2p == 0) {
@@ -558,7 +637,11 @@ private:
     static_assert(MaxSend <= ThreadPerSync && MaxRecv <= ThreadPerSync, "Not enough threads to cover all peers");
 
     index = -1;
-    flags = 0;
+    flags = (e != nullptr && e->netReg) ? NetRegElem : 0;
+    if (UserCastable<T>::value && e != nullptr) {
+      flags |= (e->castInput ? UserCastInput : 0) | (e->castOutput ? UserCastOutput : 0) |
+               (e->castBf16 ? UserCastBf16 : 0);
+    }
     assert(2*(nrecv+nsend) <= nthreads); // Ensure no thread is assigned more than one role.
     if      (tid < nrecv)                 { flags |= RoleWaitRecv; index = tid; }
     else if (tid < nrecv+nsend)           { flags |= RoleWaitSend; index = tid-nrecv; }
@@ -573,6 +656,17 @@ private:
     loadSendConn(ncclShmem.channel.peers[peer], connIndexSend, e);
 
     if (p2p && p2p->reg) flags |= UserBufferMode;
+    if (Direct && P2p && p2p && p2p->ipcReg) {
+      if (flags & RoleWaitRecv) flags |= P2pIpcRecv;
+      if (flags & RoleWaitSend) {
+        flags |= P2pIpcSend;
+        directBuff = nullptr;
+        if (!p2p->devCount) {
+          auto const* ext = &p2p[2].ipcExt;
+          directBuff = reinterpret_cast<T*>(uintptr_t(ext->buffHi32)<<32 | ext->buffLo32);
+        }
+      }
+    }
 
     if (barrierAny(flags & NetDeviceUnpack)) {
       flags |= AnyNetDeviceUnpack;
@@ -584,6 +678,16 @@ private:
       }
     }
 
+    if (NetCompressible<T, RedOp>::value && barrierAny(flags & NetCompress)) {
+      flags |= AnyNetCompress;
+      // WaitRecv then WaitSend roles occupy the first threads, in peer order
+      uint32_t mask = __ballot_sync(~0u, (flags & NetCompress) ? 1 : 0);
+      if (tid == 0) {
+        ncclShmem.groups[this->group].netCompressRecvMask = mask & ((1u << fan.nrecv()) - 1);
+        ncclShmem.groups[this->group].netCompressSendMask = mask >> fan.nrecv();
+      }
+    }
+
     setDataPtrs(inputBuf, outputBuf, redOpArg, (struct ncclWorkElemReg*)e);
   }
 
@@ -595,13 +699,14 @@ private:
     if (flags & (RolePostSend|RolePostRecv)) {
       auto *conns = (flags & RolePostSend) ? ncclShmem.groups[group].sendConns : ncclShmem.groups[group].recvConns;
       conns[index]->step = step;
+      if (flags & PostBatch) st_relaxed_sys_global(connStepPtr, step); // Return withheld credits
     }
     if ((flags & UserBufferMode) && (flags & RoleWaitSend)) {
       // Make sure we wait until the proxy has sent data before we return.
       // We don't want the next CUDA kernel to overwrite the send buffer which
       // was accessed directly.
       uint64_t prevStep = step - StepPerSlice;
-      volatile ssize_t* ptr = &(connFifo[prevStep%NCCL_STEPS].size);
+      volatile ssize_t* ptr = &(connFifo[prevStep&connStepMask].size);
       int spins = 0;
       while (*ptr != -1) if (checkAbort(spins)) break;
     }
@@ -627,6 +732,12 @@ private:
     bool recvAcceptor = flags == (flags|RoleWaitRecv|DirectRead) || (flags == (flags|RoleWaitRecv|NvlsDirectRead)); // receiver accepts direct buffer
     int regUsed = e != nullptr ? e->elem.regUsed : 0;
 
+    if ((flags & (RoleWaitRecv|NetRegMode)) == (RoleWaitRecv|NetRegMode)) {
+      // Tell the proxy we are running, so it can start receiving into the output buffer
+      connFifo[step&connStepMask].ptr = outputBuf;
+      fence_acq_rel_sys();
+    }
+
     if (Direct && recvProvider) {
       int spins = 0;
       void *volatile *slot = ncclShmem.groups[group].recvConns[index]->ptrExchange;
@@ -708,6 +819,28 @@ private:
         directBuff = (T*)e->dnInputs[index];
       }
     }
+    if (Direct && (flags & P2pIpcRecv)) {
+      // Tell the sender we are running, so our buffer is free to overwrite,
+      // and learn whether it does.
+      int spins = 0;
+      void *volatile *slot = ncclShmem.groups[group].recvConns[index]->ptrExchange;
+      void *ptr;
+      while (*slot != nullptr && !checkAbort(spins));
+      *slot = reinterpret_cast<void*>(IpcReady);
+      while ((ptr = *slot) == reinterpret_cast<void*>(IpcReady) && !checkAbort(spins));
+      if (ptr == reinterpret_cast<void*>(IpcDirect)) {
+        flags |= DirectWrite;
+        directBuff = (T*)outputBuf;
+      }
+      *slot = nullptr;
+    }
+    if (Direct && (flags & P2pIpcSend)) {
+      int spins = 0;
+      void *volatile *slot = ncclShmem.groups[group].sendConns[index]->ptrExchange;
+      while (*slot != reinterpret_cast<void*>(IpcReady) && !checkAbort(spins));
+      if (directBuff != nullptr) flags |= DirectWrite;
+      *slot = reinterpret_cast<void*>(directBuff != nullptr ? IpcDirect : IpcFifo);
+    }
   }
 
   __device__ void moveDataPtrs(intptr_t delta) {
@@ -49,6 +49,66 @@ namespace {
       }
     }
   }
+
+  // Each loop handles nranks chunks, one per rank in ring order. The ring
+  // reduce-scatters them, then each rank sends its reduced chunk down the ring
+  // to the root instead of storing it, so only the root needs an output buffer.
+  template<typename T, typename RedOp, typename Proto>
+  __device__ __forceinline__ void runRingScatter(ncclWorkElem *args) {
+    const int tid = threadIdx.x;
+    const int nthreads = (int)args->nWarps * WARP_SIZE;
+    ncclRing *ring = &ncclShmem.channel.ring;
+    const int ringIx = ring->index;
+    const int nranks = ncclShmem.comm.nRanks;
+    const int root = args->root;
+    ssize_t chunkCount = args->chunkCount;
+    const ssize_t loopCount = nranks * chunkCount;
+    const ssize_t gridOffset = args->workOffset;
+    const ssize_t channelCount = args->workCount;
+    ssize_t offset;
+    int nelem;
+
+    Primitives<T, RedOp, FanSymmetric<1>, 0, Proto, 0>
+      prims(tid, nthreads, &ring->prev, &ring->next, args->sendbuff, args->recvbuff, args->redOpArg);
+
+    auto modRanks = [&]__device__(int r)->int {
+      return r - (r >= nranks ? nranks : 0);
+    };
+    // Our distance from the root going down the ring
+    int dist = 0;
+    while (ring->userRanks[(nranks-dist)%nranks] != root) dist++;
+    const int rootIx = modRanks(ringIx + nranks - dist);
+
+    for (ssize_t elemOffset = 0; elemOffset < channelCount; elemOffset += loopCount) {
+      ssize_t remCount = channelCount - elemOffset;
+      if (remCount < loopCount) chunkCount = args->lastChunkCount;
+
+      auto setChunk = [&]__device__(int chunk) {
+        ssize_t chunkOffset = chunk * chunkCount;
+        offset = gridOffset + elemOffset + chunkOffset;
+        nelem = (int)min(chunkCount, remCount - chunkOffset);
+      };
+
+      // Reduce-scatter
+      setChunk(modRanks(ringIx + nranks - 1));
+      prims.send(offset, nelem);
+      for (int j = 2; j < nranks; ++j) {
+        setChunk(modRanks(ringIx + nranks - j));
+        prims.recvReduceSend(offset, nelem);
+      }
+      setChunk(ringIx);
+      if (dist == 0) prims.recvReduceCopy(offset, offset, nelem, /*postOp=*/true);
+      else prims.recvReduceSend(offset, nelem, /*postOp=*/true);
+
+      // Gather: forward the chunks of the ranks between the root and us,
+      // nearest first since they started first.
+      for (int d = (dist == 0 ? nranks : dist) - 1; d > 0; d--) {
+        setChunk(modRanks(rootIx + d));
+        if (dist == 0) prims.recv(offset, nelem);
+        else prims.recvSend(nelem);
+      }
+    }
+  }
 }
 
 template<typename T, typename RedOp>
@@ -72,3 +132,11 @@ struct RunWorkElement<ncclFuncReduce, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_LL128
     runRing<T, RedOp, ProtoLL128>(args);
   }
 };
+
+template<typename T, typename RedOp>
+struct RunWorkElement<ncclFuncReduce, T, RedOp, NCCL_ALGO_RING_SCATTER, NCCL_PROTO_SIMPLE> {
+  __device__ __forceinline__ void run(ncclWorkElem *args) {
+    using Proto = ProtoSimple<REDUCE_CHUNKSTEPS/REDUCE_SLICESTEPS, REDUCE_SLICESTEPS>;
+    runRingScatter<T, RedOp, Proto>(args);
+  }
+};
@@ -20,6 +20,12 @@ struct IsFloatingPoint<half>: std::true_type {};
 template<>
 struct IsFloatingPoint<__nv_bfloat16>: std::true_type {};
 #endif
+#if defined(__CUDA_FP8_TYPES_EXIST__)
+template<>
+struct IsFloatingPoint<__nv_fp8_e4m3>: std::true_type {};
+template<>
+struct IsFloatingPoint<__nv_fp8_e5m2>: std::true_type {};
+#endif
 template<>
 struct IsFloatingPoint<float>: std::true_type {};
 template<>
@@ -268,6 +274,39 @@ SPECIALIZE_REDUCE(FuncMinMax, double, 1, double, fn.isMinNotMax ? fmin(x, y) : f
 #endif
 #endif
 
+#if defined(__CUDA_FP8_TYPES_EXIST__)
+// FP8 has no native arithmetic: elements are widened to half (float on archs
+// without half math), reduced, and rounded back with saturation. Pairs are
+// converted together so 16-byte packs decompose into x2 conversions.
+#define SPECIALIZE_REDUCE_FP8(T, T2) \
+  SPECIALIZE_REDUCE_FP8_SUMPROD(T, T2) \
+  SPECIALIZE_REDUCE_FP8_MINMAX(T, T2)
+#if __CUDA_ARCH__ >= 530 && __CUDA_ARCH__ != 610
+  #define SPECIALIZE_REDUCE_FP8_SUMPROD(T, T2) \
+    SPECIALIZE_REDUCE(FuncSum, T, 1, T, T(__hadd(__half(x), __half(y)))) \
+    SPECIALIZE_REDUCE(FuncSum, T, 2, T2, T2(__hadd2(__half2(x), __half2(y)))) \
+    SPECIALIZE_REDUCE(FuncProd, T, 1, T, T(__hmul(__half(x), __half(y)))) \
+    SPECIALIZE_REDUCE(FuncProd, T, 2, T2, T2(__hmul2(__half2(x), __half2(y))))
+#else
+  #define SPECIALIZE_REDUCE_FP8_SUMPROD(T, T2) \
+    SPECIALIZE_REDUCE(FuncSum, T, 1, T, T(float(x) + float(y))) \
+    SPECIALIZE_REDUCE(FuncProd, T, 1, T, T(float(x) * float(y)))
+#endif
+#if __CUDA_ARCH__ >= 800
+  #define SPECIALIZE_REDUCE_FP8_MINMAX(T, T2) \
+    SPECIALIZE_REDUCE(FuncMinMax, T, 1, T, T(fn.isMinNotMax ? __hmin(__half(x), __half(y)) : __hmax(__half(x), __half(y)))) \
+    SPECIALIZE_REDUCE(FuncMinMax, T, 2, T2, T2(fn.isMinNotMax ? __hmin2(__half2(x), __half2(y)) : __hmax2(__half2(x), __half2(y))))
+#else
+  #define SPECIALIZE_REDUCE_FP8_MINMAX(T, T2) \
+    SPECIALIZE_REDUCE(FuncMinMax, T, 1, T, T(fn.isMinNotMax ? fminf(float(x), float(y)) : fmaxf(float(x), float(y))))
+#endif
+  SPECIALIZE_REDUCE_FP8(__nv_fp8_e4m3, __nv_fp8x2_e4m3)
+  SPECIALIZE_REDUCE_FP8(__nv_fp8_e5m2, __nv_fp8x2_e5m2)
+#undef SPECIALIZE_REDUCE_FP8_MINMAX
+#undef SPECIALIZE_REDUCE_FP8_SUMPROD
+#undef SPECIALIZE_REDUCE_FP8
+#endif
+
 #undef SPECIALIZE_REDUCE
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -412,6 +451,39 @@ struct FuncPreMulSum<half> {
   };
 #endif
 
+#if defined(__CUDA_FP8_TYPES_EXIST__)
+  // The scalar is kept widened so the multiply happens in higher precision.
+  #if __CUDA_ARCH__ >= 530 && __CUDA_ARCH__ != 610
+    #define DEFINE_FuncPreMulSum_FP8(T) \
+      template<> \
+      struct FuncPreMulSum<T> { \
+        using EltType = T; \
+        half2 scalar; \
+        __device__ FuncPreMulSum(uint64_t opArg=0) { \
+          union { uint64_t u64; T val; }; \
+          u64 = opArg; \
+          scalar.x = __half(val); \
+          scalar.y = scalar.x; \
+        } \
+      };
+  #else
+    #define DEFINE_FuncPreMulSum_FP8(T) \
+      template<> \
+      struct FuncPreMulSum<T> { \
+        using EltType = T; \
+        float scalar; \
+        __device__ FuncPreMulSum(uint64_t opArg=0) { \
+          union { uint64_t u64; T val; }; \
+          u64 = opArg; \
+          scalar = float(val); \
+        } \
+      };
+  #endif
+  DEFINE_FuncPreMulSum_FP8(__nv_fp8_e4m3)
+  DEFINE_FuncPreMulSum_FP8(__nv_fp8_e5m2)
+  #undef DEFINE_FuncPreMulSum_FP8
+#endif
+
 template<typename T>
 struct Apply_Reduce<FuncPreMulSum<T>, /*EltPerPack=*/1> {
   __device__ static BytePack<sizeof(T)> reduce(FuncPreMulSum<T> fn, BytePack<sizeof(T)> a, BytePack<sizeof(T)> b) {
@@ -483,29 +555,68 @@ struct Apply_PreOp<FuncPreMulSum<half>, /*EltPerPack=*/1> {
   #endif
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// Apply_PreOp of FuncPreMulSum for fp8.
+
+#if defined(__CUDA_FP8_TYPES_EXIST__)
+  #if __CUDA_ARCH__ >= 530 && __CUDA_ARCH__ != 610
+    #define DEFINE_Apply_PreOp_PreMulSum_FP8(T, T2) \
+      template<> \
+      struct Apply_PreOp<FuncPreMulSum<T>, /*EltPerPack=*/1> { \
+        static constexpr bool IsIdentity = false; \
+        __device__ static BytePack<sizeof(T)> preOp(FuncPreMulSum<T> fn, BytePack<sizeof(T)> a) { \
+          return toPack<T>(T(__hmul(__half(fromPack<T>(a)), fn.scalar.x))); \
+        } \
+      }; \
+      template<> \
+      struct Apply_PreOp<FuncPreMulSum<T>, /*EltPerPack=*/2> { \
+        static constexpr bool IsIdentity = false; \
+        __device__ static BytePack<sizeof(T2)> preOp(FuncPreMulSum<T> fn, BytePack<sizeof(T2)> a) { \
+          return toPack<T2>(T2(__hmul2(__half2(fromPack<T2>(a)), fn.scalar))); \
+        } \
+      };
+  #else
+    #define DEFINE_Apply_PreOp_PreMulSum_FP8(T, T2) \
+      template<> \
+      struct Apply_PreOp<FuncPreMulSum<T>, /*EltPerPack=*/1> { \
+        static constexpr bool IsIdentity = false; \
+        __device__ static BytePack<sizeof(T)> preOp(FuncPreMulSum<T> fn, BytePack<sizeof(T)> a) { \
+          return toPack<T>(T(float(fromPack<T>(a)) * fn.scalar)); \
+        } \
+      };
+  #endif
+  DEFINE_Apply_PreOp_PreMulSum_FP8(__nv_fp8_e4m3, __nv_fp8x2_e4m3)
+  DEFINE_Apply_PreOp_PreMulSum_FP8(__nv_fp8_e5m2, __nv_fp8x2_e5m2)
+  #undef DEFINE_Apply_PreOp_PreMulSum_FP8
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // FuncSumPostDiv
 
+// Sums, then applies a scalar to the result at the final store. For integers
+// the scalar is a divisor (ncclAvg), for floating point types it is a
+// multiplier (ncclAvg or ncclRedOpCreatePostMulSum).
 template<typename T, bool IsFloating=IsFloatingPoint<T>::value>
-struct FuncSumPostDiv_IntOnly;
+struct FuncSumPostDiv_Impl;
 
 template<typename T>
-struct FuncSumPostDiv: FuncSumPostDiv_IntOnly<T> {
+struct FuncSumPostDiv: FuncSumPostDiv_Impl<T> {
   __device__ FuncSumPostDiv(uint64_t opArg=0):
-    FuncSumPostDiv_IntOnly<T>(opArg) {
+    FuncSumPostDiv_Impl<T>(opArg) {
   }
 };
 
 template<typename T>
-struct FuncSumPostDiv_IntOnly<T, /*IsFloating=*/false>: FuncSum<T> {
+struct FuncSumPostDiv_Impl<T, /*IsFloating=*/false>: FuncSum<T> {
   using EltType = T;
   int divisor;
-  __device__ FuncSumPostDiv_IntOnly(uint64_t opArg=0): divisor(opArg) {}
+  __device__ FuncSumPostDiv_Impl(uint64_t opArg=0): divisor(opArg) {}
 };
 
 template<typename T>
-struct FuncSumPostDiv_IntOnly<T, /*IsFloating=*/true> {
-  static_assert(sizeof(T)!=sizeof(T), "FuncSumPostDiv is only for implementing ncclAvg on integral types.");
+struct FuncSumPostDiv_Impl<T, /*IsFloating=*/true>: FuncPreMulSum<T> {
+  using EltType = T;
+  __device__ FuncSumPostDiv_Impl(uint64_t opArg=0): FuncPreMulSum<T>(opArg) {}
 };
 
 template<typename T>
@@ -517,11 +628,25 @@ struct Apply_Reduce<FuncSumPostDiv<T>, /*EltPerPack=*/1>:
   }
 };
 
+template<typename T, bool IsFloating=IsFloatingPoint<T>::value>
+struct Apply_PostOp_SumPostDiv {
+  __device__ static BytePack<sizeof(T)> postOp(FuncSumPostDiv<T> fn, BytePack<sizeof(T)> a) {
+    return toPack<T>(fromPack<T>(a) / fn.divisor);
+  }
+};
+template<typename T>
+struct Apply_PostOp_SumPostDiv<T, /*IsFloating=*/true> {
+  __device__ static BytePack<sizeof(T)> postOp(FuncSumPostDiv<T> fn, BytePack<sizeof(T)> a) {
+    // Same multiply as FuncPreMulSum, only applied once to the reduced value.
+    return Apply_PreOp<FuncPreMulSum<T>, 1>::preOp(fn, a);
+  }
+};
+
 template<typename T>
 struct Apply_PostOp<FuncSumPostDiv<T>, /*EltPerPack=*/1> {
   static constexpr bool IsIdentity = false;
   __device__ static BytePack<sizeof(T)> postOp(FuncSumPostDiv<T> fn, BytePack<sizeof(T)> a) {
-    return toPack<T>(fromPack<T>(a) / fn.divisor);
+    return Apply_PostOp_SumPostDiv<T>::postOp(fn, a);
   }
 };
 
@@ -657,6 +782,7 @@ struct Apply_LoadMultimem {
     static constexpr bool IsMinMax = std::is_same<Fn, FuncMinMax<T>>::value;
     static constexpr bool IsFloat = IsFloatingPoint<T>::value;
     static constexpr int BigPackSize =
+      IsFloat && sizeof(T)==1 ? 0 : // no multimem.ld_reduce for fp8
       IsFloat && IsSum && sizeof(T) < 8 ? 16 :
       IsFloat && IsSum ? 8 :
       IsFloat && IsMinMax && sizeof(T)==2 ? 16 :
@@ -10,6 +10,17 @@
 
 template<typename T, typename RedOp>
 struct RunWork<ncclFuncSendRecv, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE> {
+  // Number of bytes to actually move, which is below the planned count when
+  // the user gave the count in device memory.
+  __device__ size_t actualCount(struct ncclWorkElemP2p* args, size_t count) {
+    if (!args->devCount) return count;
+    auto const* ext = &args[2].devCountExt;
+    const size_t* countPtr = reinterpret_cast<const size_t*>(uintptr_t(ext->countPtrHi32)<<32 | ext->countPtrLo32);
+    size_t offset = size_t(ext->offsetHi32)<<32 | ext->offsetLo32;
+    size_t bytes = *countPtr * ext->eltSize;
+    return bytes <= offset ? 0 : min(bytes - offset, count);
+  }
+
   template<typename Proto>
   __device__ void runSend(const int tid, const int nthreads, const uint8_t group, struct ncclWorkElemP2p* args) {
     void* buff = reinterpret_cast<void*>(uintptr_t(args->buffHi32)<<32 | args->buffLo32);
@@ -19,7 +30,7 @@ struct RunWork<ncclFuncSendRecv, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE> {
       void* recvBuff = reinterpret_cast<void*>(uintptr_t(recvArgs->buffHi32)<<32 | recvArgs->buffLo32);
       if (buff != recvBuff) {
         reduceCopy<COLL_UNROLL, RedOp, T, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>
-          (tid, nthreads, 0, nullptr, false, 1, &buff, 1, &recvBuff, count);
+          (tid, nthreads, 0, nullptr, false, 1, &buff, 1, &recvBuff, actualCount(args, count));
       }
     } else {
       int chunkSize = args->chunkSize/sizeof(T);
@@ -27,10 +38,13 @@ struct RunWork<ncclFuncSendRecv, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE> {
       int const peer = args->peer;
       Primitives<T, RedOp, FanAsymmetric<0, 1>, 1, Proto, 1> prims
         (tid, nthreads, nullptr, &peer, buff, nullptr, /*redOpArg(ignored)=*/0, group, 1, 1, nullptr, args, ncclShmem.comm.p2pChunkSize/sizeof(T));
+      size_t total = actualCount(args, count);
       size_t offset = 0;
       do {
         int nelem = min(size_t(chunkSize), count-offset);
-        prims.directSend(offset, offset, nelem);
+        // Steps past the device count still run, empty, to match the proxy.
+        int nreal = offset < total ? min(size_t(nelem), total-offset) : 0;
+        prims.directSend(offset, offset, nreal);
         offset += nelem;
       } while(offset < count && args->reg == 0);
     }
@@ -46,10 +60,12 @@ struct RunWork<ncclFuncSendRecv, T, RedOp, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE> {
       int const peer = args->peer;
       Primitives<T, RedOp, FanAsymmetric<1, 0>, 1, Proto, 1> prims
         (tid, nthreads, &peer, nullptr, nullptr, buff, /*redOpArg(ignored)=*/0, group, 1, 1, nullptr, args, ncclShmem.comm.p2pChunkSize/sizeof(T));
+      size_t total = actualCount(args, count);
       size_t offset = 0;
       do {
         int nelem = min(size_t(chunkSize), count-offset);
-        prims.directRecv(offset, nelem);
+        int nreal = offset < total ? min(size_t(nelem), total-offset) : 0;
+        prims.directRecv(offset, nreal);
         offset += nelem;
       } while(offset < count && args->reg == 0);
     }
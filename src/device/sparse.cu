@@ -0,0 +1,102 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "alloc.h"
+#include "collectives.h"
+#include "common_kernel.h"
+#include "common.h"
+#include <cuda_runtime.h>
+
+namespace {
+  // Copies the first *devNnz (index, value) pairs into a block of maxNnz
+  // entries, padding with index -1.
+  template<typename I, typename T>
+  __global__ __launch_bounds__(512, 1)
+  void sparsePack(I* dstIdx, T* dstVal, I const* srcIdx, T const* srcVal, size_t const* devNnz, size_t maxNnz) {
+    size_t nnz = min(*devNnz, maxNnz);
+    for (size_t i = blockIdx.x*blockDim.x + threadIdx.x; i < maxNnz; i += gridDim.x*blockDim.x) {
+      dstIdx[i] = i < nnz ? srcIdx[i] : I(-1);
+      if (i < nnz) dstVal[i] = srcVal[i];
+    }
+  }
+
+  // dst[idx[i]] += val[i] for the first nnz pairs, skipping indices outside
+  // [0, count). Indices must be unique within one launch.
+  template<typename I, typename T>
+  __global__ __launch_bounds__(512, 1)
+  void sparseScatter(T* dst, size_t count, I const* idx, T const* val, size_t const* devNnz, size_t maxNnz) {
+    size_t nnz = devNnz ? min(*devNnz, maxNnz) : maxNnz;
+    for (size_t i = blockIdx.x*blockDim.x + threadIdx.x; i < nnz; i += gridDim.x*blockDim.x) {
+      I ix = idx[i];
+      if (ix < 0 || size_t(ix) >= count) continue;
+      dst[ix] = applyReduce(FuncSum<T>(), dst[ix], val[i]);
+    }
+  }
+
+  template<typename I, typename T>
+  void const* sparseKernel(bool scatter) {
+    return scatter ? (void const*)&sparseScatter<I, T> : (void const*)&sparsePack<I, T>;
+  }
+
+  template<typename I>
+  void const* sparseKernel(bool scatter, ncclDataType_t eltType) {
+    switch (eltType) {
+    case ncclInt8:     return sparseKernel<I, int8_t>(scatter);
+    case ncclUint8:    return sparseKernel<I, uint8_t>(scatter);
+    case ncclInt32:    return sparseKernel<I, int32_t>(scatter);
+    case ncclUint32:   return sparseKernel<I, uint32_t>(scatter);
+    case ncclInt64:    return sparseKernel<I, int64_t>(scatter);
+    case ncclUint64:   return sparseKernel<I, uint64_t>(scatter);
+    case ncclFloat16:  return sparseKernel<I, half>(scatter);
+    #if defined(__CUDA_BF16_TYPES_EXIST__)
+    case ncclBfloat16: return sparseKernel<I, __nv_bfloat16>(scatter);
+    #endif
+    #if defined(__CUDA_FP8_TYPES_EXIST__)
+    case ncclFloat8e4m3: return sparseKernel<I, __nv_fp8_e4m3>(scatter);
+    case ncclFloat8e5m2: return sparseKernel<I, __nv_fp8_e5m2>(scatter);
+    #endif
+    case ncclFloat32:  return sparseKernel<I, float>(scatter);
+    case ncclFloat64:  return sparseKernel<I, double>(scatter);
+    default: return nullptr;
+    }
+  }
+
+  void const* sparseKernel(bool scatter, ncclDataType_t indexType, ncclDataType_t eltType) {
+    switch (indexType) {
+    case ncclInt32: return sparseKernel<int32_t>(scatter, eltType);
+    case ncclInt64: return sparseKernel<int64_t>(scatter, eltType);
+    default: return nullptr;
+    }
+  }
+
+  dim3 sparseGrid(size_t n) {
+    return dim3(std::max(1, std::min(64, (int)divUp(n, 4096))), 1, 1);
+  }
+}
+
+size_t ncclSparseBlockBytes(size_t maxNnz, ncclDataType_t indexType, ncclDataType_t eltType) {
+  return ROUNDUP(maxNnz*ncclTypeSize(indexType), 16) + ROUNDUP(maxNnz*ncclTypeSize(eltType), 16);
+}
+
+ncclResult_t ncclLaunchSparsePack(void* block, void const* indices, void const* values, size_t const* devNnz, size_t maxNnz, ncclDataType_t indexType, ncclDataType_t eltType, cudaStream_t stream) {
+  void const* kernel = sparseKernel(/*scatter=*/false, indexType, eltType);
+  if (kernel == nullptr) return ncclInvalidArgument;
+  if (maxNnz == 0) return ncclSuccess;
+  void* dstIdx = block;
+  void* dstVal = (char*)block + ROUNDUP(maxNnz*ncclTypeSize(indexType), 16);
+  void* args[6] = {&dstIdx, &dstVal, &indices, &values, &devNnz, &maxNnz};
+  CUDACHECK(cudaLaunchKernel(kernel, sparseGrid(maxNnz), dim3(512, 1, 1), args, 0, stream));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclLaunchSparseScatter(void* dst, size_t count, void const* indices, void const* values, size_t const* devNnz, size_t maxNnz, ncclDataType_t indexType, ncclDataType_t eltType, cudaStream_t stream) {
+  void const* kernel = sparseKernel(/*scatter=*/true, indexType, eltType);
+  if (kernel == nullptr) return ncclInvalidArgument;
+  if (maxNnz == 0) return ncclSuccess;
+  void* args[6] = {&dst, &count, &indices, &values, &devNnz, &maxNnz};
+  CUDACHECK(cudaLaunchKernel(kernel, sparseGrid(maxNnz), dim3(512, 1, 1), args, 0, stream));
+  return ncclSuccess;
+}
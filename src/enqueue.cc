@@ -12,9 +12,14 @@
 #include "channel.h"
 #include "cudawrap.h"
 #include "transport.h"
+#include "profiler.h"
+#include "p2p.h"
+#include "tuner.h"
+#include <algorithm> // std::sort
 #include <cassert>
 #include <cstring> // std::memcpy
 #include <cinttypes> // PRIx64
+#include <cmath> // sqrt
 
 NCCL_PARAM(L1SharedMemoryCarveout, "L1_SHARED_MEMORY_CARVEOUT", 0);
 
@@ -23,45 +28,173 @@ static ncclResult_t setCollWorkElem(uint64_t workCount, uint64_t workOffset, siz
 static ncclResult_t initCollWorkElemReg(struct ncclComm* comm, struct ncclWorkElem* work, struct ncclChannel* channel, ncclRegBufferType regBufType, void* regBufSend[], void* regBufRecv[], struct ncclWorkElemReg* workElemReg);
 static ncclResult_t computeCollChunkInfo(struct ncclInfo* collInfo, size_t nBytes, int nChannels);
 static ncclResult_t initCollProxyOp(struct ncclInfo* collInfo, int channelId, uint64_t opCount, uint32_t nsteps, struct ncclProxyOp* proxyOp);
+static ncclResult_t setCollProxyOpNetReg(struct ncclInfo* collInfo, int channelId, struct ncclWorkElem* workElem, struct ncclProxyOp* proxyOp);
+static bool ringNetRegUsable(struct ncclComm* comm, int channelId);
 static ncclResult_t getTunerInfo(struct ncclInfo* collInfo, int collNetSupport, int nvlsSupport, int numPipeOps);
+static ncclResult_t getAutotuneInfo(struct ncclInfo* collInfo, int collNetSupport, int nvlsSupport, int numPipeOps);
 static ncclResult_t topoGetAlgoInfo(struct ncclInfo* collInfo, int collNetSupport, int nvlsSupport, int numPipeOps);
 static ncclResult_t getChannnelThreadInfo(struct ncclInfo* collInfo);
 static ncclResult_t computeCollWorkFunc(struct ncclInfo* collInfo);
 static ncclResult_t getPatternInfo(struct ncclInfo* collInfo);
 static ncclResult_t getLoopInfo(struct ncclInfo* collInfo);
 static ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNetSupport);
+static bool residentKernelWanted(struct ncclComm* comm, struct ncclKernelPlan* plan);
+
+// Loads the module of kernel fn and sets its attributes for the current device.
+static ncclResult_t initKernel(void* fn, int cudaArch, size_t* maxStackSize) {
+  ncclResult_t result = ncclSuccess;
+  int carveout = ncclParamL1SharedMemoryCarveout();
+
+  if (maxStackSize) {
+    cudaFuncAttributes attr = {0};
+    CUDACHECKGOTO(cudaFuncGetAttributes(&attr, fn), result, ignore0);
+    if (attr.localSizeBytes > *maxStackSize) *maxStackSize = attr.localSizeBytes;
+  ignore0:;
+  }
+  if (carveout) {
+    CUDACHECKGOTO(cudaFuncSetAttribute(fn,
+      cudaFuncAttributePreferredSharedMemoryCarveout, carveout),
+      result, ignore1);
+  ignore1:;
+  }
+  if (ncclShmemDynamicSize(cudaArch) != 0) {
+    CUDACHECKGOTO(cudaFuncSetAttribute(fn,
+      cudaFuncAttributeMaxDynamicSharedMemorySize, ncclShmemDynamicSize(cudaArch)),
+      result, exit);
+  }
+exit:
+  return result;
+}
+
+// With NCCL_LAZY_KERNEL_INIT=1 kernels are not set up when the device is
+// first used. Every communicator sets up the kernels its algorithms and
+// protocols can reach instead, in a thread which runs during the rest of its
+// init, see ncclKernelWarmupStart().
+NCCL_PARAM(LazyKernelInit, "LAZY_KERNEL_INIT", 0);
 
 // Returns maximum kernel stack size of all CUDA kernels
 ncclResult_t ncclInitKernelsForDevice(int cudaArch, size_t* maxStackSize) {
   ncclResult_t result = ncclSuccess;
 
   if (maxStackSize) *maxStackSize = 0;
-  int carveout = ncclParamL1SharedMemoryCarveout();
+  if (ncclParamLazyKernelInit()) return ncclSuccess;
 
-  for (int k=0; k < ncclDevKernelCount; k++) {
-    void* fn = ncclDevKernelList[k];
+  // Extra iterations for the resident and argument work kernels which are not in the list.
+  for (int k=0; k < ncclDevKernelCount+2; k++) {
+    void* fn = k < ncclDevKernelCount ? ncclDevKernelList[k] : k == ncclDevKernelCount ? ncclDevKernelResident : ncclDevKernelArgsWork;
     if (fn == nullptr) continue;
+    ncclResult_t ret = initKernel(fn, cudaArch, maxStackSize);
+    if (ret != ncclSuccess) result = ret;
+  }
+  return result;
+}
 
-    if (maxStackSize) {
-      cudaFuncAttributes attr = {0};
-      CUDACHECKGOTO(cudaFuncGetAttributes(&attr, fn), result, ignore0);
-      if (attr.localSizeBytes > *maxStackSize) *maxStackSize = attr.localSizeBytes;
-    ignore0:;
-    }
-    if (carveout) {
-      CUDACHECKGOTO(cudaFuncSetAttribute(fn,
-        cudaFuncAttributePreferredSharedMemoryCarveout, carveout),
-        result, ignore1);
-    ignore1:;
-    }
-    if (ncclShmemDynamicSize(cudaArch) != 0) {
-      CUDACHECKGOTO(cudaFuncSetAttribute(fn,
-        cudaFuncAttributeMaxDynamicSharedMemorySize, ncclShmemDynamicSize(cudaArch)),
-        result, next_kernel);
+struct ncclKernelWarmup {
+  pthread_t thread;
+  bool running;
+  int cudaDev;
+  int cudaArch;
+  int nKernels;
+  void** kernels; // [ncclDevKernelCount+2], set up ones first
+  int nReady;
+  size_t maxStackSize;
+  ncclResult_t result;
+};
+
+static void warmupAddKernel(struct ncclKernelWarmup* warmup, void* fn) {
+  if (fn == nullptr) return;
+  for (int i=0; i < warmup->nKernels; i++) {
+    if (warmup->kernels[i] == fn) return;
+  }
+  warmup->kernels[warmup->nKernels++] = fn;
+}
+
+static void* kernelWarmupThread(void* warmup_) {
+  struct ncclKernelWarmup* warmup = (struct ncclKernelWarmup*)warmup_;
+  warmup->result = ncclSuccess;
+  if (cudaSetDevice(warmup->cudaDev) != cudaSuccess) {
+    warmup->result = ncclUnhandledCudaError;
+    return nullptr;
+  }
+  for (int i=0; i < warmup->nKernels; i++) {
+    ncclResult_t ret = initKernel(warmup->kernels[i], warmup->cudaArch, &warmup->maxStackSize);
+    if (ret != ncclSuccess) warmup->result = ret;
+  }
+  warmup->nReady = warmup->nKernels;
+  return nullptr;
+}
+
+ncclResult_t ncclKernelWarmupStart(struct ncclComm* comm) {
+  if (!ncclParamLazyKernelInit()) return ncclSuccess;
+  struct ncclKernelWarmup* warmup;
+  NCCLCHECK(ncclCalloc(&warmup, 1));
+  comm->kernelWarmup = warmup;
+  NCCLCHECK(ncclCalloc(&warmup->kernels, ncclDevKernelCount+2));
+  warmup->cudaDev = comm->cudaDev;
+  warmup->cudaArch = comm->cudaArch;
+
+  // The tuning model only gives a bandwidth to the algorithms and protocols
+  // which can run, every other kernel is set up on first launch.
+  warmupAddKernel(warmup, ncclDevKernelForFunc[ncclDevFuncId_P2p()]);
+  warmupAddKernel(warmup, ncclDevKernelArgsWork);
+  warmupAddKernel(warmup, ncclDevKernelResident);
+  for (int coll=0; coll < NCCL_NUM_FUNCTIONS; coll++) {
+    for (int a=0; a < NCCL_NUM_ALGORITHMS; a++) {
+      for (int p=0; p < NCCL_NUM_PROTOCOLS; p++) {
+        if (comm->bandwidths[coll][a][p] <= 0) continue;
+        for (int op=0; op < ncclNumDevRedOps; op++) {
+          for (int ty=0; ty < ncclNumTypes; ty++) {
+            int fnId = ncclDevFuncId(coll, op, ty, a, p);
+            if (fnId >= 0) warmupAddKernel(warmup, ncclDevKernelForFunc[fnId]);
+          }
+        }
+      }
     }
-  next_kernel:;
   }
-  return result;
+  INFO(NCCL_INIT, "Setting up %d of %d kernels in the background", warmup->nKernels, ncclDevKernelCount+2);
+  if (pthread_create(&warmup->thread, nullptr, kernelWarmupThread, warmup) != 0) {
+    // Do it inline instead.
+    kernelWarmupThread(warmup);
+    return warmup->result;
+  }
+  ncclSetThreadName(warmup->thread, "NCCL Kernels%2d", comm->cudaDev);
+  warmup->running = true;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclKernelWarmupWait(struct ncclComm* comm, size_t* maxStackSize) {
+  struct ncclKernelWarmup* warmup = comm->kernelWarmup;
+  *maxStackSize = 0;
+  if (warmup == nullptr) return ncclSuccess;
+  if (warmup->running) {
+    pthread_join(warmup->thread, nullptr);
+    warmup->running = false;
+  }
+  *maxStackSize = warmup->maxStackSize;
+  return warmup->result;
+}
+
+ncclResult_t ncclKernelWarmupFree(struct ncclComm* comm) {
+  struct ncclKernelWarmup* warmup = comm->kernelWarmup;
+  if (warmup == nullptr) return ncclSuccess;
+  if (warmup->running) pthread_join(warmup->thread, nullptr);
+  free(warmup->kernels);
+  free(warmup);
+  comm->kernelWarmup = nullptr;
+  return ncclSuccess;
+}
+
+// Launches of kernels the warm-up did not expect, e.g. chosen by a tuner
+// plugin, set them up first.
+static ncclResult_t kernelWarmupEnsure(struct ncclComm* comm, void* fn) {
+  struct ncclKernelWarmup* warmup = comm->kernelWarmup;
+  for (int i=0; i < warmup->nReady; i++) {
+    if (warmup->kernels[i] == fn) return ncclSuccess;
+  }
+  NCCLCHECK(initKernel(fn, comm->cudaArch, nullptr));
+  warmupAddKernel(warmup, fn);
+  warmup->nReady = warmup->nKernels;
+  return ncclSuccess;
 }
 
 /*****************************************************************************/
@@ -114,6 +247,28 @@ static void appendWorkElemColl(
   ncclIntruQueueEnqueue(&chan->workQueue, q);
 }
 
+// Works are shared by several operations, so one sampled operation makes the
+// device record the whole work.
+static void markWorkProfiled(struct ncclKernelPlan* plan, int channelId, bool profile) {
+  if (profile) ncclIntruQueueTail(&plan->channels[channelId].workQueue)->work.header.profile = 1;
+}
+
+// Fused collectives get a ncclWork of their own, see ncclCollFuseTasks().
+static void appendWorkElemFused(
+    struct ncclComm* comm, struct ncclKernelPlan* plan, int channelId,
+    struct ncclInfo* collInfo, struct ncclWorkElem const *elem) {
+  struct ncclKernelPlan::Channel* chan = &plan->channels[channelId];
+  struct ncclWorkList* q = ncclMemoryStackAlloc<struct ncclWorkList>(&comm->memScoped);
+  q->work.header.type = ncclWorkTypeFusedColl;
+  q->work.header.funcIndex = collInfo->workFuncIndex;
+  q->work.fusedElem.elem = *elem; // C++ struct assignment
+  q->work.fusedElem.nSegments = collInfo->nFusedSegments;
+  memcpy(q->work.fusedElem.segments, collInfo->fusedSegments, collInfo->nFusedSegments*sizeof(struct ncclWorkSegment));
+  chan->nWorkElem = 1;
+  chan->nWork += 1;
+  ncclIntruQueueEnqueue(&chan->workQueue, q);
+}
+
 static void finishWorkP2p(struct ncclWork* work) {
   int nElem = 0;
   for (int e=0; e < NCCL_MAX_WORK_ELEMENTS_P2P; e++) {
@@ -132,6 +287,15 @@ static void finishWorkP2p(struct ncclWork* work) {
   }
 }
 
+// Bytes of a work the kernel needs. P2p groups only look at their own element
+// and the extension two slots after it, so a p2p work is cut after those;
+// everything else is fetched whole.
+static int workFetchBytes(struct ncclWork const* work) {
+  if (work->header.type != ncclWorkTypeP2p) return sizeof(struct ncclWork);
+  int nElem = std::min(work->p2pElems[0].ngroups+2, NCCL_MAX_WORK_ELEMENTS_P2P);
+  return ROUNDUP(offsetof(struct ncclWork, p2pElems) + nElem*sizeof(struct ncclWorkElemP2p), 16);
+}
+
 static void finishWork(struct ncclWork* work) {
   if (work->header.type == ncclWorkTypeP2p) {
     finishWorkP2p(work);
@@ -140,14 +304,16 @@ static void finishWork(struct ncclWork* work) {
 
 static void appendWorkElemP2p(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int channelId,
-    struct ncclWorkElemP2p const *elem, bool fuseOk
+    struct ncclWorkElemP2p const *elem, struct ncclWorkElemP2p const *ext, bool fuseOk
   ) {
   int funcIndex = ncclDevFuncId_P2p();
   struct ncclKernelPlan::Channel* chan = &plan->channels[channelId];
   struct ncclWorkList* q = ncclIntruQueueTail(&chan->workQueue);
+  // Elements with a device count take their extension slot too
+  int nSlots = ext ? 2 : 1;
   if (q && funcIndex == q->work.header.funcIndex) {
     if (!fuseOk) goto NewWork;
-    if (chan->p2pTailElem[elem->p2pType-1] < NCCL_MAX_WORK_ELEMENTS_P2P) {
+    if (chan->p2pTailElem[elem->p2pType-1] + 2*(nSlots-1) < NCCL_MAX_WORK_ELEMENTS_P2P) {
       for (int e = -2 + chan->p2pTailElem[elem->p2pType-1]; e >= 0; e -= 2) {
         // Can't have multiple elements of the same ncclWork communicate with the
         // same peer otherwise they would attempt to use that connection concurrently.
@@ -156,7 +322,8 @@ static void appendWorkElemP2p(
       }
       int e = chan->p2pTailElem[elem->p2pType-1];
       q->work.p2pElems[e] = *elem; // C++ struct assignment
-      chan->p2pTailElem[elem->p2pType-1] += 2;
+      if (ext) q->work.p2pElems[e+2] = *ext;
+      chan->p2pTailElem[elem->p2pType-1] += 2*nSlots;
       return;
     }
   NewWork:
@@ -168,7 +335,8 @@ static void appendWorkElemP2p(
   chan->p2pTailElem[ncclWorkP2pTypeRecv-1] = 0;
   chan->p2pTailElem[ncclWorkP2pTypeSend-1] = 1;
   q->work.p2pElems[chan->p2pTailElem[elem->p2pType-1]] = *elem; // C++ struct assignment
-  chan->p2pTailElem[elem->p2pType-1] += 2;
+  if (ext) q->work.p2pElems[chan->p2pTailElem[elem->p2pType-1]+2] = *ext;
+  chan->p2pTailElem[elem->p2pType-1] += 2*nSlots;
   chan->nWork += 1;
   ncclIntruQueueEnqueue(&chan->workQueue, q);
 }
@@ -193,6 +361,9 @@ static ncclResult_t computeCollSteps(struct ncclInfo* collInfo, size_t workCount
       *steps = DIVUP(workCount, comm->channels[0].collnetDirect.nHeads * collInfo->chunkCount) * collInfo->chunkSteps;
     else if (collInfo->algorithm == NCCL_ALGO_NVLS || collInfo->algorithm == NCCL_ALGO_NVLS_TREE)
       *steps = DIVUP(workCount, comm->channels[0].nvls.nHeads * collInfo->chunkCount) * collInfo->chunkSteps;
+    else if (collInfo->algorithm == NCCL_ALGO_HIER)
+      // Steps of one chunk per loop, ncclProxySaveOp() scales them for each peer
+      *steps = DIVUP(workCount, comm->nRanks * collInfo->chunkCount) * collInfo->chunkSteps;
     else
       *steps = DIVUP(workCount, collInfo->chunkCount) * collInfo->chunkSteps;
   } else if (collInfo->coll == ncclFuncReduceScatter) {
@@ -205,6 +376,9 @@ static ncclResult_t computeCollSteps(struct ncclInfo* collInfo, size_t workCount
       *steps = DIVUP(workCount, collInfo->chunkCount) * (comm->nRanks - 1) * collInfo->chunkSteps;
     else
       *steps = DIVUP(workCount, collInfo->chunkCount) * collInfo->chunkSteps;
+  } else if (collInfo->algorithm == NCCL_ALGO_RING_SCATTER) {
+    // Steps of one chunk per loop, ncclProxySaveOp() scales them for each peer
+    *steps = DIVUP(workCount, comm->nRanks * collInfo->chunkCount) * collInfo->chunkSteps;
   } else {
     *steps = DIVUP(workCount, collInfo->chunkCount) * collInfo->chunkSteps;
   }
@@ -226,7 +400,7 @@ static ncclResult_t computeCollLastChunkInfo(struct ncclInfo* collInfo, size_t w
   struct ncclComm* comm = collInfo->comm;
 
   if (collInfo->coll == ncclFuncAllReduce) {
-    if (collInfo->algorithm == NCCL_ALGO_RING) {
+    if (collInfo->algorithm == NCCL_ALGO_RING || collInfo->algorithm == NCCL_ALGO_HIER) {
       size_t remCount = workCount % (comm->nRanks * collInfo->chunkCount);
       *lastChunkCount = DIVUP(DIVUP(remCount, comm->nRanks), alignCount) * alignCount;
     } else if (collInfo->algorithm == NCCL_ALGO_NVLS || collInfo->algorithm == NCCL_ALGO_NVLS_TREE) {
@@ -238,6 +412,9 @@ static ncclResult_t computeCollLastChunkInfo(struct ncclInfo* collInfo, size_t w
     } else {
       *lastChunkCount = collInfo->chunkCount;
     }
+  } else if (collInfo->algorithm == NCCL_ALGO_RING_SCATTER) {
+    size_t remCount = workCount % (comm->nRanks * collInfo->chunkCount);
+    *lastChunkCount = DIVUP(DIVUP(remCount, comm->nRanks), alignCount) * alignCount;
   } else {
     *lastChunkCount = collInfo->chunkCount;
   }
@@ -259,6 +436,126 @@ static ncclResult_t getCollnetLoopInfo(struct ncclInfo* collInfo, int* nstepsPer
   return ncclSuccess;
 }
 
+static void tunerTimingDetach(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  if (plan->tunerTiming != nullptr) {
+    plan->tunerTiming->next = comm->tunerTimingFree;
+    comm->tunerTimingFree = plan->tunerTiming;
+    plan->tunerTiming = nullptr;
+  }
+}
+
+// Time plans made of a single collective so the tuner can learn how its
+// choice performed. With more than one we can't attribute the duration.
+static ncclResult_t tunerTimingAttach(struct ncclComm* comm, struct ncclKernelPlan* plan, struct ncclInfo* collInfo) {
+  bool tunerWants = comm->tuner != nullptr && comm->tuner->collComplete != nullptr;
+  if ((!tunerWants && collInfo->autotuneCand < 0) || plan->persistent) return ncclSuccess;
+  if (plan->collOpCount != 1) {
+    tunerTimingDetach(comm, plan);
+    return ncclSuccess;
+  }
+  struct ncclTunerTiming* timing = comm->tunerTimingFree;
+  if (timing != nullptr) {
+    comm->tunerTimingFree = timing->next;
+  } else {
+    NCCLCHECK(ncclCalloc(&timing, 1));
+    CUDACHECK(cudaEventCreate(&timing->start));
+    CUDACHECK(cudaEventCreate(&timing->stop));
+  }
+  timing->coll = collInfo->coll;
+  timing->nBytes = collInfo->nBytes;
+  timing->algorithm = collInfo->algorithm;
+  timing->protocol = collInfo->protocol;
+  timing->nChannels = collInfo->nChannels;
+  timing->autotuneBucket = collInfo->autotuneCand >= 0 ? ncclAutotuneGetBucket(comm, collInfo->coll, collInfo->nBytes) : nullptr;
+  timing->autotuneCand = collInfo->autotuneCand;
+  plan->tunerTiming = timing;
+  return ncclSuccess;
+}
+
+// NVTX marker with the tuning decisions of a collective, and the plan that
+// runs it. The plan id matches the range around the kernel launch.
+static void nvtxCollPlanned(struct ncclComm* comm, struct ncclKernelPlan* plan, struct ncclInfo* collInfo) {
+  struct NvtxParamsCollPlanned {
+    uint64_t commHash;
+    uint64_t planId;
+    size_t count;
+    int datatype;
+    int algorithm;
+    int protocol;
+    int nChannels;
+  };
+  static constexpr nvtxPayloadSchemaEntry_t CollPlannedSchema[] = {
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_UINT64, "Communicator hash"},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_UINT64, "Plan id", nullptr, 0, offsetof(NvtxParamsCollPlanned, planId)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_SIZE, "Count", nullptr, 0, offsetof(NvtxParamsCollPlanned, count)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Datatype", nullptr, 0, offsetof(NvtxParamsCollPlanned, datatype)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Algorithm", nullptr, 0, offsetof(NvtxParamsCollPlanned, algorithm)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Protocol", nullptr, 0, offsetof(NvtxParamsCollPlanned, protocol)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Channels", nullptr, 0, offsetof(NvtxParamsCollPlanned, nChannels)}
+  };
+  NvtxParamsCollPlanned payload{comm->commHash, plan->planId, collInfo->count, collInfo->datatype,
+    collInfo->algorithm, collInfo->protocol, collInfo->nChannels};
+  NVTX3_MARK_WITH_PARAMS(CollPlanned, collInfo->opName, payload);
+}
+
+// Report the timed kernels that have completed, in launch order. Never blocks.
+static ncclResult_t tunerTimingPoll(struct ncclComm* comm) {
+  while (!ncclIntruQueueEmpty(&comm->tunerTimingQueue)) {
+    struct ncclTunerTiming* timing = ncclIntruQueueHead(&comm->tunerTimingQueue);
+    cudaError_t err = cudaEventQuery(timing->stop);
+    if (err == cudaErrorNotReady) break;
+    CUDACHECK(err);
+    float ms;
+    CUDACHECK(cudaEventElapsedTime(&ms, timing->start, timing->stop));
+    ncclIntruQueueDequeue(&comm->tunerTimingQueue);
+    timing->next = comm->tunerTimingFree;
+    comm->tunerTimingFree = timing;
+    struct ncclAutotuneBucket* bucket = timing->autotuneBucket;
+    if (bucket && bucket->state != ncclAutotuneDone) {
+      bucket->cand[timing->autotuneCand].time += ms*1000;
+      bucket->cand[timing->autotuneCand].count++;
+    }
+    if (comm->tuner != nullptr && comm->tuner->collComplete != nullptr) {
+      ncclResult_t ret = comm->tuner->collComplete(comm->tunerContext, timing->coll, timing->nBytes,
+          timing->algorithm, timing->protocol, timing->nChannels, ms*1000);
+      if (ret != ncclSuccess) INFO(NCCL_TUNING, "Tuner plugin %s collComplete returned %d", comm->tuner->name, ret);
+    }
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTunerTimingWait(struct ncclComm* comm) {
+  for (struct ncclTunerTiming* timing = ncclIntruQueueHead(&comm->tunerTimingQueue); timing; timing = timing->next) {
+    CUDACHECK(cudaEventSynchronize(timing->stop));
+  }
+  return tunerTimingPoll(comm);
+}
+
+ncclResult_t ncclTunerTimingFree(struct ncclComm* comm) {
+  NCCLCHECK(tunerTimingPoll(comm));
+  while (!ncclIntruQueueEmpty(&comm->tunerTimingQueue)) {
+    struct ncclTunerTiming* timing = ncclIntruQueueDequeue(&comm->tunerTimingQueue);
+    timing->next = comm->tunerTimingFree;
+    comm->tunerTimingFree = timing;
+  }
+  while (comm->tunerTimingFree != nullptr) {
+    struct ncclTunerTiming* timing = comm->tunerTimingFree;
+    comm->tunerTimingFree = timing->next;
+    CUDACHECKIGNORE(cudaEventDestroy(timing->start));
+    CUDACHECKIGNORE(cudaEventDestroy(timing->stop));
+    free(timing);
+  }
+  return ncclSuccess;
+}
+
+// Each channel takes at most half of its fifo ring of works per kernel. The
+// budget is the room left on the fullest channel of the plan, and every
+// collective or p2p adds at most one work to each channel it uses.
+static void workBudgetCharge(struct ncclComm* comm, struct ncclKernelPlan* plan, int c, int* nWorkBudget) {
+  if (plan->persistent) return;
+  *nWorkBudget = std::min(*nWorkBudget, int(comm->workFifoChannelDepth/2) - plan->channels[c].nWork);
+}
+
 static ncclResult_t addCollnetCollToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int usableChannels,
     struct ncclInfo* collInfo, int* nWorkBudget
@@ -267,6 +564,8 @@ static ncclResult_t addCollnetCollToPlan(
   struct ncclKernelPlan::Channel *chans = plan->channels;
   struct ncclWorkElem workElem;
   uint64_t opCount = uint64_t(plan->collOpCount++) << 1 | 0;
+  NCCLCHECK(tunerTimingAttach(comm, plan, collInfo));
+  nvtxCollPlanned(comm, plan, collInfo);
   ncclRegBufferType regBufType = collInfo->regBufType;
   int nChannels = std::min(collInfo->nChannels, usableChannels);
   size_t countPerChannel = DIVUP(collInfo->count, nChannels);
@@ -284,7 +583,6 @@ static ncclResult_t addCollnetCollToPlan(
   for (int bid = 0; bid < nChannels; bid++) {
     workElem.bid = bid;
     // Add work elem
-    *nWorkBudget += chans[bid].nWork;
     if (regBufType == NCCL_REGULAR_BUFFER) {
       appendWorkElemColl(comm, plan, bid, collInfo->workFuncIndex, &workElem);
     } else {
@@ -292,7 +590,8 @@ static ncclResult_t addCollnetCollToPlan(
       NCCLCHECKGOTO(initCollWorkElemReg(comm, &workElem, &comm->channels[bid], regBufType, collInfo->regBufSend, collInfo->regBufRecv, &workElemReg), ret, fail);
       appendWorkElemColl(comm, plan, bid, collInfo->workFuncIndex, &workElemReg);
     }
-    *nWorkBudget -= chans[bid].nWork; // subtract delta of chans[c].nWork
+    markWorkProfiled(plan, bid, collInfo->profile);
+    workBudgetCharge(comm, plan, bid, nWorkBudget);
 
     // Add proxy task. Empty collectives do not make it to the proxy thread
     // since they don't imply synchronization for the user like p2p.
@@ -329,6 +628,8 @@ static ncclResult_t addTunedCollToPlan(
   struct ncclKernelPlan::Channel *chans = plan->channels;
   struct ncclWorkElem workElem;
   uint64_t opCount = uint64_t(plan->collOpCount++) << 1 | 0;
+  NCCLCHECK(tunerTimingAttach(comm, plan, collInfo));
+  nvtxCollPlanned(comm, plan, collInfo);
   uint64_t workCount;
   uint64_t workOffset = 0;
   uint32_t typeSize = ncclTypeSize(collInfo->datatype);
@@ -338,6 +639,7 @@ static ncclResult_t addTunedCollToPlan(
   int maxIndexInLeast;
   size_t maxBytesInLeast;
   int nChannels = std::min(collInfo->nChannels, usableChannels);
+  int first = comm->tasks.channelFirst;
   int rnChannels = 0;
   size_t countPerChannels;
   size_t remCount = collInfo->count;
@@ -350,21 +652,21 @@ static ncclResult_t addTunedCollToPlan(
 
   // Choose the `nBid` least loaded channels to do the work. This ensures
   // all bids go to different channels in case they need to synchronize.
-  least[0] = 0;
+  least[0] = first;
   maxIndexInLeast = 0;
-  maxBytesInLeast = chans[0].collBytes;
+  maxBytesInLeast = chans[first].collBytes;
   // Initialize least[] such that the first nBid channels are accounted for.
   for (int b = 1; b < nChannels; b++) {
-    least[b] = b;
-    if (maxBytesInLeast < chans[b].collBytes) {
+    least[b] = first+b;
+    if (maxBytesInLeast < chans[first+b].collBytes) {
       maxIndexInLeast = b;
-      maxBytesInLeast = chans[b].collBytes;
+      maxBytesInLeast = chans[first+b].collBytes;
     }
   }
   // Sort in the rest of the channels. If a channel has less work than the max
   // member of least[], replace that member and compute the new max. We only
   // sort channels when coll algo is not collnet.
-  for (int c = nChannels; c < usableChannels; c++) {
+  for (int c = first+nChannels; c < first+usableChannels; c++) {
     if (chans[c].collBytes < maxBytesInLeast) {
       least[maxIndexInLeast] = c;
       maxBytesInLeast = chans[least[0]].collBytes;
@@ -384,17 +686,20 @@ static ncclResult_t addTunedCollToPlan(
     workCount = std::min(countPerChannels, remCount);
     NCCLCHECKGOTO(computeCollLastChunkInfo(collInfo, workCount, alignCount, &lastChunkCount), ret, fail);
     NCCLCHECKGOTO(setCollWorkElem(workCount, workOffset, lastChunkCount, &workElem), ret, fail);
+    workElem.netReg = collInfo->netReg && ringNetRegUsable(comm, c);
 
     // Add work elem
-    *nWorkBudget += chans[c].nWork;
-    if (regBufType == NCCL_REGULAR_BUFFER) {
+    if (collInfo->nFusedSegments) {
+      appendWorkElemFused(comm, plan, c, collInfo, &workElem);
+    } else if (regBufType == NCCL_REGULAR_BUFFER) {
       appendWorkElemColl(comm, plan, c, collInfo->workFuncIndex, &workElem);
     } else {
       struct ncclWorkElemReg workElemReg;
       NCCLCHECKGOTO(initCollWorkElemReg(comm, &workElem, &comm->channels[c], regBufType, collInfo->regBufSend, collInfo->regBufRecv, &workElemReg), ret, fail);
       appendWorkElemColl(comm, plan, c, collInfo->workFuncIndex, &workElemReg);
     }
-    *nWorkBudget -= chans[c].nWork; // subtract delta of chans[c].nWork
+    markWorkProfiled(plan, c, collInfo->profile);
+    workBudgetCharge(comm, plan, c, nWorkBudget);
 
     // Add proxy task. Empty collectives do not make it to the proxy thread
     // since they don't imply synchronization for the user like p2p.
@@ -403,6 +708,7 @@ static ncclResult_t addTunedCollToPlan(
       struct ncclProxyOp proxyOp;
       NCCLCHECKGOTO(computeCollSteps(collInfo, workCount, &steps), ret, fail);
       NCCLCHECKGOTO(initCollProxyOp(collInfo, c, opCount, steps, &proxyOp), ret, fail);
+      if (workElem.netReg) NCCLCHECKGOTO(setCollProxyOpNetReg(collInfo, c, &workElem, &proxyOp), ret, fail);
       NCCLCHECKGOTO(addProxyOpIfNeeded(comm, plan, &proxyOp), ret, fail);
     }
 
@@ -436,6 +742,8 @@ static ncclResult_t addCBDCollToPlan(
   struct ncclKernelPlan::Channel *chans = plan->channels;
   size_t enqBytes;
   uint64_t opCount = uint64_t(plan->collOpCount++) << 1 | 0;
+  NCCLCHECK(tunerTimingAttach(comm, plan, collInfo));
+  nvtxCollPlanned(comm, plan, collInfo);
   size_t typeSize = ncclTypeSize(collInfo->datatype);
   size_t workBytesTotal = collInfo->count * typeSize;
   size_t workCountTotal = collInfo->count;
@@ -450,7 +758,7 @@ static ncclResult_t addCBDCollToPlan(
   NCCLCHECKGOTO(computeCollChunkInfo(collInfo, collInfo->aggnBytes, collInfo->nChannels), ret, fail);
   NCCLCHECKGOTO(computeCollAlignCount(collInfo, &alignCount), ret, fail);
   NCCLCHECKGOTO(initCollWorkElem(collInfo, &workElem), ret, fail);
-  for (int c = 0; c < usableChannels; c++) {
+  for (int c = comm->tasks.channelFirst; c < comm->tasks.channelFirst + usableChannels; c++) {
     if (plan->maxBytesPerChannel <= chans[c].collBytes) continue;
     if (workBytesTotal == 0) break;
     enqBytes = std::min(plan->maxBytesPerChannel - chans[c].collBytes, workBytesTotal);
@@ -459,17 +767,20 @@ static ncclResult_t addCBDCollToPlan(
 
     NCCLCHECKGOTO(computeCollLastChunkInfo(collInfo, workCount, alignCount, &lastChunkCount), ret, fail);
     NCCLCHECKGOTO(setCollWorkElem(workCount, workOffset, lastChunkCount, &workElem), ret, fail);
+    workElem.netReg = collInfo->netReg && ringNetRegUsable(comm, c);
 
     // Add work elem
-    *nWorkBudget += chans[c].nWork;
-    if (regBufType == NCCL_REGULAR_BUFFER) {
+    if (collInfo->nFusedSegments) {
+      appendWorkElemFused(comm, plan, c, collInfo, &workElem);
+    } else if (regBufType == NCCL_REGULAR_BUFFER) {
       appendWorkElemColl(comm, plan, c, collInfo->workFuncIndex, &workElem);
     } else {
       struct ncclWorkElemReg workElemReg;
       NCCLCHECKGOTO(initCollWorkElemReg(comm, &workElem, &comm->channels[c], regBufType, collInfo->regBufSend, collInfo->regBufRecv, &workElemReg), ret, fail);
       appendWorkElemColl(comm, plan, c, collInfo->workFuncIndex, &workElemReg);
     }
-    *nWorkBudget -= chans[c].nWork; // subtract delta of chans[c].nWork
+    markWorkProfiled(plan, c, collInfo->profile);
+    workBudgetCharge(comm, plan, c, nWorkBudget);
 
     // Add proxy task. Empty collectives do not make it to the proxy thread
     // since they don't imply synchronization for the user like p2p.
@@ -478,6 +789,7 @@ static ncclResult_t addCBDCollToPlan(
       struct ncclProxyOp proxyOp;
       NCCLCHECKGOTO(computeCollSteps(collInfo, workCount, &steps), ret, fail);
       NCCLCHECKGOTO(initCollProxyOp(collInfo, c, opCount, steps, &proxyOp), ret, fail);
+      if (workElem.netReg) NCCLCHECKGOTO(setCollProxyOpNetReg(collInfo, c, &workElem, &proxyOp), ret, fail);
       NCCLCHECKGOTO(addProxyOpIfNeeded(comm, plan, &proxyOp), ret, fail);
     }
 
@@ -508,9 +820,33 @@ NCCL_PARAM(P2pLLThreshold, "P2P_LL_THRESHOLD", 16384);
 
 // Put p2p op in plan assuming there is space in nWorkBudget, so you must
 // ensure *nWorkBudget >= 1 upon entry.
+static_assert(NCCL_STATS_TRANSPORT_NVLS == NTRANSPORTS, "NVLS is counted after the other transports");
+
+// Transport of a connector, as counted by ncclCommGetStats
+static int statsTransport(struct ncclConnector* conn) {
+  for (int t=0; t<NTRANSPORTS; t++) {
+    if (conn->transportComm == &ncclTransports[t]->send || conn->transportComm == &ncclTransports[t]->recv) return t;
+  }
+  return TRANSPORT_P2P; // not connected, e.g. to ourselves
+}
+
+static void statsAddCollBytes(struct ncclComm* comm, struct ncclInfo* info) {
+  int t;
+  if (info->algorithm == NCCL_ALGO_NVLS || info->algorithm == NCCL_ALGO_NVLS_TREE) {
+    t = NCCL_STATS_TRANSPORT_NVLS;
+  } else if (info->algorithm == NCCL_ALGO_COLLNET_DIRECT || info->algorithm == NCCL_ALGO_COLLNET_CHAIN) {
+    t = TRANSPORT_COLLNET;
+  } else {
+    int next = comm->channels[0].ring.next;
+    t = next >= 0 && next != comm->rank ? statsTransport(comm->channels[0].peers[next]->send) : TRANSPORT_P2P;
+  }
+  ncclStatsAdd(&comm->stats.transportBytes[t], info->nBytes);
+}
+
 static ncclResult_t addP2pToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget,
-    bool isSendNotRecv, int peer, int chunk, void *addr, size_t bytes, bool fuseOk
+    bool isSendNotRecv, int peer, int chunk, void *addr, size_t bytes, int knownReg, bool fuseOk,
+    struct ncclTaskP2p* task
   ) {
   struct ncclInfo info = {
     isSendNotRecv ? ncclFuncSend : ncclFuncRecv,
@@ -527,23 +863,33 @@ static ncclResult_t addP2pToPlan(
   struct ncclConnInfo* conn = isSendNotRecv ?
     &comm->channels[channelId].peers[peer]->send[1].conn : &comm->channels[channelId].peers[peer]->recv[1].conn;
   info.protocol = ((conn->buffs[NCCL_PROTO_LL] != nullptr) && bytes <= ncclParamP2pLLThreshold()) ? NCCL_PROTO_LL : NCCL_PROTO_SIMPLE;
+  ncclStatsAdd(&comm->stats.transportBytes[statsTransport(isSendNotRecv ?
+    comm->channels[channelId].peers[peer]->send+1 : comm->channels[channelId].peers[peer]->recv+1)], bytes);
 
   int reg = 0;
-  if (info.protocol == NCCL_PROTO_SIMPLE) {
+  if (info.protocol == NCCL_PROTO_SIMPLE && knownReg != -1) {
+    reg = knownReg;
+  } else if (info.protocol == NCCL_PROTO_SIMPLE) {
     struct ncclReg* regRecord;
     NCCLCHECK(ncclRegFind(comm, addr, bytes, &regRecord));
-    reg = regRecord && regRecord->nDevs ? 1 : 0;
+    reg = regRecord && regRecord->nDevs ? (regRecord->netPtrType == NCCL_PTR_HOST ? 2 : 1) : 0;
   }
 
   struct ncclProxyOp proxyOp = {};
   // May tune chunksize and set proxyOp.reg=0 if not using the network.
-  NCCLCHECK(ncclProxyComputeP2p(&info, &proxyOp, reg));
+  NCCLCHECK(ncclProxyComputeP2p(&info, &proxyOp, reg != 0));
+  proxyOp.regHost = proxyOp.reg && reg == 2;
+  proxyOp.profile = task->profile;
+
+  // Both sides of a chunk agree on this, see p2pIpcExchange
+  bool ipcReg = task->ipcReg == 1 && info.protocol == NCCL_PROTO_SIMPLE && bytes != 0 && (conn->flags & NCCL_P2P_IPC_REG);
 
   struct ncclWorkElemP2p elem = {0};
   elem.proto = info.protocol;
   elem.peer = peer;
   elem.nWarps = NCCL_MAX_NTHREADS/WARP_SIZE;
   elem.reg = proxyOp.reg;
+  elem.ipcReg = ipcReg;
   elem.p2pType = isSendNotRecv ? ncclWorkP2pTypeSend : ncclWorkP2pTypeRecv;
   elem.buffLo32 = uint32_t(reinterpret_cast<uintptr_t>(addr));
   elem.buffHi32 = reinterpret_cast<uintptr_t>(addr)>>32;
@@ -551,9 +897,33 @@ static ncclResult_t addP2pToPlan(
   elem.countHi32 = bytes>>32;
   elem.chunkSize = info.chunkSize; // computed by ncclProxyComputeP2p
 
-  *nWorkBudget += plan->channels[channelId].nWork;
-  appendWorkElemP2p(comm, plan, channelId, &elem, fuseOk);
-  *nWorkBudget -= plan->channels[channelId].nWork;
+  // Buffers and proxy steps are planned for `bytes`, the kernel reads how
+  // much of it to actually move.
+  struct ncclWorkElemP2p ext = {0};
+  bool hasExt = task->devCount != nullptr && bytes != 0;
+  if (hasExt) {
+    size_t offset = (char*)addr - (char*)task->buff;
+    elem.devCount = 1;
+    ext.peer = -1;
+    ext.p2pType = ncclWorkP2pTypeUnused;
+    ext.devCountExt.countPtrLo32 = uint32_t(reinterpret_cast<uintptr_t>(task->devCount));
+    ext.devCountExt.countPtrHi32 = reinterpret_cast<uintptr_t>(task->devCount)>>32;
+    ext.devCountExt.offsetLo32 = uint32_t(offset);
+    ext.devCountExt.offsetHi32 = offset>>32;
+    ext.devCountExt.eltSize = task->eltSize;
+  } else if (ipcReg && isSendNotRecv) {
+    void* remote = task->ipcRemote ? (char*)task->ipcRemote + ((char*)addr - (char*)task->buff) : nullptr;
+    hasExt = true;
+    ext.peer = -1;
+    ext.p2pType = ncclWorkP2pTypeUnused;
+    ext.ipcExt.buffLo32 = uint32_t(reinterpret_cast<uintptr_t>(remote));
+    ext.ipcExt.buffHi32 = reinterpret_cast<uintptr_t>(remote)>>32;
+  }
+
+  plan->hasP2p = true;
+  appendWorkElemP2p(comm, plan, channelId, &elem, hasExt ? &ext : nullptr, fuseOk);
+  markWorkProfiled(plan, channelId, task->profile);
+  workBudgetCharge(comm, plan, channelId, nWorkBudget);
 
   // Calculate the opCount after appendWorkElemP2p since it will always return
   // with channel->nWork equal to one plus the work index this p2p settled in.
@@ -594,6 +964,8 @@ static ncclResult_t registerIntraNodeBuffers(
   ncclResult_t result = ncclSuccess;
 
   info->regBufType = NCCL_REGULAR_BUFFER;
+  // Peers would read the narrow user buffers as float
+  if (info->castInput || info->castOutput) return ncclSuccess;
 #if CUDART_VERSION >= 11030
   if ((info->algorithm == NCCL_ALGO_NVLS || info->algorithm == NCCL_ALGO_NVLS_TREE) && comm->nvlsRegSupport) {
     bool regBufUsed = false;
@@ -610,6 +982,11 @@ static ncclResult_t registerIntraNodeBuffers(
       ncclNvlsLocalRegisterBuffer(comm, sendbuff, recvbuff, info->sendbuffSize, info->recvbuffSize, &regBufUsed, info->regBufSend, info->regBufRecv);
     }
 
+    /* then the multicast bindings kept from previous calls, for eager calls as well */
+    if (regBufUsed == false && (!plan->persistent || ncclParamGraphRegister())) {
+      NCCLCHECK(ncclNvlsCachedRegisterBuffer(comm, plan, sendbuff, recvbuff, info->sendbuffSize, info->recvbuffSize, &regBufUsed, info->regBufSend, info->regBufRecv));
+    }
+
     if (regBufUsed == false && plan->persistent && ncclParamGraphRegister()) {
       ncclNvlsGraphRegisterBuffer(comm, plan, sendbuff, recvbuff, info->sendbuffSize, info->recvbuffSize, &regBufUsed, info->regBufSend, info->regBufRecv);
     }
@@ -716,6 +1093,43 @@ fallback:
   return result;
 }
 
+NCCL_PARAM(NetRegister, "NET_REGISTER", 1);
+
+// Ring AllGather steps only carry data which ends up in the output buffer, so
+// when it is registered the network can send and receive from it directly.
+static ncclResult_t registerNetBuffers(struct ncclComm* comm, struct ncclInfo* info) {
+  info->netReg = false;
+  if (info->castInput || info->castOutput) return ncclSuccess;
+  if (info->coll != ncclFuncAllGather || info->algorithm != NCCL_ALGO_RING || info->protocol != NCCL_PROTO_SIMPLE) return ncclSuccess;
+  if (comm->nNodes == 1 || info->nBytes == 0 || ncclParamNetRegister() == 0) return ncclSuccess;
+  struct ncclReg* reg;
+  NCCLCHECK(ncclRegFind(comm, info->recvbuff, info->recvbuffSize, &reg));
+  info->netReg = reg && reg->nDevs > 0;
+  return ncclSuccess;
+}
+
+// Both ends of a ring connection pick the registered buffer on their own, so
+// each network connector of the channel needs to support it.
+static bool ringNetRegUsable(struct ncclComm* comm, int channelId) {
+  struct ncclChannel* channel = comm->channels+channelId;
+  struct ncclConnector* send = &channel->peers[channel->ring.next]->send[0];
+  struct ncclConnector* recv = &channel->peers[channel->ring.prev]->recv[0];
+  bool sendNet = send->transportComm == &netTransport.send;
+  bool recvNet = recv->transportComm == &netTransport.recv;
+  if (sendNet && (send->conn.flags & NCCL_NET_REG) == 0) return false;
+  if (recvNet && (recv->conn.flags & NCCL_NET_REG) == 0) return false;
+  return sendNet || recvNet;
+}
+
+// Consecutive tasks are tuned together. Fused ones have restrictions of their
+// own so they are kept apart.
+static bool collAggregatable(struct ncclInfo* aggInfo, struct ncclInfo* info) {
+  return info->coll == aggInfo->coll && info->opFull.op == aggInfo->opFull.op && info->datatype == aggInfo->datatype &&
+         (info->nFusedSegments != 0) == (aggInfo->nFusedSegments != 0) &&
+         info->castInput == aggInfo->castInput && info->castOutput == aggInfo->castOutput &&
+         info->castType == aggInfo->castType;
+}
+
 static ncclResult_t getCBDCollnChannel(struct ncclKernelPlan* plan, struct ncclInfo* collInfo, int usableChannels) {
   size_t firstEnqBytes;
   size_t workBytesTotal = collInfo->workBytes;
@@ -762,7 +1176,7 @@ static ncclResult_t scheduleCollTasksToPlan(
 
         memcpy(aggInfo, collInfo, sizeof(struct ncclInfo));
         while (nextInfo) {
-          if (nextInfo->coll == aggInfo->coll && nextInfo->opFull.op == aggInfo->opFull.op && nextInfo->datatype == aggInfo->datatype) {
+          if (collAggregatable(aggInfo, nextInfo)) {
             aggInfo->count += nextInfo->count;
             nextInfo = nextInfo->next;
           } else {
@@ -772,19 +1186,36 @@ static ncclResult_t scheduleCollTasksToPlan(
 
         nvlsSupport = comm->nvlsSupport && ncclNvlsSupported(aggInfo->opFull.op, aggInfo->datatype);
         NCCLCHECK(getCollNetSupport(aggInfo, &collNetSupport));
+        // Fused collectives need each channel to work on its own range
+        if (aggInfo->nFusedSegments) nvlsSupport = collNetSupport = 0;
         NCCLCHECK(ncclInfoSetDerived(aggInfo, comm->nRanks));
         NCCLCHECK(getTunerInfo(aggInfo, collNetSupport, nvlsSupport, 1));
+        NCCLCHECK(getAutotuneInfo(aggInfo, collNetSupport, nvlsSupport, 1));
         NCCLCHECK(topoGetAlgoInfo(aggInfo, collNetSupport, nvlsSupport, 1));
+        if (!comm->collConnected[aggInfo->algorithm]) {
+          WARN("%s selected algorithm %s which is not connected", ncclFuncStr[aggInfo->coll], ncclAlgoStr[aggInfo->algorithm]);
+          return ncclInternalError;
+        }
         NCCLCHECK(getChannnelThreadInfo(aggInfo));
+        ncclContentionCollTuned(comm);
+        statsAddCollBytes(comm, aggInfo);
         NCCLCHECK(computeCollWorkFunc(aggInfo));
         NCCLCHECK(getPatternInfo(aggInfo));
 
         // Try to assign algo and proto to all possible collectives
         nextInfo = collInfo;
         while (nextInfo) {
-          if (nextInfo->coll == aggInfo->coll && nextInfo->opFull.op == aggInfo->opFull.op && nextInfo->datatype == aggInfo->datatype) {
+          if (collAggregatable(aggInfo, nextInfo)) {
             NCCLCHECK(ncclInfoSetDerived(nextInfo, comm->nRanks));
             NCCLCHECK(getTunerInfo(nextInfo, collNetSupport, nvlsSupport, 1));
+            if (aggInfo->autotuned) {
+              nextInfo->autotuned = true;
+              nextInfo->autotuneCand = aggInfo->autotuneCand;
+              if (aggInfo->userTuned) {
+                nextInfo->nChannels = aggInfo->nChannels;
+                nextInfo->userTuned = true;
+              }
+            }
             nextInfo->algorithm = aggInfo->algorithm;
             nextInfo->protocol = aggInfo->protocol;
             nextInfo->nThreads = aggInfo->nThreads;
@@ -795,6 +1226,7 @@ static ncclResult_t scheduleCollTasksToPlan(
             NCCLCHECK(getChannnelThreadInfo(nextInfo));
             // if possible, start registration
             registerIntraNodeBuffers(comm, plan, nextInfo);
+            NCCLCHECK(registerNetBuffers(comm, nextInfo));
             // accumulate channels
             accChannels += nextInfo->nChannels;
             nextInfo = nextInfo->next;
@@ -826,6 +1258,8 @@ static ncclResult_t scheduleCollTasksToPlan(
     }
 
     tasks->usableChannels = std::min(usableChannels, accChannels);
+    if (tasks->maxCTAs != 0) tasks->usableChannels = std::min(tasks->usableChannels, tasks->maxCTAs);
+    if (tasks->channelCount != 0) tasks->usableChannels = std::min(tasks->usableChannels, tasks->channelCount);
   }
 
   /* Calculate maxBytesPerChannel for CBD colls and it should be 16 bytes aligned
@@ -837,8 +1271,7 @@ static ncclResult_t scheduleCollTasksToPlan(
     // Get nChannels and peek whether the budget allows before we enqueue
     collInfo = ncclIntruQueueHead(&tasks->collCBDQueue);
     collInfo->nChannels = DIVUP(collInfo->workBytes * tasks->usableChannels, totalCBDBytes);
-    // Haven't got nChannels info yet, relax the budget boundary a bit.
-    if (*nWorkBudget < collInfo->nChannels) return ncclSuccess;
+    if (*nWorkBudget < 1) return ncclSuccess;
 
     collInfo = ncclIntruQueueDequeue(&tasks->collCBDQueue);
     NCCLCHECK(addCBDCollToPlan(comm, plan, tasks->usableChannels, collInfo, nWorkBudget));
@@ -849,7 +1282,7 @@ static ncclResult_t scheduleCollTasksToPlan(
   // Then enqueue collnet colls
   while (!ncclIntruQueueEmpty(&tasks->collnetQueue)) {
     collInfo = ncclIntruQueueHead(&tasks->collnetQueue);
-    if (*nWorkBudget < collInfo->nChannels) return ncclSuccess;
+    if (*nWorkBudget < 1) return ncclSuccess;
 
     collInfo = ncclIntruQueueDequeue(&tasks->collnetQueue);
     NCCLCHECK(addCollnetCollToPlan(comm, plan, tasks->usableChannels, collInfo, nWorkBudget));
@@ -859,7 +1292,7 @@ static ncclResult_t scheduleCollTasksToPlan(
   // Finally enqueue user-tuned colls
   while (!ncclIntruQueueEmpty(&tasks->collTunedQueue)) {
     collInfo = ncclIntruQueueHead(&tasks->collTunedQueue);
-    if (*nWorkBudget < collInfo->nChannels) return ncclSuccess;
+    if (*nWorkBudget < 1) return ncclSuccess;
 
     collInfo = ncclIntruQueueDequeue(&tasks->collTunedQueue);
     NCCLCHECK(addTunedCollToPlan(comm, plan, tasks->usableChannels, collInfo, nWorkBudget));
@@ -879,6 +1312,70 @@ static size_t calcP2pChunkSize(size_t totalSize, int minChannels, int maxChannel
   return alignUp(size, minSize);
 }
 
+// Chunk size bounds of the p2p ops with peer. Both sides of a connection
+// must split the same way, so they only depend on what both ranks see.
+static void p2pChunkBounds(struct ncclComm* comm, int peer, ssize_t stepSize, ssize_t* minSize, ssize_t* maxSize) {
+  *minSize = comm->nNodes > 1 ? stepSize/2 : stepSize/8;
+  *maxSize = comm->nNodes > 1 ? stepSize : stepSize*32;
+  if (comm->p2pLocalChunkMin && peer != -1 && comm->rankToNode[peer] == comm->node) {
+    int chunkMin = comm->p2pLocalChunkMin[comm->rankToLocalRank[peer]];
+    if (chunkMin) {
+      *minSize = chunkMin;
+      *maxSize = stepSize*32;
+    }
+  }
+}
+
+int64_t ncclParamP2pIpcRegister();
+// Smallest send/recv worth a bootstrap round trip to offer the receive buffer
+NCCL_PARAM(P2pIpcRegisterMinBytes, "P2P_IPC_REGISTER_MIN_BYTES", 1<<20);
+#define P2P_IPC_BOOTSTRAP_TAG (-1024)
+
+// Whether both sides of a task exchange the receive buffer. Only depends on
+// what the peer sees the same way.
+static ncclResult_t p2pIpcEligible(struct ncclComm* comm, bool isSendNotRecv, int peer, struct ncclTaskP2p* task, int* eligible) {
+  *eligible = 0;
+  if (peer == comm->rank || task->bytes < (size_t)ncclParamP2pIpcRegisterMinBytes()) return ncclSuccess;
+  int channelId;
+  NCCLCHECK(ncclChannelCompute(comm, peer, 0, isSendNotRecv ? ncclFuncSend : ncclFuncRecv, &channelId));
+  struct ncclConnInfo* conn = isSendNotRecv ?
+    &comm->channels[channelId].peers[peer]->send[1].conn : &comm->channels[channelId].peers[peer]->recv[1].conn;
+  *eligible = (conn->flags & NCCL_P2P_IPC_REG) ? 1 : 0;
+  return ncclSuccess;
+}
+
+// Receivers offer their registered buffers to senders in other processes,
+// which map them so the kernel can write into them directly. All offers are
+// sent before waiting for any, so ranks never wait on each other in a cycle.
+static ncclResult_t p2pIpcExchange(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  struct ncclP2pIpcMsg msg;
+  for (int a=0; a < tasks->nP2pActiveSteps; a++) {
+    int peer = tasks->p2pRecvOrder[tasks->p2pActiveSteps[a]];
+    if (peer == -1) continue;
+    for (struct ncclTaskP2p* recv = ncclIntruQueueHead(&tasks->peers[peer].recvQueue); recv; recv = recv->next) {
+      if (recv->ipcReg != -1) continue;
+      NCCLCHECK(p2pIpcEligible(comm, false, peer, recv, &recv->ipcReg));
+      if (recv->ipcReg == 0) continue;
+      NCCLCHECK(ncclP2pIpcExportBuffer(comm, recv->buff, recv->bytes, &msg));
+      NCCLCHECK(bootstrapSend(comm->bootstrap, peer, P2P_IPC_BOOTSTRAP_TAG, &msg, sizeof(msg)));
+    }
+  }
+  for (int a=0; a < tasks->nP2pActiveSteps; a++) {
+    int peer = tasks->p2pSendOrder[tasks->p2pActiveSteps[a]];
+    if (peer == -1) continue;
+    for (struct ncclTaskP2p* send = ncclIntruQueueHead(&tasks->peers[peer].sendQueue); send; send = send->next) {
+      if (send->ipcReg != -1) continue;
+      NCCLCHECK(p2pIpcEligible(comm, true, peer, send, &send->ipcReg));
+      if (send->ipcReg == 0) continue;
+      NCCLCHECK(bootstrapRecv(comm->bootstrap, peer, P2P_IPC_BOOTSTRAP_TAG, &msg, sizeof(msg)));
+      // The device count extension takes the slot of the mapped buffer
+      if (send->devCount == nullptr) NCCLCHECK(ncclP2pIpcImportBuffer(comm, peer, &msg, &send->ipcRemote));
+    }
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t scheduleP2pTasksToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget
   ) {
@@ -888,6 +1385,7 @@ static ncclResult_t scheduleP2pTasksToPlan(
   int const *sendOrder = tasks->p2pSendOrder;
   int const *recvOrder = tasks->p2pRecvOrder;
 
+  tunerTimingDetach(comm, plan); // p2p work would be counted against the collective
   plan->threadPerBlock = std::max(plan->threadPerBlock, NCCL_MAX_NTHREADS);
   if (!plan->kernelSpecialized) {
     plan->kernelFn = ncclDevKernelForFunc[ncclDevFuncId_P2p()];
@@ -903,10 +1401,17 @@ static ncclResult_t scheduleP2pTasksToPlan(
   // Try to use all channels, but one channel per operation.
   while (nChannelsMin*nRanks > comm->p2pnChannels && nChannelsMin > 1) nChannelsMin /= 2;
 
+  // Only visit the steps with queued work, in order
+  int* activeSteps = tasks->p2pActiveSteps;
+  std::sort(activeSteps, activeSteps + tasks->nP2pActiveSteps);
+
+  if (ncclParamP2pIpcRegister()) NCCLCHECK(p2pIpcExchange(comm));
+
   bool fuseOk = false;
   // We can perform 8 send/recv per round per CTA. Make sure we jump between fused blocks at node boundaries.
   while (tasks->nTasksP2p != 0) {
-    for (int i=0; i < tasks->p2pOrderSteps; i++) {
+    for (int a=0; a < tasks->nP2pActiveSteps; a++) {
+      int i = activeSteps[a];
       int sendPeer = sendOrder[i];
       int recvPeer = recvOrder[i];
       struct ncclTaskP2p* send = sendPeer != -1 ? ncclIntruQueueHead(&peers[sendPeer].sendQueue) : NULL;
@@ -924,16 +1429,23 @@ static ncclResult_t scheduleP2pTasksToPlan(
           WARN("Trying to recv to self without a matching send");
           return ncclInvalidUsage;
         }
+        // The self copy pairs each send element with the recv element next to
+        // it, so both need the same number of slots.
+        if (send && (send->devCount == nullptr) != (recv->devCount == nullptr)) {
+          WARN("Send to self and recv from self must both use a device count or neither");
+          return ncclInvalidUsage;
+        }
       }
       if (send != nullptr || recv != nullptr) {
         char* recvPtr = recv ? (char*)recv->buff : nullptr;
         char* sendPtr = send ? (char*)send->buff : nullptr;
         ssize_t recvBytes = recv ? recv->bytes : 0;
         ssize_t sendBytes = send ? send->bytes : 0;
-        ssize_t minSize = comm->nNodes > 1 ? stepSize/2 : stepSize/8;
-        ssize_t maxSize = comm->nNodes > 1 ? stepSize : stepSize*32;
-        ssize_t recvChunkBytesMax = calcP2pChunkSize(recvBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
-        ssize_t sendChunkBytesMax = calcP2pChunkSize(sendBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
+        ssize_t recvMinSize, recvMaxSize, sendMinSize, sendMaxSize;
+        p2pChunkBounds(comm, recvPeer, stepSize, &recvMinSize, &recvMaxSize);
+        p2pChunkBounds(comm, sendPeer, stepSize, &sendMinSize, &sendMaxSize);
+        ssize_t recvChunkBytesMax = calcP2pChunkSize(recvBytes, nChannelsMin, nChannelsMax, recvMinSize, recvMaxSize);
+        ssize_t sendChunkBytesMax = calcP2pChunkSize(sendBytes, nChannelsMin, nChannelsMax, sendMinSize, sendMaxSize);
         // Zero size send/recv are syncs, encode here with -1.
         recvBytes = recv && recvBytes == 0 ? -1 : recvBytes;
         sendBytes = send && sendBytes == 0 ? -1 : sendBytes;
@@ -942,15 +1454,20 @@ static ncclResult_t scheduleP2pTasksToPlan(
         if (recv) recvBytes -= recv->chunk*recvChunkBytesMax;
         if (send) sendPtr   += send->chunk*sendChunkBytesMax;
         if (send) sendBytes -= send->chunk*sendChunkBytesMax;
+        // All peers of an AllToAll are in flight together, so its elements
+        // keep filling the tail work of their channel across step groups and
+        // only cut when the work is full. Fusing never orders two elements
+        // that were not already ordered, so this can't deadlock.
+        bool batched = (send == nullptr || send->batched) && (recv == nullptr || recv->batched);
 
         do {
-          if ((i % (NCCL_MAX_WORK_ELEMENTS_P2P/2)) == 0) fuseOk = false;
+          if ((i % (NCCL_MAX_WORK_ELEMENTS_P2P/2)) == 0 && !batched) fuseOk = false;
           ssize_t recvChunkBytes = std::min(recvBytes, recvChunkBytesMax); // -1 preserved
           ssize_t sendChunkBytes = std::min(sendBytes, sendChunkBytesMax);
           if (recvChunkBytes != 0) {
             if (recvChunkBytes == -1) recvChunkBytes = 0;
             if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
-            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/false, recvPeer, recv->chunk, recvPtr, recvChunkBytes, fuseOk));
+            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/false, recvPeer, recv->chunk, recvPtr, recvChunkBytes, recv->reg, fuseOk, recv));
             fuseOk = true;
             recvPtr += recvChunkBytes;
             recvBytes -= recvChunkBytes;
@@ -964,7 +1481,7 @@ static ncclResult_t scheduleP2pTasksToPlan(
           if (sendChunkBytes != 0) {
             if (sendChunkBytes == -1) sendChunkBytes = 0;
             if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
-            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/true, sendPeer, send->chunk, sendPtr, sendChunkBytes, fuseOk));
+            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/true, sendPeer, send->chunk, sendPtr, sendChunkBytes, send->reg, fuseOk, send));
             fuseOk = true;
             sendPtr += sendChunkBytes;
             sendBytes -= sendChunkBytes;
@@ -978,6 +1495,16 @@ static ncclResult_t scheduleP2pTasksToPlan(
         } while (sendBytes != 0 || recvBytes != 0);
       }
     }
+    // Drop the steps that ran out of work, keeping the others in order
+    int nActive = 0;
+    for (int a=0; a < tasks->nP2pActiveSteps; a++) {
+      int i = activeSteps[a];
+      bool pending = (sendOrder[i] != -1 && !ncclIntruQueueEmpty(&peers[sendOrder[i]].sendQueue)) ||
+                     (recvOrder[i] != -1 && !ncclIntruQueueEmpty(&peers[recvOrder[i]].recvQueue));
+      if (pending) activeSteps[nActive++] = i;
+      else tasks->p2pStepActive[i] = false;
+    }
+    tasks->nP2pActiveSteps = nActive;
   }
   return ncclSuccess;
 }
@@ -987,49 +1514,116 @@ static inline bool rollingLess32(uint32_t a, uint32_t b) {
   constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
   return a-b > PositiveMax;
 }
-static inline uint32_t rollingMin32(uint32_t a, uint32_t b) {
-  constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
-  return (b-a <= PositiveMax) ? a : b;
-}
-
-// Spin until its safe to increase comm->workFifoSent to desiredSent.
-static void waitWorkFifoAvailable(struct ncclComm* comm, uint32_t desiredSent) {
-  if (__builtin_expect(rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent), false)) {
-    while (1) {
-      // We have to poll for notifications from device.
-      uint32_t* doneLive = comm->workFifoDone;
-      uint32_t ackd[MAXCHANNELS];
-      for (int c=0; c < MAXCHANNELS; c++) {
-        ackd[c] = __atomic_load_n(&doneLive[c], __ATOMIC_RELAXED);
-      }
-      // Compiler-only fence to prevent fusion of loops to encourage dense loads.
-      __atomic_signal_fence(__ATOMIC_SEQ_CST);
-
-      uint32_t ackdAll = comm->workFifoSent;
-      for (int c=0; c < MAXCHANNELS; c++) {
-        // ackdAll is min over all non-quiesced channels
-        if (ackd[c] != comm->channels[c].workFifoSent)
-          ackdAll = rollingMin32(ackdAll, ackd[c]);
-      }
 
-      // Compiler only fence to prevent fusion of loops to encourage dense stores.
-      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+// Spin until its safe to increase the workFifoSent of channel c to desiredSent.
+static void waitWorkFifoAvailable(struct ncclComm* comm, int c, uint32_t desiredSent) {
+  struct ncclChannel* channel = &comm->channels[c];
+  uint32_t depth = comm->workFifoChannelDepth;
+  if (__builtin_expect(!rollingLess32(channel->workFifoAckd + depth, desiredSent), true)) return;
+  uint64_t t0 = clockNano();
+  while (rollingLess32(channel->workFifoAckd + depth, desiredSent)) {
+    // We have to poll for notifications from device. Only this channel's
+    // progress matters, the others have their own rings.
+    channel->workFifoAckd = __atomic_load_n(&comm->workFifoDone[c], __ATOMIC_RELAXED);
+    if (!rollingLess32(channel->workFifoAckd + depth, desiredSent)) break;
+    sched_yield();
+  }
+  ncclStatsAdd(&comm->stats.workFifoStalls, 1);
+  ncclStatsAdd(&comm->stats.workFifoStallNs, clockNano()-t0);
+}
 
-      for (int c=0; c < MAXCHANNELS; c++) {
-        // Advance counter on quiesced channels so they don't lag behind
-        // too far where they could get lost in 32-bit wraparound.
-        if (ackd[c] == comm->channels[c].workFifoSent) {
-          comm->channels[c].workFifoSent = ackdAll;
-          __atomic_store_n(&doneLive[c], ackdAll, __ATOMIC_RELAXED);
-        }
-      }
-      comm->workFifoAckdMin = ackdAll;
+// Graph captured plans can be replayed at any time, so their works get a
+// device buffer of their own. Buffers are recycled through comm->workPool, up
+// to NCCL_WORK_POOL_SIZE of every size, so that capturing again does not need
+// a cudaMalloc.
+NCCL_PARAM(WorkPoolSize, "WORK_POOL_SIZE", 16);
+
+static ncclResult_t workPoolAlloc(struct ncclComm* comm, int nWork, struct ncclWorkBuff** buff) {
+  int sizeLog2 = 6;
+  while ((1<<sizeLog2) < nWork) sizeLog2++;
+  struct ncclWorkBuff* b = comm->workPool[sizeLog2];
+  if (b != nullptr) {
+    comm->workPool[sizeLog2] = b->next;
+    comm->workPoolCount[sizeLog2] -= 1;
+  } else {
+    NCCLCHECK(ncclCalloc(&b, 1));
+    b->sizeLog2 = sizeLog2;
+    ncclMemScope memScope(&comm->memStats, ncclMemWorkFifo);
+    ncclResult_t ret = ncclCudaMalloc(&b->ptr, size_t(1)<<sizeLog2);
+    if (ret != ncclSuccess) {
+      free(b);
+      return ret;
+    }
+  }
+  b->next = nullptr;
+  b->refs = 1;
+  *buff = b;
+  return ncclSuccess;
+}
+
+static ncclResult_t workPoolRelease(struct ncclComm* comm, struct ncclWorkBuff* b) {
+  if (--b->refs > 0) return ncclSuccess;
+  if (comm->workPoolCount[b->sizeLog2] < ncclParamWorkPoolSize()) {
+    b->next = comm->workPool[b->sizeLog2];
+    comm->workPool[b->sizeLog2] = b;
+    comm->workPoolCount[b->sizeLog2] += 1;
+    return ncclSuccess;
+  }
+  NCCLCHECK(ncclCudaFree(b->ptr));
+  free(b);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclWorkPoolFree(struct ncclComm* comm) {
+  for (int i=0; i < NCCL_WORK_POOL_CLASSES; i++) {
+    while (comm->workPool[i] != nullptr) {
+      struct ncclWorkBuff* b = comm->workPool[i];
+      comm->workPool[i] = b->next;
+      NCCLCHECK(ncclCudaFree(b->ptr));
+      free(b);
+    }
+    comm->workPoolCount[i] = 0;
+  }
+  return ncclSuccess;
+}
+
+// Small plans pass their works as kernel arguments, see ncclDevKernelArgsWork.
+NCCL_PARAM(WorkArgs, "WORK_ARGS", 1);
+
+static bool planWorkInArgs(struct ncclComm* comm, struct ncclKernelPlan* plan, int nWork) {
+#if CUDART_VERSION >= 11070
+  return ncclParamWorkArgs() && comm->cudaArch >= 700 && nWork <= NCCL_WORK_ARGS_NWORK &&
+         !residentKernelWanted(comm, plan);
+#else
+  return false;
+#endif
+}
 
-      // See if that was enough.
-      if (!rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent)) break;
-      sched_yield();
+// Lay the channels of a graph captured plan out one after the other in a
+// device buffer of its own, and point plan->workFirst at them.
+static ncclResult_t persistentWorkUpload(struct ncclComm* comm, struct ncclKernelPlan* plan, int nWork, struct ncclWorkBuff** buff) {
+  struct ncclWork* workHeap = ncclMemoryStackAlloc<struct ncclWork>(&comm->memScoped, nWork);
+  uint32_t ix = 0;
+  for (int c=0; c < plan->channelUbound; c++) {
+    struct ncclWorkList* q = ncclIntruQueueHead(&plan->channels[c].workQueue);
+    plan->workFirst.ix[c] = ix;
+    while (q != nullptr) {
+      if (q->next != nullptr) {
+        q->work.header.workNext = ix+1;
+      } else {
+        q->work.header.inFifo = 0;
+      }
+      workHeap[ix++] = q->work; // C++ struct assignment
+      q = q->next;
     }
   }
+  NCCLCHECK(workPoolAlloc(comm, nWork, buff));
+  ncclResult_t ret = ncclCudaMemcpy((*buff)->ptr, workHeap, nWork);
+  if (ret != ncclSuccess) {
+    workPoolRelease(comm, *buff);
+    *buff = nullptr;
+  }
+  return ret;
 }
 
 static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* plan) {
@@ -1037,63 +1631,72 @@ static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* pla
   int channelUbound = plan->channelUbound;
   int nWork = 0;
   for (int c=0; c < channelUbound; c++) nWork += plan->channels[c].nWork;
-
-  struct ncclWork* workHeap;
-  if (!persistent) {
-    workHeap = comm->workFifoHeap;
-  } else {
-    workHeap = ncclMemoryStackAlloc<struct ncclWork>(&comm->memScoped, nWork);
+  plan->workFirst.arrival = ncclStragglerPlanArrival(comm, plan);
+
+  // Arguments are copied at launch, or at capture for graphs, so persistent
+  // plans can take this path too.
+  if (planWorkInArgs(comm, plan, nWork)) {
+    struct ncclDevKernelArgsWork* args = ncclMemoryStackAlloc<struct ncclDevKernelArgsWork>(&comm->memScoped);
+    args->comm = comm->devComm;
+    args->channelMask = plan->channelMask;
+    args->workFirst.arrival = plan->workFirst.arrival;
+    uint32_t ix = 0;
+    for (int c=0; c < channelUbound; c++) {
+      struct ncclWorkList* q = ncclIntruQueueHead(&plan->channels[c].workQueue);
+      args->workFirst.ix[c] = ix;
+      while (q != nullptr) {
+        if (q->next != nullptr) {
+          q->work.header.workNext = ix+1;
+        } else {
+          q->work.header.inFifo = 0;
+        }
+        args->works[ix++] = q->work; // C++ struct assignment
+        q = q->next;
+      }
+    }
+    plan->argsWork = args;
+    plan->workHead = nullptr;
+    return ncclSuccess;
   }
-  uint32_t ixMask = persistent ? ~uint32_t(0) : comm->workFifoDepth-1;
-  uint32_t ixSent;
+
   if (persistent) {
-    ixSent = 0;
-  } else {
-    ixSent = comm->workFifoSent;
-    // First work for a channel has to be at workHeap+blockIdx.x which means
-    // we cannot tolerate fifo wraparound. So round up to the wrap boundary
-    // if not doing so would incur crossing it.
-    if (((ixSent + plan->channelCount-1) & ixMask) < (ixSent & ixMask)) {
-      ixSent = (ixSent + ixMask) & ~ixMask;
-      // Need to update workFifoSent so waitWorkFifoAvailable() knows we've
-      // skipped those elements. Consider if all the channels report quiesced,
-      // this way the skipped slots will be considered consumed as well.
-      comm->workFifoSent = ixSent;
-    }
-    waitWorkFifoAvailable(comm, ixSent + nWork);
-  }
-  uint32_t ixHead = ixSent;
-  ixSent += plan->channelCount;
-  int channelsWithWork = 0; // number of channels below `c` with work structs.
+    // Plans restored from the plan cache share the works uploaded by the
+    // capture which recorded them.
+    if (plan->workBuff == nullptr) NCCLCHECK(persistentWorkUpload(comm, plan, nWork, &plan->workBuff));
+    plan->workHead = plan->workBuff->ptr;
+    return ncclSuccess;
+  }
+
+  struct ncclWork* workHeap = comm->workFifoHeap;
+  uint32_t ixMask = comm->workFifoChannelDepth-1;
   for (int c=0; c < channelUbound; c++) {
     struct ncclWorkList* q = ncclIntruQueueHead(&plan->channels[c].workQueue);
-    // Offset of first work equals number of channels below with work.
-    uint32_t ix = ixHead + channelsWithWork;
-    channelsWithWork += q != nullptr ? 1 : 0;
+    if (q == nullptr) continue;
+    struct ncclChannel* channel = &comm->channels[c];
+    uint32_t base = c*comm->workFifoChannelDepth;
+    uint32_t ixSent = channel->workFifoSent;
+    waitWorkFifoAvailable(comm, c, ixSent + plan->channels[c].nWork);
+    plan->workFirst.ix[c] = base + (ixSent & ixMask);
     while (q != nullptr) {
+      uint32_t ix = base + (ixSent & ixMask);
+      ixSent += 1;
       if (q->next != nullptr) {
-        q->work.header.workNext = int32_t(ixSent & ixMask) - int32_t(ixHead & ixMask);
+        q->work.header.workNext = base + (ixSent & ixMask);
+        q->work.header.nextSize = (workFetchBytes(&q->next->work)/16) % (NCCL_WORK_SIZE/16);
       } else {
-        q->work.header.inFifo = !persistent ? 1 : 0;
-        // Tell channel to ack us back ix+1 indicating that all slots up to and
-        // including ix have been consumed.
-        q->work.header.doneAcks = ix+1;
-        comm->channels[c].workFifoSent = ix+1;
+        q->work.header.inFifo = 1;
+        // Tell channel to ack us back ixSent indicating that all slots of its
+        // ring up to and including ix have been consumed.
+        q->work.header.doneAcks = ixSent;
       }
-      workHeap[ix & ixMask] = q->work; // C++ struct assignment
+      // Only what the kernel will fetch crosses PCIe
+      memcpy(&workHeap[ix], &q->work, workFetchBytes(&q->work));
       q = q->next;
-      if (q != nullptr) ix = ixSent++;
     }
+    channel->workFifoSent = ixSent;
   }
-
-  if (!persistent) {
-    comm->workFifoSent = ixSent;
-    if (comm->workFifoHeapGdrHandle != nullptr) wc_store_fence();
-    plan->workHead = &comm->devWorkFifoHeap[ixHead & ixMask];
-  } else {
-    NCCLCHECK(ncclCudaMalloc(&plan->workHead, nWork));
-    NCCLCHECK(ncclCudaMemcpy(plan->workHead, workHeap, nWork));
-  }
+  if (comm->workFifoHeapGdrHandle != nullptr || comm->workFifoHeapDevice) wc_store_fence();
+  plan->workHead = comm->devWorkFifoHeap;
   return ncclSuccess;
 }
 
@@ -1142,6 +1745,8 @@ static ncclResult_t uploadProxyOps(struct ncclComm* comm, struct ncclKernelPlan*
       q->opCount = (collOpCount<<1) + oldId;
     }
 
+    q->priority = plan->proxyPriority;
+    q->opTag = plan->opTag;
     NCCLCHECK(ncclProxySaveOp(comm, q, nullptr));
     q->opCount = oldId; // Restore for next uploadProxyOps()
     if (!plan->persistent) {
@@ -1159,6 +1764,22 @@ static ncclResult_t uploadProxyOps(struct ncclComm* comm, struct ncclKernelPlan*
   return ncclSuccess;
 }
 
+NCCL_PARAM(ProxyStreamPriority, "PROXY_STREAM_PRIORITY", 0);
+
+// Proxy ops of high priority communicators, or launched on a stream of higher
+// than default CUDA priority when NCCL_PROXY_STREAM_PRIORITY=1, are progressed
+// ahead of the bulk traffic sharing the proxy thread.
+static ncclResult_t planProxyPriority(struct ncclComm* comm, cudaStream_t stream, uint8_t* priority) {
+  *priority = comm->config.priority;
+  if (*priority == 0 && ncclParamProxyStreamPriority()) {
+    int streamPriority;
+    CUDACHECK(cudaStreamGetPriority(stream, &streamPriority));
+    // Lower numbers are higher priorities, the default is 0.
+    if (streamPriority < 0) *priority = 1;
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t hostStreamPlanTask(struct ncclComm* comm, struct ncclKernelPlan* plan) {
   NCCLCHECK(uploadProxyOps(comm, plan));
   NCCLCHECK(ncclProxyStart(comm));
@@ -1178,11 +1799,116 @@ static void CUDART_CB hostStreamPlanCallback(void *plan_) {
   }
 }
 
+// Plans whose proxy ops must be posted in stream order (graph captured plans,
+// and all plans while some are alive) normally post them from a host function
+// node on the host stream, which costs tens of microseconds and puts a host
+// node in every graph replay. With NCCL_PROXY_DOORBELL the launch stream
+// instead writes a doorbell in host memory and waits for a comm thread polling
+// it to post the proxy ops of the plan and clear it.
+NCCL_PARAM(ProxyDoorbell, "PROXY_DOORBELL", 0);
+
+static void* doorbellThreadMain(void* comm_) {
+  struct ncclComm* comm = (struct ncclComm*)comm_;
+  while (!__atomic_load_n(&comm->doorbellStop, __ATOMIC_ACQUIRE) && !__atomic_load_n(comm->abortFlag, __ATOMIC_RELAXED)) {
+    bool idle = true;
+    for (int s=0; s < NCCL_DOORBELL_SLOTS; s++) {
+      if (__atomic_load_n(&comm->doorbells[s], __ATOMIC_ACQUIRE) == 0) continue;
+      struct ncclKernelPlan* plan = __atomic_load_n(&comm->doorbellPlans[s], __ATOMIC_ACQUIRE);
+      if (plan == nullptr) continue;
+      idle = false;
+      bool persistent = plan->persistent;
+      // Non-persistent plans are reclaimed by hostStreamPlanTask, release their slot first.
+      if (!persistent) __atomic_store_n(&comm->doorbellPlans[s], nullptr, __ATOMIC_RELEASE);
+      ncclResult_t result = hostStreamPlanTask(comm, plan);
+      if (result != ncclSuccess) {
+        WARN("Proxy doorbell of slot %d failed : %s", s, ncclGetErrorString(result));
+      }
+      __atomic_store_n(&comm->doorbells[s], 0, __ATOMIC_RELEASE);
+    }
+    if (idle) sched_yield();
+  }
+  return nullptr;
+}
+
+static ncclResult_t doorbellStart(struct ncclComm* comm) {
+  comm->doorbellState = -1;
+  if (CUPFN(cuStreamWriteValue32) == nullptr || CUPFN(cuStreamWaitValue32) == nullptr) {
+    INFO(NCCL_INIT, "NCCL_PROXY_DOORBELL set but stream memory operations are not available, using host functions");
+    return ncclSuccess;
+  }
+  { ncclMemScope memScope(&comm->memStats, ncclMemOther);
+    NCCLCHECK(ncclCudaHostCalloc(&comm->doorbells, NCCL_DOORBELL_SLOTS));
+  }
+  for (int s=0; s < NCCL_DOORBELL_SLOTS; s++) comm->doorbellPlans[s] = nullptr;
+  comm->doorbellStop = 0;
+  if (pthread_create(&comm->doorbellThread, nullptr, doorbellThreadMain, comm) != 0) {
+    WARN("Unable to create the proxy doorbell thread");
+    NCCLCHECK(ncclCudaHostFree(comm->doorbells));
+    comm->doorbells = nullptr;
+    return ncclSystemError;
+  }
+  ncclSetThreadName(comm->doorbellThread, "NCCL Doorbell%2d", comm->cudaDev);
+  comm->doorbellState = 1;
+  INFO(NCCL_INIT, "Proxy doorbell thread started");
+  return ncclSuccess;
+}
+
+ncclResult_t ncclProxyDoorbellStop(struct ncclComm* comm) {
+  if (comm->doorbellState != 1) return ncclSuccess;
+  __atomic_store_n(&comm->doorbellStop, 1, __ATOMIC_RELEASE);
+  pthread_join(comm->doorbellThread, nullptr);
+  // On abort the thread may have left streams waiting on some doorbells
+  for (int s=0; s < NCCL_DOORBELL_SLOTS; s++) __atomic_store_n(&comm->doorbells[s], 0, __ATOMIC_RELEASE);
+  NCCLCHECK(ncclCudaHostFree(comm->doorbells));
+  comm->doorbells = nullptr;
+  comm->doorbellState = 0;
+  return ncclSuccess;
+}
+
+// Give a doorbell to every plan with proxy ops, or to none of them so that
+// their ops are still posted in plan order.
+static ncclResult_t doorbellsAssign(struct ncclComm* comm, struct ncclKernelPlan* planHead, bool* assigned) {
+  *assigned = false;
+  if (!ncclParamProxyDoorbell() || comm->doorbellState < 0) return ncclSuccess;
+  if (comm->doorbellState == 0) NCCLCHECK(doorbellStart(comm));
+  if (comm->doorbellState != 1) return ncclSuccess;
+  int s = 0;
+  for (struct ncclKernelPlan* plan=planHead; plan != nullptr; plan = plan->next) {
+    if (!plan->hasProxyOps) continue;
+    while (s < NCCL_DOORBELL_SLOTS && __atomic_load_n(&comm->doorbellPlans[s], __ATOMIC_ACQUIRE) != nullptr) s++;
+    if (s == NCCL_DOORBELL_SLOTS) {
+      for (struct ncclKernelPlan* p=planHead; p != plan; p = p->next) {
+        if (p->doorbell >= 0) __atomic_store_n(&comm->doorbellPlans[p->doorbell], nullptr, __ATOMIC_RELEASE);
+        p->doorbell = -1;
+      }
+      return ncclSuccess;
+    }
+    plan->doorbell = s;
+    __atomic_store_n(&comm->doorbellPlans[s], plan, __ATOMIC_RELEASE);
+  }
+  *assigned = true;
+  return ncclSuccess;
+}
+
+// Ring and wait for the proxy ops to be posted before the kernels.
+static ncclResult_t doorbellsRing(struct ncclComm* comm, struct ncclKernelPlan* planHead, cudaStream_t stream) {
+  for (struct ncclKernelPlan* plan=planHead; plan != nullptr; plan = plan->next) {
+    if (plan->doorbell < 0) continue;
+    CUdeviceptr bell = (CUdeviceptr)(comm->doorbells + plan->doorbell);
+    CUCHECK(cuStreamWriteValue32(stream, bell, 1, CU_STREAM_WRITE_VALUE_DEFAULT));
+    CUCHECK(cuStreamWaitValue32(stream, bell, 0, CU_STREAM_WAIT_VALUE_EQ));
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t reclaimPlan(struct ncclComm* comm, struct ncclCommCallback* me) {
   struct ncclKernelPlan* plan = (struct ncclKernelPlan*)me; // cast from first member `reclaim`
+  NCCLCHECK(ncclProfilingDeviceDrain(comm));
+  if (!ncclIntruQueueEmpty(&comm->tunerTimingQueue)) NCCLCHECK(tunerTimingPoll(comm));
   if (plan->persistent) {
     comm->persistentRefs -= 1;
-    NCCLCHECK(ncclCudaFree(plan->workHead));
+    if (plan->doorbell >= 0) __atomic_store_n(&comm->doorbellPlans[plan->doorbell], nullptr, __ATOMIC_RELEASE);
+    if (plan->workBuff) NCCLCHECK(workPoolRelease(comm, plan->workBuff));
     for (int c=0; c < plan->channelUbound; c++) {
       struct ncclProxyOp* q = ncclIntruQueueHead(&plan->channels[c].proxyOpQueue);
       while (q != nullptr) {
@@ -1199,8 +1925,12 @@ static ncclResult_t reclaimPlan(struct ncclComm* comm, struct ncclCommCallback*
     /* free mcHandle */
     while (!ncclIntruQueueEmpty(&plan->nvlsMcHandleQueue)) {
       struct ncclNvlsMcHandleList* obj = ncclIntruQueueDequeue(&plan->nvlsMcHandleQueue);
-      NCCLCHECK(ncclNvlsDeregBuffer(&obj->mcHandle, obj->ptr, obj->dev, obj->size));
-      INFO(NCCL_NVLS, "rank %d - deregistered buffer %p on device %d, size %ld", comm->rank, (void*)obj->ptr, obj->dev, obj->size);
+      if (obj->entry) {
+        NCCLCHECK(ncclNvlsRegCacheRelease(comm, obj->entry));
+      } else {
+        NCCLCHECK(ncclNvlsDeregBuffer(&obj->mcHandle, obj->ptr, obj->dev, obj->size));
+        INFO(NCCL_NVLS, "rank %d - deregistered buffer %p on device %d, size %ld", comm->rank, (void*)obj->ptr, obj->dev, obj->size);
+      }
       ncclMemoryPoolFree(&comm->memPool_ncclNvlsHandleList, obj);
     }
     while (!ncclIntruQueueEmpty(&plan->collnetHandleQueue)) {
@@ -1224,59 +1954,362 @@ static void persistentDestructor(void* plans_) {
   }
 }
 
-ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
-  ncclResult_t result = ncclSuccess;
+// Training loops issue the same groups of collectives on the same buffers
+// every iteration. Keep the plans of the last NCCL_PLAN_CACHE groups so that
+// their ncclWork's and proxy ops can be replayed instead of scheduled again.
+NCCL_PARAM(PlanCache, "PLAN_CACHE", 16);
+
+// Only plans which depend on nothing else than the tasks can be reused.
+// Tuner plugins may change their mind at any time, registered buffers are
+// checked at insertion. Graph captured plans are cached too, so that a
+// framework capturing the same group again neither schedules it nor uploads
+// its works again: the new graph shares the device works of the first one.
+static bool planCacheUsable(struct ncclComm* comm, bool persistent) {
   struct ncclTasks* tasks = &comm->tasks;
-  bool persistent = ncclCudaGraphValid(tasks->capturingGraph);
-  int nPlans = 0;
-
-  // Poll for callbacks sent to us from other threads. Typically these free
-  // resources from to our memory pools.
-  NCCLCHECK(ncclCommPollCallbacks(comm, /*waitSome=*/false));
+  // Plans are not keyed by the group SM budget.
+  return ncclParamPlanCache() > 0 && comm->tuner == nullptr &&
+         tasks->nTasksColl != 0 && tasks->nTasksP2p == 0 && tasks->maxCTAs == 0;
+}
 
-  // We already have one frame present which holds all of our tasks (which we
-  // are about to schedule). Now push an additional frame for allocating
-  // work structs (see appendWorkElem() variants all use scoped allocation).
-  ncclMemoryStackPush(&comm->memScoped);
+static ncclResult_t planCacheGetKeys(
+    struct ncclComm* comm, struct ncclPlanCacheKey** keysOut, struct ncclInfo*** infosOut, uint64_t* hash
+  ) {
+  struct ncclTasks* tasks = &comm->tasks;
+  struct ncclPlanCacheKey* keys = ncclMemoryStackAlloc<struct ncclPlanCacheKey>(&comm->memScoped, tasks->nTasksColl);
+  struct ncclInfo** infos = ncclMemoryStackAlloc<struct ncclInfo*>(&comm->memScoped, tasks->nTasksColl);
+  int n = 0;
+  for (struct ncclInfo* info = ncclIntruQueueHead(&tasks->collQueue); info != nullptr; info = info->next) {
+    if (n == tasks->nTasksColl) {
+      WARN("Plan cache: more collectives queued than nTasksColl %d", tasks->nTasksColl);
+      return ncclInternalError;
+    }
+    // Segments of fused collectives and the buffer casts are not part of the key
+    if (info->nFusedSegments || info->castInput || info->castOutput) {
+      *keysOut = nullptr;
+      return ncclSuccess;
+    }
+    // Keys are zeroed by the allocation, so padding compares equal.
+    struct ncclPlanCacheKey* key = keys+n;
+    key->coll = info->coll;
+    key->datatype = info->datatype;
+    key->opFull.op = info->opFull.op;
+    key->opFull.proxyOp = info->opFull.proxyOp;
+    key->opFull.scalarArgIsPtr = info->opFull.scalarArgIsPtr;
+    key->opFull.scalarArg = info->opFull.scalarArg;
+    key->root = info->root;
+    key->sendbuff = info->sendbuff;
+    key->recvbuff = info->recvbuff;
+    key->count = info->count;
+    key->chunkSteps = info->chunkSteps;
+    key->sliceSteps = info->sliceSteps;
+    infos[n++] = info;
+  }
+  *keysOut = keys;
+  *infosOut = infos;
+  *hash = getHash((const char*)keys, n*sizeof(struct ncclPlanCacheKey));
+  return ncclSuccess;
+}
 
-  if (tasks->nTasksColl + tasks->nTasksP2p != 0) {
-    do {
-      struct ncclKernelPlan* plan = ncclMemoryPoolAlloc<struct ncclKernelPlan>(&comm->memPool_ncclKernelPlan, &comm->memPermanent);
-      ncclIntruQueueEnqueue(&comm->planQueue, plan);
-      nPlans += 1;
-      plan->comm = comm;
-      plan->reclaimer.fn = reclaimPlan;
-      plan->persistent = persistent;
+static struct ncclPlanCacheEntry* planCacheFind(struct ncclComm* comm, struct ncclPlanCacheKey* keys, int nColl, uint64_t hash, bool persistent) {
+  struct ncclPlanCache* cache = &comm->planCache;
+  for (int i=0; i<cache->size; i++) {
+    struct ncclPlanCacheEntry* entry = cache->entries+i;
+    // Persistent plans are not split by the work fifo budget.
+    if (entry->keys == nullptr || entry->hash != hash || entry->nColl != nColl || entry->persistent != persistent) continue;
+    if (memcmp(entry->keys, keys, nColl*sizeof(struct ncclPlanCacheKey)) != 0) continue;
+    entry->lastUsed = ++cache->clock;
+    return entry;
+  }
+  return nullptr;
+}
 
-      // Non-persistent kernels fill up at most half of our fifo per kernel.
-      int nWorkBudget = plan->persistent ? INT_MAX : comm->workFifoDepth/2;
-      int nWorkBudgetOld = nWorkBudget;
+static ncclResult_t planCacheEntryFree(struct ncclComm* comm, struct ncclPlanCacheEntry* entry) {
+  free(entry->keys);
+  free(entry->works);
+  free(entry->proxyOps);
+  // Graphs still holding plans of this entry keep the works alive.
+  struct ncclWorkBuff* workBuff = entry->workBuff;
+  memset(entry, 0, sizeof(*entry));
+  if (workBuff) NCCLCHECK(workPoolRelease(comm, workBuff));
+  return ncclSuccess;
+}
 
-      // Drain coll tasks first. This is essential since we partition tasks based
-      // on the work budget and p2p work isn't collective. If we were to drain p2p
-      // first, the place where we cut the kernel could vary by rank which would
-      // cause the "shortest channel first" channel picker to have divergent results.
-      if (tasks->nTasksColl != 0) {
-        NCCLCHECKGOTO(scheduleCollTasksToPlan(comm, plan, &nWorkBudget), result, failure);
-      }
-      // And only drain p2p tasks once colls are depleted.
-      if (tasks->nTasksColl == 0 && tasks->nTasksP2p != 0) {
-        NCCLCHECKGOTO(scheduleP2pTasksToPlan(comm, plan, &nWorkBudget), result, failure);
-      }
-      if (nWorkBudget == nWorkBudgetOld) {
-        // We weren't able to fit any tasks into our budget which means now we're
-        // stuck in an infinite loop. We defer this check until here, instead of
-        // doing it in comm init, to permit testing with insanely shallow queues
-        // for cases where that's expected to still work (e.g. few channels).
-        WARN("'NCCL_WORK_FIFO_DEPTH=%d' is too small. Minimum value is %d", comm->workFifoDepth, 2*MAXCHANNELS);
-        result = ncclInvalidUsage;
-        goto failure;
-      }
-      finishPlan(plan);
-    } while (tasks->nTasksColl + tasks->nTasksP2p != 0);
+ncclResult_t ncclPlanCacheFree(struct ncclComm* comm) {
+  struct ncclPlanCache* cache = &comm->planCache;
+  for (int i=0; i<cache->size; i++) NCCLCHECK(planCacheEntryFree(comm, cache->entries+i));
+  free(cache->entries);
+  cache->entries = nullptr;
+  cache->size = 0;
+  return ncclSuccess;
+}
 
-    struct ncclKernelPlan* planHead = ncclIntruQueueHead(&comm->planQueue);
-    comm->unlaunchedPlansHead = planHead;
+// Record a finished plan. Must be called before uploadProxyOps() which
+// recycles the proxy ops of non-persistent plans.
+static ncclResult_t planCacheInsert(
+    struct ncclComm* comm, struct ncclKernelPlan* plan,
+    struct ncclPlanCacheKey* keys, struct ncclInfo** infos, int nColl, uint64_t hash
+  ) {
+  struct ncclPlanCache* cache = &comm->planCache;
+  if (plan->tunerTiming != nullptr) return ncclSuccess;
+  if (!ncclIntruQueueEmpty(&plan->ipcMemQueue) || !ncclIntruQueueEmpty(&plan->nvlsMcHandleQueue) ||
+      !ncclIntruQueueEmpty(&plan->collnetHandleQueue)) return ncclSuccess;
+  for (int i=0; i<nColl; i++) {
+    struct ncclInfo* info = infos[i];
+    if (info->regBufType != NCCL_REGULAR_BUFFER || info->netReg || info->autotuneCand >= 0) return ncclSuccess;
+    // The choice for this size is final only once auto-tuning is done
+    struct ncclAutotuneBucket* bucket = ncclAutotuneGetBucket(comm, info->coll, info->aggnBytes);
+    if (bucket && bucket->state != ncclAutotuneDone) return ncclSuccess;
+  }
+
+  if (cache->entries == nullptr) {
+    NCCLCHECK(ncclCalloc(&cache->entries, ncclParamPlanCache()));
+    cache->size = ncclParamPlanCache();
+  }
+  struct ncclPlanCacheEntry* entry = cache->entries;
+  for (int i=0; i<cache->size; i++) {
+    if (cache->entries[i].keys == nullptr) { entry = cache->entries+i; break; }
+    if (cache->entries[i].lastUsed < entry->lastUsed) entry = cache->entries+i;
+  }
+  NCCLCHECK(planCacheEntryFree(comm, entry));
+
+  int nWork = 0, nProxyOps = 0;
+  for (int c=0; c < plan->channelUbound; c++) {
+    for (struct ncclWorkList* wl = ncclIntruQueueHead(&plan->channels[c].workQueue); wl != nullptr; wl = wl->next) entry->nWork[c]++;
+    for (struct ncclProxyOp* op = ncclIntruQueueHead(&plan->channels[c].proxyOpQueue); op != nullptr; op = op->enqNext) entry->nProxyOps[c]++;
+    nWork += entry->nWork[c];
+    nProxyOps += entry->nProxyOps[c];
+  }
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECKGOTO(ncclCalloc(&entry->keys, nColl), ret, fail);
+  NCCLCHECKGOTO(ncclCalloc(&entry->works, nWork), ret, fail);
+  if (nProxyOps) NCCLCHECKGOTO(ncclCalloc(&entry->proxyOps, nProxyOps), ret, fail);
+  memcpy(entry->keys, keys, nColl*sizeof(struct ncclPlanCacheKey));
+  nWork = nProxyOps = 0;
+  for (int c=0; c < plan->channelUbound; c++) {
+    for (struct ncclWorkList* wl = ncclIntruQueueHead(&plan->channels[c].workQueue); wl != nullptr; wl = wl->next) entry->works[nWork++] = wl->work;
+    for (struct ncclProxyOp* op = ncclIntruQueueHead(&plan->channels[c].proxyOpQueue); op != nullptr; op = op->enqNext) entry->proxyOps[nProxyOps++] = *op;
+  }
+  entry->hash = hash;
+  entry->lastUsed = ++cache->clock;
+  entry->nColl = nColl;
+  entry->kernelSpecialized = plan->kernelSpecialized;
+  entry->kernelFn = plan->kernelFn;
+  entry->channelUbound = plan->channelUbound;
+  entry->channelCount = plan->channelCount;
+  entry->channelMask = plan->channelMask;
+  entry->hasProxyOps = plan->hasProxyOps;
+  entry->threadPerBlock = plan->threadPerBlock;
+  entry->collOpCount = plan->collOpCount;
+  entry->maxBytesPerChannel = plan->maxBytesPerChannel;
+  entry->persistent = plan->persistent;
+  if (plan->persistent && !planWorkInArgs(comm, plan, nWork)) {
+    // Upload now for the plan and all the ones restored from this entry.
+    NCCLCHECKGOTO(persistentWorkUpload(comm, plan, nWork, &plan->workBuff), ret, fail);
+    entry->workBuff = plan->workBuff;
+    entry->workBuff->refs += 1;
+    entry->workFirst = plan->workFirst;
+  }
+  TRACE(NCCL_COLL, "Plan cache: recorded %sgroup of %d collectives, %d works, %d proxy ops",
+        plan->persistent ? "captured " : "", nColl, nWork, nProxyOps);
+  return ncclSuccess;
+fail:
+  planCacheEntryFree(comm, entry);
+  return ret;
+}
+
+// Rebuild a plan from the cache, as scheduleCollTasksToPlan() and
+// finishPlan() would have made it.
+static void planCacheRestore(struct ncclComm* comm, struct ncclPlanCacheEntry* entry, struct ncclKernelPlan* plan) {
+  int w = 0, p = 0;
+  for (int c=0; c < entry->channelUbound; c++) {
+    struct ncclKernelPlan::Channel* chan = &plan->channels[c];
+    for (int i=0; i < entry->nWork[c]; i++) {
+      struct ncclWorkList* q = ncclMemoryStackAlloc<struct ncclWorkList>(&comm->memScoped);
+      q->work = entry->works[w++]; // C++ struct assignment
+      ncclIntruQueueEnqueue(&chan->workQueue, q);
+    }
+    chan->nWork = entry->nWork[c];
+    for (int i=0; i < entry->nProxyOps[c]; i++) {
+      struct ncclProxyOp* q = ncclMemoryPoolAlloc<struct ncclProxyOp>(&comm->memPool_ncclProxyOp, &comm->memPermanent);
+      *q = entry->proxyOps[p++]; // C++ struct assignment
+      ncclIntruQueueEnqueue(&chan->proxyOpQueue, q);
+    }
+  }
+  plan->kernelSpecialized = entry->kernelSpecialized;
+  plan->kernelFn = entry->kernelFn;
+  plan->channelUbound = entry->channelUbound;
+  plan->channelCount = entry->channelCount;
+  plan->channelMask = entry->channelMask;
+  plan->hasProxyOps = entry->hasProxyOps;
+  plan->threadPerBlock = entry->threadPerBlock;
+  plan->collOpCount = entry->collOpCount;
+  plan->maxBytesPerChannel = entry->maxBytesPerChannel;
+  if (entry->workBuff) {
+    plan->workBuff = entry->workBuff;
+    plan->workBuff->refs += 1;
+    plan->workFirst = entry->workFirst;
+  }
+}
+
+// Turn the tasks into as many plans as needed, launched on stream.
+static ncclResult_t schedulePlans(struct ncclComm* comm, bool persistent, cudaStream_t stream, int* nPlans) {
+  struct ncclTasks* tasks = &comm->tasks;
+  while (tasks->nTasksColl + tasks->nTasksP2p != 0) {
+    struct ncclKernelPlan* plan = ncclMemoryPoolAlloc<struct ncclKernelPlan>(&comm->memPool_ncclKernelPlan, &comm->memPermanent);
+    ncclIntruQueueEnqueue(&comm->planQueue, plan);
+    *nPlans += 1;
+    plan->comm = comm;
+    plan->reclaimer.fn = reclaimPlan;
+    plan->persistent = persistent;
+    plan->planId = comm->planCount++;
+    plan->stream = stream;
+
+    // Non-persistent kernels fill up at most half of each channel's fifo ring,
+    // see workBudgetCharge.
+    int nWorkBudget = plan->persistent ? INT_MAX : comm->workFifoChannelDepth/2;
+
+    // Drain coll tasks first. This is essential since we partition tasks based
+    // on the work budget and p2p work isn't collective. If we were to drain p2p
+    // first, the place where we cut the kernel could vary by rank which would
+    // cause the "shortest channel first" channel picker to have divergent results.
+    if (tasks->nTasksColl != 0) {
+      NCCLCHECK(scheduleCollTasksToPlan(comm, plan, &nWorkBudget));
+    }
+    // And only drain p2p tasks once colls are depleted.
+    if (tasks->nTasksColl == 0 && tasks->nTasksP2p != 0) {
+      NCCLCHECK(scheduleP2pTasksToPlan(comm, plan, &nWorkBudget));
+    }
+    bool planEmpty = true;
+    for (int c=0; c < MAXCHANNELS; c++) planEmpty &= plan->channels[c].nWork == 0;
+    if (planEmpty) {
+      // We weren't able to fit any tasks into our budget which means now we're
+      // stuck in an infinite loop. We defer this check until here, instead of
+      // doing it in comm init, to permit testing with insanely shallow queues
+      // for cases where that's expected to still work (e.g. few channels).
+      WARN("'NCCL_WORK_FIFO_DEPTH=%d' is too small. Minimum value is %d", comm->workFifoDepth, 2*MAXCHANNELS);
+      return ncclInvalidUsage;
+    }
+    finishPlan(plan);
+  }
+  return ncclSuccess;
+}
+
+// Groups of collectives issued to several user streams normally launch all
+// their kernels on the first stream, after joining every stream of the group
+// through comm->deviceStream, so that the streams end up waiting on each
+// other. With NCCL_GROUP_STREAM_SPLIT, every stream gets plans of its own on a
+// disjoint subset of the channels, and only waits for the previous groups.
+// Streams are numbered in the order collectives first use them, so all ranks
+// must issue the collectives of the group to their streams the same way.
+NCCL_PARAM(GroupStreamSplit, "GROUP_STREAM_SPLIT", 0);
+int64_t ncclParamResidentKernel();
+
+static bool streamSplitUsable(struct ncclComm* comm, bool persistent) {
+  struct ncclTasks* tasks = &comm->tasks;
+  if (!ncclParamGroupStreamSplit() || tasks->streams == nullptr || tasks->streams->next == nullptr) return false;
+  int nStreams = 0;
+  for (struct ncclCudaStreamList* l = tasks->streams; l != nullptr; l = l->next) nStreams++;
+  int nChannels = tasks->maxCTAs ? std::min(tasks->maxCTAs, comm->collChannels) : comm->collChannels;
+  // Proxy ops posted from the host stream, copy engine collectives and the
+  // resident kernel are all ordered on the first stream. CollNet and NVLS run
+  // on channels of their own.
+  return tasks->nTasksP2p == 0 && tasks->nTasksCe == 0 && nStreams <= nChannels &&
+         !persistent && comm->persistentRefs == 0 && !ncclCudaLaunchBlocking && !ncclParamResidentKernel() &&
+         !comm->collNetSupport && !comm->nvlsSupport;
+}
+
+static ncclResult_t streamSplitSchedule(struct ncclComm* comm, int* nPlans) {
+  struct ncclTasks* tasks = &comm->tasks;
+  int nStreams = 0;
+  cudaStream_t streams[MAXCHANNELS];
+  struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> queues[MAXCHANNELS];
+  int nTasks[MAXCHANNELS];
+  size_t bytes[MAXCHANNELS];
+  while (!ncclIntruQueueEmpty(&tasks->collQueue)) {
+    struct ncclInfo* info = ncclIntruQueueDequeue(&tasks->collQueue);
+    int s = 0;
+    while (s < nStreams && streams[s] != info->stream) s++;
+    if (s == nStreams) {
+      streams[nStreams++] = info->stream;
+      ncclIntruQueueConstruct(&queues[s]);
+      nTasks[s] = 0;
+      bytes[s] = 0;
+    }
+    ncclIntruQueueEnqueue(&queues[s], info);
+    nTasks[s] += 1;
+    bytes[s] += info->count*ncclTypeSize(info->datatype);
+  }
+  int nChannels = tasks->maxCTAs ? std::min(tasks->maxCTAs, comm->collChannels) : comm->collChannels;
+  ncclResult_t ret = ncclSuccess;
+  for (int s=0; s < nStreams; s++) {
+    tasks->collQueue = queues[s]; // C++ struct assignment
+    tasks->nTasksColl = nTasks[s];
+    tasks->workBytesTotal = bytes[s];
+    tasks->channelFirst = s*nChannels/nStreams;
+    tasks->channelCount = (s+1)*nChannels/nStreams - tasks->channelFirst;
+    NCCLCHECKGOTO(schedulePlans(comm, /*persistent=*/false, streams[s], nPlans), ret, exit);
+  }
+exit:
+  tasks->channelFirst = tasks->channelCount = 0;
+  return ret;
+}
+
+ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
+  ncclResult_t result = ncclSuccess;
+  struct ncclTasks* tasks = &comm->tasks;
+  bool persistent = ncclCudaGraphValid(tasks->capturingGraph);
+  int nPlans = 0;
+  struct ncclPlanCacheKey* cacheKeys = nullptr;
+  struct ncclInfo** cacheInfos = nullptr;
+  int nCacheKeys = 0;
+  uint64_t cacheHash = 0;
+  struct ncclPlanCacheEntry* cached = nullptr;
+
+  // Poll for callbacks sent to us from other threads. Typically these free
+  // resources from to our memory pools.
+  NCCLCHECK(ncclCommPollCallbacks(comm, /*waitSome=*/false));
+
+  // We already have one frame present which holds all of our tasks (which we
+  // are about to schedule). Now push an additional frame for allocating
+  // work structs (see appendWorkElem() variants all use scoped allocation).
+  ncclMemoryStackPush(&comm->memScoped);
+
+  if (tasks->nTasksColl + tasks->nTasksP2p + tasks->nTasksCe != 0) {
+    tasks->streamSplit = streamSplitUsable(comm, persistent);
+    if (!tasks->streamSplit && planCacheUsable(comm, persistent)) {
+      nCacheKeys = tasks->nTasksColl;
+      NCCLCHECKGOTO(planCacheGetKeys(comm, &cacheKeys, &cacheInfos, &cacheHash), result, failure);
+      if (cacheKeys) cached = planCacheFind(comm, cacheKeys, nCacheKeys, cacheHash, persistent);
+    }
+    if (cached) {
+      struct ncclKernelPlan* plan = ncclMemoryPoolAlloc<struct ncclKernelPlan>(&comm->memPool_ncclKernelPlan, &comm->memPermanent);
+      ncclIntruQueueEnqueue(&comm->planQueue, plan);
+      nPlans += 1;
+      plan->comm = comm;
+      plan->reclaimer.fn = reclaimPlan;
+      plan->persistent = persistent;
+      plan->planId = comm->planCount++;
+      planCacheRestore(comm, cached, plan);
+      // The tasks are consumed as if they had been scheduled.
+      ncclIntruQueueConstruct(&tasks->collQueue);
+      tasks->nTasksColl = 0;
+      tasks->workBytesTotal = 0;
+    }
+    if (tasks->streamSplit) {
+      NCCLCHECKGOTO(streamSplitSchedule(comm, &nPlans), result, failure);
+    } else {
+      NCCLCHECKGOTO(schedulePlans(comm, persistent, nullptr, &nPlans), result, failure);
+    }
+
+    struct ncclKernelPlan* planHead = ncclIntruQueueHead(&comm->planQueue);
+    if (cacheKeys != nullptr && cached == nullptr && nPlans == 1) {
+      NCCLCHECKGOTO(planCacheInsert(comm, planHead, cacheKeys, cacheInfos, nCacheKeys, cacheHash), result, failure);
+    }
+    comm->unlaunchedPlansHead = planHead;
+    for (struct ncclKernelPlan* plan=planHead; plan != nullptr; plan = plan->next) {
+      NCCLCHECKGOTO(planProxyPriority(comm, plan->stream ? plan->stream : tasks->streams->stream, &plan->proxyPriority), result, failure);
+      plan->opTag = tasks->opTag;
+    }
 
     // Semantically we want these dependencies for the kernels launched:
     //   1. Launch host task on hostStream.
@@ -1295,18 +2328,34 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
     cudaStream_t launchStream = tasks->streams->stream;
     NCCLCHECKGOTO(ncclStrongStreamAcquire(tasks->capturingGraph, &comm->sharedRes->deviceStream), result, failure);
 
-    // Create dependency for device stream on user streams. First from extra user
-    // streams to deviceStream. Then deviceStream to first user stream.
-    for (struct ncclCudaStreamList* l=tasks->streams->next; l != nullptr; l = l->next) {
-      NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, &comm->sharedRes->deviceStream, l->stream), result, failure);
+    if (tasks->streamSplit) {
+      // Every user stream waits for the previous groups, but not for the
+      // other streams of this one.
+      for (struct ncclCudaStreamList* l=tasks->streams; l != nullptr; l = l->next) {
+        NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, l->stream, &comm->sharedRes->deviceStream), result, failure);
+      }
+    } else {
+      // Create dependency for device stream on user streams. First from extra user
+      // streams to deviceStream. Then deviceStream to first user stream.
+      for (struct ncclCudaStreamList* l=tasks->streams->next; l != nullptr; l = l->next) {
+        NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, &comm->sharedRes->deviceStream, l->stream), result, failure);
+      }
+      NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, launchStream, &comm->sharedRes->deviceStream), result, failure);
     }
-    NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, launchStream, &comm->sharedRes->deviceStream), result, failure);
+
+    // Copy engine collectives go first on the launch stream, they do not depend
+    // on the kernels nor on proxy host tasks.
+    if (tasks->nTasksCe != 0) NCCLCHECKGOTO(ncclCeCollLaunch(comm, launchStream), result, failure);
 
     if (persistent || comm->persistentRefs != 0 || ncclCudaLaunchBlocking) {
       // We have to launch host tasks to push proxy args. We are careful to only
       // do this if necessary since host tasks impose a high performance cost in CUDA.
       bool acquired = false;
-      for (struct ncclKernelPlan* plan=planHead; plan != nullptr; plan = plan->next) {
+      bool doorbells;
+      for (struct ncclKernelPlan* plan=planHead; plan != nullptr; plan = plan->next) plan->doorbell = -1;
+      NCCLCHECKGOTO(doorbellsAssign(comm, planHead, &doorbells), result, failure);
+      if (doorbells) NCCLCHECKGOTO(doorbellsRing(comm, planHead, launchStream), result, failure);
+      for (struct ncclKernelPlan* plan=planHead; plan != nullptr && !doorbells; plan = plan->next) {
         if (plan->hasProxyOps) {
           if (!acquired) {
             acquired = true;
@@ -1348,14 +2397,117 @@ ncclResult_t ncclLaunchKernelBefore_NoUncapturedCuda(struct ncclComm* comm, stru
 NCCL_PARAM(MemSyncDomain, "MEM_SYNC_DOMAIN", cudaLaunchMemSyncDomainRemote);
 #endif
 
-ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan) {
-  struct ncclTasks* tasks = &comm->tasks;
+// Keep one block per channel resident on the GPU polling for work, so that
+// non-captured launches cost two stream memory operations instead of a kernel
+// launch. The resident blocks occupy their SMs for the lifetime of the
+// communicator.
+NCCL_PARAM(ResidentKernel, "RESIDENT_KERNEL", 0);
+
+static ncclResult_t residentKernelStart(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  dim3 grid, block;
+  void* args[3];
+  size_t smem = ncclShmemDynamicSize(comm->cudaArch);
+  struct ncclResidentFifo* fifo = nullptr;
+  struct ncclResidentFlags* flags = nullptr;
+  cudaStream_t stream = nullptr;
+
+  comm->residentState = -1;
+  if (CUPFN(cuStreamWriteValue32) == nullptr || CUPFN(cuStreamWaitValue32) == nullptr) {
+    INFO(NCCL_INIT, "NCCL_RESIDENT_KERNEL set but stream memory operations are not available, using regular launches");
+    return ncclSuccess;
+  }
+  { ncclMemScope memScope(&comm->memStats, ncclMemWorkFifo);
+    NCCLCHECKGOTO(ncclCudaHostCalloc(&fifo, 1), ret, fail);
+    NCCLCHECKGOTO(ncclCudaCalloc(&flags, 1), ret, fail);
+  }
+  CUDACHECKGOTO(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), ret, fail);
+
+  comm->residentNChannels = std::max(comm->nChannels, comm->p2pnChannels);
+  grid = {(unsigned)comm->residentNChannels, 1, 1};
+  block = {NCCL_MAX_NTHREADS, 1, 1};
+  args[0] = &comm->devComm;
+  args[1] = &fifo;
+  args[2] = &flags;
+  CUDACHECKGOTO(cudaLaunchKernel(ncclDevKernelResident, grid, block, args, smem, stream), ret, fail);
+
+  comm->residentFifo = fifo;
+  comm->residentFlags = flags;
+  comm->residentStream = stream;
+  comm->residentSeq = 0;
+  comm->residentState = 1;
+  INFO(NCCL_INIT, "Resident kernel started with %d channels", comm->residentNChannels);
+  return ncclSuccess;
+fail:
+  if (stream) cudaStreamDestroy(stream);
+  if (flags) ncclCudaFree(flags);
+  if (fifo) ncclCudaHostFree(fifo);
+  return ret;
+}
+
+static ncclResult_t residentKernelEnqueue(struct ncclComm* comm, struct ncclKernelPlan* plan, cudaStream_t stream) {
+  struct ncclResidentFifo* fifo = comm->residentFifo;
+  uint32_t seq = comm->residentSeq;
+  // Wait for the slot used NCCL_RESIDENT_FIFO_DEPTH plans ago to be consumed.
+  while (seq - __atomic_load_n(&fifo->consumed, __ATOMIC_ACQUIRE) >= NCCL_RESIDENT_FIFO_DEPTH) {
+    if (__atomic_load_n(comm->abortFlag, __ATOMIC_RELAXED)) return ncclInternalError;
+    sched_yield();
+  }
+  struct ncclResidentSlot* slot = &fifo->slots[seq%NCCL_RESIDENT_FIFO_DEPTH];
+  slot->workHead = plan->workHead;
+  slot->channelMask = plan->channelMask;
+  slot->workFirst = plan->workFirst;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  // Release the slot once prior work on the stream is done, then hold the stream
+  // until all resident blocks have processed it.
+  CUCHECK(cuStreamWriteValue32(stream, (CUdeviceptr)&comm->residentFlags->ready[seq%NCCL_RESIDENT_FIFO_DEPTH], seq+1, CU_STREAM_WRITE_VALUE_DEFAULT));
+  CUCHECK(cuStreamWaitValue32(stream, (CUdeviceptr)&comm->residentFlags->done, seq+1, CU_STREAM_WAIT_VALUE_GEQ));
+  comm->residentSeq = seq+1;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclResidentKernelStop(struct ncclComm* comm) {
+  if (comm->residentState != 1) return ncclSuccess;
+  struct ncclResidentFifo* fifo = comm->residentFifo;
+  // Let the kernel drain everything already handed over, then exit.
+  __atomic_store_n(&fifo->stopSeq, comm->residentSeq, __ATOMIC_RELAXED);
+  __atomic_store_n(&fifo->stop, 1, __ATOMIC_RELEASE);
+  CUDACHECK(cudaStreamSynchronize(comm->residentStream));
+  // If the kernel exited on abort some streams may still be waiting on slots it
+  // never processed. Release them.
+  CUCHECK(cuStreamWriteValue32(comm->residentStream, (CUdeviceptr)&comm->residentFlags->done, comm->residentSeq, CU_STREAM_WRITE_VALUE_DEFAULT));
+  CUDACHECK(cudaStreamSynchronize(comm->residentStream));
+  CUDACHECK(cudaStreamDestroy(comm->residentStream));
+  NCCLCHECK(ncclCudaFree(comm->residentFlags));
+  NCCLCHECK(ncclCudaHostFree(comm->residentFifo));
+  comm->residentState = 0;
+  return ncclSuccess;
+}
+
+// Graph captured plans can be replayed at any time so they keep using regular launches.
+static bool residentKernelWanted(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  return !plan->persistent && comm->residentState >= 0 && ncclParamResidentKernel() && !ncclCudaLaunchBlocking;
+}
+
+static ncclResult_t launchPlanKernel(struct ncclComm* comm, struct ncclKernelPlan* plan, cudaStream_t launchStream) {
   void *fn = plan->kernelFn;
-  cudaStream_t launchStream = tasks->streams->stream;
+
+  if (plan->argsWork == nullptr && residentKernelWanted(comm, plan)) {
+    if (comm->residentState == 0) NCCLCHECK(residentKernelStart(comm));
+    if (comm->residentState == 1 && plan->channelUbound <= comm->residentNChannels) {
+      return residentKernelEnqueue(comm, plan, launchStream);
+    }
+  }
   dim3 grid = {(unsigned)plan->channelCount, 1, 1};
   dim3 block = {(unsigned)plan->threadPerBlock, 1, 1};
   size_t smem = ncclShmemDynamicSize(comm->cudaArch);
-  void *args[3] = {&comm->devComm, &plan->channelMask, &plan->workHead};
+  void *args[4] = {&comm->devComm, &plan->channelMask, &plan->workHead, &plan->workFirst};
+  void** kernelArgs = args;
+  if (plan->argsWork != nullptr) {
+    fn = ncclDevKernelArgsWork;
+    kernelArgs = (void**)&plan->argsWork;
+  }
+  if (comm->kernelWarmup != nullptr) NCCLCHECK(kernelWarmupEnsure(comm, fn));
 
   #if CUDART_VERSION >= 11080
   int driverVersion;
@@ -1365,7 +2517,7 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
     unsigned int clusterSize = (compCap == 90) ? comm->config.cgaClusterSize : 0;
 
     cudaLaunchConfig_t launchConfig = {0};
-    cudaLaunchAttribute launchAttrs[3];
+    cudaLaunchAttribute launchAttrs[5];
     int attrs = 0;
     /* Cooperative Group Array (CGA)
      * On sm90 and later we have an extra level of hierarchy where we
@@ -1392,6 +2544,27 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
       launchAttrs[attrs++].val.memSyncDomain = (cudaLaunchMemSyncDomain) ncclParamMemSyncDomain();
     }
     #endif
+    /* Programmatic Dependent Launch
+     * Let the kernel start while the previous kernel on the stream finishes, so
+     * that loading the comm, channel and first work overlaps with its tail.
+     * The kernel waits for it with griddepcontrol.wait before touching user
+     * data. Captured plans keep full serialization since the programmatic edge
+     * would have to be preserved in the graph.
+     */
+    if (comm->programmaticLaunch && !plan->persistent) {
+      launchAttrs[attrs].id = cudaLaunchAttributeProgrammaticStreamSerialization;
+      launchAttrs[attrs++].val.programmaticStreamSerializationAllowed = 1;
+    }
+    // Keep the connector flags and small-protocol buffers in L2 while other
+    // kernels stream through it, see NCCL_L2_PERSIST
+    if (comm->l2WindowBytes) {
+      launchAttrs[attrs].id = cudaLaunchAttributeAccessPolicyWindow;
+      launchAttrs[attrs].val.accessPolicyWindow.base_ptr = (void*)comm->l2WindowBase;
+      launchAttrs[attrs].val.accessPolicyWindow.num_bytes = comm->l2WindowBytes;
+      launchAttrs[attrs].val.accessPolicyWindow.hitRatio = comm->l2HitRatio;
+      launchAttrs[attrs].val.accessPolicyWindow.hitProp = cudaAccessPropertyPersisting;
+      launchAttrs[attrs++].val.accessPolicyWindow.missProp = cudaAccessPropertyStreaming;
+    }
     launchConfig.gridDim = grid;
     launchConfig.blockDim = block;
     launchConfig.dynamicSmemBytes = smem;
@@ -1399,12 +2572,49 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
     launchConfig.numAttrs = attrs;
     launchConfig.stream = launchStream;
 
-    CUDACHECK(cudaLaunchKernelExC(&launchConfig, fn, args));
+    CUDACHECK(cudaLaunchKernelExC(&launchConfig, fn, kernelArgs));
     return ncclSuccess;
   }
   #endif
   // Standard kernel launch
-  CUDACHECK(cudaLaunchKernel(fn, grid, block, args, smem, launchStream));
+  CUDACHECK(cudaLaunchKernel(fn, grid, block, kernelArgs, smem, launchStream));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  cudaStream_t launchStream = plan->stream ? plan->stream : comm->tasks.streams->stream;
+
+  if (comm->profiler && comm->profiler->planLaunch) {
+    comm->profiler->planLaunch(comm->profilerContext, comm->opCount, plan->channelMask, plan->collOpCount, launchStream, plan->opTag);
+  }
+  struct NvtxParamsPlanLaunch {
+    uint64_t commHash;
+    uint64_t planId;
+    int nColl;
+    int nChannels;
+  };
+  static constexpr nvtxPayloadSchemaEntry_t PlanLaunchSchema[] = {
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_UINT64, "Communicator hash"},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_UINT64, "Plan id", nullptr, 0, offsetof(NvtxParamsPlanLaunch, planId)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Collectives", nullptr, 0, offsetof(NvtxParamsPlanLaunch, nColl)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Channels", nullptr, 0, offsetof(NvtxParamsPlanLaunch, nChannels)}
+  };
+  NvtxParamsPlanLaunch payload{comm->commHash, plan->planId, plan->collOpCount, plan->channelCount};
+  // Nsight Systems projects the range onto the kernel launched inside it.
+  NVTX3_RANGE_WITH_PARAMS(PlanLaunch, "ncclKernelPlan", payload)
+
+  struct ncclTunerTiming* timing = plan->tunerTiming;
+  if (timing) CUDACHECK(cudaEventRecord(timing->start, launchStream));
+  ncclProfilingCorrelationPush(plan->opTag);
+  ncclResult_t ret = launchPlanKernel(comm, plan, launchStream);
+  ncclProfilingCorrelationPop(plan->opTag);
+  NCCLCHECK(ret);
+  if (!plan->persistent) NCCLCHECK(ncclContentionLaunch(comm, launchStream));
+  if (timing) {
+    CUDACHECK(cudaEventRecord(timing->stop, launchStream));
+    plan->tunerTiming = nullptr;
+    ncclIntruQueueEnqueue(&comm->tunerTimingQueue, timing);
+  }
   return ncclSuccess;
 }
 
@@ -1424,6 +2634,15 @@ ncclResult_t ncclLaunchKernelAfter_NoCuda(struct ncclComm* comm, struct ncclKern
   return ncclSuccess;
 }
 
+// Bump comm->opDone once everything launched so far on stream has completed,
+// see ncclCommGetOpHandle. Launches captured in graphs are not counted.
+static ncclResult_t opDoneWrite(struct ncclComm* comm, cudaStream_t stream) {
+  if (comm->opDone == nullptr || comm->tasks.capturingGraph) return ncclSuccess;
+  comm->opLaunched++;
+  CUCHECK(cuStreamWriteValue32(stream, (CUdeviceptr)comm->opDone, (uint32_t)comm->opLaunched, CU_STREAM_WRITE_VALUE_DEFAULT));
+  return ncclSuccess;
+}
+
 ncclResult_t ncclLaunchFinish(struct ncclComm* comm) {
   ncclResult_t result = ncclSuccess;
   struct ncclTasks* tasks = &comm->tasks;
@@ -1433,11 +2652,28 @@ ncclResult_t ncclLaunchFinish(struct ncclComm* comm) {
   // succeeded, and if it ncclLaunchPrepare didn't succeed we wouldn't be here.
   ncclMemoryStackPop(&comm->memScoped);
 
-  if (!ncclIntruQueueEmpty(&comm->planQueue)) {
+  if (!ncclIntruQueueEmpty(&comm->planQueue) || tasks->nTasksCe != 0) {
     // Reset queue to empty without destroying plans since those will be sent
     // back to us for reclaiming via callbackQueue.
     ncclIntruQueueConstruct(&comm->planQueue);
+    tasks->nTasksCe = 0;
+    if (tasks->streamSplit) {
+      // The next groups wait for every stream, which keep running independently.
+      tasks->streamSplit = false;
+      for (struct ncclCudaStreamList* l=tasks->streams; l != nullptr; l = l->next) {
+        NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, &comm->sharedRes->deviceStream, l->stream), result, resume0);
+      resume0:;
+      }
+      tasks->streams = nullptr;
+      NCCLCHECKGOTO(opDoneWrite(comm, comm->sharedRes->deviceStream.cudaStream), result, resume5);
+    resume5:
+      NCCLCHECKGOTO(ncclStrongStreamRelease(tasks->capturingGraph, &comm->sharedRes->deviceStream), result, resume4);
+    resume4:
+      return result;
+    }
     cudaStream_t launchStream = tasks->streams->stream; // First user stream gets launch
+    NCCLCHECKGOTO(opDoneWrite(comm, launchStream), result, resume6);
+  resume6:
     // Create dependency for deviceStream on launchStream. We know that deviceStream
     // hasn't been modified since launchStream waited on it (in ncclLaunchPrepare),
     // so we can say that launchStream subsumes it.
@@ -1480,6 +2716,26 @@ static inline ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNet
   return ncclSuccess;
 }
 
+static bool algoAvailable(struct ncclInfo* collInfo, int a, int collNetSupport, int nvlsSupport) {
+  struct ncclComm* comm = collInfo->comm;
+  if ((a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) && collNetSupport != 1) return false;
+  if ((a == NCCL_ALGO_NVLS || a == NCCL_ALGO_NVLS_TREE) && nvlsSupport != 1) return false;
+  if (a == NCCL_ALGO_HIER && (!comm->hierSupport || (collInfo->coll != ncclFuncAllReduce && collInfo->coll != ncclFuncAllGather) || collInfo->opFull.op == ncclDevPreMulSum)) return false;
+  if (a == NCCL_ALGO_RING_SCATTER && collInfo->coll != ncclFuncBroadcast && collInfo->coll != ncclFuncReduce) return false;
+  if (a == NCCL_ALGO_RECDBL && (!comm->recDblSupport || collInfo->coll != ncclFuncAllReduce || collInfo->opFull.op == ncclDevPreMulSum)) return false;
+  if (a == NCCL_ALGO_NVLS && collNetSupport != 1 && comm->nNodes > 1) return false;
+  /* now we only support single-node NVLS allgather and reducescatter */
+  if (a == NCCL_ALGO_NVLS && (collInfo->coll == ncclFuncAllGather || collInfo->coll == ncclFuncReduceScatter) && comm->nNodes > 1) return false;
+  return true;
+}
+
+bool ncclAlgoAvailable(struct ncclInfo* collInfo, int a) {
+  int collNetSupport;
+  getCollNetSupport(collInfo, &collNetSupport);
+  int nvlsSupport = collInfo->comm->nvlsSupport && ncclNvlsSupported(collInfo->opFull.op, collInfo->datatype);
+  return algoAvailable(collInfo, a, collNetSupport, nvlsSupport);
+}
+
 // numPipeOps: number of pipelined ops. Can be greater than 1 in aggregation mode. Used to adjust latency.
 static ncclResult_t topoGetAlgoInfo(struct ncclInfo* collInfo, int collNetSupport, int nvlsSupport, int numPipeOps) {
   struct ncclComm* comm = collInfo->comm;
@@ -1498,11 +2754,7 @@ static ncclResult_t topoGetAlgoInfo(struct ncclInfo* collInfo, int collNetSuppor
     collInfo->protocol = -1;
     int nAlgos = NCCL_NUM_ALGORITHMS;
     for (int a=0; a<nAlgos; a++) {
-      if ((a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) && collNetSupport != 1) continue;
-      if ((a == NCCL_ALGO_NVLS || a == NCCL_ALGO_NVLS_TREE) && nvlsSupport != 1) continue;
-      if (a == NCCL_ALGO_NVLS && collNetSupport != 1 && comm->nNodes > 1) continue;
-      /* now we only support single-node NVLS allgather and reducescatter */
-      if (a == NCCL_ALGO_NVLS && (collInfo->coll == ncclFuncAllGather || collInfo->coll == ncclFuncReduceScatter) && comm->nNodes > 1) continue;
+      if (!algoAvailable(collInfo, a, collNetSupport, nvlsSupport)) continue;
 
       for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
         float time;
@@ -1539,18 +2791,86 @@ static ncclResult_t topoGetAlgoInfo(struct ncclInfo* collInfo, int collNetSuppor
 }
 
 // Use the default topo-based tuner if tuner plugin is not successful.
-// Call the plugin first. Let it set algo+proto, and/or nChannels.
+// Call the plugin first with the cost table of the topology model. Let it
+// rewrite the costs, and/or set nChannels; we pick the cheapest entry.
 // Then, topoGetAlgoInfo will set algo/proto if not set, then nChannels and nThreads based on algo/proto.
 // Finally, nChannels will be overriden by the plugin setting.
 static ncclResult_t getTunerInfo(struct ncclInfo* collInfo, int collNetSupport, int nvlsSupport, int numPipeOps) {
+  struct ncclComm* comm = collInfo->comm;
   collInfo->algorithm = NCCL_ALGO_UNDEF;
   collInfo->protocol = NCCL_PROTO_UNDEF;
   collInfo->nChannels = 0;
-  if (collInfo->comm->tuner != NULL) {
-    NCCLCHECK(collInfo->comm->tuner->getCollInfo(
-          collInfo->comm->tunerContext, collInfo->coll, collInfo->nBytes,
-          collNetSupport, nvlsSupport, numPipeOps,
-          &collInfo->algorithm, &collInfo->protocol, &collInfo->nChannels));
+  collInfo->autotuned = false;
+  collInfo->autotuneCand = -1;
+  if (collInfo->castInput || collInfo->castOutput) {
+    // Only the ring SIMPLE primitives convert user buffers on load and store
+    collInfo->algorithm = NCCL_ALGO_RING;
+    collInfo->protocol = NCCL_PROTO_SIMPLE;
+    return ncclSuccess;
+  }
+  if (comm->forceAlgorithm != NCCL_ALGO_UNDEF) {
+    collInfo->algorithm = comm->forceAlgorithm;
+    collInfo->protocol = comm->forceProtocol;
+    return ncclSuccess;
+  }
+  if (comm->tuner != NULL && ncclTunerIsV2(comm->tuner)) {
+    // Only time the entries left open by the plugin's choice, if it made one
+    int algorithm, protocol, nChannels = 0;
+    ncclResult_t ret = ncclTunerV2GetCollInfo(comm->tunerContext, collInfo->coll, collInfo->nBytes, collNetSupport, nvlsSupport,
+        numPipeOps, &algorithm, &protocol, &nChannels);
+    if (ret == ncclSuccess) {
+      float minTime = 3600000000.0;
+      for (int a=0; a<NCCL_NUM_ALGORITHMS && (algorithm != NCCL_ALGO_UNDEF || protocol != NCCL_PROTO_UNDEF); a++) {
+        if (algorithm != NCCL_ALGO_UNDEF && a != algorithm) continue;
+        if (!algoAvailable(collInfo, a, collNetSupport, nvlsSupport)) continue;
+        for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+          if (protocol != NCCL_PROTO_UNDEF && p != protocol) continue;
+          float time;
+          bool backup = false;
+          NCCLCHECK(ncclTopoGetAlgoTime(collInfo, a, p, numPipeOps, &time, &backup));
+          if (time >= 0 && !backup && time < minTime) {
+            collInfo->algorithm = a;
+            collInfo->protocol = p;
+            minTime = time;
+          }
+        }
+      }
+      collInfo->nChannels = nChannels;
+    } else {
+      INFO(NCCL_TUNING, "Tuner plugin %s getCollInfo returned %d, using default tuning", comm->tuner->name, ret);
+    }
+  } else if (comm->tuner != NULL) {
+    float costTable[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+    for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+      bool available = algoAvailable(collInfo, a, collNetSupport, nvlsSupport);
+      for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+        float time = NCCL_ALGO_PROTO_IGNORE;
+        bool backup = false;
+        if (available) NCCLCHECK(ncclTopoGetAlgoTime(collInfo, a, p, numPipeOps, &time, &backup));
+        costTable[a*NCCL_NUM_PROTOCOLS+p] = (time < 0 || backup) ? NCCL_ALGO_PROTO_IGNORE : time;
+      }
+    }
+    int nChannels = 0;
+    ncclResult_t ret = comm->tuner->getCollInfo(comm->tunerContext, collInfo->coll, collInfo->nBytes, numPipeOps,
+        costTable, NCCL_NUM_ALGORITHMS, NCCL_NUM_PROTOCOLS, &nChannels);
+    if (ret == ncclSuccess) {
+      float minTime = 3600000000.0;
+      for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+        // Entries NCCL did not offer stay out of reach even if the plugin changed them.
+        if (!algoAvailable(collInfo, a, collNetSupport, nvlsSupport)) continue;
+        for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+          float time = costTable[a*NCCL_NUM_PROTOCOLS+p];
+          if (time >= 0 && time < minTime) {
+            collInfo->algorithm = a;
+            collInfo->protocol = p;
+            minTime = time;
+          }
+        }
+      }
+      collInfo->nChannels = nChannels;
+    } else {
+      INFO(NCCL_TUNING, "Tuner plugin %s getCollInfo returned %d, using default tuning", comm->tuner->name, ret);
+    }
   }
 
   /* We only honor nChannels decision when user sets the nChannels by tuner plugin or the coll picks
@@ -1562,6 +2882,230 @@ static ncclResult_t getTunerInfo(struct ncclInfo* collInfo, int collNetSupport,
   return ncclSuccess;
 }
 
+// Candidates worth trying for a bucket: every algorithm/protocol the model
+// doesn't rule out or consider far off, with the default number of channels
+// and, for ring and tree, half of them.
+static ncclResult_t autotuneCandidates(struct ncclInfo* collInfo, struct ncclAutotuneBucket* bucket,
+    int collNetSupport, int nvlsSupport, int numPipeOps) {
+  struct ncclComm* comm = collInfo->comm;
+  float times[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  float minTime = -1;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    bool available = algoAvailable(collInfo, a, collNetSupport, nvlsSupport);
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      float time = -1;
+      bool backup = false;
+      if (available) NCCLCHECK(ncclTopoGetAlgoTime(collInfo, a, p, numPipeOps, &time, &backup));
+      times[a][p] = backup ? -1 : time;
+      if (times[a][p] >= 0 && (minTime < 0 || times[a][p] < minTime)) minTime = times[a][p];
+    }
+  }
+  NCCLCHECK(ncclCalloc(&bucket->cand, NCCL_AUTOTUNE_MAX_CANDIDATES));
+  bucket->nCand = 0;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      if (times[a][p] < 0 || times[a][p] > 4*minTime) continue;
+      bucket->cand[bucket->nCand].algorithm = a;
+      bucket->cand[bucket->nCand].protocol = p;
+      bucket->nCand++;
+      if ((a == NCCL_ALGO_RING || a == NCCL_ALGO_TREE) && comm->collChannels >= 2) {
+        bucket->cand[bucket->nCand].algorithm = a;
+        bucket->cand[bucket->nCand].protocol = p;
+        bucket->cand[bucket->nCand].nChannels = comm->collChannels/2;
+        bucket->nCand++;
+      }
+    }
+  }
+  return ncclSuccess;
+}
+
+// Online auto-tuning, when no plugin made a choice. All ranks issue the same
+// collectives, so they walk the candidates in the same order.
+static ncclResult_t getAutotuneInfo(struct ncclInfo* collInfo, int collNetSupport, int nvlsSupport, int numPipeOps) {
+  struct ncclComm* comm = collInfo->comm;
+  struct ncclAutotuneBucket* bucket = ncclAutotuneGetBucket(comm, collInfo->coll, collInfo->nBytes);
+  if (bucket == nullptr || collInfo->algorithm != NCCL_ALGO_UNDEF) return ncclSuccess;
+  // Captured operations are never timed, don't spend trials on them.
+  bool capturing = ncclCudaGraphValid(comm->tasks.capturingGraph);
+  if (bucket->state == ncclAutotuneIdle && !capturing) {
+    NCCLCHECK(autotuneCandidates(collInfo, bucket, collNetSupport, nvlsSupport, numPipeOps));
+    if (bucket->nCand > 1) {
+      bucket->state = ncclAutotuneExplore;
+    } else {
+      // Nothing to choose from
+      bucket->state = ncclAutotuneDone;
+      bucket->algorithm = NCCL_ALGO_UNDEF;
+      free(bucket->cand);
+      bucket->cand = nullptr;
+    }
+  }
+
+  int a, p, nc, cand = -1;
+  if (bucket->state == ncclAutotuneExplore && !capturing) {
+    cand = bucket->nCalls % bucket->nCand;
+    a = bucket->cand[cand].algorithm;
+    p = bucket->cand[cand].protocol;
+    nc = bucket->cand[cand].nChannels;
+    if (++bucket->nCalls == bucket->nCand*comm->autotune->iters) {
+      // Results are gathered at the start of the next group
+      bucket->state = ncclAutotuneSync;
+      comm->autotune->nSyncPending++;
+    }
+  } else if (bucket->state == ncclAutotuneDone && bucket->algorithm != NCCL_ALGO_UNDEF) {
+    a = bucket->algorithm;
+    p = bucket->protocol;
+    nc = bucket->nChannels;
+  } else {
+    return ncclSuccess;
+  }
+
+  // The bucket is shared by all operations and datatypes; check this one can use it.
+  float time;
+  bool backup = false;
+  if (!algoAvailable(collInfo, a, collNetSupport, nvlsSupport)) return ncclSuccess;
+  NCCLCHECK(ncclTopoGetAlgoTime(collInfo, a, p, numPipeOps, &time, &backup));
+  if (time < 0 || backup) return ncclSuccess;
+  collInfo->algorithm = a;
+  collInfo->protocol = p;
+  collInfo->nChannels = nc;
+  collInfo->userTuned = nc != 0;
+  collInfo->autotuned = true;
+  collInfo->autotuneCand = cand;
+  return ncclSuccess;
+}
+
+// With runtime connection, rings and trees are connected by the preconnect job
+// before the launch. Go through the pending collectives, aggregated as in
+// scheduleCollTasksToPlan(), and find which algorithms they will use. Every
+// rank sees the same collectives so they agree on what to connect. This must
+// not change the state seen by scheduleCollTasksToPlan(): buckets the auto-tuner
+// is still exploring could use any of their candidates, so we take them all.
+NCCL_PARAM(FusionThreshold, "FUSION_THRESHOLD", 0);
+NCCL_PARAM(FusionBuffSize, "FUSION_BUFFSIZE", 1<<20);
+
+static bool collFusable(struct ncclInfo* info) {
+  return info->coll == ncclFuncAllReduce && info->algorithm == NCCL_ALGO_UNDEF &&
+         !info->castInput && !info->castOutput &&
+         info->count*ncclTypeSize(info->datatype) <= (size_t)ncclParamFusionThreshold();
+}
+
+static bool collFusableWith(struct ncclInfo* a, struct ncclInfo* b) {
+  return a->datatype == b->datatype && a->opFull.op == b->opFull.op &&
+         a->opFull.scalarArgIsPtr == b->opFull.scalarArgIsPtr && a->opFull.scalarArg == b->opFull.scalarArg;
+}
+
+// Each AllReduce goes around the ring on its own, so a group of many small
+// ones (bucketed gradients, norm parameters) pays the ring latency many times.
+// Concatenate those with the same datatype and reduction in comm->fusionBuff
+// and run them as one AllReduce, the kernel copying the segments in and out.
+ncclResult_t ncclCollFuseTasks(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  if (comm->fusionBuff == nullptr || tasks->nTasksColl < 2) return ncclSuccess;
+  struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> queue;
+  ncclIntruQueueConstruct(&queue);
+  struct ncclInfo* fused = nullptr;
+  size_t buffOffset = 0;
+  int nFused = 0, nSegments = 0;
+
+  while (!ncclIntruQueueEmpty(&tasks->collQueue)) {
+    struct ncclInfo* info = ncclIntruQueueDequeue(&tasks->collQueue);
+    size_t bytes = info->count*ncclTypeSize(info->datatype);
+    if (!collFusable(info)) {
+      fused = nullptr;
+      ncclIntruQueueEnqueue(&queue, info);
+      continue;
+    }
+    if (fused && (fused->nFusedSegments == NCCL_MAX_FUSED_SEGMENTS || !collFusableWith(fused, info) ||
+                  buffOffset + bytes > comm->fusionBuffSize)) {
+      fused = nullptr;
+    }
+    if (fused == nullptr) {
+      // Only start a fused collective if the next task can join it.
+      struct ncclInfo* next = ncclIntruQueueHead(&tasks->collQueue);
+      buffOffset = DIVUP(buffOffset, NCCL_BYTES_ALIGNMENT)*NCCL_BYTES_ALIGNMENT;
+      if (next == nullptr || !collFusable(next) || !collFusableWith(info, next) ||
+          buffOffset + bytes + next->count*ncclTypeSize(next->datatype) > comm->fusionBuffSize) {
+        ncclIntruQueueEnqueue(&queue, info);
+        continue;
+      }
+      fused = ncclMemoryStackAlloc<struct ncclInfo>(&comm->memScoped);
+      memcpy(fused, info, sizeof(struct ncclInfo));
+      fused->sendbuff = fused->recvbuff = (char*)comm->fusionBuff + buffOffset;
+      fused->count = 0;
+      fused->fusedSegments = ncclMemoryStackAlloc<struct ncclWorkSegment>(&comm->memScoped, NCCL_MAX_FUSED_SEGMENTS);
+      ncclIntruQueueEnqueue(&queue, fused);
+      tasks->nTasksColl += 1;
+      nFused++;
+    }
+    struct ncclWorkSegment* seg = fused->fusedSegments + fused->nFusedSegments++;
+    seg->sendbuff = info->sendbuff;
+    seg->recvbuff = info->recvbuff;
+    seg->count = info->count;
+    fused->count += info->count;
+    fused->profile |= info->profile;
+    buffOffset += bytes;
+    tasks->nTasksColl -= 1;
+    nSegments++;
+  }
+  tasks->collQueue = queue; // C++ struct assignment
+  if (nFused) TRACE(NCCL_COLL, "Fused %d AllReduces into %d", nSegments, nFused);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCollPrepareConnect(struct ncclComm* comm, bool* needConnect) {
+  struct ncclTasks* tasks = &comm->tasks;
+  bool need[NCCL_NUM_ALGORITHMS] = {};
+  *needConnect = false;
+  if (!comm->runtimeConn || tasks->nTasksColl == 0) return ncclSuccess;
+  bool capturing = ncclCudaGraphValid(tasks->capturingGraph);
+
+  struct ncclInfo* collInfo = ncclIntruQueueHead(&tasks->collQueue);
+  while (collInfo) {
+    if (collInfo->count == 0 || collInfo->algorithm != NCCL_ALGO_UNDEF) {
+      collInfo = collInfo->next;
+      continue;
+    }
+    struct ncclInfo aggInfo;
+    memcpy(&aggInfo, collInfo, sizeof(struct ncclInfo));
+    collInfo = collInfo->next;
+    while (collInfo && collAggregatable(&aggInfo, collInfo)) {
+      aggInfo.count += collInfo->count;
+      collInfo = collInfo->next;
+    }
+
+    int nvlsSupport = comm->nvlsSupport && ncclNvlsSupported(aggInfo.opFull.op, aggInfo.datatype);
+    int collNetSupport;
+    NCCLCHECK(getCollNetSupport(&aggInfo, &collNetSupport));
+    if (aggInfo.nFusedSegments) nvlsSupport = collNetSupport = 0;
+    NCCLCHECK(ncclInfoSetDerived(&aggInfo, comm->nRanks));
+    NCCLCHECK(getTunerInfo(&aggInfo, collNetSupport, nvlsSupport, 1));
+    struct ncclAutotuneBucket* bucket = ncclAutotuneGetBucket(comm, aggInfo.coll, aggInfo.nBytes);
+    if (aggInfo.algorithm == NCCL_ALGO_UNDEF && bucket && !capturing && bucket->state != ncclAutotuneDone) {
+      struct ncclAutotuneBucket idle = {};
+      struct ncclAutotuneBucket* cands = bucket;
+      if (bucket->state == ncclAutotuneIdle) {
+        NCCLCHECK(autotuneCandidates(&aggInfo, &idle, collNetSupport, nvlsSupport, 1));
+        cands = &idle;
+      }
+      for (int i=0; i<cands->nCand; i++) need[cands->cand[i].algorithm] = true;
+      free(idle.cand);
+    } else {
+      NCCLCHECK(getAutotuneInfo(&aggInfo, collNetSupport, nvlsSupport, 1));
+    }
+    // Also where the tuner and auto-tuner fall back to
+    NCCLCHECK(topoGetAlgoInfo(&aggInfo, collNetSupport, nvlsSupport, 1));
+    need[aggInfo.algorithm] = true;
+  }
+
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    if (need[a] && !comm->collConnected[a]) {
+      comm->collNeedConnect[a] = true;
+      *needConnect = true;
+    }
+  }
+  return ncclSuccess;
+}
+
 /* Compute nChannels and nThreads. */
 static ncclResult_t getChannnelThreadInfo(struct ncclInfo* collInfo) {
   struct ncclComm *comm = collInfo->comm;
@@ -1586,6 +3130,8 @@ static ncclResult_t getChannnelThreadInfo(struct ncclInfo* collInfo) {
       // NVLS should not need more than 16 channels to get peak BW.
       nc = comm->nvlsChannels;
     } else {
+      // Leave other comms running on the same links their share of them
+      if (comm->contentionLoad > 0) nc = std::max(1, (int)(nc / (1 + comm->contentionLoad) + 0.5f));
       // Ring/Tree channel tuning
       while (collInfo->nBytes < nc * nt * threadThreshold) {
         if (nc >= 2) nc--;
@@ -1596,6 +3142,10 @@ static ncclResult_t getChannnelThreadInfo(struct ncclInfo* collInfo) {
   } else {
     nc = collInfo->nChannels;
   }
+  // The group SM budget applies to tuned collectives as well.
+  if (comm->tasks.maxCTAs != 0 && nc > comm->tasks.maxCTAs) nc = collInfo->nChannels = comm->tasks.maxCTAs;
+  // So does our share of the SMs of the GPU, see NCCL_CONTENTION_SM_BUDGET.
+  if (comm->contentionChannels != 0 && nc > comm->contentionChannels) nc = collInfo->nChannels = comm->contentionChannels;
 
   if (collInfo->nThreads == 0) {
     if (collInfo->algorithm != NCCL_ALGO_NVLS && collInfo->algorithm != NCCL_ALGO_NVLS_TREE &&
@@ -1607,9 +3157,11 @@ static ncclResult_t getChannnelThreadInfo(struct ncclInfo* collInfo) {
     }
 
     if (collInfo->protocol == NCCL_PROTO_SIMPLE) {
-      if (collInfo->algorithm == NCCL_ALGO_RING) nt += WARP_SIZE; // Extra warp for sync
+      if (collInfo->algorithm == NCCL_ALGO_RING || collInfo->algorithm == NCCL_ALGO_RING_SCATTER ||
+          collInfo->algorithm == NCCL_ALGO_RECDBL) nt += WARP_SIZE; // Extra warp for sync
       // More threads or sync warps needed due to split thread model
       if (collInfo->algorithm == NCCL_ALGO_TREE) nt += 4*WARP_SIZE;
+      if (collInfo->algorithm == NCCL_ALGO_HIER) nt += 2*WARP_SIZE;
     }
     nt = nt / WARP_SIZE < 3 ? 3 * WARP_SIZE : nt;
     collInfo->nThreads = nt;
@@ -1621,14 +3173,21 @@ static ncclResult_t getChannnelThreadInfo(struct ncclInfo* collInfo) {
 static ncclResult_t getPatternInfo(struct ncclInfo* collInfo) {
   switch (collInfo->coll) {
     case ncclFuncBroadcast:
-      collInfo->pattern = collInfo->algorithm == NCCL_ALGO_TREE ? ncclPatternTreeDown : ncclPatternPipelineFrom; break;
+      collInfo->pattern =
+        collInfo->algorithm == NCCL_ALGO_TREE ? ncclPatternTreeDown :
+        collInfo->algorithm == NCCL_ALGO_RING_SCATTER ? ncclPatternRingScatter :
+        ncclPatternPipelineFrom; break;
     case ncclFuncReduce:
-      collInfo->pattern = collInfo->algorithm == NCCL_ALGO_TREE ? ncclPatternTreeUp : ncclPatternPipelineTo; break;
+      collInfo->pattern =
+        collInfo->algorithm == NCCL_ALGO_TREE ? ncclPatternTreeUp :
+        collInfo->algorithm == NCCL_ALGO_RING_SCATTER ? ncclPatternRingScatter :
+        ncclPatternPipelineTo; break;
     case ncclFuncReduceScatter:
     case ncclFuncAllGather:
       collInfo->pattern =
         collInfo->algorithm == NCCL_ALGO_NVLS ? ncclPatternNvls :
         collInfo->algorithm == NCCL_ALGO_COLLNET_DIRECT ? ncclPatternCollnetDirect :
+        collInfo->algorithm == NCCL_ALGO_HIER ? ncclPatternHier :
         ncclPatternRing; break;
     case ncclFuncAllReduce:
       collInfo->pattern =
@@ -1637,6 +3196,8 @@ static ncclResult_t getPatternInfo(struct ncclInfo* collInfo) {
         collInfo->algorithm == NCCL_ALGO_COLLNET_DIRECT ? ncclPatternCollnetDirect :
         collInfo->algorithm == NCCL_ALGO_COLLNET_CHAIN ? ncclPatternCollnetChain :
         collInfo->algorithm == NCCL_ALGO_TREE ? ncclPatternTreeUpDown :
+        collInfo->algorithm == NCCL_ALGO_HIER ? ncclPatternHier :
+        collInfo->algorithm == NCCL_ALGO_RECDBL ? ncclPatternRecDbl :
         ncclPatternRingTwice; break;
     default:
       WARN("Unknown pattern for collective %d algorithm %d", collInfo->coll, collInfo->algorithm);
@@ -1661,6 +3222,10 @@ static ncclResult_t initCollWorkElem(struct ncclInfo* collInfo, struct ncclWorkE
   work->chunkCount = collInfo->chunkCount;
   work->regUsed = 0;
   work->isUsed = 1;
+  work->netReg = 0;
+  work->castInput = collInfo->castInput;
+  work->castOutput = collInfo->castOutput;
+  work->castBf16 = collInfo->castType == ncclBfloat16;
 
   if (collInfo->comm->nNodes == 1)
     work->oneNode = 1;
@@ -1718,15 +3283,20 @@ static ncclResult_t initCollWorkElemReg(struct ncclComm* comm, struct ncclWorkEl
 }
 
 NCCL_PARAM(NvlsTreeMaxChunkSize, "NVLSTREE_MAX_CHUNKSIZE", -2);
+NCCL_PARAM(CollNetPipelineDepth, "COLLNET_PIPELINE_DEPTH", -2);
+NCCL_PARAM(ChunkSizeModel, "CHUNK_SIZE_MODEL", 0);
 
 static ncclResult_t computeCollChunkInfo(struct ncclInfo* collInfo, size_t nBytes, int nChannels) {
   int stepSize = collInfo->comm->buffSizes[collInfo->protocol] / NCCL_STEPS;
-  int chunkSteps = (collInfo->protocol == NCCL_PROTO_SIMPLE && collInfo->algorithm == NCCL_ALGO_RING) ? collInfo->chunkSteps : 1;
-  int sliceSteps = (collInfo->protocol == NCCL_PROTO_SIMPLE && collInfo->algorithm == NCCL_ALGO_RING) ? collInfo->sliceSteps : 1;
+  bool ringSteps = collInfo->algorithm == NCCL_ALGO_RING || collInfo->algorithm == NCCL_ALGO_HIER || collInfo->algorithm == NCCL_ALGO_RING_SCATTER;
+  int chunkSteps = (collInfo->protocol == NCCL_PROTO_SIMPLE && ringSteps) ? collInfo->chunkSteps : 1;
+  int sliceSteps = (collInfo->protocol == NCCL_PROTO_SIMPLE && ringSteps) ? collInfo->sliceSteps : 1;
   int chunkSize = stepSize * chunkSteps;
 
   if (collInfo->protocol == NCCL_PROTO_LL) chunkSize /= 2;
   if (collInfo->protocol == NCCL_PROTO_LL128) chunkSize = (chunkSize / NCCL_LL128_LINEELEMS) * NCCL_LL128_DATAELEMS;
+  // Largest chunk the connection buffers can hold
+  int maxChunkSize = chunkSize;
 
   if (collInfo->algorithm == NCCL_ALGO_COLLNET_DIRECT) {
     // Optimize chunkSize / nSteps
@@ -1765,6 +3335,47 @@ static ncclResult_t computeCollChunkInfo(struct ncclInfo* collInfo, size_t nByte
     float nstepsLL128 = 1+log2i(nNodes) + 0.1*ppn;
     while (nBytes / (nChannels*chunkSize) < nstepsLL128*64/ppn && chunkSize > 131072) chunkSize /= 2;
     while (nBytes / (nChannels*chunkSize) < nstepsLL128*16/ppn && chunkSize > 32768) chunkSize /= 2;
+  } else if (ncclParamChunkSizeModel() && collInfo->protocol == NCCL_PROTO_SIMPLE &&
+             (collInfo->algorithm == NCCL_ALGO_RING || collInfo->algorithm == NCCL_ALGO_TREE) && collInfo->coll < NCCL_NUM_FUNCTIONS) {
+    // A chunk goes through P pipeline stages of latency L and bandwidth B while
+    // each stage moves S bytes, so chunks of c bytes take (S/c + P-1) * (L + c/B),
+    // which is lowest for c = sqrt(S*L*B/(P-1)). Only shrink the chunk, down to 32K.
+    struct ncclComm* comm = collInfo->comm;
+    int coll = collInfo->coll, a = collInfo->algorithm;
+    float stages = comm->pipeStages[coll][a];
+    float lat = comm->stageLatencies[coll][a][NCCL_PROTO_SIMPLE];
+    float bw = comm->stageBandwidths[coll][a][NCCL_PROTO_SIMPLE] * 1e3; // bytes/us
+    if (stages > 1 && lat > 0 && bw > 0) {
+      // Rings move one chunk per rank each loop, except for Broadcast and Reduce
+      double stageBytes = (double)nBytes / nChannels;
+      if (a == NCCL_ALGO_RING && coll != ncclFuncBroadcast && coll != ncclFuncReduce) stageBytes /= comm->nRanks;
+      double bestChunkSize = sqrt(stageBytes * lat * bw / (stages-1));
+      while (chunkSize/2 >= bestChunkSize && chunkSize/2 >= 32768) chunkSize /= 2;
+    }
+  }
+
+  struct ncclComm* comm = collInfo->comm;
+  if (collInfo->algorithm == NCCL_ALGO_NVLS || collInfo->algorithm == NCCL_ALGO_NVLS_TREE) maxChunkSize = comm->nvlsChunkSize;
+  if (comm->tuner != nullptr && comm->tuner->getChunkSize != nullptr) {
+    size_t tunerChunkSize = chunkSize;
+    ncclResult_t ret = comm->tuner->getChunkSize(comm->tunerContext, collInfo->coll, nBytes,
+        collInfo->algorithm, collInfo->protocol, nChannels, &tunerChunkSize);
+    if (ret != ncclSuccess) {
+      INFO(NCCL_TUNING, "Tuner plugin %s getChunkSize returned %d, using default chunk size", comm->tuner->name, ret);
+    } else if (tunerChunkSize != (size_t)chunkSize) {
+      tunerChunkSize = std::min(tunerChunkSize, (size_t)maxChunkSize) & ~(size_t)15;
+      if (tunerChunkSize > 0) chunkSize = tunerChunkSize;
+    }
+  }
+
+  // Number of network reductions each CollNet connection keeps in flight. By
+  // default half of the steps go to the network, leaving the other half for the
+  // GPU to reduce the next chunks into.
+  collInfo->collnetDepth = 0;
+  if (collInfo->algorithm == NCCL_ALGO_COLLNET_DIRECT || collInfo->algorithm == NCCL_ALGO_COLLNET_CHAIN) {
+    int depth = ncclParamCollNetPipelineDepth();
+    if (depth == -2) depth = NCCL_STEPS/2;
+    collInfo->collnetDepth = std::min(std::max(depth, 1), NCCL_STEPS);
   }
 
   collInfo->chunkSize = chunkSize;
@@ -1780,6 +3391,7 @@ static ncclResult_t initCollProxyOp(struct ncclInfo* collInfo, int channelId, ui
   proxyOp->sliceSteps = collInfo->sliceSteps;
   proxyOp->chunkSteps = collInfo->chunkSteps;
   proxyOp->chunkSize = collInfo->chunkSize;
+  proxyOp->collnetDepth = collInfo->collnetDepth;
   proxyOp->protocol = collInfo->protocol;
   proxyOp->dtype = collInfo->datatype;
   // Network sees avg as sum
@@ -1787,6 +3399,7 @@ static ncclResult_t initCollProxyOp(struct ncclInfo* collInfo, int channelId, ui
   proxyOp->pattern = collInfo->pattern;
   proxyOp->coll = collInfo->coll;
   proxyOp->root = collInfo->root;
+  proxyOp->profile = collInfo->profile;
   // This is used by P2P to reduce the receive buffer size. We don't use it in collectives
   // because some protocols need to transmit more than the total size, plus they sometimes
   // round up
@@ -1806,6 +3419,7 @@ static ncclResult_t initCollProxyOp(struct ncclInfo* collInfo, int channelId, ui
   proxyOp->channelId = channelId;
   proxyOp->opCount = opCount;
 
+  memset(&proxyOp->specifics, 0, sizeof(proxyOp->specifics));
   if (collInfo->pattern == ncclPatternCollnetDirect) {
     proxyOp->specifics.collnetDirect.nNodes = collInfo->comm->nNodes;
     proxyOp->specifics.collnetDirect.node = collInfo->comm->node;
@@ -1816,6 +3430,20 @@ static ncclResult_t initCollProxyOp(struct ncclInfo* collInfo, int channelId, ui
   return ncclSuccess;
 }
 
+// Give the network proxy the layout of the ring steps so that it can find them
+// in the output buffer.
+static ncclResult_t setCollProxyOpNetReg(struct ncclInfo* collInfo, int channelId, struct ncclWorkElem* workElem, struct ncclProxyOp* proxyOp) {
+  struct ncclComm* comm = collInfo->comm;
+  proxyOp->recvbuff = (uint8_t*)collInfo->recvbuff;
+  proxyOp->specifics.ringReg.userRanks = comm->channels[channelId].ring.userRanks;
+  proxyOp->specifics.ringReg.nRanks = comm->nRanks;
+  proxyOp->specifics.ringReg.rankCount = collInfo->count;
+  proxyOp->specifics.ringReg.workOffset = workElem->workOffset;
+  proxyOp->specifics.ringReg.workCount = workElem->workCount;
+  proxyOp->specifics.ringReg.chunkCount = workElem->chunkCount;
+  return ncclSuccess;
+}
+
 static ncclResult_t hostToDevRedOp(
     ncclDevRedOpFull *opFull, ncclRedOp_t op, ncclDataType_t datatype, ncclComm *comm
   ) {
@@ -1827,6 +3455,9 @@ static ncclResult_t hostToDevRedOp(
     #if defined(__CUDA_BF16_TYPES_EXIST__)
       __nv_bfloat16 bf16;
     #endif
+    #if defined(__CUDA_FP8_TYPES_EXIST__)
+      __nv_fp8_e4m3 f8e4m3; __nv_fp8_e5m2 f8e5m2;
+    #endif
     void *ptr;
   };
   u64 = 0;
@@ -1868,6 +3499,16 @@ static ncclResult_t hostToDevRedOp(
       bf16 = __float2bfloat16(float(1.0/comm->nRanks));
       break;
     #endif
+    #if defined(__CUDA_FP8_TYPES_EXIST__)
+    case ncclFloat8e4m3:
+      opFull->op = ncclDevPreMulSum;
+      f8e4m3 = __nv_fp8_e4m3(float(1.0/comm->nRanks));
+      break;
+    case ncclFloat8e5m2:
+      opFull->op = ncclDevPreMulSum;
+      f8e5m2 = __nv_fp8_e5m2(float(1.0/comm->nRanks));
+      break;
+    #endif
     case ncclFloat32:
       opFull->op = ncclDevPreMulSum;
       f32 = float(1.0/comm->nRanks);
@@ -1907,58 +3548,154 @@ static int collCmp(struct ncclInfo *a, struct ncclInfo *b) {
     return -1;
 }
 
+// Sorting on insertion is quadratic in the number of collectives of the group,
+// so they are queued in call order and sorted once before scheduling.
+ncclResult_t ncclCollSortTasks(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  if (tasks->sorted) return ncclSuccess;
+  ncclIntruQueueSort(&tasks->collQueue, collCmp);
+  tasks->sorted = true;
+  return ncclSuccess;
+}
+
+NCCL_PARAM(ProfileSample, "PROFILE_SAMPLE", 1);
+NCCL_PARAM(ProfileSampleMinBytes, "PROFILE_SAMPLE_MIN_BYTES", 0);
+
+// Whether an operation of nBytes gets the proxy, network and device timelines
+// recorded: one in NCCL_PROFILE_SAMPLE operations of at least
+// NCCL_PROFILE_SAMPLE_MIN_BYTES, none if NCCL_PROFILE_SAMPLE<=0. The choice is
+// made once here and carried by the work and proxy ops, unsampled operations
+// only pay a branch where events are recorded.
+static bool profileSampled(struct ncclComm* comm, size_t nBytes) {
+  int64_t every = ncclParamProfileSample();
+  if (every <= 0 || nBytes < (size_t)ncclParamProfileSampleMinBytes()) return false;
+  return comm->profileSampleCount++ % every == 0;
+}
+
+// Queues one send or recv to `peer` and marks the p2p channels it will use
+// for pre-connection. Caller must have joined the thread local group.
+static ncclResult_t p2pTaskAppend(struct ncclComm* comm, bool isSendNotRecv, int peer, void* buff, size_t nBytes, int reg, bool profile,
+    const size_t* devCount = nullptr, int eltSize = 0, bool batched = false) {
+  ncclTasks *tasks = &comm->tasks;
+  struct ncclTaskP2p* p2p = ncclMemoryStackAlloc<struct ncclTaskP2p>(&comm->memScoped);
+  p2p->buff = buff;
+  p2p->bytes = nBytes;
+  p2p->chunk = 0;
+  p2p->reg = reg;
+  p2p->devCount = devCount;
+  p2p->eltSize = eltSize;
+  p2p->ipcReg = -1;
+  p2p->ipcRemote = nullptr;
+  p2p->profile = profile;
+  p2p->batched = batched;
+  ncclIntruQueueEnqueue(
+    isSendNotRecv ? &tasks->peers[peer].sendQueue : &tasks->peers[peer].recvQueue,
+    p2p);
+  tasks->nTasksP2p += 1;
+  int step = isSendNotRecv ? tasks->p2pSendStep[peer] : tasks->p2pRecvStep[peer];
+  if (!tasks->p2pStepActive[step]) {
+    tasks->p2pStepActive[step] = true;
+    tasks->p2pActiveSteps[tasks->nP2pActiveSteps++] = step;
+  }
+
+  // Mark channels that need pre-connect
+  if (comm->rank != peer) {
+    int channelBaseId;
+    NCCLCHECK(ncclChannelComputeBase(comm, peer, isSendNotRecv ? ncclFuncSend : ncclFuncRecv, &channelBaseId));
+    if (!(isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen)) {
+      (isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen) = true;
+      for (int c=0; c < comm->p2pnChannelsPerPeer; c++) {
+        int channelId;
+        NCCLCHECK(ncclChannelComputeFromBase(comm, channelBaseId, c, &channelId));
+        if (isSendNotRecv) {
+          if (comm->channels[channelId].peers[peer]->send[1].connected == 0) { // P2P uses only 1 connector
+            comm->connectSend[peer] |= (1UL<<channelId);
+            ncclGroupCommPreconnect(comm);
+          }
+        } else {
+          if (comm->channels[channelId].peers[peer]->recv[1].connected == 0) { // P2P uses only 1 connector
+            comm->connectRecv[peer] |= (1UL<<channelId);
+            ncclGroupCommPreconnect(comm);
+          }
+        }
+      }
+    }
+  }
+  return ncclSuccess;
+}
+
 // Converts `info` to a task and adds it to `comm->tasks`. The exception is with
 // single rank communicators, collectives are issued as `ncclMemcpyAsync`s and
 // thus don't need a task.
-static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo* info) {
+static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo* info, bool opConverted = false) {
   ncclTasks *tasks = &comm->tasks;
 
-  if (info->count == 0 && info->coll != ncclFuncSend && info->coll != ncclFuncRecv) return ncclSuccess;
+  if (info->count == 0 && info->coll != ncclFuncSend && info->coll != ncclFuncRecv && info->sendcounts == nullptr) return ncclSuccess;
   if (info->coll == ncclFuncSend || info->coll == ncclFuncRecv) {
-    int peer = info->root;
     ssize_t nBytes = info->count*ncclTypeSize(info->datatype);
-    bool isSendNotRecv = info->coll == ncclFuncSend;
-
     // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
     ncclGroupCommJoin(info->comm);
-    struct ncclTaskP2p* p2p = ncclMemoryStackAlloc<struct ncclTaskP2p>(&comm->memScoped);
-    p2p->buff = (void*)info->recvbuff;
-    p2p->bytes = nBytes;
-    p2p->chunk = 0;
-    ncclIntruQueueEnqueue(
-      isSendNotRecv ? &tasks->peers[peer].sendQueue : &tasks->peers[peer].recvQueue,
-      p2p);
-    tasks->nTasksP2p += 1;
-
-    // Mark channels that need pre-connect
-    if (comm->rank != peer) {
-      int channelBaseId;
-      NCCLCHECK(ncclChannelComputeBase(comm, peer, info->coll, &channelBaseId));
-      if (!(isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen)) {
-        (isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen) = true;
-        for (int c=0; c < comm->p2pnChannelsPerPeer; c++) {
-          int channelId;
-          NCCLCHECK(ncclChannelComputeFromBase(comm, channelBaseId, c, &channelId));
-          if (isSendNotRecv) {
-            if (comm->channels[channelId].peers[peer]->send[1].connected == 0) { // P2P uses only 1 connector
-              comm->connectSend[peer] |= (1UL<<channelId);
-              ncclGroupCommPreconnect(comm);
-            }
-          } else {
-            if (comm->channels[channelId].peers[peer]->recv[1].connected == 0) { // P2P uses only 1 connector
-              comm->connectRecv[peer] |= (1UL<<channelId);
-              ncclGroupCommPreconnect(comm);
-            }
-          }
-        }
+    // Registered buffers are moved whole by the network proxy, which doesn't
+    // see device counts, so those always go through the staging buffers.
+    NCCLCHECK(p2pTaskAppend(comm, info->coll == ncclFuncSend, info->root, info->recvbuff, nBytes, /*reg=*/info->devCount ? 0 : -1,
+                            profileSampled(comm, nBytes), info->devCount, ncclTypeSize(info->datatype)));
+  } else if (info->coll == ncclFuncAllToAll) {
+    size_t typeSize = ncclTypeSize(info->datatype);
+    size_t sendElts = comm->nRanks*info->count, recvElts = comm->nRanks*info->count;
+    if (info->sendcounts) {
+      sendElts = recvElts = 0;
+      for (int r=0; r<comm->nRanks; r++) {
+        sendElts = std::max(sendElts, info->sdispls[r] + info->sendcounts[r]);
+        recvElts = std::max(recvElts, info->rdispls[r] + info->recvcounts[r]);
       }
     }
+    // Look up registration once for the whole buffers rather than for every
+    // chunk of every peer. If the whole range isn't covered, fall back to
+    // per-chunk lookups at schedule time.
+    int sendReg = -1, recvReg = -1;
+    struct ncclReg* regRecord;
+    NCCLCHECK(ncclRegFind(comm, info->sendbuff, sendElts*typeSize, &regRecord));
+    if (regRecord && regRecord->nDevs) sendReg = regRecord->netPtrType == NCCL_PTR_HOST ? 2 : 1;
+    NCCLCHECK(ncclRegFind(comm, info->recvbuff, recvElts*typeSize, &regRecord));
+    if (regRecord && regRecord->nDevs) recvReg = regRecord->netPtrType == NCCL_PTR_HOST ? 2 : 1;
+
+    bool profile = profileSampled(comm, std::max(sendElts, recvElts)*typeSize);
+
+    // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
+    ncclGroupCommJoin(info->comm);
+    for (int r=0; r<comm->nRanks; r++) {
+      size_t sendCount = info->sendcounts ? info->sendcounts[r] : info->count;
+      size_t recvCount = info->sendcounts ? info->recvcounts[r] : info->count;
+      size_t sendOff = info->sendcounts ? info->sdispls[r] : r*info->count;
+      size_t recvOff = info->sendcounts ? info->rdispls[r] : r*info->count;
+      // Matching counts are zero on the peer too, so empty directions can be skipped.
+      if (sendCount) NCCLCHECK(p2pTaskAppend(comm, true, r, (char*)const_cast<void*>(info->sendbuff) + sendOff*typeSize, sendCount*typeSize, sendReg, profile, nullptr, 0, /*batched=*/true));
+      if (recvCount) NCCLCHECK(p2pTaskAppend(comm, false, r, (char*)info->recvbuff + recvOff*typeSize, recvCount*typeSize, recvReg, profile, nullptr, 0, /*batched=*/true));
+    }
+  } else if (info->coll == ncclFuncGather || info->coll == ncclFuncScatter) {
+    // Direct Gather/Scatter: one transfer between the root and each rank (the root's
+    // own block being a local copy), spread over channels and ordered by the p2p schedule.
+    bool gather = info->coll == ncclFuncGather;
+    size_t bytes = info->count*ncclTypeSize(info->datatype);
+    bool profile = profileSampled(comm, comm->nRanks*bytes);
+    char* rootBuff = gather ? (char*)info->recvbuff : (char*)const_cast<void*>(info->sendbuff);
+    char* rankBuff = gather ? (char*)const_cast<void*>(info->sendbuff) : (char*)info->recvbuff;
+    // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
+    ncclGroupCommJoin(info->comm);
+    if (comm->rank == info->root) {
+      for (int r=0; r<comm->nRanks; r++) NCCLCHECK(p2pTaskAppend(comm, !gather, r, rootBuff + r*bytes, bytes, -1, profile));
+    }
+    NCCLCHECK(p2pTaskAppend(comm, gather, info->root, rankBuff, bytes, -1, profile));
   } else {
     // Copy reduction op state from op handle into info struct here since the
     // op handle may be destroyed before ncclGroupEnd().
-    NCCLCHECK(hostToDevRedOp(&info->opFull, info->op, info->datatype, comm));
+    if (!opConverted) NCCLCHECK(hostToDevRedOp(&info->opFull, info->op, info->datatype, comm));
 
-    if (comm->nRanks == 1) {
+    if (comm->nRanks == 1 && (info->castInput || info->castOutput)) {
+      WARN("%s with a cast between float and %s is not supported on a single rank communicator", info->opName,
+           info->castType == ncclBfloat16 ? "bfloat16" : "half");
+      return ncclInvalidUsage;
+    } else if (comm->nRanks == 1) {
       NCCLCHECK(ncclLaunchOneRank(info->recvbuff, info->sendbuff, info->count, info->opFull, info->datatype, info->stream));
       return ncclSuccess;
     } else {
@@ -1970,8 +3707,13 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo* info) {
       info->algorithm = NCCL_ALGO_UNDEF;
       info->protocol = NCCL_PROTO_UNDEF;
       info->userTuned = false;
+      info->autotuned = false;
+      info->autotuneCand = -1;
+      info->nFusedSegments = 0;
+      info->profile = profileSampled(comm, info->count*ncclTypeSize(info->datatype));
       memcpy(t, info, sizeof(struct ncclInfo));
-      ncclIntruQueueSortEnqueue(&tasks->collQueue, t, collCmp);
+      ncclIntruQueueEnqueue(&tasks->collQueue, t);
+      tasks->sorted = false;
       tasks->workBytesTotal += info->count * ncclTypeSize(info->datatype);
       tasks->nTasksColl += 1;
     }
@@ -2004,10 +3746,99 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo* info) {
   return ncclSuccess;
 }
 
+/* Thread-safe communicators (NCCL_COMM_THREAD_SAFE=1)
+ *
+ * comm->tasks and the launch state of a communicator are not protected, so
+ * calls on a thread-safe communicator are first staged in a list of the
+ * calling thread. When that thread's outermost group ends, it takes the
+ * enqueueLock of the communicators it staged for, appends its tasks in call
+ * order and launches them, then releases the locks in ncclEnqueueStagedRelease.
+ * Threads only wait on each other while one of them launches on a shared
+ * communicator, and the operations of a thread (hence of a stream used by a
+ * single thread) keep their order.
+ */
+static __thread struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> ncclStagedTasks;
+static __thread struct ncclComm* ncclStagedLockedComms[NCCL_MAX_STAGED_COMMS];
+static __thread int ncclStagedNLockedComms;
+
+static ncclResult_t taskStage(struct ncclComm* comm, struct ncclInfo* info) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclInfo* t;
+  NCCLCHECK(ncclCalloc(&t, 1));
+  memcpy(t, info, sizeof(struct ncclInfo));
+  t->next = nullptr;
+  if (info->sendcounts) {
+    // The arrays may be reused by the caller once the call returned
+    size_t* arrays;
+    int n = comm->nRanks;
+    NCCLCHECKGOTO(ncclCalloc(&arrays, 4*n), ret, fail);
+    memcpy(arrays, info->sendcounts, n*sizeof(size_t));
+    memcpy(arrays+n, info->sdispls, n*sizeof(size_t));
+    memcpy(arrays+2*n, info->recvcounts, n*sizeof(size_t));
+    memcpy(arrays+3*n, info->rdispls, n*sizeof(size_t));
+    t->sendcounts = arrays;
+    t->sdispls = arrays+n;
+    t->recvcounts = arrays+2*n;
+    t->rdispls = arrays+3*n;
+  }
+  if (info->coll != ncclFuncSend && info->coll != ncclFuncRecv && info->coll != ncclFuncAllToAll &&
+      info->coll != ncclFuncGather && info->coll != ncclFuncScatter) {
+    // Same as taskAppend: the op handle may be destroyed before ncclGroupEnd()
+    NCCLCHECKGOTO(hostToDevRedOp(&t->opFull, t->op, t->datatype, comm), ret, fail);
+  }
+  ncclIntruQueueEnqueue(&ncclStagedTasks, t);
+  return ncclSuccess;
+fail:
+  free(const_cast<size_t*>(t->sendcounts));
+  free(t);
+  return ret;
+}
+
+ncclResult_t ncclEnqueueStagedFlush() {
+  if (ncclIntruQueueEmpty(&ncclStagedTasks)) return ncclSuccess;
+  // Lock in address order so that threads sharing several communicators
+  // never wait on each other in a cycle.
+  struct ncclComm** locked = ncclStagedLockedComms;
+  int nLocked = 0;
+  for (struct ncclInfo* t = ncclIntruQueueHead(&ncclStagedTasks); t; t = t->next) {
+    if (std::find(locked, locked+nLocked, t->comm) != locked+nLocked) continue;
+    if (nLocked == NCCL_MAX_STAGED_COMMS) {
+      WARN("Group uses more than %d thread-safe communicators", NCCL_MAX_STAGED_COMMS);
+      return ncclInvalidUsage;
+    }
+    locked[nLocked++] = t->comm;
+  }
+  std::sort(locked, locked+nLocked);
+  for (int c=0; c < nLocked; c++) {
+    pthread_mutex_lock(&locked[c]->enqueueLock);
+    ncclStagedNLockedComms = c+1;
+  }
+  while (!ncclIntruQueueEmpty(&ncclStagedTasks)) {
+    struct ncclInfo* t = ncclIntruQueueDequeue(&ncclStagedTasks);
+    ncclResult_t ret = taskAppend(t->comm, t, /*opConverted=*/true);
+    free(const_cast<size_t*>(t->sendcounts));
+    free(t);
+    NCCLCHECK(ret);
+  }
+  return ncclSuccess;
+}
+
+void ncclEnqueueStagedRelease() {
+  while (!ncclIntruQueueEmpty(&ncclStagedTasks)) {
+    struct ncclInfo* t = ncclIntruQueueDequeue(&ncclStagedTasks);
+    free(const_cast<size_t*>(t->sendcounts));
+    free(t);
+  }
+  for (int c=0; c < ncclStagedNLockedComms; c++) pthread_mutex_unlock(&ncclStagedLockedComms[c]->enqueueLock);
+  ncclStagedNLockedComms = 0;
+}
+
 ncclResult_t ncclEnqueueCheck(struct ncclInfo* info) {
+  uint64_t t0 = clockNano();
   NCCLCHECK(ncclGroupStartInternal());
   ncclResult_t ret = ncclSuccess;
   int devOld = -1;
+  bool counted = false;
 
   NCCLCHECKGOTO(CommCheck(info->comm, info->opName, "comm"), ret, fail);
   // Check whether communicator is ready to communicate
@@ -2024,12 +3855,28 @@ ncclResult_t ncclEnqueueCheck(struct ncclInfo* info) {
         info->datatype, info->op, info->root, info->comm, info->comm->nRanks, info->stream);
   TRACE_CALL("nccl%s(%" PRIx64 ",%" PRIx64 ",%zi,%d,%d,%d,%p,%p)", info->opName, reinterpret_cast<int64_t>(info->sendbuff), reinterpret_cast<int64_t>(info->recvbuff), info->count, info->datatype, info->op, info->root, info->comm, info->stream);
 
-  NCCLCHECKGOTO(taskAppend(info->comm, info), ret, fail);
+  if (info->comm->profiler && info->comm->profiler->collEnqueue) {
+    info->comm->profiler->collEnqueue(info->comm->profilerContext, info->comm->opCount, info->coll,
+        info->count, info->datatype, info->root, info->stream);
+  }
+
+  if (info->comm->threadSafe) {
+    NCCLCHECKGOTO(taskStage(info->comm, info), ret, fail);
+  } else {
+    NCCLCHECKGOTO(taskAppend(info->comm, info), ret, fail);
+  }
+  ncclStatsAdd(&info->comm->stats.funcOps[info->coll], 1);
+  ncclStatsAdd(&info->comm->stats.funcBytes[info->coll], info->count*ncclTypeSize(info->datatype));
+  counted = true;
 
 exit:
   if (devOld != -1) CUDACHECK(cudaSetDevice(devOld));
   ncclGroupErrCheck(ret);
   NCCLCHECK(ncclGroupEndInternal());
+  if (counted) {
+    ncclStatsAdd(&info->comm->stats.enqueueCalls, 1);
+    ncclStatsAdd(&info->comm->stats.enqueueNs, clockNano()-t0);
+  }
   /* if depth is 1, ncclGroupEndInternal() will trigger group ops. The state can change
    * so we have to check state here. */
   if (info->comm && !info->comm->config.blocking) { NCCLCHECK(ncclCommGetAsyncError(info->comm, &ret)) };
@@ -2039,10 +3886,73 @@ fail:
   goto exit;
 }
 
-NCCL_API(ncclResult_t, ncclRedOpCreatePreMulSum, ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm);
-ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm) {
-  NCCLCHECK(CommCheck(comm, "ncclRedOpCreatePreMulSum", "comm"));
-  /* join init thread before creating PreMulSum op. */
+// Marks the p2p channels to peer for connection, as p2pTaskAppend does
+static ncclResult_t p2pPreconnectMark(struct ncclComm* comm, bool isSendNotRecv, int peer, int nChannels) {
+  int channelBaseId;
+  NCCLCHECK(ncclChannelComputeBase(comm, peer, isSendNotRecv ? ncclFuncSend : ncclFuncRecv, &channelBaseId));
+  for (int c=0; c < nChannels; c++) {
+    int channelId;
+    NCCLCHECK(ncclChannelComputeFromBase(comm, channelBaseId, c, &channelId));
+    struct ncclChannelPeer* channelPeer = comm->channels[channelId].peers[peer];
+    if ((isSendNotRecv ? channelPeer->send[1].connected : channelPeer->recv[1].connected) == 0) {
+      (isSendNotRecv ? comm->connectSend : comm->connectRecv)[peer] |= (1UL<<channelId);
+      ncclGroupCommPreconnect(comm);
+    }
+  }
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommPreconnect, ncclComm_t comm, const int* sendPeers, int nSendPeers, const int* recvPeers, int nRecvPeers, int nChannels);
+ncclResult_t ncclCommPreconnect(ncclComm_t comm, const int* sendPeers, int nSendPeers, const int* recvPeers, int nRecvPeers, int nChannels) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(ncclGroupStartInternal());
+  ncclResult_t ret = ncclSuccess;
+
+  NCCLCHECKGOTO(CommCheck(comm, "CommPreconnect", "comm"), ret, fail);
+  NCCLCHECKGOTO(ncclCommEnsureReady(comm), ret, fail);
+  if (comm->threadSafe) {
+    WARN("ncclCommPreconnect: not supported on thread-safe communicators");
+    ret = ncclInvalidUsage;
+    goto fail;
+  }
+  if ((nSendPeers && sendPeers == NULL) || (nRecvPeers && recvPeers == NULL) || nSendPeers < 0 || nRecvPeers < 0 || nChannels < 0) {
+    WARN("ncclCommPreconnect: invalid arguments");
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+  for (int i=0; i<nSendPeers+nRecvPeers; i++) {
+    int peer = i < nSendPeers ? sendPeers[i] : recvPeers[i-nSendPeers];
+    if (peer < 0 || peer >= comm->nRanks) {
+      WARN("ncclCommPreconnect: invalid peer %d, nranks %d", peer, comm->nRanks);
+      ret = ncclInvalidArgument;
+      goto fail;
+    }
+  }
+  TRACE_CALL("ncclCommPreconnect(%p,%d,%d,%d)", comm, nSendPeers, nRecvPeers, nChannels);
+  if (nChannels == 0 || nChannels > comm->p2pnChannelsPerPeer) nChannels = comm->p2pnChannelsPerPeer;
+
+  // The connections are then set up by the preconnect job of the group, in
+  // the background for non-blocking communicators.
+  ncclGroupCommJoin(comm);
+  for (int i=0; i<nSendPeers; i++) {
+    if (sendPeers[i] != comm->rank) NCCLCHECKGOTO(p2pPreconnectMark(comm, true, sendPeers[i], nChannels), ret, fail);
+  }
+  for (int i=0; i<nRecvPeers; i++) {
+    if (recvPeers[i] != comm->rank) NCCLCHECKGOTO(p2pPreconnectMark(comm, false, recvPeers[i], nChannels), ret, fail);
+  }
+
+exit:
+  ncclGroupErrCheck(ret);
+  NCCLCHECK(ncclGroupEndInternal());
+  if (comm && !comm->config.blocking) { NCCLCHECK(ncclCommGetAsyncError(comm, &ret)) };
+  return ret;
+fail:
+  if (comm && !comm->config.blocking) (void) ncclCommSetAsyncError(comm, ret);
+  goto exit;
+}
+
+static ncclResult_t redOpCreateScalar(ncclRedOp_t *op, ncclDevRedOp_t devOp, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm) {
+  /* join init thread before creating the op. */
   NCCLCHECK(ncclCommEnsureReady(comm));
 
   if (comm->userRedOpFreeHead == comm->userRedOpCapacity) {
@@ -2064,7 +3974,7 @@ ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataTyp
 
   user->freeNext = -1; // allocated
   user->datatype = datatype;
-  user->opFull.op = ncclDevPreMulSum;
+  user->opFull.op = devOp;
   if (residence == ncclScalarHostImmediate) {
     user->opFull.scalarArgIsPtr = false;
     std::memcpy(&user->opFull.scalarArg, scalar, ncclTypeSize(datatype));
@@ -2074,10 +3984,30 @@ ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataTyp
   }
   *op = ncclRedOp_t(int(ncclNumOps) + ix);
   *op = ncclUserRedOpMangle(comm, *op);
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclRedOpCreatePreMulSum, ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm);
+ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm) {
+  NCCLCHECK(CommCheck(comm, "ncclRedOpCreatePreMulSum", "comm"));
+  NCCLCHECK(redOpCreateScalar(op, ncclDevPreMulSum, scalar, datatype, residence, comm));
   TRACE_CALL("ncclRedOpCreatePreMulSum(%d,%p,%d,%d,%p)", *op, scalar, datatype, residence, comm);
   return ncclSuccess;
 }
 
+NCCL_API(ncclResult_t, ncclRedOpCreatePostMulSum, ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm);
+ncclResult_t ncclRedOpCreatePostMulSum(ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm) {
+  NCCLCHECK(CommCheck(comm, "ncclRedOpCreatePostMulSum", "comm"));
+  if (!ncclTypeIsFloat(datatype)) {
+    WARN("ncclRedOpCreatePostMulSum : datatype %d is not a floating point type.", datatype);
+    return ncclInvalidArgument;
+  }
+  // Integer SumPostDiv divides, floating point SumPostDiv multiplies by the scalar.
+  NCCLCHECK(redOpCreateScalar(op, ncclDevSumPostDiv, scalar, datatype, residence, comm));
+  TRACE_CALL("ncclRedOpCreatePostMulSum(%d,%p,%d,%d,%p)", *op, scalar, datatype, residence, comm);
+  return ncclSuccess;
+}
+
 NCCL_API(ncclResult_t, ncclRedOpDestroy, ncclRedOp_t op, ncclComm_t comm);
 ncclResult_t ncclRedOpDestroy(ncclRedOp_t op, ncclComm_t comm) {
   if (0 <= int(op) && int(op) < int(ncclNumOps)) {
@@ -124,23 +124,41 @@ static ncclResult_t setTreeDown(struct ncclTree* tree, int* indexes, int d) {
   int x = 0;
   while (x < NCCL_MAX_TREE_ARITY && tree->down[x] >= 0) x++;
   if (x == NCCL_MAX_TREE_ARITY) {
-    WARN("Internal error : tree already has %d children (%d %d %d)", x, tree->down[0], tree->down[1], tree->down[2]);
+    WARN("Internal error : tree already has %d children (%d %d %d %d %d)", x, tree->down[0], tree->down[1], tree->down[2], tree->down[3], tree->down[4]);
     return ncclInternalError;
   }
   tree->down[x] = indexes[d];
   return ncclSuccess;
 }
 
+NCCL_PARAM(TreeRadix, "TREE_RADIX", 2);
+
 static ncclResult_t connectTrees(struct ncclComm* comm, int* treeToParent, int* treeToChild0, int* treeToChild1, int* treePatterns) {
   const int nChannels = comm->nChannels, nNodes = comm->nNodes, node = comm->node;
 
+  int radix = ncclParamTreeRadix();
+  if (radix < 2 || radix > NCCL_MAX_TREE_RADIX) {
+    WARN("NCCL_TREE_RADIX %d is out of range [2:%d], using %d", radix, NCCL_MAX_TREE_RADIX, radix < 2 ? 2 : NCCL_MAX_TREE_RADIX);
+    radix = radix < 2 ? 2 : NCCL_MAX_TREE_RADIX;
+  }
+  comm->treeRadix = radix;
+
   // Compute tree depth. Not an exact value but a good approximation in most
   // cases
-  int depth = comm->nRanks/nNodes - 1 + log2i(nNodes);
+  int depth = comm->nRanks/nNodes - 1 + (radix == 2 ? log2i(nNodes) : ncclGetKtreeDepth(nNodes, radix));
 
-  int t0u, t0d0, t0d1, t0ChildType, t1u, t1d0, t1d1, t1ChildType;
+  // Inter-node children of each tree. Binary trees attach child 0 and 1 to
+  // treeToChild0 and treeToChild1, k-ary trees alternate between them.
+  int t0u, t0d[NCCL_MAX_TREE_RADIX], t0ChildType, t1u, t1d[NCCL_MAX_TREE_RADIX], t1ChildType;
   int* ttp, *ttc0, *ttc1;
-  NCCLCHECK(ncclGetDtree(nNodes, node, &t0u, &t0d0, &t0d1, &t0ChildType, &t1u, &t1d0, &t1d1, &t1ChildType));
+  if (radix == 2) {
+    NCCLCHECK(ncclGetDtree(nNodes, node, &t0u, t0d, t0d+1, &t0ChildType, &t1u, t1d, t1d+1, &t1ChildType));
+  } else {
+    NCCLCHECK(ncclGetDKtree(nNodes, node, radix, &t0u, t0d, &t0ChildType, &t1u, t1d, &t1ChildType));
+    t0ChildType &= 1;
+    t1ChildType &= 1;
+    if (comm->rank == 0) INFO(NCCL_GRAPH, "Using %d-ary double tree", radix);
+  }
   for (int c=0; c<nChannels; c++) {
      struct ncclChannel* channel0 = comm->channels+c;
      struct ncclChannel* channel1 = channel0+nChannels;
@@ -151,19 +169,17 @@ static ncclResult_t connectTrees(struct ncclComm* comm, int* treeToParent, int*
        NCCLCHECK(setTreeUp(&channel0->tree, t0ChildType == 0 ? ttc0 : ttc1, t0u));
        NCCLCHECK(setTreeUp(&channel1->tree, t1ChildType == 0 ? ttc0 : ttc1, t1u));
      }
-     if (comm->rank == ttc0[node]) {
-       NCCLCHECK(setTreeDown(&channel0->tree, ttp, t0d0));
-       NCCLCHECK(setTreeDown(&channel1->tree, ttp, t1d0));
-     }
-     if (comm->rank == ttc1[node]) {
-       NCCLCHECK(setTreeDown(&channel0->tree, ttp, t0d1));
-       NCCLCHECK(setTreeDown(&channel1->tree, ttp, t1d1));
+     for (int i=0; i<radix; i++) {
+       if (comm->rank == (i%2 == 0 ? ttc0 : ttc1)[node]) {
+         NCCLCHECK(setTreeDown(&channel0->tree, ttp, t0d[i]));
+         NCCLCHECK(setTreeDown(&channel1->tree, ttp, t1d[i]));
+       }
      }
      if (comm->rank == ttp[node] ||
          comm->rank == ttc0[node] ||
          comm->rank == ttc1[node]) {
-       INFO(NCCL_GRAPH, "Tree %d : %d -> %d -> %d/%d/%d", c,           channel0->tree.up, comm->rank, channel0->tree.down[0], channel0->tree.down[1], channel0->tree.down[2]);
-       INFO(NCCL_GRAPH, "Tree %d : %d -> %d -> %d/%d/%d", c+nChannels, channel1->tree.up, comm->rank, channel1->tree.down[0], channel1->tree.down[1], channel1->tree.down[2]);
+       INFO(NCCL_GRAPH, "Tree %d : %d -> %d -> %d/%d/%d/%d/%d", c,           channel0->tree.up, comm->rank, channel0->tree.down[0], channel0->tree.down[1], channel0->tree.down[2], channel0->tree.down[3], channel0->tree.down[4]);
+       INFO(NCCL_GRAPH, "Tree %d : %d -> %d -> %d/%d/%d/%d/%d", c+nChannels, channel1->tree.up, comm->rank, channel1->tree.down[0], channel1->tree.down[1], channel1->tree.down[2], channel1->tree.down[3], channel1->tree.down[4]);
      }
      channel0->tree.depth = channel1->tree.depth = depth;
   }
@@ -335,7 +351,7 @@ int ncclMinNchannels() {
   return minNchannels;
 }
 int ncclMaxNchannels() {
-  int maxNchannels = MAXCHANNELS;
+  int maxNchannels = NCCL_DEFAULT_MAXCHANNELS;
   if (ncclParamMaxNrings() != -2) maxNchannels = ncclParamMaxNrings();
   if (ncclParamMaxNchannels() != -2) maxNchannels = ncclParamMaxNchannels();
   if (maxNchannels > MAXCHANNELS) maxNchannels = MAXCHANNELS;
@@ -424,6 +424,20 @@ ncclResult_t ncclTopoCheckGdr(struct ncclTopoSystem* system, int64_t busId, int6
 NCCL_PARAM(NetForceFlush, "NET_FORCE_FLUSH", 0);
 
 // Determine whether we need to flush the GDR recv buffers
+// Whether the GPU reaches the memory of its CPU through a coherent link
+// (C2C on Grace Hopper), so it can load and store host memory directly at
+// close to its own memory bandwidth.
+ncclResult_t ncclTopoGpuC2c(struct ncclTopoSystem* system, int64_t busId, int* c2c) {
+  *c2c = 0;
+  int g;
+  NCCLCHECK(ncclTopoIdToIndex(system, GPU, busId, &g));
+  struct ncclTopoNode* gpu = system->nodes[GPU].nodes+g;
+  for (int l=0; l<gpu->nlinks; l++) {
+    if (gpu->links[l].type == LINK_NVL && gpu->links[l].remNode->type == CPU) *c2c = 1;
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoNeedFlush(struct ncclTopoSystem* system, int64_t busId, int* flush) {
   int g;
   NCCLCHECK(ncclTopoIdToIndex(system, GPU, busId, &g));
@@ -509,6 +523,16 @@ int ncclPxnDisable(struct ncclComm* comm) {
   return pxnDisable;
 }
 
+// Route the p2p network sends of a GPU through the proxy of the GPU closest to
+// the NIC. Receives, like with PXN, stay on the proxy of the receiving GPU.
+NCCL_PARAM(ProxyShared, "PROXY_SHARED", 0);
+
+int ncclProxyShared(struct ncclComm* comm) {
+  return ncclPxnDisable(comm) != 1 && ncclParamProxyShared();
+}
+
+int64_t ncclParamP2pPxnStripe();
+
 ncclResult_t ncclTopoGetPxnRanks(struct ncclComm* comm, int** intermediateRanks, int* nranks) {
   struct ncclTopoSystem* system = comm->topo;
   *nranks = 0;
@@ -517,21 +541,35 @@ ncclResult_t ncclTopoGetPxnRanks(struct ncclComm* comm, int** intermediateRanks,
 
   int nr = 0;
   int* ranks = NULL;
+  // When striping, channels other than 0 may go through any intermediate GPU
+  // owning a NIC, so look at the NICs of all channels.
+  int nChannels = ncclParamP2pPxnStripe() ? system->nodes[NET].count : 1;
+  uint64_t seenDevs = 0;
   for (int rank=0; rank<comm->nRanks; rank++) {
-    int64_t netId;
-    int proxyRank;
-    NCCLCHECK(ncclTopoGetNetDev(comm, comm->rank, NULL, 0, rank, &netId, NULL, &proxyRank));
-    if (proxyRank == comm->rank) continue;
-    int useGdr;
-    NCCLCHECK(ncclTopoCheckGdr(comm->topo, comm->busId, netId, 1, &useGdr));
-    if (useGdr == 0) continue;
-    int found = 0;
-    for (int r=0; r<nr; r++) {
-      if (ranks[r] == proxyRank) found = 1;
-    }
-    if (!found) {
-      NCCLCHECK(ncclRealloc(&ranks, nr, nr+1));
-      ranks[nr++] = proxyRank;
+    if (nChannels > 1) {
+      // The NICs only depend on the device of the peer, skip devices already seen.
+      int nvmlDev = comm->peerInfo[rank].nvmlDev;
+      if (nvmlDev >= 0 && nvmlDev < 64) {
+        if (seenDevs & (1ULL << nvmlDev)) continue;
+        seenDevs |= 1ULL << nvmlDev;
+      }
+    }
+    for (int c=0; c<nChannels; c++) {
+      int64_t netId;
+      int proxyRank;
+      NCCLCHECK(ncclTopoGetNetDev(comm, comm->rank, NULL, c, rank, &netId, NULL, &proxyRank));
+      if (proxyRank == comm->rank) continue;
+      int useGdr;
+      NCCLCHECK(ncclTopoCheckGdr(comm->topo, comm->busId, netId, 1, &useGdr));
+      if (useGdr == 0) continue;
+      int found = 0;
+      for (int r=0; r<nr; r++) {
+        if (ranks[r] == proxyRank) found = 1;
+      }
+      if (!found) {
+        NCCLCHECK(ncclRealloc(&ranks, nr, nr+1));
+        ranks[nr++] = proxyRank;
+      }
     }
   }
   *nranks = nr;
@@ -689,8 +727,119 @@ void ncclTopoFree(struct ncclTopoSystem* system) {
   free(system);
 }
 
+// Deep copy of a system, so that searches which reserve bandwidth on links can
+// run concurrently. Links and paths point inside the system, rebase them.
+ncclResult_t ncclTopoDupSystem(struct ncclTopoSystem* system, struct ncclTopoSystem** copyPtr) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclTopoSystem* copy;
+  NCCLCHECK(ncclCalloc(&copy, 1));
+  memcpy(copy, system, sizeof(struct ncclTopoSystem));
+  char* base = (char*)system;
+  char* newBase = (char*)copy;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<copy->nodes[t].count; n++) {
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) copy->nodes[t].nodes[n].paths[p] = NULL;
+    }
+  }
+#define REBASE(type, ptr) ((type*)(newBase + ((char*)(ptr) - base)))
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<copy->nodes[t].count; n++) {
+      struct ncclTopoNode* node = copy->nodes[t].nodes+n;
+      for (int l=0; l<node->nlinks; l++) node->links[l].remNode = REBASE(struct ncclTopoNode, node->links[l].remNode);
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        struct ncclTopoLinkList* paths = system->nodes[t].nodes[n].paths[p];
+        if (paths == NULL) continue;
+        NCCLCHECKGOTO(ncclCalloc(node->paths+p, copy->nodes[p].count), ret, fail);
+        memcpy(node->paths[p], paths, copy->nodes[p].count*sizeof(struct ncclTopoLinkList));
+        for (int i=0; i<copy->nodes[p].count; i++) {
+          struct ncclTopoLinkList* path = node->paths[p]+i;
+          for (int h=0; h<path->count; h++) path->list[h] = REBASE(struct ncclTopoLink, path->list[h]);
+        }
+      }
+    }
+  }
+#undef REBASE
+  *copyPtr = copy;
+  return ncclSuccess;
+fail:
+  ncclTopoFree(copy);
+  return ret;
+}
+
+// A ncclCommSplit child which keeps every GPU of its parent's system, and
+// spans a single node only if its parent does, would build and trim the same
+// system. Copy the parent's one with the child ranks instead. Sets *system to
+// NULL when the child needs its own detection.
+ncclResult_t ncclTopoSplitSystem(struct ncclComm* comm, struct ncclComm* parent, struct ncclTopoSystem** system) {
+  struct ncclTopoSystem* parentSystem = parent->topo;
+  int ngpus = parentSystem->nodes[GPU].count;
+  int ranks[NCCL_TOPO_MAX_NODES];
+  *system = NULL;
+  if ((ngpus == parent->nRanks) != (ngpus == comm->nRanks)) return ncclSuccess;
+  for (int g=0; g<ngpus; g++) {
+    int tpRank = parent->topParentRanks[parentSystem->nodes[GPU].nodes[g].gpu.rank];
+    ranks[g] = -1;
+    for (int r=0; r<comm->nRanks; r++) {
+      if (comm->topParentRanks[r] == tpRank) { ranks[g] = r; break; }
+    }
+    if (ranks[g] == -1) return ncclSuccess;
+  }
+  NCCLCHECK(ncclTopoDupSystem(parentSystem, system));
+  for (int g=0; g<ngpus; g++) (*system)->nodes[GPU].nodes[g].gpu.rank = ranks[g];
+  return ncclSuccess;
+}
+
+// The same for a communicator created by ncclCommReconfigure from prev: when
+// the node keeps exactly the GPUs prev had on it, and spans a single node
+// only if prev did, copy prev's system. GPUs are matched by bus ID.
+ncclResult_t ncclTopoReuseSystem(struct ncclComm* comm, struct ncclComm* prev, struct ncclTopoSystem** system) {
+  struct ncclTopoSystem* prevSystem = prev->topo;
+  int ngpus = prevSystem->nodes[GPU].count;
+  int ranks[NCCL_TOPO_MAX_NODES];
+  int localRanks = 0;
+  uint64_t hostHash = comm->peerInfo[comm->rank].hostHash;
+  *system = NULL;
+  if ((ngpus == prev->nRanks) != (ngpus == comm->nRanks)) return ncclSuccess;
+  for (int r=0; r<comm->nRanks; r++) localRanks += comm->peerInfo[r].hostHash == hostHash ? 1 : 0;
+  if (localRanks != ngpus) return ncclSuccess;
+  for (int g=0; g<ngpus; g++) {
+    ranks[g] = -1;
+    for (int r=0; r<comm->nRanks; r++) {
+      if (comm->peerInfo[r].hostHash == hostHash && comm->peerInfo[r].busId == prevSystem->nodes[GPU].nodes[g].id) { ranks[g] = r; break; }
+    }
+    if (ranks[g] == -1) return ncclSuccess;
+  }
+  NCCLCHECK(ncclTopoDupSystem(prevSystem, system));
+  for (int g=0; g<ngpus; g++) (*system)->nodes[GPU].nodes[g].gpu.rank = ranks[g];
+  return ncclSuccess;
+}
+
+// Bandwidth of the path between the GPUs of two ranks, the smallest of both
+// directions so that both ranks get the same value.
+ncclResult_t ncclTopoGetGpuPathBw(struct ncclTopoSystem* system, int rank1, int rank2, float* bw, int* nvlink) {
+  int g1, g2;
+  NCCLCHECK(ncclTopoRankToIndex(system, rank1, &g1));
+  NCCLCHECK(ncclTopoRankToIndex(system, rank2, &g2));
+  struct ncclTopoLinkList* path12 = system->nodes[GPU].nodes[g1].paths[GPU]+g2;
+  struct ncclTopoLinkList* path21 = system->nodes[GPU].nodes[g2].paths[GPU]+g1;
+  *bw = std::min(path12->bw, path21->bw);
+  *nvlink = std::max(path12->type, path21->type) <= PATH_NVB ? 1 : 0;
+  return ncclSuccess;
+}
+
 NCCL_PARAM(NChannelsPerNetPeer, "NCHANNELS_PER_NET_PEER", -1);
 
+// Number of NICs GPU g can stripe a single p2p connection over, directly or
+// through PXN. The GPU does not push that traffic over its own PCI link, so it
+// is not limited by its PCI bandwidth.
+static int pxnStripeNetCount(struct ncclTopoSystem* system, int g) {
+  int count = 0;
+  for (int n=0; n<system->nodes[NET].count; n++) {
+    if (system->nodes[GPU].nodes[g].paths[NET][n].type <= PATH_PXN) count++;
+  }
+  return count;
+}
+
 static ncclResult_t ncclTopoGetNchannels(struct ncclComm* comm, int g /*local gpu index*/, int peerRank, int* nChannels) {
   int peer;
   struct ncclTopoSystem* system = comm->topo;
@@ -719,6 +868,7 @@ static ncclResult_t ncclTopoGetNchannels(struct ncclComm* comm, int g /*local gp
        // check if we need to use more than one NIC, hence more than one channel
        int netCountByBw = 1, nChannelsMax = nNetChannels;
        NCCLCHECK(getLocalNetCountByBw(system, g, &netCountByBw));
+       if (ncclParamP2pPxnStripe()) netCountByBw = std::max(netCountByBw, pxnStripeNetCount(system, g));
        // Avoid overloading channels with 8+ operations as we loose the sync warp, hence a bit of bandwidth.
        while (nChannelsMax*comm->nRanks > comm->p2pnChannels*4 && nChannelsMax > 1) nChannelsMax /= 2;
 
@@ -413,7 +413,10 @@ ncclResult_t ncclTopoSelectNets(struct ncclTopoSystem* system, int typeInter, in
       NCCLCHECK(ncclTopoGetLocalNet(system, gpu->gpu.rank, c, &netId, NULL));
       NCCLCHECK(ncclTopoIdToIndex(system, NET, netId, localNets+localNetCount));
       if (localNetCount > 0 && localNets[localNetCount] == localNets[0]) break;
-      localNetCount++;
+      // With NCCL_NET_WEIGHTED, faster NICs come back before the cycle ends
+      int seen = 0;
+      while (seen < localNetCount && localNets[seen] != localNets[localNetCount]) seen++;
+      if (seen == localNetCount) localNetCount++;
     }
     // Append NICs to list
     for (int i=0; i<localNetCount; i++) {
@@ -487,6 +490,8 @@ ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopo
         struct ncclTopoNode* net = system->nodes[NET].nodes+n;
         if (graph->pattern == NCCL_TOPO_PATTERN_TREE && net->id != startNet->id) continue; // Trees are symmetric
         if (graph->crossNic != 1 && (net->net.asic != startNet->net.asic || net->net.port != startNet->net.port)) continue;
+        // On rail-optimized fabrics, NICs only have full bandwidth to the NICs of the same rail
+        if (net->net.rail != startNet->net.rail) continue;
         if (graph->crossNic && (graph->nChannels & 1) && net->id != graph->inter[(graph->nChannels-1)*2]) continue;
 
         // Balanced Tree : count half of the bandwidth on first two GPUs
@@ -857,6 +862,277 @@ float sm90SpeedArrayInter[] = { 48.0, 45.0, 42.0, 40.0, 30.0, 24.0, 22.0, 20.0,
 #define NSPEEDSINTRA_SM90 (sizeof(sm90SpeedArrayIntra)/sizeof(float))
 #define NSPEEDSINTER_SM90 (sizeof(sm90SpeedArrayInter)/sizeof(float))
 
+// Graph cache (NCCL_GRAPH_CACHE_DIR). Search results only depend on the node
+// topology, the GPUs and NICs we kept, the paths between them and the search
+// parameters, so they can be replayed across restarts and sub-communicators.
+static uint64_t graphCacheHashCombine(uint64_t hash, const void* data, int n) {
+  return hash*31 + getHash((const char*)data, n);
+}
+
+static uint64_t graphCacheKey(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  int version = NCCL_VERSION_CODE;
+  uint64_t key = graphCacheHashCombine(system->xmlHash, &version, sizeof(version));
+  int params[] = { graph->id, graph->pattern, graph->collNet, graph->minChannels, graph->maxChannels, (int)ncclParamCrossNic() };
+  key = graphCacheHashCombine(key, params, sizeof(params));
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    if (t != GPU && t != NET) continue;
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      key = graphCacheHashCombine(key, &node->id, sizeof(node->id));
+      if (t == GPU) key = graphCacheHashCombine(key, &node->gpu.rank, sizeof(node->gpu.rank));
+      for (int r=0; r<NCCL_TOPO_NODE_TYPES; r++) {
+        if ((r != GPU && r != NET) || node->paths[r] == NULL) continue;
+        for (int i=0; i<system->nodes[r].count; i++) {
+          key = graphCacheHashCombine(key, &node->paths[r][i].type, sizeof(int));
+          key = graphCacheHashCombine(key, &node->paths[r][i].bw, sizeof(float));
+        }
+      }
+    }
+  }
+  return key;
+}
+
+static void graphCachePath(const char* dir, uint64_t key, char* path, int len) {
+  snprintf(path, len, "%s/nccl_graph_%016lx.xml", dir, key);
+}
+
+// Returns ncclSuccess with graph->nChannels == 0 on a miss, leaving graph untouched.
+static ncclResult_t graphCacheLoad(const char* path, struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  if (access(path, R_OK) != 0) return ncclSuccess;
+  ncclResult_t ret = ncclSuccess;
+  struct ncclXml* xml = NULL;
+  struct ncclTopoGraph* cached = NULL;
+  int nChannels = 0;
+  NCCLCHECKGOTO(xmlAlloc(&xml, NCCL_GRAPH_XML_MAX_NODES), ret, exit);
+  NCCLCHECKGOTO(ncclCalloc(&cached, 1), ret, exit);
+  memcpy(cached, graph, sizeof(struct ncclTopoGraph));
+  // A stale or damaged entry is not fatal, we'll just search again.
+  if (ncclTopoGetXmlGraphFromFile(path, xml) != ncclSuccess ||
+      ncclTopoGetGraphFromXml(xml->nodes, system, cached, &nChannels) != ncclSuccess) {
+    INFO(NCCL_GRAPH, "Ignoring graph cache entry %s", path);
+    goto exit;
+  }
+  if (cached->nChannels > 0) {
+    memcpy(graph, cached, sizeof(struct ncclTopoGraph));
+    INFO(NCCL_GRAPH, "Search %d : %d channels loaded from graph cache %s", graph->id, nChannels, path);
+  }
+exit:
+  free(cached);
+  free(xml);
+  return ret;
+}
+
+static ncclResult_t graphCacheSave(const char* path, struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  char tmpPath[PATH_MAX];
+  ncclResult_t ret = ncclSuccess;
+  struct ncclXml* xml;
+  NCCLCHECK(xmlAlloc(&xml, NCCL_GRAPH_XML_MAX_NODES));
+  NCCLCHECKGOTO(ncclTopoGetXmlFromGraphs(1, &graph, system, xml), ret, exit);
+  // Other ranks of the node may write the same entry, only publish complete files.
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.%lx", path, getpid(), (unsigned long)pthread_self());
+  NCCLCHECKGOTO(ncclTopoDumpXmlToFile(tmpPath, xml), ret, exit);
+  if (rename(tmpPath, path) != 0) {
+    INFO(NCCL_GRAPH, "Could not save graph cache entry %s : %s", path, strerror(errno));
+    unlink(tmpPath);
+  }
+exit:
+  free(xml);
+  return ret;
+}
+
+NCCL_PARAM(TopoSearchThreads, "TOPO_SEARCH_THREADS", 1);
+
+static int searchTimeout(struct ncclTopoGraph* tmpGraph) {
+  return tmpGraph->sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
+    tmpGraph->pattern == NCCL_TOPO_PATTERN_TREE ? NCCL_SEARCH_TIMEOUT_TREE : NCCL_SEARCH_TIMEOUT;
+}
+
+struct ncclTopoSearchPass {
+  struct ncclTopoSystem* system;
+  struct ncclTopoGraph* graph; // Best solution so far
+  int crossNic;
+  int trySameChannels;
+  int cpuArch, cpuVendor;
+  int ccMin;
+  int64_t globalTimeout;
+};
+
+// First pass at the speed set in tmpGraph: try the other search options in
+// turn, each change resetting the options tried before it. Sets done if the
+// solution is optimal or we ran out of time, in which case slower speeds
+// shouldn't be tried.
+static ncclResult_t ncclTopoSearchSpeed(struct ncclTopoSearchPass* pass, struct ncclTopoGraph* tmpGraph, int* done) {
+  struct ncclTopoSystem* system = pass->system;
+  struct ncclTopoGraph* graph = pass->graph;
+  int ngpus = system->nodes[GPU].count;
+  *done = 0;
+  while (1) {
+    int time = searchTimeout(tmpGraph);
+    tmpGraph->nChannels = 0;
+    pass->globalTimeout -= time;
+
+    NCCLCHECK(ncclTopoSearchRec(system, tmpGraph, graph, &time));
+#if 0
+    printf("Id %d Pattern %d, crossNic %d, Bw %g/%g, type %d/%d, channels %d-%d sameChannels %d -> nChannels %dx%g/%g %s\n", tmpGraph->id, tmpGraph->pattern, tmpGraph->crossNic, tmpGraph->bwInter, tmpGraph->bwIntra, tmpGraph->typeInter, tmpGraph->typeIntra, tmpGraph->minChannels, tmpGraph->maxChannels, tmpGraph->sameChannels, graph->nChannels, graph->bwInter, graph->bwIntra, time == 0 ? "TIMEOUT" : time == -1 ? "PERFECT" : "");
+    for (int c=0; c<graph->nChannels; c++) {
+      printf("%2d : ", c);
+      for (int g=0; g<ngpus; g++) {
+        printf("%d ", graph->intra[c*ngpus+g]);
+      }
+      printf("[%lx %lx]", graph->inter[c*2+0], graph->inter[c*2+1]);
+      printf("\n");
+    }
+#endif
+    // Optimal solution, stop here
+    if (time == -1 || graph->nChannels*graph->bwInter >= system->totalBw) {
+      *done = 1;
+      return ncclSuccess;
+    }
+
+    // Try having different channels (except when going through AMD CPUs)
+    if (tmpGraph->sameChannels == 1 &&
+        !(pass->cpuArch == NCCL_TOPO_CPU_ARCH_X86 && pass->cpuVendor == NCCL_TOPO_CPU_VENDOR_AMD && tmpGraph->typeIntra == PATH_SYS)) {
+      tmpGraph->sameChannels = 0;
+      continue;
+    }
+    tmpGraph->sameChannels = pass->trySameChannels;
+
+    if (time != -1) pass->globalTimeout += time;
+    else pass->globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
+    if (pass->globalTimeout < 0 && graph->nChannels) {
+      *done = 1;
+      return ncclSuccess;
+    }
+
+    // Try a simpler tree
+    if (pass->ccMin >= 90 && tmpGraph->pattern == NCCL_TOPO_PATTERN_BALANCED_TREE) {
+      tmpGraph->pattern = NCCL_TOPO_PATTERN_TREE;
+      continue;
+    }
+    tmpGraph->pattern = graph->pattern;
+
+    int maxTypeIntra = system->nodes[NET].count > 0 ? tmpGraph->typeInter : PATH_SYS;
+    if (tmpGraph->typeIntra < maxTypeIntra && (graph->nChannels == 0 || tmpGraph->typeIntra < graph->typeIntra)) {
+      tmpGraph->typeIntra += 1;
+      continue;
+    }
+    tmpGraph->typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
+
+    if (system->nodes[NET].count > 0 && tmpGraph->typeInter < PATH_SYS && (graph->nChannels == 0 || tmpGraph->typeInter < graph->typeInter || tmpGraph->typeInter < PATH_PXN)) {
+      tmpGraph->typeInter += 1;
+      continue;
+    }
+    tmpGraph->typeInter = PATH_PIX;
+
+    if (pass->crossNic == 2 && tmpGraph->crossNic == 0) {
+      // Try again with crossNic if permitted
+      tmpGraph->crossNic = 1;
+      continue;
+    }
+    tmpGraph->crossNic = pass->crossNic == 1 ? 1 : 0;
+    return ncclSuccess;
+  }
+}
+
+// Parallel first pass (NCCL_TOPO_SEARCH_THREADS > 1). Speeds are dealt round
+// robin to workers, each searching its own copy of the system with its own
+// time budget. Workers share what was found so that, like the sequential
+// search, they skip speeds which can't beat it.
+struct ncclTopoSearchShared {
+  pthread_mutex_t lock;
+  float* speedArray;
+  int nspeeds;
+  int doneSpeed; // Speed index at which a search found it should stop, -1 if none
+  float bestBw;  // Best bwInter found so far
+};
+
+struct ncclTopoSearchWorker {
+  pthread_t thread;
+  struct ncclTopoSearchShared* shared;
+  struct ncclTopoSearchPass pass;
+  struct ncclTopoGraph base;
+  struct ncclTopoGraph tmpGraph;
+  struct ncclTopoGraph graph;
+  int first, stride;
+  ncclResult_t ret;
+};
+
+static void* ncclTopoSearchWorkerMain(void* arg) {
+  struct ncclTopoSearchWorker* worker = (struct ncclTopoSearchWorker*)arg;
+  struct ncclTopoSearchShared* shared = worker->shared;
+  for (int s=worker->first; s<shared->nspeeds; s+=worker->stride) {
+    pthread_mutex_lock(&shared->lock);
+    bool skip = (shared->doneSpeed != -1 && s > shared->doneSpeed) ||
+      (shared->bestBw > 0 && shared->speedArray[s]/shared->bestBw <= .49);
+    pthread_mutex_unlock(&shared->lock);
+    // Speeds only decrease from here
+    if (skip) break;
+
+    int done;
+    memcpy(&worker->tmpGraph, &worker->base, sizeof(struct ncclTopoGraph));
+    worker->tmpGraph.bwIntra = worker->tmpGraph.bwInter = shared->speedArray[s];
+    worker->ret = ncclTopoSearchSpeed(&worker->pass, &worker->tmpGraph, &done);
+    if (worker->ret != ncclSuccess) break;
+
+    pthread_mutex_lock(&shared->lock);
+    if (worker->graph.nChannels > 0) shared->bestBw = std::max(shared->bestBw, worker->graph.bwInter);
+    if (done && (shared->doneSpeed == -1 || s < shared->doneSpeed)) shared->doneSpeed = s;
+    pthread_mutex_unlock(&shared->lock);
+    if (done) break;
+  }
+  return NULL;
+}
+
+static ncclResult_t ncclTopoSearchParallel(struct ncclTopoSearchPass* pass, struct ncclTopoGraph* tmpGraph, float* speedArray, int nspeeds, int nThreads) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclTopoSearchShared shared;
+  struct ncclTopoSearchWorker* workers;
+  int nStarted = 0;
+  pthread_mutex_init(&shared.lock, NULL);
+  shared.speedArray = speedArray;
+  shared.nspeeds = nspeeds;
+  shared.doneSpeed = -1;
+  shared.bestBw = 0;
+  NCCLCHECK(ncclCalloc(&workers, nThreads));
+  for (int t=0; t<nThreads; t++) {
+    struct ncclTopoSearchWorker* worker = workers+t;
+    worker->shared = &shared;
+    worker->pass = *pass;
+    worker->pass.graph = &worker->graph;
+    worker->first = t;
+    worker->stride = nThreads;
+    memcpy(&worker->base, tmpGraph, sizeof(struct ncclTopoGraph));
+    memcpy(&worker->graph, pass->graph, sizeof(struct ncclTopoGraph));
+    NCCLCHECKGOTO(ncclTopoDupSystem(pass->system, &worker->pass.system), ret, exit);
+  }
+  for (; nStarted<nThreads; nStarted++) {
+    SYSCHECKGOTO(pthread_create(&workers[nStarted].thread, NULL, ncclTopoSearchWorkerMain, workers+nStarted), ret, exit);
+    ncclSetThreadName(workers[nStarted].thread, "NCCL Search%2d", nStarted);
+  }
+exit:
+  for (int t=0; t<nStarted; t++) {
+    pthread_join(workers[t].thread, NULL);
+    if (ret == ncclSuccess) ret = workers[t].ret;
+  }
+  if (ret == ncclSuccess) {
+    // Keep the best solution. Worker 0 started from the fastest speed, so it wins ties.
+    for (int t=0; t<nThreads && ret == ncclSuccess; t++) {
+      struct ncclTopoGraph* found = &workers[t].graph;
+      int copy = 0;
+      if (found->nChannels == 0) continue;
+      ret = ncclTopoCompareGraphs(pass->system, found, pass->graph, &copy);
+      if (pass->graph->nChannels == 0 || copy) memcpy(pass->graph, found, sizeof(struct ncclTopoGraph));
+    }
+    INFO(NCCL_GRAPH, "Search %d : %d threads, %d channels bw %g/%g", pass->graph->id, nThreads, pass->graph->nChannels, pass->graph->bwIntra, pass->graph->bwInter);
+  }
+  for (int t=0; t<nThreads; t++) {
+    if (workers[t].pass.system) ncclTopoFree(workers[t].pass.system);
+  }
+  free(workers);
+  pthread_mutex_destroy(&shared.lock);
+  return ret;
+}
+
 ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   int ngpus = system->nodes[GPU].count;
   int crossNic = (system->nodes[NET].count > 1) &&
@@ -891,6 +1167,15 @@ ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph
   int ccMin;
   NCCLCHECK(ncclTopoGetCompCap(system, &ccMin, NULL));
   if (graph->pattern == NCCL_TOPO_PATTERN_NVLS && (system->nodes[NVS].count == 0 || ccMin < 90)) return ncclSuccess;
+
+  char cachePath[PATH_MAX];
+  const char* cacheDir = ncclGetEnv("NCCL_GRAPH_CACHE_DIR");
+  if (cacheDir) {
+    graphCachePath(cacheDir, graphCacheKey(system, graph), cachePath, sizeof(cachePath));
+    NCCLCHECK(graphCacheLoad(cachePath, system, graph));
+    if (graph->nChannels > 0) return ncclSuccess;
+  }
+
   // NVLS search must have ngpus heads at most.
   if (graph->pattern == NCCL_TOPO_PATTERN_NVLS) graph->maxChannels = system->nodes[GPU].count;
 
@@ -914,123 +1199,60 @@ ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph
     nspeeds = ccMin >= 90 ? NSPEEDSINTER_SM90 : NSPEEDSINTER;
     speedArray = ccMin >= 90 ? sm90SpeedArrayInter : speedArrayInter;
   }
-  int pass = 1;
   int speedIndex = 0;
   float maxBw = system->maxBw;
   float totalBw = system->totalBw;
   if (ngpus > 1 && graph->pattern != NCCL_TOPO_PATTERN_RING) totalBw *= ngpus*1.0/(ngpus-1);
   while ((speedArray[speedIndex] > maxBw || speedArray[speedIndex]*graph->minChannels > totalBw) && speedIndex < nspeeds-1) speedIndex++;
   tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[speedIndex];
-  int64_t globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
-
-search:
-  int time = tmpGraph.sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
-    tmpGraph.pattern == NCCL_TOPO_PATTERN_TREE ? NCCL_SEARCH_TIMEOUT_TREE : NCCL_SEARCH_TIMEOUT;
-  tmpGraph.nChannels = 0;
-  globalTimeout -= time;
-
-  NCCLCHECK(ncclTopoSearchRec(system, &tmpGraph, graph, &time));
-#if 0
-  printf("Id %d Pattern %d, crossNic %d, Bw %g/%g, type %d/%d, channels %d-%d sameChannels %d -> nChannels %dx%g/%g %s\n", tmpGraph.id, tmpGraph.pattern, tmpGraph.crossNic, tmpGraph.bwInter, tmpGraph.bwIntra, tmpGraph.typeInter, tmpGraph.typeIntra, tmpGraph.minChannels, tmpGraph.maxChannels, tmpGraph.sameChannels, graph->nChannels, graph->bwInter, graph->bwIntra, time == 0 ? "TIMEOUT" : time == -1 ? "PERFECT" : "");
-  for (int c=0; c<graph->nChannels; c++) {
-    printf("%2d : ", c);
-    for (int g=0; g<ngpus; g++) {
-      printf("%d ", graph->intra[c*ngpus+g]);
-    }
-    printf("[%lx %lx]", graph->inter[c*2+0], graph->inter[c*2+1]);
-    printf("\n");
-  }
-#endif
-  // Optimal solution, stop here
-  if (time == -1) goto done;
-  if (graph->nChannels*graph->bwInter >= system->totalBw) goto done;
-
-  if (pass == 1) {
-    // First pass, we don't have a solution yet ; try other options
-
-    // Try having different channels (except when going through AMD CPUs)
-    if (tmpGraph.sameChannels == 1 &&
-        !(cpuArch == NCCL_TOPO_CPU_ARCH_X86 && cpuVendor == NCCL_TOPO_CPU_VENDOR_AMD && tmpGraph.typeIntra == PATH_SYS)) {
-      tmpGraph.sameChannels = 0;
-      goto search;
-    }
-    tmpGraph.sameChannels = trySameChannels;
-
-    if (time != -1) globalTimeout += time;
-    else globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
-    if (globalTimeout < 0 && graph->nChannels) goto done;
-
-    // Try a simpler tree
-    if (ccMin >= 90 && tmpGraph.pattern == NCCL_TOPO_PATTERN_BALANCED_TREE) {
-      tmpGraph.pattern = NCCL_TOPO_PATTERN_TREE;
-      goto search;
-    }
-    tmpGraph.pattern = graph->pattern;
 
-    int maxTypeIntra = system->nodes[NET].count > 0 ? tmpGraph.typeInter : PATH_SYS;
-    if (tmpGraph.typeIntra < maxTypeIntra && (graph->nChannels == 0 || tmpGraph.typeIntra < graph->typeIntra)) {
-      tmpGraph.typeIntra += 1;
-      goto search;
-    }
-    tmpGraph.typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
-
-    if (system->nodes[NET].count > 0 && tmpGraph.typeInter < PATH_SYS && (graph->nChannels == 0 || tmpGraph.typeInter < graph->typeInter || tmpGraph.typeInter < PATH_PXN)) {
-      tmpGraph.typeInter += 1;
-      goto search;
-    }
-    tmpGraph.typeInter = PATH_PIX;
-
-    if (crossNic == 2 && tmpGraph.crossNic == 0) {
-      // Try again with crossNic if permitted
-      tmpGraph.crossNic = 1;
-      goto search;
-    }
-    tmpGraph.crossNic = crossNic == 1 ? 1 : 0;
-
-    // Decrease bw until we find a solution
-    if ((speedIndex < nspeeds-1) && (graph->nChannels == 0 || (speedArray[speedIndex+1]/graph->bwInter > .49))) {
-      tmpGraph.bwInter = tmpGraph.bwIntra = speedArray[++speedIndex];
-      goto search;
+  struct ncclTopoSearchPass pass1 = { system, graph, crossNic, trySameChannels, cpuArch, cpuVendor, ccMin, NCCL_SEARCH_GLOBAL_TIMEOUT };
+  int nThreads = std::min((int)ncclParamTopoSearchThreads(), nspeeds-speedIndex);
+  if (nThreads > 1) {
+    NCCLCHECK(ncclTopoSearchParallel(&pass1, &tmpGraph, speedArray+speedIndex, nspeeds-speedIndex, nThreads));
+  } else {
+    while (1) {
+      int done;
+      NCCLCHECK(ncclTopoSearchSpeed(&pass1, &tmpGraph, &done));
+      if (done) break;
+      // Decrease bw until we find a solution
+      if ((speedIndex < nspeeds-1) && (graph->nChannels == 0 || (speedArray[speedIndex+1]/graph->bwInter > .49))) {
+        tmpGraph.bwInter = tmpGraph.bwIntra = speedArray[++speedIndex];
+        continue;
+      }
+      break;
     }
-    speedIndex = 0;
-    while (speedArray[speedIndex] > maxBw && speedIndex < nspeeds-1) speedIndex++;
-    tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[speedIndex];
-
   }
 
-done:
   // We have a solution. Start from that solution and move to pass 2.
-  if (pass == 1) {
-    time = -1;
-    NCCLCHECK(ncclTopoDupChannels(graph, ccMin, ngpus));
-    memcpy(&tmpGraph, graph, sizeof(tmpGraph));
-    speedIndex = 0;
-    while (speedArray[speedIndex] > graph->bwInter && speedIndex < nspeeds-1) speedIndex++;
-    tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[speedIndex];
-    tmpGraph.minChannels = graph->nChannels;
-    pass = 2;
-  }
+  int time = -1;
+  NCCLCHECK(ncclTopoDupChannels(graph, ccMin, ngpus));
+  memcpy(&tmpGraph, graph, sizeof(tmpGraph));
+  speedIndex = 0;
+  while (speedArray[speedIndex] > graph->bwInter && speedIndex < nspeeds-1) speedIndex++;
+  tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[speedIndex];
+  tmpGraph.minChannels = graph->nChannels;
 
-  if (pass == 2) {
-    // See if we can increase bw
-    if (time != 0 && speedIndex > 0) {
-      if (graph->pattern == NCCL_TOPO_PATTERN_RING) {
-        // increase bw for Ring
-        tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[--speedIndex];
-        goto search;
-      } else if (graph->pattern == NCCL_TOPO_PATTERN_NVLS && tmpGraph.bwInter == graph->bwInter && tmpGraph.bwInter < tmpGraph.bwIntra*2) {
-        tmpGraph.minChannels = tmpGraph.maxChannels = graph->nChannels;
-        tmpGraph.bwInter = speedArray[--speedIndex];
-        goto search;
-      } else if (tmpGraph.bwIntra == graph->bwIntra && tmpGraph.bwIntra < tmpGraph.bwInter*2) {
-        // increase bwIntra for trees (2 nodes or collnet)
-        tmpGraph.bwIntra = speedArray[--speedIndex];
-        goto search;
-      }
+  // See if we can increase bw
+  while (time != 0 && speedIndex > 0) {
+    if (graph->pattern == NCCL_TOPO_PATTERN_RING) {
+      // increase bw for Ring
+      tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[--speedIndex];
+    } else if (graph->pattern == NCCL_TOPO_PATTERN_NVLS && tmpGraph.bwInter == graph->bwInter && tmpGraph.bwInter < tmpGraph.bwIntra*2) {
+      tmpGraph.minChannels = tmpGraph.maxChannels = graph->nChannels;
+      tmpGraph.bwInter = speedArray[--speedIndex];
+    } else if (tmpGraph.bwIntra == graph->bwIntra && tmpGraph.bwIntra < tmpGraph.bwInter*2) {
+      // increase bwIntra for trees (2 nodes or collnet)
+      tmpGraph.bwIntra = speedArray[--speedIndex];
+    } else {
+      break;
     }
-    time = -1;
-    memcpy(&tmpGraph, graph, sizeof(tmpGraph));
+    time = searchTimeout(&tmpGraph);
+    tmpGraph.nChannels = 0;
+    pass1.globalTimeout -= time;
+    NCCLCHECK(ncclTopoSearchRec(system, &tmpGraph, graph, &time));
   }
+  if (cacheDir && graph->nChannels > 0) NCCLCHECK(graphCacheSave(cachePath, system, graph));
 
   if (graph->nChannels == 0 && graph->collNet == 0 && graph->pattern != NCCL_TOPO_PATTERN_NVLS) {
     WARN("Could not find a path for pattern %d, falling back to simple order", graph->pattern);
@@ -1043,6 +1265,20 @@ done:
   return ncclSuccess;
 }
 
+// Translate a graph searched on a parent's system to the system copied from
+// it by ncclTopoSplitSystem. GPUs keep their index, only their rank changes.
+ncclResult_t ncclTopoSplitGraph(struct ncclTopoSystem* parentSystem, struct ncclTopoGraph* parentGraph, struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  int ngpus = system->nodes[GPU].count;
+  memcpy(graph, parentGraph, sizeof(struct ncclTopoGraph));
+  for (int i=0; i<graph->nChannels*ngpus; i++) {
+    int g;
+    NCCLCHECK(ncclTopoRankToIndex(parentSystem, parentGraph->intra[i], &g));
+    graph->intra[i] = system->nodes[GPU].nodes[g].gpu.rank;
+  }
+  INFO(NCCL_GRAPH, "Search %d : %d channels reused from parent communicator", graph->id, graph->nChannels);
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoPrintGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   INFO(NCCL_GRAPH, "Pattern %d, crossNic %d, nChannels %d, bw %f/%f, type %s/%s, sameChannels %d", graph->pattern, graph->crossNic, graph->nChannels, graph->bwIntra, graph->bwInter, topoPathTypeStr[graph->typeIntra], topoPathTypeStr[graph->typeInter], graph->sameChannels);
   int ngpus = system->nodes[GPU].count;
@@ -1111,6 +1347,54 @@ fail:
 // 0: don't use PXN for P2P, 1: use PXN if needed, 2: use PXN as much as possible to maximize aggregation
 NCCL_PARAM(P2pPxnLevel, "P2P_PXN_LEVEL", 2);
 
+// Whether the topology gives the rail of every NIC, see the "rail" attribute of net nodes
+static int ncclTopoHasRails(struct ncclTopoSystem* system) {
+  if (system->nodes[NET].count == 0) return 0;
+  for (int n=0; n<system->nodes[NET].count; n++) {
+    if (system->nodes[NET].nodes[n].net.rail == NCCL_TOPO_UNDEF) return 0;
+  }
+  return 1;
+}
+
+// Stripe the p2p channels over all the NICs reachable directly or through PXN
+// instead of only using the NIC of the remote rank's device, to spread all-to-all
+// traffic when GPUs do not all have their own NIC.
+NCCL_PARAM(P2pPxnStripe, "P2P_PXN_STRIPE", 0);
+
+// Pick, for channelId, one of the NICs with at least the bandwidth of netId (and on
+// its rail when rails are known) that GPU g1 can reach either directly or through
+// the NVLink-connected GPU local to that NIC.
+static ncclResult_t pxnStripeNet(struct ncclComm* comm, int g1, int channelId, int64_t* netId, int* netDev, int* proxyRank) {
+  struct ncclTopoSystem* system = comm->topo;
+  int n0;
+  NCCLCHECK(ncclTopoIdToIndex(system, NET, *netId, &n0));
+  struct ncclTopoNode* net0 = system->nodes[NET].nodes+n0;
+  int rails = ncclTopoHasRails(system);
+  int candidates[NCCL_TOPO_MAX_NODES];
+  int ranks[NCCL_TOPO_MAX_NODES];
+  int count = 0, first = 0;
+  for (int n=0; n<system->nodes[NET].count; n++) {
+    struct ncclTopoNode* net = system->nodes[NET].nodes+n;
+    if (rails && net->net.rail != net0->net.rail) continue;
+    if (net->net.bw < net0->net.bw) continue;
+    int g2;
+    NCCLCHECK(ncclTopoGetLocalGpu(system, net->id, &g2));
+    if (g2 == -1) continue;
+    struct ncclTopoNode* gpu2 = system->nodes[GPU].nodes+g2;
+    if (gpu2->paths[NET][n].type > PATH_PXB) continue;
+    if (g2 != g1 && gpu2->paths[GPU][g1].type > PATH_NVL) continue;
+    if (n == n0) first = count;
+    ranks[count] = gpu2->gpu.rank;
+    candidates[count++] = n;
+  }
+  if (count == 0) return ncclSuccess;
+  int c = (first + channelId) % count;
+  *netId = system->nodes[NET].nodes[candidates[c]].id;
+  *netDev = system->nodes[NET].nodes[candidates[c]].net.dev;
+  *proxyRank = ranks[c];
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoGetNetDev(struct ncclComm* comm, int rank, struct ncclTopoGraph* graph, int channelId, int peerRank, int64_t* id, int* dev, int* proxyRank) {
   int64_t netId = -1;
   int netDev = -1;
@@ -1135,11 +1419,15 @@ ncclResult_t ncclTopoGetNetDev(struct ncclComm* comm, int rank, struct ncclTopoG
     NCCLCHECK(ncclTopoGetLocalNet(comm->topo, rank, channelId, &netId, &netDev));
     if (dev) *dev = netDev;
     if (id) *id = netId;
+    int64_t usedId = netId;
     *proxyRank = rank;
 
     int pxnLevel = ncclPxnDisable(comm) == 1 ? 0 : ncclParamP2pPxnLevel();
+    // With known rails, use the NIC on the rail of the remote rank preferred device, as
+    // with NCCL_CROSS_NIC=0.
+    int sameRail = ncclParamCrossNic() == 0 || ncclTopoHasRails(comm->topo);
     // See whether we can use the remote rank preferred device.
-    if (ncclParamCrossNic() == 0 || (pxnLevel != 0)) {
+    if (sameRail || (pxnLevel != 0)) {
       // Find local NIC number close to local nvmlDev
       int nvmlDev = comm->peerInfo[peerRank].nvmlDev;
       int localRank;
@@ -1147,9 +1435,10 @@ ncclResult_t ncclTopoGetNetDev(struct ncclComm* comm, int rank, struct ncclTopoG
       NCCLCHECK(ncclTopoGetLocalNet(comm->topo, localRank, channelId, &netId, &netDev));
 
       // Check that device exists on our node
-      if (ncclParamCrossNic() == 0) {
+      if (sameRail) {
         if (dev) *dev = netDev;
         if (id) *id = netId;
+        usedId = netId;
       }
       if (pxnLevel == 1) {
         int g, n;
@@ -1159,6 +1448,7 @@ ncclResult_t ncclTopoGetNetDev(struct ncclComm* comm, int rank, struct ncclTopoG
         if (gpu->paths[NET][n].type <= PATH_PXN) {
           if (dev) *dev = netDev;
           if (id) *id = netId;
+          usedId = netId;
           NCCLCHECK(ncclTopoGetIntermediateRank(comm->topo, rank, *dev, proxyRank));
         }
       } else if (pxnLevel == 2) {
@@ -1171,6 +1461,7 @@ ncclResult_t ncclTopoGetNetDev(struct ncclComm* comm, int rank, struct ncclTopoG
           struct ncclTopoNode* peerGpu = comm->topo->nodes[GPU].nodes+g2;
           if (peerGpu->paths[GPU][g1].type <= PATH_NVL && peerGpu->paths[NET][n].type <= PATH_PXB) {
             *proxyRank = peerGpu->gpu.rank;
+            if (ncclParamP2pPxnStripe()) NCCLCHECK(pxnStripeNet(comm, g1, channelId, &netId, &netDev, proxyRank));
             if (dev) *dev = netDev;
             if (id) *id = netId;
             return ncclSuccess;
@@ -1178,6 +1469,18 @@ ncclResult_t ncclTopoGetNetDev(struct ncclComm* comm, int rank, struct ncclTopoG
         }
       }
     }
+    // Leave the NIC to the proxy of the NVLink-connected GPU that owns it.
+    // Topology paths are left alone so graph search is not affected.
+    if (*proxyRank == rank && ncclProxyShared(comm)) {
+      int n, g1, g2;
+      NCCLCHECK(ncclTopoIdToIndex(comm->topo, NET, usedId, &n));
+      NCCLCHECK(ncclTopoRankToIndex(comm->topo, rank, &g1));
+      NCCLCHECK(ncclTopoGetLocalGpu(comm->topo, usedId, &g2));
+      if (g2 != -1 && g2 != g1) {
+        struct ncclTopoNode* peerGpu = comm->topo->nodes[GPU].nodes+g2;
+        if (peerGpu->paths[GPU][g1].type <= PATH_NVL && peerGpu->paths[NET][n].type <= PATH_PXB) *proxyRank = peerGpu->gpu.rank;
+      }
+    }
   }
   return ncclSuccess;
 }
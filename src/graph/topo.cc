@@ -124,6 +124,7 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
   } else if (type == NET) {
     n->net.asic = 0ULL;
     n->net.port = NCCL_TOPO_UNDEF;
+    n->net.rail = NCCL_TOPO_UNDEF;
     n->net.bw = 0.0;
     n->net.latency = 0.0;
   }
@@ -355,9 +356,10 @@ ncclResult_t ncclTopoAddNet(struct ncclXmlNode* xmlNet, struct ncclTopoSystem* s
   int mbps;
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "speed", &mbps, 0));
   if (mbps <= 0) mbps = 10000; // Some NICs define speed = -1
-  net->net.bw = mbps / 8000.0;
+  net->net.speed = net->net.bw = mbps / 8000.0;
   if (xmlGetAttrFloat(xmlNet, "latency", &net->net.latency) != ncclSuccess) net->net.latency = 0;
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "port", &net->net.port, 0));
+  NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "rail", &net->net.rail, NCCL_TOPO_UNDEF));
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "gdr", &net->net.gdrSupport, 0));
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "maxconn", &net->net.maxChannels, MAXCHANNELS));
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "coll", &net->net.collSupport, 0));
@@ -613,11 +615,27 @@ ncclResult_t ncclTopoAddC2c(struct ncclXmlNode* node, struct ncclTopoSystem* sys
   return ncclSuccess;
 }
 
+static uint64_t xmlHash(struct ncclXml* xml) {
+  uint64_t hash = 0;
+  for (int n=0; n<xml->maxIndex; n++) {
+    struct ncclXmlNode* node = xml->nodes+n;
+    hash = hash*31 + getHash(node->name, strlen(node->name));
+    for (int a=0; a<node->nAttrs; a++) {
+      hash = hash*31 + getHash(node->attrs[a].key, strlen(node->attrs[a].key));
+      hash = hash*31 + getHash(node->attrs[a].value, strlen(node->attrs[a].value));
+    }
+  }
+  return hash;
+}
+
 ncclResult_t ncclTopoGetSystemFromXml(struct ncclXml* xml, struct ncclTopoSystem** topoSystem, const uint64_t localHostHash) {
   NCCLCHECK(ncclCalloc(topoSystem, 1));
   struct ncclTopoSystem* system = *topoSystem;
+  system->xmlHash = xmlHash(xml);
   struct ncclXmlNode* topNode;
   NCCLCHECK(xmlFindTag(xml, "system", &topNode));
+  NCCLCHECK(xmlGetAttrIntDefault(topNode, "pod", &system->netPod, NCCL_TOPO_UNDEF));
+  NCCLCHECK(xmlGetAttrIntDefault(topNode, "leaf", &system->netLeaf, NCCL_TOPO_UNDEF));
   for (int s=0; s<topNode->nSubs; s++) {
     struct ncclXmlNode* node = topNode->subs[s];
     if (strcmp(node->name, "cpu") == 0) NCCLCHECK(ncclTopoAddCpu(node, *topoSystem));
@@ -669,9 +687,7 @@ static ncclResult_t xmlInitAttrFloat(struct ncclXmlNode* node, const char* attrN
 }
 
 
-ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** system) {
-  struct ncclXml* xml;
-  NCCLCHECK(xmlAlloc(&xml, NCCL_TOPO_XML_MAX_NODES));
+static ncclResult_t ncclTopoDetectXml(struct ncclComm* comm, struct ncclXml* xml) {
   const char* xmlTopoFile = ncclGetEnv("NCCL_TOPO_FILE");
   if (xmlTopoFile) {
     INFO(NCCL_ENV, "NCCL_TOPO_FILE set by environment to %s", xmlTopoFile);
@@ -744,24 +760,212 @@ ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** sy
 
   // Remove XML branches which don't have a node with keep="1" (typically when importing a topology)
   NCCLCHECK(ncclTopoTrimXml(xml));
+  return ncclSuccess;
+}
+
+// Detected XML topologies, shared by all communicators of the process. Comms
+// created together (e.g. ncclCommInitAll) would otherwise each query sysfs,
+// NVML and the network plugins for the same devices. With NCCL_TOPO_CACHE_DIR,
+// the XML is also saved per boot so that other processes of the node can load
+// it instead of probing the hardware again. Entries are keyed on everything
+// detection depends on; ranks are set again on each use.
+NCCL_PARAM(TopoCache, "TOPO_CACHE", 1);
+
+struct ncclTopoXmlCacheEntry {
+  struct ncclTopoXmlCacheEntry* next;
+  uint64_t key;
+  struct ncclXml* xml; // Node pointers stored relative to the nodes array
+};
+static struct ncclTopoXmlCacheEntry* topoXmlCache = NULL;
+static pthread_mutex_t topoXmlCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t topoCacheHashCombine(uint64_t hash, const void* data, int n) {
+  return hash*31 + getHash((const char*)data, n);
+}
+
+static uint64_t ncclTopoXmlCacheKey(struct ncclComm* comm) {
+  int version = NCCL_VERSION_CODE;
+  uint64_t key = topoCacheHashCombine(0, &version, sizeof(version));
+  // Hardware may change across reboots, not while the node is up.
+  char bootId[64] = "";
+  FILE* file = fopen("/proc/sys/kernel/random/boot_id", "r");
+  if (file) {
+    if (fgets(bootId, sizeof(bootId), file) == NULL) bootId[0] = '\0';
+    fclose(file);
+  }
+  key = topoCacheHashCombine(key, bootId, strlen(bootId));
+  const char* topoFile = ncclGetEnv("NCCL_TOPO_FILE");
+  if (topoFile) key = topoCacheHashCombine(key, topoFile, strlen(topoFile));
+  key = topoCacheHashCombine(key, comm->ncclNet->name, strlen(comm->ncclNet->name));
+  if (comm->ncclCollNet) key = topoCacheHashCombine(key, comm->ncclCollNet->name, strlen(comm->ncclCollNet->name));
+  int flags[] = { collNetSupport(comm), comm->dmaBufSupport };
+  key = topoCacheHashCombine(key, flags, sizeof(flags));
+  for (int r=0; r<comm->nRanks; r++) {
+    if (comm->peerInfo[r].hostHash != comm->peerInfo[comm->rank].hostHash) continue;
+    key = topoCacheHashCombine(key, &comm->peerInfo[r].busId, sizeof(comm->peerInfo[r].busId));
+    key = topoCacheHashCombine(key, &comm->peerInfo[r].gdrSupport, sizeof(comm->peerInfo[r].gdrSupport));
+  }
+  return key;
+}
+
+static ncclResult_t ncclTopoXmlCacheGet(uint64_t key, struct ncclXml* xml, bool* found) {
+  *found = false;
+  pthread_mutex_lock(&topoXmlCacheLock);
+  for (struct ncclTopoXmlCacheEntry* entry = topoXmlCache; entry; entry = entry->next) {
+    if (entry->key != key) continue;
+    memcpy(xml, entry->xml, xmlMemSize(NCCL_TOPO_XML_MAX_NODES));
+    *found = true;
+    break;
+  }
+  pthread_mutex_unlock(&topoXmlCacheLock);
+  if (*found) {
+    NCCLCHECK(ncclTopoConvertXml(xml, (uintptr_t)xml->nodes, 0));
+    INFO(NCCL_GRAPH, "Topology loaded from process cache (key %lx)", key);
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoXmlCachePut(uint64_t key, struct ncclXml* xml) {
+  struct ncclTopoXmlCacheEntry* entry;
+  NCCLCHECK(ncclCalloc(&entry, 1));
+  entry->key = key;
+  NCCLCHECK(xmlAlloc(&entry->xml, NCCL_TOPO_XML_MAX_NODES));
+  memcpy(entry->xml, xml, xmlMemSize(NCCL_TOPO_XML_MAX_NODES));
+  NCCLCHECK(ncclTopoConvertXml(entry->xml, (uintptr_t)xml->nodes, 1));
+  pthread_mutex_lock(&topoXmlCacheLock);
+  // Another comm may have detected the same topology concurrently, keep the first one.
+  struct ncclTopoXmlCacheEntry* e;
+  for (e = topoXmlCache; e && e->key != key; e = e->next);
+  if (e == NULL) {
+    entry->next = topoXmlCache;
+    topoXmlCache = entry;
+  }
+  pthread_mutex_unlock(&topoXmlCacheLock);
+  if (e) {
+    free(entry->xml);
+    free(entry);
+  }
+  return ncclSuccess;
+}
+
+static void ncclTopoXmlCachePath(const char* dir, uint64_t key, char* path, int len) {
+  snprintf(path, len, "%s/nccl_topo_%016lx.bin", dir, key);
+}
+
+// A stale or damaged file is not fatal, we'll just detect again.
+static ncclResult_t ncclTopoXmlCacheLoad(const char* path, struct ncclXml* xml, bool* found) {
+  *found = false;
+  if (access(path, R_OK) != 0) return ncclSuccess;
+  if (ncclTopoGetXmlFromFile(path, xml, 0) != ncclSuccess || xml->maxIndex == 0) {
+    INFO(NCCL_GRAPH, "Ignoring topology cache file %s", path);
+    memset(xml->nodes, 0, sizeof(struct ncclXmlNode)*xml->maxNodes);
+    xml->maxIndex = 0;
+    return ncclSuccess;
+  }
+  *found = true;
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoXmlCacheSave(const char* path, struct ncclXml* xml) {
+  char tmpPath[PATH_MAX];
+  // Other ranks of the node may write the same file, only publish complete ones.
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.%lx", path, getpid(), (unsigned long)pthread_self());
+  NCCLCHECK(ncclTopoDumpXmlToFile(tmpPath, xml));
+  if (rename(tmpPath, path) != 0) {
+    INFO(NCCL_GRAPH, "Could not save topology cache file %s : %s", path, strerror(errno));
+    unlink(tmpPath);
+  }
+  return ncclSuccess;
+}
+
+// Cached XML carries the ranks of the comm which detected it.
+static ncclResult_t ncclTopoXmlSetRanks(struct ncclComm* comm, struct ncclXml* xml) {
+  for (int r=0; r<comm->nRanks; r++) {
+    if (comm->peerInfo[r].hostHash != comm->peerInfo[comm->rank].hostHash) continue;
+    char busId[NVML_DEVICE_PCI_BUS_ID_BUFFER_SIZE];
+    struct ncclXmlNode* pciNode, *gpuNode = NULL;
+    NCCLCHECK(int64ToBusId(comm->peerInfo[r].busId, busId));
+    NCCLCHECK(xmlFindTagKv(xml, "pci", &pciNode, "busid", busId));
+    if (pciNode) NCCLCHECK(xmlGetSub(pciNode, "gpu", &gpuNode));
+    if (gpuNode) NCCLCHECK(xmlSetAttrInt(gpuNode, "rank", r));
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoFuseCliqueXml(struct ncclComm* comm, struct ncclXml** xmlPtr) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclXml* xml = *xmlPtr;
+  struct ncclXml* peerXml = NULL, *cliqueXml = NULL;
+  char* bin = NULL, *mem = NULL;
+  size_t binSize = 0, maxSize = 0;
+  size_t* sizes = NULL;
+  int nHosts = 0;
+  bool leader = true;
+  uint64_t hostHash = comm->peerInfo[comm->rank].hostHash;
+  for (int i = 0; i < comm->clique.size; i++) {
+    bool first = true;
+    for (int j = 0; j < i && first; j++) first = comm->peerInfo[comm->clique.ranks[j]].hostHash != comm->peerInfo[comm->clique.ranks[i]].hostHash;
+    if (first) nHosts++;
+    if (i == comm->cliqueRank) leader = first;
+  }
+  if (leader) NCCLCHECKGOTO(ncclTopoXmlToBin(xml, &bin, &binSize), ret, fail);
+  NCCLCHECKGOTO(ncclCalloc(&sizes, comm->clique.size), ret, fail);
+  sizes[comm->cliqueRank] = binSize;
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->clique.ranks, comm->cliqueRank, comm->clique.size, sizes, sizeof(size_t)), ret, fail);
+  for (int i = 0; i < comm->clique.size; i++) maxSize = std::max(maxSize, sizes[i]);
+  NCCLCHECKGOTO(ncclCalloc(&mem, comm->clique.size*maxSize), ret, fail);
+  if (leader) memcpy(mem+maxSize*comm->cliqueRank, bin, binSize);
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->clique.ranks, comm->cliqueRank, comm->clique.size, mem, maxSize), ret, fail);
+  INFO(NCCL_GRAPH, "MNNVL clique of %d ranks on %d hosts, exchanged %zu bytes of topology per rank", comm->clique.size, nHosts, maxSize);
+
+  // Fuse host XMLs one at a time through a single decoding buffer
+  NCCLCHECKGOTO(xmlAlloc(&peerXml, NCCL_TOPO_XML_MAX_NODES), ret, fail);
+  NCCLCHECKGOTO(xmlAlloc(&cliqueXml, nHosts*NCCL_TOPO_XML_MAX_NODES), ret, fail);
+  for (int i = 0; i < comm->clique.size; i++) {
+    if (sizes[i] == 0) continue;
+    NCCLCHECKGOTO(ncclTopoXmlFromBin(mem+maxSize*i, sizes[i], peerXml), ret, fail);
+    NCCLCHECKGOTO(ncclTopoFuseXml(cliqueXml, peerXml), ret, fail);
+  }
+  free(xml);
+  *xmlPtr = cliqueXml;
+  cliqueXml = NULL;
+exit:
+  free(cliqueXml);
+  free(peerXml);
+  free(mem);
+  free(sizes);
+  free(bin);
+  return ret;
+fail:
+  goto exit;
+}
+
+ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** system) {
+  struct ncclXml* xml;
+  NCCLCHECK(xmlAlloc(&xml, NCCL_TOPO_XML_MAX_NODES));
+  bool cached = false, fromFile = false;
+  uint64_t cacheKey = 0;
+  char cachePath[PATH_MAX];
+  const char* cacheDir = ncclGetEnv("NCCL_TOPO_CACHE_DIR");
+  const char* xmlTopoFile;
+  if (ncclParamTopoCache() || cacheDir) cacheKey = ncclTopoXmlCacheKey(comm);
+  if (ncclParamTopoCache()) NCCLCHECK(ncclTopoXmlCacheGet(cacheKey, xml, &cached));
+  if (!cached && cacheDir) {
+    ncclTopoXmlCachePath(cacheDir, cacheKey, cachePath, sizeof(cachePath));
+    NCCLCHECK(ncclTopoXmlCacheLoad(cachePath, xml, &fromFile));
+  }
+  if (cached || fromFile) {
+    NCCLCHECK(ncclTopoXmlSetRanks(comm, xml));
+  } else {
+    NCCLCHECK(ncclTopoDetectXml(comm, xml));
+    if (cacheDir) NCCLCHECK(ncclTopoXmlCacheSave(cachePath, xml));
+  }
+  if (!cached && ncclParamTopoCache()) NCCLCHECK(ncclTopoXmlCachePut(cacheKey, xml));
 
   if (comm->MNNVL) {
-    // MNNVL clique support
-    char* mem;
-    NCCLCHECK(ncclCalloc(&mem, comm->clique.size * xmlMemSize(NCCL_TOPO_XML_MAX_NODES)));
-    struct ncclXml* rankXml = (struct ncclXml*)(mem+xmlMemSize(NCCL_TOPO_XML_MAX_NODES)*comm->cliqueRank);
-    memcpy(rankXml, xml, xmlMemSize(NCCL_TOPO_XML_MAX_NODES));
-    NCCLCHECK(ncclTopoConvertXml(rankXml, (uintptr_t)xml->nodes, 1));
-    NCCLCHECK(bootstrapIntraNodeAllGather(comm->bootstrap, comm->clique.ranks, comm->cliqueRank, comm->clique.size, mem, xmlMemSize(NCCL_TOPO_XML_MAX_NODES)));
-    struct ncclXml* cliqueXml;
-    NCCLCHECK(xmlAlloc(&cliqueXml, comm->clique.size*NCCL_TOPO_XML_MAX_NODES));
-    for (int i = 0; i < comm->clique.size; i++) {
-      struct ncclXml* peerXml = (struct ncclXml*)(mem+xmlMemSize(NCCL_TOPO_XML_MAX_NODES)*i);
-      NCCLCHECK(ncclTopoConvertXml(peerXml, (uintptr_t)peerXml->nodes, 0));
-      NCCLCHECK(ncclTopoFuseXml(cliqueXml, peerXml));
-    }
-    free(xml);
-    xml = cliqueXml;
+    // MNNVL clique support. Ranks of a host detect the same XML, so only the
+    // first clique rank of each host contributes it, in binary form.
+    NCCLCHECK(ncclTopoFuseCliqueXml(comm, &xml));
   }
 
   xmlTopoFile = ncclGetEnv("NCCL_TOPO_DUMP_FILE");
@@ -818,6 +1022,26 @@ ncclResult_t getLocalNetCountByBw(struct ncclTopoSystem* system, int gpu, int *c
   return ncclSuccess;
 }
 
+// Spread channels over local NICs in proportion to their speed
+NCCL_PARAM(NetWeighted, "NET_WEIGHTED", 0);
+#define NCCL_TOPO_NET_MAX_WEIGHT 4
+
+// Lists each local NIC once per multiple of the slowest speed, interleaved
+// (e.g. A B A for A twice as fast as B). With equal speeds this is localNets.
+static ncclResult_t topoNetSlots(struct ncclTopoSystem* system, int* localNets, int localNetCount, int** slots, int* nSlots) {
+  float minSpeed = system->nodes[NET].nodes[localNets[0]].net.speed;
+  for (int i=1; i<localNetCount; i++) minSpeed = std::min(minSpeed, system->nodes[NET].nodes[localNets[i]].net.speed);
+  NCCLCHECK(ncclCalloc(slots, localNetCount*NCCL_TOPO_NET_MAX_WEIGHT));
+  *nSlots = 0;
+  for (int w=0; w<NCCL_TOPO_NET_MAX_WEIGHT; w++) {
+    for (int i=0; i<localNetCount; i++) {
+      int weight = (int)(system->nodes[NET].nodes[localNets[i]].net.speed/minSpeed + 0.5);
+      if (std::min(weight, NCCL_TOPO_NET_MAX_WEIGHT) > w) (*slots)[(*nSlots)++] = localNets[i];
+    }
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoGetLocalNet(struct ncclTopoSystem* system, int rank, int channelId, int64_t* id, int* dev) {
   int gpu;
   NCCLCHECK(ncclTopoRankToIndex(system, rank, &gpu));
@@ -829,9 +1053,21 @@ ncclResult_t ncclTopoGetLocalNet(struct ncclTopoSystem* system, int rank, int ch
   NCCLCHECK(ncclTopoGetLocal(system, NET, localNets[0], GPU, &localGpus, &localGpuCount, NULL));
   int net = system->nodes[GPU].nodes[gpu].gpu.dev;
   if (isPow2(localNetCount)) net = mirrorBits(net, localNetCount);
-  net += channelId%(DIVUP(localNetCount,localGpuCount));
-  if (id) *id = system->nodes[NET].nodes[localNets[net%localNetCount]].id;
-  if (dev) *dev = system->nodes[NET].nodes[localNets[net%localNetCount]].net.dev;
+  int netIndex;
+  if (ncclParamNetWeighted() && localNetCount > 1) {
+    // Start from the slot of the NIC we would start from without weights
+    int* slots;
+    int nSlots, start = 0;
+    NCCLCHECK(topoNetSlots(system, localNets, localNetCount, &slots, &nSlots));
+    while (slots[start] != localNets[net%localNetCount]) start++;
+    netIndex = slots[(start + channelId%(DIVUP(nSlots,localGpuCount)))%nSlots];
+    free(slots);
+  } else {
+    net += channelId%(DIVUP(localNetCount,localGpuCount));
+    netIndex = localNets[net%localNetCount];
+  }
+  if (id) *id = system->nodes[NET].nodes[netIndex].id;
+  if (dev) *dev = system->nodes[NET].nodes[netIndex].net.dev;
   free(localNets);
   free(localGpus);
   return ncclSuccess;
@@ -872,9 +1108,15 @@ ncclResult_t ncclTopoCpuType(struct ncclTopoSystem* system, int* arch, int* vend
   return ncclSuccess;
 }
 
+ncclResult_t ncclTopoGetNetLocation(struct ncclTopoSystem* system, int* pod, int* leaf) {
+  *pod = system->netPod;
+  *leaf = system->netLeaf;
+  return ncclSuccess;
+}
+
 NCCL_PARAM(IgnoreCpuAffinity, "IGNORE_CPU_AFFINITY", 0);
 
-ncclResult_t ncclTopoGetCpuAffinity(struct ncclTopoSystem* system, int rank, cpu_set_t* affinity) {
+static void topoGetGpuCpu(struct ncclTopoSystem* system, int rank, struct ncclTopoNode** gpuNode, struct ncclTopoNode** cpuNode) {
   struct ncclTopoNode* cpu = NULL, *gpu = NULL;
   for (int g=0; g<system->nodes[GPU].count; g++) {
     if (system->nodes[GPU].nodes[g].gpu.rank == rank) {
@@ -891,6 +1133,13 @@ ncclResult_t ncclTopoGetCpuAffinity(struct ncclTopoSystem* system, int rank, cpu
       cpu = system->nodes[CPU].nodes+cpuIndex;
     }
   }
+  *gpuNode = gpu;
+  *cpuNode = cpu;
+}
+
+ncclResult_t ncclTopoGetCpuAffinity(struct ncclTopoSystem* system, int rank, cpu_set_t* affinity) {
+  struct ncclTopoNode* cpu, *gpu;
+  topoGetGpuCpu(system, rank, &gpu, &cpu);
   if (cpu == NULL) {
     WARN("Set CPU affinity : unable to find GPU/CPU for rank %d", rank);
     return ncclInternalError;
@@ -938,6 +1187,56 @@ ncclResult_t ncclTopoGetCpuAffinity(struct ncclTopoSystem* system, int rank, cpu
   return ncclSuccess;
 }
 
+// NUMA node of the CPU closest to our GPU, -1 if unknown.
+ncclResult_t ncclTopoGetGpuNumaId(struct ncclTopoSystem* system, int rank, int* numaId) {
+  struct ncclTopoNode* cpu, *gpu;
+  topoGetGpuCpu(system, rank, &gpu, &cpu);
+  *numaId = cpu ? (int)NCCL_TOPO_ID_LOCAL_ID(cpu->id) : -1;
+  return ncclSuccess;
+}
+
+// CPU closest to a NIC, NULL if unknown.
+static struct ncclTopoNode* topoGetNetCpu(struct ncclTopoSystem* system, int netDev) {
+  for (int n=0; n<system->nodes[NET].count; n++) {
+    struct ncclTopoNode* net = system->nodes[NET].nodes+n;
+    if (net->net.dev != netDev || net->paths[CPU] == NULL) continue;
+    int cpuIndex = -1, minHops = 0;
+    for (int c=0; c<system->nodes[CPU].count; c++) {
+      int nHops = net->paths[CPU][c].count;
+      if (cpuIndex == -1 || nHops < minHops) {
+        cpuIndex = c;
+        minHops = nHops;
+      }
+    }
+    return cpuIndex == -1 ? NULL : system->nodes[CPU].nodes+cpuIndex;
+  }
+  return NULL;
+}
+
+// Affinity of the CPU closest to a NIC, restricted to our current affinity.
+ncclResult_t ncclTopoGetNetCpuAffinity(struct ncclTopoSystem* system, int netDev, cpu_set_t* affinity) {
+  CPU_ZERO(affinity);
+  struct ncclTopoNode* cpu = topoGetNetCpu(system, netDev);
+  if (cpu == NULL) return ncclSuccess;
+
+  cpu_set_t mask;
+  SYSCHECK(sched_getaffinity(0, sizeof(cpu_set_t), &mask), "sched_getaffinity");
+  if (ncclParamIgnoreCpuAffinity()) {
+    *affinity = cpu->cpu.affinity;
+  } else {
+    CPU_AND(affinity, &mask, &cpu->cpu.affinity);
+  }
+  return ncclSuccess;
+}
+
+// All cores of the CPU closest to a NIC, regardless of our affinity.
+ncclResult_t ncclTopoGetNetCpuset(struct ncclTopoSystem* system, int netDev, cpu_set_t* cpuset) {
+  CPU_ZERO(cpuset);
+  struct ncclTopoNode* cpu = topoGetNetCpu(system, netDev);
+  if (cpu) *cpuset = cpu->cpu.affinity;
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoGetGpuCount(struct ncclTopoSystem* system, int* count) {
   *count = system->nodes[GPU].count;
   return ncclSuccess;
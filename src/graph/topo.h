@@ -122,7 +122,9 @@ struct ncclTopoNode {
       int dev; // Plugin dev number
       uint64_t asic;
       int port;
+      int rail; // Rail (or plane) of a rail-optimized fabric, NCCL_TOPO_UNDEF if unknown
       float bw;
+      float speed; // bw of the NIC, which the search does not consume
       float latency;
       int gdrSupport;
       int collSupport;
@@ -158,6 +160,11 @@ struct ncclTopoSystem {
   struct ncclTopoNodeSet nodes[NCCL_TOPO_NODE_TYPES];
   float maxBw;
   float totalBw;
+  uint64_t xmlHash; // hash of the XML the system was built from, used to key the graph cache
+  // Location of the node in the network, from the "pod" and "leaf" attributes of the
+  // system XML node. NCCL_TOPO_UNDEF if unknown.
+  int netPod;
+  int netLeaf;
 };
 
 ncclResult_t ncclTopoGetNode(struct ncclTopoSystem* system, struct ncclTopoNode** node, int type, uint64_t id);
@@ -165,6 +172,7 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
 ncclResult_t ncclTopoRemoveNode(struct ncclTopoSystem* system, int type, int id);
 ncclResult_t ncclTopoConnectNodes(struct ncclTopoNode* node, struct ncclTopoNode* remNode, int type, float bw);
 ncclResult_t ncclTopoPrintPaths(struct ncclTopoSystem* system);
+ncclResult_t ncclTopoDupSystem(struct ncclTopoSystem* system, struct ncclTopoSystem** copy);
 ncclResult_t ncclTopoLoadSystem(const char* xmlTopoFile, struct ncclTopoSystem* system);
 ncclResult_t ncclTopoGetIntermediateRank(struct ncclTopoSystem* system, int rank, int64_t netId, int* intermediateRank);
 
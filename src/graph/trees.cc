@@ -107,3 +107,48 @@ ncclResult_t ncclGetDtree(int nranks, int rank, int* s0, int* d0_0, int* d0_1, i
   }
   return ncclSuccess;
 }
+
+/* K-ary tree in heap order : rank r has parent (r-1)/k and children k*r+1 ... k*r+k.
+ * The child type is the index of the child (0 ... k-1).
+ *
+ * Illustration (k=3) :
+ *           0
+ *     /     |     \
+ *    1      2      3
+ *  / | \  / | \  / | \
+ * 4  5 6 7  8 9 10 11 12
+ */
+ncclResult_t ncclGetKtree(int nranks, int rank, int k, int* u, int* d, int* parentChildType) {
+  if (rank == 0) {
+    *u = -1;
+  } else {
+    *u = (rank-1)/k;
+    *parentChildType = (rank-1)%k;
+  }
+  for (int i=0; i<k; i++) {
+    int child = k*rank+1+i;
+    d[i] = child < nranks ? child : -1;
+  }
+  return ncclSuccess;
+}
+
+/* Build a double k-ary tree. The second tree is always the mirror of the first
+ * one : interior nodes are the lowest ranks of the first tree and the highest
+ * ranks of the second, so no node forwards data in both trees unless the trees
+ * are very small. Unlike the binary tree, shifting would not separate them.
+ */
+ncclResult_t ncclGetDKtree(int nranks, int rank, int k, int* s0, int* d0, int* parentChildType0, int* s1, int* d1, int* parentChildType1) {
+  ncclGetKtree(nranks, rank, k, s0, d0, parentChildType0);
+  int u;
+  ncclGetKtree(nranks, nranks-1-rank, k, &u, d1, parentChildType1);
+  *s1 = u == -1 ? -1 : nranks-1-u;
+  for (int i=0; i<k; i++) d1[i] = d1[i] == -1 ? -1 : nranks-1-d1[i];
+  return ncclSuccess;
+}
+
+// Number of levels below the root of a k-ary tree of nranks.
+int ncclGetKtreeDepth(int nranks, int k) {
+  int depth = 0;
+  for (long total = 1; total < nranks; total = total*k+1) depth++;
+  return depth;
+}
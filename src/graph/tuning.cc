@@ -8,6 +8,7 @@
 #include "device.h"
 #include "comm.h"
 #include "topo.h"
+#include "trees.h"
 
 NCCL_PARAM(Nthreads, "NTHREADS", -2);
 NCCL_PARAM(Ll128Nthreads, "LL128_NTHREADS", -2);
@@ -56,7 +57,9 @@ ncclResult_t parseList(const char* str, const char* elems[], int nelems, int* li
 static const float baseLat  [NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS] = {
        {  6.8, 14.0,    0 }, {  6.6, 14.0,  8.4 },  // Tree, Ring
        {    0,    0,    0 }, {    0,    0,    0 },  // Collnet Direct, Chain
-       {    0,    0,    0 }, {    0,    0,    0 }}; // NVLS, NVLS Tree
+       {    0,    0,    0 }, {    0,    0,    0 },  // NVLS, NVLS Tree
+       {    0,    0,  8.4 }, {    0,    0,  8.4 },  // Hier, RingScatter
+       {  6.6, 14.0,  8.4 }};                      // RecDbl
 
 // NVLink, PCI, Network
 #define NCCL_HW_NVLINK 0
@@ -66,15 +69,18 @@ static float hwLat [3][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS] =
 { /* NVLINK */
   { /* Tree (LL/LL128/Simple)*/ { .6, 1.25, 28 }, /* Ring (LL/LL128/Simple)*/ { .6, 1.9, 3.4 },
     /* CollNetDirect (Simple)*/ { 0, 0, 3.7 }, /* CollNetChain (Simple)*/ { 0, 0, 2.8 },
-    /* NVLS */ { 0, 0, 25 }, /* NVLSTree */ { 0, 0, 25 } },
+    /* NVLS */ { 0, 0, 25 }, /* NVLSTree */ { 0, 0, 25 }, /* Hier */ { 0, 0, 3.4 }, /* RingScatter */ { 0, 0, 3.4 },
+    /* RecDbl (LL/LL128/Simple)*/ { .6, 1.9, 3.4 } },
   /* PCI */
   { /* Tree (LL/LL128/Simple)*/ { 1.0, 1.9, 28 }, /* Ring (LL/LL128/Simple)*/ { 1.0, 2.5, 5.7 },
     /* CollNetDirect (Simple)*/ { 0, 0, 3.7 }, /* CollNetChain (Simple)*/ { 0, 0, 2.8 },
-    /* NVLS */ { 0, 0, 0 }, /* NVLSTree */ { 0, 0, 0 } },
+    /* NVLS */ { 0, 0, 0 }, /* NVLSTree */ { 0, 0, 0 }, /* Hier */ { 0, 0, 5.7 }, /* RingScatter */ { 0, 0, 5.7 },
+    /* RecDbl (LL/LL128/Simple)*/ { 1.0, 2.5, 5.7 } },
   /* NET */
   { /* Tree (LL/LL128/Simple)*/ { 5.0, 8.5, 28 }, /* Ring (LL/LL128/Simple)*/ { 2.7, 4.0, 14.0 },
     /* CollNetDirect (Simple)*/ { 0, 0, 31 }, /* CollNetChain (Simple)*/ { 0, 0, 30 },
-    /* NVLS */ { 0, 0, 18 }, /* NVLSTree */ { 0, 0, 14 } }
+    /* NVLS */ { 0, 0, 18 }, /* NVLSTree */ { 0, 0, 14 }, /* Hier */ { 0, 0, 14.0 }, /* RingScatter */ { 0, 0, 14.0 },
+    /* RecDbl (LL/LL128/Simple)*/ { 2.7, 4.0, 14.0 } }
 };
 
 /* Array indexes used below */
@@ -119,17 +125,22 @@ static float getNetOverhead(struct ncclComm* comm) {
 
 ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCompCap, struct ncclTopoGraph** graphs) {
   int simpleDefaultThreads = (graphs[NCCL_ALGO_RING]->bwIntra*graphs[NCCL_ALGO_RING]->nChannels <= PCI_BW) ? 256 : NCCL_SIMPLE_MAX_NTHREADS;
-  comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] =
+  comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] = comm->maxThreads[NCCL_ALGO_RING_SCATTER][NCCL_PROTO_SIMPLE] =
+    comm->maxThreads[NCCL_ALGO_RECDBL][NCCL_PROTO_SIMPLE] =
     getNthreads("NCCL_NTHREADS", ncclParamNthreads(), 2*WARP_SIZE, NCCL_SIMPLE_MAX_NTHREADS, simpleDefaultThreads);
   comm->maxThreads[NCCL_ALGO_TREE][NCCL_PROTO_SIMPLE] =
     getNthreads("NCCL_NTHREADS", ncclParamNthreads(), 2*WARP_SIZE, NCCL_SIMPLE_MAX_NTHREADS, NCCL_SIMPLE_MAX_NTHREADS);
+  comm->maxThreads[NCCL_ALGO_HIER][NCCL_PROTO_SIMPLE] =
+    getNthreads("NCCL_NTHREADS", ncclParamNthreads(), 2*WARP_SIZE, NCCL_SIMPLE_MAX_NTHREADS, NCCL_SIMPLE_MAX_NTHREADS);
   comm->maxThreads[NCCL_ALGO_COLLNET_DIRECT][NCCL_PROTO_SIMPLE] =
     comm->maxThreads[NCCL_ALGO_COLLNET_CHAIN][NCCL_PROTO_SIMPLE] =
     comm->maxThreads[NCCL_ALGO_NVLS][NCCL_PROTO_SIMPLE] =
     comm->maxThreads[NCCL_ALGO_NVLS_TREE][NCCL_PROTO_SIMPLE] = NCCL_MAX_NTHREADS;
   comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_LL] = comm->maxThreads[NCCL_ALGO_TREE][NCCL_PROTO_LL] =
+    comm->maxThreads[NCCL_ALGO_RECDBL][NCCL_PROTO_LL] =
     getNthreads("NCCL_NTHREADS", ncclParamNthreads(), 2*WARP_SIZE, NCCL_LL_MAX_NTHREADS, NCCL_LL_MAX_NTHREADS);
   comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_LL128] = comm->maxThreads[NCCL_ALGO_TREE][NCCL_PROTO_LL128] =
+    comm->maxThreads[NCCL_ALGO_RECDBL][NCCL_PROTO_LL128] =
     getNthreads("NCCL_LL128_NTHREADS", ncclParamLl128Nthreads(), NCCL_LL128_MAX_NTHREADS/4, NCCL_LL128_MAX_NTHREADS, NCCL_LL128_MAX_NTHREADS);
 
   int nNodes = comm->nNodes;
@@ -154,6 +165,18 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
   for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) intraHw[a] = graphs[a]->typeIntra == LINK_NVL ? NCCL_HW_NVLINK : NCCL_HW_PCI;
   for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) hw[a] = nNodes == 1 ? intraHw[a] : NCCL_HW_NET;
 
+  // Inter-node tree levels. K-ary trees are shallower, but each level waits
+  // for k children, add some serialization for that.
+  float treeLevels = comm->treeRadix > 2 ?
+    ncclGetKtreeDepth(nNodes, comm->treeRadix) * (1 + 0.1*(comm->treeRadix-2)) : log2i(nNodes);
+
+  // Recursive doubling: the first 2^nRounds ranks send all the data to
+  // one peer per round, the first rounds within the node. Folding the
+  // remaining ranks in and out costs two more rounds.
+  int rdRounds = log2i(nRanks);
+  int rdIntraRounds = std::min(rdRounds, (int)log2i(nRanks/nNodes));
+  int rdInterRounds = rdRounds - rdIntraRounds + ((1<<rdRounds) != nRanks ? 2 : 0);
+
   for (int coll=0; coll<NCCL_NUM_FUNCTIONS; coll++) {
     int nsteps = coll == ncclFuncAllReduce ? 2*(nRanks-1) :
       coll == ncclFuncReduceScatter || coll == ncclFuncAllGather ? nRanks-1 :
@@ -163,13 +186,15 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
       nNodes;
 
     for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
-      if (coll == ncclFuncBroadcast && a != NCCL_ALGO_RING) continue;
-      if (coll == ncclFuncReduce && a != NCCL_ALGO_RING) continue;
+      if (coll == ncclFuncBroadcast && a != NCCL_ALGO_RING && a != NCCL_ALGO_RING_SCATTER) continue;
+      if (coll == ncclFuncReduce && a != NCCL_ALGO_RING && a != NCCL_ALGO_RING_SCATTER) continue;
+      if (a == NCCL_ALGO_RING_SCATTER && coll != ncclFuncBroadcast && coll != ncclFuncReduce) continue;
+      if (a == NCCL_ALGO_RECDBL && coll != ncclFuncAllReduce) continue;
       if (coll == ncclFuncReduceScatter && a != NCCL_ALGO_RING && a != NCCL_ALGO_NVLS && a != NCCL_ALGO_COLLNET_DIRECT) continue;
-      if (coll == ncclFuncAllGather && a != NCCL_ALGO_RING && a != NCCL_ALGO_NVLS && a != NCCL_ALGO_COLLNET_DIRECT) continue;
+      if (coll == ncclFuncAllGather && a != NCCL_ALGO_RING && a != NCCL_ALGO_NVLS && a != NCCL_ALGO_COLLNET_DIRECT && a != NCCL_ALGO_HIER) continue;
 
       for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
-        if ((a == NCCL_ALGO_NVLS || a == NCCL_ALGO_NVLS_TREE) && p != NCCL_PROTO_SIMPLE) continue;
+        if ((a == NCCL_ALGO_NVLS || a == NCCL_ALGO_NVLS_TREE || a == NCCL_ALGO_HIER || a == NCCL_ALGO_RING_SCATTER) && p != NCCL_PROTO_SIMPLE) continue;
         int collnet = (a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) ? 1 : 0;
         float bw = nNodes <= 2 || collnet ? graphs[a]->bwIntra : graphs[a]->bwInter;
         if (a == NCCL_ALGO_NVLS) bw = std::min(graphs[a]->bwIntra, graphs[a]->bwInter);
@@ -183,6 +208,9 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
         if (a == NCCL_ALGO_TREE && p == NCCL_PROTO_LL) busBw = std::min(busBw*1.0/3.8, llMaxBw);
         if (a == NCCL_ALGO_TREE && p == NCCL_PROTO_LL128) busBw = std::min(busBw * (nNodes == 1 ? 7.0/9.0 : 120.0/128.0), graphs[a]->nChannels*perChMaxTreeLL128Bw);
         if (a == NCCL_ALGO_TREE && graphs[a]->pattern == NCCL_TOPO_PATTERN_TREE) busBw *= .85;
+        // Each k-ary tree node receives from k children instead of about one on average
+        // for the double binary tree, which its NIC has to absorb.
+        if (a == NCCL_ALGO_TREE && nNodes > 2 && comm->treeRadix > 2) busBw *= 2.0/comm->treeRadix;
         if (a == NCCL_ALGO_COLLNET_DIRECT && p != NCCL_PROTO_SIMPLE) busBw = 0;  // Not used
         if (a == NCCL_ALGO_COLLNET_CHAIN && p != NCCL_PROTO_SIMPLE) busBw = 0;  // Not used
         if (a == NCCL_ALGO_COLLNET_DIRECT && p == NCCL_PROTO_SIMPLE) {
@@ -208,11 +236,34 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
             if (minCompCap >= 90) busBw *= .85;
           }
         }
+        if (a == NCCL_ALGO_HIER) {
+          // Intra-node and inter-node rings are pipelined, so the slowest sets the
+          // pace. Each rank sends 2(nLocal-1)/nLocal of the data to its intra-node
+          // neighbor while the node sends 2(nNodes-1)/nNodes of it to the network,
+          // half as much for AllGather. That gives the algorithm BW directly, with
+          // some loss to the split.
+          int nLocal = nRanks/nNodes;
+          float nPasses = coll == ncclFuncAllGather ? 1.0 : 2.0;
+          float intraBw = graphs[a]->nChannels * graphs[a]->bwIntra * nLocal / (nPasses*(nLocal-1));
+          float interBw = graphs[a]->nChannels * graphs[a]->bwInter * nNodes / (nPasses*(nNodes-1));
+          busBw = std::min(intraBw, interBw) * .9;
+        }
+        if (a == NCCL_ALGO_RECDBL) {
+          float chBw = graphs[a]->nChannels * (p == NCCL_PROTO_LL ? .5 : p == NCCL_PROTO_LL128 ? .92 : 1.0);
+          float intraTime = rdIntraRounds / (chBw * graphs[a]->bwIntra);
+          float interTime = rdInterRounds ? rdInterRounds / (chBw * (nNodes > 1 ? graphs[a]->bwInter : graphs[a]->bwIntra)) : 0;
+          busBw = 1.0 / (intraTime + interTime);
+          if (p == NCCL_PROTO_LL) busBw = std::min(llMaxBw, busBw);
+        }
+
+        if (graphs[a]->nChannels) comm->stageBandwidths[coll][a][p] = busBw / graphs[a]->nChannels;
 
         // Convert bus BW to algorithm BW
-        if (!(a == NCCL_ALGO_COLLNET_DIRECT && (coll == ncclFuncAllGather || coll == ncclFuncReduceScatter))) {
+        if (!(a == NCCL_ALGO_COLLNET_DIRECT && (coll == ncclFuncAllGather || coll == ncclFuncReduceScatter)) && a != NCCL_ALGO_HIER && a != NCCL_ALGO_RECDBL) {
           float ratio = 1.0f;
           if (a == NCCL_ALGO_RING) ratio *= (1.0 * nRanks) / nsteps;
+          // The link next to the root carries 2(nRanks-1) of the nRanks chunks
+          else if (a == NCCL_ALGO_RING_SCATTER) ratio *= (1.0 * nRanks) / (2*(nRanks-1));
           else if (a == NCCL_ALGO_NVLS || a == NCCL_ALGO_NVLS_TREE) ratio *= 5.0/6.0;
           else ratio *= .5;
           busBw *= ratio;
@@ -236,6 +287,8 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
             } else {
               if (p == NCCL_PROTO_SIMPLE) lat = hwLat[hw[a]][NCCL_ALGO_TREE][p]; // Add some chunk latency, waiting for proper chunk modeling
               comm->latencies[coll][a][p] += nsteps*lat;
+              comm->pipeStages[coll][a] = nsteps;
+              comm->stageLatencies[coll][a][p] = lat;
             }
           } else {
             // Inter-node rings still have to launch nsteps * net overhead.
@@ -246,10 +299,15 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
             }
             intraLat = std::max(intraLat, netOverhead);
             comm->latencies[coll][a][p] += (nsteps-nInterSteps)*intraLat + nInterSteps*interLat;
+            comm->pipeStages[coll][a] = nsteps;
+            comm->stageLatencies[coll][a][p] = ((nsteps-nInterSteps)*intraLat + nInterSteps*interLat) / nsteps;
           }
         } else if (a == NCCL_ALGO_TREE) {
           comm->latencies[coll][a][p] +=
-            2 * ((nRanks/nNodes-1) * intraLat + log2i(nNodes) * interLat);
+            2 * ((nRanks/nNodes-1) * intraLat + treeLevels * interLat);
+          comm->pipeStages[coll][a] = 2 * ((nRanks/nNodes-1) + treeLevels);
+          if (comm->pipeStages[coll][a] > 0)
+            comm->stageLatencies[coll][a][p] = 2 * ((nRanks/nNodes-1) * intraLat + treeLevels * interLat) / comm->pipeStages[coll][a];
         } else if (a == NCCL_ALGO_COLLNET_DIRECT) {
           comm->latencies[coll][a][p] +=
             2 * (std::min(1, (nRanks/nNodes-1)) * intraLat + (nRanks/nNodes-1) * 0.4) + interLat;  // Add 0.4 us arity serialization latency
@@ -260,6 +318,16 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
           if (nNodes > 1) comm->latencies[coll][a][p] += interLat;
         } else if (a == NCCL_ALGO_NVLS_TREE) {
           comm->latencies[coll][a][p] += intraLat + 2 * log2i(nNodes) * interLat;
+        } else if (a == NCCL_ALGO_HIER) {
+          // Intra-node steps go over one shard of nNodes chunks
+          int nLocal = nRanks/nNodes;
+          int nPasses = coll == ncclFuncAllGather ? 1 : 2;
+          comm->latencies[coll][a][p] += nPasses * ((nLocal-1) * nNodes * intraLat + (nNodes-1) * interLat);
+        } else if (a == NCCL_ALGO_RING_SCATTER) {
+          // Scatter (or gather) then allgather (or reduce-scatter) around the ring
+          comm->latencies[coll][a][p] += 2 * ((nRanks-nNodes) * intraLat + (nNodes-1) * interLat);
+        } else if (a == NCCL_ALGO_RECDBL) {
+          comm->latencies[coll][a][p] += rdIntraRounds * intraLat + rdInterRounds * (nNodes > 1 ? interLat : intraLat);
         }
       }
     }
@@ -268,7 +336,7 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
   // Protocols/Algorithms enable/disable, and user overrides.
   // All are enabled except ll128 which is enabled by default only in certain cases.
   int protoEnable[NCCL_NUM_PROTOCOLS] = { 1, 2, 1 };
-  int algoEnable[NCCL_NUM_ALGORITHMS] = { 1, 1, 1, 1, 1, 1 };
+  int algoEnable[NCCL_NUM_ALGORITHMS] = { 1, 1, 1, 1, 1, 1, 1, 1, 1 };
 
   const char *protoStr = ncclGetEnv("NCCL_PROTO");
   if (protoStr) {
@@ -282,6 +350,8 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
   }
 
   if (comm->nNodes == 1) algoEnable[NCCL_ALGO_NVLS_TREE] = 0;
+  if (comm->hierSupport == 0) algoEnable[NCCL_ALGO_HIER] = 0;
+  if (comm->recDblSupport == 0) algoEnable[NCCL_ALGO_RECDBL] = 0;
 
   // Disable CollNet if it is not supported
   if (comm->collNetSupport == 0) {
@@ -290,7 +360,8 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
     if (nNodes > 1) algoEnable[NCCL_ALGO_NVLS] = 0;
     // If user has hard set NCCL_ALGO=COLLNET, ignore it
     if (algoEnable[NCCL_ALGO_RING] == 0 && algoEnable[NCCL_ALGO_TREE] == 0 &&
-        algoEnable[NCCL_ALGO_NVLS] == 0 && algoEnable[NCCL_ALGO_NVLS_TREE] == 0) {
+        algoEnable[NCCL_ALGO_NVLS] == 0 && algoEnable[NCCL_ALGO_NVLS_TREE] == 0 && algoEnable[NCCL_ALGO_HIER] == 0 &&
+        algoEnable[NCCL_ALGO_RECDBL] == 0) {
       algoEnable[NCCL_ALGO_RING] = algoEnable[NCCL_ALGO_TREE] = 1;
     }
   } else {
@@ -337,23 +408,25 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
 
   if (comm->rank == 0) {
     char line[1024];
-    for (int block=0; block<2; block++) {
+    // Three algorithms per table
+    for (int block=0; block<DIVUP(NCCL_NUM_ALGORITHMS, 3); block++) {
+      int nba = std::min(3, NCCL_NUM_ALGORITHMS-block*3);
       sprintf(line, "  Algorithm   |");
-      for (int ba=0; ba<NCCL_NUM_ALGORITHMS/2; ba++) {
-	int a = block*NCCL_NUM_ALGORITHMS/2+ba;
+      for (int ba=0; ba<nba; ba++) {
+	int a = block*3+ba;
         sprintf(line+strlen(line), " %14s   %14s   %14s |", "", ncclAlgoStr[a], "");
       }
       INFO(NCCL_TUNING, "%s", line);
       sprintf(line, "  Protocol    |");
-      for (int ba=0; ba<NCCL_NUM_ALGORITHMS/2; ba++) {
+      for (int ba=0; ba<nba; ba++) {
         for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
           sprintf(line+strlen(line), " %14s |", ncclProtoStr[p]);
         }
       }
       INFO(NCCL_TUNING, "%s", line);
       sprintf(line, " Max NThreads |");
-      for (int ba=0; ba<NCCL_NUM_ALGORITHMS/2; ba++) {
-	int a = block*NCCL_NUM_ALGORITHMS/2+ba;
+      for (int ba=0; ba<nba; ba++) {
+	int a = block*3+ba;
         for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
           sprintf(line+strlen(line), " %14d |", comm->maxThreads[a][p]);
         }
@@ -361,8 +434,8 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
       INFO(NCCL_TUNING, "%s", line);
       for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
         sprintf(line, "%13s |", ncclFuncStr[c]);
-        for (int ba=0; ba<NCCL_NUM_ALGORITHMS/2; ba++) {
-	  int a = block*NCCL_NUM_ALGORITHMS/2+ba;
+        for (int ba=0; ba<nba; ba++) {
+	  int a = block*3+ba;
           for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
             sprintf(line+strlen(line), "%8.1f/%6.1f |", comm->latencies[c][a][p], comm->bandwidths[c][a][p]);
           }
@@ -434,6 +507,10 @@ ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int proto
   int logSize = log2i(info->nBytes>>6);
   if (algorithm == NCCL_ALGO_TREE && logSize < 23) bw *= treeCorrectionFactor[protocol][logSize];
   if (info->nChannels != 0) bw = bw / info->comm->nChannels * info->nChannels;
+  // Algorithms are compared on the channels the group SM budget leaves them.
+  else if (info->comm->tasks.maxCTAs != 0 && info->comm->tasks.maxCTAs < info->comm->nChannels) bw = bw / info->comm->nChannels * info->comm->tasks.maxCTAs;
+  // Other comms running concurrently take their share of the links.
+  if (info->comm->contentionLoad > 0) bw /= 1 + info->comm->contentionLoad;
   if (algorithm == NCCL_ALGO_RING && protocol == NCCL_PROTO_SIMPLE && info->comm->nNodes > 1
       && info->coll == ncclFuncAllReduce && info->nBytes/(info->comm->nChannels*info->comm->nRanks) >= 64) {
     lat *= info->comm->minCompCap < 80 ? 1.9 : 1.4; // Plateau effect of ring
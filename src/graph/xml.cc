@@ -6,6 +6,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
@@ -21,23 +22,76 @@
 /* XML File Parser */
 /*******************/
 
-ncclResult_t xmlGetChar(FILE* file, char* c) {
-  if (fread(c, 1, 1, file) == 0) {
+// Files are mapped (or read) whole and scanned in memory
+struct xmlReader {
+  const char* ptr;
+  const char* end;
+  char* data;
+  size_t size;
+  bool mapped;
+};
+
+static ncclResult_t xmlReaderOpen(struct xmlReader* r, const char* path) {
+  memset(r, 0, sizeof(*r));
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return ncclSystemError;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      r->data = (char*)map;
+      r->size = st.st_size;
+      r->mapped = true;
+    }
+  }
+  if (!r->mapped) {
+    // Not a regular file, read it until EOF
+    size_t cap = 0;
+    ssize_t n;
+    do {
+      if (r->size == cap) {
+        char* data = (char*)realloc(r->data, cap = cap ? cap*2 : 65536);
+        if (data == NULL) {
+          free(r->data);
+          close(fd);
+          return ncclSystemError;
+        }
+        r->data = data;
+      }
+      n = read(fd, r->data+r->size, cap-r->size);
+      if (n > 0) r->size += n;
+    } while (n > 0 || (n == -1 && errno == EINTR));
+  }
+  close(fd);
+  r->ptr = r->data;
+  r->end = r->data+r->size;
+  return ncclSuccess;
+}
+
+static void xmlReaderClose(struct xmlReader* r) {
+  if (r->mapped) munmap(r->data, r->size);
+  else free(r->data);
+  r->data = NULL;
+}
+
+static inline ncclResult_t xmlGetChar(struct xmlReader* r, char* c) {
+  if (r->ptr == r->end) {
     WARN("XML Parse : Unexpected EOF");
     return ncclInternalError;
   }
+  *c = *r->ptr++;
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetValue(FILE* file, char* value, char* last) {
+ncclResult_t xmlGetValue(struct xmlReader* r, char* value, char* last) {
   char c;
-  NCCLCHECK(xmlGetChar(file, &c));
+  NCCLCHECK(xmlGetChar(r, &c));
   if (c != '"' && c != '\'') {
 #if INT_OK
     int o = 0;
     do {
       value[o++] = c;
-      NCCLCHECK(xmlGetChar(file, &c));
+      NCCLCHECK(xmlGetChar(r, &c));
     } while (c >= '0' && c <= '9');
     value[o] = '\0';
     *last = c;
@@ -47,46 +101,53 @@ ncclResult_t xmlGetValue(FILE* file, char* value, char* last) {
     return ncclInternalError;
 #endif
   }
-  int o = 0;
-  do {
-    NCCLCHECK(xmlGetChar(file, &c));
-    value[o++] = c;
-  } while (c != '"');
-  value[o-1] = '\0';
-  NCCLCHECK(xmlGetChar(file, last));
+  const char* quote = (const char*)memchr(r->ptr, '"', r->end-r->ptr);
+  if (quote == NULL) {
+    WARN("XML Parse : Unexpected EOF");
+    return ncclInternalError;
+  }
+  size_t len = quote-r->ptr;
+  if (len > MAX_STR_LEN) {
+    WARN("Error : value %.*s too long (max %d)", 32, r->ptr, MAX_STR_LEN);
+    return ncclInternalError;
+  }
+  memcpy(value, r->ptr, len);
+  value[len] = '\0';
+  r->ptr = quote+1;
+  NCCLCHECK(xmlGetChar(r, last));
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetToken(FILE* file, char* name, char* value, char* last) {
+static inline bool xmlTokenEnd(char c) {
+  return c == '=' || c == ' ' || c == '>' || c == '/' || c == '\n' || c == '\r';
+}
+
+ncclResult_t xmlGetToken(struct xmlReader* r, char* name, char* value, char* last) {
+  const char* start = r->ptr;
+  while (r->ptr < r->end && !xmlTokenEnd(*r->ptr)) r->ptr++;
+  size_t len = r->ptr-start;
+  if (len >= MAX_STR_LEN-1) {
+    WARN("Error : name %.*s too long (max %d)", MAX_STR_LEN-1, start, MAX_STR_LEN);
+    return ncclInternalError;
+  }
+  memcpy(name, start, len);
+  name[len] = '\0';
   char c;
-  char* ptr = name;
-  int o = 0;
-  do {
-    NCCLCHECK(xmlGetChar(file, &c));
-    if (c == '=') {
-      ptr[o] = '\0';
-      if (value == NULL) {
-        WARN("XML Parse : Unexpected value with name %s", ptr);
-        return ncclInternalError;
-      }
-      return xmlGetValue(file, value, last);
-    }
-    ptr[o] = c;
-    if (o == MAX_STR_LEN-1) {
-      ptr[o] = '\0';
-      WARN("Error : name %s too long (max %d)", ptr, MAX_STR_LEN);
+  NCCLCHECK(xmlGetChar(r, &c));
+  if (c == '=') {
+    if (value == NULL) {
+      WARN("XML Parse : Unexpected value with name %s", name);
       return ncclInternalError;
     }
-    o++;
-  } while (c != ' ' && c != '>' && c != '/' && c != '\n' && c != '\r');
-  ptr[o-1] = '\0';
+    return xmlGetValue(r, value, last);
+  }
   *last = c;
   return ncclSuccess;
 }
 
 // Shift the 3-chars string by one char and append c at the end
 #define SHIFT_APPEND(s, c) do { s[0]=s[1]; s[1]=s[2]; s[2]=c; } while(0)
-ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
+ncclResult_t xmlSkipComment(struct xmlReader* r, char* start, char next) {
   // Start from something neutral with \0 at the end.
   char end[4] = "...";
 
@@ -97,40 +158,40 @@ ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
 
   // Stop when we find "-->"
   while (strcmp(end, "-->") != 0) {
-    int c;
-    if (fread(&c, 1, 1, file) != 1) {
+    if (r->ptr == r->end) {
       WARN("XML Parse error : unterminated comment");
       return ncclInternalError;
     }
-    SHIFT_APPEND(end, c);
+    SHIFT_APPEND(end, *r->ptr++);
   }
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
+ncclResult_t xmlGetNode(struct xmlReader* r, struct ncclXmlNode* node) {
   node->type = NODE_TYPE_NONE;
   char c = ' ';
   while (c == ' ' || c == '\n' || c == '\r') {
-    if (fread(&c, 1, 1, file) == 0) return ncclSuccess;
+    if (r->ptr == r->end) return ncclSuccess;
+    c = *r->ptr++;
   }
   if (c != '<') {
     WARN("XML Parse error : expecting '<', got '%c'", c);
     return ncclInternalError;
   }
   // Read XML element name
-  NCCLCHECK(xmlGetToken(file, node->name, NULL, &c));
+  NCCLCHECK(xmlGetToken(r, node->name, NULL, &c));
 
   // Check for comments
   if (strncmp(node->name, "!--", 3) == 0) {
-    NCCLCHECK(xmlSkipComment(file, node->name+3, c));
-    return xmlGetNode(file, node);
+    NCCLCHECK(xmlSkipComment(r, node->name+3, c));
+    return xmlGetNode(r, node);
   }
 
   // Check for closing tag
   if (node->name[0] == '\0' && c == '/') {
     node->type = NODE_TYPE_CLOSE;
     // Re-read the name, we got '/' in the first call
-    NCCLCHECK(xmlGetToken(file, node->name, NULL, &c));
+    NCCLCHECK(xmlGetToken(r, node->name, NULL, &c));
     if (c != '>') {
       WARN("XML Parse error : unexpected trailing %c in closing tag %s", c, node->name);
       return ncclInternalError;
@@ -143,7 +204,7 @@ ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
   // Get Attributes
   int a = 0;
   while (c == ' ') {
-    NCCLCHECK(xmlGetToken(file, node->attrs[a].key, node->attrs[a].value, &c));
+    NCCLCHECK(xmlGetToken(r, node->attrs[a].key, node->attrs[a].value, &c));
     if (a == MAX_ATTR_COUNT) {
       INFO(NCCL_GRAPH, "XML Parse : Ignoring extra attributes (max %d)", MAX_ATTR_COUNT);
       // Actually we need to still consume the extra attributes so we have an extra one.
@@ -153,7 +214,7 @@ ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
   if (c == '/') {
     node->type = NODE_TYPE_SINGLE;
     char str[MAX_STR_LEN];
-    NCCLCHECK(xmlGetToken(file, str, NULL, &c));
+    NCCLCHECK(xmlGetToken(r, str, NULL, &c));
   }
   if (c != '>') {
     WARN("XML Parse : expected >, got '%c'", c);
@@ -162,14 +223,14 @@ ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
   return ncclSuccess;
 }
 
-typedef ncclResult_t (*xmlHandlerFunc_t)(FILE*, struct ncclXml*, struct ncclXmlNode*);
+typedef ncclResult_t (*xmlHandlerFunc_t)(struct xmlReader*, struct ncclXml*, struct ncclXmlNode*);
 
 struct xmlHandler {
   const char * name;
   xmlHandlerFunc_t func;
 };
 
-ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head, struct xmlHandler handlers[], int nHandlers) {
+ncclResult_t xmlLoadSub(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head, struct xmlHandler handlers[], int nHandlers) {
   if (head && head->type == NODE_TYPE_SINGLE) return ncclSuccess;
   while (1) {
     if (xml->maxIndex == xml->maxNodes) {
@@ -178,7 +239,7 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
     }
     struct ncclXmlNode* node = xml->nodes+xml->maxIndex;
     memset(node, 0, sizeof(struct ncclXmlNode));
-    NCCLCHECK(xmlGetNode(file, node));
+    NCCLCHECK(xmlGetNode(r, node));
     if (node->type == NODE_TYPE_NONE) {
       if (head) {
         WARN("XML Parse : unterminated %s", head->name);
@@ -208,18 +269,158 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
         node->parent = head;
         node->nSubs = 0;
         xml->maxIndex++;
-        NCCLCHECK(handlers[h].func(file, xml, node));
+        NCCLCHECK(handlers[h].func(r, xml, node));
         found = 1;
         break;
       }
     }
     if (!found) {
       if (nHandlers) INFO(NCCL_GRAPH, "Ignoring element %s", node->name);
-      NCCLCHECK(xmlLoadSub(file, xml, node, NULL, 0));
+      NCCLCHECK(xmlLoadSub(r, xml, node, NULL, 0));
     }
   }
 }
 
+/*****************/
+/* Binary format */
+/*****************/
+
+// Compact form of a topology, which ncclTopoGetXmlFromFile loads without
+// parsing: a header, then the nodes in depth-first order, each as its parent
+// index, type, name and attributes, strings as a length byte and the chars.
+#define XML_BIN_MAGIC "NCCLTOPB"
+#define XML_BIN_VERSION 1
+
+struct xmlBinHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nNodes;
+};
+
+static ncclResult_t xmlBinRead(struct xmlReader* r, void* dst, size_t size) {
+  if ((size_t)(r->end-r->ptr) < size) {
+    WARN("XML Binary : Unexpected EOF");
+    return ncclInternalError;
+  }
+  memcpy(dst, r->ptr, size);
+  r->ptr += size;
+  return ncclSuccess;
+}
+
+static ncclResult_t xmlBinReadStr(struct xmlReader* r, char* str) {
+  uint8_t len;
+  NCCLCHECK(xmlBinRead(r, &len, 1));
+  NCCLCHECK(xmlBinRead(r, str, len));
+  str[len] = '\0';
+  return ncclSuccess;
+}
+
+static bool xmlIsBin(struct xmlReader* r) {
+  return (size_t)(r->end-r->ptr) >= sizeof(struct xmlBinHeader) && memcmp(r->ptr, XML_BIN_MAGIC, 8) == 0;
+}
+
+static ncclResult_t xmlLoadBin(struct xmlReader* r, struct ncclXml* xml) {
+  struct xmlBinHeader hdr;
+  NCCLCHECK(xmlBinRead(r, &hdr, sizeof(hdr)));
+  if (hdr.version != XML_BIN_VERSION) {
+    WARN("XML Binary topology has wrong version %d, %d needed", hdr.version, XML_BIN_VERSION);
+    return ncclInvalidUsage;
+  }
+  if (hdr.nNodes == 0 || hdr.nNodes > xml->maxNodes) {
+    WARN("Error : XML parser is limited to %d nodes", xml->maxNodes);
+    return ncclInternalError;
+  }
+  for (int n=0; n<hdr.nNodes; n++) {
+    struct ncclXmlNode* node = xml->nodes+n;
+    memset(node, 0, sizeof(struct ncclXmlNode));
+    int32_t parent;
+    uint8_t type, nAttrs;
+    NCCLCHECK(xmlBinRead(r, &parent, sizeof(parent)));
+    NCCLCHECK(xmlBinRead(r, &type, 1));
+    NCCLCHECK(xmlBinReadStr(r, node->name));
+    NCCLCHECK(xmlBinRead(r, &nAttrs, 1));
+    if (parent >= n || (parent < 0 && n > 0) || nAttrs > MAX_ATTR_COUNT) {
+      WARN("XML Binary : corrupted node %d", n);
+      return ncclInternalError;
+    }
+    node->type = type;
+    node->nAttrs = nAttrs;
+    for (int a=0; a<nAttrs; a++) {
+      NCCLCHECK(xmlBinReadStr(r, node->attrs[a].key));
+      NCCLCHECK(xmlBinReadStr(r, node->attrs[a].value));
+    }
+    if (parent >= 0) {
+      struct ncclXmlNode* head = xml->nodes+parent;
+      if (head->nSubs == MAX_SUBS) {
+        WARN("Error : XML parser is limited to %d subnodes", MAX_SUBS);
+        return ncclInternalError;
+      }
+      head->subs[head->nSubs++] = node;
+      node->parent = head;
+    }
+  }
+  xml->maxIndex = hdr.nNodes;
+  return ncclSuccess;
+}
+
+// Bytes needed to encode node and its subtree, and number of nodes in it
+static size_t xmlBinSize(struct ncclXmlNode* node, int* nNodes) {
+  size_t size = sizeof(int32_t) + 3 + strlen(node->name);
+  for (int a=0; a<node->nAttrs; a++) size += 2 + strlen(node->attrs[a].key) + strlen(node->attrs[a].value);
+  (*nNodes)++;
+  for (int s=0; s<node->nSubs; s++) size += xmlBinSize(node->subs[s], nNodes);
+  return size;
+}
+
+static void xmlBinWriteStr(char** ptr, const char* str) {
+  uint8_t len = strlen(str);
+  *(*ptr)++ = len;
+  memcpy(*ptr, str, len);
+  *ptr += len;
+}
+
+static void xmlBinWriteRec(char** ptr, struct ncclXmlNode* node, int32_t parent, int32_t* index) {
+  int32_t self = (*index)++;
+  memcpy(*ptr, &parent, sizeof(parent));
+  *ptr += sizeof(parent);
+  *(*ptr)++ = node->nSubs ? NODE_TYPE_OPEN : NODE_TYPE_SINGLE;
+  xmlBinWriteStr(ptr, node->name);
+  *(*ptr)++ = node->nAttrs;
+  for (int a=0; a<node->nAttrs; a++) {
+    xmlBinWriteStr(ptr, node->attrs[a].key);
+    xmlBinWriteStr(ptr, node->attrs[a].value);
+  }
+  for (int s=0; s<node->nSubs; s++) xmlBinWriteRec(ptr, node->subs[s], self, index);
+}
+
+ncclResult_t ncclTopoXmlToBin(struct ncclXml* xml, char** buf, size_t* size) {
+  struct xmlBinHeader hdr;
+  int nNodes = 0;
+  *size = sizeof(hdr) + xmlBinSize(xml->nodes, &nNodes);
+  memcpy(hdr.magic, XML_BIN_MAGIC, 8);
+  hdr.version = XML_BIN_VERSION;
+  hdr.nNodes = nNodes;
+  NCCLCHECK(ncclCalloc(buf, *size));
+  char* ptr = *buf;
+  memcpy(ptr, &hdr, sizeof(hdr));
+  ptr += sizeof(hdr);
+  int32_t index = 0;
+  xmlBinWriteRec(&ptr, xml->nodes, -1, &index);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoXmlFromBin(const char* buf, size_t size, struct ncclXml* xml) {
+  struct xmlReader r;
+  memset(&r, 0, sizeof(r));
+  r.ptr = buf;
+  r.end = buf+size;
+  if (!xmlIsBin(&r)) {
+    WARN("XML Binary : bad magic");
+    return ncclInternalError;
+  }
+  return xmlLoadBin(&r, xml);
+}
+
 /**************/
 /* XML Writer */
 /**************/
@@ -267,7 +468,16 @@ ncclResult_t ncclTopoDumpXmlToFile(const char* xmlTopoFile, struct ncclXml* xml)
     WARN("Unable to open %s, not dumping topology.", xmlTopoFile);
     return ncclSuccess;
   }
-  NCCLCHECK(ncclTopoDumpXmlRec(0, file, xml->nodes));
+  size_t len = strlen(xmlTopoFile);
+  if (len > 4 && strcmp(xmlTopoFile+len-4, ".bin") == 0) {
+    char* buf;
+    size_t size;
+    NCCLCHECK(ncclTopoXmlToBin(xml, &buf, &size));
+    fwrite(buf, 1, size, file);
+    free(buf);
+  } else {
+    NCCLCHECK(ncclTopoDumpXmlRec(0, file, xml->nodes));
+  }
   fclose(file);
   return ncclSuccess;
 }
@@ -330,45 +540,45 @@ ncclResult_t ncclTopoFuseXml(struct ncclXml* dst, struct ncclXml* src) {
 /* Parser rules for our specific format */
 /****************************************/
 
-ncclResult_t ncclTopoXmlLoadNvlink(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadNvlink(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(r, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadC2c(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadC2c(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(r, xml, head, NULL, 0));
   return ncclSuccess;
 }
-ncclResult_t ncclTopoXmlLoadGpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadGpu(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "nvlink", ncclTopoXmlLoadNvlink }, { "c2c", ncclTopoXmlLoadC2c } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadNet(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadNet(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(r, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadNic(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadNic(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "net", ncclTopoXmlLoadNet } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadPci(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadPci(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "pci", ncclTopoXmlLoadPci }, { "gpu", ncclTopoXmlLoadGpu }, { "nic", ncclTopoXmlLoadNic} };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 3));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 3));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadCpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadCpu(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "pci", ncclTopoXmlLoadPci }, { "nic", ncclTopoXmlLoadNic } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadSystem(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadSystem(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   int version;
   NCCLCHECK(xmlGetAttrInt(head, "version", &version));
   if (version != NCCL_TOPO_XML_VERSION) {
@@ -381,24 +591,36 @@ ncclResult_t ncclTopoXmlLoadSystem(FILE* file, struct ncclXml* xml, struct ncclX
   else INFO(NCCL_GRAPH, "Loading unnamed topology");
 
   struct xmlHandler handlers[] = { { "cpu", ncclTopoXmlLoadCpu } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoGetXmlFromFile(const char* xmlTopoFile, struct ncclXml* xml, int warn) {
-  FILE* file = fopen(xmlTopoFile, "r");
-  if (file == NULL) {
+  ncclResult_t ret = ncclSuccess;
+  struct xmlReader r;
+  if (xmlReaderOpen(&r, xmlTopoFile) != ncclSuccess) {
     if (warn) {
       WARN("Could not open XML topology file %s : %s", xmlTopoFile, strerror(errno));
     }
     return ncclSuccess;
   }
   INFO(NCCL_GRAPH, "Loading topology file %s", xmlTopoFile);
-  struct xmlHandler handlers[] = { { "system", ncclTopoXmlLoadSystem } };
   xml->maxIndex = 0;
-  NCCLCHECK(xmlLoadSub(file, xml, NULL, handlers, 1));
-  fclose(file);
-  return ncclSuccess;
+  if (xmlIsBin(&r)) {
+    int version;
+    NCCLCHECKGOTO(xmlLoadBin(&r, xml), ret, exit);
+    NCCLCHECKGOTO(xmlGetAttrInt(xml->nodes, "version", &version), ret, exit);
+    if (strcmp(xml->nodes[0].name, "system") != 0 || version != NCCL_TOPO_XML_VERSION) {
+      WARN("XML Topology has wrong version %d, %d needed", version, NCCL_TOPO_XML_VERSION);
+      ret = ncclInvalidUsage;
+    }
+  } else {
+    struct xmlHandler handlers[] = { { "system", ncclTopoXmlLoadSystem } };
+    NCCLCHECKGOTO(xmlLoadSub(&r, xml, NULL, handlers, 1), ret, exit);
+  }
+exit:
+  xmlReaderClose(&r);
+  return ret;
 }
 
 /**********************/
@@ -937,29 +1159,29 @@ ncclResult_t ncclTopoTrimXml(struct ncclXml* xml) {
 /* Parser rules for the user-defined graph search */
 /**************************************************/
 
-ncclResult_t ncclTopoXmlGraphLoadGpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlGraphLoadGpu(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(r, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadNet(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlGraphLoadNet(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(r, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadChannel(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadChannel(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "net", ncclTopoXmlGraphLoadNet }, { "gpu", ncclTopoXmlGraphLoadGpu } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadGraph(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadGraph(struct xmlReader* r, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "channel", ncclTopoXmlGraphLoadChannel } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(r, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadGraphs(FILE* file, struct ncclXml* xmlGraph, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadGraphs(struct xmlReader* r, struct ncclXml* xmlGraph, struct ncclXmlNode* head) {
   int version;
   NCCLCHECK(xmlGetAttrInt(head, "version", &version));
   if (version != NCCL_GRAPH_XML_VERSION) {
@@ -972,19 +1194,21 @@ ncclResult_t ncclTopoXmlGraphLoadGraphs(FILE* file, struct ncclXml* xmlGraph, st
   else INFO(NCCL_GRAPH, "Loading graphs");
 
   struct xmlHandler handlers[] = { { "graph", ncclTopoXmlGraphLoadGraph } };
-  NCCLCHECK(xmlLoadSub(file, xmlGraph, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(r, xmlGraph, head, handlers, 1));
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoGetXmlGraphFromFile(const char* xmlGraphFile, struct ncclXml* xml) {
-  FILE* file = fopen(xmlGraphFile, "r");
-  if (file == NULL) {
+  ncclResult_t ret = ncclSuccess;
+  struct xmlReader r;
+  if (xmlReaderOpen(&r, xmlGraphFile) != ncclSuccess) {
     WARN("Could not open XML graph file %s : %s", xmlGraphFile, strerror(errno));
     return ncclSystemError;
   }
   struct xmlHandler handlers[] = { { "graphs", ncclTopoXmlGraphLoadGraphs } };
   xml->maxIndex = 0;
-  NCCLCHECK(xmlLoadSub(file, xml, NULL, handlers, 1));
-  fclose(file);
-  return ncclSuccess;
+  NCCLCHECKGOTO(xmlLoadSub(&r, xml, NULL, handlers, 1), ret, exit);
+exit:
+  xmlReaderClose(&r);
+  return ret;
 }
@@ -59,6 +59,9 @@ ncclResult_t ncclTopoTrimXml(struct ncclXml* xml);
 ncclResult_t ncclTopoFuseXml(struct ncclXml* dst, struct ncclXml* src);
 /* Relocate pointers in XML to (de-)serialize the structure */
 ncclResult_t ncclTopoConvertXml(struct ncclXml* xml, uintptr_t base, int exp);
+/* Compact binary encoding, buf is allocated by ncclTopoXmlToBin */
+ncclResult_t ncclTopoXmlToBin(struct ncclXml* xml, char** buf, size_t* size);
+ncclResult_t ncclTopoXmlFromBin(const char* buf, size_t size, struct ncclXml* xml);
 
 /**************/
 /* XML Struct */
@@ -20,6 +20,8 @@ __thread struct ncclGroupJob *ncclGroupJobMainPtr = NULL;
 __thread struct ncclGroupJob ncclGroupJobMain;
 __thread int ncclGroupBlocking = -1; /* default mode */
 __thread bool ncclGroupJobAbortFlag = false;
+__thread int ncclGroupMaxCTAs = 0;
+__thread uint64_t ncclGroupOpTag = 0;
 
 void* ncclAsyncJobMain(void* arg);
 
@@ -41,6 +43,7 @@ ncclResult_t ncclAsyncLaunch(
     job->destructor = destructor;
     job->abortFlag = comm->abortFlag;
     job->childAbortFlag = comm->childAbortFlag;
+    job->abortFlagDevHost = comm->abortFlagDevHost;
     job->state = ncclGroupJobRunning;
     job->comm = comm;
     /* check if there are blocking and nonblocking comms at the same time in group. */
@@ -98,6 +101,32 @@ exit:
   return ret;
 }
 
+NCCL_API(ncclResult_t, ncclGroupSetMaxCTAs, int maxCTAs);
+ncclResult_t ncclGroupSetMaxCTAs(int maxCTAs) {
+  if (ncclGroupDepth == 0) {
+    WARN("ncclGroupSetMaxCTAs: not in a group call.");
+    return ncclInvalidUsage;
+  }
+  if (maxCTAs < 0) {
+    WARN("ncclGroupSetMaxCTAs: invalid maxCTAs %d", maxCTAs);
+    return ncclInvalidArgument;
+  }
+  ncclGroupMaxCTAs = maxCTAs;
+  TRACE_CALL("ncclGroupSetMaxCTAs(%d)", maxCTAs);
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclGroupSetOpTag, uint64_t tag);
+ncclResult_t ncclGroupSetOpTag(uint64_t tag) {
+  if (ncclGroupDepth == 0) {
+    WARN("ncclGroupSetOpTag: not in a group call.");
+    return ncclInvalidUsage;
+  }
+  ncclGroupOpTag = tag;
+  TRACE_CALL("ncclGroupSetOpTag(%lx)", tag);
+  return ncclSuccess;
+}
+
 struct ncclPreconnectJob {
   struct ncclAsyncJob base;
   struct ncclComm* comm;
@@ -108,6 +137,29 @@ ncclResult_t ncclPreconnectFunc(struct ncclAsyncJob* job_) {
   CUDACHECK(cudaSetDevice(comm->cudaDev));
   if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
   NCCLCHECK(ncclTransportP2pSetup(comm, NULL, 1));
+  // Then rings and trees collectives of this group will use
+  if (comm->collNeedConnect[NCCL_ALGO_RING] || comm->collNeedConnect[NCCL_ALGO_RING_SCATTER]) NCCLCHECK(ncclTransportRingConnect(comm, comm->collGraphs[NCCL_ALGO_RING]));
+  if (comm->collNeedConnect[NCCL_ALGO_TREE]) NCCLCHECK(ncclTransportTreeConnect(comm, comm->collGraphs[NCCL_ALGO_TREE]));
+  if (comm->collNeedConnect[NCCL_ALGO_HIER]) NCCLCHECK(ncclTransportHierConnect(comm));
+  if (comm->collNeedConnect[NCCL_ALGO_RECDBL]) NCCLCHECK(ncclTransportRecDblConnect(comm));
+  NCCLCHECK(ncclNvlsConnect(comm));
+  return ncclSuccess;
+}
+
+struct ncclTuningSyncJob {
+  struct ncclAsyncJob base;
+  struct ncclComm* comm;
+};
+// Autotune results, contention loads and arrival times are exchanged through
+// bootstrap, which would deadlock if a thread driving several ranks did it, so
+// each comm gets its own thread.
+ncclResult_t ncclTuningSyncFunc(struct ncclAsyncJob* job_) {
+  struct ncclTuningSyncJob* job = (struct ncclTuningSyncJob*)job_;
+  struct ncclComm* comm = job->comm;
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  NCCLCHECK(ncclAutotuneSyncBuckets(comm));
+  NCCLCHECK(ncclContentionSync(comm));
+  NCCLCHECK(ncclStragglerSync(comm));
   return ncclSuccess;
 }
 
@@ -235,13 +287,18 @@ static void groupCleanup(struct ncclComm** groupCommHeadPtr, struct ncclComm** g
     // Reset comm->tasks to empty.
     comm->tasks.nTasksColl = 0;
     comm->tasks.nTasksP2p = 0;
+    comm->tasks.nTasksCe = 0;
+    comm->tasks.maxCTAs = 0;
     comm->tasks.workBytesTotal = 0;
     comm->tasks.streams = nullptr;
     ncclIntruQueueConstruct(&comm->tasks.collQueue);
+    ncclIntruQueueConstruct(&comm->tasks.ceQueue);
     for (int i = 0; i < comm->nRanks; i++) {
       ncclIntruQueueConstruct(&comm->tasks.peers[i].sendQueue);
       ncclIntruQueueConstruct(&comm->tasks.peers[i].recvQueue);
     }
+    for (int a = 0; a < comm->tasks.nP2pActiveSteps; a++) comm->tasks.p2pStepActive[comm->tasks.p2pActiveSteps[a]] = false;
+    comm->tasks.nP2pActiveSteps = 0;
 
     if (!comm->config.blocking)
       (void) ncclCommSetAsyncError(comm, error);
@@ -273,6 +330,22 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
 
   CUDACHECKGOTO(cudaGetDevice(&savedDev), ret, fail);
 
+  // Comms whose collectives need rings or trees not connected yet go through
+  // the preconnect job as well.
+  for (struct ncclComm* comm = groupCommHeadMain; comm != nullptr; comm = comm->groupNext) {
+    bool needConnect;
+    // Copy engine collectives exchange buffers with the peers, which could
+    // deadlock if other communicators of the group were waiting on them.
+    NCCLCHECKGOTO(ncclCollSortTasks(comm), ret, fail);
+    NCCLCHECKGOTO(ncclCeCollSelect(comm, groupCommHeadMain->groupNext == nullptr), ret, fail);
+    NCCLCHECKGOTO(ncclCollFuseTasks(comm), ret, fail);
+    NCCLCHECKGOTO(ncclCollPrepareConnect(comm, &needConnect), ret, fail);
+    if (needConnect && comm->preconnectNext == reinterpret_cast<struct ncclComm*>(0x1)) {
+      comm->preconnectNext = groupCommPreconnectHeadMain;
+      groupCommPreconnectHeadMain = comm;
+    }
+  }
+
   if (groupCommPreconnectHeadMain != nullptr) {
     struct ncclComm* comm = groupCommPreconnectHeadMain;
     do {
@@ -283,6 +356,7 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
       job->base.destructor = free;
       job->base.state = ncclGroupJobRunning;
       job->base.abortFlag = comm->abortFlag;
+      job->base.abortFlagDevHost = comm->abortFlagDevHost;
       job->comm = comm;
       ncclIntruQueueEnqueue(asyncJobsMain, &job->base);
 
@@ -292,6 +366,23 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
     } while (comm != nullptr);
   }
 
+  for (struct ncclComm* comm = groupCommHeadMain; comm != nullptr; comm = comm->groupNext) {
+    bool autotuneSync = comm->autotune != nullptr && comm->autotune->nSyncPending != 0;
+    bool contentionSync = comm->contention != nullptr && comm->contention->syncPending;
+    bool stragglerSync = comm->straggler != nullptr && comm->straggler->syncPending;
+    if (!autotuneSync && !contentionSync && !stragglerSync) continue;
+    struct ncclTuningSyncJob* job;
+    NCCLCHECKGOTO(ncclCalloc(&job, 1), ret, fail);
+    job->base.func = ncclTuningSyncFunc;
+    job->base.undo = nullptr;
+    job->base.destructor = free;
+    job->base.state = ncclGroupJobRunning;
+    job->base.abortFlag = comm->abortFlag;
+    job->base.abortFlagDevHost = comm->abortFlagDevHost;
+    job->comm = comm;
+    ncclIntruQueueEnqueue(asyncJobsMain, &job->base);
+  }
+
   if (!ncclIntruQueueEmpty(asyncJobsMain)) {
     struct ncclAsyncJob* job = ncclIntruQueueHead(asyncJobsMain);
     do {
@@ -323,7 +414,8 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
 
         if (__atomic_load_n(groupAbortFlag, __ATOMIC_RELAXED) || errorJobAbortFlag == true) {
           __atomic_store_n(job->abortFlag, 1, __ATOMIC_RELAXED);
-          if (job->childAbortFlag) __atomic_store_n(job->childAbortFlag, 1, __ATOMIC_RELAXED);
+          ncclAbortFlagDevSet(job->abortFlagDevHost);
+          if (job->childAbortFlag) ncclChildAbortFlagSet(job->comm, job->childAbortFlag);
         }
 
         job = job->next;
@@ -376,6 +468,18 @@ ncclResult_t ncclGroupEndInternal() {
 
   if ((--ncclGroupDepth) > 0) goto exit;
 
+  // Tasks staged for thread-safe communicators join the group now
+  if (ncclGroupError == ncclSuccess) {
+    NCCLCHECKGOTO(ncclEnqueueStagedFlush(), ret, fail);
+  }
+
+  for (struct ncclComm* comm = ncclGroupCommHead; comm != nullptr; comm = comm->groupNext) {
+    comm->tasks.maxCTAs = ncclGroupMaxCTAs;
+    comm->tasks.opTag = ncclGroupOpTag;
+  }
+  ncclGroupMaxCTAs = 0;
+  ncclGroupOpTag = 0;
+
   if ((ret = ncclGroupError) != ncclSuccess) goto fail;
 
   if (ncclGroupCommHead != nullptr || !ncclIntruQueueEmpty(&ncclAsyncJobs) || ncclGroupCommPreconnectHead != nullptr) {
@@ -421,6 +525,7 @@ ncclResult_t ncclGroupEndInternal() {
   }
 
 exit:
+  if (ncclGroupDepth == 0) ncclEnqueueStagedRelease();
   return ret;
 fail:
   groupCleanup(&ncclGroupCommHead, &ncclGroupCommPreconnectHead, &ncclAsyncJobs, &ncclGroupError, &ncclGroupBlocking, &ncclGroupJobAbortFlag, ret);
@@ -0,0 +1,65 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_AUTOTUNE_H_
+#define NCCL_AUTOTUNE_H_
+
+#include "nccl.h"
+#include "nccl_common.h"
+
+// Online auto-tuning (NCCL_AUTOTUNE=<n>). For each collective and power-of-two
+// size bucket, the first calls cycle through the algorithm/protocol/nChannels
+// combinations the model considers plausible, timing each one n times. Once
+// all have been tried, ranks agree on the fastest one from their combined
+// timings and keep using it. Results can be saved to NCCL_AUTOTUNE_FILE.
+
+#define NCCL_AUTOTUNE_BUCKETS 64
+#define NCCL_AUTOTUNE_MAX_CANDIDATES (NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS*2)
+
+enum ncclAutotuneState {
+  ncclAutotuneIdle = 0,    // Not seen yet
+  ncclAutotuneExplore = 1, // Calls are assigned candidates in turn
+  ncclAutotuneSync = 2,    // All trials issued, waiting for ranks to agree
+  ncclAutotuneDone = 3     // algorithm/protocol/nChannels hold the result
+};
+
+struct ncclAutotuneCand {
+  int algorithm, protocol;
+  int nChannels; // 0 to let NCCL pick
+  float time;    // sum of measured durations in us
+  int count;     // number of measurements
+};
+
+struct ncclAutotuneBucket {
+  int state;
+  int nCalls; // calls issued while exploring
+  int nCand;
+  struct ncclAutotuneCand* cand;
+  // Result, algorithm is NCCL_ALGO_UNDEF if default tuning should be used
+  int algorithm, protocol, nChannels;
+};
+
+struct ncclAutotune {
+  int iters; // trials per candidate
+  int nSyncPending;
+  struct ncclAutotuneBucket buckets[NCCL_NUM_FUNCTIONS][NCCL_AUTOTUNE_BUCKETS];
+};
+
+struct ncclComm;
+
+// Set up comm->autotune if NCCL_AUTOTUNE is set and no tuner plugin is loaded,
+// and load previous results. Collective across the communicator.
+ncclResult_t ncclAutotuneInit(struct ncclComm* comm);
+ncclResult_t ncclAutotuneFree(struct ncclComm* comm);
+
+struct ncclAutotuneBucket* ncclAutotuneGetBucket(struct ncclComm* comm, ncclFunc_t coll, size_t nBytes);
+
+// Wait for pending trials and pick the fastest candidate of all buckets in
+// the Sync state. Collective across the communicator, must not run on a thread
+// driving other ranks.
+ncclResult_t ncclAutotuneSyncBuckets(struct ncclComm* comm);
+
+#endif
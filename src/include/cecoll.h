@@ -0,0 +1,42 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_CECOLL_H_
+#define NCCL_CECOLL_H_
+
+#include "nccl.h"
+#include <cuda_runtime.h>
+
+// Copy engine AllGather and Broadcast (NCCL_CE_COLL_THRESHOLD=<bytes>). On
+// single node communicators with one rank per process, collectives of at
+// least that many bytes are run by every rank pulling the data it needs from
+// the user buffers of its peers with cudaMemcpyAsync, so that no SM is used.
+// Ranks synchronize with stream memory operations on flags in each other's
+// device memory.
+//
+// Direct AllGather and ReduceScatter (NCCL_DIRECT_COLL_THRESHOLD=<bytes>) do
+// the same for send buffers registered with ncclCommRegister, whose mappings
+// are kept across calls: ReduceScatter runs a kernel reducing each rank's
+// slice straight out of the send buffers of all ranks, with no intermediate
+// copy into connection buffers and no per step synchronization.
+//
+// Direct AllReduce (NCCL_DIRECT_ALLREDUCE_MAX_BYTES=<bytes>) is for small
+// messages: every rank copies its input to a scratch buffer mapped by all
+// peers, then either reduces the whole vector out of all of them (one-shot) or
+// reduces its slice and gathers the others' (two-shot, from
+// NCCL_DIRECT_ALLREDUCE_TWO_SHOT bytes).
+
+struct ncclComm;
+
+// Moves the collectives the copy engines can run from comm->tasks.collQueue
+// to comm->tasks.ceQueue. Exchanges buffer handles with the other ranks, so
+// it must only be called for groups on this communicator alone.
+ncclResult_t ncclCeCollSelect(struct ncclComm* comm, bool alone);
+// Runs the collectives of comm->tasks.ceQueue on stream.
+ncclResult_t ncclCeCollLaunch(struct ncclComm* comm, cudaStream_t stream);
+ncclResult_t ncclCeCollFree(struct ncclComm* comm);
+
+#endif
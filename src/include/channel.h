@@ -9,6 +9,7 @@
 #include "comm.h"
 
 ncclResult_t initChannel(struct ncclComm* comm, int channelid);
+ncclResult_t ncclChannelDevPeerConnect(struct ncclComm* comm, int channelId, int peer, cudaStream_t stream);
 ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share);
 ncclResult_t initCollnetChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share);
 ncclResult_t freeChannel(struct ncclChannel* channel, int nRanks, int collnetNRanks, int nvlsNRanks);
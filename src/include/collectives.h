@@ -26,6 +26,10 @@ inline int ncclTypeSize(ncclDataType_t type) {
   switch (type) {
   case ncclInt8:
   case ncclUint8:
+  #if defined(__CUDA_FP8_TYPES_EXIST__)
+  case ncclFloat8e4m3:
+  case ncclFloat8e5m2:
+  #endif
     return 1;
   case ncclFloat16:
   #if defined(__CUDA_BF16_TYPES_EXIST__)
@@ -45,6 +49,24 @@ inline int ncclTypeSize(ncclDataType_t type) {
   }
 }
 
+inline bool ncclTypeIsFloat(ncclDataType_t type) {
+  switch (type) {
+  case ncclFloat16:
+  case ncclFloat32:
+  case ncclFloat64:
+  #if defined(__CUDA_BF16_TYPES_EXIST__)
+  case ncclBfloat16:
+  #endif
+  #if defined(__CUDA_FP8_TYPES_EXIST__)
+  case ncclFloat8e4m3:
+  case ncclFloat8e5m2:
+  #endif
+    return true;
+  default:
+    return false;
+  }
+}
+
 #include <sys/types.h>
 
 #define NCCL_MODE_NORMAL 0
@@ -15,6 +15,12 @@
 #include "strongstream.h"
 #include "nccl_net.h"
 #include "register.h"
+#include "autotune.h"
+#include "contention.h"
+#include "cecoll.h"
+#include "stats.h"
+#include "memstats.h"
+#include "straggler.h"
 
 #if CUDART_VERSION < 9000
 struct cudaLaunchParams {
@@ -55,7 +61,7 @@ struct ncclRecvMem {
     struct {
       uint64_t tail;
       char pad1[CACHE_LINE_SIZE-sizeof(uint64_t)];
-      struct ncclConnFifo connFifo[NCCL_STEPS];
+      struct ncclConnFifo connFifo[NCCL_MAX_STEPS];
       int flush; // For GDRCopy-based flush
     };
     char pad4[MEM_ALIGN];
@@ -109,6 +115,11 @@ struct ncclSharedResources {
   struct ncclComm* owner; /* comm which creates this shared res. */
   struct ncclChannelPeer* peers[MAXCHANNELS];
   struct ncclDevChannelPeer* devPeers[MAXCHANNELS];
+  /* With sparsePeers (see NCCL_SPARSE_PEERS), devPeers[c] is a single empty
+   * peer shared by all ranks and connected ranks get their own device peer,
+   * listed in devPeerTable[c] by rank. */
+  int sparsePeers;
+  struct ncclDevChannelPeer** devPeerTable[MAXCHANNELS];
   /* P2P operation counter, one per channel */
   uint64_t p2pOpCount[MAXCHANNELS];
   /* Collective operation counter */
@@ -143,8 +154,13 @@ struct ncclChannel {
 
   struct ncclNvls nvls;
 
+  struct ncclHier hier;
+
+  struct ncclRecDbl recDbl;
+
   int id; // index of this channel
-  uint32_t workFifoSent; // last used work index+1
+  uint32_t workFifoSent; // Monotonic (mod 1<<32) index of next unused slot of this channel's fifo ring.
+  uint32_t workFifoAckd; // Last value of workFifoDone[id] seen by the host.
 
   /* comm split sharable resources */
   struct ncclChannelPeer* collnetPeers;
@@ -169,6 +185,24 @@ struct ncclNvlsMcHandleList {
   CUdeviceptr ptr;
   int dev;
   size_t size;
+  struct ncclNvlsRegEntry* entry; // If not NULL, the binding is cached and the plan only holds a reference to it
+};
+
+// Multicast binding of a user allocation, kept across plans so that the same
+// buffers are only bound once (see NCCL_NVLS_REG_CACHE).
+struct ncclNvlsRegEntry {
+  struct ncclNvlsRegEntry* next;
+  uint64_t id; // Same on all local ranks for the same binding
+  uintptr_t base;
+  // Retained so that no other allocation can be mapped at base while we hold the binding
+  CUmemGenericAllocationHandle memHandle;
+  CUmemGenericAllocationHandle mcHandle;
+  CUdeviceptr ptr;
+  int dev;
+  size_t size;
+  int refs; // Plans using the binding
+  bool orphan; // The communicator went away, last plan frees it
+  uint64_t lastUsed;
 };
 
 struct ncclCollnetHandleList {
@@ -179,6 +213,75 @@ struct ncclCollnetHandleList {
   struct ncclProxyConnector* proxyconn;
 };
 
+// Kernel timing for ncclTuner_t::collComplete feedback
+struct ncclTunerTiming {
+  struct ncclTunerTiming* next;
+  cudaEvent_t start, stop;
+  ncclFunc_t coll;
+  size_t nBytes;
+  int algorithm, protocol, nChannels;
+  // Autotune trial this measures, if any
+  struct ncclAutotuneBucket* autotuneBucket;
+  int autotuneCand;
+};
+
+// Plans with a doorbell at the same time, see NCCL_PROXY_DOORBELL
+#define NCCL_DOORBELL_SLOTS 64
+
+// Device copy of the works of a graph captured plan, see ncclComm::workPool
+#define NCCL_WORK_POOL_CLASSES 32
+struct ncclWorkBuff {
+  struct ncclWorkBuff* next;
+  struct ncclWork* ptr;
+  int sizeLog2; // ptr holds 1<<sizeLog2 works
+  int refs; // plans and plan cache entries sharing it
+};
+
+// Signature of one collective of a group, compared bytewise
+struct ncclPlanCacheKey {
+  ncclFunc_t coll;
+  ncclDataType_t datatype;
+  struct ncclDevRedOpFull opFull;
+  int root;
+  const void* sendbuff;
+  void* recvbuff;
+  size_t count;
+  int chunkSteps, sliceSteps;
+};
+
+// Plan of a group of collectives which fit in one kernel. ncclWork's and
+// proxy ops are stored in channel order.
+struct ncclPlanCacheEntry {
+  uint64_t hash;
+  uint64_t lastUsed;
+  int nColl;
+  struct ncclPlanCacheKey* keys; // NULL if the entry is unused
+  bool kernelSpecialized;
+  void* kernelFn;
+  int channelUbound;
+  int channelCount;
+  uint64_t channelMask;
+  bool hasProxyOps;
+  int threadPerBlock;
+  int collOpCount;
+  size_t maxBytesPerChannel;
+  int nWork[MAXCHANNELS];
+  int nProxyOps[MAXCHANNELS];
+  struct ncclWork* works;
+  struct ncclProxyOp* proxyOps;
+  bool persistent; // recorded during a graph capture
+  // Persistent entries: works laid out and uploaded once for all the captured
+  // plans restored from the entry, NULL if they are passed as kernel arguments.
+  struct ncclWorkBuff* workBuff;
+  struct ncclDevWorkFirst workFirst;
+};
+
+struct ncclPlanCache {
+  int size;
+  uint64_t clock;
+  struct ncclPlanCacheEntry* entries; // [size], allocated on first insertion
+};
+
 struct ncclKernelPlan {
   // A kernel plan is also a callback that reclaims itself. Hence this must
   // be the first member.
@@ -194,11 +297,21 @@ struct ncclKernelPlan {
   int channelCount; // number of channels present
   uint64_t channelMask; // which channels are present, channelCount == popcount(channelMask)
   bool hasProxyOps; // does any channel have a non-empty proxyOpQueue
+  bool hasP2p; // does the plan hold any point-to-point work
+  uint64_t planId; // sequence number of the plan in its comm, reported to NVTX
   int threadPerBlock;
-  // workHeap fields are null until uploadWorkFifo() or preparePersistentKernel()
+  // workHeap fields are null until uploadWork()
   struct ncclWork* workHead;
+  struct ncclDevWorkFirst workFirst;
+  struct ncclWorkBuff* workBuff; // persistent plans: pool buffer holding workHead[]
+  struct ncclDevKernelArgsWork* argsWork; // non-null if works are passed as kernel arguments
 
   int collOpCount; // zero based for this plan
+  struct ncclTunerTiming* tunerTiming; // non-null if this plan is timed for the tuner
+  int doorbell; // slot in comm->doorbells ringing for this plan's proxy ops, -1 if none
+  cudaStream_t stream; // user stream launching the plan, NULL for the first one of the group
+  uint8_t proxyPriority; // priority stamped on the plan's proxy ops
+  uint64_t opTag; // ncclGroupSetOpTag value stamped on the plan's proxy ops
 
   struct ncclIntruQueue<struct ncclPointerList, &ncclPointerList::next> ipcMemQueue;
   struct ncclIntruQueue<struct ncclNvlsMcHandleList, &ncclNvlsMcHandleList::next> nvlsMcHandleQueue;
@@ -239,6 +352,15 @@ struct ncclComm {
   // Bitmasks for ncclTransportP2pSetup
   uint64_t* connectSend;
   uint64_t* connectRecv;
+  // Runtime connection: ring and tree are only connected when a collective
+  // first selects them. Graphs are kept around for that.
+  bool runtimeConn;
+  bool collConnected[NCCL_NUM_ALGORITHMS];
+  bool collNeedConnect[NCCL_NUM_ALGORITHMS];
+  struct ncclTopoGraph* collGraphs[NCCL_NUM_ALGORITHMS];
+  // Local ring/tree/collnet/nvls search results, indexed by graph id. Kept
+  // with splitShare so that children may reuse them (NULL if not searched).
+  struct ncclTopoGraph* splitGraphs[4];
 
   uint64_t magic; // Magic number for all network communication. Not a security key -- only goal is to detect mismatches.
 
@@ -260,6 +382,7 @@ struct ncclComm {
   int maxLocalRanks;
   int* rankToNode;
   int* rankToLocalRank;
+  int* suggestedRankOrder; // See ncclCommSuggestRankOrder
   int* localRankToRank;
   // localRanks and localRanktoRank for all nodes
   struct ncclNodeRanks* nodeRanks;
@@ -282,6 +405,9 @@ struct ncclComm {
   int p2pnChannels;
   int p2pnChannelsPerPeer;
   int p2pChannels[MAXCHANNELS];
+  // Smallest p2p chunk to each node-local peer from the path model, indexed by
+  // local rank, 0 to use the defaults. NULL unless NCCL_P2P_CHUNK_MODEL=1.
+  int* p2pLocalChunkMin;
 
   // Should this comm allocate LL buffers for network P2P connections?
   bool allocP2pNetLLBuffers;
@@ -296,6 +422,11 @@ struct ncclComm {
   float latencies[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   float bandwidths[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   float ringbdw[NCCL_NUM_FUNCTIONS][NCCL_NUM_PROTOCOLS];
+  // Pipeline model of ring and tree, for chunk sizing: number of stages a chunk
+  // goes through, latency of a stage (us) and bandwidth of a channel (GB/s)
+  float pipeStages[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS];
+  float stageLatencies[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  float stageBandwidths[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   int maxThreads[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
 
   /* This attribute can indicate the states of communicators and return code of
@@ -306,20 +437,77 @@ struct ncclComm {
   volatile uint32_t *abortFlag;
   volatile uint32_t *childAbortFlag;
   uint32_t *abortFlagRefCount;
+  // Copy of abortFlag in CUDA memory polled by kernels instead (NCCL_ABORT_FLAG_DEVICE),
+  // written through its GDRCOPY mapping. Shared along with abortFlag.
+  volatile uint32_t *abortFlagDev;
+  volatile uint32_t *abortFlagDevHost;
+  void *abortFlagDevGdrHandle;
+  // Same for childAbortFlag, published by the child once it has allocated it
+  volatile uint32_t *childAbortFlagDevHost;
 
   // Device side of the communicator (for cudaFree's)
   struct ncclDevComm* devComm; // actually = &ncclDevCommAndChannels::comm
 
-  // Operation pool.
+  // Operation pool. Channel c owns the ring workFifoHeap[c*workFifoChannelDepth ...]
+  // so that channels only wait on their own progress.
   int workFifoDepth; // size of workFifoHeap[], power of 2
+  int workFifoChannelDepth; // workFifoDepth/(channels in use, rounded up to a power of 2)
   struct ncclWork* workFifoHeap;
   struct ncclWork* devWorkFifoHeap;
   void* workFifoHeapGdrHandle;
+  int workFifoHeapDevice; // in CUDA memory the host writes through a coherent link, see NCCL_WORK_FIFO_DEVICE
 
   // Work completion notificaion
   uint32_t* workFifoDone/*[MAXCHANNELS]*/; // in cudaHost memory
-  uint32_t workFifoSent; // Monotonic (mod 1<<32) index of next unused fifo slot.
-  uint32_t workFifoAckdMin; // Monotonic index of least unprocessed fifo slot over all channels.
+
+  // Device buffers of graph captured plans, free lists by log2 of their size.
+  struct ncclWorkBuff* workPool[NCCL_WORK_POOL_CLASSES];
+  int workPoolCount[NCCL_WORK_POOL_CLASSES];
+
+  // Kernels set up for this comm, NULL unless NCCL_LAZY_KERNEL_INIT is set
+  struct ncclKernelWarmup* kernelWarmup;
+
+  // Device buffer small AllReduces are fused in, NULL unless NCCL_FUSION_THRESHOLD is set
+  void* fusionBuff;
+  size_t fusionBuffSize;
+
+  // Launch kernels as programmatic dependents of the previous kernel on the stream, see NCCL_PDL
+  int programmaticLaunch;
+
+  // Connector flags and LL/LL128 buffers in our memory, kept persisting in L2
+  // for the kernel launches, see NCCL_L2_PERSIST
+  uintptr_t l2WindowBase;
+  size_t l2WindowBytes;
+  float l2HitRatio;
+
+  // Calls from several threads are staged per thread and appended under
+  // enqueueLock, see NCCL_COMM_THREAD_SAFE
+  int threadSafe;
+  pthread_mutex_t enqueueLock;
+
+  // Resident kernel, see NCCL_RESIDENT_KERNEL
+  int residentState; // 0 not started, 1 running, -1 disabled
+  int residentNChannels; // number of blocks, one per channel
+  cudaStream_t residentStream;
+  struct ncclResidentFifo* residentFifo; // in cudaHost memory
+  struct ncclResidentFlags* residentFlags; // in CUDA memory
+  uint32_t residentSeq; // number of plans handed over to the resident kernel
+
+  // Proxy doorbells, see NCCL_PROXY_DOORBELL
+  int doorbellState; // 0 not started, 1 running, -1 disabled
+  uint32_t* doorbells; // [NCCL_DOORBELL_SLOTS] in cudaHost memory, set by streams, cleared by doorbellThread
+  struct ncclKernelPlan* doorbellPlans[NCCL_DOORBELL_SLOTS];
+  pthread_t doorbellThread;
+  int doorbellStop;
+  // Host-side completion of operations, see NCCL_OP_HANDLES
+  uint32_t* opDone; // in cudaHost memory, launches completed so far (mod 1<<32), NULL if disabled
+  uint64_t opLaunched; // launches followed by a write of opDone
+
+  // Device timeline profiling, see ENABLE_DEVICE_PROFILE
+  struct ncclDevProfileEvent* devProfileEvents; // in cudaHost memory
+  uint64_t* devProfileHeads; // in CUDA memory
+  uint64_t devProfileTail[MAXCHANNELS]; // next event index to drain, per channel
+  uint64_t profileSampleCount; // operations seen by the NCCL_PROFILE_SAMPLE filter
 
   // Intra-process sync
   struct ncclComm* intraComm0; // leader of intra-process comms (self possible)
@@ -351,6 +539,18 @@ struct ncclComm {
   int nvlsRegSupport;
   /* sharable NVLS resource. */
   struct ncclNvlsSharedRes* nvlsResources;
+  struct ncclNvlsRegEntry* nvlsRegCache;
+  int nvlsRegCacheCount;
+  uint64_t nvlsRegCacheSeq;
+  uint64_t nvlsRegCacheClock;
+
+  // Hierarchical AllReduce support, see channel->hier
+  int hierSupport;
+  // Recursive doubling AllReduce support, see channel->recDbl
+  int recDblSupport;
+
+  // Fan-out of the inter-node trees, 2 for the double binary tree
+  int treeRadix;
 
   // pools backed by comm->memPermanent
   struct ncclMemoryPool memPool_ncclProxyOp;
@@ -370,6 +570,23 @@ struct ncclComm {
   int userRedOpCapacity, userRedOpFreeHead;
   ncclUserRedOp *userRedOps;
 
+  // Staging buffers of the Bruck AllToAll, allocated on first use. Calls on
+  // different streams are ordered through bruckDone since they share them.
+  void* bruckStage;
+  size_t bruckStageSize;
+  cudaEvent_t bruckDone;
+  // Same for the hierarchical AllToAll, with its block permutations in device memory
+  void* a2aHierStage;
+  size_t a2aHierStageSize;
+  int* a2aHierMaps;
+  cudaEvent_t a2aHierDone;
+  // Same for the binomial tree Gather and Scatter
+  void* rootedTreeStage;
+  cudaEvent_t rootedTreeDone;
+  // Same for the multi-root Broadcast through AllGather
+  void* bcastMultiStage;
+  cudaEvent_t bcastMultiDone;
+
   // Queue of things for the main thread to do
   struct ncclIntruQueueMpsc<struct ncclCommCallback, &ncclCommCallback::next> callbackQueue;
 
@@ -391,8 +608,35 @@ struct ncclComm {
   // Tuning plugin
   ncclTuner_t* tuner;
   void *tunerContext;
+  // Timed plans in launch order, and recycled timings
+  struct ncclIntruQueue<struct ncclTunerTiming, &ncclTunerTiming::next> tunerTimingQueue;
+  struct ncclTunerTiming* tunerTimingFree;
+  struct ncclAutotune* autotune; // NULL unless NCCL_AUTOTUNE is set
+  struct ncclContention* contention; // NULL unless NCCL_CONTENTION is set
+  float contentionLoad; // other comms agreed to share our links, on average
+  int contentionChannels; // channels agreed from our SM share (NCCL_CONTENTION_SM_BUDGET), 0 if unlimited
+  struct ncclStats stats; // see ncclCommGetStats
+  struct ncclComm* metricsNext; // in the list of communicators exported, see metrics.h
+  bool metricsRegistered;
+  int gpuShareProcs; // processes sharing the GPU, agreed by all ranks, see gpushare.h
+  bool gpuShareRegistered;
+  struct ncclMemStats memStats; // see ncclCommGetMemStats
+  struct ncclInitStats initStats; // see ncclCommGetInitStats
+  struct ncclStraggler* straggler; // NULL unless NCCL_STRAGGLER is set
+  uint64_t planCount; // plans created so far
+  // Algorithm and protocol of all collectives while ncclTopoCalibrateModel times them
+  int forceAlgorithm;
+  int forceProtocol;
+  struct ncclCeColl* ceColl; // NULL until a collective is run by the copy engines
+  ncclProfiler_t* profiler; // NULL unless a profiler plugin is loaded
+  void *profilerContext;
   // buffer registration cache
   struct ncclRegCache regCache;
+  // receive buffers of cross-process p2p peers mapped here, see p2p.cc
+  struct ncclP2pIpcImport* p2pIpcImports;
+  uint64_t p2pIpcExportCount;
+  // kernel plans of recent groups, see ncclLaunchPrepare()
+  struct ncclPlanCache planCache;
   uint64_t endMagic;
 };
 
@@ -407,6 +651,10 @@ void ncclCommPushFree(struct ncclComm* comm, void* buf);
 void ncclCommPushCudaFree(struct ncclComm* comm, void* buf);
 void ncclCommPushCudaHostFree(struct ncclComm* comm, void* buf);
 void ncclCommPushCudaGdrFree(struct ncclComm* comm, void* handle);
+// Raise the device copy of an abort flag, through its host mapping (may be NULL)
+void ncclAbortFlagDevSet(volatile uint32_t* abortFlagDevHost);
+// Aborts the init of a child comm of comm, on the host and device flags
+void ncclChildAbortFlagSet(struct ncclComm* comm, volatile uint32_t* childAbortFlag);
 
 inline ncclResult_t ncclCommPollCallbacks(struct ncclComm* comm, bool waitSome) {
   ncclResult_t result = ncclSuccess;
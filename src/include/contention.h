@@ -0,0 +1,58 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_CONTENTION_H_
+#define NCCL_CONTENTION_H_
+
+#include "nccl.h"
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+// Contention between communicators (NCCL_CONTENTION=1). Communicators of the
+// process register with a registry keyed by GPU, and record an event after
+// each kernel they launch. At every launch a comm counts the other comms on
+// its GPU whose last kernel is still running. Every NCCL_CONTENTION_INTERVAL
+// collectives ranks agree on the largest average count seen, and the cost
+// model and channel selection assume the comm only gets 1/(1+load) of the
+// links it shares with them.
+//
+// With NCCL_CONTENTION_SM_BUDGET=<SMs>, the registry also arbitrates the SMs
+// of each GPU: every comm asks for one SM per collective channel, and when
+// the comms of a GPU ask for more than the budget together, each gets a share
+// of it proportional to its request. Ranks agree on the smallest share along
+// with the load, and collectives never use more channels than that, so that
+// concurrent comms fit on the GPU side by side instead of waiting for each
+// other's SMs.
+
+struct ncclContention {
+  struct ncclContention* next; // registry list
+  int64_t busId;
+  cudaEvent_t lastLaunch;      // recorded after our last kernel
+  int interval;                // collectives between agreements
+  int nColls;                  // collectives tuned since the last agreement
+  bool syncPending;
+  float loadSum;               // sum of the other comms seen active at each launch
+  int nSamples;
+  int smRequest;               // SMs we would use without other comms, 0 if not arbitrated
+};
+
+struct ncclComm;
+
+ncclResult_t ncclContentionInit(struct ncclComm* comm);
+ncclResult_t ncclContentionFree(struct ncclComm* comm);
+
+// Sample the other comms sharing our GPU and mark our kernel as in flight.
+ncclResult_t ncclContentionLaunch(struct ncclComm* comm, cudaStream_t stream);
+
+// Count a tuned collective. All ranks tune the same collectives, so they
+// request an agreement at the same point.
+void ncclContentionCollTuned(struct ncclComm* comm);
+
+// Agree on comm->contentionLoad if requested. Collective across the
+// communicator, must not run on a thread driving other ranks.
+ncclResult_t ncclContentionSync(struct ncclComm* comm);
+
+#endif
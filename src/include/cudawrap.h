@@ -80,6 +80,11 @@ DECLARE_CUDA_PFN_EXTERN(cuCtxGetCurrent);
 DECLARE_CUDA_PFN_EXTERN(cuCtxSetCurrent);
 DECLARE_CUDA_PFN_EXTERN(cuCtxGetDevice);
 DECLARE_CUDA_PFN_EXTERN(cuPointerGetAttribute);
+// Stream memory operations (resident kernel)
+DECLARE_CUDA_PFN_EXTERN(cuStreamWriteValue32);
+DECLARE_CUDA_PFN_EXTERN(cuStreamWaitValue32);
+// GDR write flush from the host
+DECLARE_CUDA_PFN_EXTERN(cuFlushGPUDirectRDMAWrites);
 // cuMem API support
 DECLARE_CUDA_PFN_EXTERN(cuMemAddressReserve);
 DECLARE_CUDA_PFN_EXTERN(cuMemAddressFree);
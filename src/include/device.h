@@ -20,6 +20,8 @@ extern const char* ncclProtoStr[NCCL_NUM_PROTOCOLS];
 
 #define NCCL_MAX_OPS 2048
 #define NCCL_STEPS 8
+// Capacity of the connector FIFOs, net connectors may pipeline deeper than NCCL_STEPS
+#define NCCL_MAX_STEPS 16
 
 #include "net_device.h"
 
@@ -39,7 +41,10 @@ union ncclLLFifoLine {
   /* Flags have to be *after* data, because otherwise, an incomplete receive
      from the network may receive the flag but not the data.
      Note this is assuming that either we receive contiguous chunks of data
-     (sockets) or data is written with an atomicity of 8 bytes (IB/RDMA). */
+     (sockets) or data is written with an atomicity of 8 bytes (IB/RDMA).
+     For the same reason each 8 bytes need their own flag: a line carrying 12
+     bytes of data under a single flag would need 16-byte atomic stores, which
+     PCIe and RDMA do not provide. */
   struct {
     uint32_t data1;
     uint32_t flag1;
@@ -51,7 +56,9 @@ union ncclLLFifoLine {
 };
 
 #define WARP_SIZE 32
-#define MAXCHANNELS 32
+#define MAXCHANNELS 64
+// Channels used unless NCCL_MAX_NCHANNELS asks for more, up to MAXCHANNELS
+#define NCCL_DEFAULT_MAXCHANNELS 32
 #define NCCL_MAX_NTHREADS 640
 #define NCCL_SIMPLE_MAX_NTHREADS 512
 #define NCCL_LL_MAX_NTHREADS 512
@@ -83,6 +90,10 @@ static_assert(NCCL_LL_CLEAN_MASK % NCCL_STEPS == 0, "Invalid NCCL_LL_CLEAN_MASK
 #define NCCL_IPC_WRITE    0x08
 #define NCCL_IPC_READ     0x10
 #define NCCL_NVLS_MIN_POLL 0x20
+#define NCCL_NET_REG      0x40 // Network proxy can send and receive from registered user buffers
+#define NCCL_NET_COMPRESS 0x80 // Simple protocol float/bf16 sums are sent in a block-scaled 8-bit format
+#define NCCL_P2P_IPC_REG  0x100 // Cross-process P2P sender may write into the registered receive buffer
+#define NCCL_P2P_POST_BATCH 0x200 // Receiver posts its SIMPLE head every other slice (P2P read)
 
 #define NCCL_MAX_COLLNET_SIZE (1L << 29)
 
@@ -103,6 +114,7 @@ struct ncclConnInfo {
   int flags;          // Direct communication / other flags
   int shared;         // Buffers are shared
   int stepSize;       // Step size for the SIMPLE buffer
+  int nSteps;         // Steps in the SIMPLE buffer, 0 means NCCL_STEPS
   void **ptrExchange; // Pointer exchange for direct communication
   uint64_t* redOpArgExchange; // PreOp scaler exchange for direct pull case
 
@@ -142,11 +154,39 @@ struct ncclRing {
   int index; // This rank's index in the ring
 };
 
+// Hierarchical AllReduce and AllGather: a ring over the ranks of each node,
+// and for each position in it, a ring over the nodes. Both follow the order of
+// the ring.
+struct ncclHier {
+  int intraPrev;
+  int intraNext;
+  int localIndex; // This rank's index in the intra-node ring
+  int nLocal;
+  int interPrev;
+  int interNext;
+  int node;       // This node's index in the inter-node ring
+  int nNodes;
+};
+
+// Recursive doubling AllReduce: the first 2^nPeers ranks exchange their data
+// with rank^1, rank^2, rank^4, ... The other ranks are folded: they send their
+// data to rank-2^nPeers and receive the result from it.
+#define NCCL_MAX_RECDBL_PEERS 16
+struct ncclRecDbl {
+  int nPeers;
+  int peers[NCCL_MAX_RECDBL_PEERS];
+  int extra;  // Folded rank we reduce for, or for a folded rank, who reduces for it. -1 if none.
+  int folded;
+};
+
 
-// The root of each tree only has one node down (+1 intra-node).
-#define NCCL_MAX_TREE_ARITY_TOP 2
-// Nodes inside the binary tree can have to two nodes down (+1 intra-node).
-#define NCCL_MAX_TREE_ARITY 3
+// Inter-node trees are binary by default, NCCL_TREE_RADIX selects a k-ary tree.
+#define NCCL_MAX_TREE_RADIX 4
+// The root of a binary tree only has one node down (+1 intra-node), the root
+// of a k-ary tree has k.
+#define NCCL_MAX_TREE_ARITY_TOP (NCCL_MAX_TREE_RADIX+1)
+// Nodes inside the tree can have up to k nodes down (+1 intra-node).
+#define NCCL_MAX_TREE_ARITY (NCCL_MAX_TREE_RADIX+1)
 struct ncclTree {
   int depth;
   int up;
@@ -205,7 +245,8 @@ enum ncclWorkType : uint8_t {
    ncclWorkTypeUnused=0,
    ncclWorkTypeColl=1,
    ncclWorkTypeP2p=2,
-   ncclWorkTypeRegColl=3
+   ncclWorkTypeRegColl=3,
+   ncclWorkTypeFusedColl=4
 };
 enum ncclWorkP2PType : uint8_t {
   ncclWorkP2pTypeUnused=0,
@@ -215,20 +256,26 @@ enum ncclWorkP2PType : uint8_t {
 
 struct ncclWorkHeader {
   union {
-    int32_t workNext;  // when isLast=0: Offset from kernel argument workHead
+    int32_t workNext;  // when isLast=0: Index of next work in kernel argument workHead[]
     uint32_t doneAcks; // when isLast=1: Monotonic (mod 1<<32) ack value to send back.
   };
   uint16_t funcIndex;
   uint8_t isLast:1; // last work for this kernel
   uint8_t inFifo:1; // is this work in the fifo
+  uint8_t nextSize:5; // when isLast=0: bytes of the next work to fetch in 16 byte units, 0 for all NCCL_WORK_SIZE
+  uint8_t profile:1; // an operation of this work was sampled for device profiling
   enum ncclWorkType type;
 };
+static_assert(NCCL_WORK_SIZE/16 == 32, "ncclWorkHeader::nextSize encodes NCCL_WORK_SIZE as 0");
 
 struct ncclWorkElem {
   union {
     uint8_t flagBits;
     struct {
-      uint8_t isUsed:1, redOpArgIsPtr:1, oneNode:1;
+      uint8_t isUsed:1, redOpArgIsPtr:1, oneNode:1, netReg:1;
+      // User input/output hold half (or bfloat16 with castBf16) values while
+      // T is float, see ncclAllReduceMixed.
+      uint8_t castInput:1, castOutput:1, castBf16:1;
     };
   };
   uint8_t regUsed;
@@ -262,17 +309,45 @@ struct ncclWorkElemP2p {
 
   enum ncclWorkP2PType p2pType;
   uint8_t reg:1;
+  uint8_t devCount:1; // count is an upper bound, see devCountExt
+  uint8_t ipcReg:1; // handshake on ptrExchange, see ipcExt
   uint8_t nWarps:5;
   uint8_t warpStart;
   uint8_t ngroups;
   // Important not to use any fields with greater than 4-byte alignment since
   // we need sizeof(ncclWorkElemP2p)==28, but that would be padded up to 32 if
   // there were 8-byte fields.
-  //void* buff;
-  uint32_t buffHi32, buffLo32; // buff = buffHi32<<32 | buffLo32;
-  //size_t count;
-  uint32_t countHi32, countLo32; // count = countHi32<<32 | countLo32;
-  int chunkSize;
+  union {
+    struct {
+      //void* buff;
+      uint32_t buffHi32, buffLo32; // buff = buffHi32<<32 | buffLo32;
+      //size_t count;
+      uint32_t countHi32, countLo32; // count = countHi32<<32 | countLo32;
+      int chunkSize;
+    };
+    // Extension of an element with devCount set, stored two slots after it
+    // (the next slot of the same direction) with p2pType unused so no group
+    // runs it. The element moves min(*countPtr*eltSize-offset, count) bytes,
+    // but still goes through all the steps needed for count bytes since the
+    // proxy has planned those; the trailing steps are empty.
+    struct {
+      //const size_t* countPtr;
+      uint32_t countPtrHi32, countPtrLo32;
+      //size_t offset; // bytes of the user buffer before this element
+      uint32_t offsetHi32, offsetLo32;
+      int eltSize;
+    } devCountExt;
+    // Extension of a send element with ipcReg set and no devCount, stored
+    // like devCountExt. The receive buffer as mapped in this process, or 0 if
+    // the receiver didn't offer one. Both sides of an ipcReg element meet on
+    // the connection's ptrExchange once the receiver runs, and the sender
+    // tells the receiver whether it writes straight into its buffer or goes
+    // through the FIFO.
+    struct {
+      //void* buff;
+      uint32_t buffHi32, buffLo32;
+    } ipcExt;
+  };
 };
 
 static_assert(((NCCL_WORK_SIZE - alignUp(sizeof(ncclWorkHeader), alignof(ncclWorkElemP2p)))/sizeof(ncclWorkElemP2p)) >= 16, "Sanity check: NCCL_MAX_WORK_ELEMENTS_P2P == 16");
@@ -288,6 +363,23 @@ struct ncclWorkElemReg {
 #define NCCL_MAX_WORK_ELEMENTS_REG ((NCCL_WORK_SIZE - alignUp(sizeof(ncclWorkHeader), alignof(ncclWorkElemReg)))/sizeof(ncclWorkElemReg))
 static_assert(NCCL_MAX_WORK_ELEMENTS_REG == 2, "Sanity check: NCCL_MAX_WORK_ELEMENTS_REG == 2");
 
+// Small AllReduces concatenated in the fusion buffer. The collective runs on
+// the buffer, each channel copies its part of the segments in before and out
+// after.
+struct ncclWorkSegment {
+  const void* sendbuff;
+  void* recvbuff;
+  size_t count;
+};
+
+#define NCCL_MAX_FUSED_SEGMENTS 16
+struct ncclWorkElemFused {
+  struct ncclWorkElem elem;
+  int nSegments;
+  struct ncclWorkSegment segments[NCCL_MAX_FUSED_SEGMENTS];
+};
+static_assert(alignUp(sizeof(ncclWorkHeader), alignof(ncclWorkElemFused)) + sizeof(ncclWorkElemFused) <= NCCL_WORK_SIZE, "Sanity check: ncclWorkElemFused fits in ncclWork");
+
 // Number of named barriers supported by CUDA
 #define NCCL_MAX_GROUPS 16
 
@@ -298,11 +390,62 @@ struct ncclWork {
     struct ncclWorkElem elems[NCCL_MAX_WORK_ELEMENTS];
     struct ncclWorkElemP2p p2pElems[NCCL_MAX_WORK_ELEMENTS_P2P];
     struct ncclWorkElemReg regElems[NCCL_MAX_WORK_ELEMENTS_REG];
+    struct ncclWorkElemFused fusedElem;
   };
 };
 static_assert(sizeof(struct ncclWork) == NCCL_WORK_SIZE, "Sanity check: sizeof(struct ncclWork) == NCCL_WORK_SIZE");
 static_assert(sizeof(struct ncclWork)%16 == 0, "Sanity check: sizeof(struct ncclWork)%16 == 0");
 
+// Index in workHead[] of the first work of every channel. Each channel has
+// its own ring in the work fifo so a kernel's channels don't start next to
+// each other.
+struct ncclDevWorkFirst {
+  uint32_t ix[MAXCHANNELS];
+  uint32_t arrival; // 1 + slot of ncclDevComm::arrivals to stamp at kernel start, 0 for none
+};
+
+// Plans with no more than NCCL_WORK_ARGS_NWORK works are launched on
+// ncclDevKernelArgsWork with the works passed by value in the 4KB of kernel
+// argument space, sparing the kernel from reading them out of host memory.
+// workHead of the kernel is then args.works and nothing is acked back.
+#define NCCL_WORK_ARGS_NWORK 7
+struct ncclDevKernelArgsWork {
+  struct ncclDevComm* comm;
+  uint64_t channelMask;
+  struct ncclDevWorkFirst workFirst;
+  alignas(16) struct ncclWork works[NCCL_WORK_ARGS_NWORK];
+};
+static_assert(sizeof(struct ncclDevKernelArgsWork) <= 4096, "ncclDevKernelArgsWork must fit in kernel argument space");
+
+// Parameters in argument space are only addressable on sm70 and later.
+#if defined(__CUDACC__) && CUDART_VERSION >= 11070 && (!defined(__CUDA_ARCH__) || __CUDA_ARCH__ >= 700)
+  #define NCCL_GRID_CONSTANT __grid_constant__
+#else
+  #define NCCL_GRID_CONSTANT
+#endif
+
+// Resident kernel (NCCL_RESIDENT_KERNEL=1): one long-lived block per channel
+// polls for work instead of a kernel being launched for every plan. For every
+// plan the host fills slots[seq%DEPTH] and the launch stream writes
+// ready[seq%DEPTH]=seq+1 then waits for done>=seq+1.
+#define NCCL_RESIDENT_FIFO_DEPTH 256
+struct ncclResidentSlot {
+  struct ncclWork* workHead;
+  uint64_t channelMask;
+  struct ncclDevWorkFirst workFirst;
+};
+struct ncclResidentFifo { // in cudaHost memory
+  struct ncclResidentSlot slots[NCCL_RESIDENT_FIFO_DEPTH];
+  uint32_t consumed; // written by device: number of slots fully processed
+  uint32_t stop;     // written by host: exit once stopSeq plans have run
+  uint32_t stopSeq;
+};
+struct ncclResidentFlags { // in CUDA memory, target of stream memory operations
+  uint32_t ready[NCCL_RESIDENT_FIFO_DEPTH];
+  uint32_t done;
+  uint32_t blocksArrived;
+};
+
 struct ncclDevChannelPeer {
   // Stripped version of ncclChannelPeer where we only keep the ncclConnInfo
   // instead of the full ncclConnector.
@@ -317,9 +460,34 @@ struct alignas(16) ncclDevChannel {
   struct ncclTree collnetChain;
   struct ncclDirect collnetDirect;
   struct ncclNvls nvls;
+  struct ncclHier hier;
+  struct ncclRecDbl recDbl;
   uint32_t* workFifoDone; // Location of done counter, device writes index+1 of last work processed
 };
 
+// Device timeline profiling, compiled in with ENABLE_DEVICE_PROFILE (make DEVPROFILE=1).
+// Primitives stamp each wait, reduce/copy and post phase with %globaltimer into
+// a per-channel ring in cudaHost memory. The host drains the rings as plans are
+// reclaimed and merges them into the NCCL_PROXY_PROFILE Chrome trace.
+#define NCCL_DEV_PROFILE_RING_SIZE 8192
+enum ncclDevProfileEventType {
+  ncclDevProfileWork = 0,     // One ncclWork, step is the funcIndex
+  ncclDevProfileWaitRecv = 1, // Waiting for the peer to post data (Simple only)
+  ncclDevProfileWaitSend = 2, // Waiting for room in the peer's buffer
+  ncclDevProfileReduce = 3,   // Data movement. On LL/LL128 it includes the receive flag polling.
+  ncclDevProfilePost = 4,     // Fence and step update
+  ncclDevProfileNumTypes = 5
+};
+struct ncclDevProfileEvent {
+  uint64_t begin, end; // %globaltimer, in ns
+  uint32_t step;
+  uint32_t seq; // Ring index + 1, written last to publish the event
+  uint8_t type;
+  uint8_t proto;
+};
+
+#define NCCL_ARRIVAL_SLOTS 1024
+
 struct ncclDevComm {
   int rank;
   int nRanks;
@@ -334,11 +502,28 @@ struct ncclDevComm {
 
   int* collNetDenseToUserRank;
 
-  // Flag to ask NCCL kernels to abort
+  // Copy SIMPLE protocol data with cp.async.bulk (sm_90 and later)
+  int simpleBulkCopy;
+  // LL128 warps pair up to poll and stage, and to reduce and forward
+  int ll128WarpSpecialize;
+  // Poll abortFlag once per CGA cluster and share it through DSMEM (sm_90)
+  int clusterAbortShared;
+  // Kernels are launched with programmatic stream serialization (sm_90)
+  int programmaticLaunch;
+
+  // Flag to ask NCCL kernels to abort, in CUDA memory with NCCL_ABORT_FLAG_DEVICE
   volatile uint32_t* abortFlag;
 
   // Channels, device side
   struct ncclDevChannel* channels/*[MAXCHANNELS]*/;
+
+  // Device timeline profiling, NULL unless enabled
+  struct ncclDevProfileEvent* profileEvents/*[MAXCHANNELS][NCCL_DEV_PROFILE_RING_SIZE]*/; // cudaHost memory
+  uint64_t* profileHeads/*[MAXCHANNELS]*/; // CUDA memory
+
+  // Straggler detection, NULL unless enabled. Block 0 of a plan's kernel
+  // stores %globaltimer into the slot the host picked for the plan.
+  uint64_t* arrivals/*[NCCL_ARRIVAL_SLOTS]*/; // cudaHost memory
 };
 
 struct alignas(16) ncclDevCommAndChannels {
@@ -395,7 +580,8 @@ __host__ __device__ constexpr int ncclNvlsUnroll(int bytePerPack, int cudaArch =
 __host__ __device__ constexpr int ncclShmemScratchWarpSize(int cudaArch = NCCL_CUDA_ARCH) {
   return (max_constexpr<int>(
       /*LL    */0,
-      /*LL128 */(NCCL_LL128_SHMEM_ELEMS_PER_THREAD*WARP_SIZE)*sizeof(uint64_t),
+      // LL128 stages a slice with a 16B header when warp specialized.
+      /*LL128 */(NCCL_LL128_SHMEM_ELEMS_PER_THREAD*WARP_SIZE)*sizeof(uint64_t) + 16,
       /*SIMPLE*/(ncclCollUnroll(cudaArch)*WARP_SIZE + 1)*16,
       // NVLS needs an extra 16B to read unaligned data.
       /*NVLS  */WARP_SIZE*(cudaArch >= 900 ? ncclNvlsUnrollBytes(cudaArch) : 0) + 16
@@ -416,8 +602,33 @@ extern int const ncclDevFuncRowToId[];
 extern void* const ncclDevKernelForFunc[/*funcIndex*/];
 extern bool const ncclDevKernelForFuncIsSpecialized[/*funcIndex*/];
 
+// Host-side pointer to the resident kernel.
+extern void* const ncclDevKernelResident;
+// Host-side pointer to the kernel taking its works as arguments.
+extern void* const ncclDevKernelArgsWork;
+
 // Launch a one-rank reduction on stream.
 ncclResult_t ncclLaunchOneRank(void* dst, void const* src, size_t nElts, struct ncclDevRedOpFull redOp, ncclDataType_t type, cudaStream_t stream);
+// Launch dst[i] = srcs[0][i] op ... op srcs[nSrcs-1][i] on stream, for sum, prod, min and max.
+ncclResult_t ncclLaunchDirectReduce(void* dst, void* const* srcs, int nSrcs, size_t nElts, struct ncclDevRedOpFull redOp, ncclDataType_t type, cudaStream_t stream);
+// Launch a copy of the first sliceBytes of srcs[p] to dst + p*sliceBytes, for a total of nBytes, on stream.
+ncclResult_t ncclLaunchDirectGather(void* dst, void* const* srcs, int nSrcs, size_t sliceBytes, size_t nBytes, cudaStream_t stream);
+// Size of a block of maxNnz sparse (index, value) pairs: indices first, then values, each 16 byte aligned.
+size_t ncclSparseBlockBytes(size_t maxNnz, ncclDataType_t indexType, ncclDataType_t type);
+// Launch the packing of the first *devNnz pairs into a block, padding the remaining indices with -1, on stream.
+ncclResult_t ncclLaunchSparsePack(void* block, void const* indices, void const* values, size_t const* devNnz, size_t maxNnz, ncclDataType_t indexType, ncclDataType_t type, cudaStream_t stream);
+// Launch dst[indices[i]] += values[i] for i < *devNnz (maxNnz if devNnz is NULL) on stream. Negative indices are skipped.
+ncclResult_t ncclLaunchSparseScatter(void* dst, size_t count, void const* indices, void const* values, size_t const* devNnz, size_t maxNnz, ncclDataType_t indexType, ncclDataType_t type, cudaStream_t stream);
+// Number of blocks exchanged in round step of a Bruck AllToAll over nRanks.
+int ncclBruckStepBlocks(int nRanks, int step);
+// Launch the initial rotation of a Bruck AllToAll from sendbuff into recvbuff on stream.
+ncclResult_t ncclLaunchBruckRotate(void* recvbuff, void const* sendbuff, size_t blockBytes, int nRanks, int rank, cudaStream_t stream);
+// Launch the gathering of the blocks sent in round step from recvbuff into stage on stream.
+ncclResult_t ncclLaunchBruckPack(void* stage, void const* recvbuff, size_t blockBytes, int nRanks, int rank, int step, cudaStream_t stream);
+// Launch the scattering of the blocks received in round step from stage into recvbuff on stream.
+ncclResult_t ncclLaunchBruckUnpack(void* recvbuff, void const* stage, size_t blockBytes, int nRanks, int rank, int step, cudaStream_t stream);
+// Launch the copy of block map[i] of src to block i of dst, for i < n, on stream. map is in device memory.
+ncclResult_t ncclLaunchBlockGather(void* dst, void const* src, size_t blockBytes, int n, int const* map, cudaStream_t stream);
 
 // `ncclNvlsSupported()` needs to be in sync with "func_valid" in "src/device/generate.py"
 inline bool ncclNvlsSupported(int devRedOp, int type) {
@@ -441,10 +652,13 @@ inline bool ncclNvlsSupported(int devRedOp, int type) {
 
 // `ncclDevFuncIndex()` needs to be in sync with "all_functions()" in "src/device/generate.py"
 inline int ncclDevFuncId(int coll, int devRedOp, int type, int algo, int proto) {
-  #if defined(__CUDA_BF16_TYPES_EXIST__)
+  // The device tables always contain every type in "all_tys".
+  #if defined(__CUDA_FP8_TYPES_EXIST__)
   constexpr int NumTypes = ncclNumTypes;
+  #elif defined(__CUDA_BF16_TYPES_EXIST__)
+  constexpr int NumTypes = ncclNumTypes + 2;
   #else
-  constexpr int NumTypes = ncclNumTypes + 1;
+  constexpr int NumTypes = ncclNumTypes + 3;
   #endif
   int row;
   do {
@@ -452,19 +666,22 @@ inline int ncclDevFuncId(int coll, int devRedOp, int type, int algo, int proto)
     if (coll == ncclFuncSendRecv) break;
     row += 1;
 
-    int nAlgos = 3;
+    int nAlgos = 4;
     if (coll == ncclFuncAllGather) {
       int algo1 = algo == NCCL_ALGO_RING ? 0 :
                   algo == NCCL_ALGO_COLLNET_DIRECT ? 1 :
-                /*algo == NCCL_ALGO_NVLS*/ 2;
+                  algo == NCCL_ALGO_NVLS ? 2 :
+                /*algo == NCCL_ALGO_HIER*/ 3;
       row += algo1*NCCL_NUM_PROTOCOLS + proto;
       break;
     }
     row += nAlgos*NCCL_NUM_PROTOCOLS;
 
-    nAlgos = 1;
+    nAlgos = 2;
     if (coll == ncclFuncBroadcast) {
-      row += proto;
+      int algo1 = algo == NCCL_ALGO_RING ? 0 :
+                /*algo == NCCL_ALGO_RING_SCATTER*/ 1;
+      row += algo1*NCCL_NUM_PROTOCOLS + proto;
       break;
     }
     row += nAlgos*NCCL_NUM_PROTOCOLS;
@@ -476,9 +693,11 @@ inline int ncclDevFuncId(int coll, int devRedOp, int type, int algo, int proto)
     }
     row += ncclNumDevRedOps*NumTypes*nAlgos*NCCL_NUM_PROTOCOLS;
 
-    nAlgos = 1;
+    nAlgos = 2;
     if (coll == ncclFuncReduce) {
-      row += (devRedOp*NumTypes + type)*NCCL_NUM_PROTOCOLS + proto;
+      int algo1 = algo == NCCL_ALGO_RING ? 0 :
+                /*algo == NCCL_ALGO_RING_SCATTER*/ 1;
+      row += ((devRedOp*NumTypes + type)*nAlgos + algo1)*NCCL_NUM_PROTOCOLS + proto;
       break;
     }
     row += ncclNumDevRedOps*NumTypes*nAlgos*NCCL_NUM_PROTOCOLS;
@@ -18,11 +18,39 @@
 #define NCCL_BYTES_ALIGNMENT 16
 
 ncclResult_t ncclInitKernelsForDevice(int cudaArch, size_t* maxStackSize);
+// With NCCL_LAZY_KERNEL_INIT=1, sets up the kernels the comm can reach in a background thread
+ncclResult_t ncclKernelWarmupStart(struct ncclComm* comm);
+// Waits for the kernel set up and returns the maximum stack size of these kernels
+ncclResult_t ncclKernelWarmupWait(struct ncclComm* comm, size_t* maxStackSize);
+ncclResult_t ncclKernelWarmupFree(struct ncclComm* comm);
 ncclResult_t ncclEnqueueCheck(struct ncclInfo* info);
+// Tasks of thread-safe communicators staged by this thread, see NCCL_COMM_THREAD_SAFE.
+#define NCCL_MAX_STAGED_COMMS 64
+ncclResult_t ncclEnqueueStagedFlush();
+void ncclEnqueueStagedRelease();
 ncclResult_t ncclLaunchPrepare(struct ncclComm* comm);
 ncclResult_t ncclLaunchKernelBefore_NoUncapturedCuda(struct ncclComm* comm, struct ncclKernelPlan* plan);
 ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan);
 ncclResult_t ncclLaunchKernelAfter_NoCuda(struct ncclComm* comm, struct ncclKernelPlan* plan);
 ncclResult_t ncclLaunchFinish(struct ncclComm* comm);
+ncclResult_t ncclResidentKernelStop(struct ncclComm* comm);
+ncclResult_t ncclProxyDoorbellStop(struct ncclComm* comm);
+// Reports pending tuner timings and releases their events, at comm teardown
+ncclResult_t ncclTunerTimingFree(struct ncclComm* comm);
+// Waits for all launched timed kernels and reports them
+ncclResult_t ncclTunerTimingWait(struct ncclComm* comm);
+// Drops the cached kernel plans
+ncclResult_t ncclPlanCacheFree(struct ncclComm* comm);
+// Frees the device buffers kept for the works of graph captured plans
+ncclResult_t ncclWorkPoolFree(struct ncclComm* comm);
+// Replaces small AllReduces of the group by fused ones, see NCCL_FUSION_THRESHOLD
+ncclResult_t ncclCollSortTasks(struct ncclComm* comm);
+ncclResult_t ncclCollFuseTasks(struct ncclComm* comm);
+// Flags in comm->collNeedConnect the algorithms pending collectives will use
+// but which are not connected yet
+ncclResult_t ncclCollPrepareConnect(struct ncclComm* comm, bool* needConnect);
+// Whether algorithm a can run the collective, datatype and op of collInfo on
+// its comm, for tools forcing it through comm->forceAlgorithm
+bool ncclAlgoAvailable(struct ncclInfo* collInfo, int a);
 
 #endif // End include guard
@@ -0,0 +1,36 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_GPUSHARE_H_
+#define NCCL_GPUSHARE_H_
+
+#include "nccl.h"
+
+// Several processes per GPU (NCCL_GPU_SHARE), e.g. inference workers under
+// MPS. Each process has its own communicators, and each of them otherwise
+// sizes its channels, hence its connection buffers, network QPs and proxy
+// work, as if it had the GPU and its links to itself. With NCCL_GPU_SHARE=1
+// processes register in a node-local registry per GPU (a file in /dev/shm)
+// at init and count the live processes registered there; NCCL_GPU_SHARE=<n>
+// assumes n processes per GPU instead, which also holds for the processes
+// started first. Ranks agree on the largest count, and communicators use
+// 1/count of their collective and NVLS channels, so that the processes
+// sharing a GPU together use about what a single one would.
+
+#define NCCL_GPU_SHARE_MAX_PROCS 64
+
+struct ncclComm;
+
+// Set comm->gpuShareProcs to the processes sharing the GPU of comm, 1 when
+// disabled. Registers the process with the first communicator on the GPU.
+ncclResult_t ncclGpuShareRegister(struct ncclComm* comm);
+ncclResult_t ncclGpuShareDeregister(struct ncclComm* comm);
+
+// Limit the channels of comm to its share, once ranks agreed on
+// comm->gpuShareProcs and before channels are set up.
+ncclResult_t ncclGpuShareLimitChannels(struct ncclComm* comm);
+
+#endif
@@ -37,6 +37,7 @@ struct ncclAsyncJob {
   ncclGroupJobState_t state;
   volatile uint32_t *abortFlag; /* point to comm abortFlag */
   volatile uint32_t *childAbortFlag; /* point to child abortFlag */
+  volatile uint32_t *abortFlagDevHost; /* host mapping of the device copy of comm abortFlag */
   ncclComm_t comm;
 };
 
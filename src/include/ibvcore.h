@@ -321,6 +321,8 @@ enum ibv_access_flags {
 	IBV_ACCESS_REMOTE_READ		= (1<<2),
 	IBV_ACCESS_REMOTE_ATOMIC	= (1<<3),
 	IBV_ACCESS_MW_BIND		= (1<<4),
+	IBV_ACCESS_ZERO_BASED		= (1<<5),
+	IBV_ACCESS_ON_DEMAND		= (1<<6),
 	IBV_ACCESS_RELAXED_ORDERING     = (1<<20),
 };
 
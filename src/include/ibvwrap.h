@@ -54,6 +54,17 @@ ncclResult_t wrap_ibv_create_comp_channel(struct ibv_comp_channel **ret, struct
 ncclResult_t wrap_ibv_destroy_comp_channel(struct ibv_comp_channel *channel);
 ncclResult_t wrap_ibv_create_cq(struct ibv_cq **ret, struct ibv_context *context, int cqe, void *cq_context, struct ibv_comp_channel *channel, int comp_vector);
 ncclResult_t wrap_ibv_destroy_cq(struct ibv_cq *cq);
+// Non-blocking on a non-blocking channel, got is 0 if no event was pending.
+ncclResult_t wrap_ibv_get_cq_event(struct ibv_comp_channel *channel, struct ibv_cq **cq, void **cq_context, int* got);
+ncclResult_t wrap_ibv_ack_cq_events(struct ibv_cq *cq, unsigned int nevents);
+static inline ncclResult_t wrap_ibv_req_notify_cq(struct ibv_cq *cq, int solicited_only) {
+  int ret = cq->context->ops.req_notify_cq(cq, solicited_only); /*returns 0 on success, or the value of errno on failure*/
+  if (ret != IBV_SUCCESS) {
+    WARN("ibv_req_notify_cq() failed with error %s", strerror(ret));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
 static inline ncclResult_t wrap_ibv_poll_cq(struct ibv_cq *cq, int num_entries, struct ibv_wc *wc, int* num_done) {
   int done = cq->context->ops.poll_cq(cq, num_entries, wc); /*returns the number of wcs or 0 on success, a negative number otherwise*/
   if (done < 0) {
@@ -66,6 +77,8 @@ static inline ncclResult_t wrap_ibv_poll_cq(struct ibv_cq *cq, int num_entries,
 ncclResult_t wrap_ibv_create_qp(struct ibv_qp **ret, struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr);
 ncclResult_t wrap_ibv_modify_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr, int attr_mask);
 ncclResult_t wrap_ibv_destroy_qp(struct ibv_qp *qp);
+ncclResult_t wrap_ibv_create_srq(struct ibv_srq **ret, struct ibv_pd *pd, struct ibv_srq_init_attr *srq_init_attr);
+ncclResult_t wrap_ibv_destroy_srq(struct ibv_srq *srq);
 ncclResult_t wrap_ibv_query_ece(struct ibv_qp *qp, struct ibv_ece *ece, int* supported);
 ncclResult_t wrap_ibv_set_ece(struct ibv_qp *qp, struct ibv_ece *ece, int* supported);
 
@@ -87,6 +100,15 @@ static inline ncclResult_t wrap_ibv_post_recv(struct ibv_qp *qp, struct ibv_recv
   return ncclSuccess;
 }
 
+static inline ncclResult_t wrap_ibv_post_srq_recv(struct ibv_srq *srq, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr) {
+  int ret = srq->context->ops.post_srq_recv(srq, wr, bad_wr); /*returns 0 on success, or the value of errno on failure (which indicates the failure reason)*/
+  if (ret != IBV_SUCCESS) {
+    WARN("ibv_post_srq_recv() failed with error %s", strerror(ret));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t wrap_ibv_event_type_str(char **ret, enum ibv_event_type event);
 
 #endif //End include guard
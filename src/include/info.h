@@ -27,6 +27,9 @@ typedef enum : uint8_t {
   ncclPatternCollnetDirect,
   ncclPatternNvls,
   ncclPatternNvlsTree,
+  ncclPatternHier,
+  ncclPatternRingScatter,
+  ncclPatternRecDbl,
   ncclPatternSend,
   ncclPatternRecv
 } ncclPattern_t;
@@ -47,6 +50,19 @@ struct ncclInfo {
   // Algorithm details
   int chunkSteps;
   int sliceSteps;
+  // Per-peer counts and displacements (in elements) for AllToAllv, nullptr otherwise
+  const size_t* sendcounts;
+  const size_t* sdispls;
+  const size_t* recvcounts;
+  const size_t* rdispls;
+  // Device pointer to the actual count for ncclSendDevCount/ncclRecvDevCount,
+  // count is then the upper bound. nullptr otherwise.
+  const size_t* devCount;
+  // ncclAllReduceMixed/ncclReduceScatterMixed: the user buffers hold castType
+  // (half or bf16) on the input and/or output side while datatype is float.
+  ncclDataType_t castType;
+  uint8_t castInput;
+  uint8_t castOutput;
   // Computed later
   ncclDevRedOpFull opFull;
   ncclPattern_t pattern;
@@ -58,6 +74,7 @@ struct ncclInfo {
   int stepSize;
   int chunkCount;
   int chunkSize;
+  int collnetDepth;
   int channelId;
   int workFuncIndex;
   ncclRegBufferType regBufType;
@@ -66,12 +83,20 @@ struct ncclInfo {
   // collnet buffer reg handles
   void* sendMhandle;
   void* recvMhandle;
+  // ring network connections use the registered recvbuff
+  bool netReg;
+  // AllReduces fused in this one, which then works on comm->fusionBuff
+  int nFusedSegments;
+  struct ncclWorkSegment* fusedSegments;
   // Need to initialize
   int nThreads;
   int nChannels;
   int algorithm;
   int protocol;
   bool userTuned;
+  bool autotuned;
+  int autotuneCand; // autotune candidate tried by this operation, -1 if none
+  bool profile; // sampled for profiling, see NCCL_PROFILE_SAMPLE
   struct ncclInfo *next;
 };
 
@@ -81,7 +106,8 @@ inline ncclResult_t ncclInfoSetDerived(struct ncclInfo* info, int nRanks) {
     info->count = info->workBytes;
     info->datatype = ncclInt8;
   }
-  if (info->coll == ncclFuncAllGather || info->coll == ncclFuncReduceScatter) info->nBytes *= nRanks; // count is per rank
+  if (info->coll == ncclFuncAllGather || info->coll == ncclFuncReduceScatter || info->coll == ncclFuncAllToAll ||
+      info->coll == ncclFuncGather || info->coll == ncclFuncScatter) info->nBytes *= nRanks; // count is per rank
 
   /* compute buffer size for NVLS buffer registration */
   if (info->coll == ncclFuncAllGather) {
@@ -115,6 +141,23 @@ struct ncclTaskP2p {
   // Stateful chunk index. If a p2p gets "cut" over two plans this keeps track
   // of where it left off.
   int chunk;
+  // Buffer registration status when known at enqueue time (1 registered,
+  // 2 registered pinned host memory, 0 not registered), -1 to look it up for
+  // each chunk when scheduling.
+  int reg;
+  // Device pointer to the actual count in elements of eltSize bytes, bytes
+  // being the upper bound. nullptr when bytes is exact.
+  const size_t* devCount;
+  int eltSize;
+  // Whether the peer, in another process, and this rank exchanged the receive
+  // buffer (1) or not (0), -1 until p2pIpcExchange() looked at the task. For
+  // sends, the receive buffer as mapped here, nullptr if it was not offered.
+  int ipcReg;
+  void* ipcRemote;
+  // Sampled for profiling, see NCCL_PROFILE_SAMPLE
+  bool profile;
+  // Member of an AllToAll(v), whose peers are packed into works across step groups
+  bool batched;
 };
 
 struct ncclCudaStreamList {
@@ -134,13 +177,34 @@ struct ncclTasks {
   struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> collCBDQueue;
   // Queue for collnet
   struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> collnetQueue;
+  // Queue for collectives run by the copy engines (see cecoll.h)
+  struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> ceQueue;
   size_t workBytesTotal;
   int usableChannels;
-  bool sorted;
+  bool sorted; // collQueue is sorted, tasks are appended unsorted and sorted once by ncclCollSortTasks()
   struct Peer* peers/*[nRanks]*/;
   int *p2pSendOrder, *p2pRecvOrder;
   int p2pOrderSteps;
-  int nTasksColl, nTasksP2p;
+  // Inverse of p2pSendOrder/p2pRecvOrder, [nRanks]
+  int *p2pSendStep, *p2pRecvStep;
+  // Steps of the order with queued sends or recvs, so scheduling doesn't walk
+  // all of them for every round. p2pStepActive[step] is set for those in
+  // p2pActiveSteps[0..nP2pActiveSteps).
+  int* p2pActiveSteps/*[p2pOrderSteps]*/;
+  bool* p2pStepActive/*[p2pOrderSteps]*/;
+  int nP2pActiveSteps;
+  int nTasksColl, nTasksP2p, nTasksCe;
+  // Channels the collectives of this group may use at most, 0 if unlimited
+  // (see ncclGroupSetMaxCTAs).
+  int maxCTAs;
+  // Set by ncclGroupSetOpTag for the plans of the group, 0 if none
+  uint64_t opTag;
+  // Channels [channelFirst, channelFirst+channelCount) the collectives being
+  // scheduled are restricted to, channelCount 0 if unrestricted (see
+  // NCCL_GROUP_STREAM_SPLIT).
+  int channelFirst, channelCount;
+  // Every user stream got plans of its own, see NCCL_GROUP_STREAM_SPLIT.
+  bool streamSplit;
 
   // The list of user streams aggregated over all tasks present.
   struct ncclCudaStreamList* streams;
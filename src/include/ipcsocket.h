@@ -21,6 +21,8 @@
 #include <inttypes.h>
 
 #define NCCL_IPC_SOCKNAME_LEN 64
+// Most fds passed in one message
+#define NCCL_IPC_MAX_FDS 16
 
 struct ncclIpcSocket {
   int fd;
@@ -37,5 +39,7 @@ ncclResult_t ncclIpcSocketSendFd(struct ncclIpcSocket *handle, const int fd, int
 
 ncclResult_t ncclIpcSocketSendMsg(ncclIpcSocket *handle, void *hdr, int hdrLen, const int sendFd, int rank, uint64_t hash);
 ncclResult_t ncclIpcSocketRecvMsg(ncclIpcSocket *handle, void *hdr, int hdrLen, int *recvFd);
+ncclResult_t ncclIpcSocketSendMsgFds(ncclIpcSocket *handle, void *hdr, int hdrLen, const int *sendFds, int nFds, int rank, uint64_t hash);
+ncclResult_t ncclIpcSocketRecvMsgFds(ncclIpcSocket *handle, void *hdr, int hdrLen, int *recvFds, int nFds);
 
 #endif /* NCCL_IPCSOCKET_H */
@@ -0,0 +1,31 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_MEMPOOL_H_
+#define NCCL_MEMPOOL_H_
+
+#include "nccl.h"
+
+// ncclMemAlloc pool (NCCL_MEM_POOL_SLAB_SIZE=<bytes>). Buffers up to the slab
+// size are carved from slabs of that size, allocated per device like any
+// ncclMemAlloc buffer (cuMem, multicast granularity when the device supports
+// NVLS). Each slab is registered as a whole, automatically, with every
+// communicator the first time one of its buffers is used, so all buffers of a
+// slab get the registered NVLS, CollNet and network paths after a single
+// registration and without any ncclCommRegister call. Freed buffers go back
+// to their slab; one empty slab per device is kept for reuse.
+
+// Allocate from the pool. *ptr is NULL if the pool is disabled or size is
+// larger than a slab, the caller then allocates on its own.
+ncclResult_t ncclMemPoolAlloc(void** ptr, size_t size);
+// Give ptr back to its slab. *pooled is false if ptr did not come from the pool.
+ncclResult_t ncclMemPoolFree(void* ptr, bool* pooled);
+
+// Allocation and release of an ncclMemAlloc buffer or slab, bypassing the pool
+ncclResult_t ncclMemAllocDirect(void** ptr, size_t size);
+ncclResult_t ncclMemFreeDirect(void* ptr);
+
+#endif
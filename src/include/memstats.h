@@ -0,0 +1,66 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_MEMSTATS_H_
+#define NCCL_MEMSTATS_H_
+
+#include "nccl.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// In ncclCommMemStats_t order
+enum ncclMemCategory {
+  ncclMemConnector = 0,
+  ncclMemProxyShared = 1,
+  ncclMemNvls = 2,
+  ncclMemWorkFifo = 3,
+  ncclMemDevComm = 4,
+  ncclMemOther = 5
+};
+static_assert(NCCL_MEM_NUM_CATEGORIES == ncclMemOther+1, "Memory categories mismatch");
+
+struct ncclMemStats {
+  uint64_t deviceBytes[NCCL_MEM_NUM_CATEGORIES];
+  uint64_t hostBytes[NCCL_MEM_NUM_CATEGORIES];
+  uint64_t transportBytes[NCCL_STATS_NUM_TRANSPORTS];
+  int nPeers;
+  uint64_t* peerBytes;
+};
+
+// Where allocations made by the current thread are accounted. Transport
+// and peer are -1 when not relevant.
+struct ncclMemTag {
+  struct ncclMemStats* stats;
+  int category;
+  int transport;
+  int peer;
+};
+extern thread_local struct ncclMemTag ncclMemCurrentTag;
+
+// Accounts allocations made through the alloc.h helpers in this thread to
+// stats until the end of the scope. Scopes nest; a NULL stats stops tracking.
+struct ncclMemScope {
+  struct ncclMemTag saved;
+  ncclMemScope(struct ncclMemStats* stats, int category, int transport = -1, int peer = -1) {
+    saved = ncclMemCurrentTag;
+    ncclMemCurrentTag.stats = stats;
+    ncclMemCurrentTag.category = category;
+    ncclMemCurrentTag.transport = transport;
+    ncclMemCurrentTag.peer = peer;
+  }
+  ~ncclMemScope() { ncclMemCurrentTag = saved; }
+};
+
+// Record an allocation under the current tag, and release it wherever it is
+// freed from. Pointers that were never tracked are ignored.
+void ncclMemTrack(void* ptr, size_t size, int host);
+void ncclMemUntrack(void* ptr);
+
+ncclResult_t ncclMemStatsInit(struct ncclMemStats* stats, int nPeers);
+// Forget allocations still accounted to stats, which is about to go away.
+void ncclMemStatsFree(struct ncclMemStats* stats);
+
+#endif
@@ -0,0 +1,28 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_METRICS_H_
+#define NCCL_METRICS_H_
+
+#include "nccl.h"
+
+// Metrics exporter (NCCL_METRICS_FILE). A background thread periodically sums
+// the ncclCommGetStats counters of all communicators of the process and
+// writes them in Prometheus text format to NCCL_METRICS_FILE, every
+// NCCL_METRICS_INTERVAL ms. The file is replaced atomically, so pointing it
+// to a directory scraped by the node exporter's textfile collector (one file
+// per process, "%p" expands to the pid) exposes them for the whole node. The
+// hot paths are unchanged: the thread only reads the relaxed-atomic counters.
+// The file is removed once the last communicator is destroyed.
+
+struct ncclComm;
+
+// Add comm to, or remove it from, the communicators exported. The thread is
+// started with the first communicator and stopped with the last one.
+ncclResult_t ncclMetricsRegister(struct ncclComm* comm);
+ncclResult_t ncclMetricsDeregister(struct ncclComm* comm);
+
+#endif
@@ -0,0 +1,80 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_DEV_COMM_H_
+#define NCCL_DEV_COMM_H_
+
+#include "nccl.h"
+#include <stdint.h>
+
+// Device side of the communication windows created with ncclDevCommCreate.
+// The ncclDevComm_t is passed to user kernels by value. Kernels write into the
+// window of a peer with ncclDevPut (or plain stores through ncclDevPeerPtr),
+// then tell it with ncclDevSignal; the peer waits for the data with
+// ncclDevWait on its own signal, which it polls in local memory.
+//
+// Signals only grow: ncclDevSignal adds to the signal of the peer, so several
+// producers can signal the same consumer, and a consumer waits until the sum
+// reaches what it expects. Reusing a window for the next iteration is done by
+// waiting for increasing values rather than resetting signals.
+
+#if defined(__CUDACC__)
+
+// Address of offset in the window of peer
+__device__ __forceinline__ void* ncclDevPeerPtr(const ncclDevComm_t& devComm, int peer, size_t offset) {
+  return (char*)devComm.buffs[peer] + offset;
+}
+
+// Address of offset in our own window
+__device__ __forceinline__ void* ncclDevLocalPtr(const ncclDevComm_t& devComm, size_t offset) {
+  return (char*)devComm.buffs[devComm.rank] + offset;
+}
+
+// Copies bytes from src to offset in the window of peer. Called by threads
+// [0, nThreads) with their index tid, usually a whole block.
+__device__ __forceinline__ void ncclDevPut(const ncclDevComm_t& devComm, int peer, size_t offset, const void* src, size_t bytes, int tid, int nThreads) {
+  char* dst = (char*)ncclDevPeerPtr(devComm, peer, offset);
+  const char* s = (const char*)src;
+  size_t done = 0;
+  if ((((uintptr_t)dst | (uintptr_t)s) & 15) == 0) {
+    // 16 byte vectors over NVLink
+    size_t nVec = bytes/16;
+    for (size_t i=tid; i<nVec; i+=nThreads) ((uint4*)dst)[i] = ((const uint4*)s)[i];
+    done = nVec*16;
+  }
+  for (size_t i=done+tid; i<bytes; i+=nThreads) dst[i] = s[i];
+}
+
+// Adds value to signal sig of peer, once all prior writes of the calling
+// thread to peers are visible. Call from a single thread, after the threads
+// that wrote the data synchronized with it (e.g. __syncthreads()).
+__device__ __forceinline__ void ncclDevSignal(const ncclDevComm_t& devComm, int peer, int sig, uint64_t value) {
+  __threadfence_system();
+  atomicAdd((unsigned long long*)(devComm.signals[peer]+sig), (unsigned long long)value);
+}
+
+// Block-wide put followed by a signal. All threads of the block must call it.
+__device__ __forceinline__ void ncclDevPutSignal(const ncclDevComm_t& devComm, int peer, size_t offset, const void* src, size_t bytes, int sig, uint64_t value) {
+  ncclDevPut(devComm, peer, offset, src, bytes, threadIdx.x, blockDim.x);
+  __syncthreads();
+  if (threadIdx.x == 0) ncclDevSignal(devComm, peer, sig, value);
+}
+
+// Current value of our own signal sig
+__device__ __forceinline__ uint64_t ncclDevSignalValue(const ncclDevComm_t& devComm, int sig) {
+  return *(volatile uint64_t*)(devComm.signals[devComm.rank]+sig);
+}
+
+// Waits until our own signal sig reached value. Data the signaling peers put
+// before signaling is visible to the calling thread afterwards.
+__device__ __forceinline__ void ncclDevWait(const ncclDevComm_t& devComm, int sig, uint64_t value) {
+  while (ncclDevSignalValue(devComm, sig) < value);
+  __threadfence();
+}
+
+#endif // __CUDACC__
+
+#endif
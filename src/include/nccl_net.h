@@ -94,9 +94,89 @@ typedef struct {
   ncclResult_t (*irecvConsumed)(void* recvComm, int n, void* request);
 } ncclNet_v8_t;
 
-typedef ncclNet_v8_t ncclNet_t;
+// Maximum size of a memory region descriptor exchanged for one-sided operations
+#define NCCL_NET_MR_DESC_MAXSIZE 64
 
-#define NCCL_NET_PLUGIN_SYMBOL ncclNetPlugin_v8
+typedef struct {
+  // Name of the network (mainly for logs)
+  const char* name;
+  // Initialize the network.
+  ncclResult_t (*init)(ncclDebugLogger_t logFunction);
+  // Return the number of adapters.
+  ncclResult_t (*devices)(int* ndev);
+  // Get various device properties.
+  ncclResult_t (*getProperties)(int dev, ncclNetProperties_v8_t* props);
+  // Create a receiving object and provide a handle to connect to it. The
+  // handle can be up to NCCL_NET_HANDLE_MAXSIZE bytes and will be exchanged
+  // between ranks to create a connection.
+  ncclResult_t (*listen)(int dev, void* handle, void** listenComm);
+  // Connect to a handle and return a sending comm object for that peer.
+  // This call must not block for the connection to be established, and instead
+  // should return successfully with sendComm == NULL with the expectation that
+  // it will be called again until sendComm != NULL.
+  // If *sendDevComm points to a valid object, then NCCL is requesting device offload for this connection
+  ncclResult_t (*connect)(int dev, void* handle, void** sendComm, ncclNetDeviceHandle_v8_t** sendDevComm);
+  // Finalize connection establishment after remote peer has called connect.
+  // This call must not block for the connection to be established, and instead
+  // should return successfully with recvComm == NULL with the expectation that
+  // it will be called again until recvComm != NULL.
+  // If *recvDevComm points to a valid object, then NCCL is requesting device offload for this connection
+  ncclResult_t (*accept)(void* listenComm, void** recvComm, ncclNetDeviceHandle_v8_t** recvDevComm);
+  // Register/Deregister memory. Comm can be either a sendComm or a recvComm.
+  // Type is either NCCL_PTR_HOST or NCCL_PTR_CUDA.
+  ncclResult_t (*regMr)(void* comm, void* data, size_t size, int type, void** mhandle);
+  /* DMA-BUF support */
+  ncclResult_t (*regMrDmaBuf)(void* comm, void* data, size_t size, int type, uint64_t offset, int fd, void** mhandle);
+  ncclResult_t (*deregMr)(void* comm, void* mhandle);
+  // Asynchronous send to a peer.
+  // May return request == NULL if the call cannot be performed (or would block)
+  ncclResult_t (*isend)(void* sendComm, void* data, int size, int tag, void* mhandle, void** request);
+  // Asynchronous recv from a peer.
+  // May return request == NULL if the call cannot be performed (or would block)
+  ncclResult_t (*irecv)(void* recvComm, int n, void** data, int* sizes, int* tags, void** mhandles, void** request);
+  // Perform a flush/fence to make sure all data received with NCCL_PTR_CUDA is
+  // visible to the GPU
+  ncclResult_t (*iflush)(void* recvComm, int n, void** data, int* sizes, void** mhandles, void** request);
+  // Test whether a request is complete. If size is not NULL, it returns the
+  // number of bytes sent/received.
+  ncclResult_t (*test)(void* request, int* done, int* sizes);
+  // Close and free send/recv comm objects
+  ncclResult_t (*closeSend)(void* sendComm);
+  ncclResult_t (*closeRecv)(void* recvComm);
+  ncclResult_t (*closeListen)(void* listenComm);
+
+  // Copy the given mhandle to a dptr in a format usable by this plugin's device code
+  ncclResult_t (*getDeviceMr)(void* comm, void* mhandle, void** dptr_mhandle);
+
+  // Notify the plugin that a recv has completed by the device
+  ncclResult_t (*irecvConsumed)(void* recvComm, int n, void* request);
+
+  // One-sided operations. All four are NULL if the plugin does not support them.
+  // Describe memory registered on a comm, starting at data, in up to NCCL_NET_MR_DESC_MAXSIZE
+  // bytes. The descriptor is exchanged out of band with the peer, which can then access
+  // that memory through iput/iget on the connected sendComm.
+  ncclResult_t (*getMrDesc)(void* comm, void* data, void* mhandle, void* desc);
+  // Write size bytes into the remote memory described by remoteDesc, at remoteOffset,
+  // without the peer posting a receive. Completion of the request means the data left
+  // the local buffer, not that it is visible to the peer. If signal is set, the write
+  // also completes the oldest request posted by the peer with iwaitSignal, and that
+  // request returns size.
+  ncclResult_t (*iput)(void* sendComm, void* data, int size, void* mhandle, void* remoteDesc, uint64_t remoteOffset, int signal, void** request);
+  // Read size bytes from the remote memory described by remoteDesc, at remoteOffset.
+  ncclResult_t (*iget)(void* sendComm, void* data, int size, void* mhandle, void* remoteDesc, uint64_t remoteOffset, void** request);
+  // Wait for a signaled iput from the peer. Signaled iputs and isends are matched with
+  // iwaitSignal and irecv calls in the order they were issued.
+  ncclResult_t (*iwaitSignal)(void* recvComm, void** request);
+
+  // Test n requests at once, so that the plugin can poll its completions in batches.
+  // Same as calling test on each request, with sizes[i] passed as sizes (may be NULL).
+  // Optional, NULL if not supported.
+  ncclResult_t (*testAll)(int n, void** requests, int* done, int** sizes);
+} ncclNet_v9_t;
+
+typedef ncclNet_v9_t ncclNet_t;
+
+#define NCCL_NET_PLUGIN_SYMBOL ncclNetPlugin_v9
 
 typedef struct {
   void* mhandle;
@@ -155,6 +235,15 @@ typedef ncclCollNet_v8_t ncclCollNet_t;
 
 #define NCCL_COLLNET_PLUGIN_SYMBOL ncclCollNetPlugin_v8
 
+// Host memory reduction provided by NCCL to plugins which reduce on the CPU:
+// dst[i] = src0[i] op src1[i] for all ncclDataType_t and for ncclSum, ncclProd,
+// ncclMax and ncclMin. dst may be src0 or src1. It uses AVX2 or AVX-512 when
+// the CPU supports them. Plugins should look it up at runtime so they still
+// load with versions of NCCL which don't provide it:
+//   ncclNetHostReduce_t reduce = (ncclNetHostReduce_t)dlsym(RTLD_DEFAULT, NCCL_NET_HOST_REDUCE_SYMBOL);
+typedef ncclResult_t (*ncclNetHostReduce_t)(void* dst, const void* src0, const void* src1, size_t count, ncclDataType_t dataType, ncclRedOp_t redOp);
+#define NCCL_NET_HOST_REDUCE_SYMBOL "ncclNetHostReduce"
+
 typedef struct {
   char* name;                      // Used mostly for logging.
   char* pciPath;                   // Path to the PCI device in /sys.
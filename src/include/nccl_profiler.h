@@ -0,0 +1,89 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_PROFILER_PLUGIN_H_
+#define NCCL_PROFILER_PLUGIN_H_
+
+#include "nccl.h"
+#include "nccl_common.h"
+
+// Proxy operation states reported through proxyOpState(). Send and receive
+// operations go through a different set of intermediate states.
+enum {
+  ncclProfilerProxyOpBegin = 0,
+
+  ncclProfilerProxySendGPUWait = 1,   // Waiting for the GPU to produce data
+  ncclProfilerProxySendWait = 2,      // Send posted to the network
+
+  ncclProfilerProxyRecvWait = 1,      // Receive posted to the network
+  ncclProfilerProxyRecvFlushWait = 2, // Data received, waiting for the flush
+  ncclProfilerProxyRecvGPUWait = 3,   // Waiting for the GPU to consume data
+
+  ncclProfilerProxyOpEnd = 4
+};
+
+// API to be implemented by an external profiler. All callbacks but init and
+// destroy are on the critical path and must return quickly; they may be NULL
+// if the plugin is not interested in the event.
+//
+// opTag is the tag set with ncclGroupSetOpTag() for the group the plan was
+// launched from, 0 if none.
+typedef struct {
+  // Name of the profiler
+  const char* name;
+
+  // Initializes profiler states. NCCL creates one context per communicator for
+  // the host-side events, and one per proxy thread for proxy and network
+  // events. The proxy thread may be shared by communicators created with
+  // ncclCommSplit, in which case it reports against the parent's context.
+  // Inputs:
+  //   - commHash: unique identifier of the communicator, same across ranks
+  //   - rank, nRanks: position of this rank in the communicator
+  //   - logFunction: a logFunction can be useful to integrate logging together with NCCL core.
+  // Outputs:
+  //   - context: profiler context object
+  ncclResult_t (*init)(uint64_t commHash, int rank, int nRanks, ncclDebugLogger_t logFunction, void **context);
+
+  // A collective or point-to-point operation was enqueued by the user.
+  // opCount is the communicator's operation counter at enqueue time.
+  void (*collEnqueue)(void* context, uint64_t opCount, ncclFunc_t func, size_t count,
+                      ncclDataType_t datatype, int root, cudaStream_t stream);
+
+  // A kernel plan was launched. channelMask holds the channels it runs on and
+  // nColl the number of collectives aggregated in it.
+  void (*planLaunch)(void* context, uint64_t opCount, uint64_t channelMask, int nColl, cudaStream_t stream, uint64_t opTag);
+
+  // A proxy operation step reached a new state (see ncclProfilerProxy* above).
+  // Called from the proxy progress thread.
+  void (*proxyOpState)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, int state, uint64_t opTag);
+
+  // A network send or receive request for the given step completed.
+  // Called from the proxy progress thread.
+  void (*netComplete)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, size_t size, uint64_t opTag);
+
+  // Terminates the plugin context and cleans up any resources that it allocated.
+  ncclResult_t (*destroy)(void* context);
+} ncclProfiler_v2_t;
+
+typedef ncclProfiler_v2_t ncclProfiler_t;
+
+#define NCCL_PROFILER_PLUGIN_SYMBOL "ncclProfiler_v2"
+
+// v1 is v2 without the operation tags of planLaunch, proxyOpState and netComplete.
+typedef struct {
+  const char* name;
+  ncclResult_t (*init)(uint64_t commHash, int rank, int nRanks, ncclDebugLogger_t logFunction, void **context);
+  void (*collEnqueue)(void* context, uint64_t opCount, ncclFunc_t func, size_t count,
+                      ncclDataType_t datatype, int root, cudaStream_t stream);
+  void (*planLaunch)(void* context, uint64_t opCount, uint64_t channelMask, int nColl, cudaStream_t stream);
+  void (*proxyOpState)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, int state);
+  void (*netComplete)(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, size_t size);
+  ncclResult_t (*destroy)(void* context);
+} ncclProfiler_v1_t;
+
+#define NCCL_PROFILER_PLUGIN_SYMBOL_V1 "ncclProfiler_v1"
+
+#endif
@@ -53,8 +53,95 @@ typedef struct {
   ncclResult_t (*destroy)(void* context);
 } ncclTuner_v2_t;
 
-typedef ncclTuner_v2_t ncclTuner_t;
+// Cost table entries for algorithm/protocol combinations that are not available,
+// or that the plugin wants NCCL to skip.
+#define NCCL_ALGO_PROTO_IGNORE -1.0
 
-#define NCCL_TUNER_PLUGIN_SYMBOL "ncclTunerPlugin_v2"
+typedef struct {
+  // Name of the tuner
+  const char* name;
+
+  // Initializes tuner states. Same as v2.
+  ncclResult_t (*init)(size_t nRanks, size_t nNodes, ncclDebugLogger_t logFunction, void **context);
+
+  // Gets info (algo, protocol, number of ctas) for a given collective.
+  // Inputs:
+  //   - context: tuner context object
+  //   - collType: collective type , e.g., allreduce, allgather…
+  //   - nBytes: collective size in bytes
+  //   - numPipeOps: number of operations in the group
+  //   - numAlgo, numProto: dimensions of the cost table
+  //
+  // Outputs:
+  //   - collCostTable: numAlgo x numProto row-major table of the predicted time
+  //     in microseconds of each algorithm/protocol, as computed by NCCL's model.
+  //     Unavailable combinations are set to NCCL_ALGO_PROTO_IGNORE. The plugin
+  //     may rewrite any available entry; NCCL then picks the lowest time.
+  //   - nChannels: number of channels (hence SMs) to be used, 0 to let NCCL decide.
+  //
+  // If getCollInfo() does not return ncclSuccess, NCCL will fall back to the
+  // default tuning for the given collective.
+  ncclResult_t (*getCollInfo)(void* context, ncclFunc_t collType, size_t nBytes, int numPipeOps,
+                              float* collCostTable, int numAlgo, int numProto, int* nChannels);
+
+  // Reports how a tuning decision performed. Called from the thread that
+  // enqueues operations, some time after a kernel holding a single collective
+  // has completed; operations aggregated in a group are not reported.
+  // May be NULL, in which case NCCL does not time kernels.
+  // Inputs:
+  //   - collType, nBytes: collective that was run
+  //   - algorithm, protocol, nChannels: configuration that was used
+  //   - duration: kernel execution time in microseconds
+  ncclResult_t (*collComplete)(void* context, ncclFunc_t collType, size_t nBytes,
+                               int algorithm, int protocol, int nChannels, float duration);
+
+  // Terminates the plugin and cleans up any resources that the plugin allocated.
+  // context: tuner context object
+  ncclResult_t (*destroy)(void* context);
+} ncclTuner_v3_t;
+
+typedef struct {
+  // Name of the tuner
+  const char* name;
+
+  // Initializes tuner states. Same as v2.
+  ncclResult_t (*init)(size_t nRanks, size_t nNodes, ncclDebugLogger_t logFunction, void **context);
+
+  // Gets info (algo, protocol, number of ctas) for a given collective. Same as v3.
+  ncclResult_t (*getCollInfo)(void* context, ncclFunc_t collType, size_t nBytes, int numPipeOps,
+                              float* collCostTable, int numAlgo, int numProto, int* nChannels);
+
+  // Reports how a tuning decision performed. Same as v3.
+  ncclResult_t (*collComplete)(void* context, ncclFunc_t collType, size_t nBytes,
+                               int algorithm, int protocol, int nChannels, float duration);
+
+  // Gets the chunk size, the amount of data each pipeline step of the
+  // algorithm moves, once algorithm, protocol and channels are chosen.
+  // May be NULL.
+  // Inputs:
+  //   - context: tuner context object
+  //   - collType, nBytes: collective being run; nBytes covers all operations
+  //     when several are aggregated in one kernel
+  //   - algorithm, protocol, nChannels: configuration chosen for it
+  //
+  // Outputs:
+  //   - chunkSize: set on input to the chunk size NCCL picked, in bytes. The
+  //     plugin may lower or raise it; NCCL rounds it down to 16 bytes and caps
+  //     it to what the connection buffers of the protocol can hold.
+  //
+  // If getChunkSize() does not return ncclSuccess, NCCL keeps its own chunk size.
+  ncclResult_t (*getChunkSize)(void* context, ncclFunc_t collType, size_t nBytes,
+                               int algorithm, int protocol, int nChannels, size_t* chunkSize);
+
+  // Terminates the plugin and cleans up any resources that the plugin allocated.
+  // context: tuner context object
+  ncclResult_t (*destroy)(void* context);
+} ncclTuner_v4_t;
+
+typedef ncclTuner_v4_t ncclTuner_t;
+
+#define NCCL_TUNER_PLUGIN_SYMBOL "ncclTunerPlugin_v4"
+#define NCCL_TUNER_PLUGIN_SYMBOL_V3 "ncclTunerPlugin_v3"
+#define NCCL_TUNER_PLUGIN_SYMBOL_V2 "ncclTunerPlugin_v2"
 
 #endif
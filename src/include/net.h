@@ -24,4 +24,34 @@ ncclResult_t ncclGpuGdrSupport(struct ncclComm* comm, int* gdrSupport);
 extern ncclNet_t ncclNetIb;
 extern ncclNet_t ncclNetSocket;
 
+// The plugin API has no notion of communicator. The proxy makes the QoS of the
+// comm it connects for current on its thread while calling connect and accept,
+// and the internal plugins apply it to the QPs and sockets they set up.
+extern __thread struct ncclNetQos ncclNetQosCurrent;
+struct ncclNetQosScope {
+  struct ncclNetQos saved;
+  ncclNetQosScope(struct ncclNetQos qos) : saved(ncclNetQosCurrent) { ncclNetQosCurrent = qos; }
+  ~ncclNetQosScope() { ncclNetQosCurrent = saved; }
+};
+
+// Completion channel fds of the internal IB plugin, armed on all its CQs. Only
+// available when NCCL_PROXY_SLEEP_IDLE is set, so that the proxy can sleep.
+ncclResult_t ncclIbCqEventsArm(int* fds, int maxFds, int* nFds);
+ncclResult_t ncclIbCqEventsDrain();
+
+// Out-of-band connection setup of the internal IB plugin (NCCL_IB_OOB_CONNECT). Both
+// sides create their QP during transport setup and exchange its address through the
+// bootstrap, within the listen handle and the NET connect info, instead of over a socket
+// per connection. Connect and accept then reduce to local QP transitions. Each side falls
+// back to the regular connect/accept when the other did not fill its info (valid flag).
+#define NCCL_NET_OOB_INFO_SIZE 48
+ncclResult_t ncclIbOobConnectPrepare(int dev, void* oobInfo, void** oobSendComm);
+ncclResult_t ncclIbOobConnect(void* oobSendComm, void* listenHandle, void** sendComm);
+ncclResult_t ncclIbOobAccept(void* listenComm, void* oobInfo, void** recvComm);
+
+// The internal plugins leave the end of their listen handle free for the NET
+// transport, which passes the id of the net comm pair it offers for reuse
+// there (NCCL_NET_POOL_TTL).
+#define NCCL_NET_HANDLE_POOL_OFFSET (NCCL_NET_HANDLE_MAXSIZE - sizeof(uint64_t))
+
 #endif
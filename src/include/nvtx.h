@@ -27,6 +27,12 @@
 #define NVTX_SID_Reduce        8
 #define NVTX_SID_Send          9
 #define NVTX_SID_Recv          10
+#define NVTX_SID_AllToAll      12 // 11 is used by NVTX_PAYLOAD_ENTRY_NCCL_REDOP
+#define NVTX_SID_CollPlanned   13
+#define NVTX_SID_PlanLaunch    14
+#define NVTX_SID_ProxyOp       15
+#define NVTX_SID_Gather        16
+#define NVTX_SID_Scatter       17
 
 // Define static schema ID for the reduction operation.
 #define NVTX_PAYLOAD_ENTRY_NCCL_REDOP 11 + NVTX_PAYLOAD_ENTRY_TYPE_SCHEMA_ID_STATIC_START
@@ -80,6 +86,32 @@ class payload_schema {
   ::nvtx3::v1::event_attributes const nvtx3_func_attr__{nvtx3_func_name__, nvtx3_bpl__}; \
   ::nvtx3::v1::scoped_range_in<nccl_domain> const nvtx3_range__{nvtx3_func_attr__};
 
+// Payload of an event with static schema ID, for the macros below
+#define NVTX3_PAYLOAD_DATA(ID, P) \
+  static const payload_schema nvtx3_schema__{ID##Schema, std::extent<decltype(ID##Schema)>::value, \
+    NVTX_PAYLOAD_ENTRY_TYPE_SCHEMA_ID_STATIC_START + NVTX_SID_##ID, #ID}; \
+  nvtxPayloadData_t nvtx3_bpl__[] = { \
+    {NVTX_PAYLOAD_ENTRY_TYPE_SCHEMA_ID_STATIC_START + NVTX_SID_##ID, sizeof(P), &(P)}};
+
+// Marker with message M and payload P, described by the schema ID##Schema
+#define NVTX3_MARK_WITH_PARAMS(ID, M, P) do { \
+  NVTX3_PAYLOAD_DATA(ID, P) \
+  ::nvtx3::v1::mark_in<nccl_domain>(::nvtx3::v1::event_attributes{::nvtx3::v1::message{M}, nvtx3_bpl__}); \
+} while (0)
+
+// Push/pop range covering the rest of the scope
+#define NVTX3_RANGE_WITH_PARAMS(ID, M, P) \
+  NVTX3_PAYLOAD_DATA(ID, P) \
+  ::nvtx3::v1::event_attributes const nvtx3_range_attr__{::nvtx3::v1::message{M}, nvtx3_bpl__}; \
+  ::nvtx3::v1::scoped_range_in<nccl_domain> const nvtx3_range__{nvtx3_range_attr__};
+
+// Start/end range that may end on another call, H holds its nvtxRangeId_t
+#define NVTX3_RANGE_START_WITH_PARAMS(ID, M, P, H) do { \
+  NVTX3_PAYLOAD_DATA(ID, P) \
+  H = ::nvtx3::v1::start_range_in<nccl_domain>(::nvtx3::v1::event_attributes{::nvtx3::v1::message{M}, nvtx3_bpl__}).get_value(); \
+} while (0)
+#define NVTX3_RANGE_END(H) ::nvtx3::v1::end_range_in<nccl_domain>(::nvtx3::v1::range_handle{H})
+
 extern void initNvtxRegisteredEnums();
 
 #endif
@@ -37,5 +37,20 @@ typedef union {
 ncclResult_t ncclP2pAllocateShareableBuffer(size_t size, ncclIpcDesc *ipcDesc, void **ptr);
 ncclResult_t ncclP2pFreeShareableBuffer(ncclIpcDesc *ipcDesc);
 ncclResult_t ncclP2pImportShareableBuffer(struct ncclComm *comm, int tpPeer, size_t size, ncclIpcDesc *ipcDesc, void **devMemPtr);
+ncclResult_t ncclP2pImportShareableBuffers(struct ncclComm *comm, int tpPeer, int n, size_t* sizes, ncclIpcDesc** ipcDescs, void*** devMemPtrs);
+
+// Receive buffer a cross-process P2P receiver offers to its sender
+struct ncclP2pIpcMsg {
+  uint64_t id; // of the export within the receiver's comm, 0 if none
+  size_t size; // of the exported allocation
+  size_t offset; // of the receive buffer in it
+  ncclIpcDesc ipcDesc;
+};
+
+struct ncclReg;
+ncclResult_t ncclP2pIpcExportBuffer(struct ncclComm* comm, void* buff, size_t size, struct ncclP2pIpcMsg* msg);
+ncclResult_t ncclP2pIpcImportBuffer(struct ncclComm* comm, int peer, struct ncclP2pIpcMsg* msg, void** ptr);
+ncclResult_t ncclP2pIpcDeregBuffer(struct ncclReg* reg);
+ncclResult_t ncclP2pIpcCleanup(struct ncclComm* comm);
 
 #endif
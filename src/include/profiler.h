@@ -31,7 +31,48 @@ enum ncclProxyProfileState {
   ncclProxyProfileAppendEnd = 25
 };
 
-ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state);
+// Built-in proxy timeline (PROFILE_PROXY builds), written out by ncclProfilingDump
+ncclResult_t ncclProfilingTimelineRecord(struct ncclProxyArgs* args, int sub, int step, int state);
 void ncclProfilingDump();
+// Collect device timeline events (ENABLE_DEVICE_PROFILE builds only). Each comm
+// with device rings attaches, and the timeline is dumped after the last detach.
+void ncclProfilingDeviceAttach();
+void ncclProfilingDeviceDetach();
+ncclResult_t ncclProfilingDeviceDrain(struct ncclComm* comm);
+
+
+// Profiler plugin (ncclProfiler_v2, or v1 without operation tags). Loaded once
+// per process, refcounted like the tuner.
+ncclResult_t ncclProfilerPluginLoad(ncclProfiler_t** profiler);
+ncclResult_t ncclProfilerPluginUnload(ncclProfiler_t** profiler);
+
+// CUPTI external correlation of the kernels launched by the calling thread
+// between push and pop with an operation tag (NCCL_CUPTI_CORRELATION=1).
+// No-ops if disabled or libcupti cannot be loaded.
+void ncclProfilingCorrelationPush(uint64_t opTag);
+void ncclProfilingCorrelationPop(uint64_t opTag);
+
+// Per-operation events are only recorded for operations sampled at enqueue time
+// (NCCL_PROFILE_SAMPLE), proxy sleep/idle/append states always are.
+static inline ncclResult_t ncclProfilingRecord(struct ncclProxyState* proxyState, struct ncclProxyArgs* args, int sub, int step, int state) {
+  if (state < ncclProxyProfileSleep && !args->subs[sub].profile) return ncclSuccess;
+#ifdef PROFILE_PROXY
+  NCCLCHECK(ncclProfilingTimelineRecord(args, sub, step, state));
+#endif
+  ncclProfiler_t* profiler = proxyState->profiler;
+  if (profiler && profiler->proxyOpState && state < ncclProxyProfileSleep) {
+    profiler->proxyOpState(proxyState->profilerContext, args->opCount, args->subs[sub].channelId,
+        args->subs[sub].peer, args->pattern == ncclPatternSend, step, state, args->subs[sub].opTag);
+  }
+  return ncclSuccess;
+}
+
+static inline void ncclProfilingNetComplete(struct ncclProxyState* proxyState, struct ncclProxyArgs* args, int sub, int step, size_t size) {
+  ncclProfiler_t* profiler = proxyState->profiler;
+  if (profiler && profiler->netComplete && args->subs[sub].profile) {
+    profiler->netComplete(proxyState->profilerContext, args->opCount, args->subs[sub].channelId,
+        args->subs[sub].peer, args->pattern == ncclPatternSend, step, size, args->subs[sub].opTag);
+  }
+}
 
 #endif
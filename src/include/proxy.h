@@ -12,9 +12,12 @@
 #include "socket.h"
 #include "ipcsocket.h"
 #include "nccl_net.h"
+#include "nccl_profiler.h"
 #include <pthread.h>
 #include "shm.h"
 #include "p2p.h"
+#include "stats.h"
+#include "memstats.h"
 
 enum ncclProxyOpState { ncclProxyOpNone, ncclProxyOpReady, ncclProxyOpProgress };
 
@@ -29,6 +32,13 @@ union ncclProxyOpSpecifics {
     size_t sizePerRank;
     int nNodes, node;
   } collnetDirect;
+  // Ring AllGather from a registered output buffer. Ring connections are not
+  // shared, so each ncclProxyArgs carries a single sub and its channel layout.
+  struct {
+    int* userRanks; // NULL when not using the registered buffer
+    int nRanks;
+    size_t rankCount, workOffset, workCount, chunkCount; // in elements
+  } ringReg;
 };
 
 struct ncclProxyOp {
@@ -48,6 +58,12 @@ struct ncclProxyOp {
   uint8_t /*ncclPattern_t*/ pattern;
   uint8_t protocol;
   uint8_t reg;
+  uint8_t regHost; // registered buffer is pinned host memory
+  uint8_t profile; // sampled for profiling, see NCCL_PROFILE_SAMPLE
+  uint64_t opTag; // user tag of the plan, see ncclGroupSetOpTag
+  uint8_t priority; // 1 for latency-critical ops, progressed ahead of bulk ones
+  // Number of CollNet network operations kept in flight
+  uint8_t collnetDepth;
   // collnet buffer reg handles
   void* sendMhandle;
   void* recvMhandle;
@@ -59,9 +75,28 @@ struct ncclProxyOp {
   struct ncclProxyOp *enqNext;
 };
 
-struct ncclProxySubArgs {
+// Progress functions go through all subs on every pass, so fields are laid
+// out by how often they are read: step counters first, in their own cache
+// line, then what progress reads once per sub, then per step requests, and
+// fields only used with profiling or grouped receives last.
+struct alignas(64) ncclProxySubArgs {
+  uint64_t base;
+  uint64_t posted;
+  uint64_t received;
+  uint64_t flushed;
+  uint64_t transmitted;
+  uint64_t done;
+  uint64_t end;
+  int nsteps;
+  int groupSize; // Number of consecutive sub operations sharing the same recvComm
+
   struct ncclProxyConnection* connection;
+  int channelId;
+  int peer;
   int reg;
+  int regHost;
+  size_t offset;
+  ssize_t nbytes;
   // p2p mhandle
   void* mhandle;
   // collnet handles
@@ -69,25 +104,16 @@ struct ncclProxySubArgs {
   void* recvMhandle;
   uint8_t* sendbuff;
   uint8_t* recvbuff;
-  size_t offset;
-  int channelId;
-  int nsteps;
-  ssize_t nbytes;
-  int peer;
 
-  int groupSize; // Number of consecutive sub operations sharing the same recvComm
-  uint64_t base;
-  uint64_t posted;
-  uint64_t received;
-  uint64_t flushed;
-  uint64_t transmitted;
-  uint64_t done;
-  uint64_t end;
-  void* requests[NCCL_STEPS];
-  void* profilingEvents[NCCL_STEPS];
-  void* recvRequestsCache[NCCL_STEPS];
+  void* requests[NCCL_MAX_STEPS];
+
+  int profile;
+  uint64_t opTag;
+  void* profilingEvents[NCCL_MAX_STEPS];
+  void* recvRequestsCache[NCCL_MAX_STEPS];
   int recvRequestsSubCount;
 };
+static_assert(offsetof(struct ncclProxySubArgs, connection) == 64, "Proxy sub step counters must fill one cache line");
 
 struct ncclProxyArgs {
   struct ncclProxySubArgs subs[NCCL_PROXY_MAX_SUBS];
@@ -98,6 +124,7 @@ struct ncclProxyArgs {
   int sliceSteps;
   int chunkSteps;
   int chunkSize;
+  int collnetDepth;
   size_t totalSendSize;
   size_t totalRecvSize;
   size_t sendSizePerRound;
@@ -107,11 +134,13 @@ struct ncclProxyArgs {
   uint8_t /*ncclPattern_t*/ pattern;
   uint8_t /*ncclFunc_t*/ coll;
   uint8_t protocol;
+  uint8_t priority;
   int state;
   char* sharedBuff[NCCL_STEPS];
   int sharedSize[NCCL_STEPS];
 
   int idle;
+  uint64_t nvtxRange; // NVTX range of the operation, from its first progress call until it is done
 
   // Element linking
   struct ncclProxyArgs* next;
@@ -127,13 +156,31 @@ struct ncclProxyArgs {
 // Otherwise we'd be unable to post half of them to free new elements.
 #define MAX_OPS_PER_PEER (2*MAXCHANNELS*NCCL_MAX_WORK_ELEMENTS_P2P)
 
+// Chains of ops posted by one local rank to the progress thread. Each rank
+// only posts ops of its own MAX_OPS_PER_PEER range, so the ring can't hold
+// more chains than that.
+struct ncclProxyPostRing {
+  alignas(64) volatile uint64_t tail; // written by the posting rank
+  alignas(64) volatile uint64_t head; // written by the progress thread
+  struct {
+    int nextOps;
+    int nextOpsEnd;
+  } chains[MAX_OPS_PER_PEER];
+};
+
 struct ncclProxyOpsPool {
   struct ncclProxyOp ops[MAX_OPS_PER_PEER*NCCL_MAX_LOCAL_RANKS];
-  volatile int nextOps;
-  volatile int nextOpsEnd;
+  struct ncclProxyPostRing posted[NCCL_MAX_LOCAL_RANKS];
   volatile int freeOps[NCCL_MAX_LOCAL_RANKS];
+  // Only used to wake the progress thread when it blocks with nothing to progress
   pthread_mutex_t mutex;
   pthread_cond_t cond;
+  volatile int waiting;
+  // Adaptive sleep (NCCL_PROXY_SLEEP_IDLE): the progress thread may wait on an eventfd
+  // instead of cond. Only ranks of the proxy process (pid) can write to it.
+  volatile int sleeping;
+  int pid;
+  int wakeFd;
 };
 
 struct ncclProxyOps {
@@ -153,6 +200,11 @@ struct ncclProxySharedP2p {
   // CUDA IPC
   ncclIpcDesc ipcDesc;
   struct ncclProxyArgs* proxyAppend[MAXCHANNELS]; // Separate send and recv
+  // Chunks handed out dynamically (NCCL_NET_SHARED_CREDITS), NULL when
+  // statically split. Only used by the progress thread.
+  int* freeChunks;
+  int nFreeChunks;
+  int nActiveSubs;
 };
 
 struct ncclProxyPeer {
@@ -182,9 +234,33 @@ struct ncclProxyProgressState {
   struct ncclProxyArgs* pool;
   struct ncclProxyPool* pools;
   int nextOps;
+  int wakeFd; // -1 unless NCCL_PROXY_SLEEP_IDLE is set
+
+  // Additional progress threads (NCCL_PROXY_NTHREADS > 1). This thread keeps
+  // shard 0 and hands the ops of other shards over to their threads.
+  int nShards;
+  struct ncclProxyProgressShard* shards;
+};
+
+#define NCCL_PROXY_SHARD_QUEUE_SIZE 512
+
+// Progress thread serving the network connections of a subset of the NICs.
+// Ops are passed from the main progress thread through a single producer,
+// single consumer queue.
+struct ncclProxyProgressShard {
+  struct ncclProxyProgressState state;
+  struct ncclProxyState* proxyState;
+  int index;
+  cpu_set_t affinity;
+  struct ncclProxyOp queue[NCCL_PROXY_SHARD_QUEUE_SIZE];
+  uint64_t head, tail;
+  int sleeping;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
 };
 
 // Expected proxy response fifo
+#define NCCL_PROXY_RESPONSE_BUCKETS 1024
 struct ncclExpectedProxyResponse {
   void*                             opId;
   int                               respSize;
@@ -201,6 +277,7 @@ struct ncclProxyAsyncOp {
   char *reqBuff, *respBuff;
   void* opId;
   ncclProxyAsyncOp* next;
+  ncclProxyAsyncOp* prev;
 };
 
 struct ncclProxyLocalPeer {
@@ -208,6 +285,7 @@ struct ncclProxyLocalPeer {
   int tpRank;
   int tpLocalRank;
   ncclProxyAsyncOp* asyncOps;
+  ncclProxyAsyncOp* asyncOpsTail;
   int asyncOpCounter;
 };
 
@@ -229,20 +307,35 @@ struct ncclIpcHdr {
   uint64_t data[16]; // 128-bytes
 };
 
+// Network priority of a communicator (ncclConfig_t trafficClass and
+// serviceLevel), -1 where NCCL_IB_TC and NCCL_IB_SL apply. Same for the
+// socket tuning (ncclConfig_t socket*), -1 where NCCL_SOCKET_* apply.
+struct ncclNetQos {
+  int trafficClass;
+  int serviceLevel;
+  int socketBusyPoll;
+  int socketPacingRate;
+  int socketBuffSize;
+};
+
 struct ncclProxyState {
   int refCount;
   int tpRank;
   int tpnRanks;
   int tpLocalnRanks;
   int cudaDev;
+  int numaId; // NUMA node close to our GPU, for host buffers
+  cpu_set_t affinity; // dedicated cores of the proxy threads, see NCCL_PROXY_CPU_CORES
   int p2pnChannels;
   int p2pChunkSize;
   int nChannels;
   int buffSizes[NCCL_NUM_PROTOCOLS];
   bool allocP2pNetLLBuffers;
   bool dmaBufSupport;
+  struct p2pSlab* p2pSlabs; // see NCCL_P2P_SLAB_SIZE in p2p.cc
   ncclNet_t* ncclNet;
   ncclCollNet_t* ncclCollNet;
+  struct ncclNetQos netQos; // from the config of the comm owning the proxy
   volatile uint32_t* abortFlag;
   // Service threads
   pthread_t thread;
@@ -263,9 +356,17 @@ struct ncclProxyState {
 
   // Progress thread
   struct ncclProxyProgressState progressState;
+  struct ncclProxyStats stats;
+  // Memory allocated by the proxy thread, by proxy (top parent) rank
+  struct ncclMemStats memStats;
 
   // Queue of expected responses from the proxy
-  struct ncclExpectedProxyResponse* expectedResponses;
+  // Hashed by opId, large communicators have thousands of calls in flight during setup
+  struct ncclExpectedProxyResponse* expectedResponses[NCCL_PROXY_RESPONSE_BUCKETS];
+
+  // Profiler plugin, NULL if none is loaded
+  ncclProfiler_t* profiler;
+  void* profilerContext;
 };
 
 enum proxyConnectState {
@@ -280,6 +381,7 @@ enum proxyConnectState {
 struct ncclProxyConnection {
   int send, transport, shared;
   int tpLocalRank, sameProcess;
+  int peer; // top parent rank reached, -1 if unknown
   struct ncclSocket* sock;
   struct ncclTransportComm* tcomm;
   struct ncclProxyArgs *proxyAppend;
@@ -290,6 +392,7 @@ struct ncclProxyConnection {
   proxyConnectState state;
   struct ncclCollNetSharedRes* collNet;
   int needsProxyProgress;
+  int progressShard;
 };
 
 typedef ncclResult_t (*threadFunc_t)(struct ncclProxyArgs*);
@@ -304,6 +407,7 @@ ncclResult_t ncclProxySaveOp(struct ncclComm* comm, struct ncclProxyOp* proxyOp,
 ncclResult_t ncclProxyComputeP2p(struct ncclInfo* info, struct ncclProxyOp* proxyOp, int reg);
 ncclResult_t ncclProxyStart(struct ncclComm* comm);
 ncclResult_t ncclProxyInit(struct ncclComm* comm, struct ncclSocket* sock, union ncclSocketAddress* peerAddresses, uint64_t *peerAddressesUDS);
+ncclResult_t ncclProxyCpuSelect(struct ncclComm* comm, cpu_set_t* allowed);
 ncclResult_t ncclProxyCreate(struct ncclComm* comm);
 ncclResult_t ncclProxyConnect(struct ncclComm* comm, int transport, int send, int proxyRank, struct ncclProxyConnector* proxyConn);
 enum ncclProxyMsgType {
@@ -317,7 +421,8 @@ enum ncclProxyMsgType {
   ncclProxyMsgStop = 8,
   ncclProxyMsgGetFd = 9, // cuMem API support (UDS)
   ncclProxyMsgRegister = 10,
-  ncclProxyMsgDeregister = 11
+  ncclProxyMsgDeregister = 11,
+  ncclProxyMsgFree = 12 // release the resources of one connection (ncclCommShrink)
 };
 
 // This function is called by a client of the proxy that needs to invoke any of the non-progress proxyOp types
@@ -331,8 +436,11 @@ ncclResult_t ncclPollProxyResponse(struct ncclComm* comm, struct ncclProxyConnec
 
 // UDS support
 ncclResult_t ncclProxyClientGetFdBlocking(struct ncclComm* comm, int rank, void *handle, int* convertedFd);
+ncclResult_t ncclProxyClientGetFdsBlocking(struct ncclComm* comm, int rank, uint64_t* handles, int n, int* convertedFds);
 
 ncclResult_t ncclProxyStop(struct ncclComm* comm);
 ncclResult_t ncclProxyShmUnlink(struct ncclComm* comm);
+// Progress thread (shard) handling network connections of netDev
+int ncclProxyProgressShardForNet(struct ncclProxyState* proxyState, int netDev);
 ncclResult_t ncclProxyDestroy(struct ncclComm* comm);
 #endif
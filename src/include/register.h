@@ -6,7 +6,10 @@ enum {
   NVLS_REG_COMPLETE = 0x02,
   NVLS_REG_POSSIBLE = 0x04,
   NVLS_REG_NO_SUPPORT = 0x08,
-  COLLNET_REG_COMPLETE = 0x10
+  COLLNET_REG_COMPLETE = 0x10,
+  NET_REG_EVICTED = 0x20,
+  IPC_REG_COMPLETE = 0x40,
+  IPC_REG_NO_SUPPORT = 0x80
 };
 
 struct ncclReg {
@@ -15,10 +18,13 @@ struct ncclReg {
   int refs;
   uintptr_t addr;
   uint32_t state;
+  uint64_t lastUsed; // for LRU eviction of the network registration
+  uint64_t allocId;  // ncclMemAlloc allocation registered automatically, 0 for ncclCommRegister
   // net reg
   int nDevs;
   int devs[MAXCHANNELS];
   void** handles;
+  int netPtrType; // NCCL_PTR_HOST for cudaHostRegister'ed or cudaMallocHost memory
   // nvls reg
   uintptr_t baseAddr;
   size_t baseSize;
@@ -30,12 +36,17 @@ struct ncclReg {
   // collnet reg
   void* collnetHandle;
   struct ncclProxyConnector* proxyconn;
+  // p2p ipc reg
+  struct ncclP2pIpcExport* ipcExport;
 };
 
 struct ncclRegCache {
-  struct ncclReg **slots;
+  struct ncclReg **slots; // sorted by addr
   int capacity, population;
   uintptr_t pageSize;
+  size_t maxPages;     // largest registration, bounds lookups
+  size_t netRegBytes;  // bytes registered with the network
+  uint64_t clock;
   void* sComms[MAXCHANNELS];
   void* rComms[MAXCHANNELS];
 };
@@ -43,4 +54,9 @@ struct ncclRegCache {
 ncclResult_t ncclRegCleanup(struct ncclComm* comm);
 ncclResult_t ncclRegFind(struct ncclComm* comm, const void* data, size_t size, struct ncclReg** reg);
 
+// Keep track of ncclMemAlloc buffers for automatic registration. With
+// autoRegister, the buffer is registered even without NCCL_LOCAL_REGISTER_AUTO.
+ncclResult_t ncclRegTrackMemAlloc(void* ptr, size_t size, bool autoRegister = false);
+ncclResult_t ncclRegUntrackMemAlloc(void* ptr);
+
 #endif
@@ -14,6 +14,11 @@ ncclResult_t ncclShmOpen(char* shmPath, size_t shmSize, void** shmPtr, void** de
 ncclResult_t ncclShmClose(ncclShmHandle_t handle);
 ncclResult_t ncclShmUnlink(ncclShmHandle_t handle);
 
+// Pinned and mapped host memory, optionally backed by huge pages and placed on
+// a given NUMA node (-1 for no preference). Zeroed like ncclCudaHostCalloc.
+ncclResult_t ncclHostMemAlloc(void** ptr, size_t size, int numaId);
+ncclResult_t ncclHostMemFree(void* ptr, size_t size);
+
 struct ncclShmemCollBuff {
   volatile size_t *cnt[2];
   volatile void *ptr[2];
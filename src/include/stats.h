@@ -0,0 +1,73 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_STATS_H_
+#define NCCL_STATS_H_
+
+#include "nccl.h"
+#include "nccl_common.h"
+#include <stdint.h>
+
+// Counters behind ncclCommGetStats. They are bumped with relaxed atomics on
+// the hot paths and only need to be eventually consistent when read.
+
+#define NCCL_STATS_TRANSPORT_NVLS 4 // after the NTRANSPORTS transports
+
+static_assert(NCCL_STATS_NUM_FUNCS == ncclNumFuncs, "ncclCommStats_t must count every ncclFunc_t");
+static_assert(NCCL_INIT_NUM_PHASES == 11, "ncclCommInitStats_t must time every ncclInitPhase");
+
+// Updated by the user thread
+struct ncclStats {
+  uint64_t funcOps[NCCL_STATS_NUM_FUNCS];
+  uint64_t funcBytes[NCCL_STATS_NUM_FUNCS];
+  uint64_t transportBytes[NCCL_STATS_NUM_TRANSPORTS];
+  uint64_t workFifoStalls;
+  uint64_t workFifoStallNs;
+  uint64_t enqueueCalls;
+  uint64_t enqueueNs;
+  uint64_t arrivalsMeasured;
+  uint64_t arrivalsLast;
+  uint64_t arrivalSkew[NCCL_STATS_SKEW_BUCKETS];
+};
+
+// Updated by the proxy progress threads, shared by comms sharing the proxy
+struct ncclProxyStats {
+  uint64_t netSendBytes[NCCL_STATS_MAX_NET_DEVS];
+  uint64_t netRecvBytes[NCCL_STATS_MAX_NET_DEVS];
+  uint64_t activeNs;
+  uint64_t idleNs;
+};
+
+enum ncclInitPhase {
+  ncclInitPhaseBootstrap = 0,
+  ncclInitPhaseTopo = 1,
+  ncclInitPhaseSearch = 2,
+  ncclInitPhaseGraph = 3,
+  ncclInitPhaseProxy = 4,
+  ncclInitPhaseConnect = 5,
+  ncclInitPhaseNvls = 6,
+  ncclInitPhaseCollNet = 7,
+  ncclInitPhaseDevComm = 8,
+  ncclInitPhaseOther = 9,
+  ncclInitPhaseTotal = 10
+};
+
+// Behind ncclCommGetInitStats. Each phase ends where the next one starts, so
+// the phases add up to the total.
+struct ncclInitStats {
+  uint64_t start; // end of the previous phase
+  ncclCommInitStats_t times;
+};
+
+static inline void ncclStatsAdd(uint64_t* counter, uint64_t value) {
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void ncclStatsAddNet(uint64_t* counters, int netDev, uint64_t bytes) {
+  if (netDev >= 0 && netDev < NCCL_STATS_MAX_NET_DEVS) ncclStatsAdd(counters+netDev, bytes);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_STRAGGLER_H_
+#define NCCL_STRAGGLER_H_
+
+#include "nccl.h"
+#include <stdint.h>
+
+// Straggler detection (NCCL_STRAGGLER=1). Every non-captured plan made only of
+// collectives gets a slot in ncclDevComm::arrivals, where its kernel stores the
+// %globaltimer value at start. All ranks build the same sequence of such
+// plans, so every NCCL_STRAGGLER_INTERVAL plans they allgather their stamps
+// and each rank adds how late it arrived, relative to the first rank, to the
+// histogram of ncclCommGetStats. Ranks on different nodes are compared through
+// their GPU clocks, which are only as close as the host clocks they follow.
+
+struct ncclStraggler {
+  uint64_t* arrivals; // cudaHost memory, NCCL_ARRIVAL_SLOTS entries
+  uint64_t seq;       // plans given a slot so far
+  uint64_t syncedSeq; // plans whose stamps were exchanged
+  int interval;
+  bool syncPending;
+};
+
+struct ncclComm;
+struct ncclKernelPlan;
+
+// Allocate comm->straggler if NCCL_STRAGGLER is set. Called before the device
+// comm is set up.
+ncclResult_t ncclStragglerInit(struct ncclComm* comm);
+ncclResult_t ncclStragglerFree(struct ncclComm* comm);
+
+// Value for ncclDevWorkFirst::arrival of a plan about to be launched.
+uint32_t ncclStragglerPlanArrival(struct ncclComm* comm, struct ncclKernelPlan* plan);
+
+// Exchange stamps if requested. Collective across the communicator, must not
+// run on a thread driving other ranks.
+ncclResult_t ncclStragglerSync(struct ncclComm* comm);
+
+#endif
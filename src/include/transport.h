@@ -45,6 +45,7 @@ struct ncclPeerInfo {
   int cudaCompCap;
   // MNNVL support
   nvmlGpuFabricInfoV_t fabricInfo;
+  int gpuShareProcs;
 };
 
 #define CONNECT_SIZE 128
@@ -97,6 +98,8 @@ struct ncclTransportComm {
   ncclResult_t (*proxyProgress)(struct ncclProxyState* proxyState, struct ncclProxyArgs*);
   ncclResult_t (*proxyRegister)(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done);
   ncclResult_t (*proxyDeregister)(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, int* done);
+  // Completes a setup which returned ncclInProgress, returns ncclInProgress until done. NULL if setup is always blocking.
+  ncclResult_t (*setupDone)(struct ncclComm* comm, struct ncclConnect*, struct ncclConnector*);
 };
 
 struct ncclTransport {
@@ -108,12 +111,21 @@ struct ncclTransport {
 
 ncclResult_t ncclTransportP2pConnect(struct ncclComm* comm, int channelId, int nrecv, int* peerRecv, int nsend, int* peerSend, int connIndex);
 ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, int connIndex, int* highestTransportType=NULL);
+ncclResult_t ncclTransportRingConnect(struct ncclComm* comm, struct ncclTopoGraph* ringGraph);
+ncclResult_t ncclTransportTreeConnect(struct ncclComm* comm, struct ncclTopoGraph* treeGraph);
+ncclResult_t ncclTransportHierConnect(struct ncclComm* comm);
+ncclResult_t ncclTransportRecDblConnect(struct ncclComm* comm);
+ncclResult_t ncclTransportP2pRelease(struct ncclComm* comm, int connIndex);
 
 ncclResult_t ncclNvlsInit(struct ncclComm* comm);
 ncclResult_t ncclNvlsSetup(struct ncclComm* comm, struct ncclComm* parent);
+ncclResult_t ncclNvlsConnect(struct ncclComm* comm);
 ncclResult_t ncclNvlsGraphRegisterBuffer(struct ncclComm *comm, struct ncclKernelPlan *plan, const void *sendbuff, void *recvbuff, size_t sendbuffSize, size_t recvbuffSize, bool *outRegBufUsed, void **outRegBufSend, void **outRegBufRecv);
 ncclResult_t ncclNvlsLocalRegisterBuffer(struct ncclComm *comm, const void *sendbuff, void *recvbuff, size_t sendbuffSize, size_t recvbuffSize, bool *outRegBufUsed, void **outRegBufSend, void **outRegBufRecv);
 ncclResult_t ncclNvlsDeregBuffer(CUmemGenericAllocationHandle *mcHandler, CUdeviceptr ptr, int dev, size_t size);
+ncclResult_t ncclNvlsCachedRegisterBuffer(struct ncclComm *comm, struct ncclKernelPlan *plan, const void *sendbuff, void *recvbuff, size_t sendbuffSize, size_t recvbuffSize, bool *outRegBufUsed, void **outRegBufSend, void **outRegBufRecv);
+ncclResult_t ncclNvlsRegCacheRelease(struct ncclComm* comm, struct ncclNvlsRegEntry* entry);
+ncclResult_t ncclNvlsRegCacheFree(struct ncclComm* comm);
 ncclResult_t ncclNvlsFree(struct ncclComm* comm);
 
 enum { collNetRecv=0, collNetSend=1 };
@@ -19,4 +19,12 @@ ncclResult_t ncclTunerPluginLoad(ncclTuner_t** tuner);
 
 // Cleans up NCCL tuner plugin.
 ncclResult_t ncclTunerPluginUnload(ncclTuner_t** tuner);
+
+// Whether tuner is a v2 plugin behind the compat layer. Those choose directly,
+// so callers only need to time what ncclTunerV2GetCollInfo leaves open: the
+// protocols of a chosen algorithm, or the reverse. Choices left to NCCL come
+// back as NCCL_ALGO_UNDEF / NCCL_PROTO_UNDEF.
+bool ncclTunerIsV2(ncclTuner_t* tuner);
+ncclResult_t ncclTunerV2GetCollInfo(void* context, ncclFunc_t collType, size_t nBytes, int collNetSupport, int nvlsSupport,
+    int numPipeOps, int* algorithm, int* protocol, int* nChannels);
 #endif
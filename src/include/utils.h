@@ -399,6 +399,48 @@ void ncclIntruQueueFreeAll(ncclIntruQueue<T,next> *me, ncclMemoryPool *pool) {
   }
 }
 
+// Merges sorted lists a and b, b holding elements enqueued after those of a.
+// Elements of b go first unless cmp(a, b) > 0, like ncclIntruQueueSortEnqueue.
+template<typename T, T *T::*next>
+inline T* ncclIntruListMerge(T *a, T *b, int (*cmp)(T *a, T *b)) {
+  T *head = nullptr;
+  T **tail = &head;
+  while (a && b) {
+    if (cmp(a, b) > 0) { *tail = a; a = a->*next; }
+    else { *tail = b; b = b->*next; }
+    tail = &((*tail)->*next);
+  }
+  *tail = a ? a : b;
+  return head;
+}
+
+/* Sorts the queue in O(n log n) into the order ncclIntruQueueSortEnqueue would
+ * have given when enqueuing its elements one by one in queue order. */
+template<typename T, T *T::*next>
+inline void ncclIntruQueueSort(ncclIntruQueue<T,next> *me, int (*cmp)(T *a, T *b)) {
+  // bins[i] is a sorted list of 2^i elements or null; higher bins hold earlier elements
+  T *bins[64] = {};
+  T *x = me->head;
+  while (x != nullptr) {
+    T *carry = x;
+    x = x->*next;
+    carry->*next = nullptr;
+    int i = 0;
+    for (; bins[i] != nullptr; i++) {
+      carry = ncclIntruListMerge<T,next>(bins[i], carry, cmp);
+      bins[i] = nullptr;
+    }
+    bins[i] = carry;
+  }
+  T *head = nullptr;
+  for (int i = 0; i < 64; i++) {
+    if (bins[i] != nullptr) head = head ? ncclIntruListMerge<T,next>(bins[i], head, cmp) : bins[i];
+  }
+  me->head = head;
+  me->tail = head;
+  while (me->tail && me->tail->*next) me->tail = me->tail->*next;
+}
+
 /* cmp function determines the sequence of objects in the queue. If cmp returns value >= 0, it means a > b,
  * and we should put a before b; otherwise, b should be put ahead of a. */
 template<typename T, T *T::*next>
@@ -17,11 +17,17 @@
 #include "graph.h"
 #include "argcheck.h"
 #include "tuner.h"
+#include "profiler.h"
+#include "metrics.h"
+#include "gpushare.h"
+#include "mempool.h"
+#include "p2p.h"
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
 #include <dlfcn.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -37,12 +43,25 @@
 #endif
 
 const char* ncclFuncStr[NCCL_NUM_FUNCTIONS] = { "Broadcast", "Reduce", "AllGather", "ReduceScatter", "AllReduce" };
-const char* ncclAlgoStr[NCCL_NUM_ALGORITHMS] = { "Tree", "Ring", "CollNetDirect", "CollNetChain", "NVLS", "NVLSTree" };
+const char* ncclAlgoStr[NCCL_NUM_ALGORITHMS] = { "Tree", "Ring", "CollNetDirect", "CollNetChain", "NVLS", "NVLSTree", "Hier", "RingScatter", "RecDbl" };
 const char* ncclProtoStr[NCCL_NUM_PROTOCOLS] = { "LL", "LL128", "Simple" };
 
 NCCL_PARAM(GroupCudaStream, "GROUP_CUDA_STREAM", NCCL_GROUP_CUDA_STREAM);
 
 NCCL_PARAM(CheckPointers, "CHECK_POINTERS", 0);
+// Only allocate device state for the peers a rank is connected to
+NCCL_PARAM(SparsePeers, "SPARSE_PEERS", 0);
+// Gather init phase times across ranks and report their spread
+NCCL_PARAM(InitTiming, "INIT_TIMING", 0);
+
+static const char* initPhaseNames[NCCL_INIT_NUM_PHASES] = { "Bootstrap", "Topo", "Search", "Graph", "Proxy", "Connect", "NVLS", "CollNet", "DevComm", "Other", "Total" };
+
+// Charges the time since the end of the previous phase to phase
+static void initPhaseEnd(struct ncclComm* comm, int phase) {
+  uint64_t now = clockNano();
+  comm->initStats.times.ns[phase] += now - comm->initStats.start;
+  comm->initStats.start = now;
+}
 NCCL_PARAM(CommBlocking, "COMM_BLOCKING", NCCL_CONFIG_UNDEF_INT);
 
 static ncclResult_t commReclaim(ncclComm_t comm);
@@ -171,6 +190,18 @@ void ncclCommPushCudaGdrFree(struct ncclComm* comm, void* handle) {
   comm->destructorHead = dtor;
 }
 
+void ncclAbortFlagDevSet(volatile uint32_t* abortFlagDevHost) {
+  if (abortFlagDevHost == NULL) return;
+  *abortFlagDevHost = 1;
+  wc_store_fence();
+}
+
+void ncclChildAbortFlagSet(struct ncclComm* comm, volatile uint32_t* childAbortFlag) {
+  __atomic_store_n(childAbortFlag, 1, __ATOMIC_SEQ_CST);
+  // The child may not have published its device copy yet, it then sees the host flag
+  ncclAbortFlagDevSet(__atomic_load_n(&comm->childAbortFlagDevHost, __ATOMIC_SEQ_CST));
+}
+
 static ncclResult_t commFree(ncclComm_t comm) {
   /* commFree() should not involve any sync among ranks. */
   if (comm == NULL)
@@ -179,6 +210,7 @@ static ncclResult_t commFree(ncclComm_t comm) {
   /* in commReclaim, we have guaranteed only last rank which calls ncclCommDestroy() will
    * free all intra-process communicators; therefore, we only need to focus on local
    * resource cleanup in commFree(). */
+  NCCLCHECK(ncclKernelWarmupFree(comm));
   if (comm->proxyState && comm->proxyRefCountOld == 0 && comm->proxyState->thread) {
     pthread_join(comm->proxyState->thread, nullptr);
     if (comm->proxyState->threadUDS) {
@@ -188,9 +220,15 @@ static ncclResult_t commFree(ncclComm_t comm) {
   }
 
   delete[] comm->userRedOps;
+  if (comm->bruckDone) CUDACHECK(cudaEventDestroy(comm->bruckDone));
+  if (comm->a2aHierDone) CUDACHECK(cudaEventDestroy(comm->a2aHierDone));
+  if (comm->rootedTreeDone) CUDACHECK(cudaEventDestroy(comm->rootedTreeDone));
+  if (comm->bcastMultiDone) CUDACHECK(cudaEventDestroy(comm->bcastMultiDone));
 
   free(comm->connectSend);
   free(comm->connectRecv);
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) free(comm->collGraphs[a]);
+  for (int g=0; g<4; g++) free(comm->splitGraphs[g]);
 
   free(comm->peerInfo);
   if (comm->topo)
@@ -200,7 +238,9 @@ static ncclResult_t commFree(ncclComm_t comm) {
     free(comm->nodeRanks);
   }
   free(comm->rankToNode);
+  free(comm->p2pLocalChunkMin);
   free(comm->rankToLocalRank);
+  free(comm->suggestedRankOrder);
   free(comm->collNetHeads);
 
   if (comm->bootstrap)
@@ -214,6 +254,12 @@ static ncclResult_t commFree(ncclComm_t comm) {
       for (int c=0; c<MAXCHANNELS; c++) {
         if (comm->sharedRes->peers[c]) free(comm->sharedRes->peers[c]);
         if (comm->sharedRes->devPeers[c]) ncclCudaFree(comm->sharedRes->devPeers[c]);
+        if (comm->sharedRes->devPeerTable[c]) {
+          for (int r=0; r<comm->sharedRes->tpNRanks; r++) {
+            if (comm->sharedRes->devPeerTable[c][r]) ncclCudaFree(comm->sharedRes->devPeerTable[c][r]);
+          }
+          free(comm->sharedRes->devPeerTable[c]);
+        }
       }
       free(comm->sharedRes->tpRankToLocalRank);
       NCCLCHECK(ncclStrongStreamDestruct(&comm->sharedRes->hostStream));
@@ -223,7 +269,10 @@ static ncclResult_t commFree(ncclComm_t comm) {
     }
   }
 
-  if (comm->nvlsSupport) NCCLCHECK(ncclNvlsFree(comm));
+  if (comm->nvlsSupport) {
+    NCCLCHECK(ncclNvlsRegCacheFree(comm));
+    NCCLCHECK(ncclNvlsFree(comm));
+  }
 
   struct ncclDestructor* dtor = comm->destructorHead;
   while (dtor != nullptr) {
@@ -235,6 +284,7 @@ static ncclResult_t commFree(ncclComm_t comm) {
   ncclMemoryStackDestruct(&comm->memPermanent);
 
   if (ncclAtomicRefCountDecrement(comm->abortFlagRefCount) == 0) {
+    if (comm->abortFlagDevGdrHandle) NCCLCHECK(ncclGdrCudaFree(comm->abortFlagDevGdrHandle));
     NCCLCHECK(ncclCudaHostFree((void *)comm->abortFlag));
     free(comm->abortFlagRefCount);
   }
@@ -243,8 +293,11 @@ static ncclResult_t commFree(ncclComm_t comm) {
   free(comm->topParentRanks);
   free(comm->topParentLocalRanks);
 
+  NCCLCHECK(ncclP2pIpcCleanup(comm));
   NCCLCHECK(ncclRegCleanup(comm));
 
+  ncclMemStatsFree(&comm->memStats);
+  pthread_mutex_destroy(&comm->enqueueLock);
   commPoison(comm); // poison comm before free to avoid comm reuse.
   free(comm);
 
@@ -254,7 +307,19 @@ static ncclResult_t commFree(ncclComm_t comm) {
 NCCL_PARAM(DisableGraphHelper, "GRAPH_HELPER_DISABLE", 0);
 // GDRCOPY support: FIFO_ENABLE when enabled locates a workFifo in CUDA memory
 NCCL_PARAM(GdrCopyFifoEnable, "GDRCOPY_FIFO_ENABLE", 1);
+// Kernels poll a copy of the abort flag in CUDA memory rather than the cudaHost one
+// across PCIe. The host raises it through GDRCOPY, so this requires NCCL_GDRCOPY_ENABLE.
+NCCL_PARAM(AbortFlagDevice, "ABORT_FLAG_DEVICE", 0);
 NCCL_PARAM(WorkFifoDepth, "WORK_FIFO_DEPTH", 64<<10);
+// Without GDRCOPY, place the workFifo in CUDA memory when the CPU can store to
+// it directly (ATS over NVLink-C2C), so kernels fetch work from local memory.
+NCCL_PARAM(WorkFifoDevice, "WORK_FIFO_DEVICE", 0);
+NCCL_PARAM(SimpleBulkCopy, "SIMPLE_BULK_COPY", 0);
+NCCL_PARAM(Ll128WarpSpecialize, "LL128_WARP_SPECIALIZE", 0);
+NCCL_PARAM(CGASharedAbort, "CGA_SHARED_ABORT", 0);
+NCCL_PARAM(Pdl, "PDL", 0);
+NCCL_PARAM(CommThreadSafe, "COMM_THREAD_SAFE", 0);
+NCCL_PARAM(OpHandles, "OP_HANDLES", 0);
 enum ncclLaunchMode ncclParamLaunchMode;
 
 NCCL_PARAM(DmaBufEnable, "DMABUF_ENABLE", 1);
@@ -302,7 +367,11 @@ exit:
   return ret;
 }
 
+static void commTeardownWait();
+
 static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, int ndev, int rank) {
+  // Let asynchronous teardowns give their resources back first
+  commTeardownWait();
   if (ndev < 1) {
     WARN("invalid device count (%d) requested", ndev);
     return ncclInvalidArgument;
@@ -317,6 +386,14 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
   comm->destructorHead = nullptr;
   comm->rank = rank;
   comm->nRanks = ndev;
+  comm->forceAlgorithm = NCCL_ALGO_UNDEF;
+  comm->forceProtocol = NCCL_PROTO_UNDEF;
+  NCCLCHECK(ncclMemStatsInit(&comm->memStats, ndev));
+  pthread_mutex_init(&comm->enqueueLock, NULL);
+  // A nonblocking group launches asynchronously, after the staged tasks'
+  // locks would have been released.
+  comm->threadSafe = ncclParamCommThreadSafe() && comm->config.blocking;
+  if (ncclParamCommThreadSafe() && !comm->config.blocking) INFO(NCCL_INIT, "NCCL_COMM_THREAD_SAFE ignored for nonblocking communicator");
 
   NCCLCHECK(ncclNetInit(comm));
   INFO(NCCL_INIT, "Using network %s", comm->ncclNet->name);
@@ -370,6 +447,9 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
     /* most of attributes are assigned later in initTransportsRank(). */
     sharedRes->owner = comm;
     sharedRes->tpNRanks = comm->nRanks;
+    // Children splitting with splitShare would reuse connections without
+    // updating their own device peers, so they keep dense ones.
+    sharedRes->sparsePeers = ncclParamSparsePeers() && !comm->config.splitShare;
     NCCLCHECK(ncclCalloc(&sharedRes->tpRankToLocalRank, comm->nRanks));
     NCCLCHECK(ncclStrongStreamConstruct(&sharedRes->deviceStream));
     NCCLCHECK(ncclStrongStreamConstruct(&sharedRes->hostStream));
@@ -392,6 +472,9 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
   return ncclSuccess;
 }
 
+int64_t ncclParamFusionThreshold();
+int64_t ncclParamFusionBuffSize();
+
 static ncclResult_t devCommSetup(ncclComm_t comm) {
   ncclResult_t ret = ncclSuccess;
   int nRanks = comm->nRanks;
@@ -399,46 +482,125 @@ static ncclResult_t devCommSetup(ncclComm_t comm) {
   struct ncclDevCommAndChannels *devCommAndChans = NULL;
 
   NCCLCHECKGOTO(ncclStrongStreamAcquireUncaptured(&comm->sharedRes->deviceStream), ret, fail);
-  NCCLCHECKGOTO(ncclCudaCallocAsync(&devCommAndChans, 1, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+  { ncclMemScope memScope(&comm->memStats, ncclMemDevComm);
+    NCCLCHECKGOTO(ncclCudaCallocAsync(&devCommAndChans, 1, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+  }
   ncclCommPushCudaFree(comm, devCommAndChans);
   comm->devComm = &devCommAndChans->comm;
   tmpCommAndChans.comm.rank = comm->rank;
   tmpCommAndChans.comm.nRanks = nRanks;
   tmpCommAndChans.comm.node = comm->node;
   tmpCommAndChans.comm.nNodes = comm->nNodes;
-  tmpCommAndChans.comm.abortFlag = comm->abortFlag;
+  if (comm->abortFlagDev == NULL && ncclParamAbortFlagDevice()) {
+    if (ncclGdrCopy != NULL) {
+      uint32_t *abortFlagDevHost, *abortFlagDev;
+      NCCLCHECKGOTO(ncclGdrCudaCalloc(&abortFlagDevHost, &abortFlagDev, 1, &comm->abortFlagDevGdrHandle), ret, fail);
+      comm->abortFlagDevHost = abortFlagDevHost;
+      comm->abortFlagDev = abortFlagDev;
+      // Abort may have been requested while we were initializing
+      if (__atomic_load_n(comm->abortFlag, __ATOMIC_RELAXED)) ncclAbortFlagDevSet(comm->abortFlagDevHost);
+    } else {
+      INFO(NCCL_INIT, "NCCL_ABORT_FLAG_DEVICE ignored, GDRCOPY is not enabled");
+    }
+  }
+  tmpCommAndChans.comm.abortFlag = comm->abortFlagDev ? comm->abortFlagDev : comm->abortFlag;
   for (int p=0; p < NCCL_NUM_PROTOCOLS; p++) {
     tmpCommAndChans.comm.buffSizes[p] = comm->buffSizes[p];
   }
   tmpCommAndChans.comm.p2pChunkSize = comm->p2pChunkSize;
   tmpCommAndChans.comm.channels = &devCommAndChans->channels[0];
+  tmpCommAndChans.comm.simpleBulkCopy = ncclParamSimpleBulkCopy() && comm->compCap >= 90;
+  tmpCommAndChans.comm.ll128WarpSpecialize = ncclParamLl128WarpSpecialize();
+  tmpCommAndChans.comm.clusterAbortShared = ncclParamCGASharedAbort() && comm->compCap == 90 && comm->config.cgaClusterSize > 1;
+  comm->programmaticLaunch = ncclParamPdl() && comm->compCap >= 90;
+  tmpCommAndChans.comm.programmaticLaunch = comm->programmaticLaunch;
 
   comm->workFifoDepth = ncclParamWorkFifoDepth();
   if (0 != (comm->workFifoDepth & (comm->workFifoDepth-1))) {
     WARN("NCCL_WORK_FIFO_DEPTH=%d is being ignored because it is not a power of 2.", comm->workFifoDepth);
     comm->workFifoDepth = 64<<10;
   }
+  if (comm->workFifoDepth < MAXCHANNELS) {
+    WARN("NCCL_WORK_FIFO_DEPTH=%d is being ignored because it is smaller than %d.", comm->workFifoDepth, MAXCHANNELS);
+    comm->workFifoDepth = 64<<10;
+  }
+  // Rings only go to the channels this comm can use, so that each one keeps
+  // its depth whatever MAXCHANNELS is. P2p channels are rounded up to a power
+  // of two and may go past nChannels.
+  int fifoChannels = 1;
+  while (fifoChannels < std::max(std::max(comm->nChannels, comm->p2pnChannels), comm->nvlsChannels)) fifoChannels *= 2;
+  comm->workFifoChannelDepth = comm->workFifoDepth/fifoChannels;
   tmpCommAndChans.comm.workFifoDepth = comm->workFifoDepth;
 
+  comm->workFifoHeapDevice = 0;
+  if (ncclGdrCopy == NULL && ncclParamWorkFifoDevice() == 1) {
+    int hostPageTables = 0;
+    CUDACHECKGOTO(cudaDeviceGetAttribute(&hostPageTables, cudaDevAttrPageableMemoryAccessUsesHostPageTables, comm->cudaDev), ret, fail);
+    comm->workFifoHeapDevice = hostPageTables;
+    if (!hostPageTables) INFO(NCCL_INIT, "NCCL_WORK_FIFO_DEVICE ignored, CPU cannot access CUDA memory directly");
+  }
   if (ncclGdrCopy != NULL && ncclParamGdrCopyFifoEnable() == 1) {
     // The workFifoHeap lives in GDR mapped CUDA memory.
     NCCLCHECKGOTO(ncclGdrCudaCalloc(&comm->workFifoHeap, &comm->devWorkFifoHeap, comm->workFifoDepth, &comm->workFifoHeapGdrHandle), ret, fail);
     ncclCommPushCudaGdrFree(comm, comm->workFifoHeapGdrHandle);
+  } else if (comm->workFifoHeapDevice) {
+    // The workFifoHeap lives in CUDA memory, written by the CPU through ATS.
+    comm->workFifoHeapGdrHandle = nullptr;
+    ncclMemScope memScope(&comm->memStats, ncclMemWorkFifo);
+    NCCLCHECKGOTO(ncclCudaCalloc(&comm->workFifoHeap, comm->workFifoDepth), ret, fail);
+    ncclCommPushCudaFree(comm, comm->workFifoHeap);
+    comm->devWorkFifoHeap = comm->workFifoHeap;
   } else {
     // The workFifoHeap lives in cudaHost memory.
     comm->workFifoHeapGdrHandle = nullptr;
+    ncclMemScope memScope(&comm->memStats, ncclMemWorkFifo);
     NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->workFifoHeap, comm->workFifoDepth), ret, fail);
     ncclCommPushCudaHostFree(comm, comm->workFifoHeap);
     comm->devWorkFifoHeap = comm->workFifoHeap;
   }
   tmpCommAndChans.comm.workFifoHeap = comm->devWorkFifoHeap;
 
-  NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->workFifoDone, MAXCHANNELS), ret, fail);
+  if (ncclParamFusionThreshold() > 0 && ncclParamFusionBuffSize() > 0) {
+    char* fusionBuff;
+    comm->fusionBuffSize = ncclParamFusionBuffSize();
+    ncclMemScope memScope(&comm->memStats, ncclMemOther);
+    NCCLCHECKGOTO(ncclCudaCallocAsync(&fusionBuff, comm->fusionBuffSize, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+    ncclCommPushCudaFree(comm, fusionBuff);
+    comm->fusionBuff = fusionBuff;
+  }
+
+#ifdef ENABLE_DEVICE_PROFILE
+  if (ncclGetEnv("NCCL_PROXY_PROFILE")) {
+    ncclMemScope memScope(&comm->memStats, ncclMemOther);
+    NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->devProfileEvents, MAXCHANNELS*NCCL_DEV_PROFILE_RING_SIZE), ret, fail);
+    ncclCommPushCudaHostFree(comm, comm->devProfileEvents);
+    ncclProfilingDeviceAttach();
+    NCCLCHECKGOTO(ncclCudaCallocAsync(&comm->devProfileHeads, MAXCHANNELS, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+    ncclCommPushCudaFree(comm, comm->devProfileHeads);
+  }
+#endif
+  tmpCommAndChans.comm.profileEvents = comm->devProfileEvents;
+  tmpCommAndChans.comm.profileHeads = comm->devProfileHeads;
+  NCCLCHECKGOTO(ncclStragglerInit(comm), ret, fail);
+  tmpCommAndChans.comm.arrivals = comm->straggler ? comm->straggler->arrivals : NULL;
+
+  { ncclMemScope memScope(&comm->memStats, ncclMemWorkFifo);
+    NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->workFifoDone, MAXCHANNELS), ret, fail);
+  }
   ncclCommPushCudaHostFree(comm, comm->workFifoDone);
-  comm->workFifoSent = 0;
-  comm->workFifoAckdMin = 0;
+
+  if (ncclParamOpHandles()) {
+    if (CUPFN(cuStreamWriteValue32) == nullptr) {
+      INFO(NCCL_INIT, "NCCL_OP_HANDLES set but stream memory operations are not available, operation handles disabled");
+    } else {
+      ncclMemScope memScope(&comm->memStats, ncclMemOther);
+      NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->opDone, 1), ret, fail);
+      ncclCommPushCudaHostFree(comm, comm->opDone);
+    }
+  }
 
   if (comm->collNetDenseToUserRank != nullptr) {
+    ncclMemScope memScope(&comm->memStats, ncclMemDevComm);
     NCCLCHECKGOTO(ncclCudaCallocAsync(&tmpCommAndChans.comm.collNetDenseToUserRank, nRanks, comm->sharedRes->deviceStream.cudaStream), ret, fail);
     ncclCommPushCudaFree(comm, tmpCommAndChans.comm.collNetDenseToUserRank);
     NCCLCHECKGOTO(ncclCudaMemcpyAsync(tmpCommAndChans.comm.collNetDenseToUserRank, comm->collNetDenseToUserRank, nRanks, comm->sharedRes->deviceStream.cudaStream), ret, fail);
@@ -452,6 +614,8 @@ static ncclResult_t devCommSetup(ncclComm_t comm) {
     tmpCommAndChans.channels[c].collnetChain = comm->channels[c].collnetChain;
     tmpCommAndChans.channels[c].collnetDirect = comm->channels[c].collnetDirect;
     tmpCommAndChans.channels[c].nvls = comm->channels[c].nvls;
+    tmpCommAndChans.channels[c].hier = comm->channels[c].hier;
+    tmpCommAndChans.channels[c].recDbl = comm->channels[c].recDbl;
     tmpCommAndChans.channels[c].workFifoDone = &comm->workFifoDone[c];
 
     if (comm->channels[c].ring.userRanks != nullptr) {
@@ -500,6 +664,7 @@ static ncclResult_t fillInfo(struct ncclComm* comm, struct ncclPeerInfo* info, u
   NCCLCHECK(ncclGpuGdrSupport(comm, &info->gdrSupport));
   info->comm = comm;
   info->cudaCompCap = comm->minCompCap = comm->maxCompCap = comm->compCap;
+  info->gpuShareProcs = comm->gpuShareProcs;
 
   // MNNVL support
   {
@@ -539,6 +704,84 @@ static ncclResult_t setupChannel(struct ncclComm* comm, int channelId, int rank,
   return ncclSuccess;
 }
 
+NCCL_PARAM(HierEnable, "HIER_ENABLE", 1);
+
+// Derive the hierarchical AllReduce/AllGather rings from the rings. This needs every node
+// to have the same number of ranks, more than one, and to appear as a single
+// segment of each ring. All ranks see the same rings, hence agree on support.
+static ncclResult_t hierSetup(struct ncclComm* comm) {
+  int nRanks = comm->nRanks, nNodes = comm->nNodes;
+  int nLocal = nRanks / nNodes;
+  comm->hierSupport = 0;
+  if (ncclParamHierEnable() == 0 || nNodes == 1 || nLocal == 1) return ncclSuccess;
+  for (int n=0; n<nNodes; n++) {
+    if (comm->nodeRanks[n].localRanks != nLocal) return ncclSuccess;
+  }
+  for (int c=0; c<comm->nChannels; c++) {
+    int* userRanks = comm->channels[c].ring.userRanks;
+    int nSegments = 0;
+    for (int i=0; i<nRanks; i++) {
+      if (comm->rankToNode[userRanks[i]] != comm->rankToNode[userRanks[(i+1)%nRanks]]) nSegments++;
+    }
+    if (nSegments != nNodes) {
+      INFO(NCCL_INIT, "Ring %d does not visit nodes in contiguous segments, disabling hierarchical AllReduce", c);
+      return ncclSuccess;
+    }
+  }
+
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclRing* ring = &comm->channels[c].ring;
+    struct ncclHier* hier = &comm->channels[c].hier;
+    int* userRanks = ring->userRanks;
+    int pos = 0;
+    while (comm->rankToNode[userRanks[nRanks-1-pos]] == comm->node) pos++;
+    // Segments start at the same ring index modulo nLocal
+    int start = ring->index - pos;
+    int shift = (start % nLocal + nLocal) % nLocal;
+    hier->localIndex = pos;
+    hier->nLocal = nLocal;
+    hier->intraNext = pos < nLocal-1 ? userRanks[1] : userRanks[nRanks-(nLocal-1)];
+    hier->intraPrev = pos > 0 ? userRanks[nRanks-1] : userRanks[nLocal-1];
+    hier->interNext = userRanks[nLocal];
+    hier->interPrev = userRanks[nRanks-nLocal];
+    hier->node = ((start - shift) % nRanks + nRanks) % nRanks / nLocal;
+    hier->nNodes = nNodes;
+    TRACE(NCCL_INIT, "Hier %02d : intra %d -> %d -> %d [%d/%d] inter %d -> %d -> %d [%d/%d]", c,
+        hier->intraPrev, comm->rank, hier->intraNext, pos, nLocal, hier->interPrev, comm->rank, hier->interNext, hier->node, nNodes);
+  }
+  comm->hierSupport = 1;
+  return ncclSuccess;
+}
+
+NCCL_PARAM(RecDblEnable, "RECDBL_ENABLE", 0);
+
+// Recursive doubling peers, by rank so that the first rounds stay within a node
+// when ranks are numbered node by node. Off by default since every channel gets
+// connections to log2(nRanks) more peers.
+static ncclResult_t recDblSetup(struct ncclComm* comm) {
+  int nRanks = comm->nRanks, rank = comm->rank;
+  comm->recDblSupport = 0;
+  if (ncclParamRecDblEnable() == 0 || nRanks == 1) return ncclSuccess;
+  int nPeers = log2i(nRanks);
+  if (nPeers > NCCL_MAX_RECDBL_PEERS) return ncclSuccess;
+  int pow2 = 1 << nPeers;
+  struct ncclRecDbl recDbl;
+  memset(&recDbl, 0, sizeof(recDbl));
+  recDbl.extra = -1;
+  if (rank >= pow2) {
+    recDbl.folded = 1;
+    recDbl.extra = rank - pow2;
+  } else {
+    recDbl.nPeers = nPeers;
+    for (int i=0; i<nPeers; i++) recDbl.peers[i] = rank ^ (1<<i);
+    if (rank + pow2 < nRanks) recDbl.extra = rank + pow2;
+  }
+  for (int c=0; c<comm->nChannels; c++) comm->channels[c].recDbl = recDbl;
+  TRACE(NCCL_INIT, "RecDbl : %d peers, extra %d%s", recDbl.nPeers, recDbl.extra, recDbl.folded ? " (folded)" : "");
+  comm->recDblSupport = 1;
+  return ncclSuccess;
+}
+
 #define DEFAULT_LL_BUFFSIZE (NCCL_LL_LINES_PER_THREAD*NCCL_LL_MAX_NTHREADS*NCCL_STEPS*sizeof(union ncclLLFifoLine))
 #define DEFAULT_LL128_BUFFSIZE (NCCL_LL128_ELEMS_PER_THREAD*NCCL_LL128_MAX_NTHREADS*NCCL_STEPS*sizeof(uint64_t))
 #define DEFAULT_BUFFSIZE (1 << 22) /* 4MiB */
@@ -579,10 +822,41 @@ static ncclResult_t computeBuffSizes(struct ncclComm* comm) {
   return ncclSuccess;
 }
 
+NCCL_PARAM(P2pChunkModel, "P2P_CHUNK_MODEL", 0);
+
+// Size the smallest p2p chunk to each node-local peer from the bandwidth one
+// channel gets on the path, so that the synchronization of a chunk (about 1us
+// over NVLink, 2us over PCI) costs at most 1/8 of its time. Small sends then
+// use few channels on slow paths, large ones are split up to the NVLink/PCI
+// maximum even when the comm spans several nodes.
+static ncclResult_t p2pChunkModelInit(struct ncclComm* comm) {
+  if (ncclParamP2pChunkModel() == 0) return ncclSuccess;
+  NCCLCHECK(ncclCalloc(&comm->p2pLocalChunkMin, comm->localRanks));
+  for (int l=0; l<comm->localRanks; l++) {
+    int peer = comm->localRankToRank[l];
+    float bw;
+    int nvlink;
+    if (peer == comm->rank) continue;
+    if (ncclTopoGetGpuPathBw(comm->topo, comm->rank, peer, &bw, &nvlink) != ncclSuccess) continue;
+    float lat = nvlink ? 1.0 : 2.0;
+    // bw is in GB/s, i.e. 1000 bytes per us.
+    int64_t size = (int64_t)(bw*1000/comm->p2pnChannelsPerPeer*lat*8);
+    size = std::min(std::max(size, (int64_t)comm->p2pChunkSize/32), (int64_t)comm->p2pChunkSize);
+    // Chunks are aligned on it, keep it a power of two.
+    int chunkMin = 1;
+    while (chunkMin*2 <= size) chunkMin *= 2;
+    comm->p2pLocalChunkMin[l] = chunkMin;
+    TRACE(NCCL_INIT, "P2P chunk model: rank %d -> %d bw %g GB/s, min chunk %d", comm->rank, peer, bw, chunkMin);
+  }
+  return ncclSuccess;
+}
+
 NCCL_PARAM(GraphDumpFileRank, "GRAPH_DUMP_FILE_RANK", 0);
 NCCL_PARAM(CollNetNodeThreshold, "COLLNET_NODE_THRESHOLD", 2);
+NCCL_PARAM(NetHierarchy, "NET_HIERARCHY", 1);
 NCCL_PARAM(NvbPreconnect, "NVB_PRECONNECT", 1);
 NCCL_PARAM(AllocP2pNetLLBuffers, "ALLOC_P2P_NET_LL_BUFFERS", 0);
+NCCL_PARAM(RuntimeConnect, "RUNTIME_CONNECT", 0);
 
 static ncclResult_t collNetInitRailRankMap(ncclComm_t comm) {
   int rank = comm->rank;
@@ -890,7 +1164,20 @@ static int checkMNNVL(struct ncclComm* comm) {
 }
 #endif
 
-static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* parent = NULL) {
+NCCL_PARAM(CommSplitReuseGraphs, "COMM_SPLIT_REUSE_GRAPHS", 1);
+
+// Search a graph, or take it from the parent when the system was copied from
+// it and the parent searched that graph too.
+static ncclResult_t searchGraph(struct ncclComm* comm, struct ncclComm* parent, struct ncclTopoGraph** splitGraphs, struct ncclTopoGraph* graph) {
+  if (splitGraphs && splitGraphs[graph->id]) {
+    NCCLCHECK(ncclTopoSplitGraph(parent->topo, splitGraphs[graph->id], comm->topo, graph));
+  } else {
+    NCCLCHECK(ncclTopoCompute(comm->topo, graph));
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* parent = NULL, struct ncclComm* prev = NULL) {
   // We use 2 AllGathers
   // 1. { peerInfo, comm, compCap}
   // 2. { nChannels, graphInfo, topoRanks }
@@ -903,7 +1190,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   struct ncclTopoGraph treeGraph;
   struct ncclTopoGraph collNetGraph;
   struct ncclTopoGraph nvlsGraph;
-  struct ncclTopoGraph* graphs[] = { &treeGraph, &ringGraph, &collNetGraph, &collNetGraph, &nvlsGraph, &nvlsGraph };
+  struct ncclTopoGraph* graphs[] = { &treeGraph, &ringGraph, &collNetGraph, &collNetGraph, &nvlsGraph, &nvlsGraph, &ringGraph, &ringGraph, &ringGraph };
 
   struct graphInfo {
     int pattern;
@@ -919,26 +1206,33 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   struct allGatherInfo {
     struct graphInfo graphInfo[NCCL_NUM_ALGORITHMS];
     struct ncclTopoRanks topoRanks;
+    int netPod;
+    int netLeaf;
   };
 
   int nChannelsOrig;
   struct allGatherInfo *allGather3Data = NULL;
   struct ncclTopoRanks** allTopoRanks = NULL;
-  int *nodesFirstRank = NULL, *nodesTreePatterns = NULL;
+  int *nodesFirstRank = NULL, *nodesTreePatterns = NULL, *nodesOrder = NULL;
   int *rings = NULL;
   int* nvbPeers = NULL;
   struct ncclProxyConnector proxyConn;
   int* pxnPeers = NULL;
   int *topParentLocalRanks = NULL;
   int tpProxyRank;
+  struct ncclTopoGraph** splitGraphs = NULL;
+  struct ncclComm* topoParent = NULL; // comm whose system and graphs we reuse
 
   // AllGather1 - begin
   NCCLCHECKGOTO(ncclCalloc(&comm->peerInfo, nranks+1), ret, fail); // Extra rank to represent CollNet root
+  NCCLCHECKGOTO(ncclGpuShareRegister(comm), ret, fail);
   NCCLCHECKGOTO(fillInfo(comm, comm->peerInfo+rank, comm->commHash), ret, fail);
   NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, comm->peerInfo, sizeof(struct ncclPeerInfo)), ret, fail);
+  initPhaseEnd(comm, ncclInitPhaseBootstrap);
 
   for (int i = 0; i < nranks; i++) {
     if (comm->peerInfo[i].hostHash != comm->peerInfo[rank].hostHash) nNodes++;
+    comm->gpuShareProcs = std::max(comm->gpuShareProcs, comm->peerInfo[i].gpuShareProcs);
     if ((i != rank) && (comm->peerInfo[i].hostHash == comm->peerInfo[rank].hostHash) && (comm->peerInfo[i].busId == comm->peerInfo[rank].busId)) {
       WARN("Duplicate GPU detected : rank %d and rank %d both on CUDA device %lx", rank, i, comm->peerInfo[rank].busId);
       ret = ncclInvalidUsage;
@@ -986,9 +1280,6 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
       }
     }
 
-    // Buffer Registration is not supported with MNNVL
-    if (comm->MNNVL) comm->nvlsRegSupport = 0;
-
     TRACE(NCCL_INIT,"pidHash[%d] %lx intraProcRank %d intraProcRanks %d intraProcRank0 %d",
         rank, comm->peerInfo[rank].pidHash, intraProcRank, intraProcRanks, intraProcRank0);
     if (intraProcRank == -1 || intraProcRank0 == -1 || comm->peerInfo[intraProcRank0].comm == NULL) {
@@ -1008,16 +1299,32 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     comm->intraBarrierGate = 0;
   } while(0);
 
-  // Topo detection / System graph creation
-  NCCLCHECKGOTO(ncclTopoGetSystem(comm, &comm->topo), ret, fail);
-  // Compute paths between GPUs and NICs
-  NCCLCHECKGOTO(ncclTopoComputePaths(comm->topo, comm), ret, fail);
-  // Remove inaccessible GPUs and unused NICs
-  NCCLCHECKGOTO(ncclTopoTrimSystem(comm->topo, comm), ret, fail);
-  // Recompute paths after trimming
-  NCCLCHECKGOTO(ncclTopoComputePaths(comm->topo, comm), ret, fail);
-  // Init search
-  NCCLCHECKGOTO(ncclTopoSearchInit(comm->topo), ret, fail);
+  // Split children keeping all GPUs of their parent on this node reuse its
+  // system and graphs. The condition is the same for all ranks of the node.
+  if (parent && parent->config.splitShare && ncclParamCommSplitReuseGraphs() && !parent->MNNVL && !comm->MNNVL) {
+    NCCLCHECKGOTO(ncclTopoSplitSystem(comm, parent, &comm->topo), ret, fail);
+    topoParent = parent;
+  }
+  // Likewise for nodes keeping the same GPUs through ncclCommReconfigure
+  if (prev && ncclParamCommSplitReuseGraphs() && !prev->MNNVL && !comm->MNNVL) {
+    NCCLCHECKGOTO(ncclTopoReuseSystem(comm, prev, &comm->topo), ret, fail);
+    topoParent = prev;
+  }
+  if (comm->topo) {
+    splitGraphs = topoParent->splitGraphs;
+    INFO(NCCL_INIT, "comm %p rank %d reusing topology of %s comm %p", comm, rank, parent ? "parent" : "previous", topoParent);
+  } else {
+    // Topo detection / System graph creation
+    NCCLCHECKGOTO(ncclTopoGetSystem(comm, &comm->topo), ret, fail);
+    // Compute paths between GPUs and NICs
+    NCCLCHECKGOTO(ncclTopoComputePaths(comm->topo, comm), ret, fail);
+    // Remove inaccessible GPUs and unused NICs
+    NCCLCHECKGOTO(ncclTopoTrimSystem(comm->topo, comm), ret, fail);
+    // Recompute paths after trimming
+    NCCLCHECKGOTO(ncclTopoComputePaths(comm->topo, comm), ret, fail);
+    // Init search
+    NCCLCHECKGOTO(ncclTopoSearchInit(comm->topo), ret, fail);
+  }
   // Print final topology
   NCCLCHECKGOTO(ncclTopoPrint(comm->topo), ret, fail);
 
@@ -1043,13 +1350,15 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   // Determine local Nvls support
   NCCLCHECK(ncclNvlsInit(comm));
 
+  initPhaseEnd(comm, ncclInitPhaseTopo);
+
   // Get rings and trees
   memset(&ringGraph, 0, sizeof(struct ncclTopoGraph));
   ringGraph.id = 0;
   ringGraph.pattern = NCCL_TOPO_PATTERN_RING;
   ringGraph.minChannels = 1;
-  ringGraph.maxChannels = MAXCHANNELS/2;
-  NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &ringGraph), ret, fail);
+  ringGraph.maxChannels = std::max(NCCL_DEFAULT_MAXCHANNELS, ncclMaxNchannels())/2;
+  NCCLCHECKGOTO(searchGraph(comm, topoParent, splitGraphs, &ringGraph), ret, fail);
   NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &ringGraph), ret, fail);
 
   memset(&treeGraph, 0, sizeof(struct ncclTopoGraph));
@@ -1057,7 +1366,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   treeGraph.pattern = NCCL_TOPO_PATTERN_BALANCED_TREE;
   treeGraph.minChannels = ringGraph.nChannels;
   treeGraph.maxChannels = ringGraph.nChannels;
-  NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &treeGraph), ret, fail);
+  NCCLCHECKGOTO(searchGraph(comm, topoParent, splitGraphs, &treeGraph), ret, fail);
   NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &treeGraph), ret, fail);
 
   memset(&collNetGraph, 0, sizeof(struct ncclTopoGraph));
@@ -1066,7 +1375,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   collNetGraph.collNet = 1;
   collNetGraph.minChannels = collNetGraph.maxChannels = ringGraph.nChannels;
   if (comm->collNetSupport) {
-    NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &collNetGraph), ret, fail);
+    NCCLCHECKGOTO(searchGraph(comm, topoParent, splitGraphs, &collNetGraph), ret, fail);
     NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &collNetGraph), ret, fail);
   }
 
@@ -1074,12 +1383,22 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   nvlsGraph.id = 3;
   nvlsGraph.pattern = NCCL_TOPO_PATTERN_NVLS;
   nvlsGraph.minChannels = 1;
-  nvlsGraph.maxChannels = MAXCHANNELS;
+  nvlsGraph.maxChannels = std::max(NCCL_DEFAULT_MAXCHANNELS, ncclMaxNchannels());
   if (comm->nvlsSupport) {
-    NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &nvlsGraph), ret, fail);
+    NCCLCHECKGOTO(searchGraph(comm, topoParent, splitGraphs, &nvlsGraph), ret, fail);
     NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &nvlsGraph), ret, fail);
   }
 
+  // Kept for split children and ncclCommReconfigure
+  {
+    struct ncclTopoGraph* searched[4] = { &ringGraph, &treeGraph, comm->collNetSupport ? &collNetGraph : NULL, comm->nvlsSupport ? &nvlsGraph : NULL };
+    for (int g=0; g<4; g++) {
+      if (searched[g] == NULL) continue;
+      NCCLCHECKGOTO(ncclCalloc(&comm->splitGraphs[g], 1), ret, fail);
+      memcpy(comm->splitGraphs[g], searched[g], sizeof(struct ncclTopoGraph));
+    }
+  }
+
   // Initialize num P2P LL buffers for this communicator
   comm->allocP2pNetLLBuffers = ncclParamAllocP2pNetLLBuffers() == 1;
 
@@ -1088,6 +1407,8 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     NCCLCHECKGOTO(ncclTopoDumpGraphs(comm->topo, 4, dumpGraphs), ret, fail);
   }
 
+  initPhaseEnd(comm, ncclInitPhaseSearch);
+
   // AllGather3 - begin
   NCCLCHECKGOTO(ncclCalloc(&allGather3Data, nranks), ret, fail);
 
@@ -1104,6 +1425,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   comm->nChannels = std::min(treeGraph.nChannels, ringGraph.nChannels);
   NCCLCHECKGOTO(ncclTopoPreset(comm, graphs, &allGather3Data[rank].topoRanks), ret, fail);
+  NCCLCHECKGOTO(ncclTopoGetNetLocation(comm->topo, &allGather3Data[rank].netPod, &allGather3Data[rank].netLeaf), ret, fail);
 
   NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, allGather3Data, sizeof(*allGather3Data)), ret, fail);
 
@@ -1123,6 +1445,34 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     }
     comm->rankToNode[r] = node;
   }
+  // Inter-node rings and trees follow the order of the nodes, and subtrees of the
+  // double binary tree cover consecutive nodes. Order nodes by pod and leaf switch
+  // so that rings and trees stay under the same leaf as long as they can and
+  // cross the fewest spine switches. Without hints the order is unchanged.
+  NCCLCHECKGOTO(ncclCalloc(&nodesOrder, comm->nNodes), ret, fail);
+  for (int n=0; n<comm->nNodes; n++) nodesOrder[n] = n;
+  std::stable_sort(nodesOrder, nodesOrder+comm->nNodes, [&](int a, int b) {
+    struct allGatherInfo* infoA = allGather3Data+nodesFirstRank[a];
+    struct allGatherInfo* infoB = allGather3Data+nodesFirstRank[b];
+    if (infoA->netPod != infoB->netPod) return infoA->netPod < infoB->netPod;
+    return infoA->netLeaf < infoB->netLeaf;
+  });
+  if (ncclParamNetHierarchy()) {
+    int* oldFirstRank = NULL;
+    NCCLCHECKGOTO(ncclCalloc(&oldFirstRank, 3*comm->nNodes), ret, fail);
+    int* oldTreePatterns = oldFirstRank+comm->nNodes;
+    int* newIndex = oldTreePatterns+comm->nNodes;
+    memcpy(oldFirstRank, nodesFirstRank, comm->nNodes*sizeof(int));
+    memcpy(oldTreePatterns, nodesTreePatterns, comm->nNodes*sizeof(int));
+    for (int n=0; n<comm->nNodes; n++) {
+      newIndex[nodesOrder[n]] = n;
+      nodesFirstRank[n] = oldFirstRank[nodesOrder[n]];
+      nodesTreePatterns[n] = oldTreePatterns[nodesOrder[n]];
+      nodesOrder[n] = n;
+    }
+    for (int r=0; r<nranks; r++) comm->rankToNode[r] = newIndex[comm->rankToNode[r]];
+    free(oldFirstRank);
+  }
   // Now that we know nNodes, alloc nodeRanks and compute localRanks for each node
   NCCLCHECKGOTO(ncclCalloc(&comm->nodeRanks, comm->nNodes), ret, fail);
   NCCLCHECKGOTO(ncclCalloc(&comm->rankToLocalRank, comm->nRanks), ret, fail);
@@ -1142,6 +1492,13 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     int node = comm->rankToNode[r];
     comm->nodeRanks[node].localRankToRank[comm->nodeRanks[node].localRanks++] = r;
   }
+  // Suggest a rank order which keeps the ranks of a node together, and nodes of the
+  // same pod and leaf switch next to each other.
+  NCCLCHECKGOTO(ncclCalloc(&comm->suggestedRankOrder, comm->nRanks), ret, fail);
+  for (int n=0, next=0; n<comm->nNodes; n++) {
+    struct ncclNodeRanks* nodeRanks = comm->nodeRanks+nodesOrder[n];
+    for (int l=0; l<nodeRanks->localRanks; l++) comm->suggestedRankOrder[nodeRanks->localRankToRank[l]] = next++;
+  }
   comm->node = comm->rankToNode[rank];
   comm->localRankToRank = comm->nodeRanks[comm->node].localRankToRank;
   comm->localRank = comm->rankToLocalRank[rank];
@@ -1159,6 +1516,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   INFO(NCCL_INIT, "comm %p rank %d nRanks %d nNodes %d localRanks %d localRank %d MNNVL %d",
        comm, rank, comm->nRanks, comm->nNodes, comm->localRanks, comm->localRank, comm->MNNVL);
+  NCCLCHECKGOTO(bootstrapIntraNodeShmSetup(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks), ret, fail);
 
   nChannelsOrig = comm->nChannels;
   NCCLCHECKGOTO(ncclCalloc(&allTopoRanks, comm->nRanks), ret, fail);
@@ -1204,8 +1562,14 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
         comm->collNetRegSupport = false;
       }
     }
+    if (comm->collNetSupport == 1) {
+      INFO(NCCL_INIT, "CollNet %s offloads AllReduce%s%s, user buffer registration %s", comm->ncclCollNet->name,
+          comm->ncclCollNet->iallgather ? " AllGather" : "", comm->ncclCollNet->ireducescatter ? " ReduceScatter" : "",
+          comm->collNetRegSupport ? "enabled" : "disabled");
+    }
   }
 
+  NCCLCHECKGOTO(ncclGpuShareLimitChannels(comm), ret, fail);
   NCCLCHECKGOTO(ncclCalloc(&rings, nranks*MAXCHANNELS), ret, fail);
   NCCLCHECKGOTO(ncclTopoPostset(comm, nodesFirstRank, nodesTreePatterns, allTopoRanks, rings, graphs, parent), ret, fail);
   // AllGather3 - end
@@ -1216,8 +1580,9 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   line[0]='\0';
   for (int c=0; c<comm->nChannels; c++) {
     struct ncclTree* tree = &comm->channels[c].tree;
-    snprintf(line+strlen(line), 1023-strlen(line), " [%d] %d/%d/%d->%d->%d",
-        c, tree->down[0], tree->down[1], tree->down[2], rank, tree->up);
+    snprintf(line+strlen(line), 1023-strlen(line), " [%d] %d/%d/%d", c, tree->down[0], tree->down[1], tree->down[2]);
+    for (int i=3; i<NCCL_MAX_TREE_ARITY && tree->down[i] != -1; i++) snprintf(line+strlen(line), 1023-strlen(line), "/%d", tree->down[i]);
+    snprintf(line+strlen(line), 1023-strlen(line), "->%d->%d", rank, tree->up);
     INFO(NCCL_GRAPH, "Ring %02d : %d -> %d -> %d", c, comm->channels[c].ring.prev, comm->rank, comm->channels[c].ring.next);
   }
   line[1023] = '\0';
@@ -1227,6 +1592,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   // Compute nChannels per peer for p2p
   NCCLCHECKGOTO(ncclTopoComputeP2pChannels(comm), ret, fail);
+  NCCLCHECKGOTO(p2pChunkModelInit(comm), ret, fail);
 
   /* until now, all info of comm should be known. We can initialize shared resources and
    * map localRanks to top parent local ranks. NOTE: this shareRes init must be put before
@@ -1245,33 +1611,51 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   }
   comm->topParentLocalRanks = topParentLocalRanks;
 
+  initPhaseEnd(comm, ncclInitPhaseGraph);
+
   // Launch proxy service thread, after this, the proxy calls can be used.
   if (parent && parent->config.splitShare) {
     comm->proxyState = parent->sharedRes->proxyState;
     ncclAtomicRefCountIncrement(&parent->sharedRes->proxyState->refCount);
   } else {
+    NCCLCHECKGOTO(ncclProxyCpuSelect(comm, CPU_COUNT(&comm->cpuAffinity) ? &affinitySave : NULL), ret, fail);
     NCCLCHECKGOTO(ncclProxyCreate(comm), ret, fail);
   }
+  initPhaseEnd(comm, ncclInitPhaseProxy);
 
-  // Connect with prev/next for each ring
   for (int c=0; c<comm->nChannels; c++) {
-    struct ncclChannel* channel = comm->channels+c;
     NCCLCHECKGOTO(setupChannel(comm, c, rank, nranks, rings+c*nranks), ret, fail);
-    if (comm->nRanks == 1) continue;
-    NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, 1, &channel->ring.prev, 1, &channel->ring.next, 0), ret, fail);
   }
-  NCCLCHECKGOTO(ncclTransportP2pSetup(comm, &ringGraph, 0), ret, fail);
-  INFO(NCCL_INIT, "Connected all rings");
-
-  // Connect Trees
-  for (int c=0; c<comm->nChannels; c++) {
-    struct ncclChannel* channel = comm->channels+c;
-    if (comm->nRanks == 1) continue;
-    NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, NCCL_MAX_TREE_ARITY, channel->tree.down, 1, &channel->tree.up, 0), ret, fail);
-    NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, 1, &channel->tree.up, NCCL_MAX_TREE_ARITY, channel->tree.down, 0), ret, fail);
+  NCCLCHECKGOTO(hierSetup(comm), ret, fail);
+  NCCLCHECKGOTO(recDblSetup(comm), ret, fail);
+
+  // Other algorithms are still connected below, or not at all if unsupported.
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) comm->collConnected[a] = true;
+  comm->runtimeConn = comm->nRanks > 1 && ncclParamRuntimeConnect();
+  // Rings and trees may also be connected again after ncclCommShrink
+  NCCLCHECKGOTO(ncclCalloc(&comm->collGraphs[NCCL_ALGO_RING], 1), ret, fail);
+  NCCLCHECKGOTO(ncclCalloc(&comm->collGraphs[NCCL_ALGO_TREE], 1), ret, fail);
+  memcpy(comm->collGraphs[NCCL_ALGO_RING], &ringGraph, sizeof(struct ncclTopoGraph));
+  memcpy(comm->collGraphs[NCCL_ALGO_TREE], &treeGraph, sizeof(struct ncclTopoGraph));
+  if (comm->runtimeConn) {
+    // Connect rings and trees the first time a collective uses them
+    comm->collConnected[NCCL_ALGO_RING] = comm->collConnected[NCCL_ALGO_TREE] = false;
+    comm->collConnected[NCCL_ALGO_RING_SCATTER] = false;
+    if (comm->hierSupport) comm->collConnected[NCCL_ALGO_HIER] = false;
+    if (comm->recDblSupport) comm->collConnected[NCCL_ALGO_RECDBL] = false;
+    INFO(NCCL_INIT, "Rings and trees will be connected at runtime");
+  } else {
+    // Connect with prev/next for each ring
+    NCCLCHECKGOTO(ncclTransportRingConnect(comm, &ringGraph), ret, fail);
+    // Connect Trees
+    NCCLCHECKGOTO(ncclTransportTreeConnect(comm, &treeGraph), ret, fail);
+    // Connect the hierarchical rings
+    if (comm->hierSupport) NCCLCHECKGOTO(ncclTransportHierConnect(comm), ret, fail);
+    // Connect the recursive doubling peers
+    if (comm->recDblSupport) NCCLCHECKGOTO(ncclTransportRecDblConnect(comm), ret, fail);
   }
-  NCCLCHECKGOTO(ncclTransportP2pSetup(comm, &treeGraph, 0), ret, fail);
-  INFO(NCCL_INIT, "Connected all trees");
+
+  initPhaseEnd(comm, ncclInitPhaseConnect);
 
   // Setup NVLS
   NCCLCHECKGOTO(ncclNvlsSetup(comm, parent), ret, fail);
@@ -1286,13 +1670,17 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     INFO(NCCL_INIT, "Connected NVLS tree");
   }
 
+  initPhaseEnd(comm, ncclInitPhaseNvls);
+
   // Check if we can setup CollNet
   if (comm->collNetSupport > 0) collNetTrySetup(comm, parent, &collNetGraph);
+  initPhaseEnd(comm, ncclInitPhaseCollNet);
 
   TRACE(NCCL_INIT, "rank %d nranks %d - CONNECTED %d RINGS AND TREES", rank, nranks, comm->nChannels);
 
   // Compute time models for algorithm and protocol combinations
   NCCLCHECKGOTO(ncclTopoTuneModel(comm, comm->minCompCap, comm->maxCompCap, graphs), ret, fail);
+  NCCLCHECKGOTO(ncclKernelWarmupStart(comm), ret, fail);
 
   INFO(NCCL_INIT, "%d coll channels, %d collnet channels, %d nvls channels, %d p2p channels, %d p2p channels per peer", comm->nChannels, comm->nChannels, comm->nvlsChannels, comm->p2pnChannels, comm->p2pnChannelsPerPeer);
 
@@ -1308,6 +1696,11 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     tasks->peers = ncclMemoryStackAlloc<ncclTasks::Peer>(&comm->memPermanent, tasks->p2pOrderSteps);
     tasks->p2pSendOrder = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
     tasks->p2pRecvOrder = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
+    tasks->p2pSendStep = ncclMemoryStackAlloc<int>(&comm->memPermanent, comm->nRanks);
+    tasks->p2pRecvStep = ncclMemoryStackAlloc<int>(&comm->memPermanent, comm->nRanks);
+    tasks->p2pActiveSteps = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
+    tasks->p2pStepActive = ncclMemoryStackAlloc<bool>(&comm->memPermanent, tasks->p2pOrderSteps);
+    tasks->nP2pActiveSteps = 0;
     int i=0;
     // schedule delta 0, +1, -1, +2, -2, ...
     // also make sure we don't do 0 twice, nor +n/2 and -n/2 if n is even.
@@ -1322,9 +1715,11 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
         int recvIndex = (localRank-step+steps)%steps;
         int recvRank = recvIndex < nodeRanks[recvNode].localRanks ? nodeRanks[recvNode].localRankToRank[recvIndex] : -1;
         tasks->p2pRecvOrder[i] = recvRank;
+        if (recvRank != -1) tasks->p2pRecvStep[recvRank] = i;
         int sendIndex = (localRank+step)%steps;
         int sendRank = sendIndex < nodeRanks[sendNode].localRanks ? nodeRanks[sendNode].localRankToRank[sendIndex] : -1;
         tasks->p2pSendOrder[i] = sendRank;
+        if (sendRank != -1) tasks->p2pSendStep[sendRank] = i;
         i++;
       }
       index++;
@@ -1340,6 +1735,8 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     assert(i == tasks->p2pOrderSteps);
   } while (0);
 
+  initPhaseEnd(comm, ncclInitPhaseOther);
+
   if (ncclParamNvbPreconnect()) {
     // Connect p2p when using NVB path
     int nvbNpeers;
@@ -1363,6 +1760,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
     NCCLCHECKGOTO(ncclTransportP2pSetup(comm, NULL, 1), ret, fail);
   }
+  initPhaseEnd(comm, ncclInitPhaseConnect);
 
   // Connect to local net proxy
   tpProxyRank = comm->topParentRanks[comm->rank];
@@ -1396,9 +1794,17 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     }
   }
 
+  initPhaseEnd(comm, ncclInitPhaseProxy);
+
   // Call devCommSetup before the last barrier, making sure we don't have a thread running in front and starting to
   // launch NCCL kernels before all cuda mem allocation is complete. That could cause a deadlock.
   NCCLCHECKGOTO(devCommSetup(comm), ret, fail);
+  // Let the parent abort our kernels from now on. Pairs with ncclChildAbortFlagSet.
+  if (parent && !parent->config.splitShare && comm->abortFlagDevHost) {
+    __atomic_store_n(&parent->childAbortFlagDevHost, comm->abortFlagDevHost, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(comm->abortFlag, __ATOMIC_SEQ_CST)) ncclAbortFlagDevSet(comm->abortFlagDevHost);
+  }
+  initPhaseEnd(comm, ncclInitPhaseDevComm);
 
   /* Local intra-node barrier */
   NCCLCHECKGOTO(bootstrapIntraNodeBarrier(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, comm->localRankToRank[0]), ret, fail);
@@ -1416,6 +1822,7 @@ exit:
   free(allTopoRanks);
   free(nodesTreePatterns);
   free(nodesFirstRank);
+  free(nodesOrder);
   free(allGather3Data);
   free(rings);
   free(nvbPeers);
@@ -1440,9 +1847,14 @@ struct ncclCommInitRankAsyncJob {
   // For ncclCommInitRank
   int nranks, myrank;
   ncclUniqueId commId;
+  // For ncclCommInitRankScalable, commIds[0] is also in commId
+  int nId;
+  ncclUniqueId* commIds;
   // for ncclCommSplit
   struct ncclComm* parent;
   int color, key;
+  // For ncclCommReconfigure, the communicator this rank was part of
+  struct ncclComm* prev;
 };
 
 struct ncclCommFinalizeAsyncJob {
@@ -1498,6 +1910,46 @@ fail:
   goto exit;
 }
 
+// Sums the phases into the total and reports them. With NCCL_INIT_TIMING,
+// also gathers them from all ranks to report their spread.
+static ncclResult_t initStatsReport(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  ncclCommInitStats_t* times = &comm->initStats.times;
+  uint64_t* all = NULL;
+  char line[1024];
+  int len = 0;
+  times->ns[ncclInitPhaseTotal] = 0;
+  for (int p=0; p<ncclInitPhaseTotal; p++) times->ns[ncclInitPhaseTotal] += times->ns[p];
+  for (int p=0; p<NCCL_INIT_NUM_PHASES; p++) {
+    len += snprintf(line+len, sizeof(line)-len, " %s %.2f", initPhaseNames[p], times->ns[p]/1e6);
+  }
+  INFO(NCCL_INIT, "comm %p rank %d init times (ms):%s", comm, comm->rank, line);
+  if (ncclParamInitTiming() == 0) goto exit;
+
+  NCCLCHECKGOTO(ncclCalloc(&all, comm->nRanks*NCCL_INIT_NUM_PHASES), ret, fail);
+  memcpy(all+comm->rank*NCCL_INIT_NUM_PHASES, times->ns, sizeof(times->ns));
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, all, sizeof(times->ns)), ret, fail);
+  for (int p=0; p<NCCL_INIT_NUM_PHASES; p++) {
+    times->minNs[p] = UINT64_MAX;
+    for (int r=0; r<comm->nRanks; r++) {
+      uint64_t ns = all[r*NCCL_INIT_NUM_PHASES+p];
+      times->minNs[p] = std::min(times->minNs[p], ns);
+      if (r == 0 || ns > times->maxNs[p]) {
+        times->maxNs[p] = ns;
+        times->maxRank[p] = r;
+      }
+    }
+    if (comm->rank == 0) {
+      INFO(NCCL_INIT, "comm %p init phase %-9s min %.2f ms max %.2f ms (rank %d)", comm, initPhaseNames[p], times->minNs[p]/1e6, times->maxNs[p]/1e6, times->maxRank[p]);
+    }
+  }
+exit:
+  free(all);
+  return ret;
+fail:
+  goto exit;
+}
+
 static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
   struct ncclCommInitRankAsyncJob* job = (struct ncclCommInitRankAsyncJob*)job_;
   ncclComm_t comm = job->comm;
@@ -1508,6 +1960,7 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
   int* parentRanks = NULL;
   int cudaArch;
 
+  comm->initStats.start = clockNano();
   CUDACHECKGOTO(cudaSetDevice(cudaDev), res, fail);
   CUDACHECKGOTO(cudaDeviceGetAttribute(&archMajor, cudaDevAttrComputeCapabilityMajor, cudaDev), res, fail);
   CUDACHECKGOTO(cudaDeviceGetAttribute(&archMinor, cudaDevAttrComputeCapabilityMinor, cudaDev), res, fail);
@@ -1520,6 +1973,7 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
     TRACE(NCCL_INIT, "Setting cudaLimitStackSize to %zi", maxLocalSizeBytes);
     CUDACHECKIGNORE(cudaDeviceSetLimit(cudaLimitStackSize, maxLocalSizeBytes));
   }
+  initPhaseEnd(comm, ncclInitPhaseOther);
 
   if (job->parent) {
     NCCLCHECKGOTO(ncclCalloc(&parentRanks, job->parent->nRanks), res, fail);
@@ -1531,7 +1985,11 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
     NCCLCHECKGOTO(bootstrapSplit((struct ncclBootstrapHandle*)&job->commId, comm, job->parent, job->color, job->key, parentRanks), res, fail);
   } else {
     NCCLCHECKGOTO(commAlloc(comm, NULL, job->nranks, job->myrank), res, fail);
-    NCCLCHECKGOTO(bootstrapInit((struct ncclBootstrapHandle*)&job->commId, comm), res, fail);
+    if (job->nId > 1) {
+      NCCLCHECKGOTO(bootstrapInit(job->nId, (struct ncclBootstrapHandle*)job->commIds, comm), res, fail);
+    } else {
+      NCCLCHECKGOTO(bootstrapInit(1, (struct ncclBootstrapHandle*)&job->commId, comm), res, fail);
+    }
   }
 
   comm->cudaArch = cudaArch;
@@ -1545,20 +2003,49 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
     comm, comm->rank, comm->nRanks, comm->cudaDev, comm->nvmlDev, comm->busId, (unsigned long long)hashUniqueId(job->commId));
   }
 
-  NCCLCHECKGOTO(initTransportsRank(comm, job->parent), res, fail);
+  // Load the profiler before the transports so the proxy thread can pick it up.
+  NCCLCHECKGOTO(ncclProfilerPluginLoad(&comm->profiler), res, fail);
+  if (comm->profiler) {
+    ncclResult_t initRet = comm->profiler->init(comm->commHash, comm->rank, comm->nRanks, ncclDebugLog, &comm->profilerContext);
+    if (initRet != ncclSuccess) {
+      // Destroy is only for contexts that were set up, so drop the plugin for this comm
+      INFO(NCCL_INIT, "Profiler plugin %s init returned %d, profiling disabled", comm->profiler->name, initRet);
+      comm->profilerContext = NULL;
+      NCCLCHECKGOTO(ncclProfilerPluginUnload(&comm->profiler), res, fail);
+    }
+  }
+
+  NCCLCHECKGOTO(initTransportsRank(comm, job->parent, job->prev), res, fail);
 
   NCCLCHECKGOTO(ncclTunerPluginLoad(&comm->tuner), res, fail);
   if (comm->tuner) {
     NCCLCHECK(comm->tuner->init(comm->nRanks, comm->nNodes, ncclDebugLog, &comm->tunerContext));
   }
+  NCCLCHECKGOTO(ncclAutotuneInit(comm), res, fail);
+  NCCLCHECKGOTO(ncclContentionInit(comm), res, fail);
+
+  if (comm->kernelWarmup) {
+    NCCLCHECKGOTO(ncclKernelWarmupWait(comm, &maxLocalSizeBytes), res, fail);
+    // Kernels were not set up by ncclInitKernelsForDevice() above, do it now.
+    if (maxLocalSizeBytes > 0 && ncclParamSetStackSize() == 1) {
+      TRACE(NCCL_INIT, "Setting cudaLimitStackSize to %zi", maxLocalSizeBytes);
+      CUDACHECKIGNORE(cudaDeviceSetLimit(cudaLimitStackSize, maxLocalSizeBytes));
+    }
+  }
+  initPhaseEnd(comm, ncclInitPhaseOther);
+  NCCLCHECKGOTO(initStatsReport(comm), res, fail);
 
   // update communicator state
   comm->initState = ncclSuccess;
+  NCCLCHECKGOTO(ncclMetricsRegister(comm), res, fail);
+  // Runs collectives, so needs the comm to be ready
+  NCCLCHECKGOTO(ncclTopoCalibrateModel(comm), res, fail);
 
   // Trace this call for replay tool
   if (job->parent) {
     /* unlink child abort flag. */
     __atomic_store_n(&job->parent->childAbortFlag, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&job->parent->childAbortFlagDevHost, NULL, __ATOMIC_RELEASE);
     TRACE_CALL("ncclCommSplit(%p, %d, %d, %p, %d, %d)",
                 job->parent, job->color, job->key, comm, comm->rank, comm->nRanks);
   } else {
@@ -1732,6 +2219,42 @@ static ncclResult_t parseCommConfig(ncclComm_t comm, ncclConfig_t *config) {
     goto fail;
   }
 
+  if (internalConfigPtr->trafficClass != NCCL_CONFIG_UNDEF_INT && (internalConfigPtr->trafficClass < 0 || internalConfigPtr->trafficClass > 255)) {
+    WARN("Invalid config trafficClass attribute value %d", internalConfigPtr->trafficClass);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->serviceLevel != NCCL_CONFIG_UNDEF_INT && (internalConfigPtr->serviceLevel < 0 || internalConfigPtr->serviceLevel > 15)) {
+    WARN("Invalid config serviceLevel attribute value %d", internalConfigPtr->serviceLevel);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->priority != NCCL_CONFIG_UNDEF_INT && (internalConfigPtr->priority < 0 || internalConfigPtr->priority > 1)) {
+    WARN("Invalid config priority attribute value %d", internalConfigPtr->priority);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->socketBusyPoll != NCCL_CONFIG_UNDEF_INT && internalConfigPtr->socketBusyPoll < 0) {
+    WARN("Invalid config socketBusyPoll attribute value %d", internalConfigPtr->socketBusyPoll);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->socketPacingRate != NCCL_CONFIG_UNDEF_INT && internalConfigPtr->socketPacingRate < 0) {
+    WARN("Invalid config socketPacingRate attribute value %d", internalConfigPtr->socketPacingRate);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->socketBuffSize != NCCL_CONFIG_UNDEF_INT && internalConfigPtr->socketBuffSize < 0 && internalConfigPtr->socketBuffSize != -2) {
+    WARN("Invalid config socketBuffSize attribute value %d", internalConfigPtr->socketBuffSize);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
   /* default config value can be tuned on different platform. */
   NCCL_CONFIG_DEFAULT(internalConfigPtr, blocking, NCCL_CONFIG_UNDEF_INT, 1, "Blocking", "%d");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, cgaClusterSize, NCCL_CONFIG_UNDEF_INT, 4, "CGA cluster size", "%d");
@@ -1739,6 +2262,7 @@ static ncclResult_t parseCommConfig(ncclComm_t comm, ncclConfig_t *config) {
   NCCL_CONFIG_DEFAULT(internalConfigPtr, maxCTAs, NCCL_CONFIG_UNDEF_INT, MAXCHANNELS, "Max CTAs", "%d");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, netName, NCCL_CONFIG_UNDEF_PTR, NULL, "Net name", "%s");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, splitShare, NCCL_CONFIG_UNDEF_INT, 0, "Split share", "%d");
+  NCCL_CONFIG_DEFAULT(internalConfigPtr, priority, NCCL_CONFIG_UNDEF_INT, 0, "Priority", "%d");
 
   /* assign config to communicator */
   comm->config.blocking = internalConfigPtr->blocking;
@@ -1747,6 +2271,16 @@ static ncclResult_t parseCommConfig(ncclComm_t comm, ncclConfig_t *config) {
   comm->config.maxCTAs = internalConfigPtr->maxCTAs;
   comm->config.netName = internalConfigPtr->netName;
   comm->config.splitShare = internalConfigPtr->splitShare;
+  comm->config.priority = internalConfigPtr->priority;
+  // Left undefined, the network keeps using NCCL_IB_TC and NCCL_IB_SL.
+  comm->config.trafficClass = internalConfigPtr->trafficClass;
+  comm->config.serviceLevel = internalConfigPtr->serviceLevel;
+  if (comm->config.trafficClass != NCCL_CONFIG_UNDEF_INT) INFO(NCCL_ENV, "Comm config Traffic class set to %d", comm->config.trafficClass);
+  if (comm->config.serviceLevel != NCCL_CONFIG_UNDEF_INT) INFO(NCCL_ENV, "Comm config Service level set to %d", comm->config.serviceLevel);
+  // Left undefined, the socket transport keeps using the NCCL_SOCKET_* variables.
+  comm->config.socketBusyPoll = internalConfigPtr->socketBusyPoll;
+  comm->config.socketPacingRate = internalConfigPtr->socketPacingRate;
+  comm->config.socketBuffSize = internalConfigPtr->socketBuffSize;
 
   NCCLCHECKGOTO(envConfigOverride(comm), ret, fail);
 
@@ -1756,12 +2290,19 @@ fail:
   goto exit;
 }
 
-static ncclResult_t ncclCommInitRankDev(ncclComm_t* newcomm, int nranks, ncclUniqueId commId, int myrank, int cudaDev, ncclConfig_t *config) {
+static void ncclCommInitJobFree(void* job_) {
+  struct ncclCommInitRankAsyncJob* job = (struct ncclCommInitRankAsyncJob*)job_;
+  free(job->commIds);
+  free(job);
+}
+
+static ncclResult_t ncclCommInitRankDev(ncclComm_t* newcomm, int nranks, int nId, ncclUniqueId* commIds, int myrank, int cudaDev, ncclConfig_t *config, struct ncclComm* prev = NULL) {
   ncclResult_t res = ncclSuccess;
   ncclComm_t comm = NULL;
   struct ncclCommInitRankAsyncJob *job = NULL;
+  ncclUniqueId commId = commIds[0];
   const char* env = ncclGetEnv("NCCL_COMM_ID");
-  if (env && myrank == 0) {
+  if (env && myrank == 0 && nId == 1) {
     INFO(NCCL_ENV, "NCCL_COMM_ID set by environment to %s", env);
     NCCLCHECKGOTO(bootstrapCreateRoot((struct ncclBootstrapHandle*)&commId, true), res, fail);
   }
@@ -1779,6 +2320,11 @@ static ncclResult_t ncclCommInitRankDev(ncclComm_t* newcomm, int nranks, ncclUni
     res = ncclInvalidArgument;
     goto fail;
   }
+  if (nId < 1 || nId > nranks) {
+    WARN("Invalid number of unique IDs %d for %d ranks", nId, nranks);
+    res = ncclInvalidArgument;
+    goto fail;
+  }
 
   NCCLCHECKGOTO(ncclCalloc(&comm, 1), res, fail);
   comm->startMagic = comm->endMagic = NCCL_MAGIC; // Used to detect comm corruption.
@@ -1794,9 +2340,15 @@ static ncclResult_t ncclCommInitRankDev(ncclComm_t* newcomm, int nranks, ncclUni
   job->comm = comm;
   job->nranks = nranks;
   job->commId = commId; // C++ struct assignment
+  job->nId = nId;
+  if (nId > 1) {
+    NCCLCHECKGOTO(ncclCalloc(&job->commIds, nId), res, fail);
+    memcpy(job->commIds, commIds, nId*sizeof(ncclUniqueId));
+  }
   job->myrank = myrank;
   job->cudaDev = cudaDev;
-  NCCLCHECKGOTO(ncclAsyncLaunch(&job->base, ncclCommInitRankFunc, NULL, free, comm), res, fail);
+  job->prev = prev;
+  NCCLCHECKGOTO(ncclAsyncLaunch(&job->base, ncclCommInitRankFunc, NULL, ncclCommInitJobFree, comm), res, fail);
 
 exit:
   return ncclGroupErrCheck(res);
@@ -1834,7 +2386,7 @@ ncclResult_t ncclCommInitRank(ncclComm_t* newcomm, int nranks, ncclUniqueId comm
   NvtxParamsCommInitRank payload{myrank, nranks, cudaDev};
   NVTX3_FUNC_WITH_PARAMS(CommInitRank, CommInitRankSchema, payload)
 
-  NCCLCHECK(ncclCommInitRankDev(newcomm, nranks, commId, myrank, cudaDev, &config));
+  NCCLCHECK(ncclCommInitRankDev(newcomm, nranks, 1, &commId, myrank, cudaDev, &config));
   return ncclSuccess;
 }
 
@@ -1887,7 +2439,7 @@ ncclResult_t ncclCommInitAll(ncclComm_t* comms, int ndev, const int* devlist) {
   NCCLCHECKGOTO(ncclGroupStart(), ret, fail);
   for (int i=0; i<ndev; i++) {
     // Ignore return codes .. we need to call ncclGroupEnd to clean up anyway
-    ncclCommInitRankDev(comms+i, ndev, uniqueId, i, devlist ? devlist[i] : i, &config);
+    ncclCommInitRankDev(comms+i, ndev, 1, &uniqueId, i, devlist ? devlist[i] : i, &config);
   }
   NCCLCHECKGOTO(ncclGroupEnd(), ret, fail);
 
@@ -1922,7 +2474,73 @@ ncclResult_t ncclCommInitRankConfig(ncclComm_t *newcomm, int nranks, ncclUniqueI
     internalConfigPtr = &internalConfig;
   else
     internalConfigPtr = config;
-  NCCLCHECKGOTO(ncclCommInitRankDev(newcomm, nranks, commId, myrank, cudaDev, internalConfigPtr), ret, fail);
+  NCCLCHECKGOTO(ncclCommInitRankDev(newcomm, nranks, 1, &commId, myrank, cudaDev, internalConfigPtr), ret, fail);
+
+exit:
+  ncclGroupErrCheck(ret);
+  NCCLCHECK(ncclGroupEndInternal());
+  if (newcomm && *newcomm && !(*newcomm)->config.blocking) (void) ncclCommGetAsyncError(*newcomm, &ret);
+  return ret;
+fail:
+  if (newcomm && *newcomm && !(*newcomm)->config.blocking) (void) ncclCommSetAsyncError(*newcomm, ret);
+  goto exit;
+}
+
+NCCL_API(ncclResult_t, ncclCommInitRankScalable, ncclComm_t* newcomm, int nranks, int myrank, int nId, ncclUniqueId* commIds, ncclConfig_t* config);
+ncclResult_t ncclCommInitRankScalable(ncclComm_t* newcomm, int nranks, int myrank, int nId, ncclUniqueId* commIds, ncclConfig_t* config) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  int cudaDev;
+  ncclResult_t ret = ncclSuccess;
+  ncclConfig_t internalConfig = NCCL_CONFIG_INITIALIZER;
+  ncclConfig_t *internalConfigPtr = NULL;
+  NCCLCHECK(ncclGroupStartInternal());
+
+  (void)ncclCudaLibraryInit();
+  CUDACHECKGOTO(cudaGetDevice(&cudaDev), ret, fail);
+  NCCLCHECKGOTO(PtrCheck(commIds, "CommInitRankScalable", "commIds"), ret, fail);
+
+  if (config == NULL)
+    internalConfigPtr = &internalConfig;
+  else
+    internalConfigPtr = config;
+  NCCLCHECKGOTO(ncclCommInitRankDev(newcomm, nranks, nId, commIds, myrank, cudaDev, internalConfigPtr), ret, fail);
+
+exit:
+  ncclGroupErrCheck(ret);
+  NCCLCHECK(ncclGroupEndInternal());
+  if (newcomm && *newcomm && !(*newcomm)->config.blocking) (void) ncclCommGetAsyncError(*newcomm, &ret);
+  return ret;
+fail:
+  if (newcomm && *newcomm && !(*newcomm)->config.blocking) (void) ncclCommSetAsyncError(*newcomm, ret);
+  goto exit;
+}
+
+NCCL_API(ncclResult_t, ncclCommReconfigure, ncclComm_t comm, int nranks, ncclUniqueId commId, int myrank, ncclComm_t* newcomm, ncclConfig_t* config);
+ncclResult_t ncclCommReconfigure(ncclComm_t comm, int nranks, ncclUniqueId commId, int myrank, ncclComm_t* newcomm, ncclConfig_t* config) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  int cudaDev;
+  ncclResult_t ret = ncclSuccess;
+  ncclConfig_t internalConfig = NCCL_CONFIG_INITIALIZER;
+  ncclConfig_t *internalConfigPtr = NULL;
+  NCCLCHECK(ncclGroupStartInternal());
+
+  (void)ncclCudaLibraryInit();
+  if (comm) {
+    NCCLCHECKGOTO(CommCheck(comm, "CommReconfigure", "comm"), ret, fail);
+    NCCLCHECKGOTO(ncclCommEnsureReady(comm), ret, fail);
+    cudaDev = comm->cudaDev;
+    CUDACHECKGOTO(cudaSetDevice(cudaDev), ret, fail);
+  } else {
+    CUDACHECKGOTO(cudaGetDevice(&cudaDev), ret, fail);
+  }
+
+  if (config != NULL)
+    internalConfigPtr = config;
+  else if (comm != NULL)
+    internalConfigPtr = &comm->config;
+  else
+    internalConfigPtr = &internalConfig;
+  NCCLCHECKGOTO(ncclCommInitRankDev(newcomm, nranks, 1, &commId, myrank, cudaDev, internalConfigPtr, comm), ret, fail);
 
 exit:
   ncclGroupErrCheck(ret);
@@ -1949,9 +2567,13 @@ static ncclResult_t commDestroySync(struct ncclAsyncJob* job_) {
   TRACE(NCCL_INIT, "Destroying comm %p rank %d abortFlag %d asyncResult %d", comm, comm->rank, *comm->abortFlag, comm->asyncResult);
 
   if (comm->initState == ncclSuccess) {
+    NCCLCHECKGOTO(ncclResidentKernelStop(comm), ret, fail);
     NCCLCHECKGOTO(ncclStrongStreamSynchronize(&comm->sharedRes->hostStream), ret, fail);
     NCCLCHECKGOTO(ncclStrongStreamSynchronize(&comm->sharedRes->deviceStream), ret, fail);
+    NCCLCHECKGOTO(ncclProxyDoorbellStop(comm), ret, fail);
+    NCCLCHECKGOTO(ncclProfilingDeviceDrain(comm), ret, fail);
   }
+  if (comm->devProfileEvents) ncclProfilingDeviceDetach();
   NCCLCHECKGOTO(ncclCommPollCallbacks(comm, false), ret, fail);
   // And keep polling until all graphs referencing us die.
   while (comm->persistentRefs != 0) {
@@ -1978,11 +2600,25 @@ static ncclResult_t commCleanup(ncclComm_t comm) {
     CUDACHECK(cudaSetDevice(commDevice));
   }
 
+  NCCLCHECK(ncclMetricsDeregister(comm));
+  NCCLCHECK(ncclGpuShareDeregister(comm));
+  NCCLCHECK(ncclTunerTimingFree(comm));
+  NCCLCHECK(ncclAutotuneFree(comm));
+  NCCLCHECK(ncclContentionFree(comm));
+  NCCLCHECK(ncclStragglerFree(comm));
+  NCCLCHECK(ncclCeCollFree(comm));
+  NCCLCHECK(ncclPlanCacheFree(comm));
+  NCCLCHECK(ncclWorkPoolFree(comm));
   if (comm->tuner != NULL) {
     NCCLCHECK(comm->tuner->destroy(comm->tunerContext));
     NCCLCHECK(ncclTunerPluginUnload(&comm->tuner));
   }
 
+  if (comm->profiler != NULL) {
+    NCCLCHECK(comm->profiler->destroy(comm->profilerContext));
+    NCCLCHECK(ncclProfilerPluginUnload(&comm->profiler));
+  }
+
   NCCLCHECK(commFree(comm));
 
   if (savedDevice != commDevice) {
@@ -2043,6 +2679,102 @@ fail:
   goto exit;
 }
 
+int64_t ncclParamTeardownParallel();
+// Free the local resources of communicators after ncclCommDestroy returned.
+// Pending teardowns are joined by the next communicator init and at exit.
+NCCL_PARAM(TeardownAsync, "TEARDOWN_ASYNC", 0);
+
+struct commTeardownThread {
+  struct commTeardownThread* next;
+  pthread_t thread;
+};
+static pthread_mutex_t teardownLock = PTHREAD_MUTEX_INITIALIZER;
+static struct commTeardownThread* teardownThreads = NULL;
+static bool teardownAtExit = false;
+
+struct commCleanupJob {
+  ncclComm_t comm;
+  ncclResult_t ret;
+};
+
+static void* commCleanupMain(void* arg) {
+  struct commCleanupJob* job = (struct commCleanupJob*)arg;
+  int rank = job->comm->rank;
+  void* comm = job->comm;
+  if ((job->ret = commCleanup(job->comm)) != ncclSuccess) {
+    WARN("commReclaim: cleanup comm %p rank %d failed in destroy/abort, error %d", comm, rank, job->ret);
+  }
+  return NULL;
+}
+
+// Frees the local resources of all communicators of the process listed from
+// intracomm0, each on its own thread with NCCL_TEARDOWN_PARALLEL.
+static ncclResult_t commCleanupAll(ncclComm_t intracomm0) {
+  ncclResult_t ret = ncclSuccess;
+  struct commCleanupJob* jobs = NULL;
+  pthread_t* threads = NULL;
+  int n = 0;
+  for (ncclComm_t c = intracomm0; c; c = c->intraNext) n++;
+  // Comms are freed as we go, so list them first
+  NCCLCHECK(ncclCalloc(&jobs, n));
+  for (int i=0; i<n; i++, intracomm0 = intracomm0->intraNext) jobs[i].comm = intracomm0;
+  if (ncclParamTeardownParallel() && n > 1 && ncclCalloc(&threads, n) == ncclSuccess) {
+    for (int i=0; i<n; i++) {
+      if (pthread_create(threads+i, NULL, commCleanupMain, jobs+i) != 0) {
+        threads[i] = 0;
+        commCleanupMain(jobs+i);
+      }
+    }
+    for (int i=0; i<n; i++) {
+      if (threads[i]) pthread_join(threads[i], NULL);
+    }
+  } else {
+    for (int i=0; i<n; i++) commCleanupMain(jobs+i);
+  }
+  for (int i=0; i<n; i++) {
+    if (jobs[i].ret != ncclSuccess) ret = jobs[i].ret;
+  }
+  free(jobs);
+  free(threads);
+  return ret;
+}
+
+static void* commCleanupAsync(void* arg) {
+  (void)commCleanupAll((ncclComm_t)arg);
+  return NULL;
+}
+
+// Joins all teardown threads started so far
+static void commTeardownWait() {
+  pthread_mutex_lock(&teardownLock);
+  struct commTeardownThread* t = teardownThreads;
+  teardownThreads = NULL;
+  pthread_mutex_unlock(&teardownLock);
+  while (t) {
+    struct commTeardownThread* next = t->next;
+    pthread_join(t->thread, NULL);
+    free(t);
+    t = next;
+  }
+}
+
+static ncclResult_t commTeardownStart(ncclComm_t intracomm0) {
+  struct commTeardownThread* t;
+  NCCLCHECK(ncclCalloc(&t, 1));
+  if (pthread_create(&t->thread, NULL, commCleanupAsync, intracomm0) != 0) {
+    free(t);
+    return ncclSystemError;
+  }
+  ncclSetThreadName(t->thread, "NCCL Teardown");
+  pthread_mutex_lock(&teardownLock);
+  t->next = teardownThreads;
+  teardownThreads = t;
+  // Registered after CUDA is initialized, so it runs before CUDA tears down
+  if (!teardownAtExit) teardownAtExit = atexit(commTeardownWait) == 0;
+  pthread_mutex_unlock(&teardownLock);
+  return ncclSuccess;
+}
+
 static ncclResult_t commReclaim(ncclComm_t comm) {
   ncclResult_t ret = ncclSuccess;
   ncclResult_t state;
@@ -2108,15 +2840,8 @@ static ncclResult_t commReclaim(ncclComm_t comm) {
       }
 
       /* free local resources. */
-      nextIntraComm = intracomm0;
-      while (nextIntraComm) {
-        curIntraComm = nextIntraComm;
-        curRank = curIntraComm->rank;
-        nextIntraComm = nextIntraComm->intraNext;
-
-        if ((ret = commCleanup(curIntraComm)) != ncclSuccess) {
-          WARN("commReclaim: cleanup comm %p rank %d failed in destroy/abort, error %d", curIntraComm, curRank, ret);
-        }
+      if (!ncclParamTeardownAsync() || commTeardownStart(intracomm0) != ncclSuccess) {
+        ret = commCleanupAll(intracomm0);
       }
     }
   }
@@ -2175,9 +2900,10 @@ ncclResult_t ncclCommAbort(ncclComm_t comm) {
   // Ask anything that might still be running on the device to quit
   childAbortFlag = __atomic_load_n(&comm->childAbortFlag, __ATOMIC_ACQUIRE);
   if (childAbortFlag != NULL) {
-    __atomic_store_n(childAbortFlag, 1, __ATOMIC_RELAXED);
+    ncclChildAbortFlagSet(comm, childAbortFlag);
   }
   __atomic_store_n(comm->abortFlag, 1, __ATOMIC_RELAXED);
+  ncclAbortFlagDevSet(comm->abortFlagDevHost);
   /* init thread must be joined before we destroy the comm,
    * and we should ignore the init error here. */
   ncclCommEnsureReady(comm);
@@ -2209,13 +2935,18 @@ ncclResult_t ncclCommSplit(ncclComm_t comm, int color, int key, ncclComm_t *newc
     if (comm->config.splitShare) {
       childComm->abortFlag = comm->abortFlag;
       childComm->abortFlagRefCount = comm->abortFlagRefCount;
+      childComm->abortFlagDev = comm->abortFlagDev;
+      childComm->abortFlagDevHost = comm->abortFlagDevHost;
+      childComm->abortFlagDevGdrHandle = comm->abortFlagDevGdrHandle;
       comm->childAbortFlag = NULL;
+      comm->childAbortFlagDevHost = NULL;
       ncclAtomicRefCountIncrement(comm->abortFlagRefCount);
     } else {
       NCCLCHECKGOTO(ncclCudaHostCalloc((uint32_t**)&childComm->abortFlag, 1), res, fail);
       NCCLCHECKGOTO(ncclCalloc((uint32_t**)&childComm->abortFlagRefCount, 1), res, fail);
       /* temporarily used to abort everything during child comm init. */
       comm->childAbortFlag = childComm->abortFlag;
+      comm->childAbortFlagDevHost = NULL;
       *childComm->abortFlagRefCount = 1;
     }
     if (config == NULL) {
@@ -2326,9 +3057,221 @@ ncclResult_t ncclCommUserRank(const ncclComm_t comm, int* rank) {
   return ncclSuccess;
 }
 
+NCCL_API(ncclResult_t, ncclCommSuggestRankOrder, const ncclComm_t comm, int* order);
+ncclResult_t ncclCommSuggestRankOrder(const ncclComm_t comm, int* order) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+
+  NCCLCHECK(CommCheck(comm, "CommSuggestRankOrder", "comm"));
+  NCCLCHECK(PtrCheck(order, "CommSuggestRankOrder", "order"));
+
+  NCCLCHECK(ncclCommEnsureReady(comm));
+
+  memcpy(order, comm->suggestedRankOrder, comm->nRanks*sizeof(int));
+  return ncclSuccess;
+}
+
+static uint64_t statsLoad(uint64_t* counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+NCCL_API(ncclResult_t, ncclCommGetStats, const ncclComm_t comm, ncclCommStats_t* stats);
+ncclResult_t ncclCommGetStats(const ncclComm_t comm, ncclCommStats_t* stats) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+
+  NCCLCHECK(CommCheck(comm, "CommGetStats", "comm"));
+  NCCLCHECK(PtrCheck(stats, "CommGetStats", "stats"));
+
+  memset(stats, 0, sizeof(*stats));
+  for (int f=0; f<NCCL_STATS_NUM_FUNCS; f++) {
+    stats->funcOps[f] = statsLoad(comm->stats.funcOps+f);
+    stats->funcBytes[f] = statsLoad(comm->stats.funcBytes+f);
+  }
+  for (int t=0; t<NCCL_STATS_NUM_TRANSPORTS; t++) stats->transportBytes[t] = statsLoad(comm->stats.transportBytes+t);
+  stats->workFifoStalls = statsLoad(&comm->stats.workFifoStalls);
+  stats->workFifoStallNs = statsLoad(&comm->stats.workFifoStallNs);
+  stats->enqueueCalls = statsLoad(&comm->stats.enqueueCalls);
+  stats->enqueueNs = statsLoad(&comm->stats.enqueueNs);
+  stats->arrivalsMeasured = statsLoad(&comm->stats.arrivalsMeasured);
+  stats->arrivalsLast = statsLoad(&comm->stats.arrivalsLast);
+  for (int b=0; b<NCCL_STATS_SKEW_BUCKETS; b++) stats->arrivalSkew[b] = statsLoad(comm->stats.arrivalSkew+b);
+  struct ncclProxyState* proxyState = comm->proxyState;
+  if (proxyState) {
+    for (int d=0; d<NCCL_STATS_MAX_NET_DEVS; d++) {
+      stats->netSendBytes[d] = statsLoad(proxyState->stats.netSendBytes+d);
+      stats->netRecvBytes[d] = statsLoad(proxyState->stats.netRecvBytes+d);
+    }
+    stats->proxyActiveNs = statsLoad(&proxyState->stats.activeNs);
+    stats->proxyIdleNs = statsLoad(&proxyState->stats.idleNs);
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t opHandleCheck(const ncclComm_t comm, const char* opname) {
+  NCCLCHECK(CommCheck(comm, opname, "comm"));
+  if (comm->opDone == nullptr) {
+    WARN("%s: operation handles are not enabled on comm %p, set NCCL_OP_HANDLES=1", opname, comm);
+    return ncclInvalidUsage;
+  }
+  return ncclSuccess;
+}
+
+// The GPU writes the low 32 bits of the launch count, see opDoneWrite()
+static bool opHandleDone(const ncclComm_t comm, uint64_t handle) {
+  uint32_t done = __atomic_load_n(comm->opDone, __ATOMIC_ACQUIRE);
+  return (int32_t)(done - (uint32_t)handle) >= 0;
+}
+
+NCCL_API(ncclResult_t, ncclCommGetOpHandle, const ncclComm_t comm, uint64_t* handle);
+ncclResult_t ncclCommGetOpHandle(const ncclComm_t comm, uint64_t* handle) {
+  NCCLCHECK(opHandleCheck(comm, "CommGetOpHandle"));
+  NCCLCHECK(PtrCheck(handle, "CommGetOpHandle", "handle"));
+  struct ncclTasks* tasks = &comm->tasks;
+  bool pending = tasks->nTasksColl + tasks->nTasksP2p + tasks->nTasksCe > 0;
+  *handle = comm->opLaunched + (pending ? 1 : 0);
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommOpTest, const ncclComm_t comm, uint64_t handle, int* done);
+ncclResult_t ncclCommOpTest(const ncclComm_t comm, uint64_t handle, int* done) {
+  NCCLCHECK(opHandleCheck(comm, "CommOpTest"));
+  NCCLCHECK(PtrCheck(done, "CommOpTest", "done"));
+  *done = opHandleDone(comm, handle) ? 1 : 0;
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommOpWait, const ncclComm_t comm, uint64_t handle);
+ncclResult_t ncclCommOpWait(const ncclComm_t comm, uint64_t handle) {
+  NCCLCHECK(opHandleCheck(comm, "CommOpWait"));
+  while (!opHandleDone(comm, handle)) {
+    ncclResult_t asyncError;
+    if (__atomic_load_n(comm->abortFlag, __ATOMIC_RELAXED)) return ncclInternalError;
+    NCCLCHECK(ncclCommGetAsyncError(comm, &asyncError));
+    if (asyncError != ncclSuccess && asyncError != ncclInProgress) return asyncError;
+    sched_yield();
+  }
+  return ncclSuccess;
+}
+
+static void memStatsAdd(ncclCommMemStats_t* stats, struct ncclMemStats* memStats) {
+  for (int c=0; c<NCCL_MEM_NUM_CATEGORIES; c++) {
+    stats->deviceBytes[c] += statsLoad(memStats->deviceBytes+c);
+    stats->hostBytes[c] += statsLoad(memStats->hostBytes+c);
+  }
+  for (int t=0; t<NCCL_STATS_NUM_TRANSPORTS; t++) stats->transportBytes[t] += statsLoad(memStats->transportBytes+t);
+}
+
+NCCL_API(ncclResult_t, ncclCommGetMemStats, const ncclComm_t comm, ncclCommMemStats_t* stats, uint64_t* peerBytes);
+ncclResult_t ncclCommGetMemStats(const ncclComm_t comm, ncclCommMemStats_t* stats, uint64_t* peerBytes) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+
+  NCCLCHECK(CommCheck(comm, "CommGetMemStats", "comm"));
+  NCCLCHECK(PtrCheck(stats, "CommGetMemStats", "stats"));
+
+  memset(stats, 0, sizeof(*stats));
+  memStatsAdd(stats, &comm->memStats);
+  struct ncclProxyState* proxyState = comm->proxyState;
+  if (proxyState) memStatsAdd(stats, &proxyState->memStats);
+  for (int c=0; c<NCCL_MEM_NUM_CATEGORIES; c++) {
+    stats->totalDeviceBytes += stats->deviceBytes[c];
+    stats->totalHostBytes += stats->hostBytes[c];
+  }
+  if (peerBytes) {
+    for (int r=0; r<comm->nRanks; r++) {
+      peerBytes[r] = statsLoad(comm->memStats.peerBytes+r);
+      int tpRank = comm->topParentRanks[r];
+      if (proxyState && tpRank < proxyState->memStats.nPeers) peerBytes[r] += statsLoad(proxyState->memStats.peerBytes+tpRank);
+    }
+  }
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommGetInitStats, const ncclComm_t comm, ncclCommInitStats_t* stats);
+ncclResult_t ncclCommGetInitStats(const ncclComm_t comm, ncclCommInitStats_t* stats) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+
+  NCCLCHECK(CommCheck(comm, "CommGetInitStats", "comm"));
+  NCCLCHECK(PtrCheck(stats, "CommGetInitStats", "stats"));
+  NCCLCHECK(ncclCommEnsureReady(comm));
+
+  memcpy(stats, &comm->initStats.times, sizeof(*stats));
+  return ncclSuccess;
+}
+
+static uint64_t memStatsDeviceBytes(struct ncclComm* comm) {
+  ncclCommMemStats_t stats;
+  if (ncclCommGetMemStats(comm, &stats, NULL) != ncclSuccess) return 0;
+  return stats.totalDeviceBytes;
+}
+
+NCCL_API(ncclResult_t, ncclCommShrink, ncclComm_t comm, int policy);
+ncclResult_t ncclCommShrink(ncclComm_t comm, int policy) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  ncclResult_t ret = ncclSuccess;
+  int oldDev = -1;
+  uint64_t bytesBefore;
+  bool p2p, coll;
+
+  NCCLCHECK(CommCheck(comm, "CommShrink", "comm"));
+  NCCLCHECK(ncclCommEnsureReady(comm));
+  if (policy & ~NCCL_SHRINK_ALL) {
+    WARN("ncclCommShrink: invalid policy %x", policy);
+    return ncclInvalidArgument;
+  }
+  if (ncclGroupDepth > 0 || comm->tasks.nTasksColl || comm->tasks.nTasksP2p || comm->tasks.nTasksCe) {
+    WARN("ncclCommShrink: cannot be called with operations pending in a group");
+    return ncclInvalidUsage;
+  }
+  if (comm->sharedRes->owner != comm || comm->sharedRes->refCount > 1) {
+    WARN("ncclCommShrink: communicator shares its resources (splitShare) with other communicators");
+    return ncclInvalidUsage;
+  }
+  if (comm->nRanks == 1) return ncclSuccess;
+
+  // CollNet uses both connection indexes and NVLS trees the collective one,
+  // and they are not connected again at runtime.
+  p2p = (policy & NCCL_SHRINK_P2P) && comm->collNetSupport == 0;
+  coll = (policy & NCCL_SHRINK_COLL) && comm->collNetSupport == 0 && !(comm->nvlsSupport && comm->nNodes > 1);
+  if (!p2p && (policy & NCCL_SHRINK_P2P)) INFO(NCCL_INIT, "ncclCommShrink: point-to-point connections are kept, CollNet uses them");
+  if (!coll && (policy & NCCL_SHRINK_COLL)) INFO(NCCL_INIT, "ncclCommShrink: ring and tree connections are kept, CollNet or NVLS trees use them");
+
+  bytesBefore = memStatsDeviceBytes(comm);
+  CUDACHECK(cudaGetDevice(&oldDev));
+  CUDACHECKGOTO(cudaSetDevice(comm->cudaDev), ret, fail);
+  // Make sure no rank still has operations using our buffers
+  NCCLCHECKGOTO(bootstrapBarrier(comm->bootstrap, comm->rank, comm->nRanks, 0), ret, fail);
+  if (p2p) NCCLCHECKGOTO(ncclTransportP2pRelease(comm, 1), ret, fail);
+  if (coll) {
+    NCCLCHECKGOTO(ncclTransportP2pRelease(comm, 0), ret, fail);
+    // Connected again by the next collectives using them
+    comm->runtimeConn = true;
+    comm->collConnected[NCCL_ALGO_RING] = comm->collConnected[NCCL_ALGO_RING_SCATTER] = false;
+    comm->collConnected[NCCL_ALGO_TREE] = false;
+    if (comm->hierSupport) comm->collConnected[NCCL_ALGO_HIER] = false;
+    if (comm->recDblSupport) comm->collConnected[NCCL_ALGO_RECDBL] = false;
+  }
+  INFO(NCCL_INIT, "comm %p rank %d shrunk (policy %x), device memory %lu -> %lu bytes",
+      comm, comm->rank, policy, bytesBefore, memStatsDeviceBytes(comm));
+
+exit:
+  if (oldDev != -1) CUDACHECK(cudaSetDevice(oldDev));
+  return ret;
+fail:
+  goto exit;
+}
+
 NCCL_API(ncclResult_t, ncclMemAlloc, void **ptr, size_t size);
 ncclResult_t  ncclMemAlloc(void **ptr, size_t size) {
   NVTX3_FUNC_RANGE_IN(nccl_domain);
+  if (ptr != NULL && size != 0) {
+    NCCLCHECK(ncclMemPoolAlloc(ptr, size));
+    if (*ptr != NULL) return ncclSuccess;
+  }
+  NCCLCHECK(ncclMemAllocDirect(ptr, size));
+  NCCLCHECK(ncclRegTrackMemAlloc(*ptr, size));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclMemAllocDirect(void **ptr, size_t size) {
   ncclResult_t ret = ncclSuccess;
 
 #if CUDART_VERSION >= 12010
@@ -2406,6 +3349,14 @@ fail:
 NCCL_API(ncclResult_t, ncclMemFree, void *ptr);
 ncclResult_t  ncclMemFree(void *ptr) {
   NVTX3_FUNC_RANGE_IN(nccl_domain);
+  bool pooled;
+  NCCLCHECK(ncclMemPoolFree(ptr, &pooled));
+  if (pooled) return ncclSuccess;
+  NCCLCHECK(ncclRegUntrackMemAlloc(ptr));
+  return ncclMemFreeDirect(ptr);
+}
+
+ncclResult_t ncclMemFreeDirect(void *ptr) {
   ncclResult_t ret = ncclSuccess;
   int saveDevice;
 
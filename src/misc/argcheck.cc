@@ -66,16 +66,32 @@ ncclResult_t ArgsCheck(struct ncclInfo* info) {
     return ncclInvalidArgument;
   }
 
+  if (info->coll == ncclFuncAllToAll) {
+    if (info->sendcounts) {
+      NCCLCHECK(PtrCheck((void*)info->sendcounts, info->opName, "sendcounts"));
+      NCCLCHECK(PtrCheck((void*)info->sdispls, info->opName, "sdispls"));
+      NCCLCHECK(PtrCheck((void*)info->recvcounts, info->opName, "recvcounts"));
+      NCCLCHECK(PtrCheck((void*)info->rdispls, info->opName, "rdispls"));
+    }
+    if (info->sendbuff == info->recvbuff && info->sendbuff != nullptr) {
+      WARN("%s : in-place operation is not supported", info->opName);
+      return ncclInvalidArgument;
+    }
+  }
+
   if (info->comm->checkPointers) {
     if ((info->coll == ncclFuncSend || info->coll == ncclFuncRecv)) {
       if (info->count >0)
         NCCLCHECK(CudaPtrCheck(info->recvbuff, info->comm, "buff", info->opName));
+      if (info->devCount)
+        NCCLCHECK(CudaPtrCheck(info->devCount, info->comm, "devCount", info->opName));
     } else {
       // Check CUDA device pointers
-      if (info->coll != ncclFuncBroadcast || info->comm->rank == info->root) {
+      bool isRoot = info->comm->rank == info->root;
+      if ((info->coll != ncclFuncBroadcast && info->coll != ncclFuncScatter) || isRoot) {
         NCCLCHECK(CudaPtrCheck(info->sendbuff, info->comm, "sendbuff", info->opName));
       }
-      if (info->coll != ncclFuncReduce || info->comm->rank == info->root) {
+      if ((info->coll != ncclFuncReduce && info->coll != ncclFuncGather) || isRoot) {
         NCCLCHECK(CudaPtrCheck(info->recvbuff, info->comm, "recvbuff", info->opName));
       }
     }
@@ -0,0 +1,227 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "autotune.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "enqueue.h"
+#include "param.h"
+#include <stdio.h>
+#include <unistd.h>
+
+NCCL_PARAM(Autotune, "AUTOTUNE", 0);
+
+#define AUTOTUNE_NOENTRY (-2)
+
+// Results learned by a communicator only apply to communicators of the same
+// shape, which the file records with each entry.
+static void autotuneKey(struct ncclComm* comm, int* key) {
+  key[0] = comm->nRanks;
+  key[1] = comm->nNodes;
+  key[2] = comm->collChannels;
+}
+
+static ncclResult_t autotuneLoad(struct ncclComm* comm, const char* path, int* table) {
+  for (int i=0; i<NCCL_NUM_FUNCTIONS*NCCL_AUTOTUNE_BUCKETS; i++) table[3*i] = AUTOTUNE_NOENTRY;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    INFO(NCCL_TUNING, "Autotune: could not open %s, starting from scratch", path);
+    return ncclSuccess;
+  }
+  int key[3];
+  autotuneKey(comm, key);
+  char line[256];
+  int nEntries = 0;
+  while (fgets(line, sizeof(line), file)) {
+    int k[3], coll, bucket, a, p, nc;
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%d %d %d %d %d %d %d %d", k, k+1, k+2, &coll, &bucket, &a, &p, &nc) != 8) continue;
+    if (k[0] != key[0] || k[1] != key[1] || k[2] != key[2]) continue;
+    if (coll < 0 || coll >= NCCL_NUM_FUNCTIONS || bucket < 0 || bucket >= NCCL_AUTOTUNE_BUCKETS) continue;
+    if (a < NCCL_ALGO_UNDEF || a >= NCCL_NUM_ALGORITHMS || p < NCCL_PROTO_UNDEF || p >= NCCL_NUM_PROTOCOLS || nc < 0) continue;
+    int* entry = table + 3*(coll*NCCL_AUTOTUNE_BUCKETS+bucket);
+    entry[0] = a; entry[1] = p; entry[2] = nc;
+    nEntries++;
+  }
+  fclose(file);
+  INFO(NCCL_TUNING, "Autotune: loaded %d entries from %s", nEntries, path);
+  return ncclSuccess;
+}
+
+// Rewrite the file with our entries, keeping those of other communicator shapes.
+static ncclResult_t autotuneSave(struct ncclComm* comm, const char* path) {
+  int key[3];
+  autotuneKey(comm, key);
+  char tmpPath[PATH_MAX];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, getpid());
+  FILE* out = fopen(tmpPath, "w");
+  if (out == NULL) {
+    WARN("Autotune: could not open %s for writing : %s", tmpPath, strerror(errno));
+    return ncclSystemError;
+  }
+  fprintf(out, "# nRanks nNodes nChannels coll sizeLog2 algorithm protocol nChannels\n");
+  FILE* in = fopen(path, "r");
+  if (in) {
+    char line[256];
+    while (fgets(line, sizeof(line), in)) {
+      int k[3];
+      if (line[0] == '#' || sscanf(line, "%d %d %d", k, k+1, k+2) != 3) continue;
+      if (k[0] == key[0] && k[1] == key[1] && k[2] == key[2]) continue;
+      fputs(line, out);
+    }
+    fclose(in);
+  }
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int b=0; b<NCCL_AUTOTUNE_BUCKETS; b++) {
+      struct ncclAutotuneBucket* bucket = comm->autotune->buckets[c]+b;
+      if (bucket->state != ncclAutotuneDone) continue;
+      fprintf(out, "%d %d %d %d %d %d %d %d\n", key[0], key[1], key[2], c, b, bucket->algorithm, bucket->protocol, bucket->nChannels);
+    }
+  }
+  fclose(out);
+  if (rename(tmpPath, path) != 0) {
+    WARN("Autotune: could not rename %s to %s : %s", tmpPath, path, strerror(errno));
+    unlink(tmpPath);
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutotuneInit(struct ncclComm* comm) {
+  int iters = ncclParamAutotune();
+  if (iters <= 0 || comm->nRanks == 1) return ncclSuccess;
+  if (comm->tuner != NULL) {
+    INFO(NCCL_TUNING, "Autotune: tuner plugin %s loaded, NCCL_AUTOTUNE ignored", comm->tuner->name);
+    return ncclSuccess;
+  }
+  NCCLCHECK(ncclCalloc(&comm->autotune, 1));
+  comm->autotune->iters = iters;
+
+  const char* path = ncclGetEnv("NCCL_AUTOTUNE_FILE");
+  if (path == NULL) return ncclSuccess;
+  // Only rank 0 reads the file so that all ranks start from the same table.
+  int* table;
+  NCCLCHECK(ncclCalloc(&table, 3*NCCL_NUM_FUNCTIONS*NCCL_AUTOTUNE_BUCKETS));
+  ncclResult_t ret = ncclSuccess;
+  if (comm->rank == 0) NCCLCHECKGOTO(autotuneLoad(comm, path, table), ret, exit);
+  NCCLCHECKGOTO(bootstrapBroadcast(comm->bootstrap, comm->rank, comm->nRanks, 0, table, 3*NCCL_NUM_FUNCTIONS*NCCL_AUTOTUNE_BUCKETS*sizeof(int)), ret, exit);
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int b=0; b<NCCL_AUTOTUNE_BUCKETS; b++) {
+      int* entry = table + 3*(c*NCCL_AUTOTUNE_BUCKETS+b);
+      if (entry[0] == AUTOTUNE_NOENTRY) continue;
+      struct ncclAutotuneBucket* bucket = comm->autotune->buckets[c]+b;
+      bucket->state = ncclAutotuneDone;
+      bucket->algorithm = entry[0];
+      bucket->protocol = entry[1];
+      bucket->nChannels = entry[2];
+    }
+  }
+exit:
+  free(table);
+  return ret;
+}
+
+ncclResult_t ncclAutotuneFree(struct ncclComm* comm) {
+  if (comm->autotune == NULL) return ncclSuccess;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int b=0; b<NCCL_AUTOTUNE_BUCKETS; b++) free(comm->autotune->buckets[c][b].cand);
+  }
+  free(comm->autotune);
+  comm->autotune = NULL;
+  return ncclSuccess;
+}
+
+struct ncclAutotuneBucket* ncclAutotuneGetBucket(struct ncclComm* comm, ncclFunc_t coll, size_t nBytes) {
+  if (comm->autotune == NULL || coll >= NCCL_NUM_FUNCTIONS) return NULL;
+  int b = 0;
+  while (b < NCCL_AUTOTUNE_BUCKETS-1 && (nBytes >> (b+1))) b++;
+  return comm->autotune->buckets[coll]+b;
+}
+
+ncclResult_t ncclAutotuneSyncBuckets(struct ncclComm* comm) {
+  struct ncclAutotune* autotune = comm->autotune;
+  if (autotune == NULL || autotune->nSyncPending == 0) return ncclSuccess;
+  ncclResult_t ret = ncclSuccess;
+  float* all = NULL;
+  int n = 0;
+
+  // Every trial of the buckets being synced was issued before this group, so
+  // their kernels can complete without us.
+  NCCLCHECK(ncclTunerTimingWait(comm));
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int b=0; b<NCCL_AUTOTUNE_BUCKETS; b++) {
+      if (autotune->buckets[c][b].state == ncclAutotuneSync) n += 2*autotune->buckets[c][b].nCand;
+    }
+  }
+  if (n > 0) {
+    NCCLCHECK(ncclCalloc(&all, n*comm->nRanks));
+    float* mine = all + n*comm->rank;
+    for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+      for (int b=0; b<NCCL_AUTOTUNE_BUCKETS; b++) {
+        struct ncclAutotuneBucket* bucket = autotune->buckets[c]+b;
+        if (bucket->state != ncclAutotuneSync) continue;
+        for (int i=0; i<bucket->nCand; i++) {
+          *mine++ = bucket->cand[i].time;
+          *mine++ = bucket->cand[i].count;
+        }
+      }
+    }
+    NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, all, n*sizeof(float)), ret, exit);
+  }
+
+  {
+    int offset = 0;
+    for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+      for (int b=0; b<NCCL_AUTOTUNE_BUCKETS; b++) {
+        struct ncclAutotuneBucket* bucket = autotune->buckets[c]+b;
+        if (bucket->state != ncclAutotuneSync) continue;
+        // All ranks see the same data, hence make the same choice.
+        float bestTime = -1;
+        bucket->algorithm = NCCL_ALGO_UNDEF;
+        bucket->protocol = NCCL_PROTO_UNDEF;
+        bucket->nChannels = 0;
+        for (int i=0; i<bucket->nCand; i++) {
+          float time = 0, count = 0;
+          for (int r=0; r<comm->nRanks; r++) {
+            time += all[r*n+offset+2*i];
+            count += all[r*n+offset+2*i+1];
+          }
+          if (count == 0) continue;
+          time /= count;
+          if (bestTime < 0 || time < bestTime) {
+            bestTime = time;
+            bucket->algorithm = bucket->cand[i].algorithm;
+            bucket->protocol = bucket->cand[i].protocol;
+            bucket->nChannels = bucket->cand[i].nChannels;
+          }
+        }
+        offset += 2*bucket->nCand;
+        if (comm->rank == 0) {
+          if (bucket->algorithm == NCCL_ALGO_UNDEF) {
+            INFO(NCCL_TUNING, "Autotune: %s %ld Bytes bucket, no timing, using default tuning", ncclFuncStr[c], 1L << b);
+          } else {
+            INFO(NCCL_TUNING, "Autotune: %s %ld Bytes bucket -> %s/%s nChannels %d, %.1f us",
+                ncclFuncStr[c], 1L << b, ncclAlgoStr[bucket->algorithm], ncclProtoStr[bucket->protocol], bucket->nChannels, bestTime);
+          }
+        }
+        free(bucket->cand);
+        bucket->cand = NULL;
+        bucket->nCand = 0;
+        bucket->state = ncclAutotuneDone;
+      }
+    }
+  }
+  autotune->nSyncPending = 0;
+
+  if (comm->rank == 0) {
+    const char* path = ncclGetEnv("NCCL_AUTOTUNE_FILE");
+    // Failing to save should not fail the operation.
+    if (path) (void)autotuneSave(comm, path);
+  }
+exit:
+  free(all);
+  return ret;
+}
@@ -0,0 +1,134 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "comm.h"
+#include "graph.h"
+#include "bootstrap.h"
+#include "info.h"
+#include "param.h"
+
+// Time rings and trees at init, and rescale the tuning model to what they achieve.
+NCCL_PARAM(Calibrate, "CALIBRATE", 0);
+NCCL_PARAM(CalibrateBytes, "CALIBRATE_BYTES", 32*1024*1024);
+
+#define CALIBRATE_SMALL_BYTES (8*1024)
+#define CALIBRATE_ITERS 5
+// Don't trust a measurement which disagrees with the model more than that
+#define CALIBRATE_MAX_SCALE 8.0f
+
+#define CALIBRATE_NALGOS 2
+static const int calibrateAlgos[CALIBRATE_NALGOS] = { NCCL_ALGO_RING, NCCL_ALGO_TREE };
+
+static ncclResult_t calibrateTime(struct ncclComm* comm, int algorithm, int protocol, float* buff, size_t nBytes,
+    cudaStream_t stream, cudaEvent_t start, cudaEvent_t stop, float* us) {
+  ncclResult_t ret = ncclSuccess;
+  size_t count = nBytes/sizeof(float);
+  float ms;
+  comm->forceAlgorithm = algorithm;
+  comm->forceProtocol = protocol;
+  // The first call also connects the algorithm with NCCL_RUNTIME_CONNECT
+  NCCLCHECKGOTO(ncclAllReduce(buff, buff, count, ncclFloat, ncclSum, comm, stream), ret, exit);
+  CUDACHECKGOTO(cudaEventRecord(start, stream), ret, exit);
+  for (int i=0; i<CALIBRATE_ITERS; i++) {
+    NCCLCHECKGOTO(ncclAllReduce(buff, buff, count, ncclFloat, ncclSum, comm, stream), ret, exit);
+  }
+  CUDACHECKGOTO(cudaEventRecord(stop, stream), ret, exit);
+  CUDACHECKGOTO(cudaEventSynchronize(stop), ret, exit);
+  CUDACHECKGOTO(cudaEventElapsedTime(&ms, start, stop), ret, exit);
+  *us = ms*1000/CALIBRATE_ITERS;
+exit:
+  comm->forceAlgorithm = NCCL_ALGO_UNDEF;
+  comm->forceProtocol = NCCL_PROTO_UNDEF;
+  return ret;
+}
+
+static ncclResult_t calibrateModelTime(struct ncclComm* comm, int algorithm, int protocol, size_t nBytes, float* us) {
+  struct ncclInfo info;
+  memset(&info, 0, sizeof(info));
+  info.comm = comm;
+  info.coll = ncclFuncAllReduce;
+  info.nBytes = nBytes;
+  return ncclTopoGetAlgoTime(&info, algorithm, protocol, 1, us, NULL);
+}
+
+static float calibrateClamp(float scale) {
+  return std::min(std::max(scale, 1/CALIBRATE_MAX_SCALE), CALIBRATE_MAX_SCALE);
+}
+
+ncclResult_t ncclTopoCalibrateModel(struct ncclComm* comm) {
+  if (ncclParamCalibrate() == 0 || comm->nRanks == 1) return ncclSuccess;
+  if (comm->config.blocking == 0) {
+    INFO(NCCL_INIT|NCCL_TUNING, "Calibration: skipped, not supported on non-blocking communicators");
+    return ncclSuccess;
+  }
+  ncclResult_t ret = ncclSuccess;
+  size_t bytes = ncclParamCalibrateBytes();
+  float* buff = NULL;
+  float* allTimes = NULL;
+  cudaStream_t stream = NULL;
+  cudaEvent_t start = NULL, stop = NULL;
+  // Large SIMPLE and small LL AllReduce times of each algorithm, -1 if it is disabled.
+  // All ranks have the same tuning tables, so they issue the same calls.
+  float times[CALIBRATE_NALGOS][2];
+
+  NCCLCHECKGOTO(ncclCudaCalloc(&buff, bytes/sizeof(float)), ret, exit);
+  CUDACHECKGOTO(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), ret, exit);
+  CUDACHECKGOTO(cudaEventCreate(&start), ret, exit);
+  CUDACHECKGOTO(cudaEventCreate(&stop), ret, exit);
+  for (int i=0; i<CALIBRATE_NALGOS; i++) {
+    int a = calibrateAlgos[i];
+    times[i][0] = times[i][1] = -1;
+    if (comm->bandwidths[ncclFuncAllReduce][a][NCCL_PROTO_SIMPLE] > 0) {
+      NCCLCHECKGOTO(calibrateTime(comm, a, NCCL_PROTO_SIMPLE, buff, bytes, stream, start, stop, &times[i][0]), ret, exit);
+    }
+    if (comm->bandwidths[ncclFuncAllReduce][a][NCCL_PROTO_LL] > 0) {
+      NCCLCHECKGOTO(calibrateTime(comm, a, NCCL_PROTO_LL, buff, CALIBRATE_SMALL_BYTES, stream, start, stop, &times[i][1]), ret, exit);
+    }
+  }
+
+  // Use the slowest rank's times, so that all ranks rescale their tables the same way
+  NCCLCHECKGOTO(ncclCalloc(&allTimes, comm->nRanks*CALIBRATE_NALGOS*2), ret, exit);
+  memcpy(allTimes+comm->rank*CALIBRATE_NALGOS*2, times, sizeof(times));
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, allTimes, sizeof(times)), ret, exit);
+  for (int r=0; r<comm->nRanks; r++) {
+    for (int i=0; i<CALIBRATE_NALGOS; i++) {
+      for (int s=0; s<2; s++) times[i][s] = std::max(times[i][s], allTimes[(r*CALIBRATE_NALGOS+i)*2+s]);
+    }
+  }
+
+  for (int i=0; i<CALIBRATE_NALGOS; i++) {
+    int a = calibrateAlgos[i];
+    float model[2] = { -1, -1 };
+    float bwScale = 1, latScale = 1;
+    if (times[i][0] > 0) {
+      NCCLCHECKGOTO(calibrateModelTime(comm, a, NCCL_PROTO_SIMPLE, bytes, &model[0]), ret, exit);
+      if (model[0] > 0) bwScale = calibrateClamp(model[0]/times[i][0]);
+    }
+    if (times[i][1] > 0) {
+      NCCLCHECKGOTO(calibrateModelTime(comm, a, NCCL_PROTO_LL, CALIBRATE_SMALL_BYTES, &model[1]), ret, exit);
+      if (model[1] > 0) latScale = calibrateClamp(times[i][1]/model[1]);
+    }
+    for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+      for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+        comm->bandwidths[c][a][p] *= bwScale;
+        comm->latencies[c][a][p] *= latScale;
+        if (a == NCCL_ALGO_RING) comm->ringbdw[c][p] *= bwScale;
+      }
+    }
+    if (comm->rank == 0) {
+      INFO(NCCL_INIT|NCCL_TUNING, "Calibration: %s took %.1f us for %ld bytes (model %.1f) and %.1f us for %d bytes (model %.1f), bandwidth x%.2f latency x%.2f",
+          ncclAlgoStr[a], times[i][0], bytes, model[0], times[i][1], CALIBRATE_SMALL_BYTES, model[1], bwScale, latScale);
+    }
+  }
+
+exit:
+  free(allTimes);
+  if (stop) CUDACHECK(cudaEventDestroy(stop));
+  if (start) CUDACHECK(cudaEventDestroy(start));
+  if (stream) CUDACHECK(cudaStreamDestroy(stream));
+  if (buff) NCCLCHECK(ncclCudaFree(buff));
+  return ret;
+}
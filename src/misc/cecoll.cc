@@ -0,0 +1,387 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "cecoll.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "cudawrap.h"
+#include "transport.h"
+#include "param.h"
+#include "register.h"
+#include "device.h"
+
+NCCL_PARAM(CeCollThreshold, "CE_COLL_THRESHOLD", 0);
+NCCL_PARAM(CeCollNStreams, "CE_COLL_NSTREAMS", 4);
+NCCL_PARAM(DirectCollThreshold, "DIRECT_COLL_THRESHOLD", 0);
+NCCL_PARAM(DirectAllReduceMaxBytes, "DIRECT_ALLREDUCE_MAX_BYTES", 0);
+NCCL_PARAM(DirectAllReduceTwoShot, "DIRECT_ALLREDUCE_TWO_SHOT", 65536);
+
+#define CE_MAX_STREAMS 8
+// Peer buffers stay mapped between calls, as long as they are among the last
+// CE_IPC_CACHE_SIZE ones used.
+#define CE_IPC_CACHE_SIZE 16
+#define CE_NPHASES 3
+
+struct ncclCeIpcEntry {
+  cudaIpcMemHandle_t handle;
+  void* base; // NULL if unused
+  uint64_t lastUsed;
+};
+
+struct ncclCeColl {
+  int nStreams;
+  cudaStream_t streams[CE_MAX_STREAMS];
+  cudaEvent_t fork;
+  cudaEvent_t join[CE_MAX_STREAMS];
+  // flags[phase*NCCL_MAX_LOCAL_RANKS+p] is written by local rank p when it
+  // reached that phase of our call number seq.
+  uint32_t* flags;
+  uint32_t* peerFlags[NCCL_MAX_LOCAL_RANKS];
+  // Direct AllReduce: every rank copies its input to its scratch buffer,
+  // which the others have mapped.
+  void* scratch;
+  void* peerScratch[NCCL_MAX_LOCAL_RANKS];
+  uint32_t seq;
+  uint64_t clock;
+  struct ncclCeIpcEntry cache[NCCL_MAX_LOCAL_RANKS][CE_IPC_CACHE_SIZE];
+};
+
+// What one rank exports when setting up
+struct ncclCeSetupDesc {
+  cudaIpcMemHandle_t flags;
+  cudaIpcMemHandle_t scratch;
+  int hasScratch;
+};
+
+// Buffer one rank exports for one collective
+struct ncclCeBuffDesc {
+  int valid;
+  cudaIpcMemHandle_t handle;
+  size_t offset;
+};
+
+static bool ceCollUsable(struct ncclComm* comm, bool alone) {
+  return (ncclParamCeCollThreshold() > 0 || ncclParamDirectCollThreshold() > 0 || ncclParamDirectAllReduceMaxBytes() > 0) && alone && comm->nNodes == 1 && comm->nRanks > 1 &&
+         comm->intraRanks == 1 && comm->intraHighestTransportType == TRANSPORT_P2P &&
+         !ncclCudaGraphValid(comm->tasks.capturingGraph) &&
+         CUPFN(cuStreamWriteValue32) != nullptr && CUPFN(cuStreamWaitValue32) != nullptr &&
+         CUPFN(cuMemGetAddressRange) != nullptr;
+}
+
+// AllGather and ReduceScatter of at least NCCL_DIRECT_COLL_THRESHOLD bytes
+// whose send buffers are registered on every rank read the peer send buffers
+// directly, AllGather with the copy engines and ReduceScatter with a kernel
+// reducing the slices of all ranks at once. Only depends on what all ranks
+// agree on; registration is checked when exporting.
+static bool ceCollDirect(struct ncclComm* comm, struct ncclInfo* info) {
+  size_t nBytes = info->count*ncclTypeSize(info->datatype)*comm->nRanks;
+  if (ncclParamDirectCollThreshold() <= 0 || nBytes == 0 || nBytes < (size_t)ncclParamDirectCollThreshold()) return false;
+  if (info->castInput || info->castOutput) return false;
+  if (info->coll == ncclFuncAllGather) return true;
+  return info->coll == ncclFuncReduceScatter && !info->opFull.scalarArgIsPtr &&
+         (info->opFull.op == ncclDevSum || info->opFull.op == ncclDevProd || info->opFull.op == ncclDevMinMax);
+}
+
+// AllReduce of at most NCCL_DIRECT_ALLREDUCE_MAX_BYTES goes through the scratch
+// buffers, one-shot below NCCL_DIRECT_ALLREDUCE_TWO_SHOT bytes and two-shot
+// from there: the latency of a handful of kernels and flag writes instead of
+// the 2*(nRanks-1) steps of the ring.
+static bool ceCollAllReduce(struct ncclComm* comm, struct ncclInfo* info) {
+  size_t nBytes = info->count*ncclTypeSize(info->datatype);
+  if (info->coll != ncclFuncAllReduce || nBytes == 0 || nBytes > (size_t)ncclParamDirectAllReduceMaxBytes()) return false;
+  if (info->castInput || info->castOutput) return false;
+  return !info->opFull.scalarArgIsPtr &&
+         (info->opFull.op == ncclDevSum || info->opFull.op == ncclDevProd || info->opFull.op == ncclDevMinMax);
+}
+
+static bool ceCollCopy(struct ncclComm* comm, struct ncclInfo* info) {
+  if (ncclParamCeCollThreshold() <= 0) return false;
+  size_t nBytes = info->count*ncclTypeSize(info->datatype);
+  if (info->coll == ncclFuncAllGather) nBytes *= comm->nRanks;
+  else if (info->coll != ncclFuncBroadcast) return false;
+  return nBytes != 0 && nBytes >= (size_t)ncclParamCeCollThreshold();
+}
+
+static bool ceCollCandidate(struct ncclComm* comm, struct ncclInfo* info) {
+  return ceCollDirect(comm, info) || ceCollCopy(comm, info) || ceCollAllReduce(comm, info);
+}
+
+static ncclResult_t ceCollSetup(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclCeColl* ce;
+  struct ncclCeSetupDesc* descs = nullptr;
+  NCCLCHECK(ncclCalloc(&ce, 1));
+  comm->ceColl = ce;
+  ce->nStreams = std::max(1, std::min<int>(CE_MAX_STREAMS, ncclParamCeCollNStreams()));
+  for (int s=0; s < ce->nStreams; s++) {
+    CUDACHECK(cudaStreamCreateWithFlags(&ce->streams[s], cudaStreamNonBlocking));
+    CUDACHECK(cudaEventCreateWithFlags(&ce->join[s], cudaEventDisableTiming));
+  }
+  CUDACHECK(cudaEventCreateWithFlags(&ce->fork, cudaEventDisableTiming));
+  // Allocated with cudaMalloc so that it can be exported with cudaIpcGetMemHandle.
+  CUDACHECK(cudaMalloc(&ce->flags, CE_NPHASES*NCCL_MAX_LOCAL_RANKS*sizeof(uint32_t)));
+  CUDACHECK(cudaMemsetAsync(ce->flags, 0, CE_NPHASES*NCCL_MAX_LOCAL_RANKS*sizeof(uint32_t), ce->streams[0]));
+  CUDACHECK(cudaStreamSynchronize(ce->streams[0]));
+  // Room for one 16 byte alignment pad per two-shot slice
+  if (ncclParamDirectAllReduceMaxBytes() > 0) CUDACHECK(cudaMalloc(&ce->scratch, ncclParamDirectAllReduceMaxBytes() + NCCL_MAX_LOCAL_RANKS*16));
+
+  NCCLCHECK(ncclCalloc(&descs, comm->localRanks));
+  CUDACHECKGOTO(cudaIpcGetMemHandle(&descs[comm->localRank].flags, ce->flags), ret, exit);
+  if (ce->scratch) {
+    CUDACHECKGOTO(cudaIpcGetMemHandle(&descs[comm->localRank].scratch, ce->scratch), ret, exit);
+    descs[comm->localRank].hasScratch = 1;
+  }
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, descs, sizeof(struct ncclCeSetupDesc)), ret, exit);
+  for (int p=0; p < comm->localRanks; p++) {
+    if (p == comm->localRank) continue;
+    CUDACHECKGOTO(cudaIpcOpenMemHandle((void**)&ce->peerFlags[p], descs[p].flags, cudaIpcMemLazyEnablePeerAccess), ret, exit);
+    if (descs[p].hasScratch) CUDACHECKGOTO(cudaIpcOpenMemHandle(&ce->peerScratch[p], descs[p].scratch, cudaIpcMemLazyEnablePeerAccess), ret, exit);
+  }
+  INFO(NCCL_INIT, "Copy engine AllGather/Broadcast enabled from %ld bytes, direct AllGather/ReduceScatter from %ld bytes, direct AllReduce up to %ld bytes, %d streams",
+       ncclParamCeCollThreshold(), ncclParamDirectCollThreshold(), ncclParamDirectAllReduceMaxBytes(), ce->nStreams);
+exit:
+  free(descs);
+  return ret;
+}
+
+// Returns the address of desc in the memory of local rank peer.
+static ncclResult_t ceIpcMap(struct ncclComm* comm, int peer, struct ncclCeBuffDesc* desc, void** ptr) {
+  struct ncclCeColl* ce = comm->ceColl;
+  struct ncclCeIpcEntry* cache = ce->cache[peer];
+  struct ncclCeIpcEntry* entry = cache;
+  ce->clock++;
+  for (int i=0; i < CE_IPC_CACHE_SIZE; i++) {
+    if (cache[i].base != nullptr && memcmp(&cache[i].handle, &desc->handle, sizeof(cudaIpcMemHandle_t)) == 0) {
+      cache[i].lastUsed = ce->clock;
+      *ptr = (char*)cache[i].base + desc->offset;
+      return ncclSuccess;
+    }
+    if (cache[i].lastUsed < entry->lastUsed) entry = cache+i;
+  }
+  if (entry->base != nullptr) {
+    // Copies from the mapping we evict may still be in flight.
+    for (int s=0; s < ce->nStreams; s++) CUDACHECK(cudaStreamSynchronize(ce->streams[s]));
+    CUDACHECK(cudaIpcCloseMemHandle(entry->base));
+    entry->base = nullptr;
+  }
+  CUDACHECK(cudaIpcOpenMemHandle(&entry->base, desc->handle, cudaIpcMemLazyEnablePeerAccess));
+  entry->handle = desc->handle;
+  entry->lastUsed = ce->clock;
+  *ptr = (char*)entry->base + desc->offset;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCeCollSelect(struct ncclComm* comm, bool alone) {
+  struct ncclTasks* tasks = &comm->tasks;
+  if (tasks->nTasksColl == 0 || !ceCollUsable(comm, alone)) return ncclSuccess;
+  // All ranks see the same collectives, hence take the same decisions up to
+  // the exchange.
+  int nCand = 0;
+  for (struct ncclInfo* info = ncclIntruQueueHead(&tasks->collQueue); info != nullptr; info = info->next) {
+    if (ceCollCandidate(comm, info)) nCand++;
+  }
+  if (nCand == 0) return ncclSuccess;
+  if (comm->ceColl == nullptr) NCCLCHECK(ceCollSetup(comm));
+
+  ncclResult_t ret = ncclSuccess;
+  int localRanks = comm->localRanks;
+  struct ncclCeBuffDesc* descs;
+  struct ncclIntruQueue<struct ncclInfo, &ncclInfo::next> queue;
+  ncclIntruQueueConstruct(&queue);
+  NCCLCHECK(ncclCalloc(&descs, nCand*localRanks));
+  int i = 0;
+  for (struct ncclInfo* info = ncclIntruQueueHead(&tasks->collQueue); info != nullptr; info = info->next) {
+    if (!ceCollCandidate(comm, info)) continue;
+    struct ncclCeBuffDesc* desc = descs + comm->localRank*nCand + i++;
+    // AllReduce goes through the scratch buffers, mapped at setup.
+    if (info->coll == ncclFuncAllReduce) {
+      desc->valid = comm->ceColl->scratch != nullptr;
+      continue;
+    }
+    // Only the root of a Broadcast has something to export.
+    if (info->coll == ncclFuncBroadcast && info->root != comm->rank) {
+      desc->valid = 1;
+      continue;
+    }
+    void* base;
+    size_t size;
+    if (!ceCollCopy(comm, info)) {
+      // Direct collectives are only for registered buffers: those stay where
+      // they are, so peers map them once and then find them in their cache.
+      struct ncclReg* reg = nullptr;
+      size_t sendBytes = info->count*ncclTypeSize(info->datatype);
+      if (info->coll == ncclFuncReduceScatter) sendBytes *= comm->nRanks;
+      NCCLCHECKGOTO(ncclRegFind(comm, info->sendbuff, sendBytes, &reg), ret, exit);
+      if (reg == nullptr) continue;
+    }
+    if (cudaIpcGetMemHandle(&desc->handle, (void*)info->sendbuff) != cudaSuccess ||
+        CUPFN(cuMemGetAddressRange((CUdeviceptr*)&base, &size, (CUdeviceptr)info->sendbuff)) != CUDA_SUCCESS) {
+      // E.g. memory from cuMemCreate, which the collective then runs on SMs for.
+      (void)cudaGetLastError();
+      continue;
+    }
+    desc->valid = 1;
+    desc->offset = (char*)info->sendbuff - (char*)base;
+  }
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->localRankToRank, comm->localRank, localRanks, descs, nCand*sizeof(struct ncclCeBuffDesc)), ret, exit);
+
+  i = 0;
+  while (!ncclIntruQueueEmpty(&tasks->collQueue)) {
+    struct ncclInfo* info = ncclIntruQueueDequeue(&tasks->collQueue);
+    if (!ceCollCandidate(comm, info)) {
+      ncclIntruQueueEnqueue(&queue, info);
+      continue;
+    }
+    bool valid = true;
+    for (int p=0; p < localRanks; p++) valid &= descs[p*nCand+i].valid != 0;
+    if (!valid) {
+      ncclIntruQueueEnqueue(&queue, info);
+      i++;
+      continue;
+    }
+    for (int p=0; p < localRanks; p++) {
+      info->regBufSend[p] = nullptr;
+      if (p == comm->localRank || info->coll == ncclFuncAllReduce) continue;
+      if (info->coll == ncclFuncBroadcast && comm->localRankToRank[p] != info->root) continue;
+      NCCLCHECKGOTO(ceIpcMap(comm, p, descs+p*nCand+i, &info->regBufSend[p]), ret, exit);
+    }
+    ncclIntruQueueEnqueue(&tasks->ceQueue, info);
+    tasks->nTasksColl -= 1;
+    tasks->nTasksCe += 1;
+    tasks->workBytesTotal -= info->count*ncclTypeSize(info->datatype);
+    i++;
+  }
+exit:
+  // Put back what we did not get to.
+  while (!ncclIntruQueueEmpty(&tasks->collQueue)) ncclIntruQueueEnqueue(&queue, ncclIntruQueueDequeue(&tasks->collQueue));
+  tasks->collQueue = queue; // C++ struct assignment
+  free(descs);
+  return ret;
+}
+
+// Every rank tells the others it reached phase, then waits for them to do the same.
+static ncclResult_t ceCollBarrier(struct ncclComm* comm, cudaStream_t stream, int phase) {
+  struct ncclCeColl* ce = comm->ceColl;
+  for (int p=0; p < comm->localRanks; p++) {
+    if (p == comm->localRank) continue;
+    CUCHECK(cuStreamWriteValue32(stream, (CUdeviceptr)(ce->peerFlags[p] + phase*NCCL_MAX_LOCAL_RANKS + comm->localRank), ce->seq, CU_STREAM_WRITE_VALUE_DEFAULT));
+  }
+  for (int p=0; p < comm->localRanks; p++) {
+    if (p == comm->localRank) continue;
+    CUCHECK(cuStreamWaitValue32(stream, (CUdeviceptr)(ce->flags + phase*NCCL_MAX_LOCAL_RANKS + p), ce->seq, CU_STREAM_WAIT_VALUE_GEQ));
+  }
+  return ncclSuccess;
+}
+
+// One-shot: every rank reduces the whole vector out of the scratch buffers of
+// all ranks. Two-shot: every rank reduces its slice in place in its own
+// scratch buffer, then gathers the reduced slices of the others.
+static ncclResult_t ceCollAllReduceLaunch(struct ncclComm* comm, struct ncclInfo* info, cudaStream_t stream) {
+  struct ncclCeColl* ce = comm->ceColl;
+  int nRanks = comm->localRanks;
+  int me = comm->localRank;
+  size_t eltSize = ncclTypeSize(info->datatype);
+  size_t bytes = info->count*eltSize;
+  void* srcs[NCCL_MAX_LOCAL_RANKS];
+  CUDACHECK(cudaMemcpyAsync(ce->scratch, info->sendbuff, bytes, cudaMemcpyDeviceToDevice, stream));
+  NCCLCHECK(ceCollBarrier(comm, stream, 0));
+  if (bytes < (size_t)ncclParamDirectAllReduceTwoShot()) {
+    for (int p=0; p < nRanks; p++) srcs[p] = p == me ? ce->scratch : ce->peerScratch[p];
+    NCCLCHECK(ncclLaunchDirectReduce(info->recvbuff, srcs, nRanks, info->count, info->opFull, info->datatype, stream));
+    // Nobody may overwrite its scratch buffer before all peers are done reading it.
+    NCCLCHECK(ceCollBarrier(comm, stream, 1));
+    return ncclSuccess;
+  }
+  // Slices are 16 byte aligned so that the kernels can use vector loads.
+  size_t sliceElts = ROUNDUP(DIVUP(info->count, nRanks), 16/eltSize);
+  size_t first = std::min(info->count, me*sliceElts);
+  size_t nElts = std::min(info->count, first+sliceElts) - first;
+  for (int p=0; p < nRanks; p++) srcs[p] = (char*)(p == me ? ce->scratch : ce->peerScratch[p]) + first*eltSize;
+  if (nElts) NCCLCHECK(ncclLaunchDirectReduce(srcs[me], srcs, nRanks, nElts, info->opFull, info->datatype, stream));
+  NCCLCHECK(ceCollBarrier(comm, stream, 1));
+  for (int p=0; p < nRanks; p++) srcs[p] = (char*)(p == me ? ce->scratch : ce->peerScratch[p]) + p*sliceElts*eltSize;
+  NCCLCHECK(ncclLaunchDirectGather(info->recvbuff, srcs, nRanks, sliceElts*eltSize, bytes, stream));
+  NCCLCHECK(ceCollBarrier(comm, stream, 2));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCeCollLaunch(struct ncclComm* comm, cudaStream_t stream) {
+  struct ncclTasks* tasks = &comm->tasks;
+  struct ncclCeColl* ce = comm->ceColl;
+  while (!ncclIntruQueueEmpty(&tasks->ceQueue)) {
+    struct ncclInfo* info = ncclIntruQueueDequeue(&tasks->ceQueue);
+    size_t bytes = info->count*ncclTypeSize(info->datatype);
+    ce->seq++;
+    if (info->coll == ncclFuncAllReduce) {
+      NCCLCHECK(ceCollAllReduceLaunch(comm, info, stream));
+      continue;
+    }
+    // The buffers of all ranks are ready once all of them got here.
+    NCCLCHECK(ceCollBarrier(comm, stream, 0));
+    CUDACHECK(cudaEventRecord(ce->fork, stream));
+    for (int s=0; s < ce->nStreams; s++) CUDACHECK(cudaStreamWaitEvent(ce->streams[s], ce->fork, 0));
+    if (info->coll == ncclFuncAllGather) {
+      // Every peer is read on its own stream, hence by its own copy engine.
+      for (int p=0; p < comm->localRanks; p++) {
+        int r = comm->localRankToRank[p];
+        const void* src = p == comm->localRank ? info->sendbuff : info->regBufSend[p];
+        char* dst = (char*)info->recvbuff + r*bytes;
+        if (src == dst) continue;
+        CUDACHECK(cudaMemcpyAsync(dst, src, bytes, cudaMemcpyDeviceToDevice, ce->streams[p%ce->nStreams]));
+      }
+    } else if (info->coll == ncclFuncReduceScatter) {
+      // Every rank reduces its own slice straight out of all send buffers.
+      void* srcs[NCCL_MAX_LOCAL_RANKS];
+      for (int p=0; p < comm->localRanks; p++) {
+        const void* send = p == comm->localRank ? info->sendbuff : info->regBufSend[p];
+        srcs[p] = (char*)send + comm->rank*bytes;
+      }
+      NCCLCHECK(ncclLaunchDirectReduce(info->recvbuff, srcs, comm->localRanks, info->count, info->opFull, info->datatype, stream));
+    } else {
+      const void* src = info->root == comm->rank ? info->sendbuff : info->regBufSend[comm->rankToLocalRank[info->root]];
+      if (src != info->recvbuff) {
+        // Split the copy over the streams so that several copy engines work on it.
+        size_t chunk = ROUNDUP(DIVUP(bytes, ce->nStreams), 4096);
+        for (int s=0; s*chunk < bytes; s++) {
+          size_t size = std::min(chunk, bytes - s*chunk);
+          CUDACHECK(cudaMemcpyAsync((char*)info->recvbuff + s*chunk, (const char*)src + s*chunk, size, cudaMemcpyDeviceToDevice, ce->streams[s]));
+        }
+      }
+    }
+    for (int s=0; s < ce->nStreams; s++) {
+      CUDACHECK(cudaEventRecord(ce->join[s], ce->streams[s]));
+      CUDACHECK(cudaStreamWaitEvent(stream, ce->join[s], 0));
+    }
+    // Nobody may reuse its send buffer before all peers are done reading it.
+    NCCLCHECK(ceCollBarrier(comm, stream, 1));
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCeCollFree(struct ncclComm* comm) {
+  struct ncclCeColl* ce = comm->ceColl;
+  if (ce == nullptr) return ncclSuccess;
+  for (int s=0; s < ce->nStreams; s++) {
+    if (ce->streams[s]) CUDACHECK(cudaStreamSynchronize(ce->streams[s]));
+  }
+  for (int p=0; p < NCCL_MAX_LOCAL_RANKS; p++) {
+    for (int i=0; i < CE_IPC_CACHE_SIZE; i++) {
+      if (ce->cache[p][i].base) CUDACHECK(cudaIpcCloseMemHandle(ce->cache[p][i].base));
+    }
+    if (ce->peerFlags[p]) CUDACHECK(cudaIpcCloseMemHandle(ce->peerFlags[p]));
+    if (ce->peerScratch[p]) CUDACHECK(cudaIpcCloseMemHandle(ce->peerScratch[p]));
+  }
+  if (ce->flags) CUDACHECK(cudaFree(ce->flags));
+  if (ce->scratch) CUDACHECK(cudaFree(ce->scratch));
+  for (int s=0; s < ce->nStreams; s++) {
+    if (ce->streams[s]) CUDACHECK(cudaStreamDestroy(ce->streams[s]));
+    if (ce->join[s]) CUDACHECK(cudaEventDestroy(ce->join[s]));
+  }
+  if (ce->fork) CUDACHECK(cudaEventDestroy(ce->fork));
+  free(ce);
+  comm->ceColl = nullptr;
+  return ncclSuccess;
+}
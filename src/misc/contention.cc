@@ -0,0 +1,146 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "contention.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "param.h"
+#include <pthread.h>
+
+NCCL_PARAM(Contention, "CONTENTION", 0);
+NCCL_PARAM(ContentionInterval, "CONTENTION_INTERVAL", 256);
+NCCL_PARAM(ContentionSmBudget, "CONTENTION_SM_BUDGET", 0);
+
+// All communicators of the process with NCCL_CONTENTION set
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ncclContention* registryHead = NULL;
+
+ncclResult_t ncclContentionInit(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclContention* contention = NULL;
+  if (ncclParamContention() == 0) return ncclSuccess;
+  NCCLCHECK(ncclCalloc(&contention, 1));
+  contention->busId = comm->busId;
+  contention->interval = std::max(1, (int)ncclParamContentionInterval());
+  if (ncclParamContentionSmBudget() > 0) contention->smRequest = comm->collChannels;
+  // Never recorded, so it reads as complete until our first launch.
+  CUDACHECKGOTO(cudaEventCreateWithFlags(&contention->lastLaunch, cudaEventDisableTiming), ret, fail);
+  pthread_mutex_lock(&registryLock);
+  contention->next = registryHead;
+  registryHead = contention;
+  pthread_mutex_unlock(&registryLock);
+  comm->contention = contention;
+  INFO(NCCL_INIT|NCCL_TUNING, "Contention: accounting for other communicators, agreeing every %d collectives, SM budget %ld",
+       contention->interval, ncclParamContentionSmBudget());
+exit:
+  return ret;
+fail:
+  free(contention);
+  goto exit;
+}
+
+ncclResult_t ncclContentionFree(struct ncclComm* comm) {
+  struct ncclContention* contention = comm->contention;
+  if (contention == NULL) return ncclSuccess;
+  pthread_mutex_lock(&registryLock);
+  struct ncclContention** ptr = &registryHead;
+  while (*ptr != contention) ptr = &(*ptr)->next;
+  *ptr = contention->next;
+  pthread_mutex_unlock(&registryLock);
+  // Nobody can query the event once we are out of the registry.
+  CUDACHECKIGNORE(cudaEventDestroy(contention->lastLaunch));
+  free(contention);
+  comm->contention = NULL;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclContentionLaunch(struct ncclComm* comm, cudaStream_t stream) {
+  struct ncclContention* contention = comm->contention;
+  ncclResult_t ret = ncclSuccess;
+  int others = 0;
+  if (contention == NULL) return ncclSuccess;
+  pthread_mutex_lock(&registryLock);
+  for (struct ncclContention* other = registryHead; other; other = other->next) {
+    if (other == contention || other->busId != contention->busId) continue;
+    cudaError_t err = cudaEventQuery(other->lastLaunch);
+    if (err == cudaErrorNotReady) others++;
+    else CUDACHECKGOTO(err, ret, exit);
+  }
+exit:
+  pthread_mutex_unlock(&registryLock);
+  NCCLCHECK(ret);
+  contention->loadSum += others;
+  contention->nSamples++;
+  CUDACHECK(cudaEventRecord(contention->lastLaunch, stream));
+  return ncclSuccess;
+}
+
+// Our share of the SM budget of the GPU, given what the other comms on it ask
+// for. Only the comms registered right now count, so the share grows back
+// when other comms are destroyed.
+static int contentionSmShare(struct ncclContention* contention) {
+  int64_t budget = ncclParamContentionSmBudget();
+  int64_t requested = 0;
+  if (contention->smRequest == 0) return 0;
+  pthread_mutex_lock(&registryLock);
+  for (struct ncclContention* other = registryHead; other; other = other->next) {
+    if (other->busId == contention->busId) requested += other->smRequest;
+  }
+  pthread_mutex_unlock(&registryLock);
+  if (requested <= budget) return contention->smRequest;
+  return std::max<int64_t>(1, contention->smRequest*budget/requested);
+}
+
+void ncclContentionCollTuned(struct ncclComm* comm) {
+  struct ncclContention* contention = comm->contention;
+  if (contention == NULL) return;
+  if (++contention->nColls == contention->interval) {
+    // The new load is agreed at the start of the next group
+    contention->nColls = 0;
+    contention->syncPending = true;
+  }
+}
+
+// What every rank contributes to an agreement
+struct contentionSample {
+  float load;
+  int smShare;
+};
+
+ncclResult_t ncclContentionSync(struct ncclComm* comm) {
+  struct ncclContention* contention = comm->contention;
+  ncclResult_t ret = ncclSuccess;
+  struct contentionSample* loads = NULL;
+  if (contention == NULL || !contention->syncPending) return ncclSuccess;
+  NCCLCHECK(ncclCalloc(&loads, comm->nRanks));
+  loads[comm->rank].load = contention->nSamples ? contention->loadSum / contention->nSamples : 0;
+  loads[comm->rank].smShare = contentionSmShare(contention);
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, loads, sizeof(*loads)), ret, exit);
+  {
+    // The most loaded rank sets the pace of the whole collective, and the
+    // rank with the smallest share the number of channels.
+    float load = 0;
+    int channels = 0;
+    for (int r=0; r<comm->nRanks; r++) {
+      load = std::max(load, loads[r].load);
+      if (loads[r].smShare != 0 && (channels == 0 || loads[r].smShare < channels)) channels = loads[r].smShare;
+    }
+    if (comm->rank == 0 && load != comm->contentionLoad) {
+      INFO(NCCL_TUNING, "Contention: %.2f other communicators active on average, was %.2f", load, comm->contentionLoad);
+    }
+    if (comm->rank == 0 && channels != comm->contentionChannels) {
+      INFO(NCCL_TUNING, "Contention: SM share of %d channels, was %d", channels, comm->contentionChannels);
+    }
+    comm->contentionLoad = load;
+    comm->contentionChannels = channels;
+  }
+  contention->loadSum = 0;
+  contention->nSamples = 0;
+  contention->syncPending = false;
+exit:
+  free(loads);
+  return ret;
+}
@@ -79,6 +79,11 @@ DECLARE_CUDA_PFN(cuMemSetAccess);
 DECLARE_CUDA_PFN(cuMemUnmap);
 /* ncclMemAlloc/Free */
 DECLARE_CUDA_PFN(cuPointerGetAttribute);
+/* Stream memory operations (resident kernel) */
+DECLARE_CUDA_PFN(cuStreamWriteValue32);
+DECLARE_CUDA_PFN(cuStreamWaitValue32);
+/* transport/net.cc */
+DECLARE_CUDA_PFN(cuFlushGPUDirectRDMAWrites);
 #if CUDA_VERSION >= 11070
 /* transport/collNet.cc/net.cc*/
 DECLARE_CUDA_PFN(cuMemGetHandleForAddressRange); // DMA-BUF support
@@ -151,6 +156,11 @@ static ncclResult_t cudaPfnFuncLoader(void) {
   LOAD_SYM(cuMemUnmap, 1);
 /* ncclMemAlloc/Free */
   LOAD_SYM(cuPointerGetAttribute, 1);
+/* Stream memory operations (resident kernel) */
+  LOAD_SYM(cuStreamWriteValue32, 1);
+  LOAD_SYM(cuStreamWaitValue32, 1);
+/* GDR write flush from the host */
+  LOAD_SYM(cuFlushGPUDirectRDMAWrites, 1);
 #if CUDA_VERSION >= 11070
   LOAD_SYM(cuMemGetHandleForAddressRange, 1); // DMA-BUF support
 #endif
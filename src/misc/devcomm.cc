@@ -0,0 +1,109 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "argcheck.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "transport.h"
+
+static_assert(NCCL_DEV_COMM_MAX_RANKS <= NCCL_MAX_LOCAL_RANKS, "Device communication windows are single node");
+
+// What one rank exports for a window
+struct ncclDevCommDesc {
+  cudaIpcMemHandle_t handle;
+  void* ptr;
+};
+
+// Host side state of a window: which peer mappings we must close
+struct ncclDevCommState {
+  void* base;
+  bool ipc[NCCL_DEV_COMM_MAX_RANKS];
+};
+
+static bool devCommSamePid(struct ncclComm* comm, int peer) {
+  struct ncclPeerInfo* myInfo = comm->peerInfo+comm->rank;
+  struct ncclPeerInfo* peerInfo = comm->peerInfo+peer;
+  return myInfo->hostHash == peerInfo->hostHash && myInfo->pidHash == peerInfo->pidHash;
+}
+
+static ncclResult_t devCommFree(struct ncclDevCommState* state, ncclDevComm_t* devComm) {
+  for (int r=0; r<devComm->nRanks; r++) {
+    if (state->ipc[r] && devComm->buffs[r]) CUDACHECK(cudaIpcCloseMemHandle(devComm->buffs[r]));
+  }
+  if (state->base) CUDACHECK(cudaFree(state->base));
+  free(state);
+  memset(devComm, 0, sizeof(*devComm));
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclDevCommCreate, ncclComm_t comm, size_t size, int nSignals, ncclDevComm_t* devComm);
+ncclResult_t ncclDevCommCreate(ncclComm_t comm, size_t size, int nSignals, ncclDevComm_t* devComm) {
+  NCCLCHECK(CommCheck(comm, "ncclDevCommCreate", "comm"));
+  NCCLCHECK(PtrCheck(devComm, "ncclDevCommCreate", "devComm"));
+  if (comm->nNodes != 1 || comm->nRanks > NCCL_DEV_COMM_MAX_RANKS || comm->intraHighestTransportType != TRANSPORT_P2P) {
+    WARN("ncclDevCommCreate: needs a single node communicator of at most %d ranks connected through P2P", NCCL_DEV_COMM_MAX_RANKS);
+    return ncclInvalidUsage;
+  }
+  if (nSignals < 0) {
+    WARN("ncclDevCommCreate: invalid nSignals %d", nSignals);
+    return ncclInvalidArgument;
+  }
+
+  ncclResult_t ret = ncclSuccess;
+  struct ncclDevCommState* state = nullptr;
+  struct ncclDevCommDesc* descs = nullptr;
+  // Signals follow the window, 16 byte aligned
+  size_t signalOffset = ROUNDUP(size, 16);
+  size_t allocSize = signalOffset + nSignals*sizeof(uint64_t);
+  memset(devComm, 0, sizeof(*devComm));
+  devComm->rank = comm->rank;
+  devComm->nRanks = comm->nRanks;
+  devComm->size = size;
+  devComm->nSignals = nSignals;
+  NCCLCHECK(ncclCalloc(&state, 1));
+  devComm->internal = state;
+  NCCLCHECKGOTO(ncclCalloc(&descs, comm->nRanks), ret, fail);
+  CUDACHECKGOTO(cudaMalloc(&state->base, std::max<size_t>(allocSize, 1)), ret, fail);
+  CUDACHECKGOTO(cudaMemset(state->base, 0, std::max<size_t>(allocSize, 1)), ret, fail);
+  descs[comm->rank].ptr = state->base;
+  CUDACHECKGOTO(cudaIpcGetMemHandle(&descs[comm->rank].handle, state->base), ret, fail);
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, descs, sizeof(struct ncclDevCommDesc)), ret, fail);
+
+  for (int r=0; r<comm->nRanks; r++) {
+    if (r == comm->rank) {
+      devComm->buffs[r] = state->base;
+    } else if (devCommSamePid(comm, r)) {
+      cudaError_t err = cudaDeviceEnablePeerAccess(comm->peerInfo[r].cudaDev, 0);
+      if (err != cudaSuccess && err != cudaErrorPeerAccessAlreadyEnabled) CUDACHECKGOTO(err, ret, fail);
+      (void)cudaGetLastError();
+      devComm->buffs[r] = descs[r].ptr;
+    } else {
+      CUDACHECKGOTO(cudaIpcOpenMemHandle(&devComm->buffs[r], descs[r].handle, cudaIpcMemLazyEnablePeerAccess), ret, fail);
+      state->ipc[r] = true;
+    }
+    devComm->signals[r] = (uint64_t*)((char*)devComm->buffs[r] + signalOffset);
+  }
+  INFO(NCCL_INIT, "Device communication window of %zu bytes and %d signals on %d ranks", size, nSignals, comm->nRanks);
+exit:
+  free(descs);
+  return ret;
+fail:
+  devCommFree(state, devComm);
+  goto exit;
+}
+
+NCCL_API(ncclResult_t, ncclDevCommDestroy, ncclComm_t comm, ncclDevComm_t* devComm);
+ncclResult_t ncclDevCommDestroy(ncclComm_t comm, ncclDevComm_t* devComm) {
+  NCCLCHECK(CommCheck(comm, "ncclDevCommDestroy", "comm"));
+  NCCLCHECK(PtrCheck(devComm, "ncclDevCommDestroy", "devComm"));
+  struct ncclDevCommState* state = (struct ncclDevCommState*)devComm->internal;
+  if (state == nullptr) return ncclSuccess;
+  // Peers may still be reading or writing our window until they got here
+  CUDACHECK(cudaDeviceSynchronize());
+  NCCLCHECK(bootstrapBarrier(comm->bootstrap, comm->rank, comm->nRanks, 0xdc0));
+  NCCLCHECK(devCommFree(state, devComm));
+  return ncclSuccess;
+}
@@ -0,0 +1,111 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "gpushare.h"
+#include "comm.h"
+#include "param.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+NCCL_PARAM(GpuShare, "GPU_SHARE", 0);
+
+// Communicators of this process per GPU, the process stays registered while any is alive
+static pthread_mutex_t gpuShareLock = PTHREAD_MUTEX_INITIALIZER;
+static struct { int64_t busId; int refs; } gpuShareRefs[NCCL_GPU_SHARE_MAX_PROCS];
+
+// The registry of a GPU is an array of pids, updated under flock. Pids of
+// processes which died without deregistering are dropped on every update.
+static ncclResult_t registryUpdate(int64_t busId, bool add, int* nProcs) {
+  char path[64];
+  int pids[NCCL_GPU_SHARE_MAX_PROCS];
+  int kept[NCCL_GPU_SHARE_MAX_PROCS];
+  int n = 0, fd = -1;
+  int me = getpid();
+  ncclResult_t ret = ncclSuccess;
+
+  snprintf(path, sizeof(path), "/dev/shm/nccl-gpushare-%lx", busId);
+  SYSCHECKGOTO(fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR), ret, exit);
+  SYSCHECKGOTO(flock(fd, LOCK_EX), ret, exit);
+  memset(pids, 0, sizeof(pids));
+  memset(kept, 0, sizeof(kept));
+  // A new registry reads short, as empty
+  SYSCHECKGOTO(pread(fd, pids, sizeof(pids), 0), ret, unlock);
+  for (int i = 0; i < NCCL_GPU_SHARE_MAX_PROCS; i++) {
+    if (pids[i] == 0 || pids[i] == me) continue;
+    if (kill(pids[i], 0) == 0 || errno == EPERM) kept[n++] = pids[i];
+  }
+  if (add && n < NCCL_GPU_SHARE_MAX_PROCS) kept[n++] = me;
+  SYSCHECKGOTO(pwrite(fd, kept, sizeof(kept), 0), ret, unlock);
+  *nProcs = n;
+unlock:
+  flock(fd, LOCK_UN);
+exit:
+  if (fd != -1) close(fd);
+  return ret;
+}
+
+ncclResult_t ncclGpuShareRegister(struct ncclComm* comm) {
+  int64_t param = ncclParamGpuShare();
+  ncclResult_t ret = ncclSuccess;
+  comm->gpuShareProcs = 1;
+  if (param <= 0) return ncclSuccess;
+  if (param > 1) {
+    comm->gpuShareProcs = std::min<int64_t>(param, NCCL_GPU_SHARE_MAX_PROCS);
+    return ncclSuccess;
+  }
+
+  pthread_mutex_lock(&gpuShareLock);
+  int slot = -1, nProcs = 1;
+  for (int i = 0; i < NCCL_GPU_SHARE_MAX_PROCS; i++) {
+    if (gpuShareRefs[i].refs && gpuShareRefs[i].busId == comm->busId) { slot = i; break; }
+    if (gpuShareRefs[i].refs == 0 && slot == -1) slot = i;
+  }
+  if (slot == -1) {
+    WARN("GPU sharing: too many GPUs in the process, not accounting for busId %lx", comm->busId);
+    goto exit;
+  }
+  // Count again with every new communicator, processes may have come and gone
+  NCCLCHECKGOTO(registryUpdate(comm->busId, true, &nProcs), ret, exit);
+  gpuShareRefs[slot].busId = comm->busId;
+  gpuShareRefs[slot].refs++;
+  comm->gpuShareRegistered = true;
+  comm->gpuShareProcs = nProcs;
+exit:
+  pthread_mutex_unlock(&gpuShareLock);
+  return ret;
+}
+
+ncclResult_t ncclGpuShareDeregister(struct ncclComm* comm) {
+  if (!comm->gpuShareRegistered) return ncclSuccess;
+  pthread_mutex_lock(&gpuShareLock);
+  for (int i = 0; i < NCCL_GPU_SHARE_MAX_PROCS; i++) {
+    if (gpuShareRefs[i].refs == 0 || gpuShareRefs[i].busId != comm->busId) continue;
+    if (--gpuShareRefs[i].refs == 0) {
+      int nProcs;
+      // Others simply don't count us anymore if this fails
+      (void)registryUpdate(comm->busId, false, &nProcs);
+    }
+    break;
+  }
+  comm->gpuShareRegistered = false;
+  pthread_mutex_unlock(&gpuShareLock);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclGpuShareLimitChannels(struct ncclComm* comm) {
+  int nProcs = comm->gpuShareProcs;
+  if (nProcs <= 1) return ncclSuccess;
+  // Channels are usually duplicated once the rings are set up, share that count
+  int maxCTAs = std::max(comm->config.minCTAs, DIVUP(2*comm->nChannels, nProcs));
+  comm->config.maxCTAs = std::min(comm->config.maxCTAs, maxCTAs);
+  if (comm->nvlsChannels) comm->nvlsChannels = std::max(comm->config.minCTAs, DIVUP(comm->nvlsChannels, nProcs));
+  INFO(NCCL_INIT, "GPU shared by %d processes, using up to %d channels, %d NVLS channels", nProcs, comm->config.maxCTAs, comm->nvlsChannels);
+  return ncclSuccess;
+}
@@ -0,0 +1,281 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "core.h"
+#include "nccl_net.h"
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+// Host memory reductions for net/collNet plugins which reduce on the CPU, see
+// ncclNetHostReduce_t in nccl_net.h. Elements are processed in blocks which
+// are converted to the computation type in local arrays. The loops on those
+// are written for the compiler to vectorize, and the whole thing is compiled
+// once per instruction set: baseline (SSE2 on x86, NEON on aarch64), AVX2 and
+// AVX-512, the latter two picked at runtime.
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define NCCL_HOST_REDUCE_X86 1
+#include <immintrin.h>
+#define NCCL_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define NCCL_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,fma,f16c")))
+#endif
+
+#define HOST_REDUCE_BLOCK 64
+#define HOST_REDUCE_INLINE inline __attribute__((always_inline))
+
+namespace {
+
+// Storage types without a native host type
+struct Half { uint16_t x; };
+struct Bf16 { uint16_t x; };
+struct Fp8e4m3 { uint8_t x; };
+struct Fp8e5m2 { uint8_t x; };
+
+template<typename T> struct RedSum { HOST_REDUCE_INLINE T operator()(T a, T b) const { return a + b; } };
+template<typename T> struct RedProd { HOST_REDUCE_INLINE T operator()(T a, T b) const { return a * b; } };
+template<typename T> struct RedMax { HOST_REDUCE_INLINE T operator()(T a, T b) const { return a > b ? a : b; } };
+template<typename T> struct RedMin { HOST_REDUCE_INLINE T operator()(T a, T b) const { return a < b ? a : b; } };
+
+HOST_REDUCE_INLINE float bitsToFloat(uint32_t u) { float f; memcpy(&f, &u, sizeof(f)); return f; }
+HOST_REDUCE_INLINE uint32_t floatToBits(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+
+static inline float halfToFloat(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t man = h & 0x3ff;
+  if (exp == 0x1f) return bitsToFloat(sign | 0x7f800000 | (man << 13));
+  if (exp == 0) return bitsToFloat(sign | floatToBits(ldexpf((float)man, -24)));
+  return bitsToFloat(sign | ((exp + 112) << 23) | (man << 13));
+}
+
+// Round to nearest even, like __float2half_rn()
+static inline uint16_t floatToHalf(float f) {
+  uint32_t u = floatToBits(f);
+  uint16_t sign = (u >> 16) & 0x8000;
+  uint32_t a = u & 0x7fffffff;
+  if (a > 0x7f800000) return sign | 0x7e00;
+  if (a >= 0x477ff000) return sign | 0x7c00; // 65520 and above round to infinity
+  if (a < 0x38800000) return sign | (uint16_t)nearbyintf(bitsToFloat(a) * 16777216.0f); // subnormal, 2^24
+  a += 0xfff + ((a >> 13) & 1);
+  return sign | (uint16_t)((a >> 13) - (112 << 10));
+}
+
+HOST_REDUCE_INLINE float bf16ToFloat(uint16_t h) { return bitsToFloat((uint32_t)h << 16); }
+
+HOST_REDUCE_INLINE uint16_t floatToBf16(float f) {
+  uint32_t u = floatToBits(f);
+  if ((u & 0x7fffffff) > 0x7f800000) return (u >> 16) | 0x40;
+  return (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+}
+
+// FP8 values saturate to the largest finite one, like __NV_SATFINITE.
+// nMan mantissa bits, exponent bias, largest finite code. NaN is code 0x7f.
+static inline uint8_t floatToFp8(float f, int nMan, int bias, uint32_t maxCode) {
+  uint32_t u = floatToBits(f);
+  uint8_t sign = (u >> 24) & 0x80;
+  uint32_t a = u & 0x7fffffff;
+  if (a > 0x7f800000) return sign | 0x7f;
+  uint32_t code;
+  if (a < ((uint32_t)(127 - bias + 1) << 23)) {
+    // Subnormals are contiguous with the smallest normal
+    code = (uint32_t)nearbyintf(ldexpf(bitsToFloat(a), bias - 1 + nMan));
+  } else {
+    int shift = 23 - nMan;
+    a += (1u << (shift-1)) - 1 + ((a >> shift) & 1);
+    code = (a >> shift) - ((uint32_t)(127 - bias) << nMan);
+  }
+  return sign | (code > maxCode ? maxCode : code);
+}
+
+static float fp8ToFloatSlow(uint8_t x, int nMan, int bias, bool e4m3) {
+  int exp = (x & 0x7f) >> nMan;
+  int man = x & ((1 << nMan) - 1);
+  float v;
+  if (e4m3 ? (x & 0x7f) == 0x7f : exp == 0x1f) v = (man || e4m3) ? NAN : INFINITY;
+  else if (exp == 0) v = ldexpf((float)man, 1 - bias - nMan);
+  else v = ldexpf((float)(man + (1 << nMan)), exp - bias - nMan);
+  return (x & 0x80) ? -v : v;
+}
+
+float fp8e4m3Table[256];
+float fp8e5m2Table[256];
+
+// Conversion between the storage type S and the computation type C
+template<typename S>
+struct HostConv {
+  typedef S C;
+  static HOST_REDUCE_INLINE void load(C* x, const S* s, int n) { memcpy(x, s, n*sizeof(S)); }
+  static HOST_REDUCE_INLINE void store(S* s, const C* x, int n) { memcpy(s, x, n*sizeof(S)); }
+};
+template<>
+struct HostConv<Half> {
+  typedef float C;
+  static HOST_REDUCE_INLINE void load(float* x, const Half* s, int n) { for (int i=0; i<n; i++) x[i] = halfToFloat(s[i].x); }
+  static HOST_REDUCE_INLINE void store(Half* s, const float* x, int n) { for (int i=0; i<n; i++) s[i].x = floatToHalf(x[i]); }
+};
+template<>
+struct HostConv<Bf16> {
+  typedef float C;
+  static HOST_REDUCE_INLINE void load(float* x, const Bf16* s, int n) { for (int i=0; i<n; i++) x[i] = bf16ToFloat(s[i].x); }
+  static HOST_REDUCE_INLINE void store(Bf16* s, const float* x, int n) { for (int i=0; i<n; i++) s[i].x = floatToBf16(x[i]); }
+};
+template<>
+struct HostConv<Fp8e4m3> {
+  typedef float C;
+  static HOST_REDUCE_INLINE void load(float* x, const Fp8e4m3* s, int n) { for (int i=0; i<n; i++) x[i] = fp8e4m3Table[s[i].x]; }
+  static HOST_REDUCE_INLINE void store(Fp8e4m3* s, const float* x, int n) { for (int i=0; i<n; i++) s[i].x = floatToFp8(x[i], 3, 7, 0x7e); }
+};
+template<>
+struct HostConv<Fp8e5m2> {
+  typedef float C;
+  static HOST_REDUCE_INLINE void load(float* x, const Fp8e5m2* s, int n) { for (int i=0; i<n; i++) x[i] = fp8e5m2Table[s[i].x]; }
+  static HOST_REDUCE_INLINE void store(Fp8e5m2* s, const float* x, int n) { for (int i=0; i<n; i++) s[i].x = floatToFp8(x[i], 2, 15, 0x7b); }
+};
+
+template<typename S, template<typename> class Op, template<typename> class Conv>
+static HOST_REDUCE_INLINE void reduceBlocks(void* dstv, const void* av, const void* bv, size_t count) {
+  typedef typename Conv<S>::C C;
+  S* dst = (S*)dstv;
+  const S* a = (const S*)av;
+  const S* b = (const S*)bv;
+  // dst may alias a or b: each block is fully read before it is written.
+  C x[HOST_REDUCE_BLOCK], y[HOST_REDUCE_BLOCK];
+  size_t i = 0;
+  for (; i + HOST_REDUCE_BLOCK <= count; i += HOST_REDUCE_BLOCK) {
+    Conv<S>::load(x, a+i, HOST_REDUCE_BLOCK);
+    Conv<S>::load(y, b+i, HOST_REDUCE_BLOCK);
+    for (int j=0; j<HOST_REDUCE_BLOCK; j++) x[j] = Op<C>()(x[j], y[j]);
+    Conv<S>::store(dst+i, x, HOST_REDUCE_BLOCK);
+  }
+  int n = (int)(count - i);
+  if (n) {
+    Conv<S>::load(x, a+i, n);
+    Conv<S>::load(y, b+i, n);
+    for (int j=0; j<n; j++) x[j] = Op<C>()(x[j], y[j]);
+    Conv<S>::store(dst+i, x, n);
+  }
+}
+
+struct IsaBase {
+  template<typename S, template<typename> class Op>
+  static void run(void* dst, const void* a, const void* b, size_t count) { reduceBlocks<S, Op, HostConv>(dst, a, b, count); }
+};
+
+#if NCCL_HOST_REDUCE_X86
+// Half precision goes through F16C, other types only need wider registers.
+template<typename S> struct HostConvAvx2 : HostConv<S> {};
+template<>
+struct HostConvAvx2<Half> {
+  typedef float C;
+  NCCL_TARGET_AVX2 static void load(float* x, const Half* s, int n) {
+    int i = 0;
+    for (; i+8 <= n; i += 8) _mm256_storeu_ps(x+i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(s+i))));
+    for (; i < n; i++) x[i] = halfToFloat(s[i].x);
+  }
+  NCCL_TARGET_AVX2 static void store(Half* s, const float* x, int n) {
+    int i = 0;
+    for (; i+8 <= n; i += 8) _mm_storeu_si128((__m128i*)(s+i), _mm256_cvtps_ph(_mm256_loadu_ps(x+i), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC));
+    for (; i < n; i++) s[i].x = floatToHalf(x[i]);
+  }
+};
+
+template<typename S> struct HostConvAvx512 : HostConv<S> {};
+template<>
+struct HostConvAvx512<Half> {
+  typedef float C;
+  NCCL_TARGET_AVX512 static void load(float* x, const Half* s, int n) {
+    int i = 0;
+    for (; i+16 <= n; i += 16) _mm512_storeu_ps(x+i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(s+i))));
+    for (; i < n; i++) x[i] = halfToFloat(s[i].x);
+  }
+  NCCL_TARGET_AVX512 static void store(Half* s, const float* x, int n) {
+    int i = 0;
+    for (; i+16 <= n; i += 16) _mm256_storeu_si256((__m256i*)(s+i), _mm512_cvtps_ph(_mm512_loadu_ps(x+i), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC));
+    for (; i < n; i++) s[i].x = floatToHalf(x[i]);
+  }
+};
+
+struct IsaAvx2 {
+  template<typename S, template<typename> class Op>
+  NCCL_TARGET_AVX2 static void run(void* dst, const void* a, const void* b, size_t count) { reduceBlocks<S, Op, HostConvAvx2>(dst, a, b, count); }
+};
+
+struct IsaAvx512 {
+  template<typename S, template<typename> class Op>
+  NCCL_TARGET_AVX512 static void run(void* dst, const void* a, const void* b, size_t count) { reduceBlocks<S, Op, HostConvAvx512>(dst, a, b, count); }
+};
+#endif
+
+typedef void (*hostReduceFn_t)(void* dst, const void* a, const void* b, size_t count);
+hostReduceFn_t hostReduceFns[ncclNumTypes][ncclAvg];
+const char* hostReduceIsa;
+pthread_once_t hostReduceOnce = PTHREAD_ONCE_INIT;
+
+// Sums and products of signed integers wrap around like on the GPU, hence
+// are computed on the unsigned type.
+template<typename Isa, typename T, typename Arith>
+static void fillType(hostReduceFn_t* fns) {
+  fns[ncclSum] = Isa::template run<Arith, RedSum>;
+  fns[ncclProd] = Isa::template run<Arith, RedProd>;
+  fns[ncclMax] = Isa::template run<T, RedMax>;
+  fns[ncclMin] = Isa::template run<T, RedMin>;
+}
+
+template<typename Isa>
+static void fillTable(const char* name) {
+  fillType<Isa, int8_t, uint8_t>(hostReduceFns[ncclInt8]);
+  fillType<Isa, uint8_t, uint8_t>(hostReduceFns[ncclUint8]);
+  fillType<Isa, int32_t, uint32_t>(hostReduceFns[ncclInt32]);
+  fillType<Isa, uint32_t, uint32_t>(hostReduceFns[ncclUint32]);
+  fillType<Isa, int64_t, uint64_t>(hostReduceFns[ncclInt64]);
+  fillType<Isa, uint64_t, uint64_t>(hostReduceFns[ncclUint64]);
+  fillType<Isa, Half, Half>(hostReduceFns[ncclFloat16]);
+  fillType<Isa, float, float>(hostReduceFns[ncclFloat32]);
+  fillType<Isa, double, double>(hostReduceFns[ncclFloat64]);
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+  fillType<Isa, Bf16, Bf16>(hostReduceFns[ncclBfloat16]);
+#endif
+#if defined(__CUDA_FP8_TYPES_EXIST__)
+  fillType<Isa, Fp8e4m3, Fp8e4m3>(hostReduceFns[ncclFloat8e4m3]);
+  fillType<Isa, Fp8e5m2, Fp8e5m2>(hostReduceFns[ncclFloat8e5m2]);
+#endif
+  hostReduceIsa = name;
+}
+
+void hostReduceInit() {
+  for (int i=0; i<256; i++) {
+    fp8e4m3Table[i] = fp8ToFloatSlow(i, 3, 7, true);
+    fp8e5m2Table[i] = fp8ToFloatSlow(i, 2, 15, false);
+  }
+  fillTable<IsaBase>("baseline");
+#if NCCL_HOST_REDUCE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+    fillTable<IsaAvx512>("AVX-512");
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+    fillTable<IsaAvx2>("AVX2");
+  }
+#endif
+  INFO(NCCL_INIT|NCCL_NET, "Host reductions use %s instructions", hostReduceIsa);
+}
+
+} // namespace
+
+NCCL_API(ncclResult_t, ncclNetHostReduce, void* dst, const void* src0, const void* src1, size_t count, ncclDataType_t dataType, ncclRedOp_t redOp);
+ncclResult_t ncclNetHostReduce(void* dst, const void* src0, const void* src1, size_t count, ncclDataType_t dataType, ncclRedOp_t redOp) {
+  if ((int)dataType < 0 || dataType >= ncclNumTypes) {
+    WARN("ncclNetHostReduce: invalid data type %d", dataType);
+    return ncclInvalidArgument;
+  }
+  if ((int)redOp < 0 || redOp >= ncclAvg) {
+    WARN("ncclNetHostReduce: invalid reduction %d, only ncclSum, ncclProd, ncclMax and ncclMin are supported", redOp);
+    return ncclInvalidArgument;
+  }
+  pthread_once(&hostReduceOnce, hostReduceInit);
+  hostReduceFns[dataType][redOp](dst, src0, src1, count);
+  return ncclSuccess;
+}
@@ -45,9 +45,15 @@ ncclResult_t buildIbvSymbols(struct ncclIbvSymbols* ibvSymbols) {
   ASSIGN_SYM(ibvSymbols, ibv_dereg_mr, ibv_internal_dereg_mr);
   ASSIGN_SYM(ibvSymbols, ibv_create_cq, ibv_internal_create_cq);
   ASSIGN_SYM(ibvSymbols, ibv_destroy_cq, ibv_internal_destroy_cq);
+  ASSIGN_SYM(ibvSymbols, ibv_create_comp_channel, ibv_internal_create_comp_channel);
+  ASSIGN_SYM(ibvSymbols, ibv_destroy_comp_channel, ibv_internal_destroy_comp_channel);
+  ASSIGN_SYM(ibvSymbols, ibv_get_cq_event, ibv_internal_get_cq_event);
+  ASSIGN_SYM(ibvSymbols, ibv_ack_cq_events, ibv_internal_ack_cq_events);
   ASSIGN_SYM(ibvSymbols, ibv_create_qp, ibv_internal_create_qp);
   ASSIGN_SYM(ibvSymbols, ibv_modify_qp, ibv_internal_modify_qp);
   ASSIGN_SYM(ibvSymbols, ibv_destroy_qp, ibv_internal_destroy_qp);
+  ASSIGN_SYM(ibvSymbols, ibv_create_srq, ibv_internal_create_srq);
+  ASSIGN_SYM(ibvSymbols, ibv_destroy_srq, ibv_internal_destroy_srq);
   ASSIGN_SYM(ibvSymbols, ibv_fork_init, ibv_internal_fork_init);
   ASSIGN_SYM(ibvSymbols, ibv_event_type_str, ibv_internal_event_type_str);
   
@@ -120,9 +126,15 @@ ncclResult_t buildIbvSymbols(struct ncclIbvSymbols* ibvSymbols) {
   LOAD_SYM(ibvhandle, "ibv_dereg_mr", ibvSymbols->ibv_internal_dereg_mr);
   LOAD_SYM(ibvhandle, "ibv_create_cq", ibvSymbols->ibv_internal_create_cq);
   LOAD_SYM(ibvhandle, "ibv_destroy_cq", ibvSymbols->ibv_internal_destroy_cq);
+  LOAD_SYM(ibvhandle, "ibv_create_comp_channel", ibvSymbols->ibv_internal_create_comp_channel);
+  LOAD_SYM(ibvhandle, "ibv_destroy_comp_channel", ibvSymbols->ibv_internal_destroy_comp_channel);
+  LOAD_SYM(ibvhandle, "ibv_get_cq_event", ibvSymbols->ibv_internal_get_cq_event);
+  LOAD_SYM(ibvhandle, "ibv_ack_cq_events", ibvSymbols->ibv_internal_ack_cq_events);
   LOAD_SYM(ibvhandle, "ibv_create_qp", ibvSymbols->ibv_internal_create_qp);
   LOAD_SYM(ibvhandle, "ibv_modify_qp", ibvSymbols->ibv_internal_modify_qp);
   LOAD_SYM(ibvhandle, "ibv_destroy_qp", ibvSymbols->ibv_internal_destroy_qp);
+  LOAD_SYM(ibvhandle, "ibv_create_srq", ibvSymbols->ibv_internal_create_srq);
+  LOAD_SYM(ibvhandle, "ibv_destroy_srq", ibvSymbols->ibv_internal_destroy_srq);
   LOAD_SYM(ibvhandle, "ibv_fork_init", ibvSymbols->ibv_internal_fork_init);
   LOAD_SYM(ibvhandle, "ibv_event_type_str", ibvSymbols->ibv_internal_event_type_str);
 
@@ -151,9 +163,15 @@ teardown:
   ibvSymbols->ibv_internal_dereg_mr = NULL;
   ibvSymbols->ibv_internal_create_cq = NULL;
   ibvSymbols->ibv_internal_destroy_cq = NULL;
+  ibvSymbols->ibv_internal_create_comp_channel = NULL;
+  ibvSymbols->ibv_internal_destroy_comp_channel = NULL;
+  ibvSymbols->ibv_internal_get_cq_event = NULL;
+  ibvSymbols->ibv_internal_ack_cq_events = NULL;
   ibvSymbols->ibv_internal_create_qp = NULL;
   ibvSymbols->ibv_internal_modify_qp = NULL;
   ibvSymbols->ibv_internal_destroy_qp = NULL;
+  ibvSymbols->ibv_internal_create_srq = NULL;
+  ibvSymbols->ibv_internal_destroy_srq = NULL;
   ibvSymbols->ibv_internal_fork_init = NULL;
   ibvSymbols->ibv_internal_event_type_str = NULL;
   ibvSymbols->ibv_internal_query_ece = NULL;
@@ -194,6 +194,30 @@ ncclResult_t wrap_ibv_destroy_cq(struct ibv_cq *cq) {
   IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_cq, ibv_internal_destroy_cq(cq), 0, "ibv_destroy_cq");
 }
 
+ncclResult_t wrap_ibv_create_comp_channel(struct ibv_comp_channel **ret, struct ibv_context *context) {
+  IBV_PTR_CHECK_ERRNO(ibvSymbols, ibv_internal_create_comp_channel, ibv_internal_create_comp_channel(context), *ret, NULL, "ibv_create_comp_channel");
+}
+
+ncclResult_t wrap_ibv_destroy_comp_channel(struct ibv_comp_channel *channel) {
+  IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_comp_channel, ibv_internal_destroy_comp_channel(channel), 0, "ibv_destroy_comp_channel");
+}
+
+ncclResult_t wrap_ibv_get_cq_event(struct ibv_comp_channel *channel, struct ibv_cq **cq, void **cq_context, int* got) { /*returns 0 on success, and -1 on error*/
+  CHECK_NOT_NULL(ibvSymbols, ibv_internal_get_cq_event);
+  *got = 0;
+  if (ibvSymbols.ibv_internal_get_cq_event(channel, cq, cq_context) == 0) {
+    *got = 1;
+  } else if (errno != EAGAIN) {
+    WARN("Call to ibv_get_cq_event failed with error %s", strerror(errno));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t wrap_ibv_ack_cq_events(struct ibv_cq *cq, unsigned int nevents) {
+  IBV_PASSTHRU(ibvSymbols, ibv_internal_ack_cq_events, ibv_internal_ack_cq_events(cq, nevents));
+}
+
 ncclResult_t wrap_ibv_destroy_qp(struct ibv_qp *qp) {
   IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_qp, ibv_internal_destroy_qp(qp), 0, "ibv_destroy_qp");
 }
@@ -202,6 +226,14 @@ ncclResult_t wrap_ibv_create_qp(struct ibv_qp **ret, struct ibv_pd *pd, struct i
   IBV_PTR_CHECK_ERRNO(ibvSymbols, ibv_internal_create_qp, ibv_internal_create_qp(pd, qp_init_attr), *ret, NULL, "ibv_create_qp");
 }
 
+ncclResult_t wrap_ibv_create_srq(struct ibv_srq **ret, struct ibv_pd *pd, struct ibv_srq_init_attr *srq_init_attr) {
+  IBV_PTR_CHECK_ERRNO(ibvSymbols, ibv_internal_create_srq, ibv_internal_create_srq(pd, srq_init_attr), *ret, NULL, "ibv_create_srq");
+}
+
+ncclResult_t wrap_ibv_destroy_srq(struct ibv_srq *srq) {
+  IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_srq, ibv_internal_destroy_srq(srq), 0, "ibv_destroy_srq");
+}
+
 ncclResult_t wrap_ibv_modify_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr, int attr_mask) { /*returns 0 on success, or the value of errno on failure (which indicates the failure reason)*/
   IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_modify_qp, ibv_internal_modify_qp(qp, attr, attr_mask), 0, "ibv_modify_qp");
 }
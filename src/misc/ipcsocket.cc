@@ -99,16 +99,18 @@ ncclResult_t ncclIpcSocketClose(ncclIpcSocket *handle) {
   return ncclSuccess;
 }
 
-ncclResult_t ncclIpcSocketRecvMsg(ncclIpcSocket *handle, void *hdr, int hdrLen, int *recvFd) {
+ncclResult_t ncclIpcSocketRecvMsgFds(ncclIpcSocket *handle, void *hdr, int hdrLen, int *recvFds, int nFds) {
   struct msghdr msg = {0, 0, 0, 0, 0, 0, 0};
   struct iovec iov[1];
 
   // Union to guarantee alignment requirements for control array
   union {
     struct cmsghdr cm;
-    char control[CMSG_SPACE(sizeof(int))];
+    char control[CMSG_SPACE(NCCL_IPC_MAX_FDS*sizeof(int))];
   } control_un;
 
+  if (nFds > NCCL_IPC_MAX_FDS) return ncclInternalError;
+
   struct cmsghdr *cmptr;
   char dummy_buffer[1];
   int ret;
@@ -135,38 +137,44 @@ ncclResult_t ncclIpcSocketRecvMsg(ncclIpcSocket *handle, void *hdr, int hdrLen,
     if (handle->abortFlag && __atomic_load_n(handle->abortFlag, __ATOMIC_RELAXED)) return ncclInternalError;
   }
 
-  if (recvFd != NULL) {
-    if (((cmptr = CMSG_FIRSTHDR(&msg)) != NULL) && (cmptr->cmsg_len == CMSG_LEN(sizeof(int)))) {
+  if (nFds > 0) {
+    if (((cmptr = CMSG_FIRSTHDR(&msg)) != NULL) && (cmptr->cmsg_len == CMSG_LEN(nFds*sizeof(int)))) {
       if ((cmptr->cmsg_level != SOL_SOCKET) || (cmptr->cmsg_type != SCM_RIGHTS)) {
         WARN("UDS: Receiving data over socket failed");
       return ncclSystemError;
       }
 
-      memmove(recvFd, CMSG_DATA(cmptr), sizeof(*recvFd));
+      memmove(recvFds, CMSG_DATA(cmptr), nFds*sizeof(*recvFds));
     } else {
       WARN("UDS: Receiving data over socket %s failed", handle->socketName);
       return ncclSystemError;
     }
-    TRACE(NCCL_INIT|NCCL_P2P, "UDS: Got recvFd %d from socket %s", *recvFd, handle->socketName);
+    TRACE(NCCL_INIT|NCCL_P2P, "UDS: Got %d fds, first %d, from socket %s", nFds, recvFds[0], handle->socketName);
   }
 
   return ncclSuccess;
 }
 
+ncclResult_t ncclIpcSocketRecvMsg(ncclIpcSocket *handle, void *hdr, int hdrLen, int *recvFd) {
+  return ncclIpcSocketRecvMsgFds(handle, hdr, hdrLen, recvFd, recvFd ? 1 : 0);
+}
+
 ncclResult_t ncclIpcSocketRecvFd(ncclIpcSocket *handle, int *recvFd) {
   return ncclIpcSocketRecvMsg(handle, NULL, 0, recvFd);
 }
 
-ncclResult_t ncclIpcSocketSendMsg(ncclIpcSocket *handle, void *hdr, int hdrLen, const int sendFd, int rank, uint64_t hash) {
+ncclResult_t ncclIpcSocketSendMsgFds(ncclIpcSocket *handle, void *hdr, int hdrLen, const int *sendFds, int nFds, int rank, uint64_t hash) {
   struct msghdr msg = {0, 0, 0, 0, 0, 0, 0};
   struct iovec iov[1];
   char temp[NCCL_IPC_SOCKNAME_LEN];
 
   union {
     struct cmsghdr cm;
-    char control[CMSG_SPACE(sizeof(int))];
+    char control[CMSG_SPACE(NCCL_IPC_MAX_FDS*sizeof(int))];
   } control_un;
 
+  if (nFds > NCCL_IPC_MAX_FDS) return ncclInternalError;
+
   struct cmsghdr *cmptr;
   char dummy_buffer[1];
   struct sockaddr_un cliaddr;
@@ -188,17 +196,17 @@ ncclResult_t ncclIpcSocketSendMsg(ncclIpcSocket *handle, void *hdr, int hdrLen,
 
   TRACE(NCCL_INIT, "UDS: Sending hdr %p len %d to UDS socket %s", hdr, hdrLen, temp);
 
-  if (sendFd != -1) {
-    TRACE(NCCL_INIT, "UDS: Sending fd %d to UDS socket %s", sendFd, temp);
+  if (nFds > 0) {
+    TRACE(NCCL_INIT, "UDS: Sending %d fds, first %d, to UDS socket %s", nFds, sendFds[0], temp);
 
     msg.msg_control = control_un.control;
-    msg.msg_controllen = sizeof(control_un.control);
+    msg.msg_controllen = CMSG_SPACE(nFds*sizeof(int));
 
     cmptr = CMSG_FIRSTHDR(&msg);
-    cmptr->cmsg_len = CMSG_LEN(sizeof(int));
+    cmptr->cmsg_len = CMSG_LEN(nFds*sizeof(int));
     cmptr->cmsg_level = SOL_SOCKET;
     cmptr->cmsg_type = SCM_RIGHTS;
-    memmove(CMSG_DATA(cmptr), &sendFd, sizeof(sendFd));
+    memmove(CMSG_DATA(cmptr), sendFds, nFds*sizeof(*sendFds));
   }
 
   msg.msg_name = (void *)&cliaddr;
@@ -227,6 +235,10 @@ ncclResult_t ncclIpcSocketSendMsg(ncclIpcSocket *handle, void *hdr, int hdrLen,
   return ncclSuccess;
 }
 
+ncclResult_t ncclIpcSocketSendMsg(ncclIpcSocket *handle, void *hdr, int hdrLen, const int sendFd, int rank, uint64_t hash) {
+  return ncclIpcSocketSendMsgFds(handle, hdr, hdrLen, &sendFd, sendFd != -1 ? 1 : 0, rank, hash);
+}
+
 ncclResult_t ncclIpcSocketSendFd(ncclIpcSocket *handle, const int sendFd, int rank, uint64_t hash) {
   return ncclIpcSocketSendMsg(handle, NULL, 0, sendFd, rank, hash);
 }
@@ -0,0 +1,212 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "mempool.h"
+#include "comm.h"
+#include "param.h"
+#include "register.h"
+#include <pthread.h>
+
+NCCL_PARAM(MemPoolSlabSize, "MEM_POOL_SLAB_SIZE", 0);
+
+// Buffers are carved at this alignment, enough for every protocol and NVLS
+#define MEM_POOL_ALIGN 512
+
+struct memPoolRange {
+  size_t offset;
+  size_t size;
+};
+
+struct memPoolSlab {
+  uintptr_t base;
+  size_t size;
+  int dev;
+  size_t used;
+  // Free ranges, sorted by offset and never adjacent
+  struct memPoolRange* free;
+  int nFree, freeCapacity;
+  struct memPoolSlab* next;
+};
+
+// Buffers handed out, sorted by address
+struct memPoolBlock {
+  uintptr_t addr;
+  size_t size;
+  struct memPoolSlab* slab;
+};
+
+static pthread_mutex_t memPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static struct memPoolSlab* memPoolSlabs = NULL;
+static struct memPoolBlock* memPoolBlocks = NULL;
+static int memPoolBlockCount = 0, memPoolBlockCapacity = 0;
+
+// Index of the first block starting after addr. Must hold memPoolLock.
+static int blockUpperBound(uintptr_t addr) {
+  int lo = 0, hi = memPoolBlockCount;
+  while (lo < hi) {
+    int mid = (lo+hi)/2;
+    if (memPoolBlocks[mid].addr <= addr) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// First fit
+static bool slabCarve(struct memPoolSlab* slab, size_t size, uintptr_t* addr) {
+  for (int i=0; i<slab->nFree; i++) {
+    struct memPoolRange* r = slab->free+i;
+    if (r->size < size) continue;
+    *addr = slab->base + r->offset;
+    r->offset += size;
+    r->size -= size;
+    if (r->size == 0) {
+      memmove(r, r+1, (slab->nFree-i-1)*sizeof(struct memPoolRange));
+      slab->nFree--;
+    }
+    slab->used += size;
+    return true;
+  }
+  return false;
+}
+
+static ncclResult_t slabRelease(struct memPoolSlab* slab, uintptr_t addr, size_t size) {
+  size_t offset = addr - slab->base;
+  int i = 0;
+  while (i < slab->nFree && slab->free[i].offset < offset) i++;
+  bool mergePrev = i > 0 && slab->free[i-1].offset + slab->free[i-1].size == offset;
+  bool mergeNext = i < slab->nFree && offset + size == slab->free[i].offset;
+  if (mergePrev && mergeNext) {
+    slab->free[i-1].size += size + slab->free[i].size;
+    memmove(slab->free+i, slab->free+i+1, (slab->nFree-i-1)*sizeof(struct memPoolRange));
+    slab->nFree--;
+  } else if (mergePrev) {
+    slab->free[i-1].size += size;
+  } else if (mergeNext) {
+    slab->free[i].offset = offset;
+    slab->free[i].size += size;
+  } else {
+    if (slab->nFree == slab->freeCapacity) {
+      int capacity = slab->freeCapacity < 16 ? 16 : 2*slab->freeCapacity;
+      NCCLCHECK(ncclRealloc(&slab->free, slab->freeCapacity, capacity));
+      slab->freeCapacity = capacity;
+    }
+    memmove(slab->free+i+1, slab->free+i, (slab->nFree-i)*sizeof(struct memPoolRange));
+    slab->free[i].offset = offset;
+    slab->free[i].size = size;
+    slab->nFree++;
+  }
+  slab->used -= size;
+  return ncclSuccess;
+}
+
+static ncclResult_t slabCreate(int dev, size_t size, struct memPoolSlab** slabPtr) {
+  struct memPoolSlab* slab = NULL;
+  void* base = NULL;
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECK(ncclCalloc(&slab, 1));
+  NCCLCHECKGOTO(ncclCalloc(&slab->free, 16), ret, fail);
+  slab->freeCapacity = 16;
+  NCCLCHECKGOTO(ncclMemAllocDirect(&base, size), ret, fail);
+  // Communicators register the whole slab the first time any of its buffers is used
+  NCCLCHECKGOTO(ncclRegTrackMemAlloc(base, size, /*autoRegister=*/true), ret, fail);
+  slab->base = (uintptr_t)base;
+  slab->size = size;
+  slab->dev = dev;
+  slab->free[0].offset = 0;
+  slab->free[0].size = size;
+  slab->nFree = 1;
+  slab->next = memPoolSlabs;
+  memPoolSlabs = slab;
+  INFO(NCCL_ALLOC, "ncclMemAlloc pool: new slab %p size %zu on device %d", base, size, dev);
+  *slabPtr = slab;
+  return ncclSuccess;
+fail:
+  if (base) ncclMemFreeDirect(base);
+  free(slab->free);
+  free(slab);
+  return ret;
+}
+
+static ncclResult_t slabDestroy(struct memPoolSlab* slab) {
+  struct memPoolSlab** s = &memPoolSlabs;
+  while (*s != slab) s = &(*s)->next;
+  *s = slab->next;
+  INFO(NCCL_ALLOC, "ncclMemAlloc pool: releasing slab %p size %zu on device %d", (void*)slab->base, slab->size, slab->dev);
+  // Registrations of the slab are dropped by each communicator when it sees the id is gone
+  NCCLCHECK(ncclRegUntrackMemAlloc((void*)slab->base));
+  NCCLCHECK(ncclMemFreeDirect((void*)slab->base));
+  free(slab->free);
+  free(slab);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclMemPoolAlloc(void** ptr, size_t size) {
+  int64_t slabSize = ncclParamMemPoolSlabSize();
+  ncclResult_t ret = ncclSuccess;
+  struct memPoolSlab* slab;
+  uintptr_t addr = 0;
+  int dev;
+  *ptr = NULL;
+  if (slabSize <= 0 || size > (size_t)slabSize) return ncclSuccess;
+  ALIGN_SIZE(size, MEM_POOL_ALIGN);
+  CUDACHECK(cudaGetDevice(&dev));
+
+  pthread_mutex_lock(&memPoolLock);
+  for (slab = memPoolSlabs; slab != NULL; slab = slab->next) {
+    if (slab->dev == dev && slabCarve(slab, size, &addr)) break;
+  }
+  if (slab == NULL) {
+    NCCLCHECKGOTO(slabCreate(dev, slabSize, &slab), ret, exit);
+    slabCarve(slab, size, &addr);
+  }
+  if (memPoolBlockCount == memPoolBlockCapacity) {
+    int capacity = memPoolBlockCapacity < 64 ? 64 : 2*memPoolBlockCapacity;
+    NCCLCHECKGOTO(ncclRealloc(&memPoolBlocks, memPoolBlockCapacity, capacity), ret, undo);
+    memPoolBlockCapacity = capacity;
+  }
+  {
+    int i = blockUpperBound(addr);
+    memmove(memPoolBlocks+i+1, memPoolBlocks+i, (memPoolBlockCount-i)*sizeof(struct memPoolBlock));
+    memPoolBlocks[i].addr = addr;
+    memPoolBlocks[i].size = size;
+    memPoolBlocks[i].slab = slab;
+    memPoolBlockCount++;
+  }
+  *ptr = (void*)addr;
+exit:
+  pthread_mutex_unlock(&memPoolLock);
+  return ret;
+undo:
+  slabRelease(slab, addr, size);
+  goto exit;
+}
+
+ncclResult_t ncclMemPoolFree(void* ptr, bool* pooled) {
+  ncclResult_t ret = ncclSuccess;
+  *pooled = false;
+  if (ptr == NULL) return ncclSuccess;
+  pthread_mutex_lock(&memPoolLock);
+  int i = blockUpperBound((uintptr_t)ptr)-1;
+  if (i >= 0 && memPoolBlocks[i].addr == (uintptr_t)ptr) {
+    struct memPoolSlab* slab = memPoolBlocks[i].slab;
+    size_t size = memPoolBlocks[i].size;
+    memmove(memPoolBlocks+i, memPoolBlocks+i+1, (memPoolBlockCount-i-1)*sizeof(struct memPoolBlock));
+    memPoolBlockCount--;
+    *pooled = true;
+    NCCLCHECKGOTO(slabRelease(slab, (uintptr_t)ptr, size), ret, exit);
+    if (slab->used == 0) {
+      // Keep a single empty slab per device
+      struct memPoolSlab* s;
+      for (s = memPoolSlabs; s != NULL; s = s->next) {
+        if (s != slab && s->dev == slab->dev && s->used == 0) break;
+      }
+      if (s != NULL) NCCLCHECKGOTO(slabDestroy(slab), ret, exit);
+    }
+  }
+exit:
+  pthread_mutex_unlock(&memPoolLock);
+  return ret;
+}
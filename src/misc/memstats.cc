@@ -0,0 +1,103 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "memstats.h"
+#include "alloc.h"
+#include <pthread.h>
+
+thread_local struct ncclMemTag ncclMemCurrentTag = { NULL, ncclMemOther, -1, -1 };
+
+// Tracked allocations, hashed by pointer, so that frees can be accounted to
+// the stats and category the allocation was made under.
+#define NCCL_MEM_TRACK_BUCKETS 1024
+
+struct ncclMemEntry {
+  struct ncclMemEntry* next;
+  void* ptr;
+  size_t size;
+  int host;
+  struct ncclMemTag tag;
+};
+
+static struct ncclMemEntry* memEntries[NCCL_MEM_TRACK_BUCKETS];
+static pthread_mutex_t memEntriesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int memBucket(void* ptr) {
+  return (int)(((uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL) >> 54) % NCCL_MEM_TRACK_BUCKETS;
+}
+
+static void memAccount(struct ncclMemTag* tag, size_t size, int host, int sign) {
+  struct ncclMemStats* stats = tag->stats;
+  uint64_t* counters[3] = {
+    (host ? stats->hostBytes : stats->deviceBytes) + tag->category,
+    tag->transport >= 0 && tag->transport < NCCL_STATS_NUM_TRANSPORTS ? stats->transportBytes + tag->transport : NULL,
+    tag->peer >= 0 && tag->peer < stats->nPeers ? stats->peerBytes + tag->peer : NULL
+  };
+  for (int i=0; i<3; i++) {
+    if (counters[i] == NULL) continue;
+    if (sign > 0) __atomic_fetch_add(counters[i], size, __ATOMIC_RELAXED);
+    else __atomic_fetch_sub(counters[i], size, __ATOMIC_RELAXED);
+  }
+}
+
+void ncclMemTrack(void* ptr, size_t size, int host) {
+  struct ncclMemTag tag = ncclMemCurrentTag;
+  if (tag.stats == NULL || ptr == NULL) return;
+  struct ncclMemEntry* entry = (struct ncclMemEntry*)malloc(sizeof(struct ncclMemEntry));
+  if (entry == NULL) return; // Accounting is best effort
+  entry->ptr = ptr;
+  entry->size = size;
+  entry->host = host;
+  entry->tag = tag;
+  int b = memBucket(ptr);
+  pthread_mutex_lock(&memEntriesLock);
+  entry->next = memEntries[b];
+  memEntries[b] = entry;
+  memAccount(&tag, size, host, 1);
+  pthread_mutex_unlock(&memEntriesLock);
+}
+
+void ncclMemUntrack(void* ptr) {
+  if (ptr == NULL) return;
+  int b = memBucket(ptr);
+  pthread_mutex_lock(&memEntriesLock);
+  for (struct ncclMemEntry** prev = memEntries+b; *prev; prev = &(*prev)->next) {
+    struct ncclMemEntry* entry = *prev;
+    if (entry->ptr != ptr) continue;
+    *prev = entry->next;
+    memAccount(&entry->tag, entry->size, entry->host, -1);
+    free(entry);
+    break;
+  }
+  pthread_mutex_unlock(&memEntriesLock);
+}
+
+ncclResult_t ncclMemStatsInit(struct ncclMemStats* stats, int nPeers) {
+  memset(stats, 0, sizeof(*stats));
+  NCCLCHECK(ncclCalloc(&stats->peerBytes, nPeers));
+  stats->nPeers = nPeers;
+  return ncclSuccess;
+}
+
+void ncclMemStatsFree(struct ncclMemStats* stats) {
+  pthread_mutex_lock(&memEntriesLock);
+  for (int b=0; b<NCCL_MEM_TRACK_BUCKETS; b++) {
+    struct ncclMemEntry** prev = memEntries+b;
+    while (*prev) {
+      struct ncclMemEntry* entry = *prev;
+      if (entry->tag.stats == stats) {
+        *prev = entry->next;
+        free(entry);
+      } else {
+        prev = &entry->next;
+      }
+    }
+  }
+  pthread_mutex_unlock(&memEntriesLock);
+  free(stats->peerBytes);
+  stats->peerBytes = NULL;
+  stats->nPeers = 0;
+}
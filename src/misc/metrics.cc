@@ -0,0 +1,212 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "metrics.h"
+#include "comm.h"
+#include "param.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+NCCL_PARAM(MetricsInterval, "METRICS_INTERVAL", 1000);
+
+static const char* metricsFuncStr[NCCL_STATS_NUM_FUNCS] = { "Broadcast", "Reduce", "AllGather", "ReduceScatter", "AllReduce", "SendRecv", "Send", "Recv", "AllToAll", "Gather", "Scatter" };
+static const char* metricsTransportStr[NCCL_STATS_NUM_TRANSPORTS] = { "P2P", "SHM", "NET", "CollNet", "NVLS" };
+
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metricsCond = PTHREAD_COND_INITIALIZER;
+static struct ncclComm* metricsComms = nullptr; // linked through ncclComm::metricsNext
+static pthread_t metricsThread;
+static bool metricsStop;
+static char metricsPath[PATH_MAX];
+
+struct ncclMetrics {
+  ncclCommStats_t stats;
+  int nComms;
+  int nFailed;
+};
+
+// Proxy counters are shared by the communicators sharing a proxy, count each proxy once
+static void metricsCollect(struct ncclMetrics* m) {
+  struct ncclProxyState* proxies[64];
+  int nProxies = 0;
+  memset(m, 0, sizeof(*m));
+  for (struct ncclComm* comm = metricsComms; comm != nullptr; comm = comm->metricsNext) {
+    ncclCommStats_t s;
+    if (ncclCommGetStats(comm, &s) != ncclSuccess) continue;
+    m->nComms++;
+    ncclResult_t asyncResult = __atomic_load_n(&comm->asyncResult, __ATOMIC_RELAXED);
+    if (asyncResult != ncclSuccess && asyncResult != ncclInProgress) m->nFailed++;
+    for (int f=0; f<NCCL_STATS_NUM_FUNCS; f++) {
+      m->stats.funcOps[f] += s.funcOps[f];
+      m->stats.funcBytes[f] += s.funcBytes[f];
+    }
+    for (int t=0; t<NCCL_STATS_NUM_TRANSPORTS; t++) m->stats.transportBytes[t] += s.transportBytes[t];
+    m->stats.workFifoStalls += s.workFifoStalls;
+    m->stats.workFifoStallNs += s.workFifoStallNs;
+    m->stats.enqueueCalls += s.enqueueCalls;
+    m->stats.enqueueNs += s.enqueueNs;
+    m->stats.arrivalsMeasured += s.arrivalsMeasured;
+    m->stats.arrivalsLast += s.arrivalsLast;
+    for (int b=0; b<NCCL_STATS_SKEW_BUCKETS; b++) m->stats.arrivalSkew[b] += s.arrivalSkew[b];
+
+    bool seen = false;
+    for (int p=0; p<nProxies; p++) seen |= proxies[p] == comm->proxyState;
+    if (seen) continue;
+    if (nProxies < 64) proxies[nProxies++] = comm->proxyState;
+    for (int d=0; d<NCCL_STATS_MAX_NET_DEVS; d++) {
+      m->stats.netSendBytes[d] += s.netSendBytes[d];
+      m->stats.netRecvBytes[d] += s.netRecvBytes[d];
+    }
+    m->stats.proxyActiveNs += s.proxyActiveNs;
+    m->stats.proxyIdleNs += s.proxyIdleNs;
+  }
+}
+
+static void metricsHeader(FILE* f, const char* name, const char* type, const char* help) {
+  fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metricsWrite(FILE* f, struct ncclMetrics* m) {
+  int pid = getpid();
+  ncclCommStats_t* s = &m->stats;
+  metricsHeader(f, "nccl_communicators", "gauge", "Communicators alive in the process");
+  fprintf(f, "nccl_communicators{pid=\"%d\"} %d\n", pid, m->nComms);
+  metricsHeader(f, "nccl_communicators_failed", "gauge", "Communicators with an asynchronous error");
+  fprintf(f, "nccl_communicators_failed{pid=\"%d\"} %d\n", pid, m->nFailed);
+
+  metricsHeader(f, "nccl_ops_total", "counter", "Operations enqueued");
+  for (int i=0; i<NCCL_STATS_NUM_FUNCS; i++) fprintf(f, "nccl_ops_total{pid=\"%d\",func=\"%s\"} %lu\n", pid, metricsFuncStr[i], s->funcOps[i]);
+  metricsHeader(f, "nccl_op_bytes_total", "counter", "Bytes of the operations enqueued");
+  for (int i=0; i<NCCL_STATS_NUM_FUNCS; i++) fprintf(f, "nccl_op_bytes_total{pid=\"%d\",func=\"%s\"} %lu\n", pid, metricsFuncStr[i], s->funcBytes[i]);
+  metricsHeader(f, "nccl_transport_bytes_total", "counter", "Bytes of the operations per transport");
+  for (int i=0; i<NCCL_STATS_NUM_TRANSPORTS; i++) fprintf(f, "nccl_transport_bytes_total{pid=\"%d\",transport=\"%s\"} %lu\n", pid, metricsTransportStr[i], s->transportBytes[i]);
+
+  metricsHeader(f, "nccl_net_send_bytes_total", "counter", "Bytes sent per network device");
+  for (int d=0; d<NCCL_STATS_MAX_NET_DEVS; d++) {
+    if (s->netSendBytes[d] || s->netRecvBytes[d]) fprintf(f, "nccl_net_send_bytes_total{pid=\"%d\",dev=\"%d\"} %lu\n", pid, d, s->netSendBytes[d]);
+  }
+  metricsHeader(f, "nccl_net_recv_bytes_total", "counter", "Bytes received per network device");
+  for (int d=0; d<NCCL_STATS_MAX_NET_DEVS; d++) {
+    if (s->netSendBytes[d] || s->netRecvBytes[d]) fprintf(f, "nccl_net_recv_bytes_total{pid=\"%d\",dev=\"%d\"} %lu\n", pid, d, s->netRecvBytes[d]);
+  }
+  metricsHeader(f, "nccl_proxy_active_seconds_total", "counter", "Time proxy threads spent progressing operations");
+  fprintf(f, "nccl_proxy_active_seconds_total{pid=\"%d\"} %.6f\n", pid, s->proxyActiveNs*1e-9);
+  metricsHeader(f, "nccl_proxy_idle_seconds_total", "counter", "Time proxy threads spent idle");
+  fprintf(f, "nccl_proxy_idle_seconds_total{pid=\"%d\"} %.6f\n", pid, s->proxyIdleNs*1e-9);
+
+  metricsHeader(f, "nccl_work_fifo_stalls_total", "counter", "Launches waiting for the GPU to free work FIFO slots");
+  fprintf(f, "nccl_work_fifo_stalls_total{pid=\"%d\"} %lu\n", pid, s->workFifoStalls);
+  metricsHeader(f, "nccl_work_fifo_stall_seconds_total", "counter", "Time launches waited for work FIFO slots");
+  fprintf(f, "nccl_work_fifo_stall_seconds_total{pid=\"%d\"} %.6f\n", pid, s->workFifoStallNs*1e-9);
+  metricsHeader(f, "nccl_enqueue_calls_total", "counter", "Calls enqueueing operations");
+  fprintf(f, "nccl_enqueue_calls_total{pid=\"%d\"} %lu\n", pid, s->enqueueCalls);
+  metricsHeader(f, "nccl_enqueue_seconds_total", "counter", "Host time spent in calls enqueueing operations");
+  fprintf(f, "nccl_enqueue_seconds_total{pid=\"%d\"} %.6f\n", pid, s->enqueueNs*1e-9);
+
+  // Straggler detection (NCCL_STRAGGLER=1). The delays themselves are not
+  // kept, so the histogram has no _sum.
+  metricsHeader(f, "nccl_arrivals_last_total", "counter", "Collective plans this process' ranks started last");
+  fprintf(f, "nccl_arrivals_last_total{pid=\"%d\"} %lu\n", pid, s->arrivalsLast);
+  metricsHeader(f, "nccl_arrival_skew_seconds", "histogram", "Start delay of collective plans relative to the first rank");
+  uint64_t count = 0;
+  for (int b=0; b<NCCL_STATS_SKEW_BUCKETS; b++) {
+    count += s->arrivalSkew[b];
+    fprintf(f, "nccl_arrival_skew_seconds_bucket{pid=\"%d\",le=\"%g\"} %lu\n", pid, (double)(1ULL<<b)*1e-6, count);
+  }
+  fprintf(f, "nccl_arrival_skew_seconds_bucket{pid=\"%d\",le=\"+Inf\"} %lu\n", pid, count);
+  fprintf(f, "nccl_arrival_skew_seconds_count{pid=\"%d\"} %lu\n", pid, count);
+}
+
+static void metricsExport() {
+  struct ncclMetrics m;
+  char tmpPath[PATH_MAX+8];
+  metricsCollect(&m);
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", metricsPath);
+  FILE* f = fopen(tmpPath, "w");
+  if (f == nullptr) return;
+  metricsWrite(f, &m);
+  fclose(f);
+  // Scrapers never see a partial file
+  if (rename(tmpPath, metricsPath) != 0) unlink(tmpPath);
+}
+
+static void* metricsThreadMain(void*) {
+  int64_t intervalMs = std::max<int64_t>(ncclParamMetricsInterval(), 10);
+  pthread_mutex_lock(&metricsLock);
+  while (!metricsStop) {
+    metricsExport();
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += intervalMs/1000;
+    ts.tv_nsec += (intervalMs%1000)*1000000;
+    if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+    pthread_cond_timedwait(&metricsCond, &metricsLock, &ts);
+  }
+  // No communicator left, don't let scrapers report stale values
+  unlink(metricsPath);
+  pthread_mutex_unlock(&metricsLock);
+  return nullptr;
+}
+
+// Expand %p to the pid, like NCCL_DEBUG_FILE
+static void metricsPathInit(const char* env) {
+  char* p = metricsPath;
+  char* end = metricsPath + PATH_MAX - 16;
+  for (int c=0; env[c] != '\0' && p < end; c++) {
+    if (env[c] == '%' && env[c+1] == 'p') {
+      p += snprintf(p, 16, "%d", getpid());
+      c++;
+    } else {
+      *p++ = env[c];
+    }
+  }
+  *p = '\0';
+}
+
+ncclResult_t ncclMetricsRegister(struct ncclComm* comm) {
+  const char* env = ncclGetEnv("NCCL_METRICS_FILE");
+  if (env == nullptr || env[0] == '\0') return ncclSuccess;
+  pthread_mutex_lock(&metricsLock);
+  ncclResult_t ret = ncclSuccess;
+  if (metricsComms == nullptr) {
+    metricsPathInit(env);
+    metricsStop = false;
+    if (pthread_create(&metricsThread, nullptr, metricsThreadMain, nullptr) != 0) {
+      WARN("Failed to start the metrics exporter thread");
+      ret = ncclSystemError;
+      goto exit;
+    }
+    ncclSetThreadName(metricsThread, "NCCL Metrics");
+    INFO(NCCL_INIT, "Exporting metrics to %s every %ld ms", metricsPath, ncclParamMetricsInterval());
+  }
+  comm->metricsNext = metricsComms;
+  metricsComms = comm;
+  comm->metricsRegistered = true;
+exit:
+  pthread_mutex_unlock(&metricsLock);
+  return ret;
+}
+
+ncclResult_t ncclMetricsDeregister(struct ncclComm* comm) {
+  if (!comm->metricsRegistered) return ncclSuccess;
+  pthread_mutex_lock(&metricsLock);
+  for (struct ncclComm** c = &metricsComms; *c != nullptr; c = &(*c)->metricsNext) {
+    if (*c == comm) {
+      *c = comm->metricsNext;
+      break;
+    }
+  }
+  comm->metricsRegistered = false;
+  bool last = metricsComms == nullptr;
+  if (last) {
+    metricsStop = true;
+    pthread_cond_signal(&metricsCond);
+  }
+  pthread_mutex_unlock(&metricsLock);
+  if (last) pthread_join(metricsThread, nullptr);
+  return ncclSuccess;
+}
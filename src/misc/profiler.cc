@@ -7,9 +7,124 @@
 #include "profiler.h"
 
 //#define PROFILE_PROXY 1
-#ifdef PROFILE_PROXY
+#if defined(PROFILE_PROXY) || defined(ENABLE_DEVICE_PROFILE)
+#define ENABLE_TIMER 1
 #include "timer.h"
 #include "alloc.h"
+#include "comm.h"
+#include <time.h>
+
+#define MAX_EVENTS 200000
+double profilingStart = 0;
+// Host realtime clock at profilingStart, used to place %globaltimer stamps on
+// the proxy timeline.
+static double profilingStartReal = 0;
+
+static void profilingInit() {
+  if (profilingStart != 0) return;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  profilingStart = gettime();
+  profilingStartReal = ts.tv_sec*1E6 + ts.tv_nsec*1E-3;
+}
+#endif
+
+#ifdef ENABLE_DEVICE_PROFILE
+static const char* deviceProfileTypeStr[] = { "Work", "WaitRecv", "WaitSend", "Reduce", "Post" };
+static const char* deviceProfileProtoStr[] = { "LL", "LL128", "Simple", "" };
+struct ncclDeviceProfileEvent {
+  double begin, end;
+  uint32_t step;
+  int rank;
+  uint16_t channel;
+  uint8_t type;
+  uint8_t proto;
+};
+
+// Shared by all comms of the process, guarded by deviceLock. deviceComms counts
+// the comms with device rings; events are written out when the last one is gone.
+static pthread_mutex_t deviceLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ncclDeviceProfileEvent* deviceEvents = NULL;
+static int deviceIndex = 0;
+static uint64_t deviceDropped = 0;
+static int deviceComms = 0;
+
+void ncclProfilingDeviceAttach() {
+  pthread_mutex_lock(&deviceLock);
+  deviceComms++;
+  pthread_mutex_unlock(&deviceLock);
+}
+
+void ncclProfilingDeviceDetach() {
+  pthread_mutex_lock(&deviceLock);
+  bool last = --deviceComms == 0;
+  pthread_mutex_unlock(&deviceLock);
+  if (last) ncclProfilingDump();
+}
+
+// Move every published event out of the device rings. The kernels of the plan
+// being reclaimed may still be running, so we stop at the first slot whose seq
+// has not been written yet and pick up the rest on the next call.
+ncclResult_t ncclProfilingDeviceDrain(struct ncclComm* comm) {
+  if (comm->devProfileEvents == NULL) return ncclSuccess;
+  pthread_mutex_lock(&deviceLock);
+  if (deviceEvents == NULL && ncclCalloc(&deviceEvents, MAX_EVENTS) != ncclSuccess) {
+    pthread_mutex_unlock(&deviceLock);
+    return ncclSystemError;
+  }
+  profilingInit();
+  for (int c=0; c < MAXCHANNELS; c++) {
+    struct ncclDevProfileEvent* ring = comm->devProfileEvents + c*NCCL_DEV_PROFILE_RING_SIZE;
+    uint64_t tail = comm->devProfileTail[c];
+    while (true) {
+      struct ncclDevProfileEvent* e = ring + tail%NCCL_DEV_PROFILE_RING_SIZE;
+      uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+      int32_t ahead = (int32_t)(seq - (uint32_t)(tail+1));
+      if (ahead < 0) break; // Not written yet
+      if (ahead > 0) {
+        // The device lapped us and overwrote this slot, skip to its new event.
+        deviceDropped += ahead;
+        tail += ahead;
+      }
+      if (deviceIndex < MAX_EVENTS) {
+        struct ncclDeviceProfileEvent* d = deviceEvents+deviceIndex++;
+        d->begin = e->begin*1E-3 - profilingStartReal;
+        d->end = e->end*1E-3 - profilingStartReal;
+        d->step = e->step;
+        d->rank = comm->rank;
+        d->channel = c;
+        d->type = e->type;
+        d->proto = e->proto;
+      } else {
+        deviceDropped++;
+      }
+      tail++;
+    }
+    comm->devProfileTail[c] = tail;
+  }
+  pthread_mutex_unlock(&deviceLock);
+  return ncclSuccess;
+}
+
+// Called with deviceLock held
+static void deviceProfilingDump(FILE* f) {
+  if (deviceDropped) WARN("Device profiler dropped %ld events, ring or host buffer overflow", deviceDropped);
+  for (int i=0; i<deviceIndex; i++) {
+    struct ncclDeviceProfileEvent* e = deviceEvents+i;
+    if (e->type >= ncclDevProfileNumTypes) continue;
+    const char* proto = deviceProfileProtoStr[e->proto < NCCL_NUM_PROTOCOLS ? e->proto : NCCL_NUM_PROTOCOLS];
+    fprintf(f, "{\"name\": \"%s%s%s-%d\", \"cat\": \"GPU\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %f, \"dur\": %f, \"args\": { \"rank\": %d } },\n",
+        deviceProfileTypeStr[e->type], proto[0] ? "-" : "", proto, e->step, e->channel, e->type == ncclDevProfileWork ? 2 : 3,
+        e->begin, e->end - e->begin, e->rank);
+  }
+}
+#else
+void ncclProfilingDeviceAttach() {}
+void ncclProfilingDeviceDetach() {}
+ncclResult_t ncclProfilingDeviceDrain(struct ncclComm* comm) { return ncclSuccess; }
+#endif
+
+#ifdef PROFILE_PROXY
 
 static const char* profilingStateSendStr[] = { "BufferWait", "GPUWait", "SendWait", "", "End" };
 static const char* profilingStateRecvStr[] = { "BufferWait", "RecvWait", "FlushWait", "GPUWait", "End" };
@@ -26,18 +141,16 @@ struct ncclProxyProfileEvent {
 
 struct ncclProxyProfileEvent* profilingEvents = NULL;
 int profilingIndex = 0;
-double profilingStart = 0;
-#define MAX_EVENTS 200000
 
-ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state) {
+ncclResult_t ncclProfilingTimelineRecord(struct ncclProxyArgs* args, int sub, int step, int state) {
   if (profilingEvents == NULL) {
     NCCLCHECK(ncclCalloc(&profilingEvents, MAX_EVENTS));
-    profilingStart = gettime();
+    profilingInit();
   }
   struct ncclProxyProfileEvent* event = NULL;
   if (state%8 == 0) {
     if (profilingIndex == MAX_EVENTS) return ncclSuccess;
-    args->subs[sub].profilingEvents[step%NCCL_STEPS] = event = profilingEvents+profilingIndex++;
+    args->subs[sub].profilingEvents[step%NCCL_MAX_STEPS] = event = profilingEvents+profilingIndex++;
     if (state == ncclProxyProfileBegin) {
       // Proxy operation information
       event->opCount = args->opCount;
@@ -48,8 +161,8 @@ ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step,
       event->opIndex = (((uint64_t)args)/sizeof(struct ncclProxyArgs))%256;
     } else event->peer = -state;
   } else {
-    event = (struct ncclProxyProfileEvent*)args->subs[sub].profilingEvents[step%NCCL_STEPS];
-    if (state == ncclProxyProfileEnd) args->subs[sub].profilingEvents[step%NCCL_STEPS] = NULL;
+    event = (struct ncclProxyProfileEvent*)args->subs[sub].profilingEvents[step%NCCL_MAX_STEPS];
+    if (state == ncclProxyProfileEnd) args->subs[sub].profilingEvents[step%NCCL_MAX_STEPS] = NULL;
     if (state == ncclProxyProfileAppendEnd) event->opCount = args->opCount;
   }
   // Timestamp
@@ -57,15 +170,7 @@ ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step,
   return ncclSuccess;
 }
 
-void ncclProfilingDump() {
-  static int dumpDone = 0;
-  if (dumpDone) return;
-  dumpDone = 1;
-  const char* str = ncclGetEnv("NCCL_PROXY_PROFILE");
-  if (!str) { free(profilingEvents); return; }
-  FILE* f = fopen(str, "w");
-  fprintf(f, "[\n");
-
+static void proxyProfilingDump(FILE* f) {
   for (int i=0; i<profilingIndex; i++) {
     struct ncclProxyProfileEvent* e = profilingEvents+i;
     const int sendrecv = e->peer >= 0;
@@ -105,11 +210,209 @@ void ncclProfilingDump() {
           typeStr, i, e->timestamp[1]);
     }
   }
-  fprintf(f, "{} ]\n");
-  fclose(f);
   free(profilingEvents);
+  profilingEvents = NULL;
+}
+#else
+ncclResult_t ncclProfilingTimelineRecord(struct ncclProxyArgs* args, int sub, int step, int state) { return ncclSuccess; }
+#endif
+
+#if defined(PROFILE_PROXY) || defined(ENABLE_DEVICE_PROFILE)
+void ncclProfilingDump() {
+  static int dumpDone = 0;
+#ifdef ENABLE_DEVICE_PROFILE
+  // Wait for the last comm with device rings, see ncclProfilingDeviceDetach
+  pthread_mutex_lock(&deviceLock);
+  if (deviceComms > 0 || __atomic_exchange_n(&dumpDone, 1, __ATOMIC_ACQ_REL)) {
+    pthread_mutex_unlock(&deviceLock);
+    return;
+  }
+#else
+  if (__atomic_exchange_n(&dumpDone, 1, __ATOMIC_ACQ_REL)) return;
+#endif
+  const char* str = ncclGetEnv("NCCL_PROXY_PROFILE");
+  FILE* f = str ? fopen(str, "w") : NULL;
+  if (f) fprintf(f, "[\n");
+#ifdef PROFILE_PROXY
+  if (f) proxyProfilingDump(f);
+  else free(profilingEvents);
+#endif
+#ifdef ENABLE_DEVICE_PROFILE
+  if (f) deviceProfilingDump(f);
+  free(deviceEvents);
+  deviceEvents = NULL;
+  pthread_mutex_unlock(&deviceLock);
+#endif
+  if (f) {
+    fprintf(f, "{} ]\n");
+    fclose(f);
+  }
 }
 #else
-ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state) { return ncclSuccess; }
 void ncclProfilingDump() {}
 #endif
+
+#include <dlfcn.h>
+#include "param.h"
+
+static pthread_mutex_t profilerPluginLock = PTHREAD_MUTEX_INITIALIZER;
+static int profilerPluginRefCount;
+static void* profilerPluginLib = nullptr;
+static ncclProfiler_t* profilerSymbol = nullptr;
+
+// v1 plugins get the same events without the operation tags.
+static ncclProfiler_v1_t* profilerSymbolV1 = nullptr;
+static ncclProfiler_t profilerV1Compat;
+
+static void profilerV1CompatPlanLaunch(void* context, uint64_t opCount, uint64_t channelMask, int nColl, cudaStream_t stream, uint64_t opTag) {
+  profilerSymbolV1->planLaunch(context, opCount, channelMask, nColl, stream);
+}
+static void profilerV1CompatProxyOpState(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, int state, uint64_t opTag) {
+  profilerSymbolV1->proxyOpState(context, opCount, channelId, peer, isSend, step, state);
+}
+static void profilerV1CompatNetComplete(void* context, uint64_t opCount, int channelId, int peer, int isSend, int step, size_t size, uint64_t opTag) {
+  profilerSymbolV1->netComplete(context, opCount, channelId, peer, isSend, step, size);
+}
+
+static ncclProfiler_t* profilerV1CompatInit(ncclProfiler_v1_t* v1) {
+  profilerSymbolV1 = v1;
+  profilerV1Compat.name = v1->name;
+  profilerV1Compat.init = v1->init;
+  profilerV1Compat.collEnqueue = v1->collEnqueue;
+  profilerV1Compat.planLaunch = v1->planLaunch ? profilerV1CompatPlanLaunch : nullptr;
+  profilerV1Compat.proxyOpState = v1->proxyOpState ? profilerV1CompatProxyOpState : nullptr;
+  profilerV1Compat.netComplete = v1->netComplete ? profilerV1CompatNetComplete : nullptr;
+  profilerV1Compat.destroy = v1->destroy;
+  return &profilerV1Compat;
+}
+
+static void* openProfilerPluginLib(void) {
+  char libName[PATH_MAX];
+  const char* envName = ncclGetEnv("NCCL_PROFILER_PLUGIN");
+  if (envName == nullptr || strlen(envName) == 0) {
+    snprintf(libName, PATH_MAX, "libnccl-profiler.so");
+  } else {
+    INFO(NCCL_ENV, "PROFILER/Plugin: NCCL_PROFILER_PLUGIN set to %s", envName);
+    // Try the name as given first, then as a plugin suffix.
+    void* handle = dlopen(envName, RTLD_LAZY | RTLD_LOCAL);
+    if (handle) return handle;
+    snprintf(libName, PATH_MAX, "libnccl-profiler-%s.so", envName);
+  }
+  void* handle = dlopen(libName, RTLD_LAZY | RTLD_LOCAL);
+  if (handle == nullptr) {
+    INFO(NCCL_ENV, "PROFILER/Plugin: No plugin found (%s)", libName);
+  }
+  return handle;
+}
+
+enum {
+  profilerPluginLoadFailed  = -1,
+  profilerPluginLoadReady   =  0,
+  profilerPluginLoadSuccess =  1,
+};
+static int profilerPluginStatus = profilerPluginLoadReady;
+
+ncclResult_t ncclProfilerPluginLoad(ncclProfiler_t** profiler) {
+  // Initialize to nullptr by default if the profiler cannot be loaded.
+  *profiler = nullptr;
+  if (profilerPluginLoadFailed == profilerPluginStatus) {
+    return ncclSuccess;
+  }
+
+  pthread_mutex_lock(&profilerPluginLock);
+  if (profilerPluginLoadFailed == profilerPluginStatus) {
+    goto exit;
+  }
+
+  if (profilerPluginLoadSuccess == profilerPluginStatus) {
+    *profiler = profilerSymbol;
+    ++profilerPluginRefCount;
+    goto exit;
+  }
+
+  profilerPluginLib = openProfilerPluginLib();
+  if (nullptr == profilerPluginLib) {
+    goto fail;
+  }
+
+  profilerSymbol = (ncclProfiler_t*)dlsym(profilerPluginLib, NCCL_PROFILER_PLUGIN_SYMBOL);
+  if (profilerSymbol == nullptr) {
+    ncclProfiler_v1_t* v1 = (ncclProfiler_v1_t*)dlsym(profilerPluginLib, NCCL_PROFILER_PLUGIN_SYMBOL_V1);
+    if (v1 == nullptr) {
+      INFO(NCCL_ENV, "PROFILER/Plugin: Failed to find " NCCL_PROFILER_PLUGIN_SYMBOL " or " NCCL_PROFILER_PLUGIN_SYMBOL_V1 ", profiler plugin disabled.");
+      dlclose(profilerPluginLib);
+      goto fail;
+    }
+    INFO(NCCL_ENV, "PROFILER/Plugin: Found " NCCL_PROFILER_PLUGIN_SYMBOL_V1 ", no operation tags.");
+    profilerSymbol = profilerV1CompatInit(v1);
+  }
+
+  INFO(NCCL_ENV, "PROFILER/Plugin: Using profiler plugin %s", profilerSymbol->name);
+  *profiler = profilerSymbol;
+  ++profilerPluginRefCount;
+  profilerPluginStatus = profilerPluginLoadSuccess;
+
+exit:
+  pthread_mutex_unlock(&profilerPluginLock);
+  return ncclSuccess;
+fail:
+  profilerPluginLib = nullptr;
+  profilerPluginStatus = profilerPluginLoadFailed;
+  goto exit;
+}
+
+ncclResult_t ncclProfilerPluginUnload(ncclProfiler_t** profiler) {
+  if (*profiler == nullptr) return ncclSuccess;
+  pthread_mutex_lock(&profilerPluginLock);
+  if (0 == (--profilerPluginRefCount)) {
+    INFO(NCCL_ENV, "PROFILER/Plugin: Closing profiler: '%s'", profilerSymbol->name);
+    dlclose(profilerPluginLib);
+    profilerPluginLib = nullptr;
+    profilerSymbol = nullptr;
+    profilerSymbolV1 = nullptr;
+    profilerPluginStatus = profilerPluginLoadReady;
+  }
+  *profiler = nullptr;
+  pthread_mutex_unlock(&profilerPluginLock);
+  return ncclSuccess;
+}
+
+// CUPTI is only looked up at runtime, declare what we use of cupti_activity.h.
+#define NCCL_CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0 3
+typedef int (*cuptiPushExternalCorrelationId_t)(int kind, uint64_t id);
+typedef int (*cuptiPopExternalCorrelationId_t)(int kind, uint64_t* lastId);
+static cuptiPushExternalCorrelationId_t cuptiPush = nullptr;
+static cuptiPopExternalCorrelationId_t cuptiPop = nullptr;
+static pthread_once_t cuptiOnce = PTHREAD_ONCE_INIT;
+
+NCCL_PARAM(CuptiCorrelation, "CUPTI_CORRELATION", 0);
+
+static void cuptiLoad() {
+  if (ncclParamCuptiCorrelation() == 0) return;
+  void* handle = dlopen("libcupti.so", RTLD_NOW | RTLD_NOLOAD);
+  if (handle == nullptr) handle = dlopen("libcupti.so", RTLD_NOW);
+  if (handle == nullptr) {
+    INFO(NCCL_INIT, "PROFILER/CUPTI: failed to open libcupti.so, no external correlation");
+    return;
+  }
+  cuptiPush = (cuptiPushExternalCorrelationId_t)dlsym(handle, "cuptiActivityPushExternalCorrelationId");
+  cuptiPop = (cuptiPopExternalCorrelationId_t)dlsym(handle, "cuptiActivityPopExternalCorrelationId");
+  if (cuptiPush == nullptr || cuptiPop == nullptr) {
+    INFO(NCCL_INIT, "PROFILER/CUPTI: external correlation not supported by libcupti.so");
+    cuptiPush = nullptr;
+    cuptiPop = nullptr;
+    return;
+  }
+  INFO(NCCL_INIT, "PROFILER/CUPTI: tagging kernel launches with CUSTOM0 external correlation ids");
+}
+
+void ncclProfilingCorrelationPush(uint64_t opTag) {
+  if (opTag == 0) return;
+  pthread_once(&cuptiOnce, cuptiLoad);
+  if (cuptiPush) cuptiPush(NCCL_CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, opTag);
+}
+
+void ncclProfilingCorrelationPop(uint64_t opTag) {
+  uint64_t lastId;
+  if (opTag != 0 && cuptiPop) cuptiPop(NCCL_CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, &lastId);
+}
@@ -16,6 +16,92 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <utils.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// 0: default pages, 1: transparent huge pages, 2: 2MB huge pages, 3: 1GB huge pages
+NCCL_PARAM(HostHugePages, "HOST_HUGEPAGES", 0);
+NCCL_PARAM(HostNumaBind, "HOST_NUMA_BIND", 0);
+
+#define HOST_HUGEPAGE_2M (1UL << 21)
+#define HOST_HUGEPAGE_1G (1UL << 30)
+
+// Must be called before the pages are first touched.
+static void hostMemAdvise(void* ptr, size_t size, int numaId) {
+  if (ncclParamHostHugePages() > 0 && madvise(ptr, size, MADV_HUGEPAGE) != 0) {
+    INFO(NCCL_ALLOC, "madvise(MADV_HUGEPAGE) of %p size %zu failed : %s", ptr, size, strerror(errno));
+  }
+  if (ncclParamHostNumaBind() && numaId >= 0 && numaId < 64) {
+    // Preferred rather than bound so that a full node does not fail the allocation.
+    unsigned long nodeMask = 1UL << numaId;
+    if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &nodeMask, 64, 0) != 0) {
+      INFO(NCCL_ALLOC, "mbind of %p size %zu to NUMA node %d failed : %s", ptr, size, numaId, strerror(errno));
+    }
+  }
+}
+
+static bool hostMemCustom() {
+  return ncclParamHostHugePages() > 0 || ncclParamHostNumaBind();
+}
+
+static size_t hostMemAllocSize(size_t size) {
+  int64_t mode = ncclParamHostHugePages();
+  if (mode >= 3) return ROUNDUP(size, HOST_HUGEPAGE_1G);
+  if (mode == 2 || (mode == 1 && size >= HOST_HUGEPAGE_2M)) return ROUNDUP(size, HOST_HUGEPAGE_2M);
+  return ROUNDUP(size, sysconf(_SC_PAGESIZE));
+}
+
+ncclResult_t ncclHostMemAlloc(void** ptr, size_t size, int numaId) {
+  *ptr = NULL;
+  if (!hostMemCustom()) return ncclCudaHostCalloc((char**)ptr, size);
+
+  ncclResult_t ret = ncclSuccess;
+  size_t allocSize = hostMemAllocSize(size);
+  int64_t mode = ncclParamHostHugePages();
+  void* p = MAP_FAILED;
+  cudaStreamCaptureMode captureMode = cudaStreamCaptureModeRelaxed;
+  if (mode >= 2) {
+    int hugeFlags = MAP_HUGETLB | ((mode >= 3 ? 30 : 21) << MAP_HUGE_SHIFT);
+    p = mmap(NULL, allocSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | hugeFlags, -1, 0);
+    if (p == MAP_FAILED) {
+      INFO(NCCL_ALLOC, "Could not get %zu bytes of %s huge pages (%s), using default pages", allocSize, mode >= 3 ? "1GB" : "2MB", strerror(errno));
+    }
+  }
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, allocSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      WARN("Failed to map %zu bytes of host memory : %s", allocSize, strerror(errno));
+      return ncclSystemError;
+    }
+  }
+  hostMemAdvise(p, allocSize, numaId);
+  // First touch, so that pages are placed according to the advice above
+  memset(p, 0, allocSize);
+  CUDACHECKGOTO(cudaThreadExchangeStreamCaptureMode(&captureMode), ret, fail);
+  CUDACHECKGOTO(cudaHostRegister(p, allocSize, cudaHostRegisterMapped), ret, restore);
+  INFO(NCCL_ALLOC, "Host Alloc Size %zu (%zu) pointer %p NUMA node %d", size, allocSize, p, numaId);
+  ncclMemTrack(p, allocSize, 1);
+  *ptr = p;
+restore:
+  CUDACHECK(cudaThreadExchangeStreamCaptureMode(&captureMode));
+  if (ret != ncclSuccess) goto fail;
+  return ncclSuccess;
+fail:
+  munmap(p, allocSize);
+  return ret;
+}
+
+ncclResult_t ncclHostMemFree(void* ptr, size_t size) {
+  if (!hostMemCustom()) return ncclCudaHostFree(ptr);
+  if (ptr == NULL) return ncclSuccess;
+  ncclMemUntrack(ptr);
+  CUDACHECK(cudaHostUnregister(ptr));
+  if (munmap(ptr, hostMemAllocSize(size)) != 0) {
+    WARN("munmap of host memory %p size %zu failed : %s", ptr, size, strerror(errno));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
 
 struct shmHandleInternal {
   int fd;
@@ -87,6 +173,9 @@ ncclResult_t ncclShmOpen(char* shmPath, size_t shmSize, void** shmPtr, void** de
   }
 
   if (create) {
+    // tmpfs can only use transparent huge pages. Its NUMA placement follows the
+    // creating thread, which NCCL binds close to the GPU during init.
+    hostMemAdvise(hptr, realShmSize, -1);
     *(int*)(hptr + shmSize) = refcount;
   } else {
     int remref = ncclAtomicRefCountDecrement((int*)(hptr + shmSize));
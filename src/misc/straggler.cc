@@ -0,0 +1,105 @@
+/*************************************************************************
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "straggler.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "param.h"
+
+NCCL_PARAM(Straggler, "STRAGGLER", 0);
+NCCL_PARAM(StragglerInterval, "STRAGGLER_INTERVAL", 128);
+
+ncclResult_t ncclStragglerInit(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclStraggler* straggler = NULL;
+  if (ncclParamStraggler() == 0) return ncclSuccess;
+  NCCLCHECK(ncclCalloc(&straggler, 1));
+  // Exchanged stamps must not have been overwritten by later plans yet
+  straggler->interval = std::min(std::max(1, (int)ncclParamStragglerInterval()), NCCL_ARRIVAL_SLOTS/2);
+  NCCLCHECKGOTO(ncclCudaHostCalloc(&straggler->arrivals, NCCL_ARRIVAL_SLOTS), ret, fail);
+  comm->straggler = straggler;
+  INFO(NCCL_INIT, "Straggler detection enabled, exchanging arrival times every %d plans", straggler->interval);
+exit:
+  return ret;
+fail:
+  free(straggler);
+  goto exit;
+}
+
+ncclResult_t ncclStragglerFree(struct ncclComm* comm) {
+  if (comm->straggler == NULL) return ncclSuccess;
+  NCCLCHECK(ncclCudaHostFree(comm->straggler->arrivals));
+  free(comm->straggler);
+  comm->straggler = NULL;
+  return ncclSuccess;
+}
+
+uint32_t ncclStragglerPlanArrival(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  struct ncclStraggler* straggler = comm->straggler;
+  // Point-to-point plans differ between ranks, and captured plans run later
+  // and any number of times.
+  if (straggler == NULL || plan->persistent || plan->collOpCount == 0 || plan->hasP2p) return 0;
+  int slot = straggler->seq % NCCL_ARRIVAL_SLOTS;
+  __atomic_store_n(straggler->arrivals+slot, 0, __ATOMIC_RELAXED);
+  if (++straggler->seq - straggler->syncedSeq >= (uint64_t)straggler->interval) straggler->syncPending = true;
+  return slot+1;
+}
+
+// Bucket b holds lateness in [2^(b-1), 2^b) us, bucket 0 less than 1 us.
+static int skewBucket(uint64_t ns) {
+  int b = 0;
+  for (uint64_t us = ns/1000; us && b < NCCL_STATS_SKEW_BUCKETS-1; us >>= 1) b++;
+  return b;
+}
+
+ncclResult_t ncclStragglerSync(struct ncclComm* comm) {
+  struct ncclStraggler* straggler = comm->straggler;
+  ncclResult_t ret = ncclSuccess;
+  uint64_t* all = NULL;
+  int* lastCount = NULL;
+  if (straggler == NULL || !straggler->syncPending) return ncclSuccess;
+  // Every rank gave slots to the same plans, so they agree on the window.
+  int n = straggler->seq - straggler->syncedSeq;
+  NCCLCHECK(ncclCalloc(&all, n*comm->nRanks));
+  NCCLCHECKGOTO(ncclCalloc(&lastCount, comm->nRanks), ret, exit);
+  for (int i=0; i<n; i++) {
+    all[comm->rank*n+i] = __atomic_load_n(straggler->arrivals+(straggler->syncedSeq+i)%NCCL_ARRIVAL_SLOTS, __ATOMIC_RELAXED);
+  }
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, all, n*sizeof(uint64_t)), ret, exit);
+  {
+    int measured = 0;
+    uint64_t maxSkew = 0;
+    for (int i=0; i<n; i++) {
+      uint64_t first = UINT64_MAX, last = 0;
+      int lastRank = -1;
+      for (int r=0; r<comm->nRanks; r++) {
+        uint64_t t = all[r*n+i];
+        if (t == 0) { lastRank = -1; break; } // Some rank hasn't started it yet
+        first = std::min(first, t);
+        if (t >= last) { last = t; lastRank = r; }
+      }
+      if (lastRank == -1) continue;
+      measured++;
+      maxSkew = std::max(maxSkew, last-first);
+      lastCount[lastRank]++;
+      ncclStatsAdd(comm->stats.arrivalSkew+skewBucket(all[comm->rank*n+i]-first), 1);
+      if (lastRank == comm->rank) ncclStatsAdd(&comm->stats.arrivalsLast, 1);
+    }
+    ncclStatsAdd(&comm->stats.arrivalsMeasured, measured);
+    if (comm->rank == 0 && measured > 0) {
+      int worst = 0;
+      for (int r=1; r<comm->nRanks; r++) if (lastCount[r] > lastCount[worst]) worst = r;
+      INFO(NCCL_TUNING, "Straggler: %d/%d plans measured, rank %d arrived last %d times, max skew %.1f us",
+          measured, n, worst, lastCount[worst], maxSkew/1000.0);
+    }
+  }
+  straggler->syncedSeq = straggler->seq;
+  straggler->syncPending = false;
+exit:
+  free(lastCount);
+  free(all);
+  return ret;
+}
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 
 #include "debug.h"
+#include "checks.h"
 #include "nccl_tuner.h"
 
 pthread_mutex_t tunerPluginLock = PTHREAD_MUTEX_INITIALIZER;
@@ -17,6 +18,82 @@ static int tunerPluginRefCount;
 static void* tunerPluginLib = nullptr;
 ncclTuner_t* tunerSymbol = nullptr;
 
+// v2 plugins pick algorithm and protocol directly, either or both. Translate
+// that into the v3 cost table by keeping only the entry, or the row or column,
+// they chose.
+static ncclTuner_v2_t* tunerSymbolV2 = nullptr;
+static ncclTuner_t tunerV2Compat;
+
+bool ncclTunerIsV2(ncclTuner_t* tuner) {
+  return tuner == &tunerV2Compat;
+}
+
+ncclResult_t ncclTunerV2GetCollInfo(void* context, ncclFunc_t collType, size_t nBytes, int collNetSupport, int nvlsSupport,
+    int numPipeOps, int* algorithm, int* protocol, int* nChannels) {
+  *algorithm = NCCL_ALGO_UNDEF;
+  *protocol = NCCL_PROTO_UNDEF;
+  NCCLCHECK(tunerSymbolV2->getCollInfo(context, collType, nBytes, collNetSupport, nvlsSupport, numPipeOps,
+        algorithm, protocol, nChannels));
+  if (*algorithm < 0 || *algorithm >= NCCL_NUM_ALGORITHMS) *algorithm = NCCL_ALGO_UNDEF;
+  if (*protocol < 0 || *protocol >= NCCL_NUM_PROTOCOLS) *protocol = NCCL_PROTO_UNDEF;
+  return ncclSuccess;
+}
+
+static ncclResult_t tunerV2CompatGetCollInfo(void* context, ncclFunc_t collType, size_t nBytes, int numPipeOps,
+    float* collCostTable, int numAlgo, int numProto, int* nChannels) {
+  int collNetSupport = 0, nvlsSupport = 0;
+  for (int p=0; p<numProto; p++) {
+    if (collCostTable[NCCL_ALGO_COLLNET_DIRECT*numProto+p] != NCCL_ALGO_PROTO_IGNORE ||
+        collCostTable[NCCL_ALGO_COLLNET_CHAIN*numProto+p] != NCCL_ALGO_PROTO_IGNORE) collNetSupport = 1;
+    if (collCostTable[NCCL_ALGO_NVLS*numProto+p] != NCCL_ALGO_PROTO_IGNORE ||
+        collCostTable[NCCL_ALGO_NVLS_TREE*numProto+p] != NCCL_ALGO_PROTO_IGNORE) nvlsSupport = 1;
+  }
+  int algorithm, protocol;
+  NCCLCHECK(ncclTunerV2GetCollInfo(context, collType, nBytes, collNetSupport, nvlsSupport, numPipeOps,
+        &algorithm, &protocol, nChannels));
+  if (algorithm == NCCL_ALGO_UNDEF && protocol == NCCL_PROTO_UNDEF) return ncclSuccess;
+  // Leave the table alone if nothing the plugin chose is available
+  bool chosen = false;
+  for (int a=0; a<numAlgo; a++) {
+    for (int p=0; p<numProto; p++) {
+      if ((algorithm != NCCL_ALGO_UNDEF && a != algorithm) || (protocol != NCCL_PROTO_UNDEF && p != protocol)) continue;
+      if (collCostTable[a*numProto+p] != NCCL_ALGO_PROTO_IGNORE) chosen = true;
+    }
+  }
+  if (!chosen) return ncclSuccess;
+  for (int a=0; a<numAlgo; a++) {
+    for (int p=0; p<numProto; p++) {
+      if ((algorithm != NCCL_ALGO_UNDEF && a != algorithm) || (protocol != NCCL_PROTO_UNDEF && p != protocol))
+        collCostTable[a*numProto+p] = NCCL_ALGO_PROTO_IGNORE;
+    }
+  }
+  return ncclSuccess;
+}
+
+static ncclTuner_t* tunerV2CompatInit(ncclTuner_v2_t* v2) {
+  tunerSymbolV2 = v2;
+  tunerV2Compat.name = v2->name;
+  tunerV2Compat.init = v2->init;
+  tunerV2Compat.getCollInfo = tunerV2CompatGetCollInfo;
+  tunerV2Compat.collComplete = nullptr;
+  tunerV2Compat.getChunkSize = nullptr;
+  tunerV2Compat.destroy = v2->destroy;
+  return &tunerV2Compat;
+}
+
+// v3 plugins only lack getChunkSize, NCCL keeps its own chunk sizes
+static ncclTuner_t tunerV3Compat;
+
+static ncclTuner_t* tunerV3CompatInit(ncclTuner_v3_t* v3) {
+  tunerV3Compat.name = v3->name;
+  tunerV3Compat.init = v3->init;
+  tunerV3Compat.getCollInfo = v3->getCollInfo;
+  tunerV3Compat.collComplete = v3->collComplete;
+  tunerV3Compat.getChunkSize = nullptr;
+  tunerV3Compat.destroy = v3->destroy;
+  return &tunerV3Compat;
+}
+
 static void* tryOpenDynamicLib(const char* name) {
   if (nullptr == name || strlen(name) == 0) {
     return nullptr;
@@ -157,9 +234,19 @@ ncclResult_t ncclTunerPluginLoad(ncclTuner_t** tuner) {
 
   tunerSymbol = (ncclTuner_t*)dlsym(tunerPluginLib, NCCL_TUNER_PLUGIN_SYMBOL);
   if (tunerSymbol == nullptr) {
-    INFO(NCCL_ENV|NCCL_TUNING, "TUNER/Plugin: Failed to find " NCCL_TUNER_PLUGIN_SYMBOL ", using internal tuner instead.");
-    dlclose(tunerPluginLib);
-    goto fail;
+    ncclTuner_v3_t* v3 = (ncclTuner_v3_t*)dlsym(tunerPluginLib, NCCL_TUNER_PLUGIN_SYMBOL_V3);
+    ncclTuner_v2_t* v2 = v3 ? nullptr : (ncclTuner_v2_t*)dlsym(tunerPluginLib, NCCL_TUNER_PLUGIN_SYMBOL_V2);
+    if (v3) {
+      INFO(NCCL_ENV|NCCL_TUNING, "TUNER/Plugin: Found " NCCL_TUNER_PLUGIN_SYMBOL_V3 ", no chunk size tuning.");
+      tunerSymbol = tunerV3CompatInit(v3);
+    } else if (v2) {
+      INFO(NCCL_ENV|NCCL_TUNING, "TUNER/Plugin: Found " NCCL_TUNER_PLUGIN_SYMBOL_V2 ", no duration feedback.");
+      tunerSymbol = tunerV2CompatInit(v2);
+    } else {
+      INFO(NCCL_ENV|NCCL_TUNING, "TUNER/Plugin: Failed to find " NCCL_TUNER_PLUGIN_SYMBOL ", " NCCL_TUNER_PLUGIN_SYMBOL_V3 " or " NCCL_TUNER_PLUGIN_SYMBOL_V2 ", using internal tuner instead.");
+      dlclose(tunerPluginLib);
+      goto fail;
+    }
   }
 
   INFO(NCCL_ENV|NCCL_TUNING, "TUNER/Plugin: Using tuner plugin %s", tunerSymbol->name);
@@ -184,6 +271,7 @@ ncclResult_t ncclTunerPluginUnload(ncclTuner_t** tuner) {
     dlclose(tunerPluginLib);
     tunerPluginLib = nullptr;
     tunerSymbol = nullptr;
+    tunerSymbolV2 = nullptr;
     *tuner = nullptr;
   }
   pthread_mutex_unlock(&tunerPluginLock);
@@ -330,6 +330,12 @@ const char* ncclDatatypeToString(ncclDataType_t type) {
 #if defined(__CUDA_BF16_TYPES_EXIST__)
     case ncclBfloat16:
       return "ncclBfloat16";
+#endif
+#if defined(__CUDA_FP8_TYPES_EXIST__)
+    case ncclFloat8e4m3:
+      return "ncclFloat8e4m3";
+    case ncclFloat8e5m2:
+      return "ncclFloat8e5m2";
 #endif
     default:
       return "Unknown";
@@ -350,6 +356,12 @@ const char* ncclAlgoToString(int algo) {
       return "NVLS";
     case NCCL_ALGO_NVLS_TREE:
       return "NVLS_TREE";
+    case NCCL_ALGO_HIER:
+      return "HIER";
+    case NCCL_ALGO_RING_SCATTER:
+      return "RING_SCATTER";
+    case NCCL_ALGO_RECDBL:
+      return "RECDBL";
     default:
       return "Unknown";
   }
@@ -11,16 +11,22 @@
 #include <string.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <stddef.h>
 //#include <sys/types.h>
 //#include <sys/stat.h>
 //#include <unistd.h>
 
-static ncclNet_v8_t ncclNet_v5_as_v8;
-static ncclNet_v8_t ncclNet_v6_as_v8;
-static ncclNet_v8_t ncclNet_v7_as_v8;
+__thread struct ncclNetQos ncclNetQosCurrent = { -1, -1, -1, -1, -1 };
+
+static ncclNet_t ncclNet_v5_as_v8;
+static ncclNet_t ncclNet_v6_as_v8;
+static ncclNet_t ncclNet_v7_as_v8;
+static ncclNet_t ncclNet_v8_as_v9;
 static ncclNet_v5_t *ncclNet_v5;
 static ncclNet_v6_t *ncclNet_v6;
 static ncclNet_v7_t *ncclNet_v7;
+static ncclNet_v8_t *ncclNet_v8;
+static_assert(offsetof(ncclNet_v9_t, irecvConsumed) == offsetof(ncclNet_v8_t, irecvConsumed), "ncclNet_v9_t must extend ncclNet_v8_t");
 static ncclCollNet_v8_t ncclCollNet_v5_as_v8;
 static ncclCollNet_v8_t ncclCollNet_v6_as_v8;
 static ncclCollNet_v8_t ncclCollNet_v7_as_v8;
@@ -423,7 +429,17 @@ ncclResult_t ncclNetPluginInit() {
     return ncclSuccess;
   }
 
-  ncclNets[0] = (ncclNet_v8_t*)dlsym(netPluginLib, "ncclNetPlugin_v8");
+  ncclNets[0] = (ncclNet_v9_t*)dlsym(netPluginLib, "ncclNetPlugin_v9");
+  if (ncclNets[0] == nullptr) {
+    INFO(NCCL_INIT|NCCL_NET, "NET/Plugin: Failed to find ncclNetPlugin_v9 symbol.");
+    ncclNet_v8 = (ncclNet_v8_t*)dlsym(netPluginLib, "ncclNetPlugin_v8");
+    if (ncclNet_v8 != nullptr) {
+      // v9 only appends the optional one-sided calls, which stay NULL
+      memcpy(&ncclNet_v8_as_v9, ncclNet_v8, sizeof(ncclNet_v8_t));
+      ncclNets[0] = &ncclNet_v8_as_v9;
+      INFO(NCCL_INIT|NCCL_NET, "NET/Plugin: Loaded net plugin %s (v8)", ncclNets[0]->name);
+    }
+  }
   if (ncclNets[0] == nullptr) {
     INFO(NCCL_INIT|NCCL_NET, "NET/Plugin: Failed to find ncclNetPlugin_v8 symbol.");
     // Try v7 plugin
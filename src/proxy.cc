@@ -10,6 +10,9 @@
 #include "socket.h"
 #include "shm.h"
 #include "profiler.h"
+#include "cpuset.h"
+#include "net.h"
+#include "bootstrap.h"
 #define ENABLE_TIMER 0
 #include "timer.h"
 
@@ -17,6 +20,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 enum { proxyRecv=0, proxySend=1 };
 
@@ -40,43 +45,64 @@ struct ncclProxyPool {
   struct ncclProxyArgs elems[PROXYARGS_ALLOCATE_SIZE];
 };
 
-static void expectedProxyResponseFree(struct ncclProxyState* state) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  struct ncclExpectedProxyResponse* prev = NULL;
-
-  while (elem) {
-    prev = elem;
-    elem = elem->next;
-    free(prev->respBuff);
-    free(prev);
-  }
+static struct ncclExpectedProxyResponse** expectedProxyResponseBucket(struct ncclProxyState* state, void* opId) {
+  uint64_t h = (uint64_t)(uintptr_t)opId * 0x9E3779B97F4A7C15ULL;
+  return state->expectedResponses + (h >> 32) % NCCL_PROXY_RESPONSE_BUCKETS;
 }
 
-static ncclResult_t expectedProxyResponseStore(struct ncclProxyState* state, void* opId, void* respBuff, int respSize, ncclResult_t res) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  while (elem) {
-    if (elem->opId == opId) {
-      if (respSize != elem->respSize) {
-        WARN("Mismatched response size for opId=%p", opId);
-        return ncclInternalError;
-      }
+static struct ncclExpectedProxyResponse* expectedProxyResponseFind(struct ncclProxyState* state, void* opId) {
+  struct ncclExpectedProxyResponse* elem = *expectedProxyResponseBucket(state, opId);
+  while (elem && elem->opId != opId) elem = elem->next;
+  return elem;
+}
 
-      if (elem->done) {
-        WARN("Storing response for already completed opId=%p", opId);
-        return ncclInternalError;
-      }
+// Unlink and free the element of opId, returns false if there is none.
+static bool expectedProxyResponseUnlink(struct ncclProxyState* state, void* opId, void* respBuff, ncclResult_t* res) {
+  struct ncclExpectedProxyResponse** ptr = expectedProxyResponseBucket(state, opId);
+  while (*ptr && (*ptr)->opId != opId) ptr = &(*ptr)->next;
+  struct ncclExpectedProxyResponse* elem = *ptr;
+  if (elem == NULL) return false;
+  *ptr = elem->next;
+  if (respBuff) memcpy(respBuff, elem->respBuff, elem->respSize);
+  if (res) *res = elem->res;
+  free(elem->respBuff);
+  free(elem);
+  return true;
+}
 
-      memcpy(elem->respBuff, respBuff, respSize);
-      free(respBuff);
-      elem->done = true;
-      elem->res  = res;
-      return ncclSuccess;
+static void expectedProxyResponseFree(struct ncclProxyState* state) {
+  for (int b = 0; b < NCCL_PROXY_RESPONSE_BUCKETS; b++) {
+    struct ncclExpectedProxyResponse* elem = state->expectedResponses[b];
+    while (elem) {
+      struct ncclExpectedProxyResponse* next = elem->next;
+      free(elem->respBuff);
+      free(elem);
+      elem = next;
     }
-    elem = elem->next;
+    state->expectedResponses[b] = NULL;
   }
+}
 
-  WARN("Proxy response for opId=%p doesn't match any expected response", opId);
-  return ncclInternalError;
+static ncclResult_t expectedProxyResponseStore(struct ncclProxyState* state, void* opId, void* respBuff, int respSize, ncclResult_t res) {
+  struct ncclExpectedProxyResponse* elem = expectedProxyResponseFind(state, opId);
+  if (elem == NULL) {
+    WARN("Proxy response for opId=%p doesn't match any expected response", opId);
+    return ncclInternalError;
+  }
+  if (respSize != elem->respSize) {
+    WARN("Mismatched response size for opId=%p", opId);
+    return ncclInternalError;
+  }
+  if (elem->done) {
+    WARN("Storing response for already completed opId=%p", opId);
+    return ncclInternalError;
+  }
+
+  memcpy(elem->respBuff, respBuff, respSize);
+  free(respBuff);
+  elem->done = true;
+  elem->res  = res;
+  return ncclSuccess;
 }
 
 static ncclResult_t expectedProxyResponseEnqueue(struct ncclProxyState* state, void* opId, int respSize) {
@@ -90,103 +116,57 @@ static ncclResult_t expectedProxyResponseEnqueue(struct ncclProxyState* state, v
   ex->res      = ncclInternalError;
   ex->done     = false;
 
-  // Enqueue
-  struct ncclExpectedProxyResponse* list = state->expectedResponses;
-  if (list == NULL) {
-    state->expectedResponses = ex;
-    return ncclSuccess;
-  }
-  while (list->next) list = list->next;
-  list->next = ex;
+  // Responses are matched by opId only, order within a bucket doesn't matter
+  struct ncclExpectedProxyResponse** bucket = expectedProxyResponseBucket(state, opId);
+  ex->next = *bucket;
+  *bucket = ex;
   return ncclSuccess;
 }
 
 static ncclResult_t expectedProxyResponseDequeue(struct ncclProxyState* state, void* opId, void* respBuff, int* found) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  struct ncclExpectedProxyResponse* prev = NULL;
+  struct ncclExpectedProxyResponse* elem = expectedProxyResponseFind(state, opId);
   *found = 0;
-  while (elem) {
-    if ((elem->opId == opId) && elem->done) {
-      if (prev == NULL) {
-        state->expectedResponses = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      memcpy(respBuff, elem->respBuff, elem->respSize);
-      ncclResult_t res = elem->res;
-      free(elem->respBuff);
-      free(elem);
-      *found = 1;
-      return res;
-    }
-    prev = elem;
-    elem = elem->next;
-  }
-  return ncclSuccess;
+  if (elem == NULL || !elem->done) return ncclSuccess;
+  ncclResult_t res = ncclSuccess;
+  expectedProxyResponseUnlink(state, opId, respBuff, &res);
+  *found = 1;
+  return res;
 }
 
 static ncclResult_t expectedProxyResponseRemove(struct ncclProxyState* state, void* opId) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  struct ncclExpectedProxyResponse* prev = NULL;
-  while (elem) {
-    if (elem->opId == opId) {
-      if (prev == NULL) {
-        state->expectedResponses = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      free(elem->respBuff);
-      free(elem);
-      return ncclSuccess;
-    }
-    prev = elem;
-    elem = elem->next;
-  }
+  if (expectedProxyResponseUnlink(state, opId, NULL, NULL)) return ncclSuccess;
   WARN("Couldn't find opId=%p", opId);
   return ncclInternalError;
 }
 
 static ncclResult_t asyncProxyOpEnqueue(struct ncclProxyLocalPeer* peer, ncclProxyAsyncOp* op) {
-  ncclProxyAsyncOp* list = peer->asyncOps;
-  if (list == NULL) {
-    peer->asyncOps = op;
-    return ncclSuccess;
-  }
-  while (list->next) list = list->next;
-  list->next = op;
+  op->next = NULL;
+  op->prev = peer->asyncOpsTail;
+  if (peer->asyncOpsTail) peer->asyncOpsTail->next = op;
+  else peer->asyncOps = op;
+  peer->asyncOpsTail = op;
   return ncclSuccess;
 }
 
+// op is always an element of the peer's list, so it is unlinked in place.
 static ncclResult_t asyncProxyOpDequeue(struct ncclProxyLocalPeer* peer, ncclProxyAsyncOp* op) {
-  struct ncclProxyAsyncOp* elem = peer->asyncOps;
-  struct ncclProxyAsyncOp* prev = NULL;
-  while (elem) {
-    if (elem->opId == op->opId) {
-      if (prev == NULL) {
-        peer->asyncOps = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-
-      if (elem->reqBuff) {
-        free(elem->reqBuff);
-      }
-      if (elem->respBuff) {
-        free(elem->respBuff);
-      }
-      free(elem);
+  if (op == NULL) {
+    WARN("Attempting to dequeue null operation");
+    return ncclInternalError;
+  }
+  if (op->prev) op->prev->next = op->next;
+  else peer->asyncOps = op->next;
+  if (op->next) op->next->prev = op->prev;
+  else peer->asyncOpsTail = op->prev;
 
-      return ncclSuccess;
-    }
-    prev = elem;
-    elem = elem->next;
+  if (op->reqBuff) {
+    free(op->reqBuff);
   }
-  if (op) {
-    WARN("Attempting to dequeue nonexistent async opId=%p", op->opId);
-  } else {
-    WARN("Attempting to dequeue null operation");
+  if (op->respBuff) {
+    free(op->respBuff);
   }
-  return ncclInternalError;
+  free(op);
+  return ncclSuccess;
 }
 
 static ncclResult_t allocateArgs(struct ncclProxyProgressState* state, struct ncclProxyArgs** argsptr) {
@@ -195,7 +175,12 @@ static ncclResult_t allocateArgs(struct ncclProxyProgressState* state, struct nc
     // Allocate a new pool of elements. Make sure we allocate the memory close
     // to the network thread
     struct ncclProxyPool* newPool;
-    NCCLCHECK(ncclCalloc(&newPool, 1));
+    // Sub args are cache line aligned
+    if (posix_memalign((void**)&newPool, alignof(struct ncclProxyPool), sizeof(struct ncclProxyPool)) != 0) {
+      WARN("Failed to allocate %zu bytes of proxy args", sizeof(struct ncclProxyPool));
+      return ncclSystemError;
+    }
+    memset(newPool, 0, sizeof(struct ncclProxyPool));
 
     struct ncclProxyArgs* newElems = newPool->elems;
     // Chain newly allocated elements
@@ -361,6 +346,9 @@ static ncclResult_t ncclProxyOpToArgs(struct ncclProxyOp* op, struct ncclProxyAr
   sub->offset = 0;
   sub->peer = op->root;
   sub->reg = op->reg;
+  sub->regHost = op->regHost;
+  sub->profile = op->profile;
+  sub->opTag = op->opTag;
   sub->sendMhandle = op->sendMhandle;
   sub->recvMhandle = op->recvMhandle;
   sub->sendbuff = op->sendbuff;
@@ -369,6 +357,7 @@ static ncclResult_t ncclProxyOpToArgs(struct ncclProxyOp* op, struct ncclProxyAr
   if (subIndex) {
     if ((args->sliceSteps != op->sliceSteps) ||
         (args->chunkSteps != op->chunkSteps) ||
+        (args->collnetDepth != op->collnetDepth) ||
         (args->protocol != op->protocol) ||
         (args->dtype != op->dtype) ||
         (args->redOp != op->redOp) ||
@@ -388,11 +377,13 @@ static ncclResult_t ncclProxyOpToArgs(struct ncclProxyOp* op, struct ncclProxyAr
   args->sliceSteps = op->sliceSteps;
   args->chunkSteps = op->chunkSteps;
   args->chunkSize = op->chunkSize;
+  args->collnetDepth = op->collnetDepth;
   args->dtype = op->dtype;
   args->redOp = op->redOp;
   args->pattern = op->pattern;
   args->protocol = op->protocol;
   args->coll = op->coll;
+  args->priority = op->priority;
   args->specifics = op->specifics;
   args->state = ncclProxyOpReady;
   args->progress = op->connection->tcomm->proxyProgress;
@@ -425,6 +416,14 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
       // Create the list
       DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld) as first element\n", OP_INDEX(args), shared, args->opCount);
       state->active = args;
+    } else if (args->priority) {
+      // Insert after the last high priority element, so that each progress
+      // pass services (and posts sends for) high priority ops before bulk ones.
+      struct ncclProxyArgs** ptr = &state->active;
+      while (*ptr && (*ptr)->priority) ptr = &(*ptr)->next;
+      args->next = *ptr;
+      *ptr = args;
+      DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld) as high priority element\n", OP_INDEX(args), shared, args->opCount);
     } else {
       // Append element at the end of the list
       struct ncclProxyArgs* last = state->active;
@@ -437,19 +436,58 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
   return ncclSuccess;
 }
 
-ncclResult_t ncclProxyPost(struct ncclProxyOpsPool* pool, int nextOps, int nextOpsEnd) {
-  pthread_mutex_lock(&pool->mutex);
-  if (pool->nextOps == -1) {
-    pool->nextOps = nextOps;
+static void proxyWakeFd(int fd) {
+  uint64_t one = 1;
+  ssize_t n = write(fd, &one, sizeof(one));
+  (void)n;
+}
+
+// Posting is lock free. The progress thread sets waiting (resp. sleeping) before
+// checking the rings one last time, so either it sees our ops or we see it
+// waiting and wake it up.
+ncclResult_t ncclProxyPost(struct ncclProxyOpsPool* pool, int tpLocalRank, int nextOps, int nextOpsEnd) {
+  struct ncclProxyPostRing* ring = pool->posted+tpLocalRank;
+  uint64_t tail = ring->tail;
+  while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == MAX_OPS_PER_PEER) sched_yield();
+  ring->chains[tail%MAX_OPS_PER_PEER].nextOps = nextOps;
+  ring->chains[tail%MAX_OPS_PER_PEER].nextOpsEnd = nextOpsEnd;
+  __atomic_store_n(&ring->tail, tail+1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&pool->mutex);
     pthread_cond_signal(&pool->cond);
-  } else {
-    pool->ops[pool->nextOpsEnd].next = nextOps;
+    pthread_mutex_unlock(&pool->mutex);
   }
-  pool->nextOpsEnd = nextOpsEnd;
-  pthread_mutex_unlock(&pool->mutex);
+  // Ranks in other processes can't wake a sleeping progress thread, it will find their
+  // ops when its sleep times out.
+  if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) && pool->pid == getpid()) proxyWakeFd(pool->wakeFd);
   return ncclSuccess;
 }
 
+static bool proxyOpsPosted(struct ncclProxyState* proxyState, struct ncclProxyOpsPool* pool) {
+  for (int r = 0; r < proxyState->tpLocalnRanks; r++) {
+    if (__atomic_load_n(&pool->posted[r].tail, __ATOMIC_SEQ_CST) != pool->posted[r].head) return true;
+  }
+  return false;
+}
+
+// Take all chains posted so far and link them into one.
+static int proxyOpsTakePosted(struct ncclProxyState* proxyState, struct ncclProxyOpsPool* pool) {
+  int first = -1, last = -1;
+  for (int r = 0; r < proxyState->tpLocalnRanks; r++) {
+    struct ncclProxyPostRing* ring = pool->posted+r;
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      int nextOps = ring->chains[head%MAX_OPS_PER_PEER].nextOps;
+      if (first == -1) first = nextOps;
+      else pool->ops[last].next = nextOps;
+      last = ring->chains[head%MAX_OPS_PER_PEER].nextOpsEnd;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+  return first;
+}
+
 static ncclResult_t ncclLocalOpAppend(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, struct ncclProxyOp* proxyOp) {
   int tpLocalRank = comm->topParentLocalRanks[comm->localRank];
   struct ncclProxyOps* proxyOps = comm->proxyState->proxyOps;
@@ -505,7 +543,7 @@ static ncclResult_t ncclLocalOpAppend(struct ncclComm* comm, struct ncclProxyCon
     int nextOps = proxyOps->nextOps;
     proxyOps->nextOps = pool->ops[lastOp].next;
     pool->ops[lastOp].next = -1;
-    NCCLCHECK(ncclProxyPost(proxyOps->pool, nextOps, lastOp));
+    NCCLCHECK(ncclProxyPost(proxyOps->pool, tpLocalRank, nextOps, lastOp));
     proxyOps->count -= toSend;
   }
   TIME_STOP(0);
@@ -587,6 +625,51 @@ ncclResult_t ncclProxySaveOp(struct ncclComm* comm, struct ncclProxyOp* op, bool
       NCCLCHECK(SaveProxy(comm, channel, proxySend, channel->nvls.treeDown[2], op, 0, justInquire));
       NCCLCHECK(SaveProxy(comm, channel, proxyRecv, channel->nvls.treeUp, op, 0, justInquire));
     } break;
+  case ncclPatternHier: {
+      // op->nsteps covers one chunk per loop. Each loop moves nNodes chunks
+      // per intra-node ring step and one chunk per inter-node ring step.
+      // AllGather goes around each ring once, AllReduce twice.
+      struct ncclHier* hier = &channel->hier;
+      struct ncclProxyOp intraOp = *op, interOp = *op;
+      int nPasses = op->coll == ncclFuncAllGather ? 1 : 2;
+      intraOp.nsteps = op->nsteps * nPasses*(hier->nLocal-1) * hier->nNodes;
+      interOp.nsteps = op->nsteps * nPasses*(hier->nNodes-1);
+      NCCLCHECK(SaveProxy(comm, channel, proxyRecv, hier->intraPrev, &intraOp, 0, justInquire));
+      NCCLCHECK(SaveProxy(comm, channel, proxySend, hier->intraNext, &intraOp, 0, justInquire));
+      NCCLCHECK(SaveProxy(comm, channel, proxyRecv, hier->interPrev, &interOp, 0, justInquire));
+      NCCLCHECK(SaveProxy(comm, channel, proxySend, hier->interNext, &interOp, 0, justInquire));
+    } break;
+  case ncclPatternRingScatter: {
+      // op->nsteps covers one chunk per loop. How many of the nRanks chunks
+      // of each loop go through a rank depends on its distance to the root,
+      // see broadcast.h and reduce.h.
+      struct ncclRing* ring = &channel->ring;
+      int nRanks = comm->nRanks, dist = 0;
+      while (ring->userRanks[(nRanks-dist)%nRanks] != op->root) dist++;
+      int nRecv, nSend;
+      if (op->coll == ncclFuncBroadcast) {
+        nRecv = (dist == 0 ? 0 : nRanks-dist) + nRanks-1;
+        nSend = (dist == 0 ? nRanks-1 : nRanks-1-dist) + nRanks-1;
+      } else {
+        nRecv = nRanks-1 + (dist == 0 ? nRanks-1 : dist-1);
+        nSend = dist == 0 ? nRanks-1 : nRanks-1+dist;
+      }
+      struct ncclProxyOp recvOp = *op, sendOp = *op;
+      recvOp.nsteps = op->nsteps * nRecv;
+      sendOp.nsteps = op->nsteps * nSend;
+      NCCLCHECK(SaveProxy(comm, channel, proxyRecv, ring->prev, &recvOp, 0, justInquire));
+      NCCLCHECK(SaveProxy(comm, channel, proxySend, ring->next, &sendOp, 0, justInquire));
+    } break;
+  case ncclPatternRecDbl: {
+      // Every chunk goes once each way to each peer, and to the folded rank
+      struct ncclRecDbl* recDbl = &channel->recDbl;
+      for (int i=0; i<recDbl->nPeers; i++) {
+        NCCLCHECK(SaveProxy(comm, channel, proxyRecv, recDbl->peers[i], op, 0, justInquire));
+        NCCLCHECK(SaveProxy(comm, channel, proxySend, recDbl->peers[i], op, 0, justInquire));
+      }
+      NCCLCHECK(SaveProxy(comm, channel, proxyRecv, recDbl->extra, op, 0, justInquire));
+      NCCLCHECK(SaveProxy(comm, channel, proxySend, recDbl->extra, op, 0, justInquire));
+    } break;
   case ncclPatternSend:
   case ncclPatternRecv: {
       if (op->root == comm->rank) return ncclSuccess;
@@ -689,16 +772,50 @@ static ncclResult_t removeOp(struct ncclProxyProgressState* state, struct ncclPr
   return ncclSuccess;
 }
 
+// NVTX range covering the life of a proxy operation on the progress thread,
+// so Nsight Systems shows network activity next to the kernels.
+static void proxyNvtxStart(struct ncclProxyArgs* op) {
+  struct NvtxParamsProxyOp {
+    uint64_t opCount;
+    size_t bytes;
+    int coll;
+    int pattern;
+    int protocol;
+    int nsubs;
+    int channelId;
+    int peer;
+    int nsteps;
+  };
+  static constexpr nvtxPayloadSchemaEntry_t ProxyOpSchema[] = {
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_UINT64, "Operation count"},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_SIZE, "Bytes", nullptr, 0, offsetof(NvtxParamsProxyOp, bytes)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Collective", nullptr, 0, offsetof(NvtxParamsProxyOp, coll)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Pattern", nullptr, 0, offsetof(NvtxParamsProxyOp, pattern)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Protocol", nullptr, 0, offsetof(NvtxParamsProxyOp, protocol)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Sub operations", nullptr, 0, offsetof(NvtxParamsProxyOp, nsubs)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "First channel", nullptr, 0, offsetof(NvtxParamsProxyOp, channelId)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "First peer", nullptr, 0, offsetof(NvtxParamsProxyOp, peer)},
+    {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "Steps", nullptr, 0, offsetof(NvtxParamsProxyOp, nsteps)}
+  };
+  size_t bytes = 0;
+  for (int s=0; s<op->nsubs; s++) bytes += op->subs[s].nbytes;
+  NvtxParamsProxyOp payload{op->opCount, bytes, op->coll, op->pattern, op->protocol, op->nsubs,
+    op->subs[0].channelId, op->subs[0].peer, op->subs[0].nsteps};
+  NVTX3_RANGE_START_WITH_PARAMS(ProxyOp, "ncclProxyOp", payload, op->nvtxRange);
+}
+
 static ncclResult_t progressOps(struct ncclProxyState* proxyState, struct ncclProxyProgressState* state, struct ncclProxyArgs* opStart, int* idle) {
   struct ncclProxyArgs* prevOp = NULL;
   struct ncclProxyArgs* op = opStart;
   while (op) {
     if (op->state == ncclProxyOpNone) return ncclInternalError;
+    if (op->state == ncclProxyOpReady) proxyNvtxStart(op);
     TIME_START(0); TIME_START(1);
     NCCLCHECK(op->progress(proxyState, op));
     if (op->idle) { TIME_STOP(1); TIME_CANCEL(0); } else { TIME_CANCEL(1); TIME_STOP(0); }
     *idle &= op->idle;
     if (op->state == ncclProxyOpNone) {
+      NVTX3_RANGE_END(op->nvtxRange);
       TIME_START(2);
       NCCLCHECK(removeOp(state, &op, &prevOp));
       TIME_STOP(2);
@@ -712,6 +829,26 @@ static ncclResult_t progressOps(struct ncclProxyState* proxyState, struct ncclPr
 
 NCCL_PARAM(ProxyAppendBatchSize, "PROXY_APPEND_BATCH_SIZE", 16);
 
+static bool proxyShardFull(struct ncclProxyProgressShard* shard) {
+  return shard->tail - __atomic_load_n(&shard->head, __ATOMIC_ACQUIRE) == NCCL_PROXY_SHARD_QUEUE_SIZE;
+}
+
+// Only called by the main progress thread.
+static void proxyShardPush(struct ncclProxyProgressShard* shard, struct ncclProxyOp* op) {
+  shard->queue[shard->tail%NCCL_PROXY_SHARD_QUEUE_SIZE] = *op;
+  __atomic_store_n(&shard->tail, shard->tail+1, __ATOMIC_SEQ_CST);
+}
+
+static void proxyShardWake(struct ncclProxyProgressShard* shard) {
+  // The shard sets sleeping before checking the queue one last time, so
+  // either it sees our ops or we see it sleeping.
+  if (__atomic_load_n(&shard->sleeping, __ATOMIC_SEQ_CST) == 0) return;
+  if (shard->state.wakeFd != -1) proxyWakeFd(shard->state.wakeFd);
+  pthread_mutex_lock(&shard->mutex);
+  pthread_cond_signal(&shard->cond);
+  pthread_mutex_unlock(&shard->mutex);
+}
+
 static ncclResult_t ncclProxyGetPostedOps(struct ncclProxyState* proxyState, int* added) {
   struct ncclProxyProgressState* state = &proxyState->progressState;
   if (state->opsPool == NULL) return ncclInternalError;
@@ -720,31 +857,27 @@ static ncclResult_t ncclProxyGetPostedOps(struct ncclProxyState* proxyState, int
   struct ncclProxyArgs profArgs; // Only used for profiling purposes
   if (state->nextOps != -1) goto process_nextops;
 
-  // If we have ops to progress, no need to block waiting for something to arrive or even wait for the lock
-  // to be available. Exit, continue progress, and come back later.
-  if (state->active != NULL && (pool->nextOps == -1 || pthread_mutex_trylock(&pool->mutex) != 0)) return ncclSuccess;
-
+  // If we have ops to progress, no need to block waiting for something to arrive.
+  // Take what is there, continue progress, and come back later.
   if (state->active == NULL) {
     pthread_mutex_lock(&pool->mutex);
-    while (pool->nextOps == -1 && !state->stop) {
+    __atomic_store_n(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+    while (!proxyOpsPosted(proxyState, pool) && !state->stop) {
       struct ncclProxyArgs profArgs; // Only used for profiling purposes
-      ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileSleep);
+      ncclProfilingRecord(proxyState, &profArgs, 0, 0, ncclProxyProfileSleep);
       pthread_cond_wait(&pool->cond, &pool->mutex);
-      ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileWakeup);
-    }
-    if (state->stop) { // We might have been woken up to stop.
-      pthread_mutex_unlock(&pool->mutex);
-      return ncclSuccess;
+      ncclProfilingRecord(proxyState, &profArgs, 0, 0, ncclProxyProfileWakeup);
     }
+    __atomic_store_n(&pool->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->mutex);
+    if (state->stop) return ncclSuccess; // We might have been woken up to stop.
   }
 
-  state->nextOps = pool->nextOps;
-  pool->nextOps = pool->nextOpsEnd = -1;
-  pthread_mutex_unlock(&pool->mutex);
-  if (state->nextOps == -1) return ncclInternalError;
+  state->nextOps = proxyOpsTakePosted(proxyState, pool);
+  if (state->nextOps == -1) return ncclSuccess;
 
 process_nextops:
-  ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileAppend);
+  ncclProfilingRecord(proxyState, &profArgs, 0, 0, ncclProxyProfileAppend);
   TIME_START(2);
   int freeOp[NCCL_MAX_LOCAL_RANKS];
   int freeOpEnd[NCCL_MAX_LOCAL_RANKS];
@@ -753,6 +886,7 @@ process_nextops:
   uint64_t lastOpCount = 0;
   int lastPeer = -1;
   int count = 0;
+  uint64_t pushed = 0;
   for (int opIndex = state->nextOps; opIndex != -1;) {
     struct ncclProxyOp* peerOp = pool->ops+opIndex;
     int peer = opIndex / MAX_OPS_PER_PEER;
@@ -761,8 +895,15 @@ process_nextops:
     lastOpCount = peerOp->opCount;
     lastPeer = peer;
     if (peerOp->connection == NULL) return ncclInternalError;
+    int shard = peerOp->connection->progressShard;
+    if (shard && proxyShardFull(state->shards+shard-1)) break;
     if (peerOp->next != -1) __builtin_prefetch(pool->ops+peerOp->next);
-    NCCLCHECK(ProxyAppend(state, peerOp));
+    if (shard) {
+      proxyShardPush(state->shards+shard-1, peerOp);
+      pushed |= 1UL << shard;
+    } else {
+      NCCLCHECK(ProxyAppend(state, peerOp));
+    }
     (*added)++;
     int lastOpIndex = opIndex;
     opIndex = peerOp->next;
@@ -776,6 +917,10 @@ process_nextops:
     state->nextOps = opIndex;
   }
 
+  for (int s = 1; s < state->nShards; s++) {
+    if (pushed & (1UL << s)) proxyShardWake(state->shards+s-1);
+  }
+
   for (int i = 0; i < proxyState->tpLocalnRanks; i++) {
     if (freeOp[i] == -1) continue;
     int newFree = freeOp[i];
@@ -796,7 +941,7 @@ process_nextops:
     }
   }
   profArgs.opCount = *added;
-  ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileAppendEnd);
+  ncclProfilingRecord(proxyState, &profArgs, 0, 0, ncclProxyProfileAppendEnd);
   TIME_STOP(2);
   return ncclSuccess;
 }
@@ -840,6 +985,44 @@ static int setProxyThreadContext(struct ncclProxyState* proxyState) {
   return 0;
 }
 
+// Once all ops have been idle for NCCL_PROXY_SLEEP_IDLE us, the progress thread sleeps until
+// new ops are posted, a network completion arrives, or NCCL_PROXY_SLEEP_MAX us have passed,
+// which bounds the delay to notice progress of the GPU or of other processes.
+NCCL_PARAM(ProxySleepIdle, "PROXY_SLEEP_IDLE", 0);
+NCCL_PARAM(ProxySleepMax, "PROXY_SLEEP_MAX", 1000);
+
+// Network completions only wake us up with the internal IB plugin.
+static ncclResult_t proxySleep(struct ncclProxyState* proxyState, struct ncclProxyProgressState* state, int* idle) {
+  struct pollfd fds[NCCL_MAX_NETDEVS+1];
+  int netFds[NCCL_MAX_NETDEVS];
+  int nNetFds = 0;
+  if (proxyState->ncclNet == &ncclNetIb) NCCLCHECK(ncclIbCqEventsArm(netFds, NCCL_MAX_NETDEVS, &nNetFds));
+  // Completions which arrived before the CQs were armed won't raise events, look one last time.
+  NCCLCHECK(progressOps(proxyState, state, state->active, idle));
+  if (*idle == 0) return ncclSuccess;
+
+  fds[0].fd = state->wakeFd;
+  fds[0].events = POLLIN;
+  for (int i=0; i<nNetFds; i++) {
+    fds[i+1].fd = netFds[i];
+    fds[i+1].events = POLLIN;
+  }
+  int64_t sleepMax = ncclParamProxySleepMax();
+  struct timespec timeout = { (time_t)(sleepMax/1000000), (long)(sleepMax%1000000)*1000 };
+  int n = ppoll(fds, nNetFds+1, &timeout, NULL);
+  if (n == -1 && errno != EINTR) {
+    WARN("[Proxy Progress] ppoll failed : %s", strerror(errno));
+    return ncclSystemError;
+  }
+  if (n > 0 && (fds[0].revents & POLLIN)) {
+    uint64_t count;
+    ssize_t r = read(state->wakeFd, &count, sizeof(count));
+    (void)r;
+  }
+  if (n > 0 && nNetFds) NCCLCHECK(ncclIbCqEventsDrain());
+  return ncclSuccess;
+}
+
 // Set to SIGUSR1 or SIGUSR2 to help debug proxy state during hangs
 NCCL_PARAM(ProxyDumpSignal, "PROXY_DUMP_SIGNAL", -1);
 NCCL_PARAM(ProgressAppendOpFreq, "PROGRESS_APPENDOP_FREQ", 8);
@@ -851,7 +1034,7 @@ void* ncclProxyProgress(void *proxyState_) {
   } else if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
     WARN("[Proxy Progress] Failed to set CUDA device %d", proxyState->cudaDev);
   }
-  // if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
+  if (CPU_COUNT(&proxyState->affinity)) sched_setaffinity(0, sizeof(cpu_set_t), &proxyState->affinity);
 
   struct ncclProxyProgressState* state = &proxyState->progressState;
   state->nextOps = -1;
@@ -869,17 +1052,42 @@ void* ncclProxyProgress(void *proxyState_) {
    * ncclParamProgressAppendOpFreq(). If they are equal, we will append proxy ops. This will decrease the
    * frequency of calling ncclProxyGetPostedOps() and reduce the perf impact. */
   int proxyOpAppendCounter = 0;
+  uint64_t idleStart = 0;
+  uint64_t lastTime = clockNano();
   struct ncclProxyArgs profArgs; // Only used for profiling purposes
   while ((state->stop == 0 || (state->stop == 1 && state->active)) && *proxyState->abortFlag == 0) {
     int idle = 1;
     ncclResult_t ret = progressOps(proxyState, state, state->active, &idle);
+    uint64_t now = clockNano();
+    ncclStatsAdd(idle ? &proxyState->stats.idleNs : &proxyState->stats.activeNs, now-lastTime);
+    lastTime = now;
     if (ret != ncclSuccess) {
       __atomic_store_n(&proxyState->asyncResult, ret, __ATOMIC_RELEASE);
       INFO(NCCL_ALL,"%s:%d -> %d [Progress Thread]", __FILE__, __LINE__, ret);
       continue;
     }
-    if (lastIdle == 0 && idle == 1) ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileIdle);
-    if (lastIdle == 1 && idle == 0) ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileActive);
+    if (state->wakeFd != -1 && idle && state->active && state->nextOps == -1) {
+      struct ncclProxyOpsPool* pool = state->opsPool;
+      if (idleStart == 0) {
+        idleStart = now;
+      } else if (now - idleStart > ncclParamProxySleepIdle()*1000) {
+        __atomic_store_n(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!proxyOpsPosted(proxyState, pool) && state->stop == 0) ret = proxySleep(proxyState, state, &idle);
+        __atomic_store_n(&pool->sleeping, 0, __ATOMIC_RELAXED);
+        now = clockNano();
+        ncclStatsAdd(&proxyState->stats.idleNs, now-lastTime);
+        lastTime = now;
+        idleStart = 0;
+        if (ret != ncclSuccess) {
+          __atomic_store_n(&proxyState->asyncResult, ret, __ATOMIC_RELEASE);
+          INFO(NCCL_ALL,"%s:%d -> %d [Progress Thread]", __FILE__, __LINE__, ret);
+        }
+      }
+    } else {
+      idleStart = 0;
+    }
+    if (lastIdle == 0 && idle == 1) ncclProfilingRecord(proxyState, &profArgs, 0, 0, ncclProxyProfileIdle);
+    if (lastIdle == 1 && idle == 0) ncclProfilingRecord(proxyState, &profArgs, 0, 0, ncclProxyProfileActive);
     if (idle || (++proxyOpAppendCounter == ncclParamProgressAppendOpFreq())) {
       int added = 0;
       proxyOpAppendCounter = 0;
@@ -900,14 +1108,86 @@ void* ncclProxyProgress(void *proxyState_) {
   return NULL;
 }
 
+static ncclResult_t proxyShardGetPostedOps(struct ncclProxyProgressShard* shard, int* added) {
+  struct ncclProxyProgressState* state = &shard->state;
+  uint64_t tail = __atomic_load_n(&shard->tail, __ATOMIC_ACQUIRE);
+  if (shard->head == tail && state->active == NULL) {
+    pthread_mutex_lock(&shard->mutex);
+    __atomic_store_n(&shard->sleeping, 1, __ATOMIC_SEQ_CST);
+    while ((tail = __atomic_load_n(&shard->tail, __ATOMIC_SEQ_CST)) == shard->head && !state->stop) {
+      pthread_cond_wait(&shard->cond, &shard->mutex);
+    }
+    __atomic_store_n(&shard->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  for (uint64_t head = shard->head; head < tail; head++) {
+    NCCLCHECK(ProxyAppend(state, shard->queue+head%NCCL_PROXY_SHARD_QUEUE_SIZE));
+    (*added)++;
+  }
+  __atomic_store_n(&shard->head, tail, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
+static void* ncclProxyProgressShardMain(void* shard_) {
+  struct ncclProxyProgressShard* shard = (struct ncclProxyProgressShard*)shard_;
+  struct ncclProxyState* proxyState = shard->proxyState;
+  struct ncclProxyProgressState* state = &shard->state;
+  if (setProxyThreadContext(proxyState)) {
+    INFO(NCCL_INIT, "[Proxy Progress %d] Created CUDA context on device %d", shard->index, proxyState->cudaDev);
+  } else if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
+    WARN("[Proxy Progress %d] Failed to set CUDA device %d", shard->index, proxyState->cudaDev);
+  }
+  if (CPU_COUNT(&shard->affinity)) sched_setaffinity(0, sizeof(cpu_set_t), &shard->affinity);
+  char threadName[NCCL_THREAD_NAMELEN];
+  snprintf(threadName, NCCL_THREAD_NAMELEN, "NCCL Progress%2d.%d", proxyState->cudaDev, shard->index);
+  nvtxNameOsThreadA(syscall(SYS_gettid), threadName);
+
+  uint64_t idleStart = 0;
+  uint64_t lastTime = clockNano();
+  // The main progress thread stops (and stops feeding us) before we are asked to.
+  while ((state->stop == 0 || state->active || shard->head != __atomic_load_n(&shard->tail, __ATOMIC_ACQUIRE)) && *proxyState->abortFlag == 0) {
+    int idle = 1;
+    ncclResult_t ret = progressOps(proxyState, state, state->active, &idle);
+    uint64_t now = clockNano();
+    ncclStatsAdd(idle ? &proxyState->stats.idleNs : &proxyState->stats.activeNs, now-lastTime);
+    lastTime = now;
+    if (ret == ncclSuccess && state->wakeFd != -1 && idle && state->active) {
+      if (idleStart == 0) {
+        idleStart = now;
+      } else if (now - idleStart > ncclParamProxySleepIdle()*1000) {
+        __atomic_store_n(&shard->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (shard->head == __atomic_load_n(&shard->tail, __ATOMIC_SEQ_CST) && state->stop == 0) ret = proxySleep(proxyState, state, &idle);
+        __atomic_store_n(&shard->sleeping, 0, __ATOMIC_RELAXED);
+        now = clockNano();
+        ncclStatsAdd(&proxyState->stats.idleNs, now-lastTime);
+        lastTime = now;
+        idleStart = 0;
+      }
+    } else {
+      idleStart = 0;
+    }
+    if (ret == ncclSuccess) {
+      int added = 0;
+      ret = proxyShardGetPostedOps(shard, &added);
+      if (ret == ncclSuccess && idle && added == 0) sched_yield();
+    }
+    if (ret != ncclSuccess) {
+      __atomic_store_n(&proxyState->asyncResult, ret, __ATOMIC_RELEASE);
+      INFO(NCCL_ALL,"%s:%d -> %d [Progress Thread %d]", __FILE__, __LINE__, ret, shard->index);
+    }
+  }
+  return NULL;
+}
+
 ncclResult_t ncclProxyStart(struct ncclComm* comm) {
   struct ncclProxyOps* proxyOps = comm->proxyState->proxyOps;
   if (proxyOps == NULL) return ncclSuccess;
   TIME_START(1);
+  int tpLocalRank = comm->topParentLocalRanks[comm->localRank];
   for (int r = 0; r < comm->sharedRes->tpNLocalRanks; r++) {
     struct ncclProxyOps* ops = proxyOps + r;
     if (ops->pool == NULL || ops->nextOps == -1) continue;
-    NCCLCHECK(ncclProxyPost(ops->pool, ops->nextOps, ops->nextOpsEnd));
+    NCCLCHECK(ncclProxyPost(ops->pool, tpLocalRank, ops->nextOps, ops->nextOpsEnd));
     ops->nextOps = ops->nextOpsEnd = -1;
     ops->count = 0;
   }
@@ -921,10 +1201,20 @@ static ncclResult_t ncclProxyProgressCreate(struct ncclProxyState* proxyState) {
   if (!state->thread) {
     pthread_create(&state->thread, NULL, ncclProxyProgress, proxyState);
     ncclSetThreadName(state->thread, "NCCL Progress%2d", proxyState->tpLocalnRanks);
+    for (int s = 1; s < state->nShards; s++) {
+      struct ncclProxyProgressShard* shard = state->shards+s-1;
+      pthread_create(&shard->state.thread, NULL, ncclProxyProgressShardMain, shard);
+      ncclSetThreadName(shard->state.thread, "NCCL Progress%2d.%d", proxyState->tpLocalnRanks, s);
+    }
   }
   return ncclSuccess;
 }
 
+int ncclProxyProgressShardForNet(struct ncclProxyState* proxyState, int netDev) {
+  int nShards = proxyState->progressState.nShards;
+  return nShards > 1 ? netDev % nShards : 0;
+}
+
 ncclResult_t ncclProxyProgressDestroy(struct ncclProxyState* proxyState) {
   struct ncclProxyProgressState* state = &proxyState->progressState;
 
@@ -934,8 +1224,32 @@ ncclResult_t ncclProxyProgressDestroy(struct ncclProxyState* proxyState) {
     state->stop = 1;
     pthread_cond_signal(&state->opsPool->cond);
     pthread_mutex_unlock(&state->opsPool->mutex);
+    if (state->wakeFd != -1) proxyWakeFd(state->wakeFd);
     pthread_join(state->thread, NULL);
+    if (state->wakeFd != -1) close(state->wakeFd);
+  }
+
+  for (int s = 1; s < state->nShards; s++) {
+    struct ncclProxyProgressShard* shard = state->shards+s-1;
+    if (shard->state.thread) {
+      pthread_mutex_lock(&shard->mutex);
+      shard->state.stop = 1;
+      pthread_cond_signal(&shard->cond);
+      pthread_mutex_unlock(&shard->mutex);
+      if (shard->state.wakeFd != -1) proxyWakeFd(shard->state.wakeFd);
+      pthread_join(shard->state.thread, NULL);
+      if (shard->state.wakeFd != -1) close(shard->state.wakeFd);
+    }
+    while (shard->state.pools != NULL) {
+      struct ncclProxyPool *next = shard->state.pools->next;
+      free(shard->state.pools);
+      shard->state.pools = next;
+    }
+    pthread_mutex_destroy(&shard->mutex);
+    pthread_cond_destroy(&shard->cond);
   }
+  free(state->shards);
+  state->shards = NULL;
 
   // Free off any memory allocated for the proxy arg pools
   while (state->pools != NULL) {
@@ -991,17 +1305,87 @@ static ncclResult_t proxyFree(struct ncclProxyConnection* connection, struct ncc
   return ncclSuccess;
 }
 
+// Release connections of different transports in parallel at teardown
+NCCL_PARAM(TeardownParallel, "TEARDOWN_PARALLEL", 0);
+
+// Connections of one transport, freed in order by one thread. Connections of
+// a transport share state (NET shared buffers and comms), those of different
+// transports do not.
+struct proxyFreeBatch {
+  struct ncclProxyState* proxyState;
+  struct ncclProxyConnection** connections;
+  int n;
+  ncclResult_t ret;
+};
+
+static void* proxyFreeBatchMain(void* arg) {
+  struct proxyFreeBatch* batch = (struct proxyFreeBatch*)arg;
+  if (cudaSetDevice(batch->proxyState->cudaDev) != cudaSuccess) {
+    batch->ret = ncclUnhandledCudaError;
+    return NULL;
+  }
+  for (int i=0; i<batch->n; i++) {
+    ncclResult_t ret = proxyFree(batch->connections[i], batch->proxyState);
+    if (ret != ncclSuccess && batch->ret == ncclSuccess) batch->ret = ret;
+  }
+  return NULL;
+}
+
+static ncclResult_t proxyFreeConnectionsParallel(struct ncclProxyConnectionPool* pool, struct ncclProxyState* proxyState) {
+  ncclResult_t ret = ncclSuccess;
+  struct proxyFreeBatch batches[NTRANSPORTS];
+  pthread_t threads[NTRANSPORTS];
+  bool started[NTRANSPORTS] = {};
+  memset(batches, 0, sizeof(batches));
+  for (int t=0; t<NTRANSPORTS; t++) batches[t].proxyState = proxyState;
+  for (int pass=0; pass<2; pass++) {
+    // Count, then list the connections of each transport
+    for (int b=0; b<pool->banks; b++) {
+      int max = b == pool->banks-1 ? pool->offset : NCCL_PROXY_CONN_POOL_SIZE;
+      for (int i=0; i<max; i++) {
+        ncclProxyConnection *connection = pool->pools[b]+i;
+        if (connection->state == connUninitialized) continue;
+        struct proxyFreeBatch* batch = batches+connection->transport;
+        if (pass == 0) batch->n++;
+        else batch->connections[batch->n++] = connection;
+      }
+    }
+    if (pass == 1) break;
+    for (int t=0; t<NTRANSPORTS; t++) {
+      if (batches[t].n) NCCLCHECKGOTO(ncclCalloc(&batches[t].connections, batches[t].n), ret, exit);
+      batches[t].n = 0;
+    }
+  }
+  for (int t=0; t<NTRANSPORTS; t++) {
+    if (batches[t].n == 0) continue;
+    started[t] = pthread_create(threads+t, NULL, proxyFreeBatchMain, batches+t) == 0;
+    if (started[t]) ncclSetThreadName(threads[t], "NCCL Free%2d", t);
+    else proxyFreeBatchMain(batches+t);
+  }
+  for (int t=0; t<NTRANSPORTS; t++) {
+    if (started[t]) pthread_join(threads[t], NULL);
+    if (batches[t].ret != ncclSuccess && ret == ncclSuccess) ret = batches[t].ret;
+  }
+exit:
+  for (int t=0; t<NTRANSPORTS; t++) free(batches[t].connections);
+  return ret;
+}
+
 static ncclResult_t ncclProxyFreeConnections(struct ncclProxyConnectionPool* pool, struct ncclProxyState* proxyState) {
-  for (int b=0; b<pool->banks; b++) {
-    int max = b == pool->banks-1 ? pool->offset : NCCL_PROXY_CONN_POOL_SIZE;
-    for (int i=0; i<max; i++) {
-      ncclProxyConnection *connection = pool->pools[b]+i;
-      if (connection->state != connUninitialized) {
-        NCCLCHECK(proxyFree(connection, proxyState));
+  if (ncclParamTeardownParallel()) {
+    NCCLCHECK(proxyFreeConnectionsParallel(pool, proxyState));
+  } else {
+    for (int b=0; b<pool->banks; b++) {
+      int max = b == pool->banks-1 ? pool->offset : NCCL_PROXY_CONN_POOL_SIZE;
+      for (int i=0; i<max; i++) {
+        ncclProxyConnection *connection = pool->pools[b]+i;
+        if (connection->state != connUninitialized) {
+          NCCLCHECK(proxyFree(connection, proxyState));
+        }
       }
     }
-    free(pool->pools[b]);
   }
+  for (int b=0; b<pool->banks; b++) free(pool->pools[b]);
   free(pool->pools);
   return ncclSuccess;
 }
@@ -1014,6 +1398,7 @@ struct ncclProxyInitReq {
   int tpLocalRank;
   int tpRank;
   int sameProcess;
+  int peer; // top parent rank the connection reaches, for memory accounting
 };
 
 struct ncclProxyInitResp {
@@ -1061,6 +1446,8 @@ ncclResult_t ncclProxyConnect(struct ncclComm* comm, int transport, int send, in
   req.tpLocalRank = comm->topParentLocalRanks[comm->localRank];
   req.tpRank = comm->topParentRanks[comm->rank];
   req.sameProcess = proxyConn->sameProcess;
+  int peer = ncclMemCurrentTag.peer;
+  req.peer = peer >= 0 && peer < comm->nRanks ? comm->topParentRanks[peer] : -1;
 
   struct ncclProxyInitResp resp = {0};
   // This usually sends proxyConn->connection to identify which connection this is.
@@ -1084,7 +1471,7 @@ ncclResult_t ncclProxyConnect(struct ncclComm* comm, int transport, int send, in
 }
 
 // UDS support
-ncclResult_t ncclProxyCallBlockingUDS(struct ncclComm* comm, int tpRank, int type, void* reqBuff, int reqSize, void* respBuff, int respSize, int *respFd) {
+ncclResult_t ncclProxyCallBlockingUDS(struct ncclComm* comm, int tpRank, int type, void* reqBuff, int reqSize, void* respBuff, int respSize, int *respFds, int nRespFds) {
   ncclResult_t res = ncclSuccess;
   struct ncclIpcSocket ipcSock = { 0 };
   void *opId;
@@ -1094,8 +1481,8 @@ ncclResult_t ncclProxyCallBlockingUDS(struct ncclComm* comm, int tpRank, int typ
   struct ncclProxyState* sharedProxyState = comm->proxyState;
   uint64_t pidHash = sharedProxyState->peerAddressesUDS[tpRank];
 
-  INFO(NCCL_PROXY, "ProxyCall UDS comm %p rank %d tpRank %d(%lx) reqSize %d respSize %d respFd %p opId %p",
-       comm, rank, tpRank, pidHash, reqSize, respSize, respFd, opId);
+  INFO(NCCL_PROXY, "ProxyCall UDS comm %p rank %d tpRank %d(%lx) reqSize %d respSize %d nRespFds %d opId %p",
+       comm, rank, tpRank, pidHash, reqSize, respSize, nRespFds, opId);
 
   // cuMem: Create a UDS socket to receive the response
   NCCLCHECK(ncclIpcSocketInit(&ipcSock, rank, (uint64_t)opId, comm->abortFlag));
@@ -1109,11 +1496,11 @@ ncclResult_t ncclProxyCallBlockingUDS(struct ncclComm* comm, int tpRank, int typ
   assert(reqSize <= sizeof(hdr.data));
   memcpy(&hdr.data, reqBuff, reqSize);
   NCCLCHECKGOTO(ncclIpcSocketSendMsg(&ipcSock, &hdr, sizeof(hdr), -1, tpRank, pidHash), res, error);
-  NCCLCHECKGOTO(ncclIpcSocketRecvMsg(&ipcSock, respBuff, respSize, respFd), res, error);
+  NCCLCHECKGOTO(ncclIpcSocketRecvMsgFds(&ipcSock, respBuff, respSize, respFds, nRespFds), res, error);
   NCCLCHECKGOTO(ncclIpcSocketClose(&ipcSock), res, error);
 
   INFO(NCCL_PROXY, "ProxyCall UDS comm %p rank %d tpRank %d(%lx) reqSize %d respSize %d respFd %d opId %p - DONE",
-       comm, rank, tpRank, pidHash, reqSize, respSize, (respFd ? *respFd : -1), opId);
+       comm, rank, tpRank, pidHash, reqSize, respSize, (nRespFds ? respFds[0] : -1), opId);
 
   return res;
 
@@ -1129,7 +1516,7 @@ ncclResult_t ncclProxyClientGetFdBlocking(struct ncclComm* comm, int tpRank, voi
   ncclResult_t ret = ncclSuccess;
 
   // Request the allocation of a UDS fd for the handle
-  NCCLCHECKGOTO(ncclProxyCallBlockingUDS(comm, tpRank, ncclProxyMsgGetFd, handle, sizeof(CUmemGenericAllocationHandle), NULL, 0, convertedFd), ret, error);
+  NCCLCHECKGOTO(ncclProxyCallBlockingUDS(comm, tpRank, ncclProxyMsgGetFd, handle, sizeof(CUmemGenericAllocationHandle), NULL, 0, convertedFd, 1), ret, error);
 
   // We have now received the converted fd over UDS
   INFO(NCCL_PROXY, "UDS: ClientGetFd handle 0x%lx tpRank %d returned fd %d", *(uint64_t*)handle, tpRank, *convertedFd);
@@ -1141,7 +1528,20 @@ error:
   return ret;
 }
 
-const char* ncclProxyMsgTypeStr[] = { "Unknown", "Init", "SharedInit", "Setup", "Connect", "Start", "Close", "Abort", "Stop", "GetFd" };
+// Same for up to NCCL_IPC_MAX_FDS handles of tpRank, in a single round trip
+ncclResult_t ncclProxyClientGetFdsBlocking(struct ncclComm* comm, int tpRank, uint64_t* handles, int n, int* convertedFds) {
+  ncclResult_t ret = ncclSuccess;
+  if (n <= 0 || n > NCCL_IPC_MAX_FDS) return ncclInternalError;
+  NCCLCHECKGOTO(ncclProxyCallBlockingUDS(comm, tpRank, ncclProxyMsgGetFd, handles, n*sizeof(uint64_t), NULL, 0, convertedFds, n), ret, error);
+  INFO(NCCL_PROXY, "UDS: ClientGetFds %d handles tpRank %d returned fds %d..", n, tpRank, convertedFds[0]);
+  return ret;
+
+error:
+  WARN("ncclProxyClientGetFds call to tpRank %d for %d handles failed : %d", tpRank, n, ret);
+  return ret;
+}
+
+const char* ncclProxyMsgTypeStr[] = { "Unknown", "Init", "SharedInit", "Setup", "Connect", "Start", "Close", "Abort", "Stop", "GetFd", "Register", "Deregister", "Free" };
 ncclResult_t ncclProxyCallAsync(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, int type, void* reqBuff, int reqSize, int respSize, void* opId) {
   struct ncclSocket* sock;
   ncclResult_t ret = ncclSuccess;
@@ -1256,7 +1656,8 @@ static ncclResult_t proxyProgressInit(struct ncclProxyState* proxyState) {
     shmPath[0] = '\0';
     NCCLCHECK(ncclShmOpen(shmPath, size, (void**)&pool, NULL, proxyState->tpLocalnRanks + 1, &state->handle));
     // Init pool
-    pool->nextOps = -1;
+    for (int r = 0; r < NCCL_MAX_LOCAL_RANKS; r++) pool->posted[r].head = pool->posted[r].tail = 0;
+    pool->waiting = 0;
 
     for (int r = 0; r < proxyState->tpLocalnRanks; r++) {
       pool->freeOps[r] = r*MAX_OPS_PER_PEER;
@@ -1272,6 +1673,16 @@ static ncclResult_t proxyProgressInit(struct ncclProxyState* proxyState) {
     pthread_condattr_t condAttr;
     pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
     pthread_cond_init(&pool->cond, &condAttr);
+    pool->wakeFd = state->wakeFd = -1;
+    for (int s = 1; s < state->nShards; s++) state->shards[s-1].state.wakeFd = -1;
+    if (ncclParamProxySleepIdle() > 0) {
+      pool->pid = getpid();
+      SYSCHECK(pool->wakeFd = state->wakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC), "eventfd");
+      for (int s = 1; s < state->nShards; s++) {
+        SYSCHECK(state->shards[s-1].state.wakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC), "eventfd");
+      }
+      INFO(NCCL_INIT|NCCL_PROXY, "Proxy progress will sleep after %ld us idle, for up to %ld us", ncclParamProxySleepIdle(), ncclParamProxySleepMax());
+    }
     state->opsPool = pool;
 
     memcpy(state->opsPoolShmSuffix, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof("XXXXXX")-1);
@@ -1309,6 +1720,7 @@ static ncclResult_t proxyConnInit(struct ncclProxyLocalPeer* peer, struct ncclPr
   (*connection)->send = req->send;
   (*connection)->tpLocalRank = req->tpLocalRank;
   (*connection)->sameProcess = req->sameProcess;
+  (*connection)->peer = req->peer;
   peer->tpLocalRank = req->tpLocalRank;
   peer->tpRank = req->tpRank;
 
@@ -1327,25 +1739,28 @@ static ncclResult_t proxyConnInit(struct ncclProxyLocalPeer* peer, struct ncclPr
 }
 
 // cuMem API support
-static ncclResult_t proxyGetFd(struct ncclProxyState* proxyState, int rank, void *opId, uint64_t handle) {
+static ncclResult_t proxyGetFds(struct ncclProxyState* proxyState, int rank, void *opId, uint64_t* handles, int n) {
 #if CUDART_VERSION >= 11030
   // cuMem API support
   ncclResult_t ret = ncclSuccess;
   struct ncclIpcSocket ipcSock = { 0 };
   uint64_t hash = (uint64_t) opId;
-  INFO(NCCL_PROXY, "UDS proxyGetFd received handle 0x%lx peer %d opId %lx", handle, rank, hash);
+  INFO(NCCL_PROXY, "UDS proxyGetFd received %d handles, first 0x%lx, peer %d opId %lx", n, handles[0], rank, hash);
 
   CUmemAllocationHandleType type = CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR;
-  int fd = -1;
+  int fds[NCCL_IPC_MAX_FDS];
+  int nFds = 0;
 
-  CUCHECK(cuMemExportToShareableHandle(&fd, handle, type, 0));
-  // Send back the converted fd using UDS
+  for (; nFds < n; nFds++) {
+    CUCHECKGOTO(cuMemExportToShareableHandle(fds+nFds, handles[nFds], type, 0), ret, error);
+  }
+  // Send back the converted fds using UDS
   NCCLCHECKGOTO(ncclIpcSocketInit(&ipcSock, proxyState->tpRank, hash^1, proxyState->abortFlag), ret, error);
-  NCCLCHECKGOTO(ncclIpcSocketSendFd(&ipcSock, fd, rank, hash), ret, error);
+  NCCLCHECKGOTO(ncclIpcSocketSendMsgFds(&ipcSock, NULL, 0, fds, nFds, rank, hash), ret, error);
 error:
   NCCLCHECK(ncclIpcSocketClose(&ipcSock));
-  // We can now safely close the exported fd
-  (void) close(fd);
+  // We can now safely close the exported fds
+  for (int i=0; i<nFds; i++) (void) close(fds[i]);
   return ret;
 #else
   return ncclInternalError;
@@ -1355,6 +1770,11 @@ error:
 static ncclResult_t proxyProgressAsync(struct ncclProxyAsyncOp* op, struct ncclProxyState* proxyState, int* asyncOpCount, struct ncclProxyLocalPeer* peer, struct ncclProxyConnectionPool* connectionPool) {
   int done = 1;
   ncclResult_t res = ncclInternalError;
+  // Account what the transport allocates to the connection
+  struct ncclProxyConnection* connection = op->connection;
+  ncclMemScope memScope(connection ? &proxyState->memStats : NULL,
+      op->type == ncclProxyMsgSharedInit ? ncclMemProxyShared : ncclMemConnector,
+      connection ? connection->transport : -1, connection ? connection->peer : -1);
   if (op->type == ncclProxyMsgSetup) {
     TRACE(NCCL_PROXY, "proxyProgressAsync::proxySetup() opId=%p", op->opId);
     res = op->connection->tcomm->proxySetup(op->connection, proxyState, op->reqBuff, op->reqSize, op->respBuff, op->respSize, &done);
@@ -1376,6 +1796,12 @@ static ncclResult_t proxyProgressAsync(struct ncclProxyAsyncOp* op, struct ncclP
   } else if (op->type == ncclProxyMsgDeregister) {
     TRACE(NCCL_PROXY, "proxyProgressAsync::ncclProxyMsgDeregister opId=%p op.reqBuff=%p, op->reqSize=%d, op->respSize=%d", op->opId, op->reqBuff, op->reqSize, op->respSize);
     res = op->connection->tcomm->proxyDeregister(op->connection, proxyState, op->reqBuff, op->reqSize, &done);
+  } else if (op->type == ncclProxyMsgFree) {
+    TRACE(NCCL_PROXY, "proxyProgressAsync::ncclProxyMsgFree opId=%p", op->opId);
+    res = proxyFree(op->connection, proxyState);
+    // The connection can be set up again; it is not freed a second time at teardown
+    op->connection->transportResources = NULL;
+    __atomic_store_n(&op->connection->state, connUninitialized, __ATOMIC_RELEASE);
   } else return ncclInternalError;
 
   if (done) {
@@ -1448,6 +1874,7 @@ static bool proxyMatchOpType(int type) {
     case ncclProxyMsgGetFd:
     case ncclProxyMsgRegister:
     case ncclProxyMsgDeregister:
+    case ncclProxyMsgFree:
       return true;
     default:
       return false;
@@ -1456,13 +1883,12 @@ static bool proxyMatchOpType(int type) {
 
 void* ncclProxyService(void* _args) {
   struct ncclProxyState* proxyState =  (struct ncclProxyState*) _args;
-  // if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
+  if (CPU_COUNT(&proxyState->affinity)) sched_setaffinity(0, sizeof(cpu_set_t), &proxyState->affinity);
   if (setProxyThreadContext(proxyState)) {
     INFO(NCCL_INIT, "[Proxy Service] Created CUDA context on device %d", proxyState->cudaDev);
   } else if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
     WARN("[Proxy Service] Failed to set CUDA device %d", proxyState->cudaDev);
   }
-  // if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
 
   // Prepare poll descriptor
   struct ncclProxyConnectionPool connectionPool;
@@ -1615,9 +2041,10 @@ static ncclResult_t proxyUDSRecvReq(struct ncclProxyState* proxyState, int reqFd
   NCCLCHECK(ncclIpcSocketRecvMsg(&proxyState->ipcSock, &hdr, sizeof(hdr), NULL));
   if (hdr.type == ncclProxyMsgGetFd) {
     // cuMem API support
-    uint64_t handle = *(uint64_t*)hdr.data;
-    INFO(NCCL_PROXY, "proxyUDSRecvReq::ncclProxyMsgGetFd rank %d opId %p handle=0x%lx", hdr.rank, hdr.opId, handle);
-    return proxyGetFd(proxyState, hdr.rank, hdr.opId, handle);
+    // One fd per handle, see ncclProxyClientGetFdsBlocking
+    int n = std::max(1, std::min(hdr.reqSize/(int)sizeof(uint64_t), NCCL_IPC_MAX_FDS));
+    INFO(NCCL_PROXY, "proxyUDSRecvReq::ncclProxyMsgGetFd rank %d opId %p handle=0x%lx n %d", hdr.rank, hdr.opId, hdr.data[0], n);
+    return proxyGetFds(proxyState, hdr.rank, hdr.opId, hdr.data, n);
   }
 
   return ncclInternalError;
@@ -1633,6 +2060,7 @@ void* ncclProxyServiceUDS(void* _args) {
   } else if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
     WARN("[Proxy Service UDS] Failed to set CUDA device %d", proxyState->cudaDev);
   }
+  if (CPU_COUNT(&proxyState->affinity)) sched_setaffinity(0, sizeof(cpu_set_t), &proxyState->affinity);
 
   if (ncclIpcSocketGetFd(&proxyState->ipcSock, &pollfds[0].fd) != ncclSuccess) {
     WARN("[Proxy Service UDS] Get listenSock fd fails");
@@ -1673,12 +2101,130 @@ ncclResult_t ncclProxyInit(struct ncclComm* comm, struct ncclSocket* sock, union
   comm->proxyState->listenSock = sock;
   comm->proxyState->peerAddresses = peerAddresses;
   comm->proxyState->peerAddressesUDS = peerAddressesUDS;
+  NCCLCHECK(ncclMemStatsInit(&comm->proxyState->memStats, comm->nRanks));
 
   // UDS support
   NCCLCHECK(ncclIpcSocketInit(&comm->proxyState->ipcSock, comm->rank, peerAddressesUDS[comm->rank], comm->abortFlag));
   return ncclSuccess;
 }
 
+// Progress network connections of different NICs on different threads, each
+// running close to its NICs.
+NCCL_PARAM(ProxyNThreads, "PROXY_NTHREADS", 1);
+
+static ncclResult_t proxyProgressShardsInit(struct ncclComm* comm, struct ncclProxyState* proxyState) {
+  struct ncclProxyProgressState* state = &proxyState->progressState;
+  int nNets;
+  NCCLCHECK(ncclTopoGetNetCount(comm->topo, &nNets));
+  // Shards are tracked in a 64-bit mask
+  state->nShards = std::min(std::min((int)ncclParamProxyNThreads(), nNets), 64);
+  if (state->nShards <= 1) {
+    state->nShards = 1;
+    return ncclSuccess;
+  }
+  NCCLCHECK(ncclCalloc(&state->shards, state->nShards-1));
+  for (int s = 1; s < state->nShards; s++) {
+    struct ncclProxyProgressShard* shard = state->shards+s-1;
+    shard->proxyState = proxyState;
+    shard->index = s;
+    pthread_mutex_init(&shard->mutex, NULL);
+    pthread_cond_init(&shard->cond, NULL);
+    // Shard s serves NICs s, s+nShards, ...
+    if (CPU_COUNT(&proxyState->affinity)) {
+      shard->affinity = proxyState->affinity;
+    } else {
+      NCCLCHECK(ncclTopoGetNetCpuAffinity(comm->topo, s, &shard->affinity));
+    }
+    if (CPU_COUNT(&shard->affinity)) {
+      char affinityStr[sizeof(cpu_set_t)*2];
+      NCCLCHECK(ncclCpusetToStr(&shard->affinity, affinityStr));
+      INFO(NCCL_INIT|NCCL_PROXY, "Proxy progress thread %d set to affinity %s", s, affinityStr);
+    }
+  }
+  INFO(NCCL_INIT|NCCL_PROXY, "Using %d proxy progress threads for %d NICs", state->nShards, nNets);
+  return ncclSuccess;
+}
+
+// Number of cores reserved for the proxy threads of each local rank, 0 to
+// leave them on the cores of the GPU like the main thread.
+NCCL_PARAM(ProxyCpuCores, "PROXY_CPU_CORES", 0);
+
+struct proxyCpuInfo {
+  cpu_set_t allowed; // cores the process may use, within its cgroup cpuset
+  cpu_set_t nic; // cores close to the first NIC of the rank
+  cpu_set_t gpu; // cores close to the GPU of the rank
+};
+
+// Moves up to n cores of from not taken yet into cpus, returns how many are missing.
+static int proxyCpuTake(cpu_set_t* from, cpu_set_t* taken, cpu_set_t* cpus, int n) {
+  for (int c=0; c<CPU_SETSIZE && n > 0; c++) {
+    if (!CPU_ISSET(c, from) || CPU_ISSET(c, taken)) continue;
+    CPU_SET(c, cpus);
+    CPU_SET(c, taken);
+    n--;
+  }
+  return n;
+}
+
+// Picks the cores of our proxy threads. Local ranks exchange where they would
+// like to run and all take their cores in local rank order, NIC-local cores
+// first, then GPU-local ones, then any other core they are allowed to use, so
+// that no two ranks of the node pick the same core. allowed is the affinity of
+// the process before it was narrowed to the GPU, NULL to query it.
+ncclResult_t ncclProxyCpuSelect(struct ncclComm* comm, cpu_set_t* allowed) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclProxyState* proxyState = comm->proxyState;
+  struct proxyCpuInfo* infos = NULL;
+  struct proxyCpuInfo* info;
+  cpu_set_t taken;
+  int nCores = ncclParamProxyCpuCores();
+  int nNets;
+  CPU_ZERO(&proxyState->affinity);
+  if (nCores <= 0) return ncclSuccess;
+
+  NCCLCHECK(ncclCalloc(&infos, comm->localRanks));
+  info = infos+comm->localRank;
+  if (allowed) {
+    info->allowed = *allowed;
+  } else {
+    SYSCHECKGOTO(sched_getaffinity(0, sizeof(cpu_set_t), &info->allowed), "sched_getaffinity", ret, fail);
+  }
+  NCCLCHECKGOTO(ncclTopoGetNetCount(comm->topo, &nNets), ret, fail);
+  if (nNets > 0) {
+    int netDev;
+    NCCLCHECKGOTO(ncclTopoGetLocalNet(comm->topo, comm->rank, 0, NULL, &netDev), ret, fail);
+    NCCLCHECKGOTO(ncclTopoGetNetCpuset(comm->topo, netDev, &info->nic), ret, fail);
+  }
+  info->gpu = comm->cpuAffinity;
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, infos, sizeof(struct proxyCpuInfo)), ret, fail);
+
+  CPU_ZERO(&taken);
+  for (int l=0; l<comm->localRanks; l++) {
+    info = infos+l;
+    cpu_set_t nic, gpu, cpus;
+    CPU_AND(&nic, &info->nic, &info->allowed);
+    CPU_AND(&gpu, &info->gpu, &info->allowed);
+    CPU_ZERO(&cpus);
+    int missing = proxyCpuTake(&nic, &taken, &cpus, nCores);
+    missing = proxyCpuTake(&gpu, &taken, &cpus, missing);
+    missing = proxyCpuTake(&info->allowed, &taken, &cpus, missing);
+    if (l != comm->localRank) continue;
+    proxyState->affinity = cpus;
+    if (CPU_COUNT(&cpus)) {
+      char affinityStr[sizeof(cpu_set_t)*2];
+      NCCLCHECKGOTO(ncclCpusetToStr(&cpus, affinityStr), ret, fail);
+      INFO(NCCL_INIT|NCCL_PROXY, "Proxy threads set to affinity %s%s", affinityStr, missing ? " (not enough free cores)" : "");
+    } else {
+      INFO(NCCL_INIT|NCCL_PROXY, "No free core for the proxy threads, NCCL_PROXY_CPU_CORES ignored");
+    }
+  }
+exit:
+  free(infos);
+  return ret;
+fail:
+  goto exit;
+}
+
 ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
   /* proxyState is shared among parent comm and split comms. comm->proxyState->thread is
    * pthread_join()'d by commFree() in init.cc when the refCount reduces down to 0. */
@@ -1689,6 +2235,7 @@ ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
     proxyState->tpnRanks = comm->nRanks;
     proxyState->tpLocalnRanks = comm->localRanks;
     proxyState->cudaDev = comm->cudaDev;
+    NCCLCHECK(ncclTopoGetGpuNumaId(comm->topo, comm->rank, &proxyState->numaId));
     proxyState->abortFlag = comm->abortFlag;
     proxyState->p2pnChannels = comm->p2pnChannels;
     proxyState->p2pChunkSize = comm->p2pChunkSize;
@@ -1697,7 +2244,23 @@ ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
     proxyState->dmaBufSupport = comm->dmaBufSupport;
     proxyState->ncclNet = comm->ncclNet;
     proxyState->ncclCollNet = comm->ncclCollNet;
+    proxyState->netQos.trafficClass = comm->config.trafficClass == NCCL_CONFIG_UNDEF_INT ? -1 : comm->config.trafficClass;
+    proxyState->netQos.serviceLevel = comm->config.serviceLevel == NCCL_CONFIG_UNDEF_INT ? -1 : comm->config.serviceLevel;
+    proxyState->netQos.socketBusyPoll = comm->config.socketBusyPoll == NCCL_CONFIG_UNDEF_INT ? -1 : comm->config.socketBusyPoll;
+    proxyState->netQos.socketPacingRate = comm->config.socketPacingRate == NCCL_CONFIG_UNDEF_INT ? -1 : comm->config.socketPacingRate;
+    proxyState->netQos.socketBuffSize = comm->config.socketBuffSize == NCCL_CONFIG_UNDEF_INT ? -1 : comm->config.socketBuffSize;
     memcpy(proxyState->buffSizes, comm->buffSizes, sizeof(comm->buffSizes));
+    NCCLCHECK(proxyProgressShardsInit(comm, proxyState));
+    if (comm->profiler) {
+      // The proxy holds its own plugin reference and context since it may outlive this comm.
+      NCCLCHECK(ncclProfilerPluginLoad(&proxyState->profiler));
+      ncclResult_t initRet = proxyState->profiler->init(comm->commHash, comm->rank, comm->nRanks, ncclDebugLog, &proxyState->profilerContext);
+      if (initRet != ncclSuccess) {
+        INFO(NCCL_INIT, "Profiler plugin %s init returned %d, proxy profiling disabled", proxyState->profiler->name, initRet);
+        proxyState->profilerContext = NULL;
+        NCCLCHECK(ncclProfilerPluginUnload(&proxyState->profiler));
+      }
+    }
 
     pthread_create(&comm->proxyState->thread, NULL, ncclProxyService, comm->proxyState);
     ncclSetThreadName(comm->proxyState->thread, "NCCL Service %2d", comm->cudaDev);
@@ -1767,6 +2330,11 @@ ncclResult_t ncclProxyDestroy(struct ncclComm* comm) {
   free(sharedProxyState->proxyOps);
   free(sharedProxyState->sharedDevMems);
   expectedProxyResponseFree(sharedProxyState);
+  ncclMemStatsFree(&sharedProxyState->memStats);
+  if (sharedProxyState->profiler) {
+    NCCLCHECK(sharedProxyState->profiler->destroy(sharedProxyState->profilerContext));
+    NCCLCHECK(ncclProfilerPluginUnload(&sharedProxyState->profiler));
+  }
   free(sharedProxyState);
   return ncclSuccess;
 }
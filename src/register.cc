@@ -9,6 +9,9 @@
 #include "comm.h"
 #include "net.h"
 #include "register.h"
+#include "enqueue.h"
+#include "p2p.h"
+#include <pthread.h>
 
 ncclResult_t ncclNetDeregister(struct ncclComm* comm, struct ncclReg* reg) {
   struct ncclRegCache* cache = &comm->regCache;
@@ -31,6 +34,13 @@ ncclResult_t ncclNetRegister(struct ncclComm* comm, void* addr, size_t size, str
 
   ncclResult_t ret = ncclSuccess;
 
+  // Pinned host memory is registered as such so the NIC reads and writes it
+  // directly, e.g. activations offloaded to the host.
+  cudaPointerAttributes attr;
+  reg->netPtrType = NCCL_PTR_CUDA;
+  if (cudaPointerGetAttributes(&attr, (void*)addr) == cudaSuccess && attr.type == cudaMemoryTypeHost) reg->netPtrType = NCCL_PTR_HOST;
+  (void)cudaGetLastError();
+
   // Find local devices for p2p operations
   for (int c=0; c<comm->p2pnChannels; c++) {
     int dev;
@@ -71,7 +81,7 @@ ncclResult_t ncclNetRegister(struct ncclComm* comm, void* addr, size_t size, str
       }
       NCCLCHECK(comm->ncclNet->closeListen(lComm));
     }
-    if (comm->ncclNet->regMr(cache->sComms[dev], addr, size, NCCL_PTR_CUDA, reg->handles+d) != ncclSuccess) {
+    if (comm->ncclNet->regMr(cache->sComms[dev], addr, size, reg->netPtrType, reg->handles+d) != ncclSuccess) {
       reg->handles[d] = NULL;
       NCCLCHECK(ncclNetDeregister(comm, reg));
       reg->nDevs = 0;
@@ -84,23 +94,206 @@ end:
   return ret;
 }
 
+NCCL_PARAM(LocalRegister, "LOCAL_REGISTER", 1);
+// Upper bound on buffer bytes registered with the network, 0 for no limit.
+// Least recently used buffers lose their network registration first.
+NCCL_PARAM(LocalRegisterMaxBytes, "LOCAL_REGISTER_MAX_BYTES", 0);
+// Register buffers allocated with ncclMemAlloc the first time they are used.
+NCCL_PARAM(LocalRegisterAuto, "LOCAL_REGISTER_AUTO", 0);
+
+// Live ncclMemAlloc allocations, sorted by address. The id lets communicators
+// notice a registration whose allocation was freed and its address reused.
+struct ncclMemAllocRecord {
+  uintptr_t addr;
+  size_t size;
+  uint64_t id;
+  bool autoRegister; // registered on first use even without NCCL_LOCAL_REGISTER_AUTO
+};
+static pthread_mutex_t memAllocLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ncclMemAllocRecord* memAllocs = NULL;
+static int memAllocCount = 0, memAllocCapacity = 0;
+static uint64_t memAllocNextId = 1;
+
+// Index of the first allocation starting after addr. Must hold memAllocLock.
+static int memAllocUpperBound(uintptr_t addr) {
+  int lo = 0, hi = memAllocCount;
+  while (lo < hi) {
+    int mid = (lo+hi)/2;
+    if (memAllocs[mid].addr <= addr) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+ncclResult_t ncclRegTrackMemAlloc(void* ptr, size_t size, bool autoRegister) {
+  if (ptr == NULL || size == 0) return ncclSuccess;
+  ncclResult_t ret = ncclSuccess;
+  pthread_mutex_lock(&memAllocLock);
+  if (memAllocCount == memAllocCapacity) {
+    int capacity = memAllocCapacity < 32 ? 32 : 2*memAllocCapacity;
+    NCCLCHECKGOTO(ncclRealloc(&memAllocs, memAllocCapacity, capacity), ret, exit);
+    memAllocCapacity = capacity;
+  }
+  {
+    int i = memAllocUpperBound((uintptr_t)ptr);
+    memmove(memAllocs+i+1, memAllocs+i, (memAllocCount-i)*sizeof(struct ncclMemAllocRecord));
+    memAllocs[i].addr = (uintptr_t)ptr;
+    memAllocs[i].size = size;
+    memAllocs[i].id = memAllocNextId++;
+    memAllocs[i].autoRegister = autoRegister;
+    memAllocCount++;
+  }
+exit:
+  pthread_mutex_unlock(&memAllocLock);
+  return ret;
+}
+
+ncclResult_t ncclRegUntrackMemAlloc(void* ptr) {
+  pthread_mutex_lock(&memAllocLock);
+  int i = memAllocUpperBound((uintptr_t)ptr)-1;
+  if (i >= 0 && memAllocs[i].addr == (uintptr_t)ptr) {
+    memmove(memAllocs+i, memAllocs+i+1, (memAllocCount-i-1)*sizeof(struct ncclMemAllocRecord));
+    memAllocCount--;
+  }
+  pthread_mutex_unlock(&memAllocLock);
+  return ncclSuccess;
+}
+
+// Find the live ncclMemAlloc allocation holding [addr, addr+size)
+static bool memAllocFind(uintptr_t addr, size_t size, struct ncclMemAllocRecord* record) {
+  bool found = false;
+  pthread_mutex_lock(&memAllocLock);
+  int i = memAllocUpperBound(addr)-1;
+  if (i >= 0 && addr+size <= memAllocs[i].addr+memAllocs[i].size) {
+    *record = memAllocs[i];
+    found = true;
+  }
+  pthread_mutex_unlock(&memAllocLock);
+  return found;
+}
+
+// Index of the first slot starting after addr
+static int regUpperBound(struct ncclRegCache* cache, uintptr_t addr) {
+  int lo = 0, hi = cache->population;
+  while (lo < hi) {
+    int mid = (lo+hi)/2;
+    if (cache->slots[mid]->addr <= addr) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Registrations may overlap, so walk back from the last slot starting at or
+// before addr, no further than the largest registration can reach.
+static int regLookup(struct ncclRegCache* cache, uintptr_t addr, size_t pages) {
+  for (int slot = regUpperBound(cache, addr)-1; slot >= 0; slot--) {
+    struct ncclReg* reg = cache->slots[slot];
+    size_t pageOffset = (addr-reg->addr)/cache->pageSize;
+    if (pageOffset >= cache->maxPages) break;
+    if (pageOffset+pages <= reg->pages) return slot;
+  }
+  return -1;
+}
+
+static ncclResult_t regInsert(struct ncclRegCache* cache, uintptr_t addr, size_t pages, struct ncclReg** reg) {
+  if (cache->population == cache->capacity) { // must grow cache
+    cache->capacity = cache->capacity < 32 ? 32 : 2*cache->capacity;
+    NCCLCHECK(ncclRealloc(&cache->slots, cache->population, cache->capacity));
+  }
+  int slot = regUpperBound(cache, addr);
+  memmove(cache->slots+slot+1, cache->slots+slot, (cache->population-slot)*sizeof(struct ncclReg*));
+  NCCLCHECK(ncclCalloc(cache->slots+slot, 1));
+  *reg = cache->slots[slot];
+  (*reg)->addr = addr;
+  (*reg)->pages = pages;
+  cache->population += 1;
+  if (pages > cache->maxPages) cache->maxPages = pages;
+  return ncclSuccess;
+}
+
+// Drop the network registration of a buffer
+static ncclResult_t regNetRelease(struct ncclComm* comm, struct ncclReg* reg) {
+  struct ncclRegCache* cache = &comm->regCache;
+  if (reg->nDevs > 0) cache->netRegBytes -= reg->pages*cache->pageSize;
+  NCCLCHECK(ncclNetDeregister(comm, reg));
+  return ncclSuccess;
+}
+
+static ncclResult_t regNetRegister(struct ncclComm* comm, struct ncclReg* reg) {
+  struct ncclRegCache* cache = &comm->regCache;
+  size_t bytes = reg->pages*cache->pageSize;
+  size_t maxBytes = ncclParamLocalRegisterMaxBytes();
+  while (maxBytes != 0 && cache->netRegBytes + bytes > maxBytes) {
+    struct ncclReg* lru = NULL;
+    for (int i=0; i<cache->population; i++) {
+      struct ncclReg* r = cache->slots[i];
+      if (r != reg && r->nDevs > 0 && (lru == NULL || r->lastUsed < lru->lastUsed)) lru = r;
+    }
+    if (lru == NULL) break;
+    INFO(NCCL_REG, "Evicting network registration of buffer %p pages %lx", (void*)lru->addr, lru->pages);
+    NCCLCHECK(regNetRelease(comm, lru));
+    lru->state = (lru->state & ~NET_REG_COMPLETE) | NET_REG_EVICTED;
+  }
+  NCCLCHECK(ncclNetRegister(comm, (void*)reg->addr, bytes, reg));
+  reg->state = (reg->state | NET_REG_COMPLETE) & ~NET_REG_EVICTED;
+  if (reg->nDevs > 0) cache->netRegBytes += bytes;
+  return ncclSuccess;
+}
+
+static ncclResult_t regFree(struct ncclComm* comm, struct ncclReg* reg) {
+  NCCLCHECK(regNetRelease(comm, reg));
+  if (reg->state & NVLS_REG_COMPLETE) {
+    NCCLCHECK(ncclNvlsDeregBuffer(&reg->mcHandle, reg->regAddr, reg->dev, reg->regSize));
+    reg->regAddr = (CUdeviceptr)NULL;
+  }
+  if (reg->state & COLLNET_REG_COMPLETE) {
+    NCCLCHECK(ncclCollnetDeregBuffer(comm, reg->proxyconn, reg->collnetHandle));
+  }
+  NCCLCHECK(ncclP2pIpcDeregBuffer(reg));
+  free(reg);
+  return ncclSuccess;
+}
+
 ncclResult_t ncclRegFind(struct ncclComm* comm, const void* data, size_t size, struct ncclReg** reg) {
   struct ncclRegCache* cache = &comm->regCache;
   uintptr_t pageSize = cache->pageSize;
   uintptr_t addr = (uintptr_t)data & -pageSize;
   size_t pages = ((uintptr_t)data + size - addr + pageSize-1)/pageSize;
+  struct ncclMemAllocRecord alloc;
 
   *reg = NULL;
-  for (int slot=0; /*true*/; slot++) {
-    if (slot == cache->population || addr < cache->slots[slot]->addr) return ncclSuccess;
-    if ((addr >= cache->slots[slot]->addr) &&
-        ((addr-cache->slots[slot]->addr)/pageSize+pages) <= cache->slots[slot]->pages) {
-      *reg = cache->slots[slot];
-      return ncclSuccess;
+  int slot = regLookup(cache, addr, pages);
+  if (slot >= 0 && cache->slots[slot]->allocId) {
+    // Registered on our own, make sure the allocation is still the same one.
+    struct ncclReg* r = cache->slots[slot];
+    if (!memAllocFind((uintptr_t)data, size, &alloc) || alloc.id != r->allocId) {
+      INFO(NCCL_REG, "Dropping registration of freed buffer %p pages %lx", (void*)r->addr, r->pages);
+      memmove(cache->slots+slot, cache->slots+slot+1, (cache->population-slot-1)*sizeof(struct ncclReg*));
+      cache->population -= 1;
+      NCCLCHECK(regFree(comm, r));
+      slot = -1;
     }
   }
+  if (slot < 0) {
+    if (!ncclParamLocalRegister() || !memAllocFind((uintptr_t)data, size, &alloc)) return ncclSuccess;
+    if (!ncclParamLocalRegisterAuto() && !alloc.autoRegister) return ncclSuccess;
+    // Cover the whole allocation so that other buffers carved from it hit the same entry.
+    uintptr_t allocAddr = alloc.addr & -pageSize;
+    size_t allocPages = (alloc.addr + alloc.size - allocAddr + pageSize-1)/pageSize;
+    struct ncclReg* r;
+    NCCLCHECK(regInsert(cache, allocAddr, allocPages, &r));
+    r->allocId = alloc.id;
+    NCCLCHECK(regNetRegister(comm, r));
+    INFO(NCCL_REG, "Registered ncclMemAlloc buffer %p pages %lx", (void*)r->addr, r->pages);
+    *reg = r;
+  } else {
+    *reg = cache->slots[slot];
+    // Evicted from the network, register it again now that it is used.
+    if ((*reg)->state & NET_REG_EVICTED) NCCLCHECK(regNetRegister(comm, *reg));
+  }
+  (*reg)->lastUsed = ++cache->clock;
+  return ncclSuccess;
 }
-NCCL_PARAM(LocalRegister, "LOCAL_REGISTER", 1);
 
 ncclResult_t ncclRegister(struct ncclComm* comm, void* data, size_t size, void** handle) {
   if (!ncclParamLocalRegister()) return ncclSuccess;
@@ -108,38 +301,28 @@ ncclResult_t ncclRegister(struct ncclComm* comm, void* data, size_t size, void**
   uintptr_t pageSize = cache->pageSize;
   uintptr_t addr = (uintptr_t)data & -pageSize;
   size_t pages = ((uintptr_t)data + size - addr + pageSize-1)/pageSize;
-  for (int slot=0; /*true*/; slot++) {
-    if ((slot == cache->population) || (addr < cache->slots[slot]->addr)) {
-      if (cache->population == cache->capacity) { // must grow cache
-        cache->capacity = cache->capacity < 32 ? 32 : 2*cache->capacity;
-        NCCLCHECK(ncclRealloc(&cache->slots, cache->population, cache->capacity));
-      }
-      memmove(cache->slots+slot+1, cache->slots+slot, (cache->population-slot)*sizeof(struct ncclReg*));
-      NCCLCHECK(ncclCalloc(cache->slots+slot, 1));
-      struct ncclReg* regSlot = cache->slots[slot];
-      regSlot->addr = addr;
-      regSlot->pages = pages;
-      regSlot->refs = 1;
-      NCCLCHECK(ncclNetRegister(comm, (void*)addr, pages*pageSize, regSlot));
-      regSlot->state |= NET_REG_COMPLETE;
-      cache->population += 1;
-      *handle = regSlot;
-      return ncclSuccess;
-    } else if ((addr >= cache->slots[slot]->addr) &&
-        ((addr-cache->slots[slot]->addr)/pageSize+pages) <= cache->slots[slot]->pages) {
-      cache->slots[slot]->refs++;
-      *handle = cache->slots[slot];
-      return ncclSuccess;
-    }
+  int slot = regLookup(cache, addr, pages);
+  if (slot >= 0 && cache->slots[slot]->allocId == 0) {
+    cache->slots[slot]->refs++;
+    *handle = cache->slots[slot];
+    return ncclSuccess;
   }
+  struct ncclReg* regSlot;
+  NCCLCHECK(regInsert(cache, addr, pages, &regSlot));
+  regSlot->refs = 1;
+  regSlot->lastUsed = ++cache->clock;
+  NCCLCHECK(regNetRegister(comm, regSlot));
+  *handle = regSlot;
+  return ncclSuccess;
 }
 
 ncclResult_t ncclRegCleanup(struct ncclComm* comm) {
   struct ncclRegCache* cache = &comm->regCache;
   for (int i=0; i<cache->population; i++) {
     INFO(NCCL_INIT, "Cleanup buffer %p pages %lx", (void*)cache->slots[i]->addr, cache->slots[i]->pages);
-    NCCLCHECK(ncclNetDeregister(comm, cache->slots[i]));
+    NCCLCHECK(regNetRelease(comm, cache->slots[i]));
     if (cache->slots[i]->state & NVLS_REG_COMPLETE) NCCLCHECK(ncclNvlsDeregBuffer(&cache->slots[i]->mcHandle, cache->slots[i]->regAddr, cache->slots[i]->dev, cache->slots[i]->regSize));
+    NCCLCHECK(ncclP2pIpcDeregBuffer(cache->slots[i]));
     free(cache->slots[i]);
   }
   free(cache->slots);
@@ -155,6 +338,8 @@ ncclResult_t ncclCommRegister(const ncclComm_t comm, void* buff, size_t size, vo
   NCCLCHECK(CommCheck(comm, "ncclCommRegister", "comm"));
   if (comm->checkPointers) NCCLCHECK(CudaPtrCheck(buff, comm, "buff", "ncclCommRegister"));
   NCCLCHECK(ncclRegister(comm, buff, size, handle));
+  // Cached plans were made when the buffer wasn't registered
+  NCCLCHECK(ncclPlanCacheFree(comm));
   return ncclSuccess;
 }
 
@@ -170,16 +355,8 @@ ncclResult_t ncclCommDeregister(const ncclComm_t comm, void* handle) {
     return ncclInvalidUsage;
   }
   if (--reg->refs) return ncclSuccess;
-  NCCLCHECK(ncclNetDeregister(comm, reg));
-  if (reg->state & NVLS_REG_COMPLETE) {
-    NCCLCHECK(ncclNvlsDeregBuffer(&reg->mcHandle, reg->regAddr, reg->dev, reg->regSize));
-    reg->regAddr = (CUdeviceptr)NULL;
-  }
-  if (reg->state & COLLNET_REG_COMPLETE) {
-    NCCLCHECK(ncclCollnetDeregBuffer(comm, reg->proxyconn, reg->collnetHandle));
-  }
-  free(reg);
   memmove(cache->slots+slot, cache->slots+slot+1, (cache->population-slot-1)*sizeof(struct ncclReg*));
   cache->population -= 1;
+  NCCLCHECK(regFree(comm, reg));
   return ncclSuccess;
 }
@@ -7,6 +7,7 @@
 #include "comm.h"
 #include "info.h"
 #include "bootstrap.h"
+#include "channel.h"
 #define ENABLE_TIMER 0
 #include "timer.h"
 
@@ -17,6 +18,73 @@ struct ncclTransport* ncclTransports[NTRANSPORTS] = {
   &collNetTransport
 };
 
+// Bytes of L2 to set aside for persisting accesses to the connectors of the
+// comm, 0 to disable. Capped by the device.
+NCCL_PARAM(L2Persist, "L2_PERSIST", 0);
+
+static ncclResult_t l2WindowAdd(struct ncclComm* comm, void* ptr, size_t bytes, uintptr_t* lo, uintptr_t* hi) {
+  if (ptr == NULL) return ncclSuccess;
+  cudaPointerAttributes attr;
+  if (cudaPointerGetAttributes(&attr, ptr) != cudaSuccess) {
+    (void)cudaGetLastError();
+    return ncclSuccess;
+  }
+  // Only our own memory, not host memory or buffers imported from peers
+  if (attr.type != cudaMemoryTypeDevice || attr.device != comm->cudaDev) return ncclSuccess;
+  *lo = std::min(*lo, (uintptr_t)ptr);
+  *hi = std::max(*hi, (uintptr_t)ptr + bytes);
+  return ncclSuccess;
+}
+
+// Window covering the flags the kernels poll and the LL/LL128 buffers peers
+// write into. Buffers are allocated close together when slabs are used
+// (NCCL_P2P_SLAB_SIZE), otherwise the window may be too large for the device.
+static ncclResult_t l2WindowUpdate(struct ncclComm* comm) {
+  if (ncclParamL2Persist() <= 0) return ncclSuccess;
+  uintptr_t lo = UINTPTR_MAX, hi = 0;
+  if (comm->l2WindowBytes) {
+    lo = comm->l2WindowBase;
+    hi = comm->l2WindowBase + comm->l2WindowBytes;
+  }
+  for (int c=0; c<MAXCHANNELS; c++) {
+    if (comm->channels[c].peers == NULL) continue;
+    for (int p=0; p<comm->nRanks; p++) {
+      struct ncclChannelPeer* peer = comm->channels[c].peers[p];
+      if (peer == NULL) continue;
+      for (int i=0; i<NCCL_MAX_CONNS; i++) {
+        if (peer->send[i].connected) NCCLCHECK(l2WindowAdd(comm, peer->send[i].conn.head, sizeof(uint64_t), &lo, &hi));
+        if (peer->recv[i].connected == 0) continue;
+        struct ncclConnInfo* conn = &peer->recv[i].conn;
+        NCCLCHECK(l2WindowAdd(comm, conn->tail, sizeof(uint64_t), &lo, &hi));
+        NCCLCHECK(l2WindowAdd(comm, conn->buffs[NCCL_PROTO_LL], comm->buffSizes[NCCL_PROTO_LL], &lo, &hi));
+        NCCLCHECK(l2WindowAdd(comm, conn->buffs[NCCL_PROTO_LL128], comm->buffSizes[NCCL_PROTO_LL128], &lo, &hi));
+      }
+    }
+  }
+  if (hi <= lo) return ncclSuccess;
+
+  int maxWindow = 0, maxPersist = 0;
+  CUDACHECK(cudaDeviceGetAttribute(&maxWindow, cudaDevAttrMaxAccessPolicyWindowSize, comm->cudaDev));
+  CUDACHECK(cudaDeviceGetAttribute(&maxPersist, cudaDevAttrMaxPersistingL2CacheSize, comm->cudaDev));
+  if (maxWindow == 0 || maxPersist == 0) return ncclSuccess;
+  if (hi - lo > (size_t)maxWindow) {
+    INFO(NCCL_INIT, "L2 persistence: connector window of %zu bytes exceeds the device maximum of %d, not set", (size_t)(hi-lo), maxWindow);
+    return ncclSuccess;
+  }
+  // The set-aside is per device, only ever grow it
+  size_t setAside = std::min<size_t>(ncclParamL2Persist(), maxPersist);
+  size_t current = 0;
+  CUDACHECK(cudaDeviceGetLimit(&current, cudaLimitPersistingL2CacheSize));
+  if (current < setAside) CUDACHECK(cudaDeviceSetLimit(cudaLimitPersistingL2CacheSize, setAside));
+  else setAside = current;
+
+  comm->l2WindowBase = lo;
+  comm->l2WindowBytes = hi - lo;
+  comm->l2HitRatio = std::min(1.0f, (float)setAside / comm->l2WindowBytes);
+  INFO(NCCL_INIT, "L2 persistence: connector window %zu bytes, set-aside %zu bytes, hit ratio %.2f", comm->l2WindowBytes, setAside, comm->l2HitRatio);
+  return ncclSuccess;
+}
+
 template <int type>
 static ncclResult_t selectTransport(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclConnect* connect, int channelId, int peer, int connIndex, int* transportType) {
   struct ncclPeerInfo* myInfo = comm->peerInfo+comm->rank;
@@ -30,9 +98,13 @@ static ncclResult_t selectTransport(struct ncclComm* comm, struct ncclTopoGraph*
     NCCLCHECK(transport->canConnect(&ret, comm->topo, graph, myInfo, peerInfo));
     if (ret) {
       connector->transportComm = transportComm;
-      NCCLCHECK(transportComm->setup(comm, graph, myInfo, peerInfo, connect, connector, channelId, connIndex));
+      ncclMemScope memScope(&comm->memStats, ncclMemConnector, t, peer);
+      // Transports with a setupDone function may return ncclInProgress with the
+      // proxy setup call still in flight.
+      ncclResult_t res = transportComm->setup(comm, graph, myInfo, peerInfo, connect, connector, channelId, connIndex);
+      if (res != ncclSuccess && res != ncclInProgress) return res;
       if (transportType) *transportType = t;
-      return ncclSuccess;
+      return res;
     }
   }
   WARN("No transport found for rank %d[%lx] -> rank %d[%lx]", myInfo->rank, myInfo->busId, peerInfo->rank, peerInfo->busId);
@@ -56,6 +128,63 @@ ncclResult_t ncclTransportP2pConnect(struct ncclComm* comm, int channelId, int n
   return ncclSuccess;
 }
 
+ncclResult_t ncclTransportRingConnect(struct ncclComm* comm, struct ncclTopoGraph* ringGraph) {
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    if (comm->nRanks == 1) continue;
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->ring.prev, 1, &channel->ring.next, 0));
+  }
+  NCCLCHECK(ncclTransportP2pSetup(comm, ringGraph, 0));
+  // RingScatter runs on the ring connections
+  comm->collConnected[NCCL_ALGO_RING] = comm->collConnected[NCCL_ALGO_RING_SCATTER] = true;
+  comm->collNeedConnect[NCCL_ALGO_RING] = comm->collNeedConnect[NCCL_ALGO_RING_SCATTER] = false;
+  INFO(NCCL_INIT, "Connected all rings");
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTransportTreeConnect(struct ncclComm* comm, struct ncclTopoGraph* treeGraph) {
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    if (comm->nRanks == 1) continue;
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, NCCL_MAX_TREE_ARITY, channel->tree.down, 1, &channel->tree.up, 0));
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->tree.up, NCCL_MAX_TREE_ARITY, channel->tree.down, 0));
+  }
+  NCCLCHECK(ncclTransportP2pSetup(comm, treeGraph, 0));
+  comm->collConnected[NCCL_ALGO_TREE] = true;
+  comm->collNeedConnect[NCCL_ALGO_TREE] = false;
+  INFO(NCCL_INIT, "Connected all trees");
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTransportHierConnect(struct ncclComm* comm) {
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->hier.intraPrev, 1, &channel->hier.intraNext, 0));
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->hier.interPrev, 1, &channel->hier.interNext, 0));
+  }
+  // Each rank reaches the other nodes through its own NIC rather than the ones
+  // of the ring graph.
+  NCCLCHECK(ncclTransportP2pSetup(comm, NULL, 0));
+  comm->collConnected[NCCL_ALGO_HIER] = true;
+  comm->collNeedConnect[NCCL_ALGO_HIER] = false;
+  INFO(NCCL_INIT, "Connected hierarchical rings");
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTransportRecDblConnect(struct ncclComm* comm) {
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclRecDbl* recDbl = &comm->channels[c].recDbl;
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, recDbl->nPeers, recDbl->peers, recDbl->nPeers, recDbl->peers, 0));
+    if (recDbl->extra != -1) NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &recDbl->extra, 1, &recDbl->extra, 0));
+  }
+  // Most peers are not ring neighbors, connect through each GPU's own NIC
+  NCCLCHECK(ncclTransportP2pSetup(comm, NULL, 0));
+  comm->collConnected[NCCL_ALGO_RECDBL] = true;
+  comm->collNeedConnect[NCCL_ALGO_RECDBL] = false;
+  INFO(NCCL_INIT, "Connected recursive doubling peers");
+  return ncclSuccess;
+}
+
 void dumpData(struct ncclConnect* data, int ndata) {
   for (int n=0; n<ndata; n++) {
     printf("[%d] ", n);
@@ -78,10 +207,15 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
   struct ncclConnect** sendData; // Points to entries inside data for given send connection within a channel
   int done = 0;
 
+  uint64_t* recvSetupPending; // Channels of the recv (resp. send) connectors whose setup is in flight
+  uint64_t* sendSetupPending;
+
   int maxPeers = ncclParamConnectRoundMaxPeers();
   NCCLCHECK(ncclCalloc(&data, maxPeers));
   NCCLCHECK(ncclCalloc(&recvData, maxPeers));
   NCCLCHECK(ncclCalloc(&sendData, maxPeers));
+  NCCLCHECK(ncclCalloc(&recvSetupPending, maxPeers));
+  NCCLCHECK(ncclCalloc(&sendSetupPending, maxPeers));
 
   struct timeval timeStart, timeLast;
   gettimeofday(&timeStart, NULL);
@@ -91,7 +225,6 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
   NCCLCHECKGOTO(ncclStrongStreamAcquireUncaptured(&comm->sharedRes->hostStream), ret, fail);
   // First time initialization
   for (int i=1; i<comm->nRanks; i++) {
-    int bootstrapTag = (i<<8) + (graph ? graph->id+1 : 0);
     int recvPeer = (comm->rank - i + comm->nRanks) % comm->nRanks;
     int sendPeer = (comm->rank + i) % comm->nRanks;
     uint64_t recvMask = comm->connectRecv[recvPeer];
@@ -105,12 +238,14 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
     int p = i-(done+1);
     if (recvMask || sendMask) NCCLCHECK(ncclCalloc(data+p, 2*MAXCHANNELS));
     recvData[p] = data[p];
+    recvSetupPending[p] = sendSetupPending[p] = 0;
     int sendChannels = 0, recvChannels = 0;
     int type;
     TIME_START(0);
     for (int c=0; c<MAXCHANNELS; c++) {
       if (recvMask & (1UL<<c)) {
         NCCLCHECKGOTO(selectTransport<0>(comm, graph, recvData[p]+recvChannels++, c, recvPeer, connIndex, &type), ret, fail);
+        if (ret == ncclInProgress) recvSetupPending[p] |= 1UL<<c;
         if (type > highestType) highestType = type;
       }
     }
@@ -120,28 +255,70 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
     for (int c=0; c<MAXCHANNELS; c++) {
       if (sendMask & (1UL<<c)) {
         NCCLCHECKGOTO(selectTransport<1>(comm, graph, sendData[p]+sendChannels++, c, sendPeer, connIndex, &type), ret, fail);
+        if (ret == ncclInProgress) sendSetupPending[p] |= 1UL<<c;
         if (type > highestType) highestType = type;
       }
     }
     TIME_STOP(1);
 
-    TIME_START(2);
-    if (sendPeer == recvPeer) {
-      if (recvChannels+sendChannels) {
-        NCCLCHECKGOTO(bootstrapSend(comm->bootstrap, recvPeer, bootstrapTag, data[p], sizeof(struct ncclConnect)*(recvChannels+sendChannels)), ret, fail);
-        NCCLCHECKGOTO(bootstrapRecv(comm->bootstrap, recvPeer, bootstrapTag, data[p], sizeof(struct ncclConnect)*(recvChannels+sendChannels)), ret, fail);
-        sendData[p] = data[p];
-        recvData[p] = data[p]+sendChannels;
+    if (i-done == maxPeers || i == comm->nRanks-1) {
+      // The proxy setup calls of the whole round are in flight, so that the proxies
+      // serve them back to back. Complete them before exchanging connect info.
+      bool allChannelsSetup = false;
+      while (!allChannelsSetup) {
+        allChannelsSetup = true;
+        for (int j=done+1; j<=i; j++) {
+          int p = j-(done+1);
+          if ((recvSetupPending[p] | sendSetupPending[p]) == 0) continue;
+          int recvPeer = (comm->rank - j + comm->nRanks) % comm->nRanks;
+          int sendPeer = (comm->rank + j) % comm->nRanks;
+          uint64_t recvMask = comm->connectRecv[recvPeer];
+          uint64_t sendMask = comm->connectSend[sendPeer];
+          int recvDataOffset = 0, sendDataOffset = 0;
+          for (int c=0; c<MAXCHANNELS; c++) {
+            if ((recvMask & (1UL<<c)) && (recvSetupPending[p] & (1UL<<c))) {
+              struct ncclConnector* conn = comm->channels[c].peers[recvPeer]->recv + connIndex;
+              NCCLCHECKGOTO(conn->transportComm->setupDone(comm, recvData[p] + recvDataOffset, conn), ret, fail);
+              if (ret == ncclSuccess) recvSetupPending[p] &= ~(1UL<<c);
+              else allChannelsSetup = false;
+            }
+            if (recvMask & (1UL<<c)) recvDataOffset++;
+            if ((sendMask & (1UL<<c)) && (sendSetupPending[p] & (1UL<<c))) {
+              struct ncclConnector* conn = comm->channels[c].peers[sendPeer]->send + connIndex;
+              NCCLCHECKGOTO(conn->transportComm->setupDone(comm, sendData[p] + sendDataOffset, conn), ret, fail);
+              if (ret == ncclSuccess) sendSetupPending[p] &= ~(1UL<<c);
+              else allChannelsSetup = false;
+            }
+            if (sendMask & (1UL<<c)) sendDataOffset++;
+          }
+        }
+      }
+      ret = ncclSuccess;
+
+      for (int j=done+1; j<=i; j++) {
+        int bootstrapTag = (j<<8) + (graph ? graph->id+1 : 0);
+        int recvPeer = (comm->rank - j + comm->nRanks) % comm->nRanks;
+        int sendPeer = (comm->rank + j) % comm->nRanks;
+        int recvChannels = __builtin_popcountll(comm->connectRecv[recvPeer]);
+        int sendChannels = __builtin_popcountll(comm->connectSend[sendPeer]);
+        int p = j-(done+1);
+        TIME_START(2);
+        if (sendPeer == recvPeer) {
+          if (recvChannels+sendChannels) {
+            NCCLCHECKGOTO(bootstrapSend(comm->bootstrap, recvPeer, bootstrapTag, data[p], sizeof(struct ncclConnect)*(recvChannels+sendChannels)), ret, fail);
+            NCCLCHECKGOTO(bootstrapRecv(comm->bootstrap, recvPeer, bootstrapTag, data[p], sizeof(struct ncclConnect)*(recvChannels+sendChannels)), ret, fail);
+            sendData[p] = data[p];
+            recvData[p] = data[p]+sendChannels;
+          }
+        } else {
+          if (recvChannels) NCCLCHECKGOTO(bootstrapSend(comm->bootstrap, recvPeer, bootstrapTag, recvData[p], sizeof(struct ncclConnect)*recvChannels), ret, fail);
+          if (sendChannels) NCCLCHECKGOTO(bootstrapSend(comm->bootstrap, sendPeer, bootstrapTag, sendData[p], sizeof(struct ncclConnect)*sendChannels), ret, fail);
+          if (sendChannels) NCCLCHECKGOTO(bootstrapRecv(comm->bootstrap, sendPeer, bootstrapTag, sendData[p], sizeof(struct ncclConnect)*sendChannels), ret, fail);
+          if (recvChannels) NCCLCHECKGOTO(bootstrapRecv(comm->bootstrap, recvPeer, bootstrapTag, recvData[p], sizeof(struct ncclConnect)*recvChannels), ret, fail);
+        }
+        TIME_STOP(2);
       }
-    } else {
-      if (recvChannels) NCCLCHECKGOTO(bootstrapSend(comm->bootstrap, recvPeer, bootstrapTag, recvData[p], sizeof(struct ncclConnect)*recvChannels), ret, fail);
-      if (sendChannels) NCCLCHECKGOTO(bootstrapSend(comm->bootstrap, sendPeer, bootstrapTag, sendData[p], sizeof(struct ncclConnect)*sendChannels), ret, fail);
-      if (sendChannels) NCCLCHECKGOTO(bootstrapRecv(comm->bootstrap, sendPeer, bootstrapTag, sendData[p], sizeof(struct ncclConnect)*sendChannels), ret, fail);
-      if (recvChannels) NCCLCHECKGOTO(bootstrapRecv(comm->bootstrap, recvPeer, bootstrapTag, recvData[p], sizeof(struct ncclConnect)*recvChannels), ret, fail);
-    }
-    TIME_STOP(2);
 
-    if (i-done == maxPeers || i == comm->nRanks-1) {
       // Loop until all channels with all ranks have been connected
       bool allChannelsConnected;
       allChannelsConnected = false;
@@ -165,6 +342,7 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
                 NCCLCHECKGOTO(conn->transportComm->connect(comm, sendData[p] + sendDataOffset++, 1, comm->rank, conn), ret, fail);
                 if (ret == ncclSuccess) {
                   conn->connected = 1;
+                  NCCLCHECKGOTO(ncclChannelDevPeerConnect(comm, c, sendPeer, comm->sharedRes->hostStream.cudaStream), ret, fail);
                   /* comm->channels[c].devPeers[sendPeer]->send[connIndex] is a device memory access. */
                   CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[sendPeer]->send[connIndex], &conn->conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), ret, fail);
                 } else if (ret == ncclInProgress) {
@@ -183,6 +361,7 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
                 NCCLCHECKGOTO(conn->transportComm->connect(comm, recvData[p] + recvDataOffset++, 1, comm->rank, conn), ret, fail);
                 if (ret == ncclSuccess) {
                   conn->connected = 1;
+                  NCCLCHECKGOTO(ncclChannelDevPeerConnect(comm, c, recvPeer, comm->sharedRes->hostStream.cudaStream), ret, fail);
                   /* comm->channels[c].devPeers[recvPeer]->recv[connIndex] is a device memory access. */
                   CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[recvPeer]->recv[connIndex], &conn->conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), ret, fail);
                 } else if (ret == ncclInProgress) {
@@ -256,7 +435,10 @@ ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph*
   free(data);
   free(sendData);
   free(recvData);
+  free(recvSetupPending);
+  free(sendSetupPending);
 
+  NCCLCHECKGOTO(l2WindowUpdate(comm), ret, fail);
   if (highestTransportType != NULL) *highestTransportType = highestType;
   TIME_PRINT("P2P Setup/Connect");
 exit:
@@ -295,6 +477,7 @@ int ncclTransportCollNetSetup(struct ncclComm* comm, struct ncclTopoGraph* collN
   // setup
   struct ncclConnect myConnect;
   if (isMaster) {
+    ncclMemScope memScope(&comm->memStats, ncclMemConnector, TRANSPORT_COLLNET);
     NCCLCHECK(transportComm->setup(comm, collNetGraph, myInfo, peerInfo, &myConnect, conn, collNetGraphChannelId, type));
   }
   // prepare connect handles
@@ -381,3 +564,42 @@ ncclResult_t ncclTransportCollNetFree(struct ncclComm* comm) {
   }
   return ncclSuccess;
 }
+
+// Release the connections to all peers at connIndex, so that they are set up
+// again the next time they are needed. Every rank of comm must call this with
+// no operation in flight. Peers unmap the buffers they imported before proxies
+// free them.
+ncclResult_t ncclTransportP2pRelease(struct ncclComm* comm, int connIndex) {
+  int released = 0;
+  for (int c=0; c<MAXCHANNELS; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    if (channel->id == -1 || channel->peers == NULL) continue;
+    for (int r=0; r<comm->nRanks; r++) {
+      struct ncclConnector* conns[2] = { channel->peers[r]->send+connIndex, channel->peers[r]->recv+connIndex };
+      for (int s=0; s<2; s++) {
+        if (conns[s]->transportComm == NULL) continue;
+        if (conns[s]->transportResources) NCCLCHECK(conns[s]->transportComm->free(conns[s]));
+        conns[s]->transportResources = NULL;
+        conns[s]->connected = 0;
+        released++;
+      }
+    }
+  }
+  NCCLCHECK(bootstrapBarrier(comm->bootstrap, comm->rank, comm->nRanks, connIndex));
+  for (int c=0; c<MAXCHANNELS; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    if (channel->id == -1 || channel->peers == NULL) continue;
+    for (int r=0; r<comm->nRanks; r++) {
+      struct ncclConnector* conns[2] = { channel->peers[r]->send+connIndex, channel->peers[r]->recv+connIndex };
+      for (int s=0; s<2; s++) {
+        if (conns[s]->transportComm == NULL) continue;
+        if (conns[s]->proxyConn.connection) {
+          NCCLCHECK(ncclProxyCallBlocking(comm, &conns[s]->proxyConn, ncclProxyMsgFree, NULL, 0, NULL, 0));
+        }
+        memset(conns[s], 0, sizeof(*conns[s]));
+      }
+    }
+  }
+  INFO(NCCL_INIT, "Released %d connectors with connIndex %d", released, connIndex);
+  return ncclSuccess;
+}
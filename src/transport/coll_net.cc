@@ -375,7 +375,7 @@ static ncclResult_t sharedFree(struct ncclProxyState* proxyState, struct ncclCol
   return ncclSuccess;
 }
 
-static ncclResult_t sharedBuffersInit(struct ncclCollNetSharedRes* collNet, int cuda, char** gpuPtr, char** cpuPtr, int* size) {
+static ncclResult_t sharedBuffersInit(struct ncclCollNetSharedRes* collNet, int cuda, int numaId, char** gpuPtr, char** cpuPtr, int* size) {
   if (collNet->size == 0) {
     collNet->size = 2 * collNet->nChannels * collNet->buffSize;
   }
@@ -388,7 +388,7 @@ static ncclResult_t sharedBuffersInit(struct ncclCollNetSharedRes* collNet, int
     cudaMemset((char*)collNet->cudaBuff + *size/2, 0x66, *size/2);
   }
   if (!cuda && collNet->hostBuff == NULL) {
-    NCCLCHECK(ncclCudaHostCalloc(&collNet->hostBuff, *size));
+    NCCLCHECK(ncclHostMemAlloc((void**)&collNet->hostBuff, *size, numaId));
   }
   *gpuPtr = *cpuPtr = cuda ? collNet->cudaBuff : collNet->hostBuff;
   return ncclSuccess;
@@ -405,7 +405,7 @@ static ncclResult_t sharedBuffersGet(struct ncclCollNetSharedRes* collNet, int t
 static ncclResult_t sharedBuffersDestroy(struct ncclCollNetSharedRes* collNet) {
   if (collNet->size == 0) return ncclSuccess;
   NCCLCHECK(ncclCudaFree(collNet->cudaBuff));
-  NCCLCHECK(ncclCudaHostFree(collNet->hostBuff));
+  NCCLCHECK(ncclHostMemFree(collNet->hostBuff, collNet->size));
   // This will be called multiple times, with multiple channels and send/recv. Make sure we only do it once.
   collNet->size = 0;
   return ncclSuccess;
@@ -465,7 +465,7 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
   NCCL_NET_MAP_ADD_POINTER(map, 0, 0, sizeof(struct ncclSendMem), sendMem);
   NCCL_NET_MAP_ADD_POINTER(map, 0, 0, sizeof(struct ncclRecvMem), recvMem);
 
-  NCCLCHECK(ncclCudaHostCalloc(&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size));
+  NCCLCHECK(ncclHostMemAlloc((void**)&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size, proxyState->numaId));
   map->mems[NCCL_NET_MAP_HOSTMEM].gpuPtr = map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr;
   if (ncclGdrCopy && ncclParamGdrCopySyncEnable()) {
     uint64_t *cpuPtr, *gpuPtr;
@@ -486,7 +486,7 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
   // Allocate & Register shared buffers for the Simple protocol
   int bank = resources->useGdr ? NCCL_NET_MAP_SHARED_DEVMEM : NCCL_NET_MAP_SHARED_HOSTMEM;
   struct connectMapMem* mapMem = map->mems+bank;
-  NCCLCHECK(sharedBuffersInit(connection->collNet, resources->useGdr, &mapMem->gpuPtr, &mapMem->cpuPtr, &mapMem->size));
+  NCCLCHECK(sharedBuffersInit(connection->collNet, resources->useGdr, proxyState->numaId, &mapMem->gpuPtr, &mapMem->cpuPtr, &mapMem->size));
   NCCL_NET_MAP_ADD_POINTER(map, 1, resources->useGdr, mapMem->size, buffs[NCCL_PROTO_SIMPLE]);
 
 #if CUDA_VERSION >= 11070
@@ -533,7 +533,7 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
   NCCL_NET_MAP_ADD_POINTER(map, 0, 0, sizeof(struct ncclSendMem), sendMem);
   NCCL_NET_MAP_ADD_POINTER(map, 0, 0, sizeof(struct ncclRecvMem), recvMem);
 
-  NCCLCHECK(ncclCudaHostCalloc(&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size));
+  NCCLCHECK(ncclHostMemAlloc((void**)&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size, proxyState->numaId));
   map->mems[NCCL_NET_MAP_HOSTMEM].gpuPtr = map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr;
   if (ncclGdrCopy) {
     uint64_t *cpuPtr, *gpuPtr;
@@ -555,7 +555,7 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
   // Allocate & Register shared buffers for the Simple protocol
   int bank = resources->useGdr ? NCCL_NET_MAP_SHARED_DEVMEM : NCCL_NET_MAP_SHARED_HOSTMEM;
   struct connectMapMem* mapMem = map->mems+bank;
-  NCCLCHECK(sharedBuffersInit(connection->collNet, resources->useGdr, &mapMem->gpuPtr, &mapMem->cpuPtr, &mapMem->size));
+  NCCLCHECK(sharedBuffersInit(connection->collNet, resources->useGdr, proxyState->numaId, &mapMem->gpuPtr, &mapMem->cpuPtr, &mapMem->size));
   NCCL_NET_MAP_ADD_POINTER(map, 1, resources->useGdr, mapMem->size, buffs[NCCL_PROTO_SIMPLE]);
 
 #if CUDA_VERSION >= 11070
@@ -595,7 +595,7 @@ static ncclResult_t sendProxyFree(struct ncclProxyConnection* connection, struct
       }
     }
     struct connectMapMem* mems = resources->map.mems;
-    NCCLCHECK(ncclCudaHostFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr));
+    NCCLCHECK(ncclHostMemFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, mems[NCCL_NET_MAP_HOSTMEM].size));
     NCCLCHECK(ncclCudaFree(mems[NCCL_NET_MAP_DEVMEM].cpuPtr));
     if (mems[NCCL_NET_MAP_GDCMEM].cpuPtr) NCCLCHECK(ncclGdrCudaFree(resources->gdrDesc));
     NCCLCHECK(sharedBuffersDestroy(connection->collNet));
@@ -616,7 +616,7 @@ static ncclResult_t recvProxyFree(struct ncclProxyConnection* connection, struct
       }
     }
     struct connectMapMem* mems = resources->map.mems;
-    NCCLCHECK(ncclCudaHostFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr));
+    NCCLCHECK(ncclHostMemFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, mems[NCCL_NET_MAP_HOSTMEM].size));
     NCCLCHECK(ncclCudaFree(mems[NCCL_NET_MAP_DEVMEM].cpuPtr));
     if (mems[NCCL_NET_MAP_GDCMEM].cpuPtr) NCCLCHECK(ncclGdrCudaFree(resources->gdrDesc));
     NCCLCHECK(sharedBuffersDestroy(connection->collNet));
@@ -666,9 +666,12 @@ static int calcRegionOffset(
 #define LAST_OF_GROUP(args, s) \
   ((s)%COLLNET_GROUP_NSUBS == COLLNET_GROUP_NSUBS-1 || (s) == (args)->nsubs-1)
 
-static constexpr int calcStepsPerGroup(int nGroups) {
-  //return NCCL_STEPS/nGroups;
-  return NCCL_STEPS;
+// Steps a group may have handed to the network and not yet completed. The GPU
+// keeps filling the other slots meanwhile, overlapping the intra-node reduction
+// of the next chunks with the network reduction of the previous ones.
+static int calcStepsPerGroup(struct ncclProxyArgs* args) {
+  int depth = args->collnetDepth ? args->collnetDepth : NCCL_STEPS;
+  return std::min(depth*args->sliceSteps, NCCL_STEPS);
 }
 
 static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args) {
@@ -686,7 +689,7 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
   args->idle = 1;
   if (args->state == ncclProxyOpProgress) {
     int p = NCCL_PROTO_SIMPLE;
-    int nGroups = DIVUP(args->nsubs, COLLNET_GROUP_NSUBS);
+    int stepsPerGroup = calcStepsPerGroup(args);
     for (int s=0; s<args->nsubs; s++) {
       struct ncclProxySubArgs* sub = args->subs+s;
       struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
@@ -709,7 +712,7 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
         *sendHead = sub->base + sub->posted - NCCL_STEPS;
         if (resources->gdcSync) wc_store_fence(); // Flush out WC write
       }
-      if (sub->received < sub->posted && sub->received < sub->done + calcStepsPerGroup(nGroups)) {
+      if (sub->received < sub->posted && sub->received < sub->done + stepsPerGroup) {
         int buffSlot = (sub->base+sub->received)%NCCL_STEPS;
         volatile struct ncclConnFifo* connFifo = (volatile struct ncclConnFifo*)resources->recvMem->connFifo;
         volatile uint64_t* recvTail = &resources->recvMem->tail;
@@ -888,7 +891,7 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
   args->idle = 1;
   if (args->state == ncclProxyOpProgress) {
     int p = NCCL_PROTO_SIMPLE;
-    int nGroups = DIVUP(args->nsubs, COLLNET_GROUP_NSUBS);
+    int stepsPerGroup = calcStepsPerGroup(args);
     for (int s=0; s<args->nsubs; s++) {
       int group = s/COLLNET_GROUP_NSUBS;
       int groupStart = s - (s%COLLNET_GROUP_NSUBS);
@@ -899,7 +902,7 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
       char* region = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
 
       // Enforce sync between operations of the same group.
-      if (LAST_OF_GROUP(args, s) && (sub->posted < sub->done + calcStepsPerGroup(nGroups)) && (sub->posted < sub->nsteps)) {
+      if (LAST_OF_GROUP(args, s) && (sub->posted < sub->done + stepsPerGroup) && (sub->posted < sub->nsteps)) {
         int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
         reqFifo[group][buffSlot].turnIsSendNotRecv = true;
         TRACE(NCCL_NET, "recvProxy [%ld/%d/%d] posted buffer", (long)sub->posted, group, buffSlot);
@@ -70,6 +70,7 @@ struct connectMap {
   int sameProcess;
   int shared;
   int cudaDev;
+  int nSteps; // Steps of the SIMPLE buffer
   // First 3 bits of offsets determine the mem bank. 001 is host mem, 011 is dev mem, 101 is shared host mem and 111 is shared dev mem.
   struct connectMapMem mems[NCCL_NET_MAP_MEMS];
   // Offsets. 3 MSBs indicate mem bank, 111 indicates NULL.
@@ -83,6 +84,11 @@ struct connectMap {
 struct sendNetResources {
   struct connectMap map;
   void* netSendComm;
+  void* netOobSendComm;
+  // Net comm pair reuse, see NCCL_NET_POOL_TTL
+  uint64_t poolKey;
+  uint64_t poolId;
+  void* pooledComm;
   struct ncclSendMem* sendMem;
   struct ncclRecvMem* recvMem;
 
@@ -100,6 +106,7 @@ struct sendNetResources {
   int connIndex;
   char* buffers[NCCL_NUM_PROTOCOLS];
   int buffSizes[NCCL_NUM_PROTOCOLS];
+  int nSteps[NCCL_NUM_PROTOCOLS];
   void* mhandles[NCCL_NUM_PROTOCOLS];
   uint64_t step;
   uint64_t llLastCleaning;
@@ -112,6 +119,10 @@ struct recvNetResources {
   struct connectMap map;
   void* netListenComm;
   void* netRecvComm;
+  // Net comm pair reuse, see NCCL_NET_POOL_TTL
+  uint64_t poolKey;
+  uint64_t poolId;
+  void* pooledComm;
   struct ncclSendMem* sendMem;
   struct ncclRecvMem* recvMem;
 
@@ -126,12 +137,14 @@ struct recvNetResources {
   int maxRecvs;
   uint64_t* gdcSync;
   uint64_t* gdcFlush;
+  int driverFlush;
   void* gdrDesc;
   int shared;
   int channelId;
   int connIndex;
   char* buffers[NCCL_NUM_PROTOCOLS];
   int buffSizes[NCCL_NUM_PROTOCOLS];
+  int nSteps[NCCL_NUM_PROTOCOLS];
   void* mhandles[NCCL_NUM_PROTOCOLS];
   uint64_t step;
   uint64_t llLastCleaning;
@@ -152,6 +165,21 @@ static ncclResult_t canConnect(int* ret, struct ncclTopoSystem* topo, struct ncc
 
 NCCL_PARAM(NetSharedBuffers, "NET_SHARED_BUFFERS", -2);
 NCCL_PARAM(NetSharedComms, "NET_SHARED_COMMS", 1);
+// Dedicated SIMPLE buffers may run up to NCCL_NET_MAX_STEPS steps deep to cover
+// the bandwidth-delay product of the NIC. Latency is in us, used when the
+// plugin does not report one.
+NCCL_PARAM(NetMaxSteps, "NET_MAX_STEPS", NCCL_STEPS);
+NCCL_PARAM(NetStepsLatency, "NET_STEPS_LATENCY", 10);
+
+static void netProtoSteps(struct ncclProxyState* proxyState, ncclNetProperties_t* props, int shared, int* nSteps) {
+  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) nSteps[p] = NCCL_STEPS;
+  if (shared) return;
+  int maxSteps = std::min<int64_t>(NCCL_MAX_STEPS, ncclParamNetMaxSteps());
+  float latency = props->latency > 0 ? props->latency : ncclParamNetStepsLatency();
+  double bdp = (double)latency*props->speed/8; // us * Mbps / 8 = bytes
+  int stepSize = proxyState->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
+  while (2*nSteps[NCCL_PROTO_SIMPLE] <= maxSteps && (double)nSteps[NCCL_PROTO_SIMPLE]*stepSize < bdp) nSteps[NCCL_PROTO_SIMPLE] *= 2;
+}
 
 struct setupReq {
   int tpRank;
@@ -163,18 +191,40 @@ struct setupReq {
   int needFlush;
   int channelId;
   int connIndex;
+  uint64_t poolKey;
+};
+
+// Response of the send proxy setup
+struct netSendSetupResp {
+  uint64_t poolId; // net comm offered for reuse, 0 if none
+  char oobInfo[NCCL_NET_OOB_INFO_SIZE];
 };
 
+// Connect info of a send connector, passed to the recvConnect of the peer
+struct netSendConnectInfo {
+  int tpProxyRank;
+  struct netSendSetupResp setup;
+};
+static_assert(sizeof(struct netSendConnectInfo) <= CONNECT_SIZE, "NET send connect info is too large");
+
 // Forward declaration
 static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args);
 
+// Same on both sides of a connection, and for the same connection of a later
+// communicator between the same GPUs
+static uint64_t netPoolKey(struct ncclPeerInfo* sender, struct ncclPeerInfo* receiver, int channelId, int connIndex) {
+  uint64_t key[6] = { sender->hostHash, (uint64_t)sender->busId, receiver->hostHash, (uint64_t)receiver->busId, (uint64_t)channelId, (uint64_t)connIndex };
+  return getHash((const char*)key, sizeof(key));
+}
+
 /* Determine if we will use this transport for this peer and return connect
  * information for this peer */
 static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclConnect* connectInfo, struct ncclConnector* send, int channelId, int connIndex) {
   struct setupReq req = { 0 };
   int tpProxyRank;
 
-  send->conn.shared = req.shared = graph ? 0 : ncclParamNetSharedBuffers() != -2 ? ncclParamNetSharedBuffers() : 1;
+  // Collectives have dedicated buffers, even those set up without a graph
+  send->conn.shared = req.shared = graph || connIndex == 0 ? 0 : ncclParamNetSharedBuffers() != -2 ? ncclParamNetSharedBuffers() : 1;
   req.channelId = channelId;
   req.connIndex = connIndex;
 
@@ -189,7 +239,10 @@ static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
   req.tpLocalRank = comm->topParentLocalRanks[comm->localRank];
   req.tpRank = comm->topParentRanks[myInfo->rank];
   req.tpRemoteRank = comm->topParentRanks[peerInfo->rank];
-  NCCLCHECK(ncclProxyCallBlocking(comm, &send->proxyConn, ncclProxyMsgSetup, &req, sizeof(req), NULL, 0));
+  req.poolKey = netPoolKey(myInfo, peerInfo, channelId, connIndex);
+  // Completed by sendSetupDone, so that the setups of all connectors of a round are in flight together.
+  // The response is the out-of-band QP info, if any.
+  NCCLCHECK(ncclProxyCallAsync(comm, &send->proxyConn, ncclProxyMsgSetup, &req, sizeof(req), sizeof(struct netSendSetupResp), send));
 
   if (proxyRank == myInfo->rank) {
     INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%d] -> %d[%d] [send] via NET/%s/%d%s%s", channelId, connIndex, myInfo->rank, myInfo->nvmlDev, peerInfo->rank, peerInfo->nvmlDev, comm->ncclNet->name, req.netDev,
@@ -198,20 +251,26 @@ static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
     INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%d] -> %d[%d] [send] via NET/%s/%d(%d)%s%s", channelId, connIndex, myInfo->rank, myInfo->nvmlDev, peerInfo->rank, peerInfo->nvmlDev, comm->ncclNet->name, req.netDev,
         proxyRank, req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "");
   }
-  *((int*)connectInfo) = tpProxyRank;
-  return ncclSuccess;
+  ((struct netSendConnectInfo*)connectInfo)->tpProxyRank = tpProxyRank;
+  return ncclInProgress;
+}
+
+static ncclResult_t sendSetupDone(struct ncclComm* comm, struct ncclConnect* connectInfo, struct ncclConnector* send) {
+  return ncclPollProxyResponse(comm, &send->proxyConn, &((struct netSendConnectInfo*)connectInfo)->setup, send);
 }
 
 // GDRCOPY support: TAIL_ENABLE When enabled locates the RX proxy tail in CUDA memory
 NCCL_PARAM(GdrCopySyncEnable, "GDRCOPY_SYNC_ENABLE", 1);
 // GDRCOPY support: FLUSH_ENABLE When enabled uses a PCI-E read to flush GDRDMA buffers
 NCCL_PARAM(GdrCopyFlushEnable, "GDRCOPY_FLUSH_ENABLE", 0);
+// Flush GDRDMA buffers with cuFlushGPUDirectRDMAWrites instead of a network flush (RDMA read)
+NCCL_PARAM(GdrFlushDriver, "GDR_FLUSH_DRIVER", 0);
 
 /* Setup recv connector */
 static ncclResult_t recvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclConnect* connectInfo, struct ncclConnector* recv, int channelId, int connIndex) {
   struct setupReq req = { 0 };
 
-  recv->conn.shared = req.shared = graph ? 0 : ncclParamNetSharedBuffers() != -2 ? ncclParamNetSharedBuffers() : 1;
+  recv->conn.shared = req.shared = graph || connIndex == 0 ? 0 : ncclParamNetSharedBuffers() != -2 ? ncclParamNetSharedBuffers() : 1;
   req.channelId = channelId;
   req.connIndex = connIndex;
 
@@ -220,21 +279,28 @@ static ncclResult_t recvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
   int64_t netId;
   NCCLCHECK(ncclTopoGetNetDev(comm, myInfo->rank, graph, channelId, myInfo->rank, &netId, &req.netDev, &proxyRank));
   NCCLCHECK(ncclTopoCheckGdr(comm->topo, myInfo->busId, netId, 0, &req.useGdr));
+  recv->conn.flags |= req.useGdr ? NCCL_DIRECT_NIC : 0;
 
   // Determine whether we need to flush the GDR buffer on recv or not
   if (req.useGdr) NCCLCHECK(ncclTopoNeedFlush(comm->topo, myInfo->busId, &req.needFlush));
 
-  // We don't support PXN on receive yet
+  // Receives always use our own proxy, PXN and NCCL_PROXY_SHARED only relay sends
   tpProxyRank = comm->topParentRanks[myInfo->rank];
   NCCLCHECK(ncclProxyConnect(comm, TRANSPORT_NET, 0, tpProxyRank, &recv->proxyConn));
 
   req.tpLocalRank = comm->topParentLocalRanks[comm->localRank];
   req.tpRank = comm->topParentRanks[myInfo->rank];
   req.tpRemoteRank = comm->topParentRanks[peerInfo->rank];
-  NCCLCHECK(ncclProxyCallBlocking(comm, &recv->proxyConn, ncclProxyMsgSetup, &req, sizeof(req), connectInfo, sizeof(ncclNetHandle_t)));
+  req.poolKey = netPoolKey(peerInfo, myInfo, channelId, connIndex);
+  // The listen handle is received into connectInfo by recvSetupDone
+  NCCLCHECK(ncclProxyCallAsync(comm, &recv->proxyConn, ncclProxyMsgSetup, &req, sizeof(req), sizeof(ncclNetHandle_t), recv));
   INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%d] -> %d[%d] [receive] via NET/%s/%d%s%s", channelId, connIndex, peerInfo->rank, peerInfo->nvmlDev, myInfo->rank, myInfo->nvmlDev, comm->ncclNet->name, req.netDev,
       req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "");
-  return ncclSuccess;
+  return ncclInProgress;
+}
+
+static ncclResult_t recvSetupDone(struct ncclComm* comm, struct ncclConnect* connectInfo, struct ncclConnector* recv) {
+  return ncclPollProxyResponse(comm, &recv->proxyConn, connectInfo, recv);
 }
 
 static ncclResult_t netMapShm(struct connectMapMem* mem) {
@@ -281,8 +347,22 @@ struct netSendConnectArgs {
 
 struct netRecvConnectArgs {
   int proxyRank;
+  uint64_t poolId;
+  alignas(8) char oobInfo[NCCL_NET_OOB_INFO_SIZE];
 };
 
+// Ring collectives can have the proxy send and receive from registered user
+// buffers when it lives in our process, uses GPU Direct RDMA and does all the
+// data movement itself.
+static bool netRegSupported(struct connectMap* map, struct ncclConnector* conn) {
+  return conn->proxyConn.sameProcess && !map->shared && (conn->conn.flags & NCCL_DIRECT_NIC) &&
+    conn->proxyConn.proxyProgress != NULL && conn->conn.netDeviceHandle.netDeviceType == NCCL_NET_DEVICE_HOST;
+}
+
+// Send float/bf16 sums over the network in a block-scaled 8-bit format, see
+// device/network/compress. Lossy, and must be set identically on all ranks.
+NCCL_PARAM(NetCompress, "NET_COMPRESS", 0);
+
 static ncclResult_t sendConnect(struct ncclComm* comm, struct ncclConnect* connectInfo, int nranks, int rank, struct ncclConnector* send) {
   struct connectMap* map = (connectMap*) send->transportResources;
 
@@ -322,21 +402,27 @@ static ncclResult_t sendConnect(struct ncclComm* comm, struct ncclConnect* conne
     }
   } else if (!(map->sameProcess && map->cudaDev == comm->cudaDev)) {
     if (!map->sameProcess) NCCLCHECK(netMapShm(map->mems+NCCL_NET_MAP_HOSTMEM));
+    // Both buffers live in the same proxy, import them together
+    size_t sizes[2];
+    ncclIpcDesc* ipcDescs[2];
+    void** devMemPtrs[2];
+    int nImports = 0;
+    void** sharedDevMemPtr = comm->proxyState->sharedDevMems + send->proxyConn.tpLocalRank;
+    if (map->mems[NCCL_NET_MAP_DEVMEM].size) {
+      sizes[nImports] = map->mems[NCCL_NET_MAP_DEVMEM].size;
+      ipcDescs[nImports] = &map->mems[NCCL_NET_MAP_DEVMEM].ipcDesc;
+      devMemPtrs[nImports++] = (void**)&map->mems[NCCL_NET_MAP_DEVMEM].gpuPtr;
+    }
+    if (map->mems[NCCL_NET_MAP_SHARED_DEVMEM].size && *sharedDevMemPtr == NULL) {
+      sizes[nImports] = map->mems[NCCL_NET_MAP_SHARED_DEVMEM].size;
+      ipcDescs[nImports] = &map->mems[NCCL_NET_MAP_SHARED_DEVMEM].ipcDesc;
+      devMemPtrs[nImports++] = sharedDevMemPtr;
+    }
+    NCCLCHECK(ncclP2pImportShareableBuffers(comm, send->proxyConn.tpRank, nImports, sizes, ipcDescs, devMemPtrs));
     if (map->mems[NCCL_NET_MAP_DEVMEM].size) {
-      NCCLCHECK(ncclP2pImportShareableBuffer(comm, send->proxyConn.tpRank,
-                                             map->mems[NCCL_NET_MAP_DEVMEM].size,
-                                             &map->mems[NCCL_NET_MAP_DEVMEM].ipcDesc,
-                                             (void**)&map->mems[NCCL_NET_MAP_DEVMEM].gpuPtr));
       map->mems[NCCL_NET_MAP_DEVMEM].cpuPtr = NULL;
     }
     if (map->mems[NCCL_NET_MAP_SHARED_DEVMEM].size) {
-      void** sharedDevMemPtr = comm->proxyState->sharedDevMems + send->proxyConn.tpLocalRank;
-      if (*sharedDevMemPtr == NULL) {
-        NCCLCHECK(ncclP2pImportShareableBuffer(comm, send->proxyConn.tpRank,
-                                               map->mems[NCCL_NET_MAP_SHARED_DEVMEM].size,
-                                               &map->mems[NCCL_NET_MAP_SHARED_DEVMEM].ipcDesc,
-                                               sharedDevMemPtr));
-      }
       map->mems[NCCL_NET_MAP_SHARED_DEVMEM].gpuPtr = (char*)(*sharedDevMemPtr);
       map->mems[NCCL_NET_MAP_SHARED_DEVMEM].cpuPtr = NULL;
     }
@@ -350,9 +436,10 @@ static ncclResult_t sendConnect(struct ncclComm* comm, struct ncclConnect* conne
   struct ncclRecvMem *recvMem = (struct ncclRecvMem*) NCCL_NET_MAP_GET_POINTER(map, gpu, recvMem);
   send->conn.tail = &recvMem->tail;
   send->conn.stepSize = comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
+  send->conn.nSteps = map->nSteps;
   send->conn.connFifo = recvMem->connFifo;
   // Only fuse P2P buffers, continue to allocate dedicated buffers for ring/tree
-  for (int i=0; i<NCCL_STEPS; i++) {
+  for (int i=0; i<NCCL_MAX_STEPS; i++) {
     send->conn.connFifo[i].offset = -1;
     recvMem->connFifo[i].mode = map->shared ? NCCL_MODE_OFFSET : NCCL_MODE_NORMAL;
   }
@@ -376,6 +463,8 @@ static ncclResult_t sendConnect(struct ncclComm* comm, struct ncclConnect* conne
   } else {
     send->proxyConn.proxyProgress = sendProxyProgress;
   }
+  if (netRegSupported(map, send)) send->conn.flags |= NCCL_NET_REG;
+  if (ncclParamNetCompress()) send->conn.flags |= NCCL_NET_COMPRESS;
 
   return ncclSuccess;
 }
@@ -395,7 +484,10 @@ static ncclResult_t recvConnect(struct ncclComm* comm, struct ncclConnect* conne
     INFO(NCCL_PROXY, "recvConnect ncclProxyCallAsync opId=%p &recv->proxyConn=%p connectInfo=%p",
        opId, &recv->proxyConn, connectInfo);
     netRecvConnectArgs args = {0};
-    args.proxyRank = *((int*)connectInfo);
+    struct netSendConnectInfo* info = (struct netSendConnectInfo*)connectInfo;
+    args.proxyRank = info->tpProxyRank;
+    args.poolId = info->setup.poolId;
+    memcpy(args.oobInfo, info->setup.oobInfo, NCCL_NET_OOB_INFO_SIZE);
     NCCLCHECK(ncclProxyCallAsync(comm, &recv->proxyConn, ncclProxyMsgConnect, &args, sizeof(netRecvConnectArgs), sizeof(struct connectMap), opId));
   } else {
     opId = recv;
@@ -416,9 +508,10 @@ static ncclResult_t recvConnect(struct ncclComm* comm, struct ncclConnect* conne
   void* gdcMem = map->mems[NCCL_NET_MAP_GDCMEM].gpuPtr;
   recv->conn.tail = gdcMem ? (uint64_t*)gdcMem : &recvMem->tail;
   recv->conn.stepSize = comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
+  recv->conn.nSteps = map->nSteps;
   recv->conn.connFifo = recvMem->connFifo;
   // Only fuse P2P buffers, continue to allocate dedicated buffers for ring/tree
-  for (int i=0; i<NCCL_STEPS; i++) {
+  for (int i=0; i<NCCL_MAX_STEPS; i++) {
     recvMem->connFifo[i].mode = map->shared ? NCCL_MODE_OFFSET : NCCL_MODE_NORMAL;
   }
 
@@ -441,6 +534,8 @@ static ncclResult_t recvConnect(struct ncclComm* comm, struct ncclConnect* conne
   } else {
     recv->proxyConn.proxyProgress = recvProxyProgress;
   }
+  if (netRegSupported(map, recv)) recv->conn.flags |= NCCL_NET_REG;
+  if (ncclParamNetCompress()) recv->conn.flags |= NCCL_NET_COMPRESS;
 
   return ncclSuccess;
 }
@@ -480,6 +575,31 @@ static ncclResult_t recvFree(struct ncclConnector* recv) {
 }
 
 #define NCCL_SHARED_STEPS 16
+
+// Shared buffers are split statically, each channel getting NCCL_SHARED_STEPS
+// chunks divided among the subs of an operation. With NET_SHARED_CREDITS=<n>
+// chunks of the pool are handed out from a free list instead, up to n per sub
+// (at most NCCL_STEPS), so that a few busy peers can use most of the pool. A
+// sub holding no chunk gets any free one; others only take one while a chunk
+// per active sub remains free, so every sub can always make progress.
+NCCL_PARAM(NetSharedCredits, "NET_SHARED_CREDITS", 0);
+
+static struct ncclProxySharedP2p* sharedPool(struct ncclProxyState* proxyState, int tpLocalRank, int type) {
+  struct ncclProxyPeer* peer = proxyState->progressState.localPeers[tpLocalRank];
+  return type == 0 ? &peer->send : &peer->recv;
+}
+
+static bool sharedChunkAvailable(struct ncclProxySharedP2p* pool, bool holding) {
+  return pool->nFreeChunks > (holding ? pool->nActiveSubs : 0);
+}
+
+static int sharedChunkGet(struct ncclProxyState* proxyState, struct ncclProxySharedP2p* pool) {
+  return pool->freeChunks[--pool->nFreeChunks] * proxyState->p2pChunkSize;
+}
+
+static void sharedChunkPut(struct ncclProxyState* proxyState, struct ncclProxySharedP2p* pool, int offset) {
+  pool->freeChunks[pool->nFreeChunks++] = offset / proxyState->p2pChunkSize;
+}
 static ncclResult_t sharedNetBuffersInit(struct ncclProxyState* proxyState, int cuda, int tpLocalRank, int type, int sameProcess,
     int nChannels, char** gpuPtr, char** cpuPtr, int* size, ncclIpcDesc *ipcDesc) {
   if (cuda == 0 && sameProcess == 0) {
@@ -487,6 +607,8 @@ static ncclResult_t sharedNetBuffersInit(struct ncclProxyState* proxyState, int
       return ncclInternalError;
   }
   struct ncclProxyProgressState* progressState = &proxyState->progressState;
+  // Shared buffers serve all peers of the local rank
+  ncclMemScope memScope(ncclMemCurrentTag.stats, ncclMemProxyShared, ncclMemCurrentTag.transport);
   if (progressState->localPeers == NULL) {
     NCCLCHECK(ncclCalloc(&progressState->localPeers, proxyState->tpLocalnRanks));
   }
@@ -500,6 +622,13 @@ static ncclResult_t sharedNetBuffersInit(struct ncclProxyState* proxyState, int
   if (state->size == 0) {
     state->size = nChannels * NCCL_SHARED_STEPS * proxyState->p2pChunkSize;
   }
+  if (state->freeChunks == NULL && ncclParamNetSharedCredits() > 0) {
+    int nChunks = state->size / proxyState->p2pChunkSize;
+    NCCLCHECK(ncclCalloc(&state->freeChunks, nChunks));
+    // Hand out the first chunks first
+    for (int c=0; c<nChunks; c++) state->freeChunks[c] = nChunks-1-c;
+    state->nFreeChunks = nChunks;
+  }
 
   if (size) *size = state->size;
 
@@ -511,7 +640,7 @@ static ncclResult_t sharedNetBuffersInit(struct ncclProxyState* proxyState, int
     }
   }
   if (!cuda && state->hostBuff == NULL) {
-    NCCLCHECK(ncclCudaHostCalloc(&state->hostBuff, state->size));
+    NCCLCHECK(ncclHostMemAlloc((void**)&state->hostBuff, state->size, proxyState->numaId));
   }
   if (cpuPtr) *cpuPtr = cuda ? state->cudaBuff : state->hostBuff;
   if (gpuPtr) *gpuPtr = sameProcess ? *cpuPtr : NULL;
@@ -540,7 +669,9 @@ static ncclResult_t sharedNetBuffersDestroy(struct ncclProxyState* proxyState, i
       }
       NCCLCHECK(ncclCudaFree(state->cudaBuff));
     }
-    if (state->hostBuff) NCCLCHECK(ncclCudaHostFree(state->hostBuff));
+    if (state->hostBuff) NCCLCHECK(ncclHostMemFree(state->hostBuff, state->size));
+    free(state->freeChunks);
+    state->freeChunks = NULL;
   }
 
   if (peer->send.refcount || peer->recv.refcount) return ncclSuccess;
@@ -561,6 +692,85 @@ static ncclResult_t proxySharedInit(struct ncclProxyConnection* connection, stru
   return ncclSuccess;
 }
 
+// Seconds a dedicated net comm is kept once its communicator is destroyed, to
+// be reused by a later communicator connecting the same GPUs. 0 disables it.
+NCCL_PARAM(NetPoolTtl, "NET_POOL_TTL", 0);
+
+// Net comms kept for reuse, shared by all proxies of the process. Both sides
+// of a connection pool their comm under the same key and pair id; a later
+// connection reuses them only when both sides still have theirs, which they
+// find out from the pair ids exchanged during setup.
+struct netPoolEntry {
+  struct netPoolEntry* next;
+  ncclNet_t* net;
+  uint64_t key;
+  uint64_t id;
+  int netDev;
+  int send;
+  void* comm;
+  uint64_t time;
+};
+static struct netPoolEntry* netPool = NULL;
+static pthread_mutex_t netPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static ncclResult_t netPoolClose(struct netPoolEntry* entry) {
+  ncclResult_t ret = entry->send ? entry->net->closeSend(entry->comm) : entry->net->closeRecv(entry->comm);
+  free(entry);
+  return ret;
+}
+
+// Only the internal plugins leave room in their handle for the pair id
+static bool netPoolUsable(struct ncclProxyState* proxyState, int shared) {
+  return ncclParamNetPoolTtl() > 0 && shared == 0 &&
+    (proxyState->ncclNet == &ncclNetIb || proxyState->ncclNet == &ncclNetSocket);
+}
+
+// Takes the comm pooled for key, after closing the expired ones
+static ncclResult_t netPoolTake(ncclNet_t* net, uint64_t key, int netDev, int send, uint64_t* id, void** comm) {
+  ncclResult_t ret = ncclSuccess;
+  uint64_t now = clockNano();
+  *id = 0;
+  *comm = NULL;
+  pthread_mutex_lock(&netPoolLock);
+  struct netPoolEntry** pp = &netPool;
+  while (*pp) {
+    struct netPoolEntry* entry = *pp;
+    bool expired = now - entry->time > ncclParamNetPoolTtl()*1000000000ULL;
+    bool match = !expired && *comm == NULL && entry->net == net && entry->key == key && entry->netDev == netDev && entry->send == send;
+    if (!expired && !match) {
+      pp = &entry->next;
+      continue;
+    }
+    *pp = entry->next;
+    if (match) {
+      *id = entry->id;
+      *comm = entry->comm;
+      free(entry);
+    } else if (netPoolClose(entry) != ncclSuccess) {
+      ret = ncclSystemError;
+    }
+  }
+  pthread_mutex_unlock(&netPoolLock);
+  return ret;
+}
+
+static ncclResult_t netPoolPut(ncclNet_t* net, uint64_t key, uint64_t id, int netDev, int send, void* comm) {
+  struct netPoolEntry* entry;
+  NCCLCHECK(ncclCalloc(&entry, 1));
+  entry->net = net;
+  entry->key = key;
+  entry->id = id;
+  entry->netDev = netDev;
+  entry->send = send;
+  entry->comm = comm;
+  entry->time = clockNano();
+  pthread_mutex_lock(&netPoolLock);
+  entry->next = netPool;
+  netPool = entry;
+  pthread_mutex_unlock(&netPoolLock);
+  return ncclSuccess;
+}
+
 static ncclResult_t sendProxySetup(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
   struct setupReq* req = (struct setupReq*) reqBuff;
   if (reqSize != sizeof(struct setupReq)) return ncclInternalError;
@@ -577,6 +787,7 @@ static ncclResult_t sendProxySetup(struct ncclProxyConnection* connection, struc
   resources->useGdr = req->useGdr;
   resources->channelId = req->channelId;
   resources->connIndex = req->connIndex;
+  resources->poolKey = req->poolKey;
   ncclNetProperties_t props;
   NCCLCHECK(proxyState->ncclNet->getProperties(req->netDev, &props));
   /* DMA-BUF support */
@@ -587,9 +798,17 @@ static ncclResult_t sendProxySetup(struct ncclProxyConnection* connection, struc
 
   resources->netDeviceVersion = props.netDeviceVersion;
   resources->netDeviceType = props.netDeviceType;
-
-  // We don't return any data
-  if (respSize != 0) return ncclInternalError;
+  netProtoSteps(proxyState, &props, resources->shared, resources->nSteps);
+
+  if (respSize != sizeof(struct netSendSetupResp)) return ncclInternalError;
+  struct netSendSetupResp* resp = (struct netSendSetupResp*)respBuff;
+  memset(resp, 0, respSize);
+  if (netPoolUsable(proxyState, resources->shared)) {
+    NCCLCHECK(netPoolTake(proxyState->ncclNet, resources->poolKey, resources->netDev, 1, &resources->poolId, &resources->pooledComm));
+    resp->poolId = resources->poolId;
+  }
+  // Only the internal IB plugin connects out-of-band, others leave the info invalid
+  if (proxyState->ncclNet == &ncclNetIb) NCCLCHECK(ncclIbOobConnectPrepare(req->netDev, resp->oobInfo, &resources->netOobSendComm));
   *done = 1;
   return ncclSuccess;
 }
@@ -611,6 +830,7 @@ static ncclResult_t recvProxySetup(struct ncclProxyConnection* connection, struc
   resources->needFlush = req->needFlush;
   resources->channelId = req->channelId;
   resources->connIndex = req->connIndex;
+  resources->poolKey = req->poolKey;
   ncclNetProperties_t props;
   NCCLCHECK(proxyState->ncclNet->getProperties(req->netDev, &props));
   /* DMA-BUF support */
@@ -618,9 +838,21 @@ static ncclResult_t recvProxySetup(struct ncclProxyConnection* connection, struc
   resources->maxRecvs = props.maxRecvs;
   resources->netDeviceVersion = props.netDeviceVersion;
   resources->netDeviceType = props.netDeviceType;
+  netProtoSteps(proxyState, &props, resources->shared, resources->nSteps);
 
   if (respSize != sizeof(ncclNetHandle_t)) return ncclInternalError;
+  // Accepted sockets inherit their buffer sizes from the listening one
+  ncclNetQosScope qos(proxyState->netQos);
   NCCLCHECK(proxyState->ncclNet->listen(req->netDev, respBuff, &resources->netListenComm));
+  if (netPoolUsable(proxyState, resources->shared)) {
+    // Offer the pooled comm, or the id of the new pair if there is none
+    NCCLCHECK(netPoolTake(proxyState->ncclNet, resources->poolKey, resources->netDev, 0, &resources->poolId, &resources->pooledComm));
+    if (resources->pooledComm == NULL) {
+      NCCLCHECK(getRandomData(&resources->poolId, sizeof(resources->poolId)));
+      resources->poolId |= 1; // 0 means no offer
+    }
+    memcpy((char*)respBuff+NCCL_NET_HANDLE_POOL_OFFSET, &resources->poolId, sizeof(uint64_t));
+  }
   *done = 1;
 
   return ncclSuccess;
@@ -648,6 +880,27 @@ static ncclResult_t ncclNetGetDeviceHandle(ncclNetDeviceType type, int version,
   return ncclSuccess;
 }
 
+// Use the QP prepared by sendProxySetup if the receiver prepared one as well
+static ncclResult_t netConnect(struct ncclProxyState* proxyState, struct sendNetResources* resources, void* handle, void** sendComm) {
+  ncclNetQosScope qos(proxyState->netQos);
+  if (resources->netOobSendComm) {
+    void* oobSendComm = resources->netOobSendComm;
+    resources->netOobSendComm = NULL;
+    NCCLCHECK(ncclIbOobConnect(oobSendComm, handle, sendComm));
+    if (*sendComm) return ncclSuccess;
+  }
+  return proxyState->ncclNet->connect(resources->netDev, handle, sendComm, &resources->netDeviceHandle);
+}
+
+static ncclResult_t netAccept(struct ncclProxyState* proxyState, struct recvNetResources* resources, void* oobInfo, void** recvComm) {
+  ncclNetQosScope qos(proxyState->netQos);
+  if (proxyState->ncclNet == &ncclNetIb) {
+    NCCLCHECK(ncclIbOobAccept(resources->netListenComm, oobInfo, recvComm));
+    if (*recvComm) return ncclSuccess;
+  }
+  return proxyState->ncclNet->accept(resources->netListenComm, recvComm, &resources->netDeviceHandle);
+}
+
 static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
   struct sendNetResources* resources = (struct sendNetResources*)(connection->transportResources);
   if (reqSize != sizeof(netSendConnectArgs)) return ncclInternalError;
@@ -665,6 +918,8 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
       NCCLCHECK(ncclCalloc(localPeers + resources->tpLocalRank, 1));
     }
     connection->proxyAppendPtr = localPeers[resources->tpLocalRank]->send.proxyAppend + resources->channelId;
+    // Connections sharing an append list or a net comm must be progressed by the same thread, both are per channel.
+    connection->progressShard = ncclProxyProgressShardForNet(proxyState, resources->channelId);
 
     if (resources->maxRecvs > 1 && ncclParamNetSharedComms()) {
       // Connect or reuse connection for a netdev/remote rank.
@@ -672,16 +927,34 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
         NCCLCHECK(ncclCalloc(progressState->netComms + resources->netDev, proxyState->tpnRanks));
       }
       struct ncclSharedNetComms* comms = progressState->netComms[resources->netDev] + resources->tpRemoteRank;
-      if (comms->sendComm[resources->channelId] == NULL) ret = proxyState->ncclNet->connect(resources->netDev, req->handle, comms->sendComm + resources->channelId, &resources->netDeviceHandle);
+      if (comms->sendComm[resources->channelId] == NULL) ret = netConnect(proxyState, resources, req->handle, comms->sendComm + resources->channelId);
       resources->netSendComm = comms->sendComm[resources->channelId];
       if (comms->sendComm[resources->channelId]) comms->sendRefCount[resources->channelId]++;
     } else {
-      ret = proxyState->ncclNet->connect(resources->netDev, req->handle, &resources->netSendComm, &resources->netDeviceHandle);
+      ret = netConnect(proxyState, resources, req->handle, &resources->netSendComm);
     }
   } else {
+    if (netPoolUsable(proxyState, resources->shared)) {
+      // Reuse our pooled comm if the receiver offered the same pair, else
+      // the receiver gave the id of the new pair
+      uint64_t pairId;
+      memcpy(&pairId, req->handle+NCCL_NET_HANDLE_POOL_OFFSET, sizeof(pairId));
+      if (resources->pooledComm) {
+        if (pairId == resources->poolId) resources->netSendComm = resources->pooledComm;
+        else NCCLCHECK(proxyState->ncclNet->closeSend(resources->pooledComm));
+        resources->pooledComm = NULL;
+      }
+      resources->poolId = pairId;
+    }
     // Connect to remote peer
-    ret = proxyState->ncclNet->connect(resources->netDev, req->handle, &resources->netSendComm, &resources->netDeviceHandle);
+    if (resources->netSendComm == NULL) ret = netConnect(proxyState, resources, req->handle, &resources->netSendComm);
     connection->proxyAppendPtr = &connection->proxyAppend;
+    connection->progressShard = ncclProxyProgressShardForNet(proxyState, resources->netDev);
+  }
+  // Reused a shared comm, the receiver does the same with its prepared QP
+  if (resources->netOobSendComm) {
+    NCCLCHECK(proxyState->ncclNet->closeSend(resources->netOobSendComm));
+    resources->netOobSendComm = NULL;
   }
 
   NCCLCHECK(ret);
@@ -702,12 +975,13 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
   struct connectMap* map = &resources->map;
   map->sameProcess = connection->sameProcess;
   map->shared = resources->shared;
+  map->nSteps = resources->nSteps[NCCL_PROTO_SIMPLE];
   CUDACHECK(cudaGetDevice(&map->cudaDev));
 
   if (resources->shared == 0) { // Only allocate dedicated buffers for ring/tree, not for p2p
     for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
-      NCCL_NET_MAP_ADD_POINTER(map, 0, p!= NCCL_PROTO_LL && resources->useGdr, proxyState->buffSizes[p], buffs[p]);
-      resources->buffSizes[p] = proxyState->buffSizes[p];
+      resources->buffSizes[p] = proxyState->buffSizes[p]*(resources->nSteps[p]/NCCL_STEPS);
+      NCCL_NET_MAP_ADD_POINTER(map, 0, p!= NCCL_PROTO_LL && resources->useGdr, resources->buffSizes[p], buffs[p]);
     }
   } else {
     // Get shared buffers
@@ -742,7 +1016,7 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
     }
   }
   if (map->sameProcess) {
-    NCCLCHECK(ncclCudaHostCalloc(&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size));
+    NCCLCHECK(ncclHostMemAlloc((void**)&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size, proxyState->numaId));
     map->mems[NCCL_NET_MAP_HOSTMEM].gpuPtr = map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr;
   } else {
     NCCLCHECK(netCreateShm(map->mems+NCCL_NET_MAP_HOSTMEM));
@@ -764,7 +1038,7 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
   // Don't give credits yet in shared mode.
   (resources->gdcSync ? *resources->gdcSync : resources->sendMem->head) =
     (map->shared ? -NCCL_STEPS : 0);
-  for (int i=0; i<NCCL_STEPS; i++) resources->recvMem->connFifo[i].size = -1;
+  for (int i=0; i<NCCL_MAX_STEPS; i++) resources->recvMem->connFifo[i].size = -1;
 
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
     resources->buffers[p] = NCCL_NET_MAP_GET_POINTER(map, cpu, buffs[p]);
@@ -795,6 +1069,21 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
   return ncclSuccess;
 }
 
+// The driver flush is only usable when the device can flush GDR writes on request from the host
+static ncclResult_t netDriverFlushSupport(struct ncclProxyState* proxyState, int* supported) {
+  *supported = 0;
+#if CUDART_VERSION >= 11030
+  if (CUPFN(cuFlushGPUDirectRDMAWrites) == NULL) return ncclSuccess;
+  CUdevice dev;
+  int options = 0;
+  CUCHECK(cuDeviceGet(&dev, proxyState->cudaDev));
+  CUCHECK(cuDeviceGetAttribute(&options, CU_DEVICE_ATTRIBUTE_GPU_DIRECT_RDMA_FLUSH_WRITES_OPTIONS, dev));
+  *supported = (options & CU_FLUSH_GPU_DIRECT_RDMA_WRITES_OPTION_HOST) ? 1 : 0;
+#endif
+  if (*supported == 0) INFO(NCCL_NET, "NET: GDR driver flush not supported on device %d, using network flush", proxyState->cudaDev);
+  return ncclSuccess;
+}
+
 static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
   if (reqSize != sizeof(netRecvConnectArgs)) return ncclInternalError;
   struct recvNetResources* resources = (struct recvNetResources*)(connection->transportResources);
@@ -815,6 +1104,8 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
       NCCLCHECK(ncclCalloc(localPeers + resources->tpLocalRank, 1));
     }
     connection->proxyAppendPtr = localPeers[resources->tpLocalRank]->recv.proxyAppend + resources->channelId;
+    // Connections sharing an append list or a net comm must be progressed by the same thread, both are per channel.
+    connection->progressShard = ncclProxyProgressShardForNet(proxyState, resources->channelId);
 
     if (resources->maxRecvs > 1 && ncclParamNetSharedComms()) {
       // Connect or reuse connection for a netdev/remote rank.
@@ -822,16 +1113,23 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
         NCCLCHECK(ncclCalloc(progressState->netComms + resources->netDev, proxyState->tpnRanks));
       }
       struct ncclSharedNetComms* comms = progressState->netComms[resources->netDev] + resources->tpRemoteProxyRank;
-      if (comms->recvComm[resources->channelId] == NULL) ret = proxyState->ncclNet->accept(resources->netListenComm, comms->recvComm+resources->channelId, &resources->netDeviceHandle);
+      if (comms->recvComm[resources->channelId] == NULL) ret = netAccept(proxyState, resources, req->oobInfo, comms->recvComm+resources->channelId);
       resources->netRecvComm = comms->recvComm[resources->channelId];
       if (comms->recvComm[resources->channelId]) comms->recvRefCount[resources->channelId]++;
     } else {
-      ret = proxyState->ncclNet->accept(resources->netListenComm, &resources->netRecvComm, &resources->netDeviceHandle);
+      ret = netAccept(proxyState, resources, req->oobInfo, &resources->netRecvComm);
     }
   } else {
+    if (resources->pooledComm) {
+      // Reuse our pooled comm if the sender offered the same pair
+      if (req->poolId == resources->poolId) resources->netRecvComm = resources->pooledComm;
+      else NCCLCHECK(proxyState->ncclNet->closeRecv(resources->pooledComm));
+      resources->pooledComm = NULL;
+    }
     // Connect to remote peer
-    ret = proxyState->ncclNet->accept(resources->netListenComm, &resources->netRecvComm, &resources->netDeviceHandle);
+    if (resources->netRecvComm == NULL) ret = netAccept(proxyState, resources, req->oobInfo, &resources->netRecvComm);
     connection->proxyAppendPtr = &connection->proxyAppend;
+    connection->progressShard = ncclProxyProgressShardForNet(proxyState, resources->netDev);
   }
 
   NCCLCHECK(ret);
@@ -855,11 +1153,12 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
   map->sameProcess = connection->sameProcess;
   if (map->sameProcess == 0) return ncclInternalError; // We don't support remote proxy for recv
   map->shared = resources->shared;
+  map->nSteps = resources->nSteps[NCCL_PROTO_SIMPLE];
 
   if (resources->shared == 0) { // Only allocate dedicated buffers for ring/tree, not for p2p
     for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
-      NCCL_NET_MAP_ADD_POINTER(map, 0, resources->useGdr, proxyState->buffSizes[p], buffs[p]);
-      resources->buffSizes[p] = proxyState->buffSizes[p];
+      resources->buffSizes[p] = proxyState->buffSizes[p]*(resources->nSteps[p]/NCCL_STEPS);
+      NCCL_NET_MAP_ADD_POINTER(map, 0, resources->useGdr, resources->buffSizes[p], buffs[p]);
     }
   } else {
     // Get shared buffers
@@ -891,7 +1190,7 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
       map->mems[NCCL_NET_MAP_DEVMEM].cpuPtr = map->mems[NCCL_NET_MAP_DEVMEM].gpuPtr;
     }
   }
-  NCCLCHECK(ncclCudaHostCalloc(&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size));
+  NCCLCHECK(ncclHostMemAlloc((void**)&map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, map->mems[NCCL_NET_MAP_HOSTMEM].size, proxyState->numaId));
   map->mems[NCCL_NET_MAP_HOSTMEM].gpuPtr = map->mems[NCCL_NET_MAP_HOSTMEM].cpuPtr;
   if (ncclGdrCopy && map->sameProcess) {
     uint64_t *cpuPtr, *gpuPtr;
@@ -906,6 +1205,7 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
     }
     if (ncclParamGdrCopyFlushEnable()) resources->gdcFlush = cpuPtr + 1;
   }
+  if (resources->needFlush && resources->gdcFlush == NULL && ncclParamGdrFlushDriver()) NCCLCHECK(netDriverFlushSupport(proxyState, &resources->driverFlush));
 
   resources->sendMem = (struct ncclSendMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, sendMem);
   resources->recvMem = (struct ncclRecvMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, recvMem);
@@ -953,7 +1253,7 @@ static ncclResult_t sendProxyFree(struct ncclProxyConnection* connection, struct
     }
     struct connectMapMem* mems = resources->map.mems;
     if (resources->map.sameProcess) {
-      NCCLCHECK(ncclCudaHostFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr));
+      NCCLCHECK(ncclHostMemFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, mems[NCCL_NET_MAP_HOSTMEM].size));
     } else {
       NCCLCHECK(ncclShmClose(mems[NCCL_NET_MAP_HOSTMEM].createHandle));
     }
@@ -974,11 +1274,15 @@ static ncclResult_t sendProxyFree(struct ncclProxyConnection* connection, struct
       } else {
         NCCLCHECK(proxyState->ncclNet->closeSend(resources->netSendComm));
       }
+    } else if (netPoolUsable(proxyState, resources->shared) && __atomic_load_n(proxyState->abortFlag, __ATOMIC_RELAXED) == 0) {
+      NCCLCHECK(netPoolPut(proxyState->ncclNet, resources->poolKey, resources->poolId, resources->netDev, 1, resources->netSendComm));
     } else {
       NCCLCHECK(proxyState->ncclNet->closeSend(resources->netSendComm));
     }
   }
 
+  if (resources && resources->pooledComm) NCCLCHECK(proxyState->ncclNet->closeSend(resources->pooledComm));
+  if (resources && resources->netOobSendComm) NCCLCHECK(proxyState->ncclNet->closeSend(resources->netOobSendComm));
   if (resources) free(resources);
   return ncclSuccess;
 }
@@ -997,7 +1301,7 @@ static ncclResult_t recvProxyFree(struct ncclProxyConnection* connection, struct
       }
     }
     struct connectMapMem* mems = resources->map.mems;
-    NCCLCHECK(ncclCudaHostFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr));
+    NCCLCHECK(ncclHostMemFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr, mems[NCCL_NET_MAP_HOSTMEM].size));
     NCCLCHECK(ncclCudaFree(mems[NCCL_NET_MAP_DEVMEM].cpuPtr));
     if (!resources->map.sameProcess || ncclCuMemEnable()) {
       // cuMem API support
@@ -1015,18 +1319,78 @@ static ncclResult_t recvProxyFree(struct ncclProxyConnection* connection, struct
       } else {
         NCCLCHECK(proxyState->ncclNet->closeRecv(resources->netRecvComm));
       }
+    } else if (netPoolUsable(proxyState, resources->shared) && __atomic_load_n(proxyState->abortFlag, __ATOMIC_RELAXED) == 0) {
+      NCCLCHECK(netPoolPut(proxyState->ncclNet, resources->poolKey, resources->poolId, resources->netDev, 0, resources->netRecvComm));
     } else {
       NCCLCHECK(proxyState->ncclNet->closeRecv(resources->netRecvComm));
     }
   }
 
+  if (resources && resources->pooledComm) NCCLCHECK(proxyState->ncclNet->closeRecv(resources->pooledComm));
   if (resources) free(resources);
   return ncclSuccess;
 }
 
-static_assert(NCCL_STEPS <= NCCL_NET_MAX_REQUESTS, "Not enough net requests to cover for steps");
+static_assert(NCCL_MAX_STEPS <= NCCL_NET_MAX_REQUESTS, "Not enough net requests to cover for steps");
 #define MAX_NET_SIZE (1024*1024*1024L) // Rather than send INT_MAX which is 2G-1, send a power of two.
 
+static bool ringRegUsed(struct ncclProxyArgs* args) {
+  return args->pattern == ncclPatternRing && args->specifics.ringReg.userRanks != NULL;
+}
+
+static size_t ringRegSize(struct ncclProxyArgs* args) {
+  return args->specifics.ringReg.nRanks * args->specifics.ringReg.rankCount * ncclTypeSize((ncclDataType_t)args->dtype);
+}
+
+// Locate the ring AllGather slice sent or received at a given step in the
+// registered output buffer, splitting chunks the way runRing and genericOp do
+// on the GPU.
+static char* ringRegSlice(struct ncclProxyArgs* args, struct ncclProxySubArgs* sub, int stepSize, uint64_t step, int isSend, int* size) {
+  auto* reg = &args->specifics.ringReg;
+  int typeSize = ncclTypeSize((ncclDataType_t)args->dtype);
+  int nRanks = reg->nRanks;
+  int slicePerChunk = args->chunkSteps/args->sliceSteps;
+  uint64_t chunk = step/args->chunkSteps;
+  int slice = (step%args->chunkSteps)/args->sliceSteps;
+  int k = chunk%(nRanks-1);
+  size_t elemOffset = (chunk/(nRanks-1))*reg->chunkCount;
+  int nelem = std::min(reg->chunkCount, reg->workCount-elemOffset);
+  int rank = reg->userRanks[isSend ? (nRanks-k)%nRanks : nRanks-1-k];
+  int sliceSize = std::max(DIVUP(nelem, 16*slicePerChunk)*16, stepSize/typeSize*args->sliceSteps/32);
+  int sliceOffset = std::min(slice*sliceSize, nelem);
+  if (size) *size = std::min(sliceSize, nelem-sliceOffset)*typeSize;
+  return (char*)sub->recvbuff + (reg->workOffset+elemOffset+rank*reg->rankCount+sliceOffset)*typeSize;
+}
+
+// Requests of one proxy pass, tested together so that the plugin can poll its
+// completions once for all subs instead of once per sub.
+struct netTestBatch {
+  int n;
+  int index[NCCL_PROXY_MAX_SUBS]; // Position of each sub in the batch, -1 if not tested
+  void* requests[NCCL_PROXY_MAX_SUBS];
+  int done[NCCL_PROXY_MAX_SUBS];
+  int* sizes[NCCL_PROXY_MAX_SUBS];
+};
+
+static void netTestBatchInit(struct netTestBatch* batch) {
+  batch->n = 0;
+  for (int s=0; s<NCCL_PROXY_MAX_SUBS; s++) batch->index[s] = -1;
+}
+
+static void netTestBatchAdd(struct netTestBatch* batch, int s, void* request, int* sizes) {
+  batch->index[s] = batch->n;
+  batch->requests[batch->n] = request;
+  batch->sizes[batch->n] = sizes;
+  batch->n++;
+}
+
+static ncclResult_t netTestBatchRun(struct ncclProxyState* proxyState, struct netTestBatch* batch) {
+  if (batch->n == 0) return ncclSuccess;
+  if (proxyState->ncclNet->testAll) return proxyState->ncclNet->testAll(batch->n, batch->requests, batch->done, batch->sizes);
+  for (int i=0; i<batch->n; i++) NCCLCHECK(proxyState->ncclNet->test(batch->requests[i], batch->done+i, batch->sizes[i]));
+  return ncclSuccess;
+}
+
 static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args) {
   if (args->state == ncclProxyOpReady) {
     for (int s=0; s<args->nsubs; s++) {
@@ -1037,9 +1401,15 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
       // Set step base for next op
       resources->step = sub->base + sub->nsteps;
       sub->posted = sub->transmitted = sub->done = 0;
-      for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileBegin);
+      if (resources->shared && !sub->reg && sub->nsteps > 0) {
+        struct ncclProxySharedP2p* pool = sharedPool(proxyState, resources->tpLocalRank, 0);
+        if (pool->freeChunks) pool->nActiveSubs++;
+      }
+      for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(proxyState, args, s, step, ncclProxyProfileBegin);
       if (sub->reg && sub->nbytes > 0) {
-        NCCLCHECK(proxyState->ncclNet->regMr(resources->netSendComm, sub->recvbuff, sub->nbytes, NCCL_PTR_CUDA, &sub->mhandle));
+        NCCLCHECK(proxyState->ncclNet->regMr(resources->netSendComm, sub->recvbuff, sub->nbytes, sub->regHost ? NCCL_PTR_HOST : NCCL_PTR_CUDA, &sub->mhandle));
+      } else if (ringRegUsed(args)) {
+        NCCLCHECK(proxyState->ncclNet->regMr(resources->netSendComm, sub->recvbuff, ringRegSize(args), NCCL_PTR_CUDA, &sub->mhandle));
       } else {
         sub->mhandle = resources->mhandles[args->protocol];
       }
@@ -1050,21 +1420,36 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
   if (args->state == ncclProxyOpProgress) {
     int p = args->protocol;
     int maxDepth = std::min(NCCL_STEPS, NCCL_SHARED_STEPS/args->nsubs);
+    struct netTestBatch tests;
+    int testSizes[NCCL_PROXY_MAX_SUBS];
+    netTestBatchInit(&tests);
+    for (int s=0; s<args->nsubs; s++) {
+      struct ncclProxySubArgs* sub = args->subs+s;
+      struct sendNetResources* resources = (struct sendNetResources*) (sub->connection->transportResources);
+      if (sub->done < sub->transmitted) netTestBatchAdd(&tests, s, sub->requests[(sub->base+sub->done)%resources->nSteps[p]], testSizes+s);
+    }
+    NCCLCHECK(netTestBatchRun(proxyState, &tests));
     for (int s=0; s<args->nsubs; s++) {
       struct ncclProxySubArgs* sub = args->subs+s;
       if (sub->done == sub->nsteps) continue;
       struct sendNetResources* resources = (struct sendNetResources*) (sub->connection->transportResources);
       volatile struct ncclConnFifo* connFifo = (volatile struct ncclConnFifo*)resources->recvMem->connFifo;
-      int stepSize = resources->buffSizes[p] / NCCL_STEPS;
+      int nSteps = resources->nSteps[p];
+      int stepSize = resources->buffSizes[p] / nSteps;
       char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
+      struct ncclProxySharedP2p* pool = resources->shared && !sub->reg ? sharedPool(proxyState, resources->tpLocalRank, 0) : NULL;
+      if (pool && pool->freeChunks == NULL) pool = NULL;
+      int depth = pool ? std::min<int64_t>(NCCL_STEPS, ncclParamNetSharedCredits()) : maxDepth;
       // Post buffers to the GPU
-      if (sub->posted < sub->nsteps && sub->posted < sub->done + maxDepth) {
-        int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
+      if (sub->posted < sub->nsteps && sub->posted < sub->done + (nSteps > NCCL_STEPS ? nSteps : depth) &&
+          (pool == NULL || sharedChunkAvailable(pool, sub->posted > sub->done))) {
+        int buffSlot = (sub->base+sub->posted)%nSteps;
         if (resources->shared) {
           if (!sub->reg) {
             int sharedBuffSlot = sub->posted%maxDepth;
             int offset;
-            NCCLCHECK(sharedBuffersGet(proxyState, sub->channelId, sharedBuffSlot*args->nsubs+s, &offset, NULL));
+            if (pool) offset = sharedChunkGet(proxyState, pool);
+            else NCCLCHECK(sharedBuffersGet(proxyState, sub->channelId, sharedBuffSlot*args->nsubs+s, &offset, NULL));
             resources->recvMem->connFifo[buffSlot].offset = offset;
             __sync_synchronize();
           }
@@ -1075,14 +1460,14 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
           if (resources->gdcSync) wc_store_fence(); // Flush out WC write
         } else sub->posted += args->sliceSteps;
         for (uint64_t step=sub->posted-args->sliceSteps; step<sub->posted; step++) {
-          ncclProfilingRecord(args, s, step, ncclProxyProfileSendGPUWait);
+          ncclProfilingRecord(proxyState, args, s, step, ncclProxyProfileSendGPUWait);
         }
         args->idle = 0;
         continue;
       }
       // Check whether we received data from the GPU and send it to the network
-      if (sub->transmitted < sub->posted && sub->transmitted < sub->done + NCCL_STEPS) {
-        int buffSlot = (sub->base+sub->transmitted)%NCCL_STEPS;
+      if (sub->transmitted < sub->posted && sub->transmitted < sub->done + nSteps) {
+        int buffSlot = (sub->base+sub->transmitted)%nSteps;
         volatile uint64_t* recvTail = &resources->recvMem->tail;
         uint64_t tail = sub->base + (sub->reg ? 0 : sub->transmitted);
         if ((sub->reg || connFifo[buffSlot].size != -1) && ((*recvTail > tail) || p == NCCL_PROTO_LL)) {
@@ -1115,14 +1500,17 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
             }
           } else if (p == NCCL_PROTO_SIMPLE && resources->shared) {
             buff = sub->reg ? (char*)sub->recvbuff : localBuff+resources->recvMem->connFifo[buffSlot].offset;
+          } else if (ringRegUsed(args)) {
+            buff = ringRegSlice(args, sub, stepSize, sub->transmitted, 1, NULL);
           }
           if (ready) {
             // Data is ready, try to send.
             NCCLCHECK(proxyState->ncclNet->isend(resources->netSendComm, buff, size, resources->tpRank, sub->mhandle, sub->requests+buffSlot));
             if (sub->requests[buffSlot] != NULL) {
+              ncclStatsAddNet(proxyState->stats.netSendBytes, resources->netDev, size);
               TRACE(NCCL_NET, "sendProxy [%ld/%d] Isend posted, req %p, size %d, proto %d, myRank %d, channelId %d", sub->transmitted, buffSlot, sub->requests[buffSlot], size, p, proxyState->tpRank, sub->channelId);
               sub->transmitted += args->sliceSteps;
-              for (uint64_t step=sub->transmitted-args->sliceSteps; step<sub->transmitted; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileSendWait);
+              for (uint64_t step=sub->transmitted-args->sliceSteps; step<sub->transmitted; step++) ncclProfilingRecord(proxyState, args, s, step, ncclProxyProfileSendWait);
               args->idle = 0;
               continue;
             }
@@ -1130,11 +1518,10 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
         }
       }
       // Check whether the network has completed some send operations.
-      if (sub->done < sub->transmitted) {
-        int done;
-        int size;
-        int buffSlot = (sub->base+sub->done)%NCCL_STEPS;
-        NCCLCHECK(proxyState->ncclNet->test(sub->requests[buffSlot], &done, &size));
+      if (tests.index[s] >= 0) {
+        int done = tests.done[tests.index[s]];
+        int size = testSizes[s];
+        int buffSlot = (sub->base+sub->done)%nSteps;
         if (done) {
           if (sub->reg) {
             if (size < sub->nbytes) {
@@ -1144,15 +1531,17 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
               sub->nsteps++;
             } else {
               // Signal the GPU the send is complete and it can return.
-              connFifo[sub->base%NCCL_STEPS].size = -1;
+              connFifo[sub->base%nSteps].size = -1;
             }
           }
           // Make sure size is reset to -1 before we update the head.
           if (sub->reg == 0) connFifo[buffSlot].size = -1;
           __sync_synchronize();
+          if (pool) sharedChunkPut(proxyState, pool, connFifo[buffSlot].offset);
           TRACE(NCCL_NET, "sendProxy [%ld/%d] request %p done", sub->done, buffSlot, sub->requests[buffSlot]);
+          ncclProfilingNetComplete(proxyState, args, s, sub->done, size);
           sub->done += args->sliceSteps;
-          for (uint64_t step=sub->done-args->sliceSteps; step<sub->done; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileEnd);
+          for (uint64_t step=sub->done-args->sliceSteps; step<sub->done; step++) ncclProfilingRecord(proxyState, args, s, step, ncclProxyProfileEnd);
 
           if (resources->shared == 0) {
             volatile uint64_t* sendHead = resources->gdcSync ? resources->gdcSync : &resources->sendMem->head;
@@ -1166,9 +1555,10 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
           }
           args->idle = 0;
           if (sub->done == sub->nsteps) {
-            if (sub->reg && sub->nbytes > 0) {
+            if ((sub->reg && sub->nbytes > 0) || ringRegUsed(args)) {
               NCCLCHECK(proxyState->ncclNet->deregMr(resources->netSendComm, sub->mhandle));
             }
+            if (pool) pool->nActiveSubs--;
             args->done++;
           }
         }
@@ -1215,11 +1605,17 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
       // Set step base for next op
       resources->step = sub->base + sub->nsteps;
       sub->posted = sub->received = sub->transmitted = sub->done = 0;
+      if (args->protocol == NCCL_PROTO_SIMPLE && resources->shared && !sub->reg && sub->nsteps > 0) {
+        struct ncclProxySharedP2p* pool = sharedPool(proxyState, resources->tpLocalRank, 1);
+        if (pool->freeChunks) pool->nActiveSubs++;
+      }
       for (int i=0; i<groupSize; i++) sub[-i].groupSize = groupSize;
-      for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileBegin);
+      for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(proxyState, args, s, step, ncclProxyProfileBegin);
       if (sub->reg && sub->nbytes > 0) {
         // Register buffer
-        NCCLCHECK(proxyState->ncclNet->regMr(resources->netRecvComm, sub->recvbuff, sub->nbytes, NCCL_PTR_CUDA, &sub->mhandle));
+        NCCLCHECK(proxyState->ncclNet->regMr(resources->netRecvComm, sub->recvbuff, sub->nbytes, sub->regHost ? NCCL_PTR_HOST : NCCL_PTR_CUDA, &sub->mhandle));
+      } else if (ringRegUsed(args)) {
+        NCCLCHECK(proxyState->ncclNet->regMr(resources->netRecvComm, sub->recvbuff, ringRegSize(args), NCCL_PTR_CUDA, &sub->mhandle));
       } else {
         sub->mhandle = resources->mhandles[args->protocol];
       }
@@ -1237,26 +1633,41 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
       int sizes[NCCL_PROXY_MAX_SUBS];
       int tags[NCCL_PROXY_MAX_SUBS];
       void* mhandles[NCCL_PROXY_MAX_SUBS];
+      // Chunks taken from dynamic shared pools, given back if the receive isn't posted
+      struct ncclProxySharedP2p* chunkPools[NCCL_PROXY_MAX_SUBS];
+      int chunkOffsets[NCCL_PROXY_MAX_SUBS];
+      int nChunks = 0;
       for (int i=0; i<subGroup->groupSize; i++) {
         struct ncclProxySubArgs* sub = subGroup + i;
         if (sub->posted < sub->nsteps) {
-          if (sub->posted >= sub->done + maxDepth) { subCount = 0; break; }
           struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
+          int nSteps = resources->nSteps[p];
+          struct ncclProxySharedP2p* pool = p == NCCL_PROTO_SIMPLE && resources->shared && !sub->reg ? sharedPool(proxyState, resources->tpLocalRank, 1) : NULL;
+          if (pool && pool->freeChunks == NULL) pool = NULL;
+          int depth = pool ? std::min<int64_t>(NCCL_STEPS, ncclParamNetSharedCredits()) : maxDepth;
+          if (sub->posted >= sub->done + (nSteps > NCCL_STEPS && !sub->reg ? nSteps : depth) ||
+              (pool && !sharedChunkAvailable(pool, sub->posted > sub->done))) { subCount = 0; break; }
           if (sub->reg) maxDepth = 1;
-          int stepSize = resources->buffSizes[p] / NCCL_STEPS;
+          int stepSize = resources->buffSizes[p] / nSteps;
           char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
-          int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
+          int buffSlot = (sub->base+sub->posted)%nSteps;
           volatile struct ncclConnFifo* connFifo = (volatile struct ncclConnFifo*)resources->recvMem->connFifo;
           if (p == NCCL_PROTO_SIMPLE && resources->shared) {
             if (sub->reg) {
               // Wait until CUDA kernel has started before we access the user buffer directly.
-              if (connFifo[sub->base%NCCL_STEPS].size == -1) continue;
+              if (connFifo[sub->base%nSteps].size == -1) continue;
               ptrs[subCount] = sub->recvbuff;
               sizes[subCount] = std::min(MAX_NET_SIZE, sub->nbytes);
             } else {
               int sharedBuffSlot = sub->posted%maxDepth;
               int offset;
-              NCCLCHECK(sharedBuffersGet(proxyState, sub->channelId, sharedBuffSlot*args->nsubs+s+i, &offset, sizes+subCount));
+              if (pool) {
+                offset = sharedChunkGet(proxyState, pool);
+                chunkPools[nChunks] = pool;
+                chunkOffsets[nChunks++] = offset;
+              } else {
+                NCCLCHECK(sharedBuffersGet(proxyState, sub->channelId, sharedBuffSlot*args->nsubs+s+i, &offset, sizes+subCount));
+              }
               connFifo[buffSlot].offset = offset;
               ptrs[subCount] = localBuff+offset;
             }
@@ -1266,49 +1677,73 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
           }
           sizes[subCount] = stepSize*args->sliceSteps;
           if (sub->nbytes < sizes[subCount]) sizes[subCount] = sub->nbytes;
+          if (ringRegUsed(args)) {
+            // Wait until the CUDA kernel has started before writing into the user buffer.
+            if (sub->posted == 0 && connFifo[sub->base%nSteps].ptr != (void*)sub->recvbuff) continue;
+            ptrs[subCount] = ringRegSlice(args, sub, stepSize, sub->posted, 0, sizes+subCount);
+          }
           tags[subCount] = resources->tpRemoteRank;
           mhandles[subCount] = sub->mhandle;
           subCount++;
         }
       }
+      bool recvPosted = false;
       if (subCount) {
         uint64_t step = subGroup->posted;
         struct recvNetResources* resources = (struct recvNetResources*) (subGroup->connection->transportResources);
-        void** requestPtr = subGroup->requests+(step%NCCL_STEPS);
+        void** requestPtr = subGroup->requests+(step%NCCL_MAX_STEPS);
         NCCLCHECK(proxyState->ncclNet->irecv(resources->netRecvComm, subCount, ptrs, sizes, tags, mhandles, requestPtr));
         if (*requestPtr) {
-          subGroup->recvRequestsCache[step%NCCL_STEPS] = *requestPtr;
+          recvPosted = true;
+          subGroup->recvRequestsCache[step%NCCL_MAX_STEPS] = *requestPtr;
           subGroup->recvRequestsSubCount = subCount;
           for (int i=0; i<subGroup->groupSize; i++) {
             struct ncclProxySubArgs* sub = subGroup+i;
+            if (sub->posted == 0 && ringRegUsed(args)) {
+              // The kernel only announces itself once per operation
+              struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
+              resources->recvMem->connFifo[sub->base%resources->nSteps[p]].ptr = NULL;
+            }
             sub->posted += args->sliceSteps;
-            for (uint64_t step=sub->posted-args->sliceSteps; step<sub->posted; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvWait);
+            for (uint64_t step=sub->posted-args->sliceSteps; step<sub->posted; step++) ncclProfilingRecord(proxyState, args, s+i, step, ncclProxyProfileRecvWait);
           }
           args->idle = 0;
         }
       }
+      if (!recvPosted) {
+        for (int c=0; c<nChunks; c++) sharedChunkPut(proxyState, chunkPools[c], chunkOffsets[c]);
+      }
     }
     if (args->idle == 0) return ncclSuccess;
 
+    // Groups are contiguous, so the sizes of each group's receives go at its first sub
+    struct netTestBatch tests;
+    int testSizes[NCCL_PROXY_MAX_SUBS];
+    netTestBatchInit(&tests);
+    for (int i=0; i<NCCL_PROXY_MAX_SUBS; i++) testSizes[i] = 0;
+    for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
+      struct ncclProxySubArgs* subGroup = args->subs+s;
+      if (subGroup->posted > subGroup->received) netTestBatchAdd(&tests, s, subGroup->requests[subGroup->received%NCCL_MAX_STEPS], testSizes+s);
+    }
+    NCCLCHECK(netTestBatchRun(proxyState, &tests));
     for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
       struct ncclProxySubArgs* subGroup = args->subs+s;
-      if (subGroup->posted > subGroup->received) {
+      if (tests.index[s] >= 0) {
         uint64_t step = subGroup->received;
-        int done;
+        int done = tests.done[tests.index[s]];
         void* ptrs[NCCL_PROXY_MAX_SUBS];
-        int sizes[NCCL_PROXY_MAX_SUBS];
+        int* sizes = testSizes+s;
         void* mhandles[NCCL_PROXY_MAX_SUBS];
-        for (int i=0; i<NCCL_PROXY_MAX_SUBS; i++) sizes[i] = 0;
-        NCCLCHECK(proxyState->ncclNet->test(subGroup->requests[step%NCCL_STEPS], &done, sizes));
         if (done) {
           int needFlush = 0;
           int totalSize = 0;
           int subIndex = 0;
-          for (int i=0; i<NCCL_PROXY_MAX_SUBS; i++) totalSize += sizes[i];
+          for (int i=0; i<subGroup->groupSize; i++) totalSize += sizes[i];
           for (int i=0; i<subGroup->groupSize; i++) {
             struct ncclProxySubArgs* sub = subGroup + i;
             if (sub->received < sub->nsteps) {
               int size = sizes[subIndex++];
+              ncclStatsAddNet(proxyState->stats.netRecvBytes, ((struct recvNetResources*)sub->connection->transportResources)->netDev, size);
               if (sub->reg) {
                 if (size < sub->nbytes) {
                   sub->recvbuff += size;
@@ -1320,18 +1755,20 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
                   // There is a __sync_synchronize() later to ensure it is reset before it is set again by the GPU.
                   struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
                   volatile struct ncclConnFifo* connFifo = (volatile struct ncclConnFifo*)resources->recvMem->connFifo;
-                  connFifo[sub->base%NCCL_STEPS].size = -1;
+                  connFifo[sub->base%resources->nSteps[p]].size = -1;
                 }
               }
+              ncclProfilingNetComplete(proxyState, args, s+i, sub->received, size);
             }
             sub->received += args->sliceSteps;
-            for (uint64_t step=sub->received-args->sliceSteps; step<sub->received; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvFlushWait);
+            for (uint64_t step=sub->received-args->sliceSteps; step<sub->received; step++) ncclProfilingRecord(proxyState, args, s+i, step, ncclProxyProfileRecvFlushWait);
             if (step < sub->nsteps) {
               struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
-              if (resources->useGdr) needFlush |= resources->needFlush;
+              // Data received straight into host memory needs no GDR flush
+              if (resources->useGdr && !sub->regHost) needFlush |= resources->needFlush;
             }
           }
-          subGroup->requests[step%NCCL_STEPS] = NULL;
+          subGroup->requests[step%NCCL_MAX_STEPS] = NULL;
           if (totalSize > 0 && p == NCCL_PROTO_SIMPLE && needFlush) {
             // GDRCOPY support
             struct recvNetResources* resources = (struct recvNetResources*) (subGroup->connection->transportResources);
@@ -1342,6 +1779,11 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
 #else
               WARN("NET: GDR Flush only supported on x86_64");
               return ncclInternalError;
+#endif
+            } else if (resources->driverFlush) {
+#if CUDART_VERSION >= 11030
+              // Synchronous, so there is no flush request to wait for
+              CUCHECK(cuFlushGPUDirectRDMAWrites(CU_FLUSH_GPU_DIRECT_RDMA_WRITES_TARGET_CURRENT_CTX, CU_FLUSH_GPU_DIRECT_RDMA_WRITES_TO_OWNER));
 #endif
             } else {
               int subCount = 0;
@@ -1349,18 +1791,19 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
                 struct ncclProxySubArgs* sub = subGroup + i;
                 if (step < sub->nsteps) {
                   struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
-                  int stepSize = resources->buffSizes[p] / NCCL_STEPS;
+                  int stepSize = resources->buffSizes[p] / resources->nSteps[p];
                   char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
-                  int buffSlot = (sub->base+sub->received-args->sliceSteps)%NCCL_STEPS;
+                  int buffSlot = (sub->base+sub->received-args->sliceSteps)%resources->nSteps[p];
                   ptrs[subCount] = resources->shared ?
                     (sub->reg ? (char*)sub->recvbuff : localBuff+resources->recvMem->connFifo[buffSlot].offset) :
+                    ringRegUsed(args) ? ringRegSlice(args, sub, stepSize, sub->received-args->sliceSteps, 0, NULL) :
                     localBuff+buffSlot*stepSize;
                   mhandles[subCount] = sub->mhandle;
                   subCount++;
                 }
               }
               struct recvNetResources* resources = (struct recvNetResources*) (subGroup->connection->transportResources);
-              NCCLCHECK(proxyState->ncclNet->iflush(resources->netRecvComm, subCount, ptrs, sizes, mhandles, subGroup->requests+(step%NCCL_STEPS)));
+              NCCLCHECK(proxyState->ncclNet->iflush(resources->netRecvComm, subCount, ptrs, sizes, mhandles, subGroup->requests+(step%NCCL_MAX_STEPS)));
             }
           }
           args->idle = 0;
@@ -1369,19 +1812,24 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
     }
     if (args->idle == 0) return ncclSuccess;
 
+    netTestBatchInit(&tests);
+    for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
+      struct ncclProxySubArgs* subGroup = args->subs+s;
+      void* request = subGroup->requests[subGroup->transmitted%NCCL_MAX_STEPS];
+      if (subGroup->received > subGroup->transmitted && request) netTestBatchAdd(&tests, s, request, NULL);
+    }
+    NCCLCHECK(netTestBatchRun(proxyState, &tests));
     for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
       struct ncclProxySubArgs* subGroup = args->subs+s;
       if (subGroup->received > subGroup->transmitted) {
         uint64_t step = subGroup->transmitted;
-        int done = 1;
-        void* request = subGroup->requests[step%NCCL_STEPS];
-        if (request) NCCLCHECK(proxyState->ncclNet->test(request, &done, NULL));
+        int done = tests.index[s] >= 0 ? tests.done[tests.index[s]] : 1;
         if (done) {
           for (int i=0; i<subGroup->groupSize; i++) {
             struct ncclProxySubArgs* sub = subGroup + i;
 
             sub->transmitted += args->sliceSteps;
-            for (uint64_t step=sub->transmitted-args->sliceSteps; step<sub->transmitted; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvGPUWait);
+            for (uint64_t step=sub->transmitted-args->sliceSteps; step<sub->transmitted; step++) ncclProfilingRecord(proxyState, args, s+i, step, ncclProxyProfileRecvGPUWait);
             if (step < sub->nsteps) {
               __sync_synchronize();
               struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
@@ -1407,25 +1855,29 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
         if (sub->done == sub->nsteps) continue;
         if (sub->transmitted > sub->done) {
           struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
+          struct ncclProxySharedP2p* pool = p == NCCL_PROTO_SIMPLE && resources->shared && !sub->reg ? sharedPool(proxyState, resources->tpLocalRank, 1) : NULL;
+          if (pool && pool->freeChunks == NULL) pool = NULL;
           volatile uint64_t* sendHead = &resources->sendMem->head;
           uint64_t done = sub->reg ? sub->base + sub->nsteps : *sendHead;
           while (done > sub->base + sub->done &&
               // LL and LL128 can acknowledge 0-bytes send before they even happen. Don't go past what we transmitted.
               sub->transmitted > sub->done) {
-            if (subGroup->recvRequestsCache[sub->done%NCCL_STEPS]) {
+            if (subGroup->recvRequestsCache[sub->done%NCCL_MAX_STEPS]) {
               // the multirecv requests are only cached in the first sub.
               if (proxyState->ncclNet->irecvConsumed)
-                NCCLCHECK(proxyState->ncclNet->irecvConsumed(resources->netRecvComm, subGroup->recvRequestsSubCount, subGroup->recvRequestsCache[sub->done%NCCL_STEPS]));
-              subGroup->recvRequestsCache[sub->done%NCCL_STEPS] = NULL;
+                NCCLCHECK(proxyState->ncclNet->irecvConsumed(resources->netRecvComm, subGroup->recvRequestsSubCount, subGroup->recvRequestsCache[sub->done%NCCL_MAX_STEPS]));
+              subGroup->recvRequestsCache[sub->done%NCCL_MAX_STEPS] = NULL;
             }
+            if (pool) sharedChunkPut(proxyState, pool, resources->recvMem->connFifo[(sub->base+sub->done)%resources->nSteps[p]].offset);
             sub->done += args->sliceSteps;
-            for (uint64_t step=sub->done-args->sliceSteps; step<sub->done; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileEnd);
+            for (uint64_t step=sub->done-args->sliceSteps; step<sub->done; step++) ncclProfilingRecord(proxyState, args, s+i, step, ncclProxyProfileEnd);
             args->idle = 0;
             if (sub->done == sub->nsteps) {
               struct recvNetResources* resources = (struct recvNetResources*) (sub->connection->transportResources);
-              if (sub->reg && sub->nbytes > 0) {
+              if ((sub->reg && sub->nbytes > 0) || ringRegUsed(args)) {
                 NCCLCHECK(proxyState->ncclNet->deregMr(resources->netRecvComm, sub->mhandle));
               }
+              if (pool) pool->nActiveSubs--;
               args->done++;
               break;
             }
@@ -1443,6 +1895,6 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
 struct ncclTransport netTransport = {
   "NET",
   canConnect,
-  { sendSetup, sendConnect, sendFree, proxySharedInit, sendProxySetup, sendProxyConnect, sendProxyFree, sendProxyProgress, NULL },
-  { recvSetup, recvConnect, recvFree, proxySharedInit, recvProxySetup, recvProxyConnect, recvProxyFree, recvProxyProgress, NULL }
+  { sendSetup, sendConnect, sendFree, proxySharedInit, sendProxySetup, sendProxyConnect, sendProxyFree, sendProxyProgress, NULL, NULL, sendSetupDone },
+  { recvSetup, recvConnect, recvFree, proxySharedInit, recvProxySetup, recvProxyConnect, recvProxyFree, recvProxyProgress, NULL, NULL, recvSetupDone }
 };
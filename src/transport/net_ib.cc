@@ -18,7 +18,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #define ENABLE_TIMER 0
 #include "timer.h"
@@ -66,9 +69,19 @@ struct alignas(64) ncclIbDev {
   char* pciPath;
   int realPort;
   int maxQp;
+  int maxSrqWr;
+  // Receive queue shared by the recv comms of the process (NCCL_IB_SRQ)
+  int srqRefs;
+  struct ibv_srq* srq;
   struct ncclIbMrCache mrCache;
+  // Implicit on-demand paging MR over the whole address space (NCCL_IB_ODP=2)
+  struct ibv_mr* odpMr;
+  int odpUnsupported;
   int ar; // ADAPTIVE_ROUTING
   struct ibv_port_attr portAttr;
+  // Completion events, only used when the proxy may sleep (NCCL_PROXY_SLEEP_IDLE)
+  struct ibv_comp_channel* compChannel;
+  struct ncclIbNetCommDevBase* eventBases;
 };
 
 #define MAX_IB_DEVS 32
@@ -311,6 +324,7 @@ static ncclResult_t ncclIbGetGidIndex(struct ibv_context *context, uint8_t portN
 NCCL_PARAM(IbDisable, "IB_DISABLE", 0);
 NCCL_PARAM(IbMergeVfs, "IB_MERGE_VFS", 1);
 NCCL_PARAM(IbMergeNics, "IB_MERGE_NICS", 1);
+NCCL_PARAM(IbDevCache, "IB_DEV_CACHE", 0);
 
 static ncclResult_t ncclIbGetPciPath(char* devName, char** path, int* realPort) {
   char devicePath[PATH_MAX];
@@ -386,6 +400,133 @@ int ncclIbFindMatchingDev(int dev) {
   return ncclNMergedIbDevs;
 }
 
+// Test kernel DMA-BUF support with a dummy call (fd=-1).
+// Returns 1 if supported, 0 if not, -1 if the test itself failed.
+static int ncclIbDmaBufTest(struct ibv_context* ctx) {
+  struct ibv_pd* pd;
+  if (ncclSuccess != wrap_ibv_alloc_pd(&pd, ctx)) return -1;
+  (void) wrap_direct_ibv_reg_dmabuf_mr(pd, 0ULL/*offset*/, 0ULL/*len*/, 0ULL/*iova*/, -1/*fd*/, 0/*flags*/);
+  // ibv_reg_dmabuf_mr() will fail with EOPNOTSUPP/EPROTONOSUPPORT if not supported (EBADF otherwise)
+  int supported = (errno != EOPNOTSUPP && errno != EPROTONOSUPPORT) ? 1 : 0;
+  if (ncclSuccess != wrap_ibv_dealloc_pd(pd)) return -1;
+  return supported;
+}
+
+// Node-wide cache of device and port attributes (NCCL_IB_DEV_CACHE=<seconds>).
+// The first process to initialize opens and queries every device and stores the
+// attributes in /dev/shm, under flock. Processes initializing within that many
+// seconds, and seeing the same device list, take the attributes from there; all
+// of them then open a device only when they first listen or connect on it.
+#define NCCL_IB_DEV_CACHE_VERSION 1
+#define NCCL_IB_DEV_CACHE_MAX_PORTS 8
+
+struct ncclIbDevCacheEntry {
+  char name[MAXNAMESIZE];
+  int valid; // Opened and queried
+  int nPorts;
+  uint64_t guid;
+  int maxQp;
+  int maxSrqWr;
+  int portValid[NCCL_IB_DEV_CACHE_MAX_PORTS];
+  struct ibv_port_attr portAttr[NCCL_IB_DEV_CACHE_MAX_PORTS];
+};
+
+struct ncclIbDevCache {
+  int version;
+  int nDevs;
+  int64_t time;
+  int dmaBufSupported; // -1 unknown
+  struct ncclIbDevCacheEntry devs[MAX_IB_DEVS];
+};
+
+// Device list kept for lazy opens, and DMA-BUF support as found in the cache
+static struct ibv_device** ncclIbDeviceList = NULL;
+static int ncclIbCacheDmaBufSupported = -1;
+
+static ncclResult_t ncclIbDevCacheQuery(struct ibv_device* device, struct ncclIbDevCache* cache, struct ncclIbDevCacheEntry* entry) {
+  struct ibv_context* context;
+  struct ibv_device_attr devAttr;
+  memset(entry, 0, sizeof(*entry));
+  strncpy(entry->name, device->name, MAXNAMESIZE-1);
+  if (ncclSuccess != wrap_ibv_open_device(&context, device) || context == NULL) return ncclSuccess;
+  memset(&devAttr, 0, sizeof(devAttr));
+  if (ncclSuccess == wrap_ibv_query_device(context, &devAttr)) {
+    entry->valid = 1;
+    entry->guid = devAttr.sys_image_guid;
+    entry->maxQp = devAttr.max_qp;
+    entry->maxSrqWr = devAttr.max_srq_wr;
+    entry->nPorts = std::min<int>(devAttr.phys_port_cnt, NCCL_IB_DEV_CACHE_MAX_PORTS);
+    for (int p = 0; p < entry->nPorts; p++) {
+      entry->portValid[p] = ncclSuccess == wrap_ibv_query_port(context, p+1, entry->portAttr+p);
+    }
+    if (cache->dmaBufSupported == -1) cache->dmaBufSupported = ncclIbDmaBufTest(context);
+  }
+  NCCLCHECK(wrap_ibv_close_device(context));
+  return ncclSuccess;
+}
+
+// Fill cache from the node cache, refreshing it if stale. *valid is false when
+// the cache can't be used, attributes must then be queried from the devices.
+static ncclResult_t ncclIbDevCacheLoad(struct ibv_device** devices, int nIbDevs, struct ncclIbDevCache* cache, bool* valid) {
+  char path[64];
+  int fd = -1;
+  int64_t now = time(NULL);
+  ncclResult_t ret = ncclSuccess;
+  bool fresh;
+
+  *valid = false;
+  if (nIbDevs > MAX_IB_DEVS) return ncclSuccess;
+  snprintf(path, sizeof(path), "/dev/shm/nccl-ibdevs-%d", (int)getuid());
+  SYSCHECKGOTO(fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR), ret, exit);
+  SYSCHECKGOTO(flock(fd, LOCK_EX), ret, exit);
+  memset(cache, 0, sizeof(*cache));
+  // A new cache reads short, as version 0
+  SYSCHECKGOTO(pread(fd, cache, sizeof(*cache), 0), ret, unlock);
+  fresh = cache->version == NCCL_IB_DEV_CACHE_VERSION && cache->nDevs == nIbDevs && now - cache->time < ncclParamIbDevCache();
+  for (int d = 0; fresh && d < nIbDevs; d++) fresh = strncmp(cache->devs[d].name, devices[d]->name, MAXNAMESIZE-1) == 0;
+  if (!fresh) {
+    memset(cache, 0, sizeof(*cache));
+    cache->dmaBufSupported = -1;
+    for (int d = 0; d < nIbDevs; d++) NCCLCHECKGOTO(ncclIbDevCacheQuery(devices[d], cache, cache->devs+d), ret, unlock);
+    cache->version = NCCL_IB_DEV_CACHE_VERSION;
+    cache->nDevs = nIbDevs;
+    cache->time = now;
+    SYSCHECKGOTO(pwrite(fd, cache, sizeof(*cache), 0), ret, unlock);
+  }
+  INFO(NCCL_INIT|NCCL_NET, "NET/IB : %s device cache %s", fresh ? "Using" : "Populated", path);
+  *valid = true;
+unlock:
+  flock(fd, LOCK_UN);
+exit:
+  if (fd != -1) close(fd);
+  return ret;
+}
+
+// Open the device context and start its async event thread, on first use when
+// the attributes came from the node cache
+static ncclResult_t ncclIbDevOpen(int ibDevN) {
+  struct ncclIbDev* ibDev = ncclIbDevs + ibDevN;
+  ncclResult_t res = ncclSuccess;
+  pthread_mutex_lock(&ibDev->lock);
+  if (ibDev->context == NULL) {
+    struct ibv_context* context = NULL;
+    pthread_t thread;
+    if (ncclSuccess != wrap_ibv_open_device(&context, ncclIbDeviceList[ibDev->device]) || context == NULL) {
+      WARN("NET/IB : Unable to open device %s", ibDev->devName);
+      res = ncclSystemError;
+      goto exit;
+    }
+    ibDev->context = context;
+    pthread_create(&thread, NULL, ncclIbAsyncThreadMain, ibDev);
+    ncclSetThreadName(thread, "NCCL IbAsync %2d", ibDevN);
+    pthread_detach(thread); // will not be pthread_join()'d
+    TRACE(NCCL_NET, "NET/IB: [%d] %s:%d opened on first use, context=%p", ibDevN, ibDev->devName, ibDev->portNum, context);
+  }
+exit:
+  pthread_mutex_unlock(&ibDev->lock);
+  return res;
+}
+
 ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
   ncclResult_t ret;
   if (ncclParamIbDisable()) return ncclInternalError;
@@ -420,23 +561,46 @@ ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
 
       if (ncclSuccess != wrap_ibv_get_device_list(&devices, &nIbDevs)) { ret = ncclInternalError; goto fail; }
 
+      // With the node cache, devices are opened lazily and the list is kept for that
+      struct ncclIbDevCache* devCache = NULL;
+      bool lazy = false;
+      if (ncclParamIbDevCache() > 0) {
+        NCCLCHECKGOTO(ncclCalloc(&devCache, 1), ret, fail);
+        if (ncclIbDevCacheLoad(devices, nIbDevs, devCache, &lazy) != ncclSuccess) lazy = false;
+        if (lazy) ncclIbCacheDmaBufSupported = devCache->dmaBufSupported;
+      }
+
       for (int d=0; d<nIbDevs && ncclNIbDevs<MAX_IB_DEVS; d++) {
-        struct ibv_context * context;
-        if (ncclSuccess != wrap_ibv_open_device(&context, devices[d]) || context == NULL) {
-          WARN("NET/IB : Unable to open device %s", devices[d]->name);
-          continue;
-        }
+        struct ibv_context * context = NULL;
         int nPorts = 0;
         struct ibv_device_attr devAttr;
         memset(&devAttr, 0, sizeof(devAttr));
-        if (ncclSuccess != wrap_ibv_query_device(context, &devAttr)) {
-          WARN("NET/IB : Unable to query device %s", devices[d]->name);
-          if (ncclSuccess != wrap_ibv_close_device(context)) { ret = ncclInternalError; goto fail; }
-          continue;
+        if (lazy) {
+          struct ncclIbDevCacheEntry* entry = devCache->devs+d;
+          if (!entry->valid) {
+            WARN("NET/IB : Unable to open device %s", devices[d]->name);
+            continue;
+          }
+          devAttr.sys_image_guid = entry->guid;
+          devAttr.max_qp = entry->maxQp;
+          devAttr.max_srq_wr = entry->maxSrqWr;
+          devAttr.phys_port_cnt = entry->nPorts;
+        } else {
+          if (ncclSuccess != wrap_ibv_open_device(&context, devices[d]) || context == NULL) {
+            WARN("NET/IB : Unable to open device %s", devices[d]->name);
+            continue;
+          }
+          if (ncclSuccess != wrap_ibv_query_device(context, &devAttr)) {
+            WARN("NET/IB : Unable to query device %s", devices[d]->name);
+            if (ncclSuccess != wrap_ibv_close_device(context)) { ret = ncclInternalError; goto fail; }
+            continue;
+          }
         }
         for (int port_num = 1; port_num <= devAttr.phys_port_cnt; port_num++) {
           struct ibv_port_attr portAttr;
-          if (ncclSuccess != wrap_ibv_query_port(context, port_num, &portAttr)) {
+          if (lazy && devCache->devs[d].portValid[port_num-1]) {
+            portAttr = devCache->devs[d].portAttr[port_num-1];
+          } else if (lazy || ncclSuccess != wrap_ibv_query_port(context, port_num, &portAttr)) {
             WARN("NET/IB : Unable to query port_num %d", port_num);
             continue;
           }
@@ -461,6 +625,11 @@ ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
           strncpy(ncclIbDevs[ncclNIbDevs].devName, devices[d]->name, MAXNAMESIZE);
           NCCLCHECK(ncclIbGetPciPath(ncclIbDevs[ncclNIbDevs].devName, &ncclIbDevs[ncclNIbDevs].pciPath, &ncclIbDevs[ncclNIbDevs].realPort));
           ncclIbDevs[ncclNIbDevs].maxQp = devAttr.max_qp;
+          ncclIbDevs[ncclNIbDevs].maxSrqWr = devAttr.max_srq_wr;
+          ncclIbDevs[ncclNIbDevs].srqRefs = 0;
+          ncclIbDevs[ncclNIbDevs].srq = NULL;
+          ncclIbDevs[ncclNIbDevs].odpMr = NULL;
+          ncclIbDevs[ncclNIbDevs].odpUnsupported = 0;
           ncclIbDevs[ncclNIbDevs].mrCache.capacity = 0;
           ncclIbDevs[ncclNIbDevs].mrCache.population = 0;
           ncclIbDevs[ncclNIbDevs].mrCache.slots = NULL;
@@ -473,9 +642,11 @@ ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
           TRACE(NCCL_NET,"NET/IB: [%d] %s:%s:%d/%s speed=%d context=%p pciPath=%s ar=%d", d, devices[d]->name, devices[d]->dev_name, ncclIbDevs[ncclNIbDevs].portNum,
               portAttr.link_layer == IBV_LINK_LAYER_INFINIBAND ? "IB" : "RoCE", ncclIbDevs[ncclNIbDevs].speed, context, ncclIbDevs[ncclNIbDevs].pciPath, ncclIbDevs[ncclNIbDevs].ar);
 
-          pthread_create(&ncclIbAsyncThread, NULL, ncclIbAsyncThreadMain, ncclIbDevs + ncclNIbDevs);
-          ncclSetThreadName(ncclIbAsyncThread, "NCCL IbAsync %2d", ncclNIbDevs);
-          pthread_detach(ncclIbAsyncThread); // will not be pthread_join()'d
+          if (!lazy) {
+            pthread_create(&ncclIbAsyncThread, NULL, ncclIbAsyncThreadMain, ncclIbDevs + ncclNIbDevs);
+            ncclSetThreadName(ncclIbAsyncThread, "NCCL IbAsync %2d", ncclNIbDevs);
+            pthread_detach(ncclIbAsyncThread); // will not be pthread_join()'d
+          }
 
           int mergedDev = ncclNMergedIbDevs;
           if (ncclParamIbMergeNics()) {
@@ -503,9 +674,12 @@ ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
           ncclNIbDevs++;
           nPorts++;
         }
-        if (nPorts == 0 && ncclSuccess != wrap_ibv_close_device(context)) { ret = ncclInternalError; goto fail; }
+        if (nPorts == 0 && context && ncclSuccess != wrap_ibv_close_device(context)) { ret = ncclInternalError; goto fail; }
       }
-      if (nIbDevs && (ncclSuccess != wrap_ibv_free_device_list(devices))) { ret = ncclInternalError; goto fail; };
+      free(devCache);
+      if (lazy) {
+        ncclIbDeviceList = devices;
+      } else if (nIbDevs && (ncclSuccess != wrap_ibv_free_device_list(devices))) { ret = ncclInternalError; goto fail; };
     }
     if (ncclNIbDevs == 0) {
       INFO(NCCL_INIT|NCCL_NET, "NET/IB : No device found.");
@@ -573,22 +747,19 @@ ncclResult_t ncclIbGdrSupport() {
 // ncclSystemError : DMA-BUF is not supported by the kernel
 ncclResult_t ncclIbDmaBufSupport(int dev) {
   static int dmaBufSupported = -1;
+  if (dmaBufSupported == -1 && ncclIbCacheDmaBufSupported != -1) {
+    // Found by the process which populated the node cache, don't open devices for it
+    dmaBufSupported = ncclIbCacheDmaBufSupported;
+  }
   if (dmaBufSupported == -1) {
-    ncclResult_t res;
-    struct ibv_pd* pd;
-    struct ibv_context* ctx;
     struct ncclIbMergedDev* mergedDev = ncclIbMergedDevs + dev;
 
     // Test each dev
     for (int i = 0; i < mergedDev->ndevs; i++) {
       int ibDev = mergedDev->devs[i];
-      ctx = ncclIbDevs[ibDev].context;
-      NCCLCHECKGOTO(wrap_ibv_alloc_pd(&pd, ctx), res, failure);
-      // Test kernel DMA-BUF support with a dummy call (fd=-1)
-      (void) wrap_direct_ibv_reg_dmabuf_mr(pd, 0ULL/*offset*/, 0ULL/*len*/, 0ULL/*iova*/, -1/*fd*/, 0/*flags*/);
-      // ibv_reg_dmabuf_mr() will fail with EOPNOTSUPP/EPROTONOSUPPORT if not supported (EBADF otherwise)
-      dmaBufSupported = (errno != EOPNOTSUPP && errno != EPROTONOSUPPORT) ? 1 : 0;
-      NCCLCHECKGOTO(wrap_ibv_dealloc_pd(pd), res, failure);
+      if (ncclIbDevOpen(ibDev) != ncclSuccess) goto failure;
+      dmaBufSupported = ncclIbDmaBufTest(ncclIbDevs[ibDev].context);
+      if (dmaBufSupported == -1) goto failure;
     }
   }
   if (dmaBufSupported == 0) return ncclSystemError;
@@ -685,10 +856,27 @@ struct ncclIbCommStage {
   void* comm;
 };
 
+// Address of a QP created ahead of the connection (NCCL_IB_OOB_CONNECT). Travels in the
+// listen handle from the receiver and in the NET connect info from the sender.
+struct ncclIbOobInfo {
+  uint32_t qpn;
+  uint32_t lid;
+  uint8_t ib_port;
+  uint8_t mtu;
+  uint8_t link_layer;
+  uint8_t valid;
+  uint32_t fifoRkey;
+  uint64_t fifoAddr;
+  uint64_t spn;
+  uint64_t iid;
+};
+static_assert(sizeof(struct ncclIbOobInfo) <= NCCL_NET_OOB_INFO_SIZE, "ncclIbOobInfo size too large");
+
 struct ncclIbHandle {
   union ncclSocketAddress connectAddr; // Filled by the target
   uint64_t magic; // random number to help debugging
   struct ncclIbCommStage stage; // Used by the other side when connecting
+  struct ncclIbOobInfo oob; // Filled by the target when it prepared its QP
 };
 
 // Retain local RoCE address for error logging
@@ -717,9 +905,11 @@ struct ncclIbRequest {
       void* data;
       uint32_t lkeys[NCCL_IB_MAX_DEVS_PER_NIC];
       int offset;
+      uint64_t postTime; // NCCL_IB_PACING
     } send;
     struct {
       int* sizes;
+      int signalSize; // iwaitSignal
     } recv;
   };
 };
@@ -728,7 +918,8 @@ struct ncclIbNetCommDevBase {
   int ibDevN;
   struct ibv_pd* pd;
   struct ibv_cq* cq;
-  uint64_t pad[2];
+  struct ncclIbNetCommDevBase* nextEventBase;
+  uint64_t pollEpoch; // Last ncclIbTestAll call which polled cq
   struct ncclIbGidInfo gidInfo;
 };
 
@@ -736,6 +927,7 @@ struct ncclIbListenComm {
   int dev;
   struct ncclSocket sock;
   struct ncclIbCommStage stage;
+  struct ncclIbRecvComm* oobComm; // Prepared at listen time, until ncclIbOobAccept takes it
 };
 
 struct ncclIbSendFifo {
@@ -791,6 +983,26 @@ struct alignas(32) ncclIbNetCommBase {
   struct ncclIbDevInfo remDevs[NCCL_IB_MAX_DEVS_PER_NIC];
 };
 
+// Throughput estimate of a QP, from the completion time of its writes. RC completions
+// come back in order, so posts are tracked in a FIFO.
+#define NCCL_IB_QP_STATS_DEPTH 32
+struct ncclIbQpStats {
+  uint64_t postTime[NCCL_IB_QP_STATS_DEPTH];
+  int bytes[NCCL_IB_QP_STATS_DEPTH];
+  uint64_t posted, completed;
+  uint64_t lastCompletion;
+  float bw; // bytes per ns
+};
+
+// Window of bytes in flight to the peer, see NCCL_IB_PACING.
+struct ncclIbPacer {
+  int64_t window;
+  int64_t inflight;
+  float bestBw;    // bytes per ns
+  float baseDelay; // ns, smallest completion latency not explained by bandwidth
+  uint64_t lastDecrease;
+};
+
 struct ncclIbSendComm {
   struct ncclIbNetCommBase base;
   struct ncclIbSendFifo fifo[MAX_REQUESTS][NCCL_NET_IB_MAX_RECVS];
@@ -802,6 +1014,8 @@ struct ncclIbSendComm {
   struct ncclIbRemSizesFifo remSizesFifo;
   uint64_t fifoHead;
   int ar; // Use adaptive routing when all merged devices have it enabled
+  struct ncclIbQpStats* qpStats; // NCCL_IB_ADAPTIVE_SPLIT, one per QP
+  struct ncclIbPacer* pacer; // NCCL_IB_PACING
 };
 // The SendFifo needs to be 32-byte aligned and each element needs
 // to be a 32-byte multiple, so that an entry does not get split and
@@ -827,6 +1041,7 @@ struct ncclIbRemFifo {
 
 struct alignas(16) ncclIbRecvCommDev {
   struct ncclIbNetCommDevBase base;
+  struct ibv_srq* srq;
   struct ncclIbGpuFlush gpuFlush;
   uint32_t fifoRkey;
   struct ibv_mr* fifoMr;
@@ -834,17 +1049,43 @@ struct alignas(16) ncclIbRecvCommDev {
   struct ibv_mr* sizesFifoMr;
 };
 
+// With a shared receive queue, a receive WR no longer belongs to a request. Writes
+// complete in order on a QP though, so each QP keeps the requests it expects in order.
+struct ncclIbSrqPending {
+  uint8_t reqs[MAX_REQUESTS];
+  uint32_t head;
+  uint32_t tail;
+};
+
 struct ncclIbRecvComm {
   struct ncclIbNetCommBase base;
   struct ncclIbRecvCommDev    devs[NCCL_IB_MAX_DEVS_PER_NIC];
+  struct ncclIbSrqPending* srqPending; // Per QP, NCCL_IB_SRQ only
   struct ncclIbRemFifo remFifo;
   int sizesFifo[MAX_REQUESTS][NCCL_NET_IB_MAX_RECVS];
   int gpuFlushHostMem;
   int flushEnabled;
+  // FIFO slots filled but not written to the sender yet (NCCL_IB_CTS_BATCH)
+  int ctsPending;
+  int ctsLastNreqs;
+  struct ncclIbRequest* ctsLastReq;
+  int ctsUnsignaled[NCCL_IB_MAX_DEVS_PER_NIC];
 };
 static_assert((offsetof(struct ncclIbRecvComm, remFifo) % 32) == 0, "ncclIbRecvComm fifo must be 32-byte aligned");
 
 NCCL_PARAM(IbQpsPerConn, "IB_QPS_PER_CONNECTION", 1);
+NCCL_PARAM(IbSplitDataOnQps, "IB_SPLIT_DATA_ON_QPS", 0);
+// Split messages across QPs (or merged devices) in proportion to their measured throughput
+NCCL_PARAM(IbAdaptiveSplit, "IB_ADAPTIVE_SPLIT", 0);
+// Software pacing for fabrics without working congestion control. Sends wait while the
+// bytes in flight to the peer exceed a window. The window grows additively, and shrinks
+// multiplicatively (at most once per latency) when completions take NCCL_IB_PACING_DELAY us
+// longer than the base delay of the fabric, which means packets queue in the switches.
+NCCL_PARAM(IbPacing, "IB_PACING", 0);
+NCCL_PARAM(IbPacingDelay, "IB_PACING_DELAY", 20);
+NCCL_PARAM(IbPacingMinWindow, "IB_PACING_MIN_WINDOW", 256*1024);
+NCCL_PARAM(IbPacingMaxWindow, "IB_PACING_MAX_WINDOW", 32*1024*1024);
+int64_t ncclParamProxySleepIdle();
 
 static void ncclIbAddEvent(struct ncclIbRequest* req, int devIndex, struct ncclIbNetCommDevBase* base) {
   req->events[devIndex]++;
@@ -854,6 +1095,7 @@ static void ncclIbAddEvent(struct ncclIbRequest* req, int devIndex, struct ncclI
 ncclResult_t ncclIbInitCommDevBase(int ibDevN, struct ncclIbNetCommDevBase* base) {
   base->ibDevN = ibDevN;
   ncclIbDev* ibDev = ncclIbDevs + ibDevN;
+  NCCLCHECK(ncclIbDevOpen(ibDevN));
   pthread_mutex_lock(&ibDev->lock);
   if (0 == ibDev->pdRefs++) {
     ncclResult_t res;
@@ -867,18 +1109,92 @@ ncclResult_t ncclIbInitCommDevBase(int ibDevN, struct ncclIbNetCommDevBase* base
   base->pd = ibDev->pd;
   pthread_mutex_unlock(&ibDev->lock);
 
+  if (ncclParamProxySleepIdle() > 0) {
+    ncclResult_t res = ncclSuccess;
+    pthread_mutex_lock(&ibDev->lock);
+    if (ibDev->compChannel == NULL) {
+      NCCLCHECKGOTO(wrap_ibv_create_comp_channel(&ibDev->compChannel, ibDev->context), res, unlock);
+      // Events are drained without blocking, the proxy polls the fd.
+      SYSCHECKGOTO(fcntl(ibDev->compChannel->fd, F_SETFL, fcntl(ibDev->compChannel->fd, F_GETFL) | O_NONBLOCK), res, unlock);
+    }
+    NCCLCHECKGOTO(wrap_ibv_create_cq(&base->cq, ibDev->context, 2*MAX_REQUESTS*ncclParamIbQpsPerConn(), NULL, ibDev->compChannel, 0), res, unlock);
+    base->nextEventBase = ibDev->eventBases;
+    ibDev->eventBases = base;
+unlock:
+    pthread_mutex_unlock(&ibDev->lock);
+    return res;
+  }
+
   // Recv requests can generate 2 completions (one for the post FIFO, one for the Recv).
   NCCLCHECK(wrap_ibv_create_cq(&base->cq, ibDev->context, 2*MAX_REQUESTS*ncclParamIbQpsPerConn(), NULL, NULL, 0));
 
   return ncclSuccess;
 }
 
+// Read and acknowledge all pending completion events. Called with the device lock held.
+static ncclResult_t ncclIbDrainCqEvents(struct ncclIbDev* ibDev) {
+  int got;
+  do {
+    struct ibv_cq* cq;
+    void* cqContext;
+    NCCLCHECK(wrap_ibv_get_cq_event(ibDev->compChannel, &cq, &cqContext, &got));
+    if (got) NCCLCHECK(wrap_ibv_ack_cq_events(cq, 1));
+  } while (got);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbCqEventsArm(int* fds, int maxFds, int* nFds) {
+  *nFds = 0;
+  for (int d=0; d<ncclNIbDevs && *nFds<maxFds; d++) {
+    struct ncclIbDev* ibDev = ncclIbDevs+d;
+    ncclResult_t res = ncclSuccess;
+    pthread_mutex_lock(&ibDev->lock);
+    if (ibDev->eventBases) {
+      for (struct ncclIbNetCommDevBase* base = ibDev->eventBases; base; base = base->nextEventBase) {
+        NCCLCHECKGOTO(wrap_ibv_req_notify_cq(base->cq, 0), res, unlock);
+      }
+      fds[(*nFds)++] = ibDev->compChannel->fd;
+    }
+unlock:
+    pthread_mutex_unlock(&ibDev->lock);
+    NCCLCHECK(res);
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbCqEventsDrain() {
+  for (int d=0; d<ncclNIbDevs; d++) {
+    struct ncclIbDev* ibDev = ncclIbDevs+d;
+    if (ibDev->compChannel == NULL) continue;
+    pthread_mutex_lock(&ibDev->lock);
+    ncclResult_t res = ncclIbDrainCqEvents(ibDev);
+    pthread_mutex_unlock(&ibDev->lock);
+    NCCLCHECK(res);
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbDestroyBase(struct ncclIbNetCommDevBase* base) {
   ncclResult_t res;
+  struct ncclIbDev* ibDev = ncclIbDevs+base->ibDevN;
+  if (ibDev->compChannel) {
+    pthread_mutex_lock(&ibDev->lock);
+    struct ncclIbNetCommDevBase** ptr = &ibDev->eventBases;
+    while (*ptr && *ptr != base) ptr = &(*ptr)->nextEventBase;
+    if (*ptr) *ptr = base->nextEventBase;
+    // Unread events of this CQ would make the destroy hang, and reading them later would touch a freed CQ
+    res = ncclIbDrainCqEvents(ibDev);
+    pthread_mutex_unlock(&ibDev->lock);
+    NCCLCHECK(res);
+  }
   NCCLCHECK(wrap_ibv_destroy_cq(base->cq));
 
   pthread_mutex_lock(&ncclIbDevs[base->ibDevN].lock);
   if (0 == --ncclIbDevs[base->ibDevN].pdRefs) {
+    if (ncclIbDevs[base->ibDevN].odpMr) {
+      NCCLCHECKGOTO(wrap_ibv_dereg_mr(ncclIbDevs[base->ibDevN].odpMr), res, returning);
+      ncclIbDevs[base->ibDevN].odpMr = NULL;
+    }
     NCCLCHECKGOTO(wrap_ibv_dealloc_pd(ncclIbDevs[base->ibDevN].pd), res, returning);
   }
   res = ncclSuccess;
@@ -887,15 +1203,16 @@ returning:
   return res;
 }
 
-ncclResult_t ncclIbCreateQp(uint8_t ib_port, struct ncclIbNetCommDevBase* base, int access_flags, struct ncclIbQp* qp) {
+ncclResult_t ncclIbCreateQp(uint8_t ib_port, struct ncclIbNetCommDevBase* base, int access_flags, struct ncclIbQp* qp, struct ibv_srq* srq = NULL) {
   struct ibv_qp_init_attr qpInitAttr;
   memset(&qpInitAttr, 0, sizeof(struct ibv_qp_init_attr));
   qpInitAttr.send_cq = base->cq;
   qpInitAttr.recv_cq = base->cq;
+  qpInitAttr.srq = srq;
   qpInitAttr.qp_type = IBV_QPT_RC;
   // We might send 2 messages per send (RDMA and RDMA_WITH_IMM)
   qpInitAttr.cap.max_send_wr = 2*MAX_REQUESTS;
-  qpInitAttr.cap.max_recv_wr = MAX_REQUESTS;
+  qpInitAttr.cap.max_recv_wr = srq ? 0 : MAX_REQUESTS;
   qpInitAttr.cap.max_send_sge = 1;
   qpInitAttr.cap.max_recv_sge = 1;
   qpInitAttr.cap.max_inline_data = ncclParamIbUseInline() ? sizeof(struct ncclIbSendFifo) : 0;
@@ -910,6 +1227,55 @@ ncclResult_t ncclIbCreateQp(uint8_t ib_port, struct ncclIbNetCommDevBase* base,
   return ncclSuccess;
 }
 
+// Shared receive queues. Receive WRs carry no buffer (data comes with RDMA writes), so
+// one queue per device can serve all the QPs of all the recv comms on it. This saves
+// the per-QP receive queues, MAX_REQUESTS WQEs each, and their NIC context.
+NCCL_PARAM(IbSrq, "IB_SRQ", 0);
+// Must cover the receives posted and not yet consumed by all the recv comms on a device
+NCCL_PARAM(IbSrqSize, "IB_SRQ_SIZE", 16384);
+
+static ncclResult_t ncclIbSrqGet(int ibDevN, struct ibv_srq** srq) {
+  struct ncclIbDev* ibDev = ncclIbDevs + ibDevN;
+  ncclResult_t res = ncclSuccess;
+  pthread_mutex_lock(&ibDev->lock);
+  if (ibDev->srqRefs == 0) {
+    struct ibv_srq_init_attr srqInitAttr;
+    memset(&srqInitAttr, 0, sizeof(struct ibv_srq_init_attr));
+    srqInitAttr.attr.max_wr = std::min((int)ncclParamIbSrqSize(), ibDev->maxSrqWr);
+    srqInitAttr.attr.max_sge = 1;
+    // The PD outlives the SRQ, it is referenced by the recv comm which holds the SRQ
+    NCCLCHECKGOTO(wrap_ibv_create_srq(&ibDev->srq, ibDev->pd, &srqInitAttr), res, unlock);
+    INFO(NCCL_NET, "NET/IB: %s shared receive queue of %d WRs", ibDev->devName, srqInitAttr.attr.max_wr);
+  }
+  ibDev->srqRefs++;
+  *srq = ibDev->srq;
+unlock:
+  pthread_mutex_unlock(&ibDev->lock);
+  return res;
+}
+
+static ncclResult_t ncclIbSrqRelease(int ibDevN) {
+  struct ncclIbDev* ibDev = ncclIbDevs + ibDevN;
+  ncclResult_t res = ncclSuccess;
+  pthread_mutex_lock(&ibDev->lock);
+  if (--ibDev->srqRefs == 0) {
+    res = wrap_ibv_destroy_srq(ibDev->srq);
+    ibDev->srq = NULL;
+  }
+  pthread_mutex_unlock(&ibDev->lock);
+  return res;
+}
+
+// Create the QPs of a recv comm, fed by the shared receive queue of their device if enabled
+static ncclResult_t ncclIbCreateRecvQp(struct ncclIbRecvComm* rComm, struct ncclIbRecvCommDev* rCommDev, struct ncclIbQp* qp) {
+  if (ncclParamIbSrq()) {
+    if (rComm->srqPending == NULL) NCCLCHECK(ncclCalloc(&rComm->srqPending, rComm->base.nqps));
+    if (rCommDev->srq == NULL) NCCLCHECK(ncclIbSrqGet(rCommDev->base.ibDevN, &rCommDev->srq));
+  }
+  // Remote reads are for ncclIbIget
+  return ncclIbCreateQp(ncclIbDevs[rCommDev->base.ibDevN].portNum, &rCommDev->base, IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ, qp, rCommDev->srq);
+}
+
 ncclResult_t ncclIbRtrQp(struct ibv_qp* qp, uint8_t sGidIndex, uint32_t dest_qp_num, struct ncclIbDevInfo* info) {
   struct ibv_qp_attr qpAttr;
   memset(&qpAttr, 0, sizeof(struct ibv_qp_attr));
@@ -926,12 +1292,12 @@ ncclResult_t ncclIbRtrQp(struct ibv_qp* qp, uint8_t sGidIndex, uint32_t dest_qp_
     qpAttr.ah_attr.grh.flow_label = 0;
     qpAttr.ah_attr.grh.sgid_index = sGidIndex;
     qpAttr.ah_attr.grh.hop_limit = 255;
-    qpAttr.ah_attr.grh.traffic_class = ncclParamIbTc();
+    qpAttr.ah_attr.grh.traffic_class = ncclNetQosCurrent.trafficClass >= 0 ? ncclNetQosCurrent.trafficClass : ncclParamIbTc();
   } else {
     qpAttr.ah_attr.is_global = 0;
     qpAttr.ah_attr.dlid = info->lid;
   }
-  qpAttr.ah_attr.sl = ncclParamIbSl();
+  qpAttr.ah_attr.sl = ncclNetQosCurrent.serviceLevel >= 0 ? ncclNetQosCurrent.serviceLevel : ncclParamIbSl();
   qpAttr.ah_attr.src_path_bits = 0;
   qpAttr.ah_attr.port_num = info->ib_port;
   NCCLCHECK(wrap_ibv_modify_qp(qp, &qpAttr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER));
@@ -951,17 +1317,23 @@ ncclResult_t ncclIbRtsQp(struct ibv_qp* qp) {
   return ncclSuccess;
 }
 
+// See ncclIbOobConnectPrepare
+NCCL_PARAM(IbOobConnect, "IB_OOB_CONNECT", 0);
+static ncclResult_t ncclIbOobListen(struct ncclIbListenComm* lComm, struct ncclIbOobInfo* info);
+
 ncclResult_t ncclIbListen(int dev, void* opaqueHandle, void** listenComm) {
   struct ncclIbListenComm* comm;
   NCCLCHECK(ncclCalloc(&comm, 1));
   struct ncclIbHandle* handle = (struct ncclIbHandle*) opaqueHandle;
-  static_assert(sizeof(struct ncclIbHandle) < NCCL_NET_HANDLE_MAXSIZE, "ncclIbHandle size too large");
+  static_assert(sizeof(struct ncclIbHandle) <= NCCL_NET_HANDLE_POOL_OFFSET, "ncclIbHandle size too large");
   memset(handle, 0, sizeof(struct ncclIbHandle));
   comm->dev = dev;
+  for (int i = 0; i < ncclIbMergedDevs[dev].ndevs; i++) NCCLCHECK(ncclIbDevOpen(ncclIbMergedDevs[dev].devs[i]));
   handle->magic = NCCL_SOCKET_MAGIC;
   NCCLCHECK(ncclSocketInit(&comm->sock, &ncclIbIfAddr, handle->magic, ncclSocketTypeNetIb, NULL, 1));
   NCCLCHECK(ncclSocketListen(&comm->sock));
   NCCLCHECK(ncclSocketGetAddr(&comm->sock, &handle->connectAddr));
+  if (ncclParamIbOobConnect()) NCCLCHECK(ncclIbOobListen(comm, &handle->oob));
   *listenComm = comm;
   return ncclSuccess;
 }
@@ -999,6 +1371,13 @@ ib_connect_check:
   comm->base.ndevs = mergedDev->ndevs;
   comm->base.nqps = ncclParamIbQpsPerConn() * comm->base.ndevs; // We must have at least 1 qp per-device
   comm->base.isSend = true;
+  if (ncclParamIbAdaptiveSplit() && (ncclParamIbSplitDataOnQps() ? comm->base.nqps : comm->base.ndevs) > 1) {
+    NCCLCHECK(ncclCalloc(&comm->qpStats, comm->base.nqps));
+  }
+  if (ncclParamIbPacing()) {
+    NCCLCHECK(ncclCalloc(&comm->pacer, 1));
+    comm->pacer->window = ncclParamIbPacingMaxWindow();
+  }
 
   // Init PD, Ctx for each IB device
   comm->ar = 1; // Set to 1 for logic
@@ -1172,6 +1551,25 @@ ib_send_ready:
 
 NCCL_PARAM(IbGdrFlushDisable, "GDR_FLUSH_DISABLE", 0);
 
+// Loopback QP reading from the GPU to flush GDR writes
+static ncclResult_t ncclIbInitGpuFlush(struct ncclIbRecvComm* rComm, struct ncclIbRecvCommDev* rCommDev, struct ncclIbDev* ibDev) {
+  NCCLCHECK(wrap_ibv_reg_mr(&rCommDev->gpuFlush.hostMr, rCommDev->base.pd, &rComm->gpuFlushHostMem, sizeof(int), IBV_ACCESS_LOCAL_WRITE));
+  rCommDev->gpuFlush.sge.addr = (uint64_t)&rComm->gpuFlushHostMem;
+  rCommDev->gpuFlush.sge.length = 1;
+  rCommDev->gpuFlush.sge.lkey = rCommDev->gpuFlush.hostMr->lkey;
+  NCCLCHECK(ncclIbCreateQp(ibDev->portNum, &rCommDev->base, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ, &rCommDev->gpuFlush.qp));
+  struct ncclIbDevInfo devInfo;
+  devInfo.lid         = ibDev->portAttr.lid;
+  devInfo.link_layer  = ibDev->portAttr.link_layer;
+  devInfo.ib_port     = ibDev->portNum;
+  devInfo.spn         = rCommDev->base.gidInfo.localGid.global.subnet_prefix;
+  devInfo.iid         = rCommDev->base.gidInfo.localGid.global.interface_id;
+  devInfo.mtu         = ibDev->portAttr.active_mtu;
+  NCCLCHECK(ncclIbRtrQp(rCommDev->gpuFlush.qp.qp, rCommDev->base.gidInfo.localGidIndex, rCommDev->gpuFlush.qp.qp->qp_num, &devInfo));
+  NCCLCHECK(ncclIbRtsQp(rCommDev->gpuFlush.qp.qp));
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbAccept(void* listenComm, void** recvComm, ncclNetDeviceHandle_t** /*recvDevComm*/) {
   struct ncclIbListenComm* lComm = (struct ncclIbListenComm*)listenComm;
   struct ncclIbCommStage* stage = &lComm->stage;
@@ -1260,10 +1658,7 @@ ib_recv:
     rCommDev = rComm->devs + devIndex;
     qp->remDevIdx = remDevIndex;
 
-    // Local ibDevN
-    ibDevN = rComm->devs[devIndex].base.ibDevN;
-    ibDev = ncclIbDevs + ibDevN;
-    NCCLCHECK(ncclIbCreateQp(ibDev->portNum, &rCommDev->base, IBV_ACCESS_REMOTE_WRITE, qp));
+    NCCLCHECK(ncclIbCreateRecvQp(rComm, rCommDev, qp));
     qp->devIndex = devIndex;
     devIndex = (devIndex + 1) % rComm->base.ndevs;
 
@@ -1297,22 +1692,7 @@ ib_recv:
     if (ncclParamIbUseInline()) rComm->remFifo.flags = IBV_SEND_INLINE;
 
     // Allocate Flush dummy buffer for GPU Direct RDMA
-    if (rComm->flushEnabled) {
-      NCCLCHECK(wrap_ibv_reg_mr(&rCommDev->gpuFlush.hostMr, rCommDev->base.pd, &rComm->gpuFlushHostMem, sizeof(int), IBV_ACCESS_LOCAL_WRITE));
-      rCommDev->gpuFlush.sge.addr = (uint64_t)&rComm->gpuFlushHostMem;
-      rCommDev->gpuFlush.sge.length = 1;
-      rCommDev->gpuFlush.sge.lkey = rCommDev->gpuFlush.hostMr->lkey;
-      NCCLCHECK(ncclIbCreateQp(ibDev->portNum, &rCommDev->base, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ, &rCommDev->gpuFlush.qp));
-      struct ncclIbDevInfo devInfo;
-      devInfo.lid         = ibDev->portAttr.lid;
-      devInfo.link_layer  = ibDev->portAttr.link_layer;
-      devInfo.ib_port     = ibDev->portNum;
-      devInfo.spn         = rCommDev->base.gidInfo.localGid.global.subnet_prefix;
-      devInfo.iid         = rCommDev->base.gidInfo.localGid.global.interface_id;
-      devInfo.mtu         = ibDev->portAttr.active_mtu;
-      NCCLCHECK(ncclIbRtrQp(rCommDev->gpuFlush.qp.qp, rCommDev->base.gidInfo.localGidIndex, rCommDev->gpuFlush.qp.qp->qp_num, &devInfo));
-      NCCLCHECK(ncclIbRtsQp(rCommDev->gpuFlush.qp.qp));
-    }
+    if (rComm->flushEnabled) NCCLCHECK(ncclIbInitGpuFlush(rComm, rCommDev, ibDev));
 
     // Fill Handle
     meta.devs[i].lid        = ibDev->portAttr.lid;
@@ -1367,6 +1747,149 @@ ib_recv_ready:
   return ncclSuccess;
 }
 
+// NCCL_IB_OOB_CONNECT: the socket handshake of ncclIbConnect/ncclIbAccept costs a TCP
+// connection and several round trips per connection, serialized on the proxy thread. Instead,
+// the sender creates its QP when the connection is set up and the receiver when it listens,
+// and NCCL exchanges the QP addresses through the bootstrap along with the rest of the
+// connect info of the round. Connect and accept then only move the QP to RTR and RTS.
+// The address must fit in the handle, so this covers one device and one QP per connection,
+// and ECE is not negotiated. Other connections use the socket handshake.
+static bool ncclIbOobUsable(int dev) {
+  return ncclParamIbOobConnect() && ncclIbMergedDevs[dev].ndevs == 1 && ncclParamIbQpsPerConn() == 1;
+}
+
+static ncclResult_t ncclIbOobFillInfo(struct ncclIbDev* ibDev, struct ncclIbNetCommDevBase* base, struct ibv_qp* qp, struct ncclIbOobInfo* info) {
+  info->link_layer = base->gidInfo.link_layer = ibDev->portAttr.link_layer;
+  NCCLCHECK(ncclIbGetGidIndex(ibDev->context, ibDev->portNum, ibDev->portAttr.gid_tbl_len, &base->gidInfo.localGidIndex));
+  NCCLCHECK(wrap_ibv_query_gid(ibDev->context, ibDev->portNum, base->gidInfo.localGidIndex, &base->gidInfo.localGid));
+  info->spn = base->gidInfo.localGid.global.subnet_prefix;
+  info->iid = base->gidInfo.localGid.global.interface_id;
+  info->lid = ibDev->portAttr.lid;
+  info->ib_port = ibDev->portNum;
+  info->mtu = ibDev->portAttr.active_mtu;
+  info->qpn = qp->qp_num;
+  info->valid = 1;
+  return ncclSuccess;
+}
+
+// Connect the QP of a comm with a single device and QP to the remote one described by info
+static ncclResult_t ncclIbOobRtsQp(struct ncclIbNetCommBase* base, struct ncclIbNetCommDevBase* devBase, struct ncclIbOobInfo* info) {
+  struct ncclIbDevInfo* remDevInfo = base->remDevs;
+  remDevInfo->lid = info->lid;
+  remDevInfo->ib_port = info->ib_port;
+  remDevInfo->mtu = (enum ibv_mtu) std::min((enum ibv_mtu)info->mtu, ncclIbDevs[devBase->ibDevN].portAttr.active_mtu);
+  remDevInfo->link_layer = info->link_layer;
+  remDevInfo->spn = info->spn;
+  remDevInfo->iid = info->iid;
+  remDevInfo->fifoRkey = info->fifoRkey;
+  remDevInfo->remoteGid.global.subnet_prefix = info->spn;
+  remDevInfo->remoteGid.global.interface_id = info->iid;
+  base->nRemDevs = 1;
+  base->qps[0].remDevIdx = 0;
+  NCCLCHECK(ncclIbRtrQp(base->qps[0].qp, devBase->gidInfo.localGidIndex, info->qpn, remDevInfo));
+  NCCLCHECK(ncclIbRtsQp(base->qps[0].qp));
+  base->ready = 1;
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclIbOobListen(struct ncclIbListenComm* lComm, struct ncclIbOobInfo* info) {
+  if (!ncclIbOobUsable(lComm->dev)) return ncclSuccess;
+
+  struct ncclIbRecvComm* rComm;
+  NCCLCHECK(ncclIbMalloc((void**)&rComm, sizeof(struct ncclIbRecvComm)));
+  NCCLCHECK(ncclSocketInit(&rComm->base.sock));
+  rComm->base.ndevs = 1;
+  rComm->base.nqps = 1;
+  rComm->base.isSend = false;
+
+  int ibDevN = ncclIbMergedDevs[lComm->dev].devs[0];
+  struct ncclIbDev* ibDev = ncclIbDevs + ibDevN;
+  struct ncclIbRecvCommDev* rCommDev = rComm->devs;
+  NCCLCHECK(ncclIbInitCommDevBase(ibDevN, &rCommDev->base));
+  NCCLCHECK(ncclIbCreateRecvQp(rComm, rCommDev, rComm->base.qps));
+  rComm->base.qps[0].devIndex = 0;
+  NCCLCHECK(ncclIbOobFillInfo(ibDev, &rCommDev->base, rComm->base.qps[0].qp, info));
+
+  rComm->flushEnabled = ((ncclIbGdrSupport() == ncclSuccess || ncclIbDmaBufSupport(lComm->dev) == ncclSuccess)
+                            && (ncclParamIbGdrFlushDisable() == 0)) ? 1 : 0;
+  NCCLCHECK(wrap_ibv_reg_mr(&rCommDev->fifoMr, rCommDev->base.pd, &rComm->remFifo.elems, sizeof(struct ncclIbSendFifo)*MAX_REQUESTS*NCCL_NET_IB_MAX_RECVS, IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_READ));
+  rCommDev->fifoSge.lkey = rCommDev->fifoMr->lkey;
+  if (ncclParamIbUseInline()) rComm->remFifo.flags = IBV_SEND_INLINE;
+  if (rComm->flushEnabled) NCCLCHECK(ncclIbInitGpuFlush(rComm, rCommDev, ibDev));
+
+  NCCLCHECK(wrap_ibv_reg_mr(&rCommDev->sizesFifoMr, rCommDev->base.pd, rComm->sizesFifo, sizeof(int)*MAX_REQUESTS*NCCL_NET_IB_MAX_RECVS, IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ));
+  info->fifoRkey = rCommDev->sizesFifoMr->rkey;
+  info->fifoAddr = (uint64_t)rComm->sizesFifo;
+  lComm->oobComm = rComm;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbOobConnectPrepare(int dev, void* oobInfo, void** oobSendComm) {
+  struct ncclIbOobInfo* info = (struct ncclIbOobInfo*)oobInfo;
+  memset(info, 0, sizeof(struct ncclIbOobInfo));
+  *oobSendComm = NULL;
+  if (!ncclIbOobUsable(dev)) return ncclSuccess;
+
+  struct ncclIbSendComm* comm;
+  NCCLCHECK(ncclIbMalloc((void**)&comm, sizeof(struct ncclIbSendComm)));
+  NCCLCHECK(ncclSocketInit(&comm->base.sock));
+  comm->base.ndevs = 1;
+  comm->base.nqps = 1;
+  comm->base.isSend = true;
+  if (ncclParamIbPacing()) {
+    NCCLCHECK(ncclCalloc(&comm->pacer, 1));
+    comm->pacer->window = ncclParamIbPacingMaxWindow();
+  }
+  comm->ar = ncclIbDevs[dev].ar;
+
+  int ibDevN = ncclIbMergedDevs[dev].devs[0];
+  struct ncclIbDev* ibDev = ncclIbDevs + ibDevN;
+  struct ncclIbSendCommDev* commDev = comm->devs;
+  NCCLCHECK(ncclIbInitCommDevBase(ibDevN, &commDev->base));
+  NCCLCHECK(ncclIbCreateQp(ibDev->portNum, &commDev->base, IBV_ACCESS_REMOTE_WRITE, comm->base.qps));
+  comm->base.qps[0].devIndex = 0;
+  NCCLCHECK(ncclIbOobFillInfo(ibDev, &commDev->base, comm->base.qps[0].qp, info));
+
+  NCCLCHECK(wrap_ibv_reg_mr(&commDev->fifoMr, commDev->base.pd, comm->fifo, sizeof(struct ncclIbSendFifo)*MAX_REQUESTS*NCCL_NET_IB_MAX_RECVS, IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ));
+  info->fifoRkey = commDev->fifoMr->rkey;
+  info->fifoAddr = (uint64_t)comm->fifo;
+  *oobSendComm = comm;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbOobConnect(void* oobSendComm, void* listenHandle, void** sendComm) {
+  struct ncclIbSendComm* comm = (struct ncclIbSendComm*)oobSendComm;
+  struct ncclIbOobInfo* remInfo = &((struct ncclIbHandle*)listenHandle)->oob;
+  *sendComm = NULL;
+  // The receiver prepared no QP, the caller connects through the socket
+  if (!remInfo->valid) return ncclIbCloseSend(comm);
+
+  comm->remSizesFifo.rkeys[0] = remInfo->fifoRkey;
+  comm->remSizesFifo.addr = remInfo->fifoAddr;
+  NCCLCHECK(wrap_ibv_reg_mr(comm->remSizesFifo.mrs, comm->devs[0].base.pd, &comm->remSizesFifo.elems, sizeof(int)*MAX_REQUESTS*NCCL_NET_IB_MAX_RECVS, IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_READ));
+  NCCLCHECK(ncclIbOobRtsQp(&comm->base, &comm->devs[0].base, remInfo));
+  INFO(NCCL_NET, "NET/IB: IbDev %d qpn %d connected out-of-band to qpn %d", comm->devs[0].base.ibDevN, comm->base.qps[0].qp->qp_num, remInfo->qpn);
+  *sendComm = comm;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbOobAccept(void* listenComm, void* oobInfo, void** recvComm) {
+  struct ncclIbListenComm* lComm = (struct ncclIbListenComm*)listenComm;
+  struct ncclIbOobInfo* remInfo = (struct ncclIbOobInfo*)oobInfo;
+  struct ncclIbRecvComm* rComm = lComm->oobComm;
+  *recvComm = NULL;
+  // The sender prepared no QP, the caller accepts through the socket
+  if (rComm == NULL || !remInfo->valid) return ncclSuccess;
+
+  lComm->oobComm = NULL;
+  rComm->devs[0].fifoRkey = remInfo->fifoRkey;
+  rComm->remFifo.addr = remInfo->fifoAddr;
+  NCCLCHECK(ncclIbOobRtsQp(&rComm->base, &rComm->devs[0].base, remInfo));
+  INFO(NCCL_NET, "NET/IB: IbDev %d qpn %d accepted out-of-band from qpn %d", rComm->devs[0].base.ibDevN, rComm->base.qps[0].qp->qp_num, remInfo->qpn);
+  *recvComm = rComm;
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbGetRequest(struct ncclIbNetCommBase* base, struct ncclIbRequest** req) {
   for (int i=0; i<MAX_REQUESTS; i++) {
     struct ncclIbRequest* r = base->reqs+i;
@@ -1392,14 +1915,39 @@ ncclResult_t ncclIbFreeRequest(struct ncclIbRequest* r) {
 
 ncclResult_t ncclIbTest(void* request, int* done, int* size);
 
+// On-demand paging for host buffers, on NICs supporting it. 1 registers buffers without
+// pinning them. 2 registers a single implicit MR covering the address space of the process
+// on each device, so that registering host memory becomes free. Registrations fall back to
+// pinned memory when the NIC refuses ODP. GPU memory is always pinned.
+NCCL_PARAM(IbOdp, "IB_ODP", 0);
+
+// Called with the device lock held. Returns the implicit MR, or NULL if not usable.
+static struct ibv_mr* ncclIbOdpImplicitMr(struct ncclIbDev* ibDev) {
+  if (ibDev->odpMr == NULL && !ibDev->odpUnsupported) {
+    ibDev->odpMr = wrap_direct_ibv_reg_mr(ibDev->pd, NULL, SIZE_MAX, IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ|IBV_ACCESS_ON_DEMAND);
+    if (ibDev->odpMr == NULL) {
+      INFO(NCCL_NET, "NET/IB: %s does not support implicit ODP (%s), registering buffers", ibDev->devName, strerror(errno));
+      ibDev->odpUnsupported = 1;
+    }
+  }
+  return ibDev->odpMr;
+}
+
 ncclResult_t ncclIbRegMrDmaBufInternal(ncclIbNetCommDevBase* base, void* data, size_t size, int type, uint64_t offset, int fd, ibv_mr** mhandle) {
   static __thread uintptr_t pageSize = 0;
   if (pageSize == 0) pageSize = sysconf(_SC_PAGESIZE);
-  struct ncclIbMrCache* cache = &ncclIbDevs[base->ibDevN].mrCache;
+  struct ncclIbDev* ibDev = ncclIbDevs+base->ibDevN;
+  struct ncclIbMrCache* cache = &ibDev->mrCache;
   uintptr_t addr = (uintptr_t)data & -pageSize;
   size_t pages = ((uintptr_t)data + size - addr + pageSize-1)/pageSize;
+  bool odp = type == NCCL_PTR_HOST && fd == -1 && ncclParamIbOdp();
   ncclResult_t res;
-  pthread_mutex_lock(&ncclIbDevs[base->ibDevN].lock);
+  pthread_mutex_lock(&ibDev->lock);
+  if (odp && ncclParamIbOdp() == 2 && ncclIbOdpImplicitMr(ibDev)) {
+    *mhandle = ibDev->odpMr;
+    res = ncclSuccess;
+    goto returning;
+  }
   for (int slot=0; /*true*/; slot++) {
     if (slot == cache->population || addr < cache->slots[slot].addr) { // didn't find in cache
       if (cache->population == cache->capacity) { // must grow cache
@@ -1407,10 +1955,20 @@ ncclResult_t ncclIbRegMrDmaBufInternal(ncclIbNetCommDevBase* base, void* data, s
         NCCLCHECKGOTO(ncclRealloc(&cache->slots, cache->population, cache->capacity), res, returning);
       }
       // Deregister / register
-      struct ibv_mr* mr;
+      struct ibv_mr* mr = NULL;
       unsigned int flags = IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ;
       if (ncclIbRelaxedOrderingEnabled) flags |= IBV_ACCESS_RELAXED_ORDERING;
-      if (fd != -1) {
+      if (odp && !ibDev->odpUnsupported) {
+        // Relaxed ordering needs ibv_reg_mr_iova2, leave it out rather than fail ODP for it
+        mr = wrap_direct_ibv_reg_mr(base->pd, (void*)addr, pages*pageSize, (flags & ~IBV_ACCESS_RELAXED_ORDERING)|IBV_ACCESS_ON_DEMAND);
+        if (mr == NULL) {
+          INFO(NCCL_NET, "NET/IB: %s does not support ODP (%s), pinning buffers", ibDev->devName, strerror(errno));
+          ibDev->odpUnsupported = 1;
+        }
+      }
+      if (mr) {
+        // Registered on demand
+      } else if (fd != -1) {
         /* DMA-BUF support */
         NCCLCHECKGOTO(wrap_ibv_reg_dmabuf_mr(&mr, base->pd, offset, pages*pageSize, addr, fd, flags), res, returning);
       } else {
@@ -1441,7 +1999,7 @@ ncclResult_t ncclIbRegMrDmaBufInternal(ncclIbNetCommDevBase* base, void* data, s
     }
   }
 returning:
-  pthread_mutex_unlock(&ncclIbDevs[base->ibDevN].lock);
+  pthread_mutex_unlock(&ibDev->lock);
   return res;
 }
 
@@ -1477,6 +2035,11 @@ ncclResult_t ncclIbDeregMrInternal(ncclIbNetCommDevBase* base, ibv_mr* mhandle)
   struct ncclIbMrCache* cache = &ncclIbDevs[base->ibDevN].mrCache;
   ncclResult_t res;
   pthread_mutex_lock(&ncclIbDevs[base->ibDevN].lock);
+  // The implicit ODP MR lives as long as the PD
+  if (mhandle == ncclIbDevs[base->ibDevN].odpMr) {
+    res = ncclSuccess;
+    goto returning;
+  }
   for (int i=0; i < cache->population; i++) {
     if (mhandle == cache->slots[i].mr) {
       if (0 == --cache->slots[i].refs) {
@@ -1511,7 +2074,64 @@ ncclResult_t ncclIbDeregMr(void* comm, void* mhandle) {
   return ncclSuccess;
 }
 
-NCCL_PARAM(IbSplitDataOnQps, "IB_SPLIT_DATA_ON_QPS", 0);
+// Fraction of each message sent on each of the nqps QPs used for a send, starting at
+// comm->base.qpIndex. QPs keep at least a small share so that their estimate stays current.
+static void ncclIbQpWeights(struct ncclIbSendComm* comm, int nqps, float* weights) {
+  float maxBw = 0, total = 0;
+  for (int i = 0; i < nqps; i++) {
+    float bw = comm->qpStats[(comm->base.qpIndex+i) % comm->base.nqps].bw;
+    weights[i] = bw;
+    maxBw = std::max(maxBw, bw);
+  }
+  if (maxBw == 0) {
+    for (int i = 0; i < nqps; i++) weights[i] = 1.0/nqps;
+    return;
+  }
+  for (int i = 0; i < nqps; i++) {
+    weights[i] = std::max(weights[i], maxBw/8);
+    total += weights[i];
+  }
+  for (int i = 0; i < nqps; i++) weights[i] /= total;
+}
+
+static void ncclIbQpStatsComplete(struct ncclIbSendComm* comm, uint32_t qpNum) {
+  int q;
+  for (q = 0; q < comm->base.nqps; q++) if (comm->base.qps[q].qp->qp_num == qpNum) break;
+  if (q == comm->base.nqps) return;
+  struct ncclIbQpStats* stats = comm->qpStats+q;
+  if (stats->completed == stats->posted) return;
+  uint64_t now = clockNano();
+  if (stats->posted - stats->completed <= NCCL_IB_QP_STATS_DEPTH) {
+    int index = stats->completed % NCCL_IB_QP_STATS_DEPTH;
+    // Writes queued on the same QP only start being served when the previous one completes
+    uint64_t start = std::max(stats->postTime[index], stats->lastCompletion);
+    int bytes = stats->bytes[index];
+    if (bytes > 0 && now > start) {
+      float bw = (float)bytes / (now - start);
+      stats->bw = stats->bw == 0 ? bw : stats->bw + (bw - stats->bw)/8;
+    }
+  }
+  stats->lastCompletion = now;
+  stats->completed++;
+}
+
+static void ncclIbPacerComplete(struct ncclIbPacer* pacer, int size, uint64_t latency) {
+  pacer->inflight -= size;
+  if (latency == 0) return;
+  pacer->bestBw = std::max(pacer->bestBw, (float)size/latency);
+  float delay = latency - size/pacer->bestBw;
+  if (pacer->baseDelay == 0 || delay < pacer->baseDelay) pacer->baseDelay = std::max(delay, 1.0f);
+  if (delay > pacer->baseDelay + ncclParamIbPacingDelay()*1000) {
+    uint64_t now = clockNano();
+    if (now - pacer->lastDecrease > latency) {
+      pacer->window = std::max(ncclParamIbPacingMinWindow(), pacer->window*4/5);
+      pacer->lastDecrease = now;
+    }
+  } else {
+    // About 64KB more per window worth of completions
+    pacer->window = std::min(ncclParamIbPacingMaxWindow(), pacer->window + std::max((int64_t)size*65536/pacer->window, (int64_t)1));
+  }
+}
 
 ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
   struct ncclIbRequest** reqs = comm->fifoReqs[slot];
@@ -1568,10 +2188,14 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
   // Multi-QP: make sure IB writes are multiples of 128B so that LL and LL128 protocols still work
   const int align = 128;
   int nqps = ncclParamIbSplitDataOnQps() ? comm->base.nqps : comm->base.ndevs;
+  float weights[NCCL_IB_MAX_QPS];
+  if (comm->qpStats) ncclIbQpWeights(comm, nqps, weights);
   for (int i = 0; i < nqps; i++) {
     int qpIndex = comm->base.qpIndex;
     ncclIbQp* qp = comm->base.qps + qpIndex;
     int devIndex = qp->devIndex;
+    int qpBytes = 0;
+    int chunks[NCCL_NET_IB_MAX_RECVS];
     for (int r=0; r<nreqs; r++) {
       // Track this event for completion
       //ncclIbAddEvent(reqs[r], devIndex, &comm->devs[devIndex].base);
@@ -1580,7 +2204,14 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
       comm->wrs[r].wr.rdma.rkey = slots[r].rkeys[qp->remDevIdx];
 
       int chunkSize = DIVUP(DIVUP(reqs[r]->send.size, nqps), align) * align;
+      if (comm->qpStats) {
+        // The last QP takes whatever is left
+        chunkSize = i == nqps-1 ? std::max(reqs[r]->send.size-reqs[r]->send.offset, 0) :
+          DIVUP((int)(reqs[r]->send.size*weights[i]), align) * align;
+      }
+      chunks[r] = chunkSize;
       int length = std::min(reqs[r]->send.size-reqs[r]->send.offset, chunkSize);
+      qpBytes += std::max(length, 0);
       if (length <= 0) {
         comm->wrs[r].sg_list = NULL;
         comm->wrs[r].num_sge = 0;
@@ -1601,9 +2232,16 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
 
     struct ibv_send_wr* bad_wr;
     NCCLCHECK(wrap_ibv_post_send(qp->qp, comm->wrs, &bad_wr));
+    if (comm->qpStats) {
+      struct ncclIbQpStats* stats = comm->qpStats+qpIndex;
+      int index = stats->posted % NCCL_IB_QP_STATS_DEPTH;
+      stats->postTime[index] = clockNano();
+      stats->bytes[index] = qpBytes;
+      stats->posted++;
+    }
 
     for (int r=0; r<nreqs; r++) {
-      int chunkSize = DIVUP(DIVUP(reqs[r]->send.size, nqps), align) * align;
+      int chunkSize = chunks[r];
       reqs[r]->send.offset += chunkSize;
       comm->sges[r].addr += chunkSize;
       comm->wrs[r].wr.rdma.remote_addr += chunkSize;
@@ -1613,6 +2251,13 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
     comm->base.qpIndex = (comm->base.qpIndex+1) % comm->base.nqps;
   }
 
+  if (comm->pacer) {
+    uint64_t now = clockNano();
+    for (int r=0; r<nreqs; r++) {
+      reqs[r]->send.postTime = now;
+      comm->pacer->inflight += reqs[r]->send.size;
+    }
+  }
   return ncclSuccess;
 }
 
@@ -1636,6 +2281,12 @@ ncclResult_t ncclIbIsend(void* sendComm, void* data, int size, int tag, void* mh
   // Wait until all data has arrived
   for (int r=1; r<nreqs; r++) while(slots[r].idx != idx);
   __sync_synchronize(); // order the nreqsPtr load against tag/rkey/addr loads below
+  if (comm->pacer && comm->pacer->inflight > 0 && comm->pacer->inflight + size > comm->pacer->window) {
+    // Don't hold back the rest of a multi-send which already started matching
+    int matched = 0;
+    for (int r=0; r<nreqs; r++) matched |= reqs[r] != NULL;
+    if (!matched) { *request = NULL; return ncclSuccess; }
+  }
   for (int r=0; r<nreqs; r++) {
     if (reqs[r] != NULL || slots[r].tag != tag) continue;
 
@@ -1702,13 +2353,14 @@ ncclResult_t ncclIbIsend(void* sendComm, void* data, int size, int tag, void* mh
   return ncclSuccess;
 }
 
-ncclResult_t ncclIbPostFifo(struct ncclIbRecvComm* comm, int n, void** data, int* sizes, int* tags, void** mhandles, struct ncclIbRequest* req) {
+// Write the CTS of all pending FIFO slots with a single RDMA write.
+ncclResult_t ncclIbFlushFifo(struct ncclIbRecvComm* comm) {
+  int n = comm->ctsPending;
+  if (n == 0) return ncclSuccess;
   struct ibv_send_wr wr;
   memset(&wr, 0, sizeof(wr));
 
   int slot = comm->remFifo.fifoTail%MAX_REQUESTS;
-  req->recv.sizes = comm->sizesFifo[slot];
-  for (int i=0; i<n; i++) req->recv.sizes[i] = 0;
   struct ncclIbSendFifo* localElem = comm->remFifo.elems[slot];
 
   // Select the next devIndex (local) and QP to use for posting this CTS message
@@ -1716,32 +2368,22 @@ ncclResult_t ncclIbPostFifo(struct ncclIbRecvComm* comm, int n, void** data, int
   ncclIbQp* ctsQp = comm->base.qps + comm->base.devIndex;
   comm->base.devIndex = (comm->base.devIndex + 1) % comm->base.ndevs;
 
-  for (int i=0; i<n; i++) {
-    localElem[i].addr = (uint64_t)data[i];
-    struct ncclIbMrHandle* mhandleWrapper = (struct ncclIbMrHandle*) mhandles[i];
-
-    // Send all applicable rkeys
-    for (int j = 0; j < comm->base.ndevs; j++)
-      localElem[i].rkeys[j] = mhandleWrapper->mrs[j]->rkey;
-
-    localElem[i].nreqs = n;
-    localElem[i].size = sizes[i]; // Sanity/Debugging
-    localElem[i].tag = tags[i];
-    localElem[i].idx = comm->remFifo.fifoTail+1;
-  }
   wr.wr.rdma.remote_addr = comm->remFifo.addr + slot*NCCL_NET_IB_MAX_RECVS*sizeof(struct ncclIbSendFifo);
 
   // Lookup the correct fifoRkey
   wr.wr.rdma.rkey = comm->base.remDevs[ctsQp->remDevIdx].fifoRkey;
 
-  // Set the correct sge properties
+  // Set the correct sge properties. Earlier slots are written whole, entries past their
+  // nreqs are ignored by the sender.
+  int length = ((n-1)*NCCL_NET_IB_MAX_RECVS + comm->ctsLastNreqs)*sizeof(struct ncclIbSendFifo);
   comm->devs[ctsQp->devIndex].fifoSge.addr   = (uint64_t)localElem;
-  comm->devs[ctsQp->devIndex].fifoSge.length = n*sizeof(struct ncclIbSendFifo);
+  comm->devs[ctsQp->devIndex].fifoSge.length = length;
   wr.sg_list = &comm->devs[ctsQp->devIndex].fifoSge;
   wr.num_sge = 1;
 
   wr.opcode = IBV_WR_RDMA_WRITE;
-  wr.send_flags = comm->remFifo.flags; // IBV_SEND_INLINE
+  // IBV_SEND_INLINE, QPs only accept one FIFO element inline
+  wr.send_flags = length <= sizeof(struct ncclIbSendFifo) ? comm->remFifo.flags : 0;
 
   // We need to occasionally post a request with the IBV_SEND_SIGNALED flag, otherwise
   // the send queue will never empty.
@@ -1765,17 +2407,82 @@ ncclResult_t ncclIbPostFifo(struct ncclIbRecvComm* comm, int n, void** data, int
   //  - The status of all posted Send Request is considered unknown
   //
   // slot == devIndex - When writing to fifo slot N, and this QP lives on device index N, it should send signalled.
-  // This works out that each fifo posting QP gets drained
-  if (slot == ctsQp->devIndex) {
+  // This works out that each fifo posting QP gets drained. When slots are batched, the
+  // QP writing slot N may change between rounds, so also signal after MAX_REQUESTS writes.
+  int devIndex = ctsQp->devIndex;
+  if ((devIndex >= slot && devIndex < slot+n) || comm->ctsUnsignaled[devIndex] >= MAX_REQUESTS) {
+    struct ncclIbRequest* req = comm->ctsLastReq;
     wr.send_flags |= IBV_SEND_SIGNALED;
     wr.wr_id = req - comm->base.reqs;
-    ncclIbAddEvent(req, ctsQp->devIndex, &comm->devs[ctsQp->devIndex].base);
+    ncclIbAddEvent(req, devIndex, &comm->devs[devIndex].base);
+    comm->ctsUnsignaled[devIndex] = 0;
+  } else {
+    comm->ctsUnsignaled[devIndex]++;
   }
 
   struct ibv_send_wr* bad_wr;
   NCCLCHECK(wrap_ibv_post_send(ctsQp->qp, &wr, &bad_wr));
-  comm->remFifo.fifoTail++;
+  comm->remFifo.fifoTail += n;
+  comm->ctsPending = 0;
+
+  return ncclSuccess;
+}
+
+// Coalesce up to NCCL_IB_CTS_BATCH consecutive FIFO slots into one RDMA write. Pending
+// slots are flushed when the batch is full, at the end of the FIFO, or once any receive
+// of the comm is tested, so the delay is bounded by the caller's progress loop.
+NCCL_PARAM(IbCtsBatch, "IB_CTS_BATCH", 1);
+
+ncclResult_t ncclIbPostFifo(struct ncclIbRecvComm* comm, int n, void** data, int* sizes, int* tags, void** mhandles, struct ncclIbRequest* req) {
+  uint64_t fifoIdx = comm->remFifo.fifoTail+comm->ctsPending;
+  int slot = fifoIdx%MAX_REQUESTS;
+  req->recv.sizes = comm->sizesFifo[slot];
+  for (int i=0; i<n; i++) req->recv.sizes[i] = 0;
+  struct ncclIbSendFifo* localElem = comm->remFifo.elems[slot];
+
+  for (int i=0; i<n; i++) {
+    localElem[i].addr = (uint64_t)data[i];
+    struct ncclIbMrHandle* mhandleWrapper = (struct ncclIbMrHandle*) mhandles[i];
 
+    // Send all applicable rkeys
+    for (int j = 0; j < comm->base.ndevs; j++)
+      localElem[i].rkeys[j] = mhandleWrapper->mrs[j]->rkey;
+
+    localElem[i].nreqs = n;
+    localElem[i].size = sizes[i]; // Sanity/Debugging
+    localElem[i].tag = tags[i];
+    localElem[i].idx = fifoIdx+1;
+  }
+  comm->ctsPending++;
+  comm->ctsLastNreqs = n;
+  comm->ctsLastReq = req;
+
+  // Slots written together need to be contiguous in the remote FIFO
+  if (comm->ctsPending >= ncclParamIbCtsBatch() || slot == MAX_REQUESTS-1) NCCLCHECK(ncclIbFlushFifo(comm));
+  return ncclSuccess;
+}
+
+// Post a receive WR on each of the next nqps QPs, for writes with immediate data
+static ncclResult_t ncclIbPostRecvs(struct ncclIbRecvComm* comm, struct ncclIbRequest* req, int nqps) {
+  struct ibv_recv_wr wr;
+  memset(&wr, 0, sizeof(wr));
+  wr.wr_id = req - comm->base.reqs;
+  wr.sg_list = NULL;
+  wr.num_sge = 0;
+
+  struct ibv_recv_wr* bad_wr;
+  for (int i = 0; i < nqps; i++) {
+    struct ncclIbQp* qp = comm->base.qps + comm->base.qpIndex;
+    ncclIbAddEvent(req, qp->devIndex, &comm->devs[qp->devIndex].base);
+    if (comm->srqPending) {
+      struct ncclIbSrqPending* pending = comm->srqPending + comm->base.qpIndex;
+      pending->reqs[pending->tail++ % MAX_REQUESTS] = req - comm->base.reqs;
+      NCCLCHECK(wrap_ibv_post_srq_recv(comm->devs[qp->devIndex].srq, &wr, &bad_wr));
+    } else {
+      NCCLCHECK(wrap_ibv_post_recv(qp->qp, &wr, &bad_wr));
+    }
+    comm->base.qpIndex = (comm->base.qpIndex+1)%comm->base.nqps;
+  }
   return ncclSuccess;
 }
 
@@ -1795,25 +2502,10 @@ ncclResult_t ncclIbIrecv(void* recvComm, int n, void** data, int* sizes, int* ta
     req->devBases[i] = &comm->devs[i].base;
   }
 
-  struct ibv_recv_wr wr;
-  memset(&wr, 0, sizeof(wr));
-  wr.wr_id = req - comm->base.reqs;
-  wr.sg_list = NULL;
-  wr.num_sge = 0;
-
   TIME_START(1);
   // Select either all QPs, or one qp per-device
   const int nqps = ncclParamIbSplitDataOnQps() ? comm->base.nqps : comm->base.ndevs;
-
-  // Post recvs
-  struct ibv_recv_wr* bad_wr;
-  for (int i = 0; i < nqps; i++) {
-    struct ncclIbQp* qp = comm->base.qps + comm->base.qpIndex;
-    ncclIbAddEvent(req, qp->devIndex, &comm->devs[qp->devIndex].base);
-    NCCLCHECK(wrap_ibv_post_recv(qp->qp, &wr, &bad_wr));
-    comm->base.qpIndex = (comm->base.qpIndex+1)%comm->base.nqps;
-  }
-
+  NCCLCHECK(ncclIbPostRecvs(comm, req, nqps));
   TIME_STOP(1);
 
   // Post to FIFO to notify sender
@@ -1863,21 +2555,198 @@ ncclResult_t ncclIbIflush(void* recvComm, int n, void** data, int* sizes, void**
   return ncclSuccess;
 }
 
+// Remote memory descriptor for one-sided operations, see ncclIbGetMrDesc
+struct ncclIbMrDesc {
+  uint64_t addr;
+  uint32_t rkeys[NCCL_IB_MAX_DEVS_PER_NIC];
+};
+static_assert(sizeof(struct ncclIbMrDesc) <= NCCL_NET_MR_DESC_MAXSIZE, "ncclIbMrDesc must fit in NCCL_NET_MR_DESC_MAXSIZE");
+
+ncclResult_t ncclIbGetMrDesc(void* comm, void* data, void* mhandle, void* desc) {
+  struct ncclIbNetCommBase* base = (struct ncclIbNetCommBase*)comm;
+  struct ncclIbMrHandle* mhandleWrapper = (struct ncclIbMrHandle*)mhandle;
+  struct ncclIbMrDesc* mrDesc = (struct ncclIbMrDesc*)desc;
+  memset(mrDesc, 0, sizeof(struct ncclIbMrDesc));
+  mrDesc->addr = (uint64_t)data;
+  for (int i = 0; i < base->ndevs; i++) mrDesc->rkeys[i] = mhandleWrapper->mrs[i]->rkey;
+  return ncclSuccess;
+}
+
+// One-sided write or read on a single QP. The peer's rkey is the one of the device
+// at the other end of the QP.
+static ncclResult_t ncclIbPostOneSided(struct ncclIbSendComm* comm, enum ibv_wr_opcode opcode, void* data, int size, void* mhandle, void* remoteDesc, uint64_t remoteOffset, void** request) {
+  if (comm->base.ready == 0) { WARN("NET/IB: one-sided operation called when comm->base.ready == 0"); return ncclInternalError; }
+  struct ncclIbMrHandle* mhandleWrapper = (struct ncclIbMrHandle*)mhandle;
+  struct ncclIbMrDesc* mrDesc = (struct ncclIbMrDesc*)remoteDesc;
+
+  struct ncclIbRequest* req;
+  NCCLCHECK(ncclIbGetRequest(&comm->base, &req));
+  req->type = NCCL_NET_IB_REQ_SEND;
+  req->sock = &comm->base.sock;
+  req->nreqs = 1;
+  req->send.size = size;
+  req->send.data = data;
+  req->send.offset = 0;
+
+  int qpIndex = comm->base.qpIndex;
+  struct ncclIbQp* qp = comm->base.qps + qpIndex;
+  int devIndex = qp->devIndex;
+  ncclIbAddEvent(req, devIndex, &comm->devs[devIndex].base);
+
+  struct ibv_sge sge;
+  struct ibv_send_wr wr;
+  memset(&wr, 0, sizeof(wr));
+  wr.wr_id = req - comm->base.reqs;
+  wr.opcode = opcode;
+  wr.send_flags = IBV_SEND_SIGNALED;
+  wr.imm_data = size;
+  wr.wr.rdma.remote_addr = mrDesc->addr + remoteOffset;
+  wr.wr.rdma.rkey = mrDesc->rkeys[qp->remDevIdx];
+  if (size > 0) {
+    sge.addr = (uintptr_t)data;
+    sge.length = size;
+    sge.lkey = mhandleWrapper->mrs[devIndex]->lkey;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+  }
+
+  struct ibv_send_wr* bad_wr;
+  NCCLCHECK(wrap_ibv_post_send(qp->qp, &wr, &bad_wr));
+  if (comm->qpStats) {
+    struct ncclIbQpStats* stats = comm->qpStats+qpIndex;
+    int index = stats->posted % NCCL_IB_QP_STATS_DEPTH;
+    stats->postTime[index] = clockNano();
+    stats->bytes[index] = size;
+    stats->posted++;
+  }
+  if (comm->pacer) {
+    req->send.postTime = clockNano();
+    comm->pacer->inflight += size;
+  }
+  comm->base.qpIndex = (comm->base.qpIndex+1) % comm->base.nqps;
+  *request = req;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbIput(void* sendComm, void* data, int size, void* mhandle, void* remoteDesc, uint64_t remoteOffset, int signal, void** request) {
+  return ncclIbPostOneSided((struct ncclIbSendComm*)sendComm, signal ? IBV_WR_RDMA_WRITE_WITH_IMM : IBV_WR_RDMA_WRITE,
+      data, size, mhandle, remoteDesc, remoteOffset, request);
+}
+
+ncclResult_t ncclIbIget(void* sendComm, void* data, int size, void* mhandle, void* remoteDesc, uint64_t remoteOffset, void** request) {
+  return ncclIbPostOneSided((struct ncclIbSendComm*)sendComm, IBV_WR_RDMA_READ, data, size, mhandle, remoteDesc, remoteOffset, request);
+}
+
+// A signaled iput consumes one receive WR on the QP it was written on, the same way a
+// single QP of an isend does.
+ncclResult_t ncclIbIwaitSignal(void* recvComm, void** request) {
+  struct ncclIbRecvComm* comm = (struct ncclIbRecvComm*)recvComm;
+  if (comm->base.ready == 0) { WARN("NET/IB: ncclIbIwaitSignal() called when comm->base.ready == 0"); return ncclInternalError; }
+
+  struct ncclIbRequest* req;
+  NCCLCHECK(ncclIbGetRequest(&comm->base, &req));
+  req->type = NCCL_NET_IB_REQ_RECV;
+  req->sock = &comm->base.sock;
+  req->nreqs = 1;
+  req->recv.signalSize = 0;
+  req->recv.sizes = &req->recv.signalSize;
+  NCCLCHECK(ncclIbPostRecvs(comm, req, 1));
+  *request = req;
+  return ncclSuccess;
+}
+
+// Account for a completion polled from the CQ of device i of r's comm. It may belong
+// to any request of that comm.
+static ncclResult_t ncclIbCompletion(struct ncclIbRequest* r, int i, struct ibv_wc* wc) {
+  if (wc->status != IBV_WC_SUCCESS) {
+    union ncclSocketAddress addr;
+    ncclSocketGetAddr(r->sock, &addr);
+    char localGidString[INET6_ADDRSTRLEN] = "";
+    char remoteGidString[INET6_ADDRSTRLEN] = "";
+    const char* localGidStr = NULL, *remoteGidStr = NULL;
+    if (r->devBases[i]->gidInfo.link_layer == IBV_LINK_LAYER_ETHERNET) {
+      localGidStr = inet_ntop(AF_INET6, &r->devBases[i]->gidInfo.localGid, localGidString, sizeof(localGidString));
+      remoteGidStr = inet_ntop(AF_INET6, &r->base->remDevs[i].remoteGid, remoteGidString, sizeof(remoteGidString));
+    }
+
+    char line[SOCKET_NAME_MAXLEN+1];
+    WARN("NET/IB : Got completion from peer %s with status=%d opcode=%d len=%d vendor err %d (%s)%s%s%s%s",
+        ncclSocketToString(&addr, line), wc->status, wc->opcode, wc->byte_len, wc->vendor_err, reqTypeStr[r->type],
+        localGidStr ?  " localGid ":"", localGidString, remoteGidStr ? " remoteGids":"", remoteGidString);
+    return ncclRemoteError;
+  }
+
+  struct ncclIbRequest* req = r->base->reqs+(wc->wr_id & 0xff);
+  if (wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM && ((struct ncclIbRecvComm*)r->base)->srqPending) {
+    // The WR may have been posted by any recv comm, find the request from the QP
+    struct ncclIbRecvComm* recvComm = (struct ncclIbRecvComm*)r->base;
+    int q = 0;
+    while (q < recvComm->base.nqps && recvComm->base.qps[q].qp->qp_num != wc->qp_num) q++;
+    struct ncclIbSrqPending* pending = recvComm->srqPending + q;
+    if (q == recvComm->base.nqps || pending->head == pending->tail) {
+      WARN("NET/IB: unexpected receive completion on qpn %d", wc->qp_num);
+      return ncclInternalError;
+    }
+    req = r->base->reqs + pending->reqs[pending->head++ % MAX_REQUESTS];
+  }
+
+  #ifdef ENABLE_TRACE
+  union ncclSocketAddress addr;
+  ncclSocketGetAddr(r->sock, &addr);
+  char line[SOCKET_NAME_MAXLEN+1];
+  TRACE(NCCL_NET, "Got completion from peer %s with status=%d opcode=%d len=%d wr_id=%d r=%p type=%d events={%d,%d}, i=%d",
+      ncclSocketToString(&addr, line), wc->status, wc->opcode,wc->byte_len, wc->wr_id, req, req->type, req->events[0], req->events[1], i);
+  #endif
+  if (req->type == NCCL_NET_IB_REQ_SEND) {
+    struct ncclIbSendComm* sendComm = (struct ncclIbSendComm*)req->base;
+    if (sendComm->qpStats) ncclIbQpStatsComplete(sendComm, wc->qp_num);
+    for (int j = 0; j < req->nreqs; j++) {
+      struct ncclIbRequest* sendReq = r->base->reqs+((wc->wr_id >> (j*8)) & 0xff);
+      if ((sendReq->events[i] <= 0)) {
+        WARN("NET/IB: sendReq(%p)->events={%d,%d}, i=%d, j=%d <= 0", sendReq, sendReq->events[0], sendReq->events[1], i, j);
+        return ncclInternalError;
+      }
+      sendReq->events[i]--;
+    }
+  } else {
+    if (req && wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+      if (req->type != NCCL_NET_IB_REQ_RECV) {
+        WARN("NET/IB: wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM and req->type=%d", req->type);
+        return ncclInternalError;
+      }
+      if (req->nreqs == 1) {
+        req->recv.sizes[0] = wc->imm_data;
+      }
+    }
+    req->events[i]--;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclIbRequestDone(struct ncclIbRequest* r, int* sizes) {
+  TRACE(NCCL_NET, "r=%p done", r);
+  if (sizes && r->type == NCCL_NET_IB_REQ_RECV) {
+    for (int i=0; i<r->nreqs; i++) sizes[i] = r->recv.sizes[i];
+  }
+  if (sizes && r->type == NCCL_NET_IB_REQ_SEND) {
+    sizes[0] = r->send.size;
+  }
+  if (r->type == NCCL_NET_IB_REQ_SEND && ((struct ncclIbSendComm*)r->base)->pacer) {
+    ncclIbPacerComplete(((struct ncclIbSendComm*)r->base)->pacer, r->send.size, clockNano()-r->send.postTime);
+  }
+  NCCLCHECK(ncclIbFreeRequest(r));
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbTest(void* request, int* done, int* sizes) {
   struct ncclIbRequest *r = (struct ncclIbRequest*)request;
+  // The sender can't make progress on a receive until its CTS is out
+  if (r->type == NCCL_NET_IB_REQ_RECV) NCCLCHECK(ncclIbFlushFifo((struct ncclIbRecvComm*)r->base));
   *done = 0;
   while (1) {
     if (r->events[0] == 0 && r->events[1] == 0) {
-      TRACE(NCCL_NET, "r=%p done", r);
       *done = 1;
-      if (sizes && r->type == NCCL_NET_IB_REQ_RECV) {
-        for (int i=0; i<r->nreqs; i++) sizes[i] = r->recv.sizes[i];
-      }
-      if (sizes && r->type == NCCL_NET_IB_REQ_SEND) {
-        sizes[0] = r->send.size;
-      }
-      NCCLCHECK(ncclIbFreeRequest(r));
-      return ncclSuccess;
+      return ncclIbRequestDone(r, sizes);
     }
 
     int totalWrDone = 0;
@@ -1892,57 +2761,7 @@ ncclResult_t ncclIbTest(void* request, int* done, int* sizes) {
         totalWrDone += wrDone;
         if (wrDone == 0) { TIME_CANCEL(3); } else { TIME_STOP(3); }
         if (wrDone == 0) continue;
-        for (int w=0; w<wrDone; w++) {
-          struct ibv_wc *wc = wcs+w;
-          if (wc->status != IBV_WC_SUCCESS) {
-            union ncclSocketAddress addr;
-            ncclSocketGetAddr(r->sock, &addr);
-            char localGidString[INET6_ADDRSTRLEN] = "";
-            char remoteGidString[INET6_ADDRSTRLEN] = "";
-            const char* localGidStr = NULL, *remoteGidStr = NULL;
-            if (r->devBases[i]->gidInfo.link_layer == IBV_LINK_LAYER_ETHERNET) {
-              localGidStr = inet_ntop(AF_INET6, &r->devBases[i]->gidInfo.localGid, localGidString, sizeof(localGidString));
-              remoteGidStr = inet_ntop(AF_INET6, &r->base->remDevs[i].remoteGid, remoteGidString, sizeof(remoteGidString));
-            }
-
-            char line[SOCKET_NAME_MAXLEN+1];
-            WARN("NET/IB : Got completion from peer %s with status=%d opcode=%d len=%d vendor err %d (%s)%s%s%s%s",
-                ncclSocketToString(&addr, line), wc->status, wc->opcode, wc->byte_len, wc->vendor_err, reqTypeStr[r->type],
-                localGidStr ?  " localGid ":"", localGidString, remoteGidStr ? " remoteGids":"", remoteGidString);
-            return ncclRemoteError;
-          }
-
-          union ncclSocketAddress addr;
-          ncclSocketGetAddr(r->sock, &addr);
-          struct ncclIbRequest* req = r->base->reqs+(wc->wr_id & 0xff);
-
-          #ifdef ENABLE_TRACE
-          char line[SOCKET_NAME_MAXLEN+1];
-          TRACE(NCCL_NET, "Got completion from peer %s with status=%d opcode=%d len=%d wr_id=%d r=%p type=%d events={%d,%d}, i=%d",
-              ncclSocketToString(&addr, line), wc->status, wc->opcode,wc->byte_len, wc->wr_id, req, req->type, req->events[0], req->events[1], i);
-          #endif
-          if (req->type == NCCL_NET_IB_REQ_SEND) {
-            for (int j = 0; j < req->nreqs; j++) {
-              struct ncclIbRequest* sendReq = r->base->reqs+((wc->wr_id >> (j*8)) & 0xff);
-              if ((sendReq->events[i] <= 0)) {
-                WARN("NET/IB: sendReq(%p)->events={%d,%d}, i=%d, j=%d <= 0", sendReq, sendReq->events[0], sendReq->events[1], i, j);
-                return ncclInternalError;
-              }
-              sendReq->events[i]--;
-            }
-          } else {
-            if (req && wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
-              if (req->type != NCCL_NET_IB_REQ_RECV) {
-                WARN("NET/IB: wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM and req->type=%d", req->type);
-                return ncclInternalError;
-              }
-              if (req->nreqs == 1) {
-                req->recv.sizes[0] = wc->imm_data;
-              }
-            }
-            req->events[i]--;
-          }
-        }
+        for (int w=0; w<wrDone; w++) NCCLCHECK(ncclIbCompletion(r, i, wcs+w));
       }
     }
 
@@ -1951,6 +2770,41 @@ ncclResult_t ncclIbTest(void* request, int* done, int* sizes) {
   }
 }
 
+// Completions polled per ibv_poll_cq call in ncclIbTestAll
+#define NCCL_IB_TEST_ALL_BATCH 64
+static uint64_t ncclIbTestAllEpoch;
+
+ncclResult_t ncclIbTestAll(int n, void** requests, int* done, int** sizes) {
+  for (int k = 0; k < n; k++) {
+    struct ncclIbRequest* r = (struct ncclIbRequest*)requests[k];
+    if (r->type == NCCL_NET_IB_REQ_RECV) NCCLCHECK(ncclIbFlushFifo((struct ncclIbRecvComm*)r->base));
+  }
+
+  // Drain each CQ once, whichever request it is reached through. Requests of the same
+  // comm share their CQs, and completions are accounted to the request they belong to.
+  uint64_t epoch = __atomic_add_fetch(&ncclIbTestAllEpoch, 1, __ATOMIC_RELAXED);
+  struct ibv_wc wcs[NCCL_IB_TEST_ALL_BATCH];
+  for (int k = 0; k < n; k++) {
+    struct ncclIbRequest* r = (struct ncclIbRequest*)requests[k];
+    for (int i = 0; i < NCCL_IB_MAX_DEVS_PER_NIC; i++) {
+      if (r->events[i] == 0 || r->devBases[i]->pollEpoch == epoch) continue;
+      r->devBases[i]->pollEpoch = epoch;
+      int wrDone;
+      do {
+        NCCLCHECK(wrap_ibv_poll_cq(r->devBases[i]->cq, NCCL_IB_TEST_ALL_BATCH, wcs, &wrDone));
+        for (int w=0; w<wrDone; w++) NCCLCHECK(ncclIbCompletion(r, i, wcs+w));
+      } while (wrDone == NCCL_IB_TEST_ALL_BATCH);
+    }
+  }
+
+  for (int k = 0; k < n; k++) {
+    struct ncclIbRequest* r = (struct ncclIbRequest*)requests[k];
+    done[k] = r->events[0] == 0 && r->events[1] == 0;
+    if (done[k]) NCCLCHECK(ncclIbRequestDone(r, sizes[k]));
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbCloseSend(void* sendComm) {
   struct ncclIbSendComm* comm = (struct ncclIbSendComm*)sendComm;
   if (comm) {
@@ -1965,6 +2819,8 @@ ncclResult_t ncclIbCloseSend(void* sendComm) {
       if (comm->remSizesFifo.mrs[i] != NULL) NCCLCHECK(wrap_ibv_dereg_mr(comm->remSizesFifo.mrs[i]));
       NCCLCHECK(ncclIbDestroyBase(&commDev->base));
     }
+    free(comm->qpStats);
+    free(comm->pacer);
     free(comm);
   }
   TIME_PRINT("IB");
@@ -1987,8 +2843,10 @@ ncclResult_t ncclIbCloseRecv(void* recvComm) {
       }
       if (commDev->fifoMr != NULL) NCCLCHECK(wrap_ibv_dereg_mr(commDev->fifoMr));
       if (commDev->sizesFifoMr != NULL) NCCLCHECK(wrap_ibv_dereg_mr(commDev->sizesFifoMr));
+      if (commDev->srq != NULL) NCCLCHECK(ncclIbSrqRelease(commDev->base.ibDevN));
       NCCLCHECK(ncclIbDestroyBase(&commDev->base));
     }
+    free(comm->srqPending);
     free(comm);
   }
   return ncclSuccess;
@@ -1998,6 +2856,7 @@ ncclResult_t ncclIbCloseListen(void* listenComm) {
   struct ncclIbListenComm* comm = (struct ncclIbListenComm*)listenComm;
   if (comm) {
     NCCLCHECK(ncclSocketClose(&comm->sock));
+    NCCLCHECK(ncclIbCloseRecv(comm->oobComm));
     free(comm);
   }
   return ncclSuccess;
@@ -2022,6 +2881,11 @@ ncclNet_t ncclNetIb = {
   ncclIbCloseRecv,
   ncclIbCloseListen,
   NULL /* getDeviceMr */,
-  NULL /* irecvConsumed */
+  NULL /* irecvConsumed */,
+  ncclIbGetMrDesc,
+  ncclIbIput,
+  ncclIbIget,
+  ncclIbIwaitSignal,
+  ncclIbTestAll
 };
 
@@ -15,6 +15,27 @@
 #include <poll.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE 47
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
 
 /* Init functions */
 static int ncclNetIfs = -1;
@@ -22,11 +43,45 @@ struct ncclNetSocketDev {
   union ncclSocketAddress addr;
   char devName[MAX_IF_NAME_SIZE];
   char* pciPath;
+  int minChunkSize; // Smallest task worth a socket, at least one GSO/TSO segment
 };
 static struct ncclNetSocketDev ncclNetSocketDevs[MAX_IFS];
 
+// A device as seen by NCCL. With NCCL_SOCKET_MERGE_NICS, interfaces of the
+// same family and speed are paired and the sockets of a connection are
+// striped over both.
+#define NCCL_SOCKET_MAX_DEVS_PER_NIC 2
+static int ncclNetSocketNDevs = 0;
+struct ncclNetSocketMergedDev {
+  int ndevs;
+  int devs[NCCL_SOCKET_MAX_DEVS_PER_NIC]; // Index in ncclNetSocketDevs
+  char devName[(MAX_IF_NAME_SIZE+1)*NCCL_SOCKET_MAX_DEVS_PER_NIC];
+};
+static struct ncclNetSocketMergedDev ncclNetSocketMergedDevs[MAX_IFS];
+
+NCCL_PARAM(SocketMergeNics, "SOCKET_MERGE_NICS", 0);
+
 pthread_mutex_t ncclNetSocketLock = PTHREAD_MUTEX_INITIALIZER;
 
+#define MIN_CHUNKSIZE (64*1024)
+
+// The kernel hands the NIC up to gso_max_size bytes at once (more with BIG TCP),
+// tasks smaller than that do not fill a segment.
+static ncclResult_t ncclNetSocketGetMinChunkSize(char* devName, int* minChunkSize) {
+  *minChunkSize = MIN_CHUNKSIZE;
+  char gsoPath[PATH_MAX];
+  snprintf(gsoPath, PATH_MAX, "/sys/class/net/%s/gso_max_size", devName);
+  int fd = open(gsoPath, O_RDONLY);
+  if (fd != -1) {
+    char gsoStr[16] = { 0 };
+    if (read(fd, gsoStr, sizeof(gsoStr)-1) > 0) {
+      *minChunkSize = std::max(*minChunkSize, (int)strtol(gsoStr, NULL, 0));
+    }
+    close(fd);
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t ncclNetSocketGetPciPath(char* devName, char** pciPath) {
   char devicePath[PATH_MAX];
   snprintf(devicePath, PATH_MAX, "/sys/class/net/%s/device", devName);
@@ -35,6 +90,22 @@ static ncclResult_t ncclNetSocketGetPciPath(char* devName, char** pciPath) {
   return ncclSuccess;
 }
 
+static ncclResult_t ncclNetSocketGetSpeed(char* devName, int* speed);
+
+static int ncclNetSocketFindMergedDev(int dev) {
+  int speed;
+  if (ncclNetSocketGetSpeed(ncclNetSocketDevs[dev].devName, &speed) != ncclSuccess) return ncclNetSocketNDevs;
+  for (int i=0; i<ncclNetSocketNDevs; i++) {
+    struct ncclNetSocketMergedDev* mergedDev = ncclNetSocketMergedDevs+i;
+    if (mergedDev->ndevs == NCCL_SOCKET_MAX_DEVS_PER_NIC) continue;
+    struct ncclNetSocketDev* compareDev = ncclNetSocketDevs+mergedDev->devs[0];
+    int compareSpeed;
+    if (ncclNetSocketGetSpeed(compareDev->devName, &compareSpeed) != ncclSuccess) continue;
+    if (compareDev->addr.sa.sa_family == ncclNetSocketDevs[dev].addr.sa.sa_family && compareSpeed == speed) return i;
+  }
+  return ncclNetSocketNDevs;
+}
+
 ncclResult_t ncclNetSocketInit(ncclDebugLogger_t logFunction) {
   if (ncclNetIfs == -1) {
     pthread_mutex_lock(&ncclNetSocketLock);
@@ -55,11 +126,31 @@ ncclResult_t ncclNetSocketInit(ncclDebugLogger_t logFunction) {
           strcpy(ncclNetSocketDevs[i].devName, names+i*MAX_IF_NAME_SIZE);
           memcpy(&ncclNetSocketDevs[i].addr, addrs+i, sizeof(union ncclSocketAddress));
           NCCLCHECK(ncclNetSocketGetPciPath(ncclNetSocketDevs[i].devName, &ncclNetSocketDevs[i].pciPath));
+          NCCLCHECK(ncclNetSocketGetMinChunkSize(ncclNetSocketDevs[i].devName, &ncclNetSocketDevs[i].minChunkSize));
           snprintf(line+strlen(line), MAX_LINE_LEN-strlen(line), " [%d]%s:%s", i, names+i*MAX_IF_NAME_SIZE,
               ncclSocketToString(&addrs[i], addrline));
+
+          int d = ncclParamSocketMergeNics() ? ncclNetSocketFindMergedDev(i) : ncclNetSocketNDevs;
+          struct ncclNetSocketMergedDev* mergedDev = ncclNetSocketMergedDevs+d;
+          if (d == ncclNetSocketNDevs) {
+            ncclNetSocketNDevs++;
+            mergedDev->ndevs = 0;
+            mergedDev->devName[0] = '\0';
+          } else {
+            strcat(mergedDev->devName, "+");
+          }
+          mergedDev->devs[mergedDev->ndevs++] = i;
+          strcat(mergedDev->devName, ncclNetSocketDevs[i].devName);
         }
         line[MAX_LINE_LEN] = '\0';
         INFO(NCCL_INIT|NCCL_NET,"NET/Socket : Using%s", line);
+        if (ncclNetSocketNDevs < ncclNetIfs) {
+          line[0] = '\0';
+          for (int d=0; d<ncclNetSocketNDevs; d++) {
+            snprintf(line+strlen(line), MAX_LINE_LEN-strlen(line), " [%d]%s", d, ncclNetSocketMergedDevs[d].devName);
+          }
+          INFO(NCCL_INIT|NCCL_NET,"NET/Socket : Merged devices%s", line);
+        }
       }
     }
     pthread_mutex_unlock(&ncclNetSocketLock);
@@ -68,7 +159,7 @@ ncclResult_t ncclNetSocketInit(ncclDebugLogger_t logFunction) {
 }
 
 ncclResult_t ncclNetSocketDevices(int* ndev) {
-  *ndev = ncclNetIfs;
+  *ndev = ncclNetSocketNDevs;
   return ncclSuccess;
 }
 
@@ -91,17 +182,32 @@ static ncclResult_t ncclNetSocketGetSpeed(char* devName, int* speed) {
   return ncclSuccess;
 }
 
+// Sum of the speeds of the interfaces of a merged device
+static ncclResult_t ncclNetSocketGetMergedSpeed(int dev, int* speed) {
+  struct ncclNetSocketMergedDev* mergedDev = ncclNetSocketMergedDevs+dev;
+  *speed = 0;
+  for (int i=0; i<mergedDev->ndevs; i++) {
+    int devSpeed;
+    NCCLCHECK(ncclNetSocketGetSpeed(ncclNetSocketDevs[mergedDev->devs[i]].devName, &devSpeed));
+    *speed += devSpeed;
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclNetSocketGetProperties(int dev, ncclNetProperties_t* props) {
-  props->name = ncclNetSocketDevs[dev].devName;
-  props->pciPath = ncclNetSocketDevs[dev].pciPath;
+  struct ncclNetSocketMergedDev* mergedDev = ncclNetSocketMergedDevs+dev;
+  props->name = mergedDev->devName;
+  props->pciPath = ncclNetSocketDevs[mergedDev->devs[0]].pciPath;
   props->guid = dev;
   props->ptrSupport = NCCL_PTR_HOST;
   props->regIsGlobal = 0;
-  NCCLCHECK(ncclNetSocketGetSpeed(props->name, &props->speed));
+  NCCLCHECK(ncclNetSocketGetMergedSpeed(dev, &props->speed));
   props->latency = 0; // Not set
   props->port = 0;
   props->maxComms = 65536;
   props->maxRecvs = 1;
+  // Data is received straight into the host-pinned buffers the GPU reads from,
+  // so the device unpack queue (NCCL_NET_DEVICE_UNPACK) would only add a gather pass.
   props->netDeviceType    = NCCL_NET_DEVICE_HOST;
   props->netDeviceVersion = NCCL_NET_DEVICE_INVALID_VERSION;
   return ncclSuccess;
@@ -109,13 +215,27 @@ ncclResult_t ncclNetSocketGetProperties(int dev, ncclNetProperties_t* props) {
 
 /* Communication functions */
 
-#define MAX_SOCKETS 64
-#define MAX_THREADS 16
+#define MAX_SOCKETS 128
+#define MAX_THREADS 32
 #define MAX_REQUESTS NCCL_NET_MAX_REQUESTS
-#define MIN_CHUNKSIZE (64*1024)
 
 NCCL_PARAM(SocketNsocksPerThread, "NSOCKS_PERTHREAD", -2);
 NCCL_PARAM(SocketNthreads, "SOCKET_NTHREADS", -2);
+NCCL_PARAM(SocketZeroCopy, "SOCKET_ZEROCOPY", 0);
+// Open one socket per NCCL_SOCKET_SPEED_PER_SOCK Gbps of link speed when the
+// number of sockets is auto-detected, 0 keeps the vendor defaults.
+NCCL_PARAM(SocketSpeedPerSock, "SOCKET_SPEED_PER_SOCK", 0);
+#define SOCKS_PER_THREAD_MAX 4
+// Helper threads block in poll() until one of their sockets is ready instead
+// of spinning over all of them.
+NCCL_PARAM(SocketPoll, "SOCKET_POLL", 0);
+// Data socket tuning, overridden by the ncclConfig_t socket* fields of the comm.
+// 0 leaves the kernel default. NCCL_SOCKET_BUFFSIZE=-2 sizes the buffers to the
+// link speed times NCCL_SOCKET_RTT us.
+NCCL_PARAM(SocketBusyPoll, "SOCKET_BUSY_POLL", 0);
+NCCL_PARAM(SocketPacingRate, "SOCKET_PACING_RATE", 0);
+NCCL_PARAM(SocketBuffSize, "SOCKET_BUFFSIZE", 0);
+NCCL_PARAM(SocketRtt, "SOCKET_RTT", 100);
 
 enum ncclNetSocketCommState {
   ncclNetSocketCommStateStart = 0,
@@ -133,10 +253,12 @@ struct ncclNetSocketCommStage {
 };
 
 struct ncclNetSocketHandle {
-  union ncclSocketAddress connectAddr;
+  union ncclSocketAddress connectAddrs[NCCL_SOCKET_MAX_DEVS_PER_NIC]; // One per interface of the listening device
   uint64_t magic; // random number to help debugging
+  int nDevs;
   int nSocks;
   int nThreads;
+  int minChunkSize; // Both sides must split messages into the same tasks
   struct ncclNetSocketCommStage stage;
 };
 
@@ -148,6 +270,9 @@ struct ncclNetSocketTask {
   int offset;
   int used;
   ncclResult_t result;
+  int zc;         // sent with MSG_ZEROCOPY
+  int sent;       // bytes handed to the kernel, offset is only set once they are released
+  uint32_t zcSeq; // zero-copy sends issued on the socket up to the end of this task
 };
 
 struct ncclNetSocketRequest {
@@ -177,50 +302,140 @@ struct ncclNetSocketThreadResources {
 };
 
 struct ncclNetSocketListenComm {
-  struct ncclSocket sock;
+  struct ncclSocket socks[NCCL_SOCKET_MAX_DEVS_PER_NIC];
+  int nDevs;
   struct ncclNetSocketCommStage stage;
   int nSocks;
   int nThreads;
+  int minChunkSize;
   int dev;
 };
 
+// Zero-copy state of a data socket. The kernel numbers each MSG_ZEROCOPY send
+// and reports ranges of numbers whose pages it no longer references.
+struct ncclNetSocketZc {
+  volatile int enabled;
+  uint32_t issued;
+  uint32_t completed;
+};
+
 struct ncclNetSocketComm {
   struct ncclSocket ctrlSock;
   struct ncclSocket socks[MAX_SOCKETS];
+  struct ncclNetSocketZc zc[MAX_SOCKETS];
   int dev;
   int cudaDev;
   int nSocks;
   int nThreads;
   int nextSock;
+  int minChunkSize;
   struct ncclNetSocketRequest requests[MAX_REQUESTS];
   pthread_t helperThread[MAX_THREADS];
   struct ncclNetSocketThreadResources threadResources[MAX_THREADS];
 };
 
+static ncclResult_t ncclNetSocketZcReap(struct ncclSocket* sock, struct ncclNetSocketZc* zc) {
+  while (zc->completed != zc->issued) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    // Reading the error queue never blocks
+    if (recvmsg(sock->fd, &msg, MSG_ERRQUEUE) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return ncclSuccess;
+      WARN("NET/Socket : recvmsg(MSG_ERRQUEUE) failed : %s", strerror(errno));
+      return ncclSystemError;
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) continue;
+      struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+      // Notifications cover [ee_info, ee_data] and are delivered in order on TCP
+      zc->completed = serr->ee_data + 1;
+      if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && zc->enabled) {
+        // The device could not send from our pages (e.g. loopback), pinning them only costs us
+        INFO(NCCL_NET, "NET/Socket : kernel copied zero-copy send on fd %d, disabling zero-copy on this socket", sock->fd);
+        zc->enabled = 0;
+      }
+    }
+  }
+  return ncclSuccess;
+}
+
+// Send with MSG_ZEROCOPY. The kernel sends from the user pages, so the task only
+// completes once the notifications for all of its sends have arrived.
+static ncclResult_t ncclNetSocketZcProgress(struct ncclNetSocketComm* comm, struct ncclNetSocketTask* r) {
+  struct ncclNetSocketZc* zc = comm->zc + (r->sock - comm->socks);
+  while (r->sent < r->size) {
+    ssize_t bytes = send(r->sock->fd, (char*)r->data+r->sent, r->size-r->sent, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (bytes > 0) {
+      r->sent += bytes;
+      r->zcSeq = ++zc->issued;
+      continue;
+    }
+    if (bytes == -1 && errno == EINTR) continue;
+    // ENOBUFS means too many pages are pinned, retry once notifications freed some
+    if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) break;
+    WARN("NET/Socket : zero-copy send failed : %s", strerror(errno));
+    return ncclRemoteError;
+  }
+  NCCLCHECK(ncclNetSocketZcReap(r->sock, zc));
+  if (r->sent == r->size && (int32_t)(zc->completed - r->zcSeq) >= 0) r->offset = r->size;
+  return ncclSuccess;
+}
+
+// Wait until one of the unfinished tasks can move, or for a short timeout since
+// zero-copy completions and peers closing do not always wake us.
+static void ncclNetSocketPollTasks(struct ncclNetSocketTask* tasks, int nTasks) {
+  struct pollfd fds[MAX_SOCKETS];
+  int nfds = 0;
+  for (int j=0; j<nTasks; j++) {
+    struct ncclNetSocketTask* r = tasks+j;
+    if (r->used != 1 || r->offset == r->size) continue;
+    fds[nfds].fd = r->sock->fd;
+    // Pending zero-copy notifications show up as POLLERR, which is always reported
+    fds[nfds].events = r->op == NCCL_SOCKET_RECV ? POLLIN : (r->zc && r->sent == r->size) ? 0 : POLLOUT;
+    fds[nfds].revents = 0;
+    nfds++;
+  }
+  if (nfds) (void)poll(fds, nfds, 1);
+}
+
 void* persistentSocketThread(void *args_) {
   struct ncclNetSocketThreadResources* resource = (struct ncclNetSocketThreadResources*)args_;
   struct ncclNetSocketComm* comm = resource->comm;
   struct ncclNetSocketTaskQueue* myQueue = &resource->threadTaskQueue;
   int nSocksPerThread = comm->nSocks / comm->nThreads;
+  int usePoll = ncclParamSocketPoll();
   while (1) {
     int idle = 1;
     int mark = myQueue->next; // mark newest task seen
     for (int i=0; i<myQueue->len; i+=nSocksPerThread) {
-      int repeat;
+      int repeat, moved;
       do {
-        repeat = 0;
+        repeat = moved = 0;
         for (int j=0; j<nSocksPerThread; j++) {
           struct ncclNetSocketTask* r = myQueue->tasks+i+j;
           if (r != NULL && r->used == 1 && r->offset < r->size) {
-            r->result = ncclSocketProgress(r->op, r->sock, r->data, r->size, &r->offset);
+            int offset = r->offset, sent = r->sent;
+            if (r->zc) {
+              r->result = ncclNetSocketZcProgress(comm, r);
+            } else {
+              r->result = ncclSocketProgress(r->op, r->sock, r->data, r->size, &r->offset);
+            }
             if (r->result != ncclSuccess) {
               WARN("NET/Socket : socket progress error");
               return NULL;
             }
             idle = 0;
-            if (r->offset < r->size) repeat = 1;
+            if (r->offset != offset || r->sent != sent) moved = 1;
+            // Tasks waiting for zero-copy notifications are polled again on the next pass
+            if ((r->zc ? r->sent : r->offset) < r->size) repeat = 1;
           }
         }
+        if (repeat && !moved && usePoll) ncclNetSocketPollTasks(myQueue->tasks+i, nSocksPerThread);
       } while (repeat);
     }
     if (idle) {
@@ -245,7 +460,7 @@ ncclResult_t ncclNetSocketGetNsockNthread(int dev, int* ns, int* nt) {
     // Auto-detection
     int autoNt=0, autoNs=1; // By default, we only use the main thread and do not spawn extra threads
     char vendorPath[PATH_MAX];
-    snprintf(vendorPath, PATH_MAX, "/sys/class/net/%s/device/vendor", ncclNetSocketDevs[dev].devName);
+    snprintf(vendorPath, PATH_MAX, "/sys/class/net/%s/device/vendor", ncclNetSocketDevs[ncclNetSocketMergedDevs[dev].devs[0]].devName);
     char* rPath = realpath(vendorPath, NULL);
     int fd = open(rPath, O_RDONLY);
     free(rPath);
@@ -268,6 +483,20 @@ ncclResult_t ncclNetSocketGetNsockNthread(int dev, int* ns, int* nt) {
       autoNs = 1;
     }
 end:
+    if (ncclParamSocketSpeedPerSock() > 0) {
+      int speed;
+      NCCLCHECK(ncclNetSocketGetMergedSpeed(dev, &speed));
+      int nSocks = std::min<int64_t>(MAX_SOCKETS, DIVUP(speed, ncclParamSocketSpeedPerSock()*1000));
+      if (nSocks > autoNt*autoNs) {
+        autoNt = std::min(MAX_THREADS, DIVUP(nSocks, SOCKS_PER_THREAD_MAX));
+        autoNs = nSocks/autoNt;
+      }
+    }
+    // A merged device needs at least one data socket per interface
+    if (autoNt*autoNs < ncclNetSocketMergedDevs[dev].ndevs) {
+      autoNt = ncclNetSocketMergedDevs[dev].ndevs;
+      autoNs = 1;
+    }
     if (nThreads == -2) nThreads = autoNt;
     if (nSocksPerThread == -2) nSocksPerThread = autoNs;
   }
@@ -284,28 +513,82 @@ end:
 }
 
 ncclResult_t ncclNetSocketListen(int dev, void* opaqueHandle, void** listenComm) {
-  if (dev < 0 || dev >= ncclNetIfs) { // data transfer socket is based on specified dev
+  if (dev < 0 || dev >= ncclNetSocketNDevs) { // data transfer socket is based on specified dev
     return ncclInternalError;
   }
   struct ncclNetSocketHandle* handle = (struct ncclNetSocketHandle*) opaqueHandle;
   memset(handle, 0, sizeof(struct ncclNetSocketHandle));
-  static_assert(sizeof(struct ncclNetSocketHandle) <= NCCL_NET_HANDLE_MAXSIZE, "ncclNetSocketHandle size too large");
+  static_assert(sizeof(struct ncclNetSocketHandle) <= NCCL_NET_HANDLE_POOL_OFFSET, "ncclNetSocketHandle size too large");
   struct ncclNetSocketListenComm* comm;
   NCCLCHECK(ncclCalloc(&comm, 1));
   handle->magic = NCCL_SOCKET_MAGIC;
-  NCCLCHECK(ncclSocketInit(&comm->sock, &ncclNetSocketDevs[dev].addr, handle->magic, ncclSocketTypeNetSocket, NULL, 1));
-  NCCLCHECK(ncclSocketListen(&comm->sock));
-  NCCLCHECK(ncclSocketGetAddr(&comm->sock, &handle->connectAddr));
+  // Listen on every interface of the device, the control socket uses the first one
+  struct ncclNetSocketMergedDev* mergedDev = ncclNetSocketMergedDevs+dev;
+  comm->minChunkSize = 0;
+  for (int d=0; d<mergedDev->ndevs; d++) {
+    struct ncclNetSocketDev* netDev = ncclNetSocketDevs+mergedDev->devs[d];
+    NCCLCHECK(ncclSocketInit(comm->socks+d, &netDev->addr, handle->magic, ncclSocketTypeNetSocket, NULL, 1));
+    NCCLCHECK(ncclNetSocketSetBuffers(comm->socks+d, mergedDev->devs[d]));
+    NCCLCHECK(ncclSocketListen(comm->socks+d));
+    NCCLCHECK(ncclSocketGetAddr(comm->socks+d, handle->connectAddrs+d));
+    comm->minChunkSize = std::max(comm->minChunkSize, netDev->minChunkSize);
+  }
+  handle->nDevs = comm->nDevs = mergedDev->ndevs;
   NCCLCHECK(ncclNetSocketGetNsockNthread(dev, &comm->nSocks, &comm->nThreads));
   handle->nSocks = comm->nSocks;
   handle->nThreads = comm->nThreads;
+  handle->minChunkSize = comm->minChunkSize;
   comm->dev = dev;
   *listenComm = comm;
   return ncclSuccess;
 }
 
+// Mark the packets of a connected socket with the traffic class of the comm
+// being connected, if it has one.
+static void ncclNetSocketSetQos(struct ncclSocket* sock) {
+  int tc = ncclNetQosCurrent.trafficClass;
+  if (tc < 0) return;
+  int ret = sock->addr.sa.sa_family == AF_INET6 ?
+    setsockopt(sock->fd, IPPROTO_IPV6, IPV6_TCLASS, &tc, sizeof(tc)) :
+    setsockopt(sock->fd, IPPROTO_IP, IP_TOS, &tc, sizeof(tc));
+  if (ret != 0) INFO(NCCL_NET, "NET/Socket : could not set traffic class %d : %s", tc, strerror(errno));
+}
+
+static void ncclNetSocketSetOpt(struct ncclSocket* sock, int level, int name, const char* str, int value) {
+  if (setsockopt(sock->fd, level, name, &value, sizeof(value)) != 0)
+    INFO(NCCL_NET, "NET/Socket : could not set %s to %d : %s", str, value, strerror(errno));
+}
+
+// Buffer sizes must be set before connect() or listen() to size the TCP window.
+// dev is an interface, not a merged device.
+static ncclResult_t ncclNetSocketSetBuffers(struct ncclSocket* sock, int dev) {
+  int buffSize = ncclNetQosCurrent.socketBuffSize >= 0 || ncclNetQosCurrent.socketBuffSize == -2 ?
+    ncclNetQosCurrent.socketBuffSize : ncclParamSocketBuffSize();
+  if (buffSize == -2) {
+    int speed;
+    NCCLCHECK(ncclNetSocketGetSpeed(ncclNetSocketDevs[dev].devName, &speed));
+    buffSize = std::min<int64_t>(INT_MAX/2, (int64_t)speed*ncclParamSocketRtt()/8); // Mbps * us / 8 = bytes
+  }
+  if (buffSize <= 0) return ncclSuccess;
+  ncclNetSocketSetOpt(sock, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", buffSize);
+  ncclNetSocketSetOpt(sock, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", buffSize);
+  return ncclSuccess;
+}
+
+static void ncclNetSocketSetTuning(struct ncclSocket* sock) {
+  int busyPoll = ncclNetQosCurrent.socketBusyPoll >= 0 ? ncclNetQosCurrent.socketBusyPoll : ncclParamSocketBusyPoll();
+  int pacingRate = ncclNetQosCurrent.socketPacingRate >= 0 ? ncclNetQosCurrent.socketPacingRate : ncclParamSocketPacingRate();
+  if (busyPoll > 0) ncclNetSocketSetOpt(sock, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", busyPoll);
+  if (pacingRate > 0) {
+    // Bytes per second, in 32 bits
+    uint32_t rate = std::min<uint64_t>(UINT_MAX, (uint64_t)pacingRate*1000000);
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) != 0)
+      INFO(NCCL_NET, "NET/Socket : could not set SO_MAX_PACING_RATE to %u : %s", rate, strerror(errno));
+  }
+}
+
 ncclResult_t ncclNetSocketConnect(int dev, void* opaqueHandle, void** sendComm, ncclNetDeviceHandle_t** /*sendDevComm*/) {
-  if (dev < 0 || dev >= ncclNetIfs) { // data transfer socket is based on specified dev
+  if (dev < 0 || dev >= ncclNetSocketNDevs) { // data transfer socket is based on specified dev
     return ncclInternalError;
   }
 
@@ -325,10 +608,18 @@ ncclResult_t ncclNetSocketConnect(int dev, void* opaqueHandle, void** sendComm,
   comm->nSocks = handle->nSocks;
   comm->nThreads = handle->nThreads;
   comm->dev = dev;
+  comm->minChunkSize = handle->minChunkSize;
   CUDACHECK(cudaGetDevice(&comm->cudaDev));
   for (; i<comm->nSocks+1; i++) {
+    // Data sockets go round-robin over the interfaces of the remote device.
+    // The listener accepts them in the same order.
     sock = (i == comm->nSocks) ? &comm->ctrlSock : comm->socks+i;
-    NCCLCHECK(ncclSocketInit(sock, &handle->connectAddr, handle->magic, ncclSocketTypeNetSocket, NULL, 1));
+    union ncclSocketAddress* addr = handle->connectAddrs + (i == comm->nSocks ? 0 : i % handle->nDevs);
+    NCCLCHECK(ncclSocketInit(sock, addr, handle->magic, ncclSocketTypeNetSocket, NULL, 1));
+    if (i < comm->nSocks) {
+      struct ncclNetSocketMergedDev* mergedDev = ncclNetSocketMergedDevs+dev;
+      NCCLCHECK(ncclNetSocketSetBuffers(sock, mergedDev->devs[i % mergedDev->ndevs]));
+    }
 
     stage->sock = sock;
     stage->state = ncclNetSocketCommStateConnect;
@@ -339,6 +630,16 @@ socket_connect_check:
     NCCLCHECK(ncclSocketReady(sock, &ready));
     if (! ready) return ncclSuccess;
     stage->state = ncclNetSocketCommStateSend;
+    ncclNetSocketSetQos(sock);
+    if (i < comm->nSocks) ncclNetSocketSetTuning(sock);
+    if (i < comm->nSocks && ncclParamSocketZeroCopy()) {
+      int one = 1;
+      if (setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        comm->zc[i].enabled = 1;
+      } else {
+        INFO(NCCL_NET, "NET/Socket : could not enable SO_ZEROCOPY : %s", strerror(errno));
+      }
+    }
 
 socket_send:
     int done = 0;
@@ -366,6 +667,7 @@ ncclResult_t ncclNetSocketAccept(void* listenComm, void** recvComm, ncclNetDevic
   rComm->nSocks = lComm->nSocks;
   rComm->nThreads = lComm->nThreads;
   rComm->dev = lComm->dev;
+  rComm->minChunkSize = lComm->minChunkSize;
   CUDACHECK(cudaGetDevice(&rComm->cudaDev));
   for (; i<rComm->nSocks+1; i++) {
     uint8_t sendSockIdx;
@@ -375,22 +677,25 @@ ncclResult_t ncclNetSocketAccept(void* listenComm, void** recvComm, ncclNetDevic
     stage->sock = sock;
     stage->state = ncclNetSocketCommStateAccept;
     stage->iteration = i;
-    NCCLCHECK(ncclSocketAccept(sock, &lComm->sock));
+    NCCLCHECK(ncclSocketAccept(sock, lComm->socks + (i == rComm->nSocks ? 0 : i % lComm->nDevs)));
 
 socket_accept_check:
     NCCLCHECK(ncclSocketReady(sock, &ready));
     if (!ready) return ncclSuccess;
 
     stage->state = ncclNetSocketCommStateRecv;
+    ncclNetSocketSetQos(sock);
 socket_recv:
     int done = 0;
     NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_RECV, sock, &sendSockIdx, sizeof(uint8_t), &done));
     if (done == 0) return ncclSuccess;
 
-    if (sendSockIdx == rComm->nSocks)
+    if (sendSockIdx == rComm->nSocks) {
       memcpy(&rComm->ctrlSock, sock, sizeof(struct ncclSocket));
-    else
+    } else {
+      ncclNetSocketSetTuning(sock);
       memcpy(rComm->socks+sendSockIdx, sock, sizeof(struct ncclSocket));
+    }
     free(sock);
   }
   *recvComm = rComm;
@@ -448,6 +753,8 @@ ncclResult_t ncclNetSocketGetTask(struct ncclNetSocketComm* comm, int op, void*
     r->sock = comm->socks + comm->nextSock;
     r->offset = 0;
     r->result = ncclSuccess;
+    r->zc = op == NCCL_SOCKET_SEND && size >= comm->minChunkSize && comm->zc[comm->nextSock].enabled;
+    r->sent = 0;
     comm->nextSock = (comm->nextSock + 1) % comm->nSocks;
     r->used = 1;
     *req = r;
@@ -495,7 +802,7 @@ ncclResult_t ncclNetSocketTest(void* request, int* done, int* size) {
     int chunkOffset = 0, i = 0;
     if (r->comm->nSocks > 0) {
       // each request can be divided up to nSocks tasks
-      int taskSize = std::max(MIN_CHUNKSIZE, DIVUP(r->size, r->comm->nSocks));
+      int taskSize = std::max(r->comm->minChunkSize, DIVUP(r->size, r->comm->nSocks));
       while (chunkOffset < r->size) {
         int chunkSize = std::min(taskSize, r->size-chunkOffset);
         NCCLCHECK(ncclNetSocketGetTask(r->comm, r->op, (char*)(r->data)+chunkOffset, chunkSize, r->tasks+i++));
@@ -561,9 +868,11 @@ ncclResult_t ncclNetSocketIflush(void* recvComm, int n, void** data, int* sizes,
 ncclResult_t ncclNetSocketCloseListen(void* opaqueComm) {
   struct ncclNetSocketListenComm* comm = (struct ncclNetSocketListenComm*)opaqueComm;
   if (comm) {
-    int ready;
-    NCCLCHECK(ncclSocketReady(&comm->sock, &ready));
-    if (ready) NCCLCHECK(ncclSocketClose(&comm->sock));
+    for (int d=0; d<comm->nDevs; d++) {
+      int ready;
+      NCCLCHECK(ncclSocketReady(comm->socks+d, &ready));
+      if (ready) NCCLCHECK(ncclSocketClose(comm->socks+d));
+    }
     free(comm);
   }
   return ncclSuccess;
@@ -614,5 +923,10 @@ ncclNet_t ncclNetSocket = {
   ncclNetSocketClose,
   ncclNetSocketCloseListen,
   NULL /* getDeviceMr */,
-  NULL /* irecvConsumed */
+  NULL /* irecvConsumed */,
+  NULL /* getMrDesc */,
+  NULL /* iput */,
+  NULL /* iget */,
+  NULL /* iwaitSignal */,
+  NULL /* testAll */
 };
@@ -150,6 +150,7 @@ ncclResult_t nvlsGroupBindMem(struct ncclComm *comm, struct ncclNvlsSharedRes* r
   CUCHECK(cuMemSetAccess(ptr, size, &resources->accessDesc, 1));
   CUDACHECK(cudaMemset((void*)ptr, 0, size));
   resources->ucBuff = (char*)ptr;
+  ncclMemTrack(resources->ucBuff, size, 0);
   INFO(NCCL_NVLS, "NVLS Mapped UC at %p size %zi", resources->ucBuff, size);
 
   // Bind physical memory to the Multicast group
@@ -207,6 +208,7 @@ ncclResult_t nvlsGroupUnmapMem(struct ncclComm *comm, struct ncclNvlsSharedRes*
        resources->ucHandle, resources->ucBuff, resources->mcHandle, resources->mcBuff);
 
   // Release the UC memory and mapping
+  ncclMemUntrack(resources->ucBuff);
   ptr = (CUdeviceptr)resources->ucBuff;
   size = resources->size;
   CUCHECK(cuMemUnmap(ptr, size));
@@ -260,21 +262,132 @@ ncclResult_t ncclNvlsInit(struct ncclComm* comm) {
   return ncclSuccess;
 }
 
+// Allocate the NVLS buffers of all channels and bind them to a new multicast
+// object. With runtime connection, this waits for the first collective which
+// may run an NVLS algorithm, as the buffers take a lot of device memory.
+static ncclResult_t nvlsAllocBuffers(struct ncclComm* comm) {
+  struct ncclNvlsSharedRes* resources = comm->nvlsResources;
+  int nHeads = comm->channels[0].nvls.nHeads;
+  int headRank = comm->channels[0].nvls.headRank;
+  int nChannels = comm->nChannels;
+  ncclResult_t res = ncclSuccess;
+  CUdevice dev;
+  CUCHECK(cuCtxGetDevice(&dev));
+
+  int nvlsStepSize = comm->nvlsChunkSize;
+  size_t buffSize = nvlsStepSize * NCCL_STEPS;
+  size_t memSize = NVLS_MEM_ALIGN_SIZE;
+  size_t nvlsPerRankSize = nChannels * 2 * (buffSize + memSize);
+  size_t nvlsTotalSize = nvlsPerRankSize * nHeads;
+
+  INFO(NCCL_INIT | NCCL_NVLS, "NVLS comm %p headRank %d nHeads %d buffSize %zi memSize %zi nvlsPerRankSize %zi nvlsTotalSize %zi",
+    comm, headRank, nHeads, buffSize, memSize, nvlsPerRankSize, nvlsTotalSize);
+
+  char* shareableHandle = resources->shareableHandle;
+  NCCLCHECKGOTO(nvlsGetProperties(comm, resources, dev, nvlsTotalSize), res, fail);
+  if (comm->localRank == 0) {
+    NCCLCHECKGOTO(nvlsGroupCreate(comm, &resources->properties, comm->localRank, comm->localRanks, &resources->mcHandle, shareableHandle), res, fail);
+    NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, 0, shareableHandle, NVLS_HANDLE_SIZE), res, fail);
+  } else {
+    NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, 0, shareableHandle, NVLS_HANDLE_SIZE), res, fail);
+    NCCLCHECKGOTO(nvlsGroupConnect(comm, shareableHandle, comm->localRankToRank[0], &resources->mcHandle), res, fail);
+  }
+
+  NCCLCHECKGOTO(nvlsGroupAddDevice(comm, resources), res, fail);
+  { ncclMemScope memScope(&comm->memStats, ncclMemNvls, NCCL_STATS_TRANSPORT_NVLS);
+    NCCLCHECKGOTO(nvlsGroupBindMem(comm, resources), res, fail);
+  }
+  if (comm->localRanks > 1) {
+    // Local intra-node barrier to ensure everyone has bound their memory to the group
+    NCCLCHECKGOTO(bootstrapIntraNodeBarrier(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, comm->localRankToRank[0]), res, fail);
+  }
+  if (comm->MNNVL) {
+    // MNNVL: Clique wide barrier to ensure everyone has bound their memory to the group
+    NCCLCHECKGOTO(bootstrapIntraNodeBarrier(comm->bootstrap, comm->clique.ranks, comm->cliqueRank, comm->clique.size, comm->clique.ranks[0]), res, fail);
+  }
+  NCCLCHECKGOTO(nvlsGroupMapMem(comm, resources), res, fail);
+
+  for (int h = 0; h < nHeads; h++) {
+    int nvlsPeer = comm->nRanks + 1 + h;
+    for (int c = 0; c < nChannels; c++) {
+      struct ncclChannel* channel = comm->channels + c;
+      char* mem = NULL;
+      struct ncclChannelPeer* peer = channel->peers[nvlsPeer];
+
+      // Reduce UC -> MC
+      mem = resources->ucBuff + (h * 2 * nChannels + c) * (buffSize + memSize);
+      peer->send[1].transportComm = &nvlsTransport.send;
+      peer->send[1].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
+      peer->send[1].conn.head = (uint64_t*)(mem + buffSize);
+      peer->send[1].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
+      peer->send[1].conn.stepSize = nvlsStepSize;
+      mem = resources->mcBuff + (h * 2 * nChannels + c) * (buffSize + memSize);
+      peer->recv[0].transportComm = &nvlsTransport.recv;
+      peer->recv[0].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
+      peer->recv[0].conn.head = (uint64_t*)(mem + buffSize);
+      peer->recv[0].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
+      peer->recv[0].conn.stepSize = nvlsStepSize;
+      peer->recv[0].conn.flags |= NCCL_NVLS_MIN_POLL;
+
+      // Broadcast MC -> UC
+      mem = resources->ucBuff + ((h * 2 + 1) * nChannels + c) * (buffSize + memSize);
+      peer->recv[1].transportComm = &nvlsTransport.recv;
+      peer->recv[1].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
+      peer->recv[1].conn.head = (uint64_t*)(mem + buffSize);
+      peer->recv[1].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
+      peer->recv[1].conn.stepSize = nvlsStepSize;
+      mem = resources->mcBuff + ((h * 2 + 1) * nChannels + c) * (buffSize + memSize);
+      peer->send[0].transportComm = &nvlsTransport.send;
+      peer->send[0].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
+      peer->send[0].conn.head = (uint64_t*)(mem + buffSize);
+      peer->send[0].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
+      peer->send[0].conn.stepSize = nvlsStepSize;
+      peer->send[0].conn.flags |= NCCL_NVLS_MIN_POLL;
+
+      CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->send[0], &peer->send[0].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, fail);
+      CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->recv[0], &peer->recv[0].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, fail);
+      CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->send[1], &peer->send[1].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, fail);
+      CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->recv[1], &peer->recv[1].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, fail);
+
+      /*INFO(NCCL_INIT|NCCL_NVLS, "Peer %d Channel %d MC buff %p/%p UC Buff %p/%p",
+          nvlsPeer, c,
+          resources->mcBuff + (h*2*nChannels+c)*(buffSize+memSize),
+          resources->mcBuff + ((h*2+1)*nChannels+c)*(buffSize+memSize),
+          resources->ucBuff + (h*2*nChannels+c)*(buffSize+memSize),
+          resources->ucBuff + ((h*2+1)*nChannels+c)*(buffSize+memSize));*/
+    }
+  }
+  comm->collConnected[NCCL_ALGO_NVLS] = comm->collConnected[NCCL_ALGO_NVLS_TREE] = true;
+  comm->collNeedConnect[NCCL_ALGO_NVLS] = comm->collNeedConnect[NCCL_ALGO_NVLS_TREE] = false;
+fail:
+  return res;
+}
+
+ncclResult_t ncclNvlsConnect(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  if (!comm->collNeedConnect[NCCL_ALGO_NVLS] && !comm->collNeedConnect[NCCL_ALGO_NVLS_TREE]) return ncclSuccess;
+  // Connection info is copied on the host stream, which kernels then wait for
+  NCCLCHECK(ncclStrongStreamAcquireUncaptured(&comm->sharedRes->hostStream));
+  NCCLCHECKGOTO(nvlsAllocBuffers(comm), ret, exit);
+exit:
+  NCCLCHECK(ncclStrongStreamWaitStream(ncclCudaGraphNone(), &comm->sharedRes->deviceStream, &comm->sharedRes->hostStream));
+  NCCLCHECK(ncclStrongStreamRelease(ncclCudaGraphNone(), &comm->sharedRes->hostStream));
+  return ret;
+}
+
 ncclResult_t ncclNvlsSetup(struct ncclComm* comm, struct ncclComm* parent) {
   if (comm->nvlsSupport == 0 || comm->nvlsChannels == 0) return ncclSuccess;
 
-  int nHeads = comm->channels[0].nvls.nHeads;
-  int headRank = comm->channels[0].nvls.headRank;
   char shmPath[sizeof("/dev/shm/nccl-XXXXXX")];
   uintptr_t *nvlsShmem = NULL;
   size_t typeSize;
 
-  CUdevice dev;
-  CUCHECK(cuCtxGetDevice(&dev));
-
   ncclResult_t res = ncclSuccess;
   bool nvlsShare = true;
-  if (parent && parent->nvlsSupport && parent->config.splitShare && parent->localRanks == comm->localRanks)
+  comm->nvlsChunkSize = ncclParamNvlsChunkSize();
+  // Parents whose buffers are still to be allocated at runtime have nothing to share yet.
+  if (parent && parent->nvlsSupport && parent->config.splitShare && parent->localRanks == comm->localRanks &&
+      parent->nvlsResources->mcBuff != NULL)
     nvlsShare = true;
   else
     nvlsShare = false;
@@ -307,91 +420,21 @@ ncclResult_t ncclNvlsSetup(struct ncclComm* comm, struct ncclComm* parent) {
       NCCLCHECK(initNvlsChannel(comm, c, parent, false));
     }
 
-    int nvlsStepSize = comm->nvlsChunkSize = ncclParamNvlsChunkSize();
-    size_t buffSize = nvlsStepSize * NCCL_STEPS;
-    size_t memSize = NVLS_MEM_ALIGN_SIZE;
-    size_t nvlsPerRankSize = nChannels * 2 * (buffSize + memSize);
-    size_t nvlsTotalSize = nvlsPerRankSize * nHeads;
-
-    INFO(NCCL_INIT | NCCL_NVLS, "NVLS comm %p headRank %d nHeads %d buffSize %zi memSize %zi nvlsPerRankSize %zi nvlsTotalSize %zi",
-      comm, headRank, nHeads, buffSize, memSize, nvlsPerRankSize, nvlsTotalSize);
-
-    char* shareableHandle = resources->shareableHandle;
-    NCCLCHECKGOTO(nvlsGetProperties(comm, resources, dev, nvlsTotalSize), res, cleanup);
-    if (comm->localRank == 0) {
-      NCCLCHECKGOTO(nvlsGroupCreate(comm, &resources->properties, comm->localRank, comm->localRanks, &resources->mcHandle, shareableHandle), res, cleanup);
-      NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, 0, shareableHandle, NVLS_HANDLE_SIZE), res, cleanup);
+    if (comm->runtimeConn) {
+      comm->collConnected[NCCL_ALGO_NVLS] = comm->collConnected[NCCL_ALGO_NVLS_TREE] = false;
+      INFO(NCCL_INIT | NCCL_NVLS, "NVLS buffers will be allocated at runtime");
     } else {
-      NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, 0, shareableHandle, NVLS_HANDLE_SIZE), res, cleanup);
-      NCCLCHECKGOTO(nvlsGroupConnect(comm, shareableHandle, comm->localRankToRank[0], &resources->mcHandle), res, cleanup);
-    }
-
-    NCCLCHECKGOTO(nvlsGroupAddDevice(comm, resources), res, cleanup);
-    NCCLCHECKGOTO(nvlsGroupBindMem(comm, resources), res, cleanup);
-    if (comm->localRanks > 1) {
-      // Local intra-node barrier to ensure everyone has bound their memory to the group
-      NCCLCHECKGOTO(bootstrapIntraNodeBarrier(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, comm->localRankToRank[0]), res, cleanup);
-    }
-    if (comm->MNNVL) {
-      // MNNVL: Clique wide barrier to ensure everyone has bound their memory to the group
-      NCCLCHECKGOTO(bootstrapIntraNodeBarrier(comm->bootstrap, comm->clique.ranks, comm->cliqueRank, comm->clique.size, comm->clique.ranks[0]), res, cleanup);
-    }
-    NCCLCHECKGOTO(nvlsGroupMapMem(comm, resources), res, cleanup);
-
-    for (int h = 0; h < nHeads; h++) {
-      int nvlsPeer = comm->nRanks + 1 + h;
-      for (int c = 0; c < nChannels; c++) {
-        struct ncclChannel* channel = comm->channels + c;
-        char* mem = NULL;
-        struct ncclChannelPeer* peer = channel->peers[nvlsPeer];
-
-        // Reduce UC -> MC
-        mem = resources->ucBuff + (h * 2 * nChannels + c) * (buffSize + memSize);
-        peer->send[1].transportComm = &nvlsTransport.send;
-        peer->send[1].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
-        peer->send[1].conn.head = (uint64_t*)(mem + buffSize);
-        peer->send[1].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
-        peer->send[1].conn.stepSize = nvlsStepSize;
-        mem = resources->mcBuff + (h * 2 * nChannels + c) * (buffSize + memSize);
-        peer->recv[0].transportComm = &nvlsTransport.recv;
-        peer->recv[0].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
-        peer->recv[0].conn.head = (uint64_t*)(mem + buffSize);
-        peer->recv[0].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
-        peer->recv[0].conn.stepSize = nvlsStepSize;
-        peer->recv[0].conn.flags |= NCCL_NVLS_MIN_POLL;
-
-        // Broadcast MC -> UC
-        mem = resources->ucBuff + ((h * 2 + 1) * nChannels + c) * (buffSize + memSize);
-        peer->recv[1].transportComm = &nvlsTransport.recv;
-        peer->recv[1].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
-        peer->recv[1].conn.head = (uint64_t*)(mem + buffSize);
-        peer->recv[1].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
-        peer->recv[1].conn.stepSize = nvlsStepSize;
-        mem = resources->mcBuff + ((h * 2 + 1) * nChannels + c) * (buffSize + memSize);
-        peer->send[0].transportComm = &nvlsTransport.send;
-        peer->send[0].conn.buffs[NCCL_PROTO_SIMPLE] = mem;
-        peer->send[0].conn.head = (uint64_t*)(mem + buffSize);
-        peer->send[0].conn.tail = (uint64_t*)(mem + buffSize + memSize / 2);
-        peer->send[0].conn.stepSize = nvlsStepSize;
-        peer->send[0].conn.flags |= NCCL_NVLS_MIN_POLL;
-
-        CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->send[0], &peer->send[0].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, cleanup);
-        CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->recv[0], &peer->recv[0].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, cleanup);
-        CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->send[1], &peer->send[1].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, cleanup);
-        CUDACHECKGOTO(cudaMemcpyAsync(&comm->channels[c].devPeersHostPtr[nvlsPeer]->recv[1], &peer->recv[1].conn, sizeof(struct ncclConnInfo), cudaMemcpyHostToDevice, comm->sharedRes->hostStream.cudaStream), res, cleanup);
-
-        /*INFO(NCCL_INIT|NCCL_NVLS, "Peer %d Channel %d MC buff %p/%p UC Buff %p/%p",
-            nvlsPeer, c,
-            resources->mcBuff + (h*2*nChannels+c)*(buffSize+memSize),
-            resources->mcBuff + ((h*2+1)*nChannels+c)*(buffSize+memSize),
-            resources->ucBuff + (h*2*nChannels+c)*(buffSize+memSize),
-            resources->ucBuff + ((h*2+1)*nChannels+c)*(buffSize+memSize));*/
-      }
+      NCCLCHECKGOTO(nvlsAllocBuffers(comm), res, cleanup);
     }
   }
 
-  // MNNVL does not support NVLS buffer registration
-  if (comm->MNNVL) return res;
+  // MNNVL: local ranks span several hosts and exchange registration data
+  // through bootstrap (see nvlsAllgather), there is no shared memory segment.
+  if (comm->MNNVL) {
+    // ncclReg keeps one address per local rank
+    if (comm->localRanks > NCCL_MAX_LOCAL_RANKS) comm->nvlsRegSupport = 0;
+    return res;
+  }
 
   /* create shared memory for fast NVLS buffer registration */
   typeSize = sizeof(struct localRegData) << 1;
@@ -425,14 +468,25 @@ ncclResult_t ncclNvlsFree(struct ncclComm* comm) {
 
   if (ncclAtomicRefCountDecrement(&resources->refCount) == 0) {
     NCCLCHECK(ncclShmClose(resources->nvlsShmemHandle));
-    NCCLCHECK(nvlsGroupUnbind(comm, resources));
-    NCCLCHECK(nvlsGroupUnmapMem(comm, resources));
+    if (resources->mcBuff != NULL) {
+      NCCLCHECK(nvlsGroupUnbind(comm, resources));
+      NCCLCHECK(nvlsGroupUnmapMem(comm, resources));
+    }
     free(resources);
     comm->nvlsResources = NULL;
   }
   return ncclSuccess;
 }
 
+// Allgather among local ranks of the registration data at recvbuff+localRank*typeSize
+static ncclResult_t nvlsAllgather(struct ncclComm* comm, void* sendbuff, void* recvbuff, size_t typeSize) {
+  if (!comm->MNNVL) return ncclShmemAllgather(comm, &comm->nvlsResources->nvlsShmem, sendbuff, recvbuff, typeSize);
+  char* mine = (char*)recvbuff + comm->localRank*typeSize;
+  if (sendbuff != mine) memcpy(mine, sendbuff, typeSize);
+  NCCLCHECK(bootstrapIntraNodeAllGather(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, recvbuff, typeSize));
+  return ncclSuccess;
+}
+
 ncclResult_t tryRegisterBuffer(struct ncclComm *comm, uintptr_t userBuff, size_t buffSize, CUdeviceptr *regAddr, bool *regUsed) {
   ncclResult_t ret = ncclSuccess;
   struct ncclReg *regRecord = NULL;
@@ -477,7 +531,7 @@ ncclResult_t tryRegisterBuffer(struct ncclComm *comm, uintptr_t userBuff, size_t
     }
   }
 
-  NCCLCHECKGOTO(ncclShmemAllgather(comm, &comm->nvlsResources->nvlsShmem, regData + comm->localRank, regData, sizeof(struct localRegData)), ret, fail);
+  NCCLCHECKGOTO(nvlsAllgather(comm, regData + comm->localRank, regData, sizeof(struct localRegData)), ret, fail);
 
   for (int i = 0; i < comm->localRanks; ++i) {
     if ((regData[i].reg.state & NVLS_REG_POSSIBLE) == 0) {
@@ -516,7 +570,7 @@ ncclResult_t tryRegisterBuffer(struct ncclComm *comm, uintptr_t userBuff, size_t
   regRecord->state |= NVLS_REG_COMPLETE;
   /* get all buffer addresses */
   regRecord->caddrs[comm->localRank] = regRecord->addr;
-  NCCLCHECKGOTO(ncclShmemAllgather(comm, &comm->nvlsResources->nvlsShmem, regRecord->caddrs + comm->localRank, regRecord->caddrs, sizeof(uintptr_t)), ret, fail);
+  NCCLCHECKGOTO(nvlsAllgather(comm, regRecord->caddrs + comm->localRank, regRecord->caddrs, sizeof(uintptr_t)), ret, fail);
 
   /* Although registration is done, we still need to check whether the offsets are same among ranks. */
   for (int i = 0; i < comm->localRanks - 1; ++i) {
@@ -567,7 +621,7 @@ ncclResult_t ncclNvlsLocalRegisterBuffer(struct ncclComm *comm, const void *send
     }
   }
 
-  NCCLCHECKGOTO(ncclShmemAllgather(comm, &comm->nvlsResources->nvlsShmem, regData + comm->localRank * 2, regData, sizeof(struct localRegData) * 2), ret, fail);
+  NCCLCHECKGOTO(nvlsAllgather(comm, regData + comm->localRank * 2, regData, sizeof(struct localRegData) * 2), ret, fail);
 
   /* first check whether all local ranks find their registered buffer */
   for (int i = 0; i < comm->localRanks; ++i) {
@@ -795,6 +849,174 @@ fail:
   goto exit;
 }
 
+// Number of multicast bindings of user buffers kept when no plan uses them.
+// 0 disables the cache, graph captures then bind their buffers for each plan.
+NCCL_PARAM(NvlsRegCache, "NVLS_REG_CACHE", 16);
+
+struct cachedRegData {
+  int ok;
+  uint64_t id;
+  uintptr_t offset;
+  size_t size;
+};
+
+static ncclResult_t nvlsRegEntryFree(struct ncclNvlsRegEntry* entry) {
+  NCCLCHECK(ncclNvlsDeregBuffer(&entry->mcHandle, entry->ptr, entry->dev, entry->size));
+  CUCHECK(cuMemRelease(entry->memHandle));
+  free(entry);
+  return ncclSuccess;
+}
+
+// Drop unused bindings, least recently used first, until the cache fits.
+static ncclResult_t nvlsRegCacheTrim(struct ncclComm* comm) {
+  while (comm->nvlsRegCacheCount > ncclParamNvlsRegCache()) {
+    struct ncclNvlsRegEntry** lru = NULL;
+    for (struct ncclNvlsRegEntry** pe = &comm->nvlsRegCache; *pe != NULL; pe = &(*pe)->next) {
+      if ((*pe)->refs == 0 && (lru == NULL || (*pe)->lastUsed < (*lru)->lastUsed)) lru = pe;
+    }
+    if (lru == NULL) break;
+    struct ncclNvlsRegEntry* entry = *lru;
+    *lru = entry->next;
+    comm->nvlsRegCacheCount--;
+    INFO(NCCL_NVLS, "rank %d - evicted cached NVLS registration of %p size %ld", comm->rank, (void*)entry->base, entry->size);
+    NCCLCHECK(nvlsRegEntryFree(entry));
+  }
+  return ncclSuccess;
+}
+
+// Find or create the multicast binding of the allocation holding buff and add
+// a reference to it to the plan. All local ranks decide together, from data
+// exchanged through shared memory, so a cache hit only costs that exchange.
+static ncclResult_t nvlsCachedRegister(struct ncclComm* comm, struct ncclKernelPlan* plan, const void* buff, size_t buffSize, CUdeviceptr* regPtr, bool* regUsed) {
+  ncclResult_t ret = ncclSuccess;
+  struct cachedRegData* rdata = NULL;
+  struct cachedRegData* mine;
+  struct ncclNvlsRegEntry* entry = NULL;
+  struct ncclNvlsRegEntry* newEntry = NULL;
+  struct ncclNvlsMcHandleList* record;
+  CUdeviceptr base = 0;
+  size_t baseSize = 0;
+  CUmemGenericAllocationHandle memHandle;
+  bool memRetained = false;
+  CUmulticastObjectProp prop;
+  char shareableHandle[NVLS_HANDLE_SIZE];
+  size_t gran, minSize;
+  bool hit = true;
+
+  *regUsed = false;
+  NCCLCHECK(ncclCalloc(&rdata, comm->localRanks));
+  mine = rdata + comm->localRank;
+  // Only memory from cuMemCreate can be bound to a multicast object.
+  if (CUPFN(cuMemGetAddressRange(&base, &baseSize, (CUdeviceptr)buff)) == CUDA_SUCCESS && base % comm->nvlsResources->ucGran == 0 &&
+      CUPFN(cuMemRetainAllocationHandle(&memHandle, (void*)base)) == CUDA_SUCCESS) {
+    memRetained = true;
+    mine->ok = 1;
+    mine->offset = (uintptr_t)buff - base;
+    mine->size = baseSize;
+    for (entry = comm->nvlsRegCache; entry != NULL; entry = entry->next) {
+      if (entry->base == base && entry->memHandle == memHandle && mine->offset + buffSize <= entry->size) break;
+    }
+    if (entry) mine->id = entry->id;
+  }
+  NCCLCHECKGOTO(nvlsAllgather(comm, mine, rdata, sizeof(struct cachedRegData)), ret, fail);
+
+  minSize = rdata[0].size;
+  for (int i = 0; i < comm->localRanks; ++i) {
+    // The multicast object maps all buffers at the same offset
+    if (rdata[i].ok == 0 || rdata[i].offset != rdata[0].offset) goto fail;
+    if (rdata[i].id == 0 || rdata[i].id != rdata[0].id) hit = false;
+    minSize = std::min(minSize, rdata[i].size);
+  }
+
+  if (!hit) {
+    memcpy(&prop, &comm->nvlsResources->properties, sizeof(CUmulticastObjectProp));
+    prop.size = minSize;
+    CUCHECKGOTO(cuMulticastGetGranularity(&gran, &prop, CU_MULTICAST_GRANULARITY_RECOMMENDED), ret, fail);
+    if (minSize % gran != 0 || rdata[0].offset + buffSize > minSize) goto fail;
+
+    NCCLCHECKGOTO(ncclCalloc(&newEntry, 1), ret, fail);
+    if (comm->localRank == 0) {
+      NCCLCHECKGOTO(nvlsGroupCreate(comm, &prop, comm->localRank, comm->localRanks, &newEntry->mcHandle, shareableHandle), ret, fail);
+      NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, 0, shareableHandle, NVLS_HANDLE_SIZE), ret, fail);
+    } else {
+      NCCLCHECKGOTO(bootstrapIntraNodeBroadcast(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, 0, shareableHandle, NVLS_HANDLE_SIZE), ret, fail);
+      NCCLCHECKGOTO(nvlsGroupConnect(comm, shareableHandle, comm->localRankToRank[0], &newEntry->mcHandle), ret, fail);
+    }
+    CUCHECKGOTO(cuMulticastAddDevice(newEntry->mcHandle, comm->nvlsResources->dev), ret, fail);
+    CUCHECKGOTO(cuMulticastBindAddr(newEntry->mcHandle, 0, base, minSize, 0), ret, fail);
+    CUCHECKGOTO(cuMemAddressReserve(&newEntry->ptr, minSize, gran, 0U, 0), ret, fail);
+    CUCHECKGOTO(cuMemMap(newEntry->ptr, minSize, 0, newEntry->mcHandle, 0), ret, fail);
+    CUCHECKGOTO(cuMemSetAccess(newEntry->ptr, minSize, &comm->nvlsResources->accessDesc, 1), ret, fail);
+
+    // Registrations are made by all local ranks together, so they number them alike.
+    newEntry->id = ++comm->nvlsRegCacheSeq;
+    newEntry->base = base;
+    newEntry->memHandle = memHandle;
+    memRetained = false;
+    newEntry->dev = comm->nvlsResources->dev;
+    newEntry->size = minSize;
+    newEntry->next = comm->nvlsRegCache;
+    comm->nvlsRegCache = entry = newEntry;
+    newEntry = NULL;
+    comm->nvlsRegCacheCount++;
+    INFO(NCCL_NVLS, "rank %d cached NVLS registration of buffer %p, allocation %p size %ld, reg %p", comm->rank, buff, (void*)base, minSize, (void*)entry->ptr);
+  }
+  entry->refs++;
+  entry->lastUsed = ++comm->nvlsRegCacheClock;
+  record = ncclMemoryPoolAlloc<struct ncclNvlsMcHandleList>(&comm->memPool_ncclNvlsHandleList, &comm->memPermanent);
+  record->entry = entry;
+  ncclIntruQueueEnqueue(&plan->nvlsMcHandleQueue, record);
+  *regPtr = entry->ptr + rdata[0].offset;
+  *regUsed = true;
+  if (!hit) NCCLCHECKGOTO(nvlsRegCacheTrim(comm), ret, fail);
+
+exit:
+  if (memRetained) (void)CUPFN(cuMemRelease(memHandle));
+  free(rdata);
+  /* always return success. */
+  return ncclSuccess;
+fail:
+  free(newEntry);
+  goto exit;
+}
+
+ncclResult_t ncclNvlsCachedRegisterBuffer(struct ncclComm *comm, struct ncclKernelPlan *plan, const void *sendbuff, void *recvbuff, size_t sendbuffSize, size_t recvbuffSize, bool *outRegBufUsed, void **outRegBufSend, void **outRegBufRecv) {
+  CUdeviceptr regSendPtr = 0;
+  CUdeviceptr regRecvPtr = 0;
+  bool regUsed = true;
+
+  *outRegBufUsed = false;
+  if (ncclParamNvlsRegCache() <= 0) return ncclSuccess;
+  if (sendbuff) NCCLCHECK(nvlsCachedRegister(comm, plan, sendbuff, sendbuffSize, &regSendPtr, &regUsed));
+  if (regUsed && recvbuff) NCCLCHECK(nvlsCachedRegister(comm, plan, recvbuff, recvbuffSize, &regRecvPtr, &regUsed));
+  if (regUsed) {
+    *outRegBufSend = (void*)regSendPtr;
+    *outRegBufRecv = (void*)regRecvPtr;
+    *outRegBufUsed = true;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclNvlsRegCacheRelease(struct ncclComm* comm, struct ncclNvlsRegEntry* entry) {
+  if (--entry->refs > 0) return ncclSuccess;
+  if (entry->orphan) return nvlsRegEntryFree(entry);
+  return nvlsRegCacheTrim(comm);
+}
+
+ncclResult_t ncclNvlsRegCacheFree(struct ncclComm* comm) {
+  struct ncclNvlsRegEntry* entry = comm->nvlsRegCache;
+  while (entry != NULL) {
+    struct ncclNvlsRegEntry* next = entry->next;
+    // Plans of graphs which outlive the communicator free theirs when done.
+    if (entry->refs > 0) entry->orphan = true;
+    else NCCLCHECK(nvlsRegEntryFree(entry));
+    entry = next;
+  }
+  comm->nvlsRegCache = NULL;
+  comm->nvlsRegCacheCount = 0;
+  return ncclSuccess;
+}
+
 #else
 
 /*
@@ -814,6 +1036,10 @@ ncclResult_t ncclNvlsFree(struct ncclComm* comm) {
   return ncclSuccess;
 }
 
+ncclResult_t ncclNvlsConnect(struct ncclComm* comm) {
+  return ncclSuccess;
+}
+
 ncclResult_t ncclNvlsGraphRegisterBuffer(struct ncclComm *comm, struct ncclKernelPlan *plan, const void *sendbuff, void *recvbuff, size_t sendbuffSize, size_t recvbuffSize, bool *outRegBufUsed, void **outRegBufSend, void **outRegBufRecv) {
   *outRegBufUsed = false;
   return ncclSuccess;
@@ -828,4 +1054,17 @@ ncclResult_t ncclNvlsDeregBuffer(CUmemGenericAllocationHandle *mcHandler, CUdevi
   return ncclSuccess;
 }
 
+ncclResult_t ncclNvlsCachedRegisterBuffer(struct ncclComm *comm, struct ncclKernelPlan *plan, const void *sendbuff, void *recvbuff, size_t sendbuffSize, size_t recvbuffSize, bool *outRegBufUsed, void **outRegBufSend, void **outRegBufRecv) {
+  *outRegBufUsed = false;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclNvlsRegCacheRelease(struct ncclComm* comm, struct ncclNvlsRegEntry* entry) {
+  return ncclSuccess;
+}
+
+ncclResult_t ncclNvlsRegCacheFree(struct ncclComm* comm) {
+  return ncclSuccess;
+}
+
 #endif /* CUDA_VERSION >= 12010 */
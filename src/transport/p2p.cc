@@ -14,7 +14,9 @@ enum p2pType { P2P_DIRECT, P2P_INTERMEDIATE, P2P_IPC, P2P_CUMEM };
 
 struct ncclP2pBuff {
   void* directPtr;
-  size_t size;
+  size_t size; // of the allocation ipcDesc describes
+  size_t offset; // of directPtr in it, when sub-allocated from a slab
+  int slab;
   ncclIpcDesc ipcDesc;
 };
 
@@ -68,11 +70,17 @@ struct p2pResources {
   struct p2pShm* devShm;
   int shmSize;
   ncclShmHandle_t handle;
+  // Buffer size of each protocol on this connection, 0 if not allocated
+  int buffSizes[NCCL_NUM_PROTOCOLS];
+  // Peer slabs mapped in place of sendMemIpc/recvMemIpc
+  struct p2pImport* sendSlab;
+  struct p2pImport* recvSlab;
 };
 
 // cuMem API support
 struct p2pCuMemProxyInfo {
   struct ncclP2pBuff p2pBuff;
+  struct p2pSlab* slab; // NULL if allocated on its own
 };
 
 #include <sys/types.h>
@@ -204,6 +212,7 @@ ncclResult_t ncclP2pAllocateShareableBuffer(size_t size, ncclIpcDesc *ipcDesc, v
     // cuMem API support
     CUmemGenericAllocationHandle handle;
     NCCLCHECK(ncclCuMemAlloc(ptr, &handle, size));
+    ncclMemTrack(*ptr, size, 0);
     if (type == CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR) {
       // Return the native cuMem handle for later Export/Import via UDS
       memcpy(&ipcDesc->cuDesc.data, &handle, sizeof(handle));
@@ -232,11 +241,32 @@ ncclResult_t ncclP2pFreeShareableBuffer(ncclIpcDesc *ipcDesc) {
   return ncclSuccess;
 }
 
+#if CUDART_VERSION >= 11030
+// Maps an imported cuMem handle and gives the local GPU access to it
+static ncclResult_t p2pMapImportedHandle(struct ncclComm *comm, CUmemGenericAllocationHandle handle, size_t size, void **devMemPtr) {
+  CUdeviceptr dptr = 0;
+  CUCHECK(cuMemAddressReserve(&dptr, size, /* alignment */ 0, /* addr */ 0, /* flags */ 0));
+  CUCHECK(cuMemMap(dptr, size, /* offset */ 0, handle, /* flags */ 0));
+
+  TRACE(NCCL_P2P, "Imported shareable buffer size %zi handle 0x%llx dptr %p", size, handle, (void*)dptr);
+
+  // Allow access by the local GPU
+  CUmemAccessDesc accessDesc = {};
+  accessDesc.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+  accessDesc.location.id = comm->cudaDev;
+  accessDesc.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+  CUCHECK(cuMemSetAccess(dptr, size, &accessDesc, 1));
+  TRACE(NCCL_P2P, "Set Access for %p size %zi on dev %d", (void*)dptr, size, accessDesc.location.id);
+
+  *devMemPtr = (void *)dptr;
+  return ncclSuccess;
+}
+#endif
+
 ncclResult_t ncclP2pImportShareableBuffer(struct ncclComm *comm, int tpPeer, size_t size, ncclIpcDesc *ipcDesc, void **devMemPtr) {
   if (ncclCuMemEnable()) {
 #if CUDART_VERSION >= 11030
     // cuMem API support
-    CUdeviceptr dptr = 0;
     CUmemAllocationHandleType type = ncclCuMemHandleType;
     CUmemGenericAllocationHandle handle;
     ncclCuDesc *cuDesc = &ipcDesc->cuDesc;
@@ -253,20 +283,7 @@ ncclResult_t ncclP2pImportShareableBuffer(struct ncclComm *comm, int tpPeer, siz
     } else {
       CUCHECK(cuMemImportFromShareableHandle(&handle, cuDesc, type));
     }
-    CUCHECK(cuMemAddressReserve(&dptr, size, /* alignment */ 0, /* addr */ 0, /* flags */ 0));
-    CUCHECK(cuMemMap(dptr, size, /* offset */ 0, handle, /* flags */ 0));
-
-    TRACE(NCCL_P2P, "Imported shareable buffer size %zi handle 0x%llx dptr %p", size, handle, (void*)dptr);
-
-    // Allow access by the local GPU
-    CUmemAccessDesc accessDesc = {};
-    accessDesc.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
-    accessDesc.location.id = comm->cudaDev;
-    accessDesc.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
-    CUCHECK(cuMemSetAccess(dptr, size, &accessDesc, 1));
-    TRACE(NCCL_P2P, "Set Access for %p size %zi on dev %d", (void*)dptr, size, accessDesc.location.id);
-
-    *devMemPtr = (void *)dptr;
+    NCCLCHECK(p2pMapImportedHandle(comm, handle, size, devMemPtr));
 #else
     return ncclInternalError;
 #endif
@@ -280,9 +297,202 @@ ncclResult_t ncclP2pImportShareableBuffer(struct ncclComm *comm, int tpPeer, siz
   return ncclSuccess;
 }
 
+// Imports n buffers of the same peer. With fd handles, the fds of up to
+// NCCL_IPC_MAX_FDS buffers are fetched in a single UDS round trip.
+ncclResult_t ncclP2pImportShareableBuffers(struct ncclComm *comm, int tpPeer, int n, size_t* sizes, ncclIpcDesc** ipcDescs, void*** devMemPtrs) {
+#if CUDART_VERSION >= 11030
+  if (n > 1 && ncclCuMemEnable() && ncclCuMemHandleType == CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR) {
+    ncclResult_t ret = ncclSuccess;
+    int fds[NCCL_IPC_MAX_FDS];
+    for (int b=0; b<n; b+=NCCL_IPC_MAX_FDS) {
+      int nb = std::min(n-b, NCCL_IPC_MAX_FDS);
+      uint64_t handles[NCCL_IPC_MAX_FDS];
+      for (int i=0; i<nb; i++) handles[i] = *(uint64_t*)&ipcDescs[b+i]->cuDesc.data;
+      NCCLCHECK(ncclProxyClientGetFdsBlocking(comm, tpPeer, handles, nb, fds));
+      for (int i=0; i<nb; i++) {
+        CUmemGenericAllocationHandle handle;
+        // Keep going on errors to close all fds
+        if (ret == ncclSuccess && CUPFN(cuMemImportFromShareableHandle(&handle, (void *)(uintptr_t)fds[i], CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR)) != CUDA_SUCCESS) {
+          WARN("Failed to import fd %d from peer %d", fds[i], tpPeer);
+          ret = ncclUnhandledCudaError;
+        }
+        (void) close(fds[i]);
+        if (ret == ncclSuccess) ret = p2pMapImportedHandle(comm, handle, sizes[b+i], devMemPtrs[b+i]);
+        if (ret == ncclSuccess) INFO(NCCL_P2P, "Imported shareable buffer device %d size %zi ptr %p", comm->cudaDev, sizes[b+i], *devMemPtrs[b+i]);
+      }
+      NCCLCHECK(ret);
+    }
+    return ncclSuccess;
+  }
+#endif
+  for (int i=0; i<n; i++) {
+    NCCLCHECK(ncclP2pImportShareableBuffer(comm, tpPeer, sizes[i], ipcDescs[i], devMemPtrs[i]));
+  }
+  return ncclSuccess;
+}
+
 // Setting this to non zero causes P2P to use Reads rather than Writes
 NCCL_PARAM(P2pReadEnable, "P2P_READ_ENABLE", -2);
 NCCL_PARAM(P2pDirectDisable, "P2P_DIRECT_DISABLE", 0);
+NCCL_PARAM(P2pSizedBuffers, "P2P_SIZED_BUFFERS", 0);
+// In P2P read mode, let the receiver return SIMPLE credits every other slice
+NCCL_PARAM(P2pReadPostBatch, "P2P_READ_POST_BATCH", 0);
+
+// Point-to-point operations (connections without a graph, on connIndex 1)
+// only use LL and SIMPLE, and move at most p2pChunkSize bytes per SIMPLE
+// step. p2pChunkSize is picked from the path type (NVLink, PCI or network),
+// so with NCCL_P2P_SIZED_BUFFERS=1 these connections get NCCL_STEPS of it
+// and no LL128 buffer, instead of the buffers collectives need. Both ends
+// compute the same sizes.
+static void p2pBuffSizes(struct ncclComm* comm, struct ncclTopoGraph* graph, int connIndex, int* buffSizes) {
+  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) buffSizes[p] = comm->buffSizes[p];
+  // The CE proxy copies whole comm->buffSizes steps
+  if (ncclParamP2pSizedBuffers() == 0 || graph || connIndex != 1 || useMemcpy) return;
+  buffSizes[NCCL_PROTO_LL128] = 0;
+  buffSizes[NCCL_PROTO_SIMPLE] = std::min(buffSizes[NCCL_PROTO_SIMPLE], comm->sharedRes->tpP2pChunkSize*NCCL_STEPS);
+}
+
+// With cuMem, NCCL_P2P_SLAB_SIZE > 0 makes proxies sub-allocate connection
+// buffers from slabs of that size, so that a comm needs a few allocations and
+// exports, and peers a few imports, instead of one per connector. Slabs are
+// bump allocated and freed once all their buffers are.
+NCCL_PARAM(P2pSlabSize, "P2P_SLAB_SIZE", 0);
+#define P2P_SLAB_ALIGN 4096
+
+static bool p2pSlabEnabled() {
+  return ncclParamP2pSlabSize() > 0 && ncclCuMemEnable();
+}
+
+struct p2pSlab {
+  struct p2pSlab* next;
+  char* base;
+  size_t size;
+  size_t used;
+  int refCount; // buffers not freed yet
+  ncclIpcDesc ipcDesc;
+};
+
+// Called by the proxy thread, which owns proxyState->p2pSlabs
+static ncclResult_t p2pSlabAlloc(struct ncclProxyState* proxyState, size_t size, struct ncclP2pBuff* p2pBuff, struct p2pSlab** slabOut) {
+  size_t slabSize = ncclParamP2pSlabSize();
+  *slabOut = NULL;
+  if (!p2pSlabEnabled() || size > slabSize) {
+    NCCLCHECK(ncclP2pAllocateShareableBuffer(size, &p2pBuff->ipcDesc, &p2pBuff->directPtr));
+    p2pBuff->size = size;
+    p2pBuff->offset = 0;
+    p2pBuff->slab = 0;
+    return ncclSuccess;
+  }
+  ALIGN_SIZE(size, P2P_SLAB_ALIGN);
+  struct p2pSlab* slab = proxyState->p2pSlabs;
+  while (slab && slab->size - slab->used < size) slab = slab->next;
+  if (slab == NULL) {
+    NCCLCHECK(ncclCalloc(&slab, 1));
+    ncclResult_t ret = ncclP2pAllocateShareableBuffer(slabSize, &slab->ipcDesc, (void**)&slab->base);
+    if (ret != ncclSuccess) {
+      free(slab);
+      return ret;
+    }
+    slab->size = slabSize;
+    slab->next = proxyState->p2pSlabs;
+    proxyState->p2pSlabs = slab;
+    INFO(NCCL_P2P|NCCL_ALLOC, "Allocated P2P slab %p size %zu", slab->base, slabSize);
+  }
+  p2pBuff->directPtr = slab->base + slab->used;
+  p2pBuff->size = slab->size;
+  p2pBuff->offset = slab->used;
+  p2pBuff->slab = 1;
+  memcpy(&p2pBuff->ipcDesc, &slab->ipcDesc, sizeof(ncclIpcDesc));
+  slab->used += size;
+  slab->refCount++;
+  *slabOut = slab;
+  return ncclSuccess;
+}
+
+static ncclResult_t p2pSlabRelease(struct ncclProxyState* proxyState, struct p2pSlab* slab) {
+  if (--slab->refCount > 0) return ncclSuccess;
+  for (struct p2pSlab** prev = &proxyState->p2pSlabs; *prev; prev = &(*prev)->next) {
+    if (*prev == slab) {
+      *prev = slab->next;
+      break;
+    }
+  }
+  ncclP2pFreeShareableBuffer(&slab->ipcDesc);
+  // Do not check return code as CUDA may have already shut down
+  ncclCudaFree(slab->base);
+  free(slab);
+  return ncclSuccess;
+}
+
+// Allocations of other processes mapped in this one (slabs, registered
+// buffers), shared by all connectors and comms using them.
+struct p2pImport {
+  struct p2pImport* next;
+  uint64_t hostHash, pidHash; // of the exporting process
+  int cudaDev; // given access
+  ncclIpcDesc ipcDesc;
+  char* base;
+  int refCount;
+};
+static struct p2pImport* p2pImports = NULL;
+static pthread_mutex_t p2pImportsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static ncclResult_t p2pImportGet(struct ncclComm* comm, struct ncclPeerInfo* peerInfo, size_t size, ncclIpcDesc* ipcDesc, struct p2pImport** importOut) {
+  ncclResult_t ret = ncclSuccess;
+  struct p2pImport* import;
+  pthread_mutex_lock(&p2pImportsLock);
+  for (import = p2pImports; import; import = import->next) {
+    if (import->hostHash == peerInfo->hostHash && import->pidHash == peerInfo->pidHash && import->cudaDev == comm->cudaDev &&
+        memcmp(&import->ipcDesc, ipcDesc, sizeof(ncclIpcDesc)) == 0) break;
+  }
+  if (import == NULL) {
+    NCCLCHECKGOTO(ncclCalloc(&import, 1), ret, exit);
+    ret = ncclP2pImportShareableBuffer(comm, comm->topParentRanks[peerInfo->rank], size, ipcDesc, (void**)&import->base);
+    if (ret != ncclSuccess) {
+      free(import);
+      goto exit;
+    }
+    import->hostHash = peerInfo->hostHash;
+    import->pidHash = peerInfo->pidHash;
+    import->cudaDev = comm->cudaDev;
+    memcpy(&import->ipcDesc, ipcDesc, sizeof(ncclIpcDesc));
+    import->next = p2pImports;
+    p2pImports = import;
+  }
+  import->refCount++;
+  *importOut = import;
+exit:
+  pthread_mutex_unlock(&p2pImportsLock);
+  return ret;
+}
+
+static ncclResult_t p2pSlabImport(struct ncclComm* comm, struct ncclPeerInfo* peerInfo, struct ncclP2pBuff* p2pBuff, void** devMem, struct p2pImport** importOut) {
+  NCCLCHECK(p2pImportGet(comm, peerInfo, p2pBuff->size, &p2pBuff->ipcDesc, importOut));
+  *devMem = (*importOut)->base + p2pBuff->offset;
+  return ncclSuccess;
+}
+
+static ncclResult_t p2pImportRelease(struct p2pImport* import) {
+  ncclResult_t ret = ncclSuccess;
+  pthread_mutex_lock(&p2pImportsLock);
+  if (--import->refCount == 0) {
+    for (struct p2pImport** prev = &p2pImports; *prev; prev = &(*prev)->next) {
+      if (*prev == import) {
+        *prev = import->next;
+        break;
+      }
+    }
+    if (ncclCuMemEnable()) ret = ncclCudaFree(import->base);
+    else if (cudaIpcCloseMemHandle(import->base) != cudaSuccess) ret = ncclUnhandledCudaError;
+    free(import);
+  }
+  pthread_mutex_unlock(&p2pImportsLock);
+  return ret;
+}
+
+// Let senders write straight into the registered receive buffers of peers in
+// other processes, see ncclP2pIpcExportBuffer.
+NCCL_PARAM(P2pIpcRegister, "P2P_IPC_REGISTER", 0);
 
 #define P2P_SAME_PID(MYINFO, PEERINFO) ((MYINFO->hostHash == PEERINFO->hostHash) && (MYINFO->pidHash == PEERINFO->pidHash))
 
@@ -297,7 +507,8 @@ static ncclResult_t p2pGetInfo(struct ncclTopoSystem* topo, struct ncclPeerInfo*
   return ncclSuccess;
 }
 
-static ncclResult_t p2pMap(struct ncclComm *comm, struct ncclProxyConnector* proxyConn, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclP2pBuff* p2pBuff, void** devMem, void** ipcPtr) {
+static ncclResult_t p2pMap(struct ncclComm *comm, struct ncclProxyConnector* proxyConn, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclP2pBuff* p2pBuff, void** devMem, void** ipcPtr, struct p2pImport** slabImport) {
+  *slabImport = NULL;
   if (P2P_SAME_PID(myInfo, peerInfo)) {
     if (peerInfo->cudaDev != myInfo->cudaDev) {
       // Same PID different GPUs, enable P2P access
@@ -318,8 +529,10 @@ static ncclResult_t p2pMap(struct ncclComm *comm, struct ncclProxyConnector* pro
         accessDesc.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
         accessDesc.location.id = myInfo->cudaDev;
         accessDesc.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
-        INFO(NCCL_P2P, "Set Access for buffer %p size %zi on dev %d", p2pBuff->directPtr, p2pBuff->size, peerInfo->cudaDev);
-        CUCHECK(cuMemSetAccess((CUdeviceptr) p2pBuff->directPtr, p2pBuff->size, &accessDesc, 1));
+        // Access is given to the whole allocation, which may be a slab
+        char* allocPtr = (char*)p2pBuff->directPtr - p2pBuff->offset;
+        INFO(NCCL_P2P, "Set Access for buffer %p size %zi on dev %d", allocPtr, p2pBuff->size, peerInfo->cudaDev);
+        CUCHECK(cuMemSetAccess((CUdeviceptr) allocPtr, p2pBuff->size, &accessDesc, 1));
       }
 #endif
     }
@@ -327,6 +540,11 @@ static ncclResult_t p2pMap(struct ncclComm *comm, struct ncclProxyConnector* pro
     *ipcPtr = NULL;
   } else {
     // Different PID
+    if (p2pBuff->slab) {
+      NCCLCHECK(p2pSlabImport(comm, peerInfo, p2pBuff, devMem, slabImport));
+      *ipcPtr = NULL;
+      return ncclSuccess;
+    }
     NCCLCHECK(ncclP2pImportShareableBuffer(comm, comm->topParentRanks[peerInfo->rank], p2pBuff->size, &p2pBuff->ipcDesc, devMem));
     *ipcPtr = *devMem;
   }
@@ -351,10 +569,12 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
   if (graph && connIndex == 1) info->read = 0;
   const char* useReadStr = info->read ? "/read" : "";
 
+  p2pBuffSizes(comm, graph, connIndex, resources->buffSizes);
   int sendSize = sizeof(struct ncclSendMem);
   // For P2P Read the SIMPLE buffer is tagged on the end of the ncclSendMem structure
-  if (info->read) sendSize += comm->buffSizes[NCCL_PROTO_SIMPLE];
-  ALIGN_SIZE(sendSize, CUDA_IPC_MIN);
+  if (info->read) sendSize += resources->buffSizes[NCCL_PROTO_SIMPLE];
+  // Slabs are exported and imported as a whole
+  if (!p2pSlabEnabled()) ALIGN_SIZE(sendSize, CUDA_IPC_MIN);
 
   if (intermediateRank == -1) {
     info->rank = myInfo->rank;
@@ -377,6 +597,7 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
              channelId, connIndex, myInfo->rank, myInfo->nvmlDev, peerInfo->rank, peerInfo->nvmlDev, useReadStr, useMemcpy ? "/CE" : "");
       }
       send->conn.flags |= info->read ? NCCL_IPC_READ : NCCL_IPC_WRITE;
+      if (ncclParamP2pIpcRegister() && useMemcpy == 0) send->conn.flags |= NCCL_P2P_IPC_REG;
     }
   } else {
     resources->type = P2P_INTERMEDIATE;
@@ -394,7 +615,7 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
     memcpy(info->shmName, resources->proxyInfo.shmName, sizeof(info->shmName));
   } else {
     NCCLCHECK(ncclProxyCallBlocking(comm, &send->proxyConn, ncclProxyMsgSetup, &sendSize, sizeof(int), &info->p2pBuff, sizeof(struct ncclP2pBuff)));
-    NCCLCHECK(p2pMap(comm, &send->proxyConn, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&resources->sendDevMem, &resources->sendMemIpc));
+    NCCLCHECK(p2pMap(comm, &send->proxyConn, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&resources->sendDevMem, &resources->sendMemIpc, &resources->sendSlab));
   }
 
   return ncclSuccess;
@@ -416,10 +637,13 @@ ncclResult_t p2pRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
   // For CollNet, use write for scatter-reduce (conn 1), read for broadcast-gather (conn 0)
   if (graph && connIndex == 1) info->read = 0;
 
+  p2pBuffSizes(comm, graph, connIndex, resources->buffSizes);
   int recvSize = sizeof(struct ncclRecvMem);
   // For P2P Read the SIMPLE buffer is tagged on the end of the ncclSendMem structure
-  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) if (!(info->read && p == NCCL_PROTO_SIMPLE)) recvSize += comm->buffSizes[p];
-  ALIGN_SIZE(recvSize, CUDA_IPC_MIN);
+  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) if (!(info->read && p == NCCL_PROTO_SIMPLE)) recvSize += resources->buffSizes[p];
+  if (!p2pSlabEnabled()) ALIGN_SIZE(recvSize, CUDA_IPC_MIN);
+
+  if (info->read && ncclParamP2pReadPostBatch()) recv->conn.flags |= NCCL_P2P_POST_BATCH;
 
   if (intermediateRank == -1) {
     info->rank = myInfo->rank;
@@ -437,6 +661,7 @@ ncclResult_t p2pRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
         resources->type = P2P_IPC;
       }
       recv->conn.flags |= info->read ? NCCL_IPC_READ : NCCL_IPC_WRITE;
+      if (ncclParamP2pIpcRegister() && useMemcpy == 0) recv->conn.flags |= NCCL_P2P_IPC_REG;
     }
   } else {
     resources->type = P2P_INTERMEDIATE;
@@ -447,7 +672,7 @@ ncclResult_t p2pRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
   NCCLCHECK(ncclProxyConnect(comm, TRANSPORT_P2P, 0, tpProxyRank, &recv->proxyConn));
   NCCLCHECK(ncclProxyCallBlocking(comm, &recv->proxyConn, ncclProxyMsgSetup, &recvSize, sizeof(int), &info->p2pBuff, sizeof(struct ncclP2pBuff)));
 
-  NCCLCHECK(p2pMap(comm, &recv->proxyConn, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&resources->recvDevMem, &resources->recvMemIpc));
+  NCCLCHECK(p2pMap(comm, &recv->proxyConn, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&resources->recvDevMem, &resources->recvMemIpc, &resources->recvSlab));
   return ncclSuccess;
 }
 
@@ -457,7 +682,7 @@ static ncclResult_t p2pSendConnect(struct ncclComm* comm, struct ncclConnect* co
   struct ncclRecvMem* remDevMem = NULL;
   struct p2pConnectInfo* info = (struct p2pConnectInfo*)connectInfo;
 
-  NCCLCHECK(p2pMap(comm, &send->proxyConn, comm->peerInfo+rank, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&remDevMem, &resources->recvMemIpc));
+  NCCLCHECK(p2pMap(comm, &send->proxyConn, comm->peerInfo+rank, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&remDevMem, &resources->recvMemIpc, &resources->recvSlab));
 
   char* buff = (char*)(remDevMem+1);
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
@@ -466,11 +691,11 @@ static ncclResult_t p2pSendConnect(struct ncclComm* comm, struct ncclConnect* co
       if (resources->sendDevMem == NULL) return ncclInternalError; // We should not use read + memcpy
       send->conn.buffs[p] = (char*)(resources->sendDevMem+1);
     } else {
-      send->conn.buffs[p] = buff;
-      buff += comm->buffSizes[p];
+      send->conn.buffs[p] = resources->buffSizes[p] ? buff : NULL;
+      buff += resources->buffSizes[p];
     }
   }
-  send->conn.stepSize = comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
+  send->conn.stepSize = resources->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
 
   if (useMemcpy) {
     send->conn.tail = &resources->proxyInfo.ceRecvMem->tail;
@@ -508,7 +733,7 @@ ncclResult_t p2pRecvConnect(struct ncclComm* comm, struct ncclConnect* connectIn
     recv->conn.tail = &resources->devShm->recvMem.tail;
     recv->conn.head = &resources->devShm->sendMem.head;
   } else {
-    NCCLCHECK(p2pMap(comm, &recv->proxyConn, comm->peerInfo+rank, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&remDevMem, &resources->sendMemIpc));
+    NCCLCHECK(p2pMap(comm, &recv->proxyConn, comm->peerInfo+rank, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&remDevMem, &resources->sendMemIpc, &resources->sendSlab));
 
     struct ncclRecvMem* devMem = resources->recvDevMem;
     recv->conn.tail = &devMem->tail;
@@ -516,7 +741,7 @@ ncclResult_t p2pRecvConnect(struct ncclComm* comm, struct ncclConnect* connectIn
     recv->conn.ptrExchange = &remDevMem->ptrExchange;
     recv->conn.redOpArgExchange = remDevMem->redOpArgExchange;
   }
-  recv->conn.stepSize = comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
+  recv->conn.stepSize = resources->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
 
   char* buff = (char*)(resources->recvDevMem+1);
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
@@ -525,8 +750,8 @@ ncclResult_t p2pRecvConnect(struct ncclComm* comm, struct ncclConnect* connectIn
       /* For P2P Read the SIMPLE buffer is remote (ncclSendMem) */
       recv->conn.buffs[p] = (char*)(remDevMem+1);
     } else {
-      recv->conn.buffs[p] = buff;
-      buff += comm->buffSizes[p];
+      recv->conn.buffs[p] = resources->buffSizes[p] ? buff : NULL;
+      buff += resources->buffSizes[p];
     }
   }
   return ncclSuccess;
@@ -539,6 +764,8 @@ ncclResult_t p2pSendFree(struct ncclConnector* send) {
       // cuMem API support
       if (resources->sendMemIpc) NCCLCHECK(ncclCudaFree(resources->sendMemIpc));
       if (resources->recvMemIpc) NCCLCHECK(ncclCudaFree(resources->recvMemIpc));
+      if (resources->sendSlab) NCCLCHECK(p2pImportRelease(resources->sendSlab));
+      if (resources->recvSlab) NCCLCHECK(p2pImportRelease(resources->recvSlab));
     }
     else {
       if (resources->sendMemIpc) CUDACHECK(cudaIpcCloseMemHandle(resources->sendMemIpc));
@@ -556,6 +783,8 @@ ncclResult_t p2pRecvFree(struct ncclConnector* recv) {
       // cuMem API support
       if (resources->sendMemIpc) NCCLCHECK(ncclCudaFree(resources->sendMemIpc));
       if (resources->recvMemIpc) NCCLCHECK(ncclCudaFree(resources->recvMemIpc));
+      if (resources->sendSlab) NCCLCHECK(p2pImportRelease(resources->sendSlab));
+      if (resources->recvSlab) NCCLCHECK(p2pImportRelease(resources->recvSlab));
     }
     else {
       if (resources->sendMemIpc) CUDACHECK(cudaIpcCloseMemHandle(resources->sendMemIpc));
@@ -595,13 +824,14 @@ static ncclResult_t p2pSendProxySetup(struct ncclProxyConnection* connection, st
     int size = *((int*)reqBuff);
     if (respSize != sizeof(struct ncclP2pBuff)) return ncclInternalError;
     struct ncclP2pBuff* p2pBuff = (struct ncclP2pBuff*)respBuff;
-    NCCLCHECK(ncclP2pAllocateShareableBuffer(size, &p2pBuff->ipcDesc, &p2pBuff->directPtr));
-    p2pBuff->size = size;
+    struct p2pSlab* slab;
+    NCCLCHECK(p2pSlabAlloc(proxyState, size, p2pBuff, &slab));
     if (ncclCuMemEnable()) {
       // cuMem API support
       struct p2pCuMemProxyInfo* proxyInfo;
       NCCLCHECK(ncclCalloc(&proxyInfo, 1));
       memcpy(&proxyInfo->p2pBuff, p2pBuff, sizeof(*p2pBuff));
+      proxyInfo->slab = slab;
       connection->transportResources = proxyInfo;
     } else {
       connection->transportResources = p2pBuff->directPtr;
@@ -616,13 +846,14 @@ static ncclResult_t p2pRecvProxySetup(struct ncclProxyConnection* connection, st
   int size = *((int*)reqBuff);
   if (respSize != sizeof(struct ncclP2pBuff)) return ncclInternalError;
   struct ncclP2pBuff* p2pBuff = (struct ncclP2pBuff*)respBuff;
-  NCCLCHECK(ncclP2pAllocateShareableBuffer(size, &p2pBuff->ipcDesc, &p2pBuff->directPtr));
-  p2pBuff->size = size;
+  struct p2pSlab* slab;
+  NCCLCHECK(p2pSlabAlloc(proxyState, size, p2pBuff, &slab));
   if (ncclCuMemEnable()) {
     // cuMem API support
     struct p2pCuMemProxyInfo* proxyInfo;
     NCCLCHECK(ncclCalloc(&proxyInfo, 1));
     memcpy(&proxyInfo->p2pBuff, p2pBuff, sizeof(*p2pBuff));
+    proxyInfo->slab = slab;
     connection->transportResources = proxyInfo;
   } else {
     connection->transportResources = p2pBuff->directPtr;
@@ -663,7 +894,10 @@ static ncclResult_t p2pSendProxyFree(struct ncclProxyConnection* connection, str
     if (ncclCuMemEnable()) {
       // cuMem API support
       struct p2pCuMemProxyInfo *proxyInfo = (struct p2pCuMemProxyInfo *) connection->transportResources;
-      if (proxyInfo) {
+      if (proxyInfo && proxyInfo->slab) {
+        NCCLCHECK(p2pSlabRelease(proxyState, proxyInfo->slab));
+        free(proxyInfo);
+      } else if (proxyInfo) {
         struct ncclP2pBuff *p2pBuff = &proxyInfo->p2pBuff;
         ncclP2pFreeShareableBuffer(&p2pBuff->ipcDesc);
         ncclCudaFree(p2pBuff->directPtr);
@@ -680,7 +914,10 @@ static ncclResult_t p2pSendProxyFree(struct ncclProxyConnection* connection, str
 static ncclResult_t p2pRecvProxyFree(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState) {
   if (ncclCuMemEnable()) {
     struct p2pCuMemProxyInfo *proxyInfo = (struct p2pCuMemProxyInfo *) connection->transportResources;
-    if (proxyInfo) {
+    if (proxyInfo && proxyInfo->slab) {
+      NCCLCHECK(p2pSlabRelease(proxyState, proxyInfo->slab));
+      free(proxyInfo);
+    } else if (proxyInfo) {
       struct ncclP2pBuff *p2pBuff = &proxyInfo->p2pBuff;
       ncclP2pFreeShareableBuffer(&p2pBuff->ipcDesc);
       ncclCudaFree(p2pBuff->directPtr);
@@ -769,3 +1006,131 @@ static void initCeOperation() {
     init = 1;
   }
 }
+
+// Zero-copy send/recv between processes. A receiver whose buffer is
+// registered with ncclCommRegister exports the allocation holding it, once
+// per registration, and offers it to the sender for each receive. The sender
+// maps each offered allocation once and keeps it until the communicator is
+// destroyed, so it never has to know when the receiver deregisters.
+struct ncclP2pIpcExport {
+  uint64_t id;
+  uintptr_t base;
+  size_t size;
+  ncclIpcDesc ipcDesc;
+#if CUDART_VERSION >= 11030
+  CUmemGenericAllocationHandle handle; // retained, with cuMem
+#endif
+};
+
+struct ncclP2pIpcImport {
+  struct ncclP2pIpcImport* next;
+  int peer;
+  uint64_t id;
+  struct p2pImport* import; // NULL if the allocation could not be mapped
+};
+
+static ncclResult_t p2pIpcExport(struct ncclComm* comm, struct ncclReg* reg) {
+  CUdeviceptr base;
+  size_t size;
+  struct ncclP2pIpcExport* exp;
+  // The whole registration has to live in one allocation
+  if (CUPFN(cuMemGetAddressRange) == NULL || CUPFN(cuMemGetAddressRange(&base, &size, (CUdeviceptr)reg->addr)) != CUDA_SUCCESS ||
+      reg->addr + reg->pages*comm->regCache.pageSize > base + size) {
+    reg->state |= IPC_REG_NO_SUPPORT;
+    return ncclSuccess;
+  }
+  NCCLCHECK(ncclCalloc(&exp, 1));
+  if (ncclCuMemEnable()) {
+#if CUDART_VERSION >= 11030
+    CUmemAllocationHandleType type = ncclCuMemHandleType;
+    if (CUPFN(cuMemRetainAllocationHandle(&exp->handle, (void*)base)) != CUDA_SUCCESS) goto fail;
+    if (type == CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR) {
+      // The sender gets an fd for the handle from our proxy
+      memcpy(&exp->ipcDesc.cuDesc.data, &exp->handle, sizeof(exp->handle));
+    } else if (CUPFN(cuMemExportToShareableHandle(&exp->ipcDesc.cuDesc, exp->handle, type, 0)) != CUDA_SUCCESS) {
+      CUPFN(cuMemRelease(exp->handle));
+      goto fail;
+    }
+#else
+    goto fail;
+#endif
+  } else if (cudaIpcGetMemHandle(&exp->ipcDesc.devIpc, (void*)base) != cudaSuccess) {
+    // Not a cudaMalloc allocation
+    (void)cudaGetLastError();
+    goto fail;
+  }
+  exp->id = ++comm->p2pIpcExportCount;
+  exp->base = base;
+  exp->size = size;
+  reg->ipcExport = exp;
+  reg->state |= IPC_REG_COMPLETE;
+  INFO(NCCL_REG, "rank %d exported buffer %p size %zu for p2p peers", comm->rank, (void*)base, size);
+  return ncclSuccess;
+fail:
+  INFO(NCCL_REG, "rank %d could not export buffer %p for p2p peers", comm->rank, (void*)reg->addr);
+  free(exp);
+  reg->state |= IPC_REG_NO_SUPPORT;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclP2pIpcExportBuffer(struct ncclComm* comm, void* buff, size_t size, struct ncclP2pIpcMsg* msg) {
+  struct ncclReg* reg;
+  memset(msg, 0, sizeof(*msg));
+  NCCLCHECK(ncclRegFind(comm, buff, size, &reg));
+  if (reg == NULL) return ncclSuccess;
+  if ((reg->state & (IPC_REG_COMPLETE|IPC_REG_NO_SUPPORT)) == 0) NCCLCHECK(p2pIpcExport(comm, reg));
+  if ((reg->state & IPC_REG_COMPLETE) == 0) return ncclSuccess;
+  struct ncclP2pIpcExport* exp = reg->ipcExport;
+  msg->id = exp->id;
+  msg->size = exp->size;
+  msg->offset = (uintptr_t)buff - exp->base;
+  memcpy(&msg->ipcDesc, &exp->ipcDesc, sizeof(ncclIpcDesc));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclP2pIpcImportBuffer(struct ncclComm* comm, int peer, struct ncclP2pIpcMsg* msg, void** ptr) {
+  struct ncclP2pIpcImport* imp;
+  *ptr = NULL;
+  if (msg->id == 0) return ncclSuccess;
+  for (imp = comm->p2pIpcImports; imp; imp = imp->next) {
+    if (imp->peer == peer && imp->id == msg->id) break;
+  }
+  if (imp == NULL) {
+    NCCLCHECK(ncclCalloc(&imp, 1));
+    imp->peer = peer;
+    imp->id = msg->id;
+    // Mappings are shared with other comms importing the same allocation
+    if (p2pImportGet(comm, comm->peerInfo+peer, msg->size, &msg->ipcDesc, &imp->import) != ncclSuccess) {
+      INFO(NCCL_REG, "rank %d could not map buffer of rank %d, sending through the FIFO", comm->rank, peer);
+      imp->import = NULL;
+    }
+    imp->next = comm->p2pIpcImports;
+    comm->p2pIpcImports = imp;
+  }
+  if (imp->import) *ptr = imp->import->base + msg->offset;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclP2pIpcDeregBuffer(struct ncclReg* reg) {
+  struct ncclP2pIpcExport* exp = reg->ipcExport;
+  if (exp == NULL) return ncclSuccess;
+#if CUDART_VERSION >= 11030
+  if (ncclCuMemEnable()) CUCHECK(cuMemRelease(exp->handle));
+#endif
+  free(exp);
+  reg->ipcExport = NULL;
+  reg->state &= ~IPC_REG_COMPLETE;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclP2pIpcCleanup(struct ncclComm* comm) {
+  struct ncclP2pIpcImport* imp = comm->p2pIpcImports;
+  while (imp) {
+    struct ncclP2pIpcImport* next = imp->next;
+    if (imp->import) NCCLCHECK(p2pImportRelease(imp->import));
+    free(imp);
+    imp = next;
+  }
+  comm->p2pIpcImports = NULL;
+  return ncclSuccess;
+}
@@ -6,10 +6,18 @@
 
 #include "comm.h"
 #include "shm.h"
+#include "p2p.h"
+#include "gdrwrap.h"
+
+int64_t ncclParamGdrCopySyncEnable();
 
 struct shmConnectInfo {
   char shmName[7];
   int shmSize;
+  // Set by the receiver when its SIMPLE buffer lives in GPU memory
+  int devIpc;
+  int rank;
+  ncclIpcDesc ipcDesc;
 };
 static_assert(sizeof(shmConnectInfo) <= CONNECT_SIZE, "SHM Connect info is too large");
 
@@ -22,6 +30,10 @@ struct shmSendResources {
   struct ncclSendMem* hostMem;
   struct ncclSendMem* devHostMem;
   ncclShmHandle_t hostHandle;
+  // Receiver SIMPLE buffer, imported from the peer
+  char* remDevFifo;
+  // Both GPUs load and store host memory over C2C, no CE copies
+  int c2c;
 };
 
 struct shmRecvResources {
@@ -33,6 +45,9 @@ struct shmRecvResources {
   struct ncclRecvMem* hostMem;
   struct ncclRecvMem* devHostMem;
   ncclShmHandle_t hostHandle;
+  // SIMPLE buffer in GPU memory, exported to the sender
+  char* devFifo;
+  int c2c;
 };
 
 #define SHM_SEND_SIDE 1
@@ -44,6 +59,13 @@ static int useMemcpySend = 0;
 static int useMemcpyRecv = 0;
 NCCL_PARAM(ShmLocality, "SHM_LOCALITY", SHM_RECV_SIDE); // 1 is sender-size, 2 is receiver-size
 static int shmLocality = 0;
+// The sender proxy copies SIMPLE data straight into the receiver's GPU buffer,
+// imported through cuMem handles, rather than staging it in /dev/shm.
+NCCL_PARAM(ShmDeviceIpc, "SHM_DEVICE_IPC", 0);
+static int useDeviceIpc = 0;
+// When both GPUs are attached to host memory over C2C, direct GPU accesses
+// are faster than proxy copies, so the CE and device IPC modes are skipped.
+NCCL_PARAM(ShmC2cDirect, "SHM_C2C_DIRECT", 1);
 static void initCeOperation();
 
 /* Determine two peers can communicate with SHM */
@@ -72,11 +94,23 @@ static ncclResult_t shmCanConnect(int* ret, struct ncclTopoSystem* topo, struct
 
 #define MAX_SHM_NAME_LEN 1024
 
+// Same answer on both sides of a connection, so neither needs to tell the other
+static ncclResult_t shmC2c(struct ncclComm* comm, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, int* c2c) {
+  *c2c = 0;
+  if (ncclParamShmC2cDirect() == 0) return ncclSuccess;
+  int myC2c, peerC2c;
+  NCCLCHECK(ncclTopoGpuC2c(comm->topo, myInfo->busId, &myC2c));
+  NCCLCHECK(ncclTopoGpuC2c(comm->topo, peerInfo->busId, &peerC2c));
+  *c2c = myC2c && peerC2c;
+  return ncclSuccess;
+}
+
 /* Create and return connect structures for this peer to connect to me */
 static ncclResult_t shmSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclConnect* connectInfo, struct ncclConnector* send, int channelId, int connIndex) {
   struct shmSendResources* resources;
   NCCLCHECK(ncclCalloc(&resources, 1));
   send->transportResources = resources;
+  NCCLCHECK(shmC2c(comm, myInfo, peerInfo, &resources->c2c));
 
   static_assert(sizeof(struct shmConnectInfo) <= sizeof(struct ncclConnect), "shm Connect Info is too big");
   struct shmConnectInfo* info = (struct shmConnectInfo*)connectInfo;
@@ -92,7 +126,8 @@ static ncclResult_t shmSendSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   TRACE(NCCL_SHM,"Opened shmName %s shmSize %d", shmPath, info->shmSize);
   memcpy(info->shmName, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof(info->shmName));
 
-  INFO(NCCL_INIT|NCCL_SHM,"Channel %02d : %d[%d] -> %d[%d] via SHM/%s/%s", channelId, myInfo->rank, myInfo->nvmlDev, peerInfo->rank, peerInfo->nvmlDev, useMemcpySend?"CE":"direct", useMemcpyRecv?"CE":"direct");
+  INFO(NCCL_INIT|NCCL_SHM,"Channel %02d : %d[%d] -> %d[%d] via SHM/%s/%s%s", channelId, myInfo->rank, myInfo->nvmlDev, peerInfo->rank, peerInfo->nvmlDev,
+      useMemcpySend && !resources->c2c?"CE":"direct", useMemcpyRecv && !resources->c2c?"CE":"direct", resources->c2c?"/C2C":"");
   return ncclSuccess;
 }
 
@@ -100,6 +135,7 @@ static ncclResult_t shmRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   struct shmRecvResources* resources;
   NCCLCHECK(ncclCalloc(&resources, 1));
   recv->transportResources = resources;
+  NCCLCHECK(shmC2c(comm, myInfo, peerInfo, &resources->c2c));
 
   static_assert(sizeof(struct shmConnectInfo) <= sizeof(struct ncclConnect), "shm Connect Info is too big");
   struct shmConnectInfo* info = (struct shmConnectInfo*)connectInfo;
@@ -115,6 +151,12 @@ static ncclResult_t shmRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   TRACE(NCCL_SHM,"Opened shmName %s shmSize %d", shmPath, info->shmSize);
   memcpy(info->shmName, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof(info->shmName));
 
+  info->devIpc = 0;
+  info->rank = myInfo->rank;
+  if (useDeviceIpc && !resources->c2c) {
+    NCCLCHECK(ncclP2pAllocateShareableBuffer(comm->buffSizes[NCCL_PROTO_SIMPLE], &info->ipcDesc, (void**)&resources->devFifo));
+    info->devIpc = 1;
+  }
   return ncclSuccess;
 }
 
@@ -129,6 +171,11 @@ struct shmProxyInfo {
   uint64_t step;
   cudaStream_t stream;
   cudaEvent_t events[NCCL_STEPS];
+
+  // GDRCopy support: recv tail in GPU memory, written by the proxy through its BAR1 mapping
+  uint64_t* gdcTail;
+  uint64_t* devTail;
+  void* gdrDesc;
 };
 
 /* Connect to this peer */
@@ -152,14 +199,23 @@ static ncclResult_t shmSendConnect(struct ncclComm* comm, struct ncclConnect* co
   send->conn.head = &resources->devHostMem->head;
   send->conn.stepSize = comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
 
-  if (useMemcpyRecv) {
+  if (info->devIpc) {
+    if (shmTransport.send.proxyProgress == NULL) {
+      WARN("SHM: peer %d uses NCCL_SHM_DEVICE_IPC, which must be set on all ranks", info->rank);
+      return ncclInvalidUsage;
+    }
+    NCCLCHECK(ncclP2pImportShareableBuffer(comm, comm->topParentRanks[info->rank], comm->buffSizes[NCCL_PROTO_SIMPLE], &info->ipcDesc, (void**)&resources->remDevFifo));
+    INFO(NCCL_INIT|NCCL_SHM, "SHM: copying SIMPLE data directly to the GPU buffer of rank %d", info->rank);
+  } else if (useMemcpyRecv && !resources->c2c) {
     send->conn.connFifo = resources->devRemHostMem->connFifo;
   }
-  if (useMemcpySend) {
+  int useProxy = (useMemcpySend && !resources->c2c) || info->devIpc;
+  if (useProxy) {
     int tpProxyRank;
     tpProxyRank = comm->topParentRanks[comm->rank];
     NCCLCHECK(ncclProxyConnect(comm, TRANSPORT_SHM, 1, tpProxyRank, &send->proxyConn));
-    struct shmProxyInfo proxyInfo = { NULL, NULL, send->conn.buffs[NCCL_PROTO_SIMPLE], resources->hostMem, resources->remHostMem };
+    char* fifo = info->devIpc ? resources->remDevFifo : send->conn.buffs[NCCL_PROTO_SIMPLE];
+    struct shmProxyInfo proxyInfo = { NULL, NULL, fifo, resources->hostMem, resources->remHostMem };
     NCCLCHECK(ncclProxyCallBlocking(comm, &send->proxyConn, ncclProxyMsgConnect, &proxyInfo, sizeof(struct shmProxyInfo), &proxyInfo, sizeof(struct shmProxyInfo)));
     send->conn.buffs[NCCL_PROTO_SIMPLE] = proxyInfo.devFifo;
     send->conn.tail = &proxyInfo.ceRecvMem->tail;
@@ -167,7 +223,7 @@ static ncclResult_t shmSendConnect(struct ncclComm* comm, struct ncclConnect* co
   }
 
   // We must assign the proxyConn's proxyProgress property for proper checking at enqueue-time
-  send->proxyConn.proxyProgress = shmTransport.send.proxyProgress;
+  send->proxyConn.proxyProgress = useProxy ? shmTransport.send.proxyProgress : NULL;
 
   return ncclSuccess;
 }
@@ -192,25 +248,28 @@ static ncclResult_t shmRecvConnect(struct ncclComm* comm, struct ncclConnect* co
   recv->conn.tail = &resources->devHostMem->tail;
   recv->conn.stepSize = comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS;
 
-  if (useMemcpyRecv) {
+  if (resources->devFifo) {
+    recv->conn.buffs[NCCL_PROTO_SIMPLE] = resources->devFifo;
+  } else if (useMemcpyRecv && !resources->c2c) {
     NCCLCHECK(ncclProxyConnect(comm, TRANSPORT_SHM, 0, comm->rank, &recv->proxyConn));
     struct shmProxyInfo proxyInfo = { NULL, NULL, recv->conn.buffs[NCCL_PROTO_SIMPLE], resources->remHostMem, resources->hostMem };
     NCCLCHECK(ncclProxyCallBlocking(comm, &recv->proxyConn, ncclProxyMsgConnect, &proxyInfo, sizeof(struct shmProxyInfo), &proxyInfo, sizeof(struct shmProxyInfo)));
     recv->conn.buffs[NCCL_PROTO_SIMPLE] = proxyInfo.devFifo;
-    recv->conn.tail = &proxyInfo.ceRecvMem->tail;
+    recv->conn.tail = proxyInfo.devTail ? proxyInfo.devTail : &proxyInfo.ceRecvMem->tail;
   }
 
   // We must assign the proxyConn's proxyProgress property for proper checking at enqueue-time
-  recv->proxyConn.proxyProgress = shmTransport.recv.proxyProgress;
+  recv->proxyConn.proxyProgress = resources->devFifo || resources->c2c ? NULL : shmTransport.recv.proxyProgress;
 
   return ncclSuccess;
 }
 
 static ncclResult_t shmSendFree(struct ncclConnector* send) {
-  struct shmRecvResources* resources = (struct shmRecvResources*)send->transportResources;
+  struct shmSendResources* resources = (struct shmSendResources*)send->transportResources;
   if (resources) {
     NCCLCHECK(ncclShmClose(resources->hostHandle));
     NCCLCHECK(ncclShmClose(resources->remHandle));
+    if (resources->remDevFifo) NCCLCHECK(ncclCudaFree(resources->remDevFifo));
     free(resources);
     send->transportResources = NULL;
   }
@@ -222,6 +281,7 @@ static ncclResult_t shmRecvFree(struct ncclConnector* recv) {
   if (resources) {
     NCCLCHECK(ncclShmClose(resources->hostHandle));
     NCCLCHECK(ncclShmClose(resources->remHandle));
+    if (resources->devFifo) NCCLCHECK(ncclCudaFree(resources->devFifo));
     free(resources);
     recv->transportResources = NULL;
   }
@@ -253,6 +313,10 @@ static ncclResult_t shmRecvProxyConnect(struct ncclProxyConnection* connection,
   memcpy(proxyInfo, reqBuff, reqSize);
   NCCLCHECK(ncclCudaCalloc(&proxyInfo->devFifo, proxyState->buffSizes[NCCL_PROTO_SIMPLE]));
   NCCLCHECK(ncclCudaHostCalloc(&proxyInfo->ceRecvMem, 1));
+  if (ncclGdrCopy && ncclParamGdrCopySyncEnable()) {
+    // Keep the GPU polling its own memory; proxy updates become posted writes
+    NCCLCHECK(ncclGdrCudaCalloc(&proxyInfo->gdcTail, &proxyInfo->devTail, 1, &proxyInfo->gdrDesc));
+  }
   CUDACHECK(cudaStreamCreateWithFlags(&proxyInfo->stream, cudaStreamNonBlocking));
   for (int i=0; i<NCCL_STEPS; i++) {
     CUDACHECK(cudaEventCreate(proxyInfo->events+i));
@@ -287,6 +351,7 @@ static ncclResult_t shmRecvProxyFree(struct ncclProxyConnection* connection, str
     CUDACHECK(cudaStreamDestroy(resources->stream));
     NCCLCHECK(ncclCudaFree(resources->devFifo));
     NCCLCHECK(ncclCudaHostFree(resources->ceRecvMem));
+    if (resources->gdrDesc) NCCLCHECK(ncclGdrCudaFree(resources->gdrDesc));
     for (int i=0; i<NCCL_STEPS; i++) {
       CUDACHECK(cudaEventDestroy(resources->events[i]));
     }
@@ -326,7 +391,8 @@ static ncclResult_t shmSendProxyProgress(struct ncclProxyState* proxyState, stru
         // Check GPU has sent everything
         if ((*recvTail > sub->base+sub->transmitted)) {
           int size = connFifo[buffSlot].size;
-          CUDACHECK(cudaMemcpyAsync(resources->shmFifo+buffSlot*stepSize, resources->devFifo+buffSlot*stepSize, size, cudaMemcpyDeviceToHost, resources->stream));
+          // shmFifo is either host memory or the peer's GPU buffer
+          CUDACHECK(cudaMemcpyAsync(resources->shmFifo+buffSlot*stepSize, resources->devFifo+buffSlot*stepSize, size, cudaMemcpyDefault, resources->stream));
           CUDACHECK(cudaEventRecord(resources->events[buffSlot], resources->stream));
           resources->recvMem->connFifo[buffSlot].size = size;
           __sync_synchronize(); // make sure connFifo[].size is visible
@@ -397,7 +463,12 @@ static ncclResult_t shmRecvProxyProgress(struct ncclProxyState* proxyState, stru
         if (res == cudaSuccess) {
           sub->done += args->sliceSteps;
           // Notify GPU
-          resources->ceRecvMem->tail = sub->base + sub->done;
+          if (resources->gdcTail) {
+            *resources->gdcTail = sub->base + sub->done;
+            wc_store_fence(); // Flush out WC write
+          } else {
+            resources->ceRecvMem->tail = sub->base + sub->done;
+          }
         }
         if (sub->done == sub->nsteps) {
           resources->step = sub->base + sub->nsteps;
@@ -424,7 +495,9 @@ static void initCeOperation() {
   if (!init) {
     useMemcpySend = ncclParamShmUseCudaMemcpy() && (ncclParamShmMemcpyMode() & 1);
     useMemcpyRecv = ncclParamShmUseCudaMemcpy() && (ncclParamShmMemcpyMode() & 2);
-    if (useMemcpySend) {
+    // Importing a handle from another process needs the cuMem API
+    useDeviceIpc = ncclParamShmDeviceIpc() && ncclCuMemEnable();
+    if (useMemcpySend || useDeviceIpc) {
       shmTransport.send.proxyConnect = shmSendProxyConnect;
       shmTransport.send.proxyFree = shmSendProxyFree;
       shmTransport.send.proxyProgress = shmSendProxyProgress;